@@ -34,6 +34,7 @@
 #include "eventer/eventer.h"
 #include "eventer/eventer_impl_private.h"
 #include "mtev_hash.h"
+#include "mtev_intmap.h"
 #include "mtev_stats.h"
 #include "mtev_memory.h"
 #include <sys/types.h>
@@ -117,7 +118,9 @@ free_callback_details(void *vcd) {
 }
 
 static mtev_hash_table __name_to_func;
-static mtev_hash_table __func_to_name;
+/* Looked up on every callback dispatch, so keyed by the function
+ * pointer directly and read without locks. */
+static mtev_ptrmap_t *__func_to_name;
 int eventer_name_callback(const char *name, eventer_func_t f) {
   eventer_name_callback_ext(name, f, NULL, NULL);
   return 0;
@@ -126,8 +129,7 @@ int eventer_name_callback_ext(const char *name,
                               eventer_func_t f,
                               void (*fn)(char *,int,eventer_t,void *),
                               void *cl) {
-  void **fptr = malloc(sizeof(*fptr));
-  *fptr = (void *)f;
+  void *old = NULL;
   mtev_hash_replace(&__name_to_func, strdup(name), strlen(name),
                     (void *)f, free, NULL);
   struct callback_details *cd;
@@ -137,8 +139,8 @@ int eventer_name_callback_ext(const char *name,
   cd->closure = cl;
   cd->latency = stats_register(mtev_stats_ns(eventer_stats_ns, "callbacks"),
                                cd->simple_name, STATS_TYPE_HISTOGRAM);
-  mtev_hash_replace(&__func_to_name, (char *)fptr, sizeof(*fptr), cd,
-                    free, free_callback_details);
+  mtev_ptrmap_set(__func_to_name, (void *)f, cd, &old);
+  mtev_memory_defer_free(old, free_callback_details);
   return 0;
 }
 eventer_func_t eventer_callback_for_name(const char *name) {
@@ -155,7 +157,7 @@ const char *eventer_name_for_callback(eventer_func_t f) {
 }
 stats_handle_t *eventer_latency_handle_for_callback(eventer_func_t f) {
   void *vcd;
-  if(mtev_hash_retrieve(&__func_to_name, (char *)&f, sizeof(f), &vcd)) {
+  if(mtev_ptrmap_get(__func_to_name, (void *)f, &vcd)) {
     struct callback_details *cd = vcd;
     return cd->latency;
   }
@@ -164,7 +166,7 @@ stats_handle_t *eventer_latency_handle_for_callback(eventer_func_t f) {
 const char *eventer_name_for_callback_e(eventer_func_t f, eventer_t e) {
   void *vcd;
   struct callback_details *cd;
-  if(mtev_hash_retrieve(&__func_to_name, (char *)&f, sizeof(f), &vcd)) {
+  if(mtev_ptrmap_get(__func_to_name, (void *)f, &vcd)) {
     cd = vcd;
     if(cd->functional_name && e) {
       char *buf;
@@ -198,14 +200,16 @@ int eventer_choose(const char *name) {
 
 void eventer_init_globals() {
   mtev_allocator_options_t opts = mtev_allocator_options_create();
+  mtev_allocator_options_name(opts, "eventer_t");
   mtev_allocator_options_fixed_size(opts, sizeof(struct _event));
   mtev_allocator_options_freelist_perthreadlimit(opts, 1000);
+  mtev_allocator_options_backend(opts, MTEV_ALLOCATOR_SLAB);
   eventer_t_allocator = mtev_allocator_create(opts);
   mtev_allocator_options_free(opts);
 
   eventer_stats_ns = mtev_stats_ns(mtev_stats_ns(NULL, "mtev"), "eventer");
   mtev_hash_init_locks(&__name_to_func, MTEV_HASH_DEFAULT_SIZE, MTEV_HASH_LOCK_MODE_MUTEX);
-  mtev_hash_init_locks(&__func_to_name, MTEV_HASH_DEFAULT_SIZE, MTEV_HASH_LOCK_MODE_MUTEX);
+  __func_to_name = mtev_ptrmap_create(MTEV_HASH_DEFAULT_SIZE);
   eventer_callback_latency =
     stats_register(mtev_stats_ns(eventer_stats_ns, "callbacks"),
                    "_aggregate", STATS_TYPE_HISTOGRAM_FAST);
@@ -214,6 +218,17 @@ void eventer_init_globals() {
                    "_unnamed", STATS_TYPE_HISTOGRAM_FAST);
   stats_rob_i64(eventer_stats_ns, "events_total", (void *)&ealloctotal);
   stats_rob_i64(eventer_stats_ns, "events_current", (void *)&ealloccnt);
+  {
+    const mtev_memory_gc_stats_t *gc = mtev_memory_gc_stats_live();
+    stats_ns_t *gc_ns = mtev_stats_ns(mtev_stats_ns(mtev_stats_ns(NULL, "mtev"), "memory"), "gc");
+    stats_rob_i64(gc_ns, "pending", (void *)&gc->pending);
+    stats_rob_i64(gc_ns, "peak", (void *)&gc->peak);
+    stats_rob_i64(gc_ns, "dispatched", (void *)&gc->dispatched);
+    stats_rob_i64(gc_ns, "handoffs", (void *)&gc->handoffs);
+    stats_rob_i64(gc_ns, "queued", (void *)&gc->queued);
+    stats_rob_i64(gc_ns, "backpressure", (void *)&gc->backpressure);
+    stats_rob_i64(gc_ns, "reclaimers", (void *)&gc->reclaimers);
+  }
   eventer_impl_init_globals();
   eventer_ssl_init_globals();
 }
@@ -35,6 +35,7 @@
 #include "eventer/eventer.h"
 #include "eventer/eventer_impl_private.h"
 #include "mtev_memory.h"
+#include "mtev_bufpool.h"
 #include "mtev_log.h"
 #include "mtev_skiplist.h"
 #include "mtev_thread.h"
@@ -353,6 +354,33 @@ int eventer_impl_propset(const char *key, const char *value) {
     }
     return 0;
   }
+  else if(!strcasecmp(key, "buffer_hugepages")) {
+    if(!strcasecmp(value, "none")) mtev_bufpool_pages_default(MTEV_BUFPOOL_PAGES_NORMAL);
+    else if(!strcasecmp(value, "transparent")) mtev_bufpool_pages_default(MTEV_BUFPOOL_PAGES_TRANSPARENT);
+    else if(!strcasecmp(value, "hugetlb")) mtev_bufpool_pages_default(MTEV_BUFPOOL_PAGES_HUGETLB);
+    else {
+      mtevL(mtev_error, "buffer_hugepages must be one of none, transparent, hugetlb\n");
+      return -1;
+    }
+    return 0;
+  }
+  else if(!strcasecmp(key, "memory_gc_threads")) {
+    mtev_memory_gc_threads(atoi(value));
+    return 0;
+  }
+  else if(!strcasecmp(key, "memory_gc_batch")) {
+    int requested = atoi(value);
+    if(requested < 0) {
+      mtevL(mtev_error, "memory_gc_batch must be >= 0\n");
+      return -1;
+    }
+    mtev_memory_gc_batch(requested);
+    return 0;
+  }
+  else if(!strcasecmp(key, "memory_gc_max_pending")) {
+    mtev_memory_gc_max_pending(strtoll(value, NULL, 10));
+    return 0;
+  }
   else if(!strcasecmp(key, "debugging")) {
     if(strcmp(value, "0")) {
       EVENTER_DEBUGGING = 1;
@@ -18,6 +18,9 @@
 #include <string.h>
 #include <stdint.h>
 #include <math.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "mtev_debug.h"
 #include "mtev_printbuf.h"
@@ -84,46 +87,67 @@ static void mtev_json_object_fini(void) {
 
 /* string escaping */
 
-static int mtev_json_escape_str(struct jl_printbuf *pb, char *str)
-{
-  int pos = 0, start_offset = 0;
-  unsigned char c;
-  do {
-    c = str[pos];
-    switch(c) {
-    case '\0':
-      break;
-    case '\b':
-    case '\n':
-    case '\r':
-    case '\t':
-    case '"':
-    case '\\':
-    case '/':
-      if(pos - start_offset > 0)
-	jl_printbuf_memappend(pb, str + start_offset, pos - start_offset);
-      if(c == '\b') jl_printbuf_memappend(pb, "\\b", 2);
-      else if(c == '\n') jl_printbuf_memappend(pb, "\\n", 2);
-      else if(c == '\r') jl_printbuf_memappend(pb, "\\r", 2);
-      else if(c == '\t') jl_printbuf_memappend(pb, "\\t", 2);
-      else if(c == '"') jl_printbuf_memappend(pb, "\\\"", 2);
-      else if(c == '\\') jl_printbuf_memappend(pb, "\\\\", 2);
-      else if(c == '/') jl_printbuf_memappend(pb, "\\/", 2);
-      start_offset = ++pos;
-      break;
-    default:
-      if(c < ' ') {
-	if(pos - start_offset > 0)
-	  jl_printbuf_memappend(pb, str + start_offset, pos - start_offset);
-	jl_sprintbuf(pb, "\\u00%c%c",
-		  mtev_json_hex_chars[c >> 4],
-		  mtev_json_hex_chars[c & 0xf]);
-	start_offset = ++pos;
-      } else pos++;
+/* Append a string literal; lengths are compile-time constants. */
+#define jl_printbuf_append_lit(pb, lit) \
+  jl_printbuf_memappend_fast(pb, lit, (int)sizeof(lit) - 1)
+
+/* Status of a serialization so far: only a failed streaming flush makes
+ * it unrecoverable. */
+#define jl_printbuf_status(pb) ((pb)->flush_failed ? -1 : 0)
+
+/* Second character of the two-character escape for c, 'u' for those
+ * written as \u00XX, or 0 if c is emitted as-is. */
+static const char mtev_json_escape_tbl[256] = {
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'u', 'r', 'u', 'u',
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+  [(unsigned char)'"'] = '"',
+  [(unsigned char)'/'] = '/',
+  [(unsigned char)'\\'] = '\\',
+};
+
+/* Index of the first character at or after pos that needs escaping. */
+static inline size_t mtev_json_escape_scan(const char *str, size_t pos,
+                                           size_t len)
+{
+#if defined(__SSE2__)
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i slash = _mm_set1_epi8('/');
+  const __m128i bslash = _mm_set1_epi8('\\');
+  const __m128i ctrl = _mm_set1_epi8(0x1f);
+  while(pos + 16 <= len) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(str + pos));
+    __m128i m = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, slash)),
+      _mm_or_si128(_mm_cmpeq_epi8(v, bslash),
+                   _mm_cmpeq_epi8(_mm_min_epu8(v, ctrl), v)));
+    int bits = _mm_movemask_epi8(m);
+    if(bits) return pos + __builtin_ctz(bits);
+    pos += 16;
+  }
+#endif
+  while(pos < len && !mtev_json_escape_tbl[(unsigned char)str[pos]]) pos++;
+  return pos;
+}
+
+static int mtev_json_escape_str(struct jl_printbuf *pb, const char *str)
+{
+  size_t len = strlen(str), pos = 0, start_offset = 0;
+  char esc[6] = { '\\', 'u', '0', '0' };
+  while((pos = mtev_json_escape_scan(str, pos, len)) < len) {
+    unsigned char c = (unsigned char)str[pos];
+    if(pos > start_offset)
+      jl_printbuf_memappend(pb, str + start_offset, (int)(pos - start_offset));
+    esc[1] = mtev_json_escape_tbl[c];
+    if(esc[1] == 'u') {
+      esc[4] = mtev_json_hex_chars[c >> 4];
+      esc[5] = mtev_json_hex_chars[c & 0xf];
+      jl_printbuf_memappend_fast(pb, esc, 6);
     }
-  } while(c);
-  if(pos - start_offset > 0)
-    jl_printbuf_memappend(pb, str + start_offset, pos - start_offset);
+    else jl_printbuf_memappend_fast(pb, esc, 2);
+    start_offset = ++pos;
+  }
+  if(len > start_offset)
+    jl_printbuf_memappend(pb, str + start_offset, (int)(len - start_offset));
   return 0;
 }
 
@@ -204,6 +228,18 @@ const char* mtev_json_object_to_json_string(struct mtev_json_object *jso)
   return jso->_pb->buf;
 }
 
+int mtev_json_object_to_json_stream(struct mtev_json_object *jso,
+                                    mtev_json_object_write_fn write,
+                                    void *closure)
+{
+  char window[16384];
+  struct jl_printbuf pb;
+  jl_printbuf_init_stream(&pb, window, sizeof(window), write, closure);
+  if(!jso) jl_printbuf_append_lit(&pb, "null");
+  else if(jso->_to_json_string(jso, &pb) < 0) return -1;
+  return jl_printbuf_flush(&pb);
+}
+
 
 /* mtev_json_object_object */
 
@@ -212,21 +248,22 @@ static int mtev_json_object_object_to_json_string(struct mtev_json_object* jso,
 {
   int i=0;
   struct mtev_json_object_iter iter;
-  jl_sprintbuf(pb, "{");
+  jl_printbuf_append_lit(pb, "{");
 
   /* CAW: scope operator to make ANSI correctness */
   /* CAW: switched to mtev_json_object_object_foreachC which uses an iterator struct */
 	mtev_json_object_object_foreachC(jso, iter) {
-			if(i) jl_sprintbuf(pb, ",");
-			jl_sprintbuf(pb, " \"");
+			if(i) jl_printbuf_append_lit(pb, ", \"");
+			else jl_printbuf_append_lit(pb, " \"");
 			mtev_json_escape_str(pb, iter.key);
-			jl_sprintbuf(pb, "\": ");
-			if(iter.val == NULL) jl_sprintbuf(pb, "null");
-			else iter.val->_to_json_string(iter.val, pb);
+			jl_printbuf_append_lit(pb, "\": ");
+			if(iter.val == NULL) jl_printbuf_append_lit(pb, "null");
+			else if(iter.val->_to_json_string(iter.val, pb) < 0) return -1;
 			i++;
 	}
 
-  return jl_sprintbuf(pb, " }");
+  jl_printbuf_append_lit(pb, " }");
+  return jl_printbuf_status(pb);
 }
 
 static void mtev_json_object_lh_entry_free(struct jl_lh_entry *ent)
@@ -286,8 +323,9 @@ void mtev_json_object_object_del(struct mtev_json_object* jso, const char *key)
 static int mtev_json_object_boolean_to_json_string(struct mtev_json_object* jso,
 					      struct jl_printbuf *pb)
 {
-  if(jso->o.c_boolean) return jl_sprintbuf(pb, "true");
-  else return jl_sprintbuf(pb, "false");
+  if(jso->o.c_boolean) jl_printbuf_append_lit(pb, "true");
+  else jl_printbuf_append_lit(pb, "false");
+  return jl_printbuf_status(pb);
 }
 
 struct mtev_json_object* mtev_json_object_new_boolean(boolean b)
@@ -323,10 +361,12 @@ static int mtev_json_object_int_to_json_string(struct mtev_json_object* jso,
 					  struct jl_printbuf *pb)
 {
   if(jso->o_ioverflow == mtev_json_overflow_uint64)
-    return jl_sprintbuf(pb, "%" PRIu64 "", jso->overflow.c_uint64);
+    jl_printbuf_append_uint64(pb, jso->overflow.c_uint64);
   else if(jso->o_ioverflow == mtev_json_overflow_int64)
-    return jl_sprintbuf(pb, "%" PRId64 "", jso->overflow.c_int64);
-  return jl_sprintbuf(pb, "%d", jso->o.c_int);
+    jl_printbuf_append_int64(pb, jso->overflow.c_int64);
+  else
+    jl_printbuf_append_int64(pb, jso->o.c_int);
+  return jl_printbuf_status(pb);
 }
 
 struct mtev_json_object* mtev_json_object_new_int(int i)
@@ -408,10 +448,11 @@ int mtev_json_object_get_int(struct mtev_json_object *jso)
 static int mtev_json_object_double_to_json_string(struct mtev_json_object* jso,
 					     struct jl_printbuf *pb)
 {
-  if(isnan(jso->o.c_double) || isinf(jso->o.c_double)) {
-    return jl_sprintbuf(pb, "null");
-  }
-  return jl_sprintbuf(pb, "%lf", jso->o.c_double);
+  if(isnan(jso->o.c_double) || isinf(jso->o.c_double))
+    jl_printbuf_append_lit(pb, "null");
+  else
+    jl_printbuf_append_double(pb, jso->o.c_double);
+  return jl_printbuf_status(pb);
 }
 
 struct mtev_json_object* mtev_json_object_new_double(double d)
@@ -448,10 +489,10 @@ double mtev_json_object_get_double(struct mtev_json_object *jso)
 static int mtev_json_object_string_to_json_string(struct mtev_json_object* jso,
 					     struct jl_printbuf *pb)
 {
-  jl_sprintbuf(pb, "\"");
+  jl_printbuf_append_lit(pb, "\"");
   mtev_json_escape_str(pb, jso->o.c_string);
-  jl_sprintbuf(pb, "\"");
-  return 0;
+  jl_printbuf_append_lit(pb, "\"");
+  return jl_printbuf_status(pb);
 }
 
 static void mtev_json_object_string_delete(struct mtev_json_object* jso)
@@ -498,17 +539,18 @@ static int mtev_json_object_array_to_json_string(struct mtev_json_object* jso,
 					    struct jl_printbuf *pb)
 {
   int i;
-  jl_sprintbuf(pb, "[");
+  jl_printbuf_append_lit(pb, "[");
   for(i=0; i < mtev_json_object_array_length(jso); i++) {
 	  struct mtev_json_object *val;
-	  if(i) { jl_sprintbuf(pb, ", "); }
-	  else { jl_sprintbuf(pb, " "); }
+	  if(i) { jl_printbuf_append_lit(pb, ", "); }
+	  else { jl_printbuf_append_lit(pb, " "); }
 
       val = mtev_json_object_array_get_idx(jso, i);
-	  if(val == NULL) { jl_sprintbuf(pb, "null"); }
-	  else { val->_to_json_string(val, pb); }
+	  if(val == NULL) { jl_printbuf_append_lit(pb, "null"); }
+	  else if(val->_to_json_string(val, pb) < 0) { return -1; }
   }
-  return jl_sprintbuf(pb, " ]");
+  jl_printbuf_append_lit(pb, " ]");
+  return jl_printbuf_status(pb);
 }
 
 static void mtev_json_object_array_entry_free(void *data)
@@ -103,6 +103,21 @@ extern enum mtev_json_type mtev_json_object_get_type(struct mtev_json_object *ob
  */
 extern const char* mtev_json_object_to_json_string(struct mtev_json_object *obj);
 
+/** Receives successive chunks of a streamed serialization
+ * @returns < 0 to abort the serialization
+ */
+typedef int (*mtev_json_object_write_fn)(void *closure, const char *buf, int len);
+
+/** Stringify object to json format without building the whole string
+ * @param obj the mtev_json_object instance
+ * @param write called with each chunk of output, in order
+ * @param closure passed through to write
+ * @returns 0 on success, -1 if write failed
+ */
+extern int mtev_json_object_to_json_stream(struct mtev_json_object *obj,
+                                           mtev_json_object_write_fn write,
+                                           void *closure);
+
 
 /* object type methods */
 
@@ -345,6 +360,7 @@ extern const char* mtev_json_object_get_string(struct mtev_json_object *obj);
 #define json_object_is_type mtev_json_object_is_type
 #define json_object_get_type mtev_json_object_get_type
 #define json_object_to_json_string mtev_json_object_to_json_string
+#define json_object_to_json_stream mtev_json_object_to_json_stream
 #define json_object_new_object mtev_json_object_new_object
 #define json_object_get_object mtev_json_object_get_object
 #define json_object_object_add mtev_json_object_object_add
@@ -0,0 +1,1047 @@
+/*
+ * Copyright (c) 2017, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name Circonus, Inc. nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "mtev_defines.h"
+#include "mtev_json_ondemand.h"
+#include "mtev_cpuid.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define JSON_OD_X86 1
+#endif
+
+/* A document is its text plus the offsets of every structural character:
+ * brackets, braces, colons, commas, both quotes of each string and the
+ * first character of each literal or number.  For entries that begin a
+ * value, next[] holds the entry just past that value, so any value can be
+ * skipped in constant time.
+ */
+struct mtev_json_doc {
+  const char *buf;
+  size_t len;
+  uint32_t *idx;
+  uint32_t *next;
+  uint32_t n;
+  mtev_arena_t *arena;
+  char *copy;
+};
+
+#define JC_BS    0x1
+#define JC_QUOTE 0x2
+#define JC_WS    0x4
+#define JC_OP    0x8
+
+static const uint8_t json_class[256] = {
+  ['\\'] = JC_BS, ['"'] = JC_QUOTE,
+  [' '] = JC_WS, ['\t'] = JC_WS, ['\n'] = JC_WS, ['\r'] = JC_WS,
+  ['{'] = JC_OP, ['}'] = JC_OP, ['['] = JC_OP, [']'] = JC_OP,
+  [':'] = JC_OP, [','] = JC_OP,
+};
+
+/* stage 1: classify 64 bytes at a time into bitmasks */
+
+typedef struct {
+  uint64_t bs, quote, ws, op;
+} json_masks_t;
+
+typedef void (*json_classify_fn)(const uint8_t *, json_masks_t *);
+
+static inline void
+json_classify_scalar(const uint8_t *p, json_masks_t *m) {
+  uint64_t bs = 0, quote = 0, ws = 0, op = 0;
+  int i;
+  for(i = 0; i < 64; i++) {
+    uint64_t c = json_class[p[i]];
+    bs |= (c & 1) << i;
+    quote |= ((c >> 1) & 1) << i;
+    ws |= ((c >> 2) & 1) << i;
+    op |= ((c >> 3) & 1) << i;
+  }
+  m->bs = bs;
+  m->quote = quote;
+  m->ws = ws;
+  m->op = op;
+}
+
+#if defined(JSON_OD_X86)
+/* '[' and ']' differ from '{' and '}' only in bit 0x20 */
+static inline void
+json_classify_sse2(const uint8_t *p, json_masks_t *m) {
+  const __m128i bs = _mm_set1_epi8('\\'), quote = _mm_set1_epi8('"');
+  const __m128i sp = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t');
+  const __m128i nl = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r');
+  const __m128i lb = _mm_set1_epi8('{'), rb = _mm_set1_epi8('}');
+  const __m128i colon = _mm_set1_epi8(':'), comma = _mm_set1_epi8(',');
+  const __m128i x20 = _mm_set1_epi8(0x20);
+  int i;
+  m->bs = m->quote = m->ws = m->op = 0;
+  for(i = 0; i < 4; i++) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+    __m128i lower = _mm_or_si128(v, x20);
+    __m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, tab)),
+                              _mm_or_si128(_mm_cmpeq_epi8(v, nl), _mm_cmpeq_epi8(v, cr)));
+    __m128i op = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(lower, lb), _mm_cmpeq_epi8(lower, rb)),
+                              _mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma)));
+    m->bs |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, bs)) << (16 * i);
+    m->quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)) << (16 * i);
+    m->ws |= (uint64_t)(uint16_t)_mm_movemask_epi8(ws) << (16 * i);
+    m->op |= (uint64_t)(uint16_t)_mm_movemask_epi8(op) << (16 * i);
+  }
+}
+
+__attribute__((target("avx2")))
+static inline void
+json_classify_avx2(const uint8_t *p, json_masks_t *m) {
+  const __m256i bs = _mm256_set1_epi8('\\'), quote = _mm256_set1_epi8('"');
+  const __m256i sp = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t');
+  const __m256i nl = _mm256_set1_epi8('\n'), cr = _mm256_set1_epi8('\r');
+  const __m256i lb = _mm256_set1_epi8('{'), rb = _mm256_set1_epi8('}');
+  const __m256i colon = _mm256_set1_epi8(':'), comma = _mm256_set1_epi8(',');
+  const __m256i x20 = _mm256_set1_epi8(0x20);
+  int i;
+  m->bs = m->quote = m->ws = m->op = 0;
+  for(i = 0; i < 2; i++) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(p + 32 * i));
+    __m256i lower = _mm256_or_si256(v, x20);
+    __m256i ws = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(v, tab)),
+                                 _mm256_or_si256(_mm256_cmpeq_epi8(v, nl), _mm256_cmpeq_epi8(v, cr)));
+    __m256i op = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(lower, lb), _mm256_cmpeq_epi8(lower, rb)),
+                                 _mm256_or_si256(_mm256_cmpeq_epi8(v, colon), _mm256_cmpeq_epi8(v, comma)));
+    m->bs |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, bs)) << (32 * i);
+    m->quote |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote)) << (32 * i);
+    m->ws |= (uint64_t)(uint32_t)_mm256_movemask_epi8(ws) << (32 * i);
+    m->op |= (uint64_t)(uint32_t)_mm256_movemask_epi8(op) << (32 * i);
+  }
+}
+#endif
+
+/* Characters escaped by a backslash: those ending an odd-length run of
+ * backslashes.  Runs starting on odd bits are collapsed by an addition
+ * that carries them to their end; comparing each run end against the
+ * parity of its start picks out the odd-length ones.  *carry is set when
+ * the block ends in an unfinished escape.
+ */
+static inline uint64_t
+json_escaped(uint64_t bs, uint64_t *carry) {
+  const uint64_t even = UINT64_C(0x5555555555555555);
+  uint64_t follows, odd_starts, seq;
+  if(!bs && !*carry) return 0;
+  bs &= ~*carry;
+  follows = (bs << 1) | *carry;
+  odd_starts = bs & ~even & ~follows;
+  *carry = __builtin_add_overflow(odd_starts, bs, &seq);
+  return (even ^ (seq << 1)) & follows;
+}
+
+/* Bit i set iff an odd number of bits at or below i are set. */
+static inline uint64_t
+json_prefix_xor(uint64_t x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+static inline __attribute__((always_inline)) int
+json_stage1(const uint8_t *buf, size_t len, uint32_t *out, uint32_t *nout,
+            json_classify_fn classify) {
+  uint64_t prev_escaped = 0, prev_in_string = 0, prev_scalar = 0;
+  uint8_t tail[64];
+  uint32_t n = 0;
+  size_t off;
+
+  for(off = 0; off < len; off += 64) {
+    const uint8_t *p = buf + off;
+    uint64_t escaped, quote, in_string, scalar, structural;
+    json_masks_t m;
+    if(len - off < 64) {
+      memset(tail, ' ', sizeof(tail));
+      memcpy(tail, p, len - off);
+      p = tail;
+    }
+    classify(p, &m);
+    escaped = json_escaped(m.bs, &prev_escaped);
+    quote = m.quote & ~escaped;
+    /* in_string covers each opening quote and the contents after it */
+    in_string = json_prefix_xor(quote) ^ prev_in_string;
+    prev_in_string = (uint64_t)((int64_t)in_string >> 63);
+    scalar = ~(m.op | m.ws | quote | in_string);
+    structural = (m.op & ~in_string) | quote |
+                 (scalar & ~((scalar << 1) | prev_scalar));
+    prev_scalar = scalar >> 63;
+    while(structural) {
+      out[n++] = (uint32_t)(off + __builtin_ctzll(structural));
+      structural &= structural - 1;
+    }
+  }
+  *nout = n;
+  return prev_in_string ? -1 : 0;
+}
+
+#if !defined(JSON_OD_X86)
+static int
+json_stage1_scalar(const uint8_t *buf, size_t len, uint32_t *out, uint32_t *nout) {
+  return json_stage1(buf, len, out, nout, json_classify_scalar);
+}
+#else
+static int
+json_stage1_sse2(const uint8_t *buf, size_t len, uint32_t *out, uint32_t *nout) {
+  return json_stage1(buf, len, out, nout, json_classify_sse2);
+}
+
+__attribute__((target("avx2")))
+static int
+json_stage1_avx2(const uint8_t *buf, size_t len, uint32_t *out, uint32_t *nout) {
+  return json_stage1(buf, len, out, nout, json_classify_avx2);
+}
+#endif
+
+typedef int (*json_stage1_fn)(const uint8_t *, size_t, uint32_t *, uint32_t *);
+
+static json_stage1_fn
+json_stage1_impl(void) {
+  static volatile json_stage1_fn impl = NULL;
+  if(impl == NULL) {
+#if defined(JSON_OD_X86)
+    impl = mtev_cpuid_feature(MTEV_CPU_FEATURE_AVX2) ? json_stage1_avx2 : json_stage1_sse2;
+#else
+    impl = json_stage1_scalar;
+#endif
+  }
+  return impl;
+}
+
+/* scalars */
+
+static inline mtev_boolean
+json_is_boundary(const char *p, const char *end) {
+  return p == end || (json_class[(uint8_t)*p] & (JC_WS | JC_OP | JC_QUOTE));
+}
+
+/* Length of the number at p per the JSON grammar, or 0. */
+static size_t
+json_number_len(const char *p, const char *end) {
+  const char *s = p;
+  if(p < end && *p == '-') p++;
+  if(p == end) return 0;
+  if(*p == '0') p++;
+  else if(*p >= '1' && *p <= '9') {
+    while(p < end && *p >= '0' && *p <= '9') p++;
+  }
+  else return 0;
+  if(p < end && *p == '.') {
+    const char *f = ++p;
+    while(p < end && *p >= '0' && *p <= '9') p++;
+    if(p == f) return 0;
+  }
+  if(p < end && (*p == 'e' || *p == 'E')) {
+    const char *e;
+    p++;
+    if(p < end && (*p == '+' || *p == '-')) p++;
+    e = p;
+    while(p < end && *p >= '0' && *p <= '9') p++;
+    if(p == e) return 0;
+  }
+  return json_is_boundary(p, end) ? (size_t)(p - s) : 0;
+}
+
+static size_t
+json_scalar_len(const char *p, const char *end) {
+  size_t avail = end - p;
+  switch(*p) {
+  case 't':
+    if(avail >= 4 && !memcmp(p, "true", 4) && json_is_boundary(p + 4, end)) return 4;
+    return 0;
+  case 'f':
+    if(avail >= 5 && !memcmp(p, "false", 5) && json_is_boundary(p + 5, end)) return 5;
+    return 0;
+  case 'n':
+    if(avail >= 4 && !memcmp(p, "null", 4) && json_is_boundary(p + 4, end)) return 4;
+    return 0;
+  default:
+    return json_number_len(p, end);
+  }
+}
+
+/* stage 2: validate the grammar over the structural index */
+
+#define JSON_FAIL(msg, off) do { \
+  if(err) *err = (msg); \
+  if(erroff) *erroff = (off); \
+  return -1; \
+} while(0)
+
+static inline int
+json_hex4(const char *p) {
+  int i, cp = 0;
+  for(i = 0; i < 4; i++) {
+    char c = p[i];
+    cp <<= 4;
+    if(c >= '0' && c <= '9') cp |= c - '0';
+    else if(c >= 'a' && c <= 'f') cp |= c - 'a' + 10;
+    else if(c >= 'A' && c <= 'F') cp |= c - 'A' + 10;
+    else return -1;
+  }
+  return cp;
+}
+
+/* Check the contents of the string whose opening quote is at off without
+ * unescaping it; returns the offset of the first bad byte or -1. */
+static ssize_t
+json_string_check(const char *buf, uint32_t off, uint32_t close) {
+  const char *p = buf + off + 1, *end = buf + close;
+  while(p < end) {
+    if((uint8_t)*p < 0x20) return p - buf;
+    if(*p++ != '\\') continue;
+    switch(*p++) {
+    case '"': case '\\': case '/': case 'b':
+    case 'f': case 'n': case 'r': case 't':
+      continue;
+    case 'u':
+      if(end - p < 4 || json_hex4(p) < 0) return p - 2 - buf;
+      p += 4;
+      continue;
+    default:
+      return p - 2 - buf;
+    }
+  }
+  return -1;
+}
+
+static int
+json_stage2(mtev_json_doc_t *doc, mtev_boolean strings,
+            const char **err, size_t *erroff) {
+  enum { S_VALUE, S_FIRST_MEMBER, S_MEMBER, S_COLON, S_FIRST_ELEMENT,
+         S_AFTER_VALUE, S_DONE } state = S_VALUE;
+  const char *buf = doc->buf, *end = doc->buf + doc->len;
+  const uint32_t *idx = doc->idx;
+  uint32_t *next = doc->next;
+  uint32_t stack[MTEV_JSON_DOC_MAX_DEPTH];
+  uint32_t i, open;
+  ssize_t bad;
+  int depth = 0;
+  char c;
+
+  for(i = 0; i < doc->n; i++) {
+    c = buf[idx[i]];
+    switch(state) {
+    case S_FIRST_MEMBER:
+      if(c == '}') goto close;
+      /* fallthrough */
+    case S_MEMBER:
+      if(c != '"') JSON_FAIL("expected a member name", idx[i]);
+      if(strings && (bad = json_string_check(buf, idx[i], idx[i+1])) >= 0)
+        JSON_FAIL("invalid string", bad);
+      i++; /* the closing quote is always indexed */
+      state = S_COLON;
+      continue;
+    case S_COLON:
+      if(c != ':') JSON_FAIL("expected ':'", idx[i]);
+      state = S_VALUE;
+      continue;
+    case S_AFTER_VALUE:
+      if(c == ',') {
+        state = (buf[idx[stack[depth - 1]]] == '{') ? S_MEMBER : S_VALUE;
+        continue;
+      }
+      if(c == '}' || c == ']') goto close;
+      JSON_FAIL("expected ',' or a closing bracket", idx[i]);
+    case S_DONE:
+      JSON_FAIL("unexpected data after the document", idx[i]);
+    case S_FIRST_ELEMENT:
+      if(c == ']') goto close;
+      /* fallthrough */
+    case S_VALUE:
+      switch(c) {
+      case '{':
+      case '[':
+        if(depth == MTEV_JSON_DOC_MAX_DEPTH) JSON_FAIL("nesting too deep", idx[i]);
+        stack[depth++] = i;
+        state = (c == '{') ? S_FIRST_MEMBER : S_FIRST_ELEMENT;
+        continue;
+      case '"':
+        if(strings && (bad = json_string_check(buf, idx[i], idx[i+1])) >= 0)
+          JSON_FAIL("invalid string", bad);
+        next[i] = i + 2;
+        i++;
+        break;
+      case '}':
+      case ']':
+      case ':':
+      case ',':
+        JSON_FAIL("expected a value", idx[i]);
+      default:
+        if(!json_scalar_len(buf + idx[i], end))
+          JSON_FAIL("invalid literal or number", idx[i]);
+        next[i] = i + 1;
+        break;
+      }
+      state = depth ? S_AFTER_VALUE : S_DONE;
+      continue;
+    }
+  close:
+    open = stack[--depth];
+    if((buf[idx[open]] == '{') != (c == '}')) JSON_FAIL("mismatched bracket", idx[i]);
+    next[open] = i + 1;
+    state = depth ? S_AFTER_VALUE : S_DONE;
+  }
+  if(state != S_DONE) JSON_FAIL("unexpected end of document", doc->len);
+  return 0;
+}
+
+mtev_json_doc_t *
+mtev_json_doc_parse(const char *buf, size_t len, int flags,
+                    const char **err, size_t *erroff) {
+  mtev_json_doc_t *doc;
+  const char *e = NULL;
+  size_t eoff = 0;
+
+  if(len >= UINT32_MAX) {
+    e = "document too large";
+    goto fail;
+  }
+  doc = calloc(1, sizeof(*doc));
+  doc->len = len;
+  doc->buf = buf;
+  if(flags & MTEV_JSON_DOC_COPY) {
+    doc->copy = malloc(len ? len : 1);
+    memcpy(doc->copy, buf, len);
+    doc->buf = doc->copy;
+  }
+  /* every structural is a distinct byte; one more for the sentinel */
+  doc->idx = malloc((len + 1) * sizeof(*doc->idx));
+  doc->next = malloc((len + 1) * sizeof(*doc->next));
+  if(json_stage1_impl()((const uint8_t *)doc->buf, len, doc->idx, &doc->n) < 0) {
+    e = "unterminated string";
+    eoff = len;
+  }
+  else if(doc->n == 0) {
+    e = "empty document";
+  }
+  else {
+    doc->idx[doc->n] = (uint32_t)len;
+    doc->next[doc->n] = doc->n;
+    if(json_stage2(doc, (flags & MTEV_JSON_DOC_VALIDATE) != 0, &e, &eoff) == 0)
+      return doc;
+  }
+  mtev_json_doc_free(doc);
+ fail:
+  if(err) *err = e;
+  if(erroff) *erroff = eoff;
+  return NULL;
+}
+
+void
+mtev_json_doc_free(mtev_json_doc_t *doc) {
+  if(!doc) return;
+  if(doc->arena) mtev_arena_destroy(doc->arena);
+  free(doc->idx);
+  free(doc->next);
+  free(doc->copy);
+  free(doc);
+}
+
+mtev_arena_t *
+mtev_json_doc_arena(mtev_json_doc_t *doc) {
+  if(!doc->arena) doc->arena = mtev_arena_create(0);
+  return doc->arena;
+}
+
+mtev_json_value_t
+mtev_json_doc_root(mtev_json_doc_t *doc) {
+  mtev_json_value_t v = { doc, 0 };
+  return v;
+}
+
+static const mtev_json_value_t json_missing = { NULL, 0 };
+
+#define VCHAR(v) ((v).doc->buf[(v).doc->idx[(v).pos]])
+
+mtev_boolean
+mtev_json_value_exists(mtev_json_value_t v) {
+  return v.doc != NULL;
+}
+
+/* Extent of a scalar token; validated in stage 2. */
+static inline size_t
+json_token_len(mtev_json_value_t v) {
+  const char *p = v.doc->buf + v.doc->idx[v.pos], *end = v.doc->buf + v.doc->len;
+  const char *s = p;
+  while(p < end && !(json_class[(uint8_t)*p] & (JC_WS | JC_OP | JC_QUOTE))) p++;
+  return p - s;
+}
+
+enum mtev_json_type
+mtev_json_value_type(mtev_json_value_t v) {
+  const char *p;
+  size_t i, len;
+  if(!v.doc) return mtev_json_type_null;
+  switch(VCHAR(v)) {
+  case '{': return mtev_json_type_object;
+  case '[': return mtev_json_type_array;
+  case '"': return mtev_json_type_string;
+  case 't':
+  case 'f': return mtev_json_type_boolean;
+  case 'n': return mtev_json_type_null;
+  default: break;
+  }
+  p = v.doc->buf + v.doc->idx[v.pos];
+  len = json_token_len(v);
+  for(i = 0; i < len; i++) {
+    if(p[i] == '.' || p[i] == 'e' || p[i] == 'E') return mtev_json_type_double;
+  }
+  return mtev_json_type_int;
+}
+
+/* navigation */
+
+mtev_json_iter_t
+mtev_json_value_iter(mtev_json_value_t v) {
+  mtev_json_iter_t it = { NULL, 0, mtev_false };
+  if(v.doc && (VCHAR(v) == '{' || VCHAR(v) == '[')) {
+    it.doc = v.doc;
+    it.pos = v.pos + 1;
+    it.object = (VCHAR(v) == '{');
+  }
+  return it;
+}
+
+mtev_boolean
+mtev_json_iter_next(mtev_json_iter_t *it, mtev_json_value_t *key,
+                    mtev_json_value_t *val) {
+  const mtev_json_doc_t *doc = it->doc;
+  uint32_t vpos, after;
+  char c;
+  if(!doc) return mtev_false;
+  c = doc->buf[doc->idx[it->pos]];
+  if(c == '}' || c == ']') {
+    it->doc = NULL;
+    return mtev_false;
+  }
+  if(it->object) {
+    if(key) { key->doc = it->doc; key->pos = it->pos; }
+    vpos = it->pos + 3; /* "key" : value */
+  }
+  else {
+    if(key) *key = json_missing;
+    vpos = it->pos;
+  }
+  val->doc = it->doc;
+  val->pos = vpos;
+  after = doc->next[vpos];
+  it->pos = (doc->buf[doc->idx[after]] == ',') ? after + 1 : after;
+  return mtev_true;
+}
+
+size_t
+mtev_json_value_length(mtev_json_value_t v) {
+  mtev_json_iter_t it = mtev_json_value_iter(v);
+  mtev_json_value_t val;
+  size_t cnt = 0;
+  while(mtev_json_iter_next(&it, NULL, &val)) cnt++;
+  return cnt;
+}
+
+static mtev_json_value_t
+json_value_get_n(mtev_json_value_t obj, const char *key, size_t keylen) {
+  mtev_json_value_t found = json_missing, k, val;
+  mtev_json_iter_t it;
+  if(!obj.doc || VCHAR(obj) != '{') return json_missing;
+  it = mtev_json_value_iter(obj);
+  while(mtev_json_iter_next(&it, &k, &val)) {
+    if(mtev_json_value_string_eq(k, key, keylen)) found = val;
+  }
+  return found;
+}
+
+mtev_json_value_t
+mtev_json_value_get(mtev_json_value_t obj, const char *key) {
+  return json_value_get_n(obj, key, strlen(key));
+}
+
+mtev_json_value_t
+mtev_json_value_index(mtev_json_value_t arr, size_t i) {
+  mtev_json_iter_t it;
+  mtev_json_value_t val;
+  if(!arr.doc || VCHAR(arr) != '[') return json_missing;
+  it = mtev_json_value_iter(arr);
+  while(mtev_json_iter_next(&it, NULL, &val)) {
+    if(i-- == 0) return val;
+  }
+  return json_missing;
+}
+
+mtev_json_value_t
+mtev_json_value_path(mtev_json_value_t v, const char *path) {
+  while(*path && v.doc) {
+    if(*path == '.') {
+      path++;
+    }
+    else if(*path == '[') {
+      char *endp;
+      unsigned long i = strtoul(path + 1, &endp, 10);
+      if(endp == path + 1 || *endp != ']') return json_missing;
+      v = mtev_json_value_index(v, i);
+      path = endp + 1;
+    }
+    else {
+      size_t seg = strcspn(path, ".[");
+      v = json_value_get_n(v, path, seg);
+      path += seg;
+    }
+  }
+  return v;
+}
+
+/* scalar access */
+
+mtev_boolean
+mtev_json_value_boolean(mtev_json_value_t v, mtev_boolean *out) {
+  if(!v.doc) return mtev_false;
+  if(VCHAR(v) == 't') *out = mtev_true;
+  else if(VCHAR(v) == 'f') *out = mtev_false;
+  else return mtev_false;
+  return mtev_true;
+}
+
+/* Parse an integer token into sign and magnitude. */
+static mtev_boolean
+json_integer(mtev_json_value_t v, mtev_boolean *neg, uint64_t *mag) {
+  const char *p, *end;
+  uint64_t m = 0;
+  if(!v.doc || mtev_json_value_type(v) != mtev_json_type_int) return mtev_false;
+  p = v.doc->buf + v.doc->idx[v.pos];
+  end = p + json_token_len(v);
+  *neg = (*p == '-');
+  if(*neg) p++;
+  for(; p < end; p++) {
+    unsigned d = *p - '0';
+    if(m > (UINT64_MAX - d) / 10) return mtev_false;
+    m = m * 10 + d;
+  }
+  *mag = m;
+  return mtev_true;
+}
+
+mtev_boolean
+mtev_json_value_int64(mtev_json_value_t v, int64_t *out) {
+  mtev_boolean neg;
+  uint64_t mag;
+  if(!json_integer(v, &neg, &mag)) return mtev_false;
+  if(neg) {
+    if(mag > (uint64_t)INT64_MAX + 1) return mtev_false;
+    *out = (int64_t)(0 - mag);
+  }
+  else {
+    if(mag > (uint64_t)INT64_MAX) return mtev_false;
+    *out = (int64_t)mag;
+  }
+  return mtev_true;
+}
+
+mtev_boolean
+mtev_json_value_uint64(mtev_json_value_t v, uint64_t *out) {
+  mtev_boolean neg;
+  uint64_t mag;
+  if(!json_integer(v, &neg, &mag)) return mtev_false;
+  if(neg && mag) return mtev_false;
+  *out = mag;
+  return mtev_true;
+}
+
+/* Exact powers of ten for the fast path of double parsing. */
+static const double json_pow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+mtev_boolean
+mtev_json_value_double(mtev_json_value_t v, double *out) {
+  const char *s, *p, *end;
+  uint64_t mant = 0;
+  int sig = 0, exp10 = 0, dropped = 0, neg = 0;
+  size_t len;
+  char tmp[64], *copy;
+
+  if(!v.doc) return mtev_false;
+  switch(mtev_json_value_type(v)) {
+  case mtev_json_type_int:
+  case mtev_json_type_double:
+    break;
+  default:
+    return mtev_false;
+  }
+  s = p = v.doc->buf + v.doc->idx[v.pos];
+  len = json_token_len(v);
+  end = p + len;
+
+  /* When the digits fit in 53 bits and the power of ten is exact, one
+   * multiplication or division rounds correctly (Clinger's fast path). */
+  if(*p == '-') { neg = 1; p++; }
+  for(; p < end && *p >= '0' && *p <= '9'; p++) {
+    if(sig < 19) { mant = mant * 10 + (*p - '0'); if(mant) sig++; }
+    else { exp10++; dropped |= (*p != '0'); }
+  }
+  if(p < end && *p == '.') {
+    for(p++; p < end && *p >= '0' && *p <= '9'; p++) {
+      if(sig < 19) { mant = mant * 10 + (*p - '0'); if(mant) sig++; exp10--; }
+      else dropped |= (*p != '0');
+    }
+  }
+  if(p < end) {
+    int esign = 1, e = 0;
+    p++;
+    if(*p == '+' || *p == '-') { if(*p == '-') esign = -1; p++; }
+    for(; p < end; p++) if(e < 100000) e = e * 10 + (*p - '0');
+    exp10 += esign * e;
+  }
+  if(!dropped && mant <= (UINT64_C(1) << 53) && exp10 >= -22 && exp10 <= 22) {
+    double d = (double)mant;
+    d = (exp10 < 0) ? d / json_pow10[-exp10] : d * json_pow10[exp10];
+    *out = neg ? -d : d;
+    return mtev_true;
+  }
+
+  copy = (len < sizeof(tmp)) ? tmp : malloc(len + 1);
+  memcpy(copy, s, len);
+  copy[len] = '\0';
+  *out = strtod(copy, NULL);
+  if(copy != tmp) free(copy);
+  return mtev_true;
+}
+
+/* strings */
+
+const char *
+mtev_json_value_raw(mtev_json_value_t v, size_t *len) {
+  const mtev_json_doc_t *doc = v.doc;
+  uint32_t start;
+  if(!doc) {
+    *len = 0;
+    return NULL;
+  }
+  start = doc->idx[v.pos];
+  switch(doc->buf[start]) {
+  case '"':
+    *len = doc->idx[v.pos + 1] - start - 1;
+    return doc->buf + start + 1;
+  case '{':
+  case '[':
+    *len = doc->idx[doc->next[v.pos] - 1] + 1 - start;
+    return doc->buf + start;
+  default:
+    *len = json_token_len(v);
+    return doc->buf + start;
+  }
+}
+
+/* Unescape len bytes of string contents into out (which must hold len
+ * bytes; unescaping never lengthens).  Returns the output length or -1.
+ */
+static ssize_t
+json_unescape(const char *p, size_t len, char *out) {
+  const char *end = p + len;
+  char *o = out;
+  while(p < end) {
+    const char *run = p;
+    int cp;
+    while(p < end && *p != '\\' && (uint8_t)*p >= 0x20) p++;
+    memcpy(o, run, p - run);
+    o += p - run;
+    if(p == end) break;
+    if(*p != '\\' || ++p == end) return -1;
+    switch(*p++) {
+    case '"': *o++ = '"'; continue;
+    case '\\': *o++ = '\\'; continue;
+    case '/': *o++ = '/'; continue;
+    case 'b': *o++ = '\b'; continue;
+    case 'f': *o++ = '\f'; continue;
+    case 'n': *o++ = '\n'; continue;
+    case 'r': *o++ = '\r'; continue;
+    case 't': *o++ = '\t'; continue;
+    case 'u': break;
+    default: return -1;
+    }
+    if(end - p < 4 || (cp = json_hex4(p)) < 0) return -1;
+    p += 4;
+    if(cp >= 0xd800 && cp < 0xdc00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+      int lo = json_hex4(p + 2);
+      if(lo >= 0xdc00 && lo < 0xe000) {
+        cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+        p += 6;
+      }
+    }
+    /* lone surrogates are passed through as three byte sequences */
+    if(cp < 0x80) *o++ = (char)cp;
+    else if(cp < 0x800) {
+      *o++ = (char)(0xc0 | (cp >> 6));
+      *o++ = (char)(0x80 | (cp & 0x3f));
+    }
+    else if(cp < 0x10000) {
+      *o++ = (char)(0xe0 | (cp >> 12));
+      *o++ = (char)(0x80 | ((cp >> 6) & 0x3f));
+      *o++ = (char)(0x80 | (cp & 0x3f));
+    }
+    else {
+      *o++ = (char)(0xf0 | (cp >> 18));
+      *o++ = (char)(0x80 | ((cp >> 12) & 0x3f));
+      *o++ = (char)(0x80 | ((cp >> 6) & 0x3f));
+      *o++ = (char)(0x80 | (cp & 0x3f));
+    }
+  }
+  return o - out;
+}
+
+static const char *
+json_string_into(mtev_json_value_t v, mtev_arena_t *arena, size_t *len) {
+  const char *raw;
+  size_t rawlen;
+  ssize_t outlen;
+  char *out;
+  if(!v.doc || VCHAR(v) != '"') return NULL;
+  raw = mtev_json_value_raw(v, &rawlen);
+  out = mtev_arena_alloc(arena, rawlen + 1);
+  if((outlen = json_unescape(raw, rawlen, out)) < 0) return NULL;
+  out[outlen] = '\0';
+  if(len) *len = outlen;
+  return out;
+}
+
+const char *
+mtev_json_value_string(mtev_json_value_t v, size_t *len) {
+  if(!v.doc) return NULL;
+  return json_string_into(v, mtev_json_doc_arena(v.doc), len);
+}
+
+mtev_boolean
+mtev_json_value_string_eq(mtev_json_value_t v, const char *s, size_t len) {
+  const char *raw;
+  size_t rawlen;
+  ssize_t outlen;
+  char tmp[256], *out;
+  mtev_boolean eq;
+  if(!v.doc || VCHAR(v) != '"') return mtev_false;
+  raw = mtev_json_value_raw(v, &rawlen);
+  if(!memchr(raw, '\\', rawlen)) return rawlen == len && !memcmp(raw, s, len);
+  if(rawlen < len) return mtev_false;
+  out = (rawlen <= sizeof(tmp)) ? tmp : malloc(rawlen);
+  outlen = json_unescape(raw, rawlen, out);
+  eq = outlen == (ssize_t)len && !memcmp(out, s, len);
+  if(out != tmp) free(out);
+  return eq;
+}
+
+/* trees */
+
+static mtev_boolean
+json_dom_fill(mtev_json_value_t v, mtev_arena_t *arena, mtev_json_node_t *node) {
+  mtev_json_iter_t it;
+  mtev_json_value_t key, val;
+  size_t len;
+  uint32_t i;
+
+  node->type = mtev_json_value_type(v);
+  switch(node->type) {
+  case mtev_json_type_object:
+  case mtev_json_type_array:
+    node->length = mtev_json_value_length(v);
+    node->v.children = mtev_arena_calloc(arena, node->length ? node->length : 1,
+                                         sizeof(mtev_json_node_t));
+    it = mtev_json_value_iter(v);
+    for(i = 0; mtev_json_iter_next(&it, &key, &val); i++) {
+      mtev_json_node_t *child = &node->v.children[i];
+      if(key.doc) {
+        if(!(child->key = json_string_into(key, arena, &len))) return mtev_false;
+        child->keylen = len;
+      }
+      if(!json_dom_fill(val, arena, child)) return mtev_false;
+    }
+    break;
+  case mtev_json_type_string:
+    if(!(node->v.str = json_string_into(v, arena, &len))) return mtev_false;
+    node->length = len;
+    break;
+  case mtev_json_type_int:
+    if(mtev_json_value_int64(v, &node->v.i64)) {
+      node->overflow = (node->v.i64 >= INT_MIN && node->v.i64 <= INT_MAX) ?
+                       mtev_json_overflow_int : mtev_json_overflow_int64;
+    }
+    else if(mtev_json_value_uint64(v, &node->v.u64)) {
+      node->overflow = mtev_json_overflow_uint64;
+    }
+    else {
+      node->type = mtev_json_type_double;
+      mtev_json_value_double(v, &node->v.dbl);
+    }
+    break;
+  case mtev_json_type_double:
+    mtev_json_value_double(v, &node->v.dbl);
+    break;
+  case mtev_json_type_boolean:
+    mtev_json_value_boolean(v, &node->v.boolean);
+    break;
+  case mtev_json_type_null:
+    break;
+  }
+  return mtev_true;
+}
+
+mtev_json_node_t *
+mtev_json_value_dom(mtev_json_value_t v, mtev_arena_t *arena) {
+  mtev_json_node_t *root;
+  if(!v.doc) return NULL;
+  if(!arena) arena = mtev_json_doc_arena(v.doc);
+  root = mtev_arena_calloc(arena, 1, sizeof(*root));
+  return json_dom_fill(v, arena, root) ? root : NULL;
+}
+
+const mtev_json_node_t *
+mtev_json_node_get(const mtev_json_node_t *obj, const char *key) {
+  const mtev_json_node_t *found = NULL;
+  size_t keylen;
+  uint32_t i;
+  if(!obj || obj->type != mtev_json_type_object) return NULL;
+  keylen = strlen(key);
+  for(i = 0; i < obj->length; i++) {
+    const mtev_json_node_t *child = &obj->v.children[i];
+    if(child->keylen == keylen && !memcmp(child->key, key, keylen)) found = child;
+  }
+  return found;
+}
+
+const mtev_json_node_t *
+mtev_json_node_index(const mtev_json_node_t *arr, size_t i) {
+  if(!arr || arr->type != mtev_json_type_array || i >= arr->length) return NULL;
+  return &arr->v.children[i];
+}
+
+/* Unescape a string into a caller buffer when it fits, else the heap. */
+static const char *
+json_string_tmp(mtev_json_value_t v, char *tmp, size_t tmplen,
+                char **heap, size_t *len) {
+  const char *raw;
+  size_t rawlen;
+  ssize_t outlen;
+  char *out;
+  *heap = NULL;
+  raw = mtev_json_value_raw(v, &rawlen);
+  out = (rawlen < tmplen) ? tmp : (*heap = malloc(rawlen + 1));
+  if((outlen = json_unescape(raw, rawlen, out)) < 0) {
+    free(*heap);
+    *heap = NULL;
+    return NULL;
+  }
+  out[outlen] = '\0';
+  *len = outlen;
+  return out;
+}
+
+mtev_boolean
+mtev_json_value_to_object(mtev_json_value_t v, struct mtev_json_object **out) {
+  struct mtev_json_object *o = NULL, *child;
+  mtev_json_iter_t it;
+  mtev_json_value_t key, val;
+  char tmp[256], *heap;
+  const char *str;
+  size_t len;
+  mtev_boolean neg, b = mtev_false;
+  uint64_t mag;
+  double d = 0;
+
+  *out = NULL;
+  switch(mtev_json_value_type(v)) {
+  case mtev_json_type_object:
+    o = mtev_json_object_new_object();
+    it = mtev_json_value_iter(v);
+    while(mtev_json_iter_next(&it, &key, &val)) {
+      if(!mtev_json_value_to_object(val, &child)) goto fail;
+      if(!(str = json_string_tmp(key, tmp, sizeof(tmp), &heap, &len))) {
+        if(child) mtev_json_object_put(child);
+        goto fail;
+      }
+      mtev_json_object_object_add(o, str, child);
+      free(heap);
+    }
+    break;
+  case mtev_json_type_array:
+    o = mtev_json_object_new_array();
+    it = mtev_json_value_iter(v);
+    while(mtev_json_iter_next(&it, NULL, &val)) {
+      if(!mtev_json_value_to_object(val, &child)) goto fail;
+      mtev_json_object_array_add(o, child);
+    }
+    break;
+  case mtev_json_type_string:
+    if(!(str = json_string_tmp(v, tmp, sizeof(tmp), &heap, &len))) return mtev_false;
+    o = mtev_json_object_new_string_len(str, (int)len);
+    free(heap);
+    break;
+  case mtev_json_type_int:
+    /* as mtev_json_tokener: an int when it fits, with the 64-bit value
+     * alongside; otherwise flagged as an int64 or uint64 overflow */
+    if(json_integer(v, &neg, &mag) &&
+       mag <= (neg ? (uint64_t)INT64_MAX + 1 : UINT64_MAX)) {
+      if(neg ? mag <= (uint64_t)INT_MAX + 1 : mag <= (uint64_t)INT_MAX) {
+        o = mtev_json_object_new_int(neg ? (int)(0 - mag) : (int)mag);
+        if(neg) mtev_json_object_set_int64(o, (int64_t)(0 - mag));
+        else mtev_json_object_set_uint64(o, mag);
+      }
+      else if(neg) o = mtev_json_object_new_int64((int64_t)(0 - mag));
+      else o = mtev_json_object_new_uint64(mag);
+      break;
+    }
+    /* fallthrough */
+  case mtev_json_type_double:
+    mtev_json_value_double(v, &d);
+    o = mtev_json_object_new_double(d);
+    break;
+  case mtev_json_type_boolean:
+    mtev_json_value_boolean(v, &b);
+    o = mtev_json_object_new_boolean(b);
+    break;
+  case mtev_json_type_null:
+    break;
+  }
+  *out = o;
+  return mtev_true;
+
+ fail:
+  mtev_json_object_put(o);
+  return mtev_false;
+}
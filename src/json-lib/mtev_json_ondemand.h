@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2017, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name Circonus, Inc. nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _MTEV_JSON_ONDEMAND_H
+#define _MTEV_JSON_ONDEMAND_H
+
+/*!  \file mtev_json_ondemand.h
+
+     A JSON parser that indexes a document rather than building objects
+     from it.  Parsing locates every structural character with SIMD
+     (SSE2, or AVX2 where available), validates the grammar and records
+     where each value ends.  Values are then read in place through
+     lightweight cursors; nothing is allocated until a string is
+     unescaped or a tree is requested.  When a whole tree is needed, it
+     can be built into an arena (mtev_json_value_dom) or converted into a
+     regular mtev_json_object (mtev_json_value_to_object).
+
+     Structure, literals and numbers are validated at parse time.  String
+     contents (escapes and control characters) are validated when a string
+     is read, or at parse time with MTEV_JSON_DOC_VALIDATE.
+ */
+
+#include "mtev_defines.h"
+#include "mtev_arena.h"
+#include "mtev_json_object.h"
+
+#include <stdint.h>
+
+/*! \brief Nesting limit for documents parsed by mtev_json_doc_parse. */
+#define MTEV_JSON_DOC_MAX_DEPTH 1024
+
+/*! \brief Parse flag: copy the input so the caller may release it. */
+#define MTEV_JSON_DOC_COPY 0x1
+/*! \brief Parse flag: also validate the contents of every string, so
+    that reading a string from the document cannot fail. */
+#define MTEV_JSON_DOC_VALIDATE 0x2
+
+typedef struct mtev_json_doc mtev_json_doc_t;
+
+/*! \brief A cursor on one value within a parsed document.
+
+    Cursors are plain values, valid for the lifetime of their document.
+    A cursor with a NULL doc represents "no value" (e.g. a missing key).
+ */
+typedef struct {
+  mtev_json_doc_t *doc;
+  uint32_t pos;
+} mtev_json_value_t;
+
+/*! \brief Iteration state over the members of an object or array. */
+typedef struct {
+  mtev_json_doc_t *doc;
+  uint32_t pos;
+  mtev_boolean object;
+} mtev_json_iter_t;
+
+/*! \brief A node of a tree built with mtev_json_value_dom.
+
+    Integers are held in `v.i64`, or in `v.u64` when `overflow` is
+    mtev_json_overflow_uint64; `overflow` is mtev_json_overflow_int when
+    the value also fits in an int.  Integers beyond 64 bits become
+    doubles.  Strings are unescaped and NUL terminated
+    with their byte length in `length`.  Arrays and objects hold `length`
+    children in `v.children`; children of objects carry their member name
+    in `key`/`keylen`.
+ */
+typedef struct mtev_json_node mtev_json_node_t;
+struct mtev_json_node {
+  enum mtev_json_type type;
+  enum mtev_json_int_overflow overflow;
+  uint32_t length;
+  uint32_t keylen;
+  const char *key;
+  union {
+    mtev_boolean boolean;
+    int64_t i64;
+    uint64_t u64;
+    double dbl;
+    const char *str;
+    mtev_json_node_t *children;
+  } v;
+};
+
+/*! \fn mtev_json_doc_t *mtev_json_doc_parse(const char *buf, size_t len, int flags, const char **err, size_t *erroff)
+    \brief Index and validate a JSON document.
+    \param buf the JSON text (need not be NUL terminated).
+    \param len the length of buf.
+    \param flags a mask of MTEV_JSON_DOC_COPY and MTEV_JSON_DOC_VALIDATE.
+    \param err if not NULL, set to a static description of any error.
+    \param erroff if not NULL, set to the byte offset of any error.
+    \return a document, or NULL if the input is not valid JSON.
+
+    Unless MTEV_JSON_DOC_COPY is specified, buf must outlive the document.
+    A document is not safe for concurrent use by several threads.
+ */
+API_EXPORT(mtev_json_doc_t *)
+  mtev_json_doc_parse(const char *buf, size_t len, int flags,
+                      const char **err, size_t *erroff);
+
+/*! \fn void mtev_json_doc_free(mtev_json_doc_t *doc)
+    \brief Free a document and everything allocated from it.
+    \param doc the document.
+ */
+API_EXPORT(void) mtev_json_doc_free(mtev_json_doc_t *doc);
+
+/*! \fn mtev_json_value_t mtev_json_doc_root(mtev_json_doc_t *doc)
+    \brief Return a cursor on the top-level value of a document.
+ */
+API_EXPORT(mtev_json_value_t) mtev_json_doc_root(mtev_json_doc_t *doc);
+
+/*! \fn mtev_arena_t *mtev_json_doc_arena(mtev_json_doc_t *doc)
+    \brief Return the arena that holds strings and trees for a document.
+ */
+API_EXPORT(mtev_arena_t *) mtev_json_doc_arena(mtev_json_doc_t *doc);
+
+/*! \fn mtev_boolean mtev_json_value_exists(mtev_json_value_t v)
+    \brief Report whether a cursor refers to a value.
+ */
+API_EXPORT(mtev_boolean) mtev_json_value_exists(mtev_json_value_t v);
+
+/*! \fn enum mtev_json_type mtev_json_value_type(mtev_json_value_t v)
+    \brief Return the type of a value.
+    \return the type; numbers without a fraction or exponent are
+            mtev_json_type_int.  A missing value is mtev_json_type_null.
+ */
+API_EXPORT(enum mtev_json_type) mtev_json_value_type(mtev_json_value_t v);
+
+/*! \fn mtev_json_value_t mtev_json_value_get(mtev_json_value_t obj, const char *key)
+    \brief Look up a member of an object.
+    \return a cursor on the last member named key, or a missing value.
+ */
+API_EXPORT(mtev_json_value_t)
+  mtev_json_value_get(mtev_json_value_t obj, const char *key);
+
+/*! \fn mtev_json_value_t mtev_json_value_index(mtev_json_value_t arr, size_t idx)
+    \brief Return the element of an array at a zero-based index.
+    \return a cursor on the element, or a missing value.
+
+    Containers are skipped in constant time, so this is linear in idx
+    rather than in the size of the elements before it.
+ */
+API_EXPORT(mtev_json_value_t)
+  mtev_json_value_index(mtev_json_value_t arr, size_t idx);
+
+/*! \fn mtev_json_value_t mtev_json_value_path(mtev_json_value_t v, const char *path)
+    \brief Follow a path of member names and array indices.
+    \param path e.g. "checks[0].metrics.duration": names are separated
+           by '.' and zero-based indices are written as "[n]".
+    \return a cursor on the value, or a missing value.
+ */
+API_EXPORT(mtev_json_value_t)
+  mtev_json_value_path(mtev_json_value_t v, const char *path);
+
+/*! \fn size_t mtev_json_value_length(mtev_json_value_t v)
+    \brief Count the members of an object or elements of an array.
+ */
+API_EXPORT(size_t) mtev_json_value_length(mtev_json_value_t v);
+
+/*! \fn mtev_json_iter_t mtev_json_value_iter(mtev_json_value_t v)
+    \brief Begin iterating an object or array.
+ */
+API_EXPORT(mtev_json_iter_t) mtev_json_value_iter(mtev_json_value_t v);
+
+/*! \fn mtev_boolean mtev_json_iter_next(mtev_json_iter_t *iter, mtev_json_value_t *key, mtev_json_value_t *val)
+    \brief Advance an iterator.
+    \param key if not NULL, set to the member name (a string value) when
+           iterating an object, or to a missing value for an array.
+    \param val set to the member or element.
+    \return mtev_false once the container is exhausted.
+ */
+API_EXPORT(mtev_boolean)
+  mtev_json_iter_next(mtev_json_iter_t *iter, mtev_json_value_t *key,
+                      mtev_json_value_t *val);
+
+/*! \fn mtev_boolean mtev_json_value_boolean(mtev_json_value_t v, mtev_boolean *out)
+    \brief Read a boolean.
+    \return mtev_false if v is not a boolean.
+ */
+API_EXPORT(mtev_boolean)
+  mtev_json_value_boolean(mtev_json_value_t v, mtev_boolean *out);
+
+/*! \fn mtev_boolean mtev_json_value_int64(mtev_json_value_t v, int64_t *out)
+    \brief Read an integer that fits in an int64_t.
+    \return mtev_false if v is not an integer or is out of range.
+ */
+API_EXPORT(mtev_boolean)
+  mtev_json_value_int64(mtev_json_value_t v, int64_t *out);
+
+/*! \fn mtev_boolean mtev_json_value_uint64(mtev_json_value_t v, uint64_t *out)
+    \brief Read a non-negative integer that fits in a uint64_t.
+    \return mtev_false if v is not such an integer.
+ */
+API_EXPORT(mtev_boolean)
+  mtev_json_value_uint64(mtev_json_value_t v, uint64_t *out);
+
+/*! \fn mtev_boolean mtev_json_value_double(mtev_json_value_t v, double *out)
+    \brief Read any number as a double.
+    \return mtev_false if v is not a number.
+ */
+API_EXPORT(mtev_boolean)
+  mtev_json_value_double(mtev_json_value_t v, double *out);
+
+/*! \fn const char *mtev_json_value_raw(mtev_json_value_t v, size_t *len)
+    \brief Return the JSON text of a value in place.
+    \param len set to the length of the text.
+    \return a pointer into the document; for strings, the still-escaped
+            contents between the quotes.  Not NUL terminated.
+ */
+API_EXPORT(const char *)
+  mtev_json_value_raw(mtev_json_value_t v, size_t *len);
+
+/*! \fn const char *mtev_json_value_string(mtev_json_value_t v, size_t *len)
+    \brief Unescape a string into the document's arena.
+    \param len if not NULL, set to the byte length of the result.
+    \return a NUL terminated string, or NULL if v is not a valid string.
+ */
+API_EXPORT(const char *)
+  mtev_json_value_string(mtev_json_value_t v, size_t *len);
+
+/*! \fn mtev_boolean mtev_json_value_string_eq(mtev_json_value_t v, const char *s, size_t len)
+    \brief Compare a string value to a buffer without allocating.
+ */
+API_EXPORT(mtev_boolean)
+  mtev_json_value_string_eq(mtev_json_value_t v, const char *s, size_t len);
+
+/*! \fn mtev_json_node_t *mtev_json_value_dom(mtev_json_value_t v, mtev_arena_t *arena)
+    \brief Build a tree of a value and everything beneath it in an arena.
+    \param arena the arena to allocate from, or NULL for the document's.
+    \return the root node, or NULL if a string in the value is invalid.
+
+    Nodes reference nothing in the document, so a caller-supplied arena
+    may outlive it.
+ */
+API_EXPORT(mtev_json_node_t *)
+  mtev_json_value_dom(mtev_json_value_t v, mtev_arena_t *arena);
+
+/*! \fn const mtev_json_node_t *mtev_json_node_get(const mtev_json_node_t *obj, const char *key)
+    \brief Look up a child of an object node by name.
+ */
+API_EXPORT(const mtev_json_node_t *)
+  mtev_json_node_get(const mtev_json_node_t *obj, const char *key);
+
+/*! \fn const mtev_json_node_t *mtev_json_node_index(const mtev_json_node_t *arr, size_t idx)
+    \brief Return the child of an array node at a zero-based index.
+ */
+API_EXPORT(const mtev_json_node_t *)
+  mtev_json_node_index(const mtev_json_node_t *arr, size_t idx);
+
+/*! \fn mtev_boolean mtev_json_value_to_object(mtev_json_value_t v, struct mtev_json_object **out)
+    \brief Convert a value into a new mtev_json_object tree.
+    \param out set to a new reference (NULL for a JSON null).
+    \return mtev_false if a string in the value is invalid.
+
+    Integers are represented as mtev_json_tokener would represent them.
+ */
+API_EXPORT(mtev_boolean)
+  mtev_json_value_to_object(mtev_json_value_t v, struct mtev_json_object **out);
+
+#endif
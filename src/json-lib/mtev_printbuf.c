@@ -24,6 +24,8 @@
 #include <string.h>
 
 #include <stdarg.h>
+#include <stdint.h>
+#include <math.h>
 
 #include "mtev_bits.h"
 #include "mtev_debug.h"
@@ -45,19 +47,54 @@ struct jl_printbuf* jl_printbuf_new(void)
 }
 
 
+void jl_printbuf_init_stream(struct jl_printbuf *p, char *buf, int size,
+                             jl_printbuf_flush_func flush, void *closure)
+{
+  memset(p, 0, sizeof(*p));
+  p->buf = buf;
+  p->size = size;
+  p->flush = flush;
+  p->flush_closure = closure;
+  p->buf[0] = '\0';
+}
+
+int jl_printbuf_flush(struct jl_printbuf *p)
+{
+  if(p->bpos > 0 && p->flush && !p->flush_failed) {
+    if(p->flush(p->flush_closure, p->buf, p->bpos) < 0) p->flush_failed = 1;
+  }
+  p->bpos = 0;
+  p->buf[0] = '\0';
+  return p->flush_failed ? -1 : 0;
+}
+
 int jl_printbuf_memappend(struct jl_printbuf *p, const char *buf, int size)
 {
   char *t;
   if(p->size - p->bpos <= size) {
-    int new_size = mtev_json_max(p->size * 2, p->bpos + size + 8);
+    if(p->flush) {
+      /* streaming: drain the window rather than growing it, and hand
+       * anything that could never fit straight to the sink. */
+      if(jl_printbuf_flush(p) < 0) return -1;
+      if(p->size <= size) {
+        if(p->flush(p->flush_closure, buf, size) < 0) {
+          p->flush_failed = 1;
+          return -1;
+        }
+        return size;
+      }
+    }
+    else {
+      int new_size = mtev_json_max(p->size * 2, p->bpos + size + 8);
 #ifdef PRINTBUF_DEBUG
-    MC_DEBUG("printbuf_memappend: realloc "
-	     "bpos=%d wrsize=%d old_size=%d new_size=%d\n",
-	     p->bpos, size, p->size, new_size);
+      MC_DEBUG("printbuf_memappend: realloc "
+	       "bpos=%d wrsize=%d old_size=%d new_size=%d\n",
+	       p->bpos, size, p->size, new_size);
 #endif /* PRINTBUF_DEBUG */
-    if(!(t = (char*)realloc(p->buf, new_size))) return -1;
-    p->size = new_size;
-    p->buf = t;
+      if(!(t = (char*)realloc(p->buf, new_size))) return -1;
+      p->size = new_size;
+      p->buf = t;
+    }
   }
   memcpy(p->buf + p->bpos, buf, size);
   p->bpos += size;
@@ -65,6 +102,324 @@ int jl_printbuf_memappend(struct jl_printbuf *p, const char *buf, int size)
   return size;
 }
 
+/* integer formatting: two digits per division, written back to front */
+
+static const char jl_digits2[201] =
+  "00010203040506070809101112131415161718192021222324"
+  "25262728293031323334353637383940414243444546474849"
+  "50515253545556575859606162636465666768697071727374"
+  "75767778798081828384858687888990919293949596979899";
+
+static const uint64_t jl_pow10_u64[20] = {
+  UINT64_C(1), UINT64_C(10), UINT64_C(100), UINT64_C(1000),
+  UINT64_C(10000), UINT64_C(100000), UINT64_C(1000000),
+  UINT64_C(10000000), UINT64_C(100000000), UINT64_C(1000000000),
+  UINT64_C(10000000000), UINT64_C(100000000000),
+  UINT64_C(1000000000000), UINT64_C(10000000000000),
+  UINT64_C(100000000000000), UINT64_C(1000000000000000),
+  UINT64_C(10000000000000000), UINT64_C(100000000000000000),
+  UINT64_C(1000000000000000000), UINT64_C(10000000000000000000)
+};
+
+static inline int jl_count_digits(uint64_t v)
+{
+  /* log10 estimate from the bit length, corrected by one comparison;
+   * or-ing in the low bit keeps 0 at one digit and never changes the
+   * count of any other value. */
+  uint64_t w = v | 1;
+  int t = ((64 - __builtin_clzll(w)) * 1233) >> 12;
+  return t + (w >= jl_pow10_u64[t]);
+}
+
+static inline void jl_write_digits(char *end, uint64_t v)
+{
+  while(v >= 100) {
+    unsigned i = (unsigned)(v % 100) * 2;
+    v /= 100;
+    *--end = jl_digits2[i + 1];
+    *--end = jl_digits2[i];
+  }
+  if(v >= 10) {
+    *--end = jl_digits2[v * 2 + 1];
+    *--end = jl_digits2[v * 2];
+  }
+  else *--end = '0' + (char)v;
+}
+
+int jl_format_uint64(char *out, uint64_t v)
+{
+  int n = jl_count_digits(v);
+  jl_write_digits(out + n, v);
+  out[n] = '\0';
+  return n;
+}
+
+int jl_format_int64(char *out, int64_t v)
+{
+  if(v < 0) {
+    *out = '-';
+    return 1 + jl_format_uint64(out + 1, (uint64_t)0 - (uint64_t)v);
+  }
+  return jl_format_uint64(out, (uint64_t)v);
+}
+
+/* double formatting: Grisu2 (Loitsch, "Printing Floating-Point Numbers
+ * Quickly and Accurately with Integers", PLDI 2010) produces the shortest
+ * digit string that round-trips in all but a vanishing fraction of cases,
+ * and a correct, one-digit-longer string in those.
+ */
+
+typedef struct { uint64_t f; int e; } jl_diyfp;
+
+#define JL_DP_SIGNIFICAND_MASK UINT64_C(0x000FFFFFFFFFFFFF)
+#define JL_DP_HIDDEN_BIT UINT64_C(0x0010000000000000)
+
+/* 10^k for k = -348, -340, ..., 340, normalized and rounded to nearest */
+static const uint64_t jl_cached_powers_f[87] = {
+  UINT64_C(0xfa8fd5a0081c0288), UINT64_C(0xbaaee17fa23ebf76), UINT64_C(0x8b16fb203055ac76),
+  UINT64_C(0xcf42894a5dce35ea), UINT64_C(0x9a6bb0aa55653b2d), UINT64_C(0xe61acf033d1a45df),
+  UINT64_C(0xab70fe17c79ac6ca), UINT64_C(0xff77b1fcbebcdc4f), UINT64_C(0xbe5691ef416bd60c),
+  UINT64_C(0x8dd01fad907ffc3c), UINT64_C(0xd3515c2831559a83), UINT64_C(0x9d71ac8fada6c9b5),
+  UINT64_C(0xea9c227723ee8bcb), UINT64_C(0xaecc49914078536d), UINT64_C(0x823c12795db6ce57),
+  UINT64_C(0xc21094364dfb5637), UINT64_C(0x9096ea6f3848984f), UINT64_C(0xd77485cb25823ac7),
+  UINT64_C(0xa086cfcd97bf97f4), UINT64_C(0xef340a98172aace5), UINT64_C(0xb23867fb2a35b28e),
+  UINT64_C(0x84c8d4dfd2c63f3b), UINT64_C(0xc5dd44271ad3cdba), UINT64_C(0x936b9fcebb25c996),
+  UINT64_C(0xdbac6c247d62a584), UINT64_C(0xa3ab66580d5fdaf6), UINT64_C(0xf3e2f893dec3f126),
+  UINT64_C(0xb5b5ada8aaff80b8), UINT64_C(0x87625f056c7c4a8b), UINT64_C(0xc9bcff6034c13053),
+  UINT64_C(0x964e858c91ba2655), UINT64_C(0xdff9772470297ebd), UINT64_C(0xa6dfbd9fb8e5b88f),
+  UINT64_C(0xf8a95fcf88747d94), UINT64_C(0xb94470938fa89bcf), UINT64_C(0x8a08f0f8bf0f156b),
+  UINT64_C(0xcdb02555653131b6), UINT64_C(0x993fe2c6d07b7fac), UINT64_C(0xe45c10c42a2b3b06),
+  UINT64_C(0xaa242499697392d3), UINT64_C(0xfd87b5f28300ca0e), UINT64_C(0xbce5086492111aeb),
+  UINT64_C(0x8cbccc096f5088cc), UINT64_C(0xd1b71758e219652c), UINT64_C(0x9c40000000000000),
+  UINT64_C(0xe8d4a51000000000), UINT64_C(0xad78ebc5ac620000), UINT64_C(0x813f3978f8940984),
+  UINT64_C(0xc097ce7bc90715b3), UINT64_C(0x8f7e32ce7bea5c70), UINT64_C(0xd5d238a4abe98068),
+  UINT64_C(0x9f4f2726179a2245), UINT64_C(0xed63a231d4c4fb27), UINT64_C(0xb0de65388cc8ada8),
+  UINT64_C(0x83c7088e1aab65db), UINT64_C(0xc45d1df942711d9a), UINT64_C(0x924d692ca61be758),
+  UINT64_C(0xda01ee641a708dea), UINT64_C(0xa26da3999aef774a), UINT64_C(0xf209787bb47d6b85),
+  UINT64_C(0xb454e4a179dd1877), UINT64_C(0x865b86925b9bc5c2), UINT64_C(0xc83553c5c8965d3d),
+  UINT64_C(0x952ab45cfa97a0b3), UINT64_C(0xde469fbd99a05fe3), UINT64_C(0xa59bc234db398c25),
+  UINT64_C(0xf6c69a72a3989f5c), UINT64_C(0xb7dcbf5354e9bece), UINT64_C(0x88fcf317f22241e2),
+  UINT64_C(0xcc20ce9bd35c78a5), UINT64_C(0x98165af37b2153df), UINT64_C(0xe2a0b5dc971f303a),
+  UINT64_C(0xa8d9d1535ce3b396), UINT64_C(0xfb9b7cd9a4a7443c), UINT64_C(0xbb764c4ca7a44410),
+  UINT64_C(0x8bab8eefb6409c1a), UINT64_C(0xd01fef10a657842c), UINT64_C(0x9b10a4e5e9913129),
+  UINT64_C(0xe7109bfba19c0c9d), UINT64_C(0xac2820d9623bf429), UINT64_C(0x80444b5e7aa7cf85),
+  UINT64_C(0xbf21e44003acdd2d), UINT64_C(0x8e679c2f5e44ff8f), UINT64_C(0xd433179d9c8cb841),
+  UINT64_C(0x9e19db92b4e31ba9), UINT64_C(0xeb96bf6ebadf77d9), UINT64_C(0xaf87023b9bf0ee6b),
+};
+static const int16_t jl_cached_powers_e[87] = {
+  -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+  -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+  -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+  -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+  -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+  109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+  375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+  641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+  907, 933, 960, 986, 1013, 1039, 1066,
+};
+
+static inline jl_diyfp jl_diyfp_mul(jl_diyfp a, jl_diyfp b)
+{
+  __uint128_t p = (__uint128_t)a.f * b.f;
+  jl_diyfp r;
+  r.f = (uint64_t)(p >> 64) + (((uint64_t)p >> 63) & 1);
+  r.e = a.e + b.e + 64;
+  return r;
+}
+
+static inline jl_diyfp jl_diyfp_normalize(jl_diyfp a)
+{
+  int s = __builtin_clzll(a.f);
+  a.f <<= s;
+  a.e -= s;
+  return a;
+}
+
+static inline void jl_grisu_round(char *buf, int len, uint64_t delta,
+                                  uint64_t rest, uint64_t ten_kappa,
+                                  uint64_t wp_w)
+{
+  while(rest < wp_w && delta - rest >= ten_kappa &&
+        (rest + ten_kappa < wp_w ||
+         wp_w - rest > rest + ten_kappa - wp_w)) {
+    buf[len - 1]--;
+    rest += ten_kappa;
+  }
+}
+
+static void jl_grisu_digits(jl_diyfp w, jl_diyfp mp, uint64_t delta,
+                            char *buf, int *len, int *k)
+{
+  const int shift = -mp.e;
+  const uint64_t one = UINT64_C(1) << shift;
+  const uint64_t wp_w = mp.f - w.f;
+  uint32_t p1 = (uint32_t)(mp.f >> shift);
+  uint64_t p2 = mp.f & (one - 1);
+  int kappa = jl_count_digits(p1);
+  *len = 0;
+
+  while(kappa > 0) {
+    uint32_t div = (uint32_t)jl_pow10_u64[kappa - 1];
+    uint32_t d = p1 / div;
+    p1 %= div;
+    if(d || *len) buf[(*len)++] = '0' + (char)d;
+    kappa--;
+    uint64_t tmp = ((uint64_t)p1 << shift) + p2;
+    if(tmp <= delta) {
+      *k += kappa;
+      jl_grisu_round(buf, *len, delta, tmp, jl_pow10_u64[kappa] << shift, wp_w);
+      return;
+    }
+  }
+  for(;;) {
+    p2 *= 10;
+    delta *= 10;
+    char d = (char)(p2 >> shift);
+    if(d || *len) buf[(*len)++] = '0' + d;
+    p2 &= one - 1;
+    kappa--;
+    if(p2 < delta) {
+      *k += kappa;
+      jl_grisu_round(buf, *len, delta, p2, one,
+                     -kappa < 20 ? wp_w * jl_pow10_u64[-kappa] : 0);
+      return;
+    }
+  }
+}
+
+static void jl_grisu2(double value, char *buf, int *len, int *k)
+{
+  uint64_t u;
+  jl_diyfp v, w_p, w_m, c_mk, w;
+  memcpy(&u, &value, sizeof(u));
+  int biased_e = (int)((u >> 52) & 0x7ff);
+  v.f = u & JL_DP_SIGNIFICAND_MASK;
+  if(biased_e) {
+    v.f += JL_DP_HIDDEN_BIT;
+    v.e = biased_e - 1075;
+  }
+  else v.e = -1074;
+
+  /* boundaries m+ and m- halfway to the neighbouring doubles */
+  w_p.f = (v.f << 1) + 1;
+  w_p.e = v.e - 1;
+  while(!(w_p.f & (JL_DP_HIDDEN_BIT << 1))) { w_p.f <<= 1; w_p.e--; }
+  w_p.f <<= 10;
+  w_p.e -= 10;
+  if(v.f == JL_DP_HIDDEN_BIT) { w_m.f = (v.f << 2) - 1; w_m.e = v.e - 2; }
+  else { w_m.f = (v.f << 1) - 1; w_m.e = v.e - 1; }
+  w_m.f <<= w_m.e - w_p.e;
+  w_m.e = w_p.e;
+
+  /* pick the cached power that scales m+ into [-60, -32] binary exponent */
+  double dk = (-61 - w_p.e) * 0.30102999566398114 + 347;
+  int ik = (int)dk;
+  if(dk - ik > 0.0) ik++;
+  unsigned idx = (unsigned)((ik >> 3) + 1);
+  *k = -(-348 + (int)(idx << 3));
+  c_mk.f = jl_cached_powers_f[idx];
+  c_mk.e = jl_cached_powers_e[idx];
+
+  w = jl_diyfp_mul(jl_diyfp_normalize(v), c_mk);
+  w_p = jl_diyfp_mul(w_p, c_mk);
+  w_m = jl_diyfp_mul(w_m, c_mk);
+  w_m.f++;
+  w_p.f--;
+  jl_grisu_digits(w, w_p, w_p.f - w_m.f, buf, len, k);
+}
+
+static char *jl_write_exponent(int k, char *out)
+{
+  *out++ = 'e';
+  if(k < 0) { *out++ = '-'; k = -k; }
+  if(k >= 100) {
+    *out++ = '0' + (char)(k / 100);
+    k %= 100;
+    *out++ = jl_digits2[k * 2];
+    *out++ = jl_digits2[k * 2 + 1];
+  }
+  else if(k >= 10) {
+    *out++ = jl_digits2[k * 2];
+    *out++ = jl_digits2[k * 2 + 1];
+  }
+  else *out++ = '0' + (char)k;
+  return out;
+}
+
+int jl_format_double(char *out, double v)
+{
+  char *start = out, *end;
+  int len, k, kk;
+  if(signbit(v)) {
+    *out++ = '-';
+    v = -v;
+  }
+  if(v == 0) {
+    memcpy(out, "0.0", 4);
+    return (int)(out - start) + 3;
+  }
+  jl_grisu2(v, out, &len, &k);
+  kk = len + k; /* 10^(kk-1) <= v < 10^kk */
+  if(k >= 0 && kk <= 21) {
+    /* 1234e7 -> 12340000000.0 */
+    memset(out + len, '0', kk - len);
+    out[kk] = '.';
+    out[kk + 1] = '0';
+    end = out + kk + 2;
+  }
+  else if(kk > 0 && kk <= 21) {
+    /* 1234e-2 -> 12.34 */
+    memmove(out + kk + 1, out + kk, len - kk);
+    out[kk] = '.';
+    end = out + len + 1;
+  }
+  else if(kk > -6 && kk <= 0) {
+    /* 1234e-6 -> 0.001234 */
+    int offset = 2 - kk;
+    memmove(out + offset, out, len);
+    out[0] = '0';
+    out[1] = '.';
+    memset(out + 2, '0', offset - 2);
+    end = out + len + offset;
+  }
+  else if(len == 1) {
+    /* 1e30 */
+    end = jl_write_exponent(kk - 1, out + 1);
+  }
+  else {
+    /* 1234e30 -> 1.234e33 */
+    memmove(out + 2, out + 1, len - 1);
+    out[1] = '.';
+    end = jl_write_exponent(kk - 1, out + len + 1);
+  }
+  *end = '\0';
+  return (int)(end - start);
+}
+
+int jl_printbuf_append_uint64(struct jl_printbuf *p, uint64_t v)
+{
+  char buf[JL_FORMAT_NUMBER_MAX];
+  int len = jl_format_uint64(buf, v);
+  jl_printbuf_memappend_fast(p, buf, len);
+  return len;
+}
+
+int jl_printbuf_append_int64(struct jl_printbuf *p, int64_t v)
+{
+  char buf[JL_FORMAT_NUMBER_MAX];
+  int len = jl_format_int64(buf, v);
+  jl_printbuf_memappend_fast(p, buf, len);
+  return len;
+}
+
+int jl_printbuf_append_double(struct jl_printbuf *p, double v)
+{
+  char buf[JL_FORMAT_NUMBER_MAX];
+  int len = jl_format_double(buf, v);
+  jl_printbuf_memappend_fast(p, buf, len);
+  return len;
+}
+
 #ifndef HAVE_VASPRINTF
 /* CAW: compliant version of vasprintf */
 static int vasprintf(char **buf, const char *fmt, va_list ap)
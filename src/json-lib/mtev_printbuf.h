@@ -21,14 +21,27 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
+
 #undef PRINTBUF_DEBUG
 
+/* A flush function receives the buffered bytes when a streaming printbuf
+ * fills; it returns < 0 on failure, after which further output is dropped.
+ */
+typedef int (*jl_printbuf_flush_func)(void *closure, const char *buf, int len);
+
 struct jl_printbuf {
   char *buf;
   int bpos;
   int size;
+  jl_printbuf_flush_func flush;
+  void *flush_closure;
+  int flush_failed;
 };
 
+/* Longest output of jl_format_double/jl_format_[u]int64, including '\0' */
+#define JL_FORMAT_NUMBER_MAX 32
+
 extern struct jl_printbuf*
 jl_printbuf_new(void);
 
@@ -42,13 +55,47 @@ jl_printbuf_memappend(struct jl_printbuf *p, const char *buf, int size);
 
 #define jl_printbuf_memappend_fast(p, bufptr, bufsize)          \
 do {                                                         \
-  if ((p->size - p->bpos) > bufsize) {                       \
-    memcpy(p->buf + p->bpos, (bufptr), bufsize);             \
-    p->bpos += bufsize;                                      \
-    p->buf[p->bpos]= '\0';                                   \
-  } else {  jl_printbuf_memappend(p, (bufptr), bufsize); }      \
+  if (((p)->size - (p)->bpos) > (bufsize)) {                 \
+    memcpy((p)->buf + (p)->bpos, (bufptr), (bufsize));       \
+    (p)->bpos += (bufsize);                                  \
+    (p)->buf[(p)->bpos]= '\0';                               \
+  } else {  jl_printbuf_memappend((p), (bufptr), (bufsize)); }  \
 } while (0)
 
+/* Initialize a printbuf over caller-supplied storage that never grows:
+ * whenever it fills, its contents are handed to flush() and it is reused.
+ * Such a printbuf must not be passed to jl_printbuf_free().
+ */
+extern void
+jl_printbuf_init_stream(struct jl_printbuf *p, char *buf, int size,
+                        jl_printbuf_flush_func flush, void *closure);
+
+/* Hand any buffered output of a streaming printbuf to its flush function.
+ * Returns -1 if this or any earlier flush failed.
+ */
+extern int
+jl_printbuf_flush(struct jl_printbuf *p);
+
+/* Number formatting without printf.  Each writes at most
+ * JL_FORMAT_NUMBER_MAX - 1 characters plus a terminating '\0' and returns
+ * the length.  Doubles are written in the shortest form that reads back
+ * to the identical value and always carry a '.' or exponent; the caller
+ * must handle NaN and infinities.
+ */
+extern int
+jl_format_uint64(char *out, uint64_t v);
+extern int
+jl_format_int64(char *out, int64_t v);
+extern int
+jl_format_double(char *out, double v);
+
+extern int
+jl_printbuf_append_uint64(struct jl_printbuf *p, uint64_t v);
+extern int
+jl_printbuf_append_int64(struct jl_printbuf *p, int64_t v);
+extern int
+jl_printbuf_append_double(struct jl_printbuf *p, double v);
+
 extern int
 jl_sprintbuf(struct jl_printbuf *p, const char *msg, ...);
 
@@ -30,6 +30,7 @@
 
 #include <sys/mdb_modapi.h>
 #include <ck_hs.h>
+#include <pthread.h>
 #include "utils/mtev_skiplist.h"
 #include "utils/mtev_hash.h"
 
@@ -336,146 +337,173 @@ uint32_t __hash(const char *k, uint32_t length, uint32_t initval)
    /*-------------------------------------------- report the result */
    return c;
 }
-static unsigned long
-hs_hash(const void *object, unsigned long seed)
-{
-  const ck_key_t *c = object;
-  unsigned long h;
 
-  h = (unsigned long)__hash((const char *)c, c->len, seed);
+/* Kept behind mtev_hash_table.u.locks.locks; the layout must match. */
+struct hash_shard;
+struct locks_container {
+  void (*lock)(struct locks_container *h);
+  void (*unlock)(struct locks_container *h);
+  union {
+    pthread_mutex_t hs_lock;
+    mtev_spinlock_t hs_spinlock;
+  } locks;
+  struct hash_shard *shards;
+  int nshards;
+  unsigned long presize;
+  int resizing;
+  ck_hs_t resize_hs;
+  ck_hs_iterator_t resize_iter;
+  unsigned long resize_dups;
+};
+
+struct hash_shard {
+  ck_hs_t hs;
+  struct locks_container lc;
+} CK_CC_CACHELINE;
+/* end mtev_hash.c sync section*/
+
+/* Local copies of every entry in a table.  While a table is resizing its
+ * entries are split across the old map and resize_hs, some in both; the
+ * copy in resize_hs is current.  Sharded tables add each shard in turn. */
+struct hash_helper {
+  int size;
+  int alloc;
+  int bucket;
+  ck_hash_attr_t **entries;
+};
+
+/* The keys of resize_hs, so we can skip them in the old map. */
+struct key_set {
+  unsigned long mask;
+  ck_key_t **keys;
+};
+
+static unsigned long
+key_set_hash(const ck_key_t *k) {
+  const unsigned char *p = (const unsigned char *)k;
+  unsigned long h = 2166136261UL;
+  uint32_t i;
+  for(i=0; i<k->len; i++) h = (h ^ p[i]) * 16777619UL;
   return h;
 }
 
-static bool
-hs_compare(const void *previous, const void *compare)
-{
-  const ck_key_t *prev_key = previous;
-  const ck_key_t *cur_key = compare;
+static void
+key_set_add(struct key_set *set, ck_key_t *k) {
+  unsigned long i = key_set_hash(k) & set->mask;
+  while(set->keys[i]) i = (i + 1) & set->mask;
+  set->keys[i] = k;
+}
 
-  if (prev_key->len == cur_key->len) {
-    return memcmp(prev_key, cur_key, prev_key->len) == 0;
+static int
+key_set_has(struct key_set *set, const ck_key_t *k) {
+  unsigned long i;
+  if(set->keys == NULL) return 0;
+  for(i = key_set_hash(k) & set->mask; set->keys[i]; i = (i + 1) & set->mask)
+    if(set->keys[i]->len == k->len && !memcmp(set->keys[i], k, k->len)) return 1;
+  return 0;
+}
+
+static void
+hash_helper_add(struct hash_helper *hh, ck_hash_attr_t *attr) {
+  if(hh->size == hh->alloc) {
+    int nalloc = hh->alloc ? hh->alloc * 2 : 64;
+    ck_hash_attr_t **entries = mdb_zalloc(sizeof(*entries) * nalloc, UM_GC);
+    if(hh->size) memcpy(entries, hh->entries, sizeof(*entries) * hh->size);
+    hh->entries = entries;
+    hh->alloc = nalloc;
   }
-  /* We know they're not equal if they have different lengths */
-  return false;
+  hh->entries[hh->size++] = attr;
 }
 
-int mtev_hash_retrieve2(struct ck_hs_map *hs, ck_key_t *key, void **data) {
-  ck_hash_attr_t *data_struct;
+/* Copy in the entries of one ck_hs map, skipping keys in skip (if any)
+ * and recording the keys copied in record (if any). */
+static int
+hash_collect_map(struct hash_helper *hh, uintptr_t maddr,
+                 struct key_set *skip, struct key_set *record) {
+  struct ck_hs_map map;
+  void **buckets;
+  unsigned long i;
+  size_t offset = ((size_t)&((ck_hash_attr_t *)0)->key);
 
-  if (key) {
-    data_struct = index_attribute_container(key);
-    if (data) {
-      if (data_struct) {
-        *data = data_struct->data;
-      }
-      else {
-        *data = NULL;
-      }
-    }
-    return 1;
+  if(maddr == 0) return 0;
+  if(mdb_vread(&map, sizeof(map), maddr) == -1) return -1;
+  if(map.n_entries == 0) return 0;
+  buckets = mdb_zalloc(sizeof(void *) * map.capacity, UM_GC);
+  if(mdb_vread(buckets, sizeof(void *) * map.capacity, (uintptr_t)map.entries) == -1)
+    return -1;
+  if(record) {
+    unsigned long n = 16;
+    while(n < map.n_entries * 2) n <<= 1;
+    record->mask = n - 1;
+    record->keys = mdb_zalloc(sizeof(*record->keys) * n, UM_GC);
   }
-  else {
-    *data = NULL;
+  for(i=0; i<map.capacity; i++) {
+    uintptr_t kaddr;
+    uint32_t len = 0;
+    ck_hash_attr_t *attr;
+
+    if(buckets[i] == CK_HS_EMPTY || buckets[i] == CK_HS_TOMBSTONE) continue;
+    kaddr = (uintptr_t)CK_HS_VMA(buckets[i]);
+    if(mdb_vread(&len, sizeof(len), kaddr) == -1 || len == 0) continue;
+    /* The object sits before the key */
+    attr = mdb_zalloc(offset + len + 1, UM_GC);
+    if(mdb_vread(attr, offset + len, kaddr - offset) == -1) continue;
+    if(skip && key_set_has(skip, &attr->key)) continue;
+    if(record) key_set_add(record, &attr->key);
+    hash_helper_add(hh, attr);
   }
   return 0;
 }
-/* end mtev_hash.c sync section*/
 
-struct hash_helper {
-  int size;
-  int bucket;
-  void *vmem;
-  mtev_hash_table l;
-};
-static int mtev_hash_walk_init(mdb_walk_state_t *s) {
-  mtev_hash_table l;
-  struct ck_hs_map *map;
-  struct hash_helper *hh;
-  void *dummy;
-  CK_HS_WORD *probe_bound;
-  ck_key_t **buckets;
-  int found = 0;
-
-  map = mdb_zalloc(sizeof(struct ck_hs_map), UM_GC);
-  if(mdb_vread(&l, sizeof(l), s->walk_addr) == -1) {
-    return WALK_ERR;
-  }
-  if(mdb_vread(map, sizeof(struct ck_hs_map), (uintptr_t)l.u.hs.map) == -1) {
-    return WALK_ERR;
-  }
-  probe_bound = mdb_zalloc(sizeof(CK_HS_WORD) * map->n_entries, UM_GC);
-  if (mdb_vread(probe_bound, sizeof(CK_HS_WORD) * map->n_entries, (uintptr_t)map->probe_bound) == -1) {
-    map->probe_bound = NULL;
+static int
+hash_collect_hs(struct hash_helper *hh, ck_hs_t *hs, struct locks_container *lc) {
+  struct key_set fresh = { 0, NULL };
+  if(lc && lc->resizing) {
+    if(hash_collect_map(hh, (uintptr_t)lc->resize_hs.map, NULL, &fresh) == -1)
+      return -1;
+    return hash_collect_map(hh, (uintptr_t)hs->map, &fresh, NULL);
   }
-  else {
-    map->probe_bound = probe_bound;
+  return hash_collect_map(hh, (uintptr_t)hs->map, NULL, NULL);
+}
+
+static struct hash_helper *
+hash_collect(uintptr_t addr) {
+  struct hash_helper *hh;
+  mtev_hash_table l;
+  struct locks_container lc;
+  int i;
+
+  if(mdb_vread(&l, sizeof(l), addr) == -1) return NULL;
+  hh = mdb_zalloc(sizeof(*hh), UM_GC);
+  if(l.u.locks.locks == NULL) {
+    if(hash_collect_hs(hh, &l.u.hs, NULL) == -1) return NULL;
+    return hh;
   }
-  if(map->n_entries == 0) {
-    return WALK_DONE;
+  if(mdb_vread(&lc, sizeof(lc), (uintptr_t)l.u.locks.locks) == -1) return NULL;
+  if(lc.shards) {
+    struct hash_shard *shards = mdb_zalloc(sizeof(*shards) * lc.nshards, UM_GC);
+    if(mdb_vread(shards, sizeof(*shards) * lc.nshards, (uintptr_t)lc.shards) == -1)
+      return NULL;
+    for(i=0; i<lc.nshards; i++)
+      if(hash_collect_hs(hh, &shards[i].hs, &shards[i].lc) == -1) return NULL;
+    return hh;
   }
-  l.u.hs.map = map;
-  l.u.hs.compare = hs_compare;
-  l.u.hs.hf = hs_hash;
-  //l.hs.m = &my_allocator;
-  hh = mdb_zalloc(sizeof(struct hash_helper), UM_GC);
-  hh->l = l;
-  hh->size = map->capacity;
-  buckets = mdb_zalloc(sizeof(void *) * map->capacity, UM_GC);
+  if(hash_collect_hs(hh, &l.u.hs, &lc) == -1) return NULL;
+  return hh;
+}
+
+static int mtev_hash_walk_init(mdb_walk_state_t *s) {
+  struct hash_helper *hh = hash_collect(s->walk_addr);
+  if(hh == NULL) return WALK_ERR;
   s->walk_data = hh;
-  hh->vmem = (void *)map->entries;
-  mdb_vread(buckets, sizeof(void *) * map->capacity, (uintptr_t)hh->vmem);
-  hh->bucket = 0;
-  for(;hh->bucket<hh->size;hh->bucket++) {
-    if (buckets[hh->bucket] != CK_HS_EMPTY && buckets[hh->bucket] != CK_HS_TOMBSTONE) {
-      uint32_t len = 0;
-      int ret = mdb_vread(&len, sizeof(uint32_t), (uintptr_t)buckets[hh->bucket]);
-      if (ret > 0 && len > 0) {
-        /* The object sits before the key */
-        size_t offset = ((size_t)&((ck_hash_attr_t *)0)->key);
-        void *fullkey = mdb_zalloc((size_t)(offset + len + 1), UM_GC);
-        mdb_vread(fullkey, (size_t)len+offset, ((uintptr_t)buckets[hh->bucket])-offset);
-        buckets[hh->bucket] = CK_HS_VMA(fullkey+offset);
-        found++;
-      }
-    }
-    else {
-      buckets[hh->bucket] = NULL;
-    }
-  }
-  map->entries = (void**)buckets;
-  hh->bucket = 0;
-  for(;hh->bucket<hh->size;hh->bucket++) {
-    ck_key_t *key = l.u.hs.map->entries[hh->bucket];
-    if (key && key->len != 0) {
-      void *data = NULL;
-
-      mtev_hash_retrieve2(map, key, &data);
-      s->walk_addr = (uintptr_t)data;
-      s->walk_callback(s->walk_addr, &dummy, s->walk_cbdata);
-      hh->bucket++;
-      return WALK_NEXT;
-    }
-  }
-  return WALK_DONE;
+  return WALK_NEXT;
 }
 static int mtev_hash_walk_step(mdb_walk_state_t *s) {
   void *dummy = NULL;
   struct hash_helper *hh = s->walk_data;
-  mtev_hash_table l = hh->l;
-  if(s->walk_data == NULL) return WALK_DONE;
-  for(;hh->bucket<hh->size;hh->bucket++) {
-    ck_key_t *key = l.u.hs.map->entries[hh->bucket];
-    if (key && key->len != 0) {
-      void *data = NULL;
-
-      mtev_hash_retrieve2(l.u.hs.map, key, &data);
-      s->walk_addr = (uintptr_t)data;
-      s->walk_callback(s->walk_addr, &dummy, s->walk_cbdata);
-      hh->bucket++;
-      return WALK_NEXT;
-    }
-  }
-  return WALK_DONE;
+  if(hh == NULL || hh->bucket >= hh->size) return WALK_DONE;
+  s->walk_addr = (uintptr_t)hh->entries[hh->bucket++]->data;
+  return s->walk_callback(s->walk_addr, &dummy, s->walk_cbdata);
 }
 static void mtev_hash_walk_fini(mdb_walk_state_t *s) {
 }
@@ -489,44 +517,27 @@ _print_hash_bucket_data_cb(uintptr_t addr, const void *u, void *data)
 
 static int
 mtev_log_dcmd(uintptr_t addr, unsigned flags, int argc, const mdb_arg_t *argv) {
-  mtev_hash_table l;
-  struct ck_hs_map map;
-  void **buckets;
-  uintptr_t vmem;
-  int bucket = 0;
-  char logname[128];
+  GElf_Sym sym;
+  struct hash_helper *hh;
+  int i;
 
+  if(mdb_lookup_by_name("mtev_loggers", &sym) == -1) return DCMD_ERR;
   if(argv == 0) {
-    GElf_Sym sym;
     int rv;
-    if(mdb_lookup_by_name("mtev_loggers", &sym) == -1) return DCMD_ERR;
     rv = mdb_pwalk("mtev_hash", _print_hash_bucket_data_cb, NULL, sym.st_value);
     return (rv == WALK_DONE) ? DCMD_OK : DCMD_ERR;
   }
   if(argc != 1 || argv[0].a_type != MDB_TYPE_STRING) {
     return DCMD_USAGE;
   }
-  if(mdb_readsym(&l, sizeof(l), "mtev_loggers") == -1) return DCMD_ERR;
-  if(mdb_vread(&map, sizeof(map), (uintptr_t)l.u.hs.map) == -1) return DCMD_ERR;
-  if(map.n_entries == 0) return DCMD_OK;
-  buckets = mdb_zalloc(sizeof(void *) * map.capacity, UM_GC);
-  vmem = (uintptr_t)map.entries;
-  mdb_vread(buckets, sizeof(void *) * map.capacity, (uintptr_t)vmem);
-  for(;bucket<map.capacity;bucket++) {
-    if(buckets[bucket] != CK_HS_EMPTY && buckets[bucket] != CK_HS_TOMBSTONE) {
-      uint32_t len = 0;
-      size_t offset = ((size_t)&((ck_hash_attr_t *)0)->key);
-      if(mdb_vread(&len, sizeof(uint32_t), (uintptr_t)buckets[bucket]) < 0) return DCMD_ERR;
-      /* The object sits before the key */
-      ck_hash_attr_t *fullkey = mdb_zalloc((size_t)(offset + len + 1), UM_GC);
-      mdb_vread(fullkey, (size_t)len+offset, ((uintptr_t)buckets[bucket])-offset);
-      logname[0] = '\0';
-      memcpy(logname, fullkey->key.label, MIN(sizeof(logname), fullkey->key.len - sizeof(fullkey->key.len)));
-      logname[MIN(len,sizeof(logname)-1)] = '\0';
-      if(!strcmp(logname, argv[0].a_un.a_str)) {
-        mdb_printf("%p\n", fullkey->data);
-        return DCMD_OK;
-      }
+  if((hh = hash_collect(sym.st_value)) == NULL) return DCMD_ERR;
+  for(i=0; i<hh->size; i++) {
+    ck_hash_attr_t *attr = hh->entries[i];
+    size_t namelen = attr->key.len - sizeof(attr->key.len);
+    if(strlen(argv[0].a_un.a_str) == namelen &&
+       !memcmp(attr->key.label, argv[0].a_un.a_str, namelen)) {
+      mdb_printf("%p\n", attr->data);
+      return DCMD_OK;
     }
   }
   return DCMD_OK;
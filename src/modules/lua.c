@@ -452,9 +452,8 @@ static int
 mtev_rest_show_lua_complete(mtev_http_rest_closure_t *restc, int n, char **p) {
   struct lua_reporter *reporter = restc->call_closure;
 
-  mtev_http_response_ok(restc->http_ctx, "application/json");
   pthread_mutex_lock(&reporter->lock);
-  mtev_http_response_append_json(restc->http_ctx, reporter->root);
+  mtev_http_response_json(restc->http_ctx, 200, "OK", reporter->root);
   pthread_mutex_unlock(&reporter->lock);
   mtev_http_response_end(restc->http_ctx);
 
@@ -655,6 +654,21 @@ mtev_lua_resume_clean_events(mtev_lua_resume_info_t *ci) {
   mtevL(nldeb, "cleaned_events( in: %p )\n", ci->coro_state);
 }
 
+mtev_arena_t *
+mtev_lua_resume_info_arena(mtev_lua_resume_info_t *ci) {
+  if(ci->context_magic == LUA_REST_INFO_MAGIC && ci->context_data) {
+    mtev_lua_resume_rest_info_t *ctx = ci->context_data;
+    if(ctx->restc) return mtev_http_rest_arena(ctx->restc);
+  }
+  if(!ci->arena) ci->arena = mtev_arena_create(0);
+  return ci->arena;
+}
+void
+mtev_lua_resume_clean_arena(mtev_lua_resume_info_t *ci) {
+  mtev_arena_destroy(ci->arena);
+  ci->arena = NULL;
+}
+
 void
 mtev_lua_pushmodule(lua_State *L, const char *m) {
   int stack_pos = 0;
@@ -80,6 +80,7 @@ lua_general_ctx_free(void *cl) {
           ri->lmc->lua_state, ri->coro_state);
     mtev_lua_cancel_coro(ri);
     mtev_lua_resume_clean_events(ri);
+    mtev_lua_resume_clean_arena(ri);
     free(ri);
   }
 }
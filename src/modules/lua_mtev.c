@@ -53,19 +53,26 @@
 #include <libxml/HTMLparser.h>
 #include <openssl/md5.h>
 #include <openssl/hmac.h>
+#include <ck_pr.h>
 
 #include "mtev_conf.h"
 #include "mtev_reverse_socket.h"
 #include "mtev_xml.h"
 #include "mtev_log.h"
+#include "mtev_memory.h"
 #include "mtev_str.h"
 #include "mtev_b32.h"
 #include "mtev_b64.h"
+#include "mtev_uuid_parse.h"
 #include "mtev_lockfile.h"
 #include "eventer/eventer.h"
 #include "mtev_json.h"
+#include "mtev_json_ondemand.h"
+#include "mtev_msgpack.h"
 #include "mtev_watchdog.h"
 #include "mtev_cluster.h"
+#include "mtev_http_client.h"
+#include "mtev_hyperloglog.h"
 
 #define LUA_COMPAT_MODULE
 #include "lua_mtev.h"
@@ -74,27 +81,13 @@
 #define nlerr mtev_lua_error_ls
 
 static mtev_hash_table shared_table = MTEV_HASH_EMPTY;
-static pthread_mutex_t shared_table_mutex;
 
 
+/* values in shared_table are MessagePack encodings */
 typedef struct {
-  mtev_hash_table string_keys;
-  mtev_hash_table int_keys;
-} mtev_lua_table_t;
-
-typedef struct {
-  int lua_type; // see lua.h (LUA_TNIL, LUA_TNUMBER, LUA_TBOOLEAN, LUA_TSTRING, LUA_TTABLE, LUA_TFUNCTION, LUA_TUSERDATA, LUA_TTHREAD, and LUA_TLIGHTUSERDATA)
-  union {
-    lua_Number number;
-    mtev_boolean boolean;
-    char *string;
-    mtev_lua_table_t* table;
-  } value;
-} lua_data_t;
-
-static lua_data_t* mtev_lua_serialize(lua_State *L, int index);
-void mtev_lua_deserialize(lua_State *L, const lua_data_t *data);
-static void mtev_lua_free_data(void *vdata);
+  size_t len;
+  uint8_t data[1];
+} lua_shared_value_t;
 
 #define DEFLATE_CHUNK_SIZE 32768
 #define ON_STACK_LUA_STRLEN 2048
@@ -119,6 +112,7 @@ static void mtev_lua_free_data(void *vdata);
 typedef struct {
   mtev_json_tokener *tok;
   mtev_json_object *root;
+  mtev_json_doc_t *fdoc;
 } json_crutch;
 
 static void
@@ -2247,8 +2241,17 @@ static int
 nl_uuid(lua_State *L) {
   uuid_t out;
   char uuid_str[UUID_STR_LEN+1];
-  uuid_generate(out);
-  uuid_unparse_lower(out, uuid_str);
+  mtev_uuid_generate(out);
+  mtev_uuid_unparse_lower(out, uuid_str);
+  lua_pushstring(L, uuid_str);
+  return 1;
+}
+static int
+nl_uuid_v7(lua_State *L) {
+  uuid_t out;
+  char uuid_str[UUID_STR_LEN+1];
+  mtev_uuid_generate_v7(out);
+  mtev_uuid_unparse_lower(out, uuid_str);
   lua_pushstring(L, uuid_str);
   return 1;
 }
@@ -2478,6 +2481,118 @@ mtev_lua_gunzip_gc(lua_State *L) {
   return 0;
 }
 
+static mtev_hyperloglog_t *
+mtev_lua_hll_self(lua_State *L) {
+  mtev_hyperloglog_t **hllptr;
+  /* the first arg is implicitly self (it's a method) */
+  hllptr = lua_touserdata(L, lua_upvalueindex(1));
+  if(hllptr != lua_touserdata(L, 1))
+    luaL_error(L, "must be called as method");
+  return *hllptr;
+}
+static void
+mtev_lua_hll_push(lua_State *L, mtev_hyperloglog_t *hll) {
+  mtev_hyperloglog_t **hllptr;
+  hllptr = (mtev_hyperloglog_t **)lua_newuserdata(L, sizeof(hll));
+  *hllptr = hll;
+  luaL_getmetatable(L, "mtev.hyperloglog");
+  lua_setmetatable(L, -2);
+}
+static int
+mtev_lua_hll_add(lua_State *L) {
+  int i;
+  const char *data;
+  size_t len;
+  mtev_hyperloglog_t *hll = mtev_lua_hll_self(L);
+  for(i=2; i<=lua_gettop(L); i++) {
+    data = luaL_checklstring(L, i, &len);
+    mtev_hyperloglog_add(hll, data, len);
+  }
+  return 0;
+}
+static int
+mtev_lua_hll_size(lua_State *L) {
+  lua_pushnumber(L, mtev_hyperloglog_size(mtev_lua_hll_self(L)));
+  return 1;
+}
+static int
+mtev_lua_hll_merge(lua_State *L) {
+  mtev_hyperloglog_t **other;
+  mtev_hyperloglog_t *hll = mtev_lua_hll_self(L);
+  other = luaL_checkudata(L, 2, "mtev.hyperloglog");
+  if(mtev_hyperloglog_merge(hll, *other) != 0)
+    luaL_error(L, "hyperloglogs must have the same bitcount to merge");
+  return 0;
+}
+static int
+mtev_lua_hll_serialize(lua_State *L) {
+  mtev_hyperloglog_t *hll = mtev_lua_hll_self(L);
+  size_t len = mtev_hyperloglog_serialized_size(hll);
+  char *buf = malloc(len);
+  mtevAssert(mtev_hyperloglog_serialize(hll, buf, len) == (ssize_t)len);
+  lua_pushlstring(L, buf, len);
+  free(buf);
+  return 1;
+}
+static int
+mtev_lua_hll_index_func(lua_State *L) {
+  const char *k;
+  mtev_hyperloglog_t **udata;
+  mtevAssert(lua_gettop(L) == 2);
+  if(!luaL_checkudata(L, 1, "mtev.hyperloglog")) {
+    luaL_error(L, "metatable error, arg1 not a mtev.hyperloglog!");
+  }
+  udata = lua_touserdata(L, 1);
+  if(!lua_isstring(L, 2)) {
+    luaL_error(L, "metatable error, arg2 not a string!");
+  }
+  k = lua_tostring(L, 2);
+  switch(*k) {
+    case 'a':
+     LUA_DISPATCH(add, mtev_lua_hll_add);
+     break;
+    case 'm':
+     LUA_DISPATCH(merge, mtev_lua_hll_merge);
+     break;
+    case 's':
+     LUA_DISPATCH(size, mtev_lua_hll_size);
+     LUA_DISPATCH(serialize, mtev_lua_hll_serialize);
+     break;
+    default:
+     break;
+  }
+  luaL_error(L, "mtev.hyperloglog no such element: %s", k);
+  return 0;
+}
+static int
+mtev_lua_hll_gc(lua_State *L) {
+  mtev_hyperloglog_t **hllptr;
+  hllptr = (mtev_hyperloglog_t **)lua_touserdata(L,1);
+  mtev_hyperloglog_destroy(*hllptr);
+  return 0;
+}
+static int
+nl_hyperloglog(lua_State *L) {
+  mtev_hyperloglog_t *hll;
+  int bitcount = luaL_optinteger(L, 1, 14);
+  if(NULL == (hll = mtev_hyperloglog_alloc(bitcount)))
+    luaL_error(L, "hyperloglog bitcount must be between 4 and 20");
+  mtev_lua_hll_push(L, hll);
+  return 1;
+}
+static int
+nl_hyperloglog_deserialize(lua_State *L) {
+  mtev_hyperloglog_t *hll;
+  size_t len;
+  const char *buf = luaL_checklstring(L, 1, &len);
+  if(NULL == (hll = mtev_hyperloglog_deserialize(buf, len))) {
+    lua_pushnil(L);
+    return 1;
+  }
+  mtev_lua_hll_push(L, hll);
+  return 1;
+}
+
 struct pcre_global_info {
   pcre *re;
   int offset;
@@ -3100,6 +3215,11 @@ mtev_lua_json_tostring(lua_State *L) {
   if(docptr != lua_touserdata(L, 1))
     luaL_error(L, "must be called as method");
   if(n != 1) luaL_error(L, "expects no arguments, got %d", n - 1);
+  /* parsed documents only become objects when they are serialized */
+  if(!(*docptr)->root && (*docptr)->fdoc &&
+     !mtev_json_value_to_object(mtev_json_doc_root((*docptr)->fdoc),
+                                &(*docptr)->root))
+    luaL_error(L, "invalid JSON string");
   jsonstring = mtev_json_object_to_json_string((*docptr)->root);
   lua_pushstring(L, jsonstring);
   /* jsonstring is freed with the root object later */
@@ -3169,6 +3289,85 @@ mtev_json_object_to_luatype(lua_State *L, mtev_json_object *o) {
   }
   return 1;
 }
+static int
+mtev_json_value_to_luatype(lua_State *L, mtev_json_value_t v) {
+  mtev_json_iter_t it;
+  mtev_json_value_t key, val;
+  const char *str;
+  size_t len;
+  int64_t i64;
+  uint64_t u64;
+  double dbl = 0;
+  mtev_boolean b = mtev_false;
+  char istr[64];
+
+  /* documents may nest MTEV_JSON_DOC_MAX_DEPTH deep */
+  luaL_checkstack(L, 3, "JSON document too deep");
+  switch(mtev_json_value_type(v)) {
+    case mtev_json_type_null: lua_pushnil(L); break;
+    case mtev_json_type_object:
+      lua_createtable(L, 0, mtev_json_value_length(v));
+      it = mtev_json_value_iter(v);
+      while(mtev_json_iter_next(&it, &key, &val)) {
+        str = mtev_json_value_raw(key, &len);
+        if(memchr(str, '\\', len)) {
+          if(!(str = mtev_json_value_string(key, &len)))
+            luaL_error(L, "invalid JSON string");
+        }
+        lua_pushlstring(L, str, len);
+        mtev_json_value_to_luatype(L, val);
+        lua_settable(L, -3);
+      }
+      break;
+    case mtev_json_type_array:
+    {
+      int i = 0;
+      lua_createtable(L, mtev_json_value_length(v), 0);
+      it = mtev_json_value_iter(v);
+      while(mtev_json_iter_next(&it, NULL, &val)) {
+        mtev_json_value_to_luatype(L, val);
+        lua_rawseti(L, -2, ++i);
+      }
+      break;
+    }
+    case mtev_json_type_string:
+      /* unescaped strings are pushed straight from the input */
+      str = mtev_json_value_raw(v, &len);
+      if(memchr(str, '\\', len)) {
+        if(!(str = mtev_json_value_string(v, &len)))
+          luaL_error(L, "invalid JSON string");
+      }
+      lua_pushlstring(L, str, len);
+      break;
+    case mtev_json_type_boolean:
+      mtev_json_value_boolean(v, &b);
+      lua_pushboolean(L, b);
+      break;
+    case mtev_json_type_double:
+      mtev_json_value_double(v, &dbl);
+      lua_pushnumber(L, dbl);
+      break;
+    case mtev_json_type_int:
+      /* as mtev_json_object_to_luatype: wide integers become strings */
+      if(mtev_json_value_int64(v, &i64)) {
+        if(i64 >= INT_MIN && i64 <= INT_MAX) lua_pushnumber(L, i64);
+        else {
+          snprintf(istr, sizeof(istr), "%" PRId64, i64);
+          lua_pushstring(L, istr);
+        }
+      }
+      else if(mtev_json_value_uint64(v, &u64)) {
+        snprintf(istr, sizeof(istr), "%" PRIu64, u64);
+        lua_pushstring(L, istr);
+      }
+      else {
+        mtev_json_value_double(v, &dbl);
+        lua_pushnumber(L, dbl);
+      }
+      break;
+  }
+  return 1;
+}
 /*! \lua obj = mtev.json:document()
     \brief return a lua prepresentation of an `mtev.json` object
     \return a lua object (usually a table)
@@ -3186,8 +3385,49 @@ mtev_lua_json_document(lua_State *L) {
   if(docptr != lua_touserdata(L, 1))
     luaL_error(L, "must be called as method");
   if(n != 1) luaL_error(L, "expects no arguments, got %d", n - 1);
+  if((*docptr)->fdoc)
+    return mtev_json_value_to_luatype(L, mtev_json_doc_root((*docptr)->fdoc));
   return mtev_json_object_to_luatype(L, (*docptr)->root);
 }
+/*! \lua obj = mtev.json:get(path)
+    \brief return a lua representation of part of an `mtev.json` object
+    \param path a path of the form `a.b[2].c`
+    \return a lua object or nil if the path does not exist
+
+    Only the addressed part of the document is converted.  For a parsed
+    document this avoids converting the whole document with `document()`.
+*/
+static int
+mtev_lua_json_get(lua_State *L) {
+  int n;
+  json_crutch **docptr, *doc;
+  const char *path;
+  mtev_json_value_t v;
+  n = lua_gettop(L);
+  /* the first arg is implicitly self (it's a method) */
+  docptr = lua_touserdata(L, lua_upvalueindex(1));
+  if(docptr != lua_touserdata(L, 1))
+    luaL_error(L, "must be called as method");
+  if(n != 2) luaL_error(L, "expects one argument, got %d", n - 1);
+  path = luaL_checkstring(L, 2);
+  doc = *docptr;
+  if(!doc->fdoc && doc->root) {
+    /* documents from mtev.tojson are indexed on first use */
+    const char *str = mtev_json_object_to_json_string(doc->root);
+    doc->fdoc = mtev_json_doc_parse(str, strlen(str), MTEV_JSON_DOC_COPY,
+                                    NULL, NULL);
+  }
+  if(!doc->fdoc) {
+    lua_pushnil(L);
+    return 1;
+  }
+  v = mtev_json_value_path(mtev_json_doc_root(doc->fdoc), path);
+  if(!mtev_json_value_exists(v)) {
+    lua_pushnil(L);
+    return 1;
+  }
+  return mtev_json_value_to_luatype(L, v);
+}
 static mtev_boolean
 mtev_lua_guess_is_array(lua_State *L, int idx) {
   mtev_boolean rv = mtev_true;
@@ -3286,23 +3526,31 @@ nl_tojson(lua_State *L) {
 static int
 nl_parsejson(lua_State *L) {
   json_crutch **docptr, *doc;
-  const char *in;
-  size_t inlen;
+  const char *in, *err = NULL;
+  size_t inlen, erroff = 0;
 
   if(lua_gettop(L) != 1) luaL_error(L, "parsejson requires one argument"); 
 
   in = lua_tolstring(L, 1, &inlen);
   doc = calloc(1, sizeof(*doc));
-  doc->tok = mtev_json_tokener_new();
-  doc->root = mtev_json_tokener_parse_ex(doc->tok, in, inlen);
-  if(doc->tok->err != mtev_json_tokener_success) {
-    lua_pushnil(L);
-    lua_pushstring(L, mtev_json_tokener_errors[doc->tok->err]);
-    lua_pushinteger(L, doc->tok->char_offset);
-    mtev_json_tokener_free(doc->tok);
-    if(doc->root) mtev_json_object_put(doc->root);
-    free(doc);
-    return 3;
+  doc->fdoc = mtev_json_doc_parse(in, inlen,
+                                  MTEV_JSON_DOC_COPY | MTEV_JSON_DOC_VALIDATE,
+                                  &err, &erroff);
+  if(!doc->fdoc) {
+    /* Not strict JSON: the tokener has always accepted comments, single
+     * quoted strings and trailing data, and its errors are what callers
+     * have come to expect. */
+    doc->tok = mtev_json_tokener_new();
+    doc->root = mtev_json_tokener_parse_ex(doc->tok, in, inlen);
+    if(doc->tok->err != mtev_json_tokener_success) {
+      lua_pushnil(L);
+      lua_pushstring(L, mtev_json_tokener_errors[doc->tok->err]);
+      lua_pushinteger(L, doc->tok->char_offset);
+      mtev_json_tokener_free(doc->tok);
+      if(doc->root) mtev_json_object_put(doc->root);
+      free(doc);
+      return 3;
+    }
   }
 
   docptr = (json_crutch **)lua_newuserdata(L, sizeof(doc)); 
@@ -3317,6 +3565,7 @@ mtev_lua_json_gc(lua_State *L) {
   json = (json_crutch **)lua_touserdata(L,1);
   if((*json)->tok) mtev_json_tokener_free((*json)->tok);
   if((*json)->root) mtev_json_object_put((*json)->root);
+  if((*json)->fdoc) mtev_json_doc_free((*json)->fdoc);
   free(*json);
   return 0;
 }
@@ -3339,6 +3588,9 @@ mtev_json_index_func(lua_State *L) {
     case 'd':
      LUA_DISPATCH(document, mtev_lua_json_document);
      break;
+    case 'g':
+     LUA_DISPATCH(get, mtev_lua_json_get);
+     break;
     case 't':
      LUA_DISPATCH(tostring, mtev_lua_json_tostring);
      break;
@@ -3741,208 +3993,277 @@ mtev_lua_process_gc(lua_State *L) {
   return 0;
 }
 
-static void
-mtev_lua_free_table(void *vtable) {
-  mtev_lua_table_t* table = vtable;
-  mtev_hash_destroy(&table->string_keys, free, mtev_lua_free_data);
-  mtev_hash_destroy(&table->int_keys, free, mtev_lua_free_data);
-  free(table);
-}
+/* Encodes the value at idx; on failure returns mtev_false with a message
+ * in err, leaving the buffer to be destroyed by the caller (raising a lua
+ * error here would leak it). */
+static mtev_boolean
+mtev_lua_msgpack_pack(lua_State *L, int idx, mtev_dyn_buffer_t *buf,
+                      int depth, char *err, size_t errlen) {
+  const char *str;
+  size_t len;
+  lua_Number num;
 
-static void
-mtev_lua_free_data(void *vdata) {
-  lua_data_t* data = vdata;
-  switch(data->lua_type){
-    case(LUA_TSTRING):
-      free(data->value.string);
+  if(idx < 0) idx = lua_gettop(L) + idx + 1;
+  switch(lua_type(L, idx)) {
+    case LUA_TNIL:
+      mtev_msgpack_pack_nil(buf);
       break;
-    case(LUA_TTABLE):
-      mtev_lua_free_table(data->value.table);
-    break;
-  }
-
-  free(data);
-}
-
-static mtev_lua_table_t*
-mtev_lua_serialize_table(lua_State *L, int index) {
-  mtev_lua_table_t *table;
-  lua_data_t *value;
-  lua_Number number_key;
-  char* number_key_str;
-  const char* string_key;
-  size_t string_key_len;
-
-  if(index < 0) {
-    index = lua_gettop(L) + index + 1;
-  }
-
-  lua_getfield (L, index, "serialize"); // -1: serialize
-  if(lua_isfunction(L, -1)) {
-
-    lua_pushvalue(L, index); // -2: serialize -1: self
-    lua_call(L, 1, 1); // -1: result
-    if(!lua_istable(L, -1)) {
-      luaL_error(L, "serialize() must return a table\n");
-      return NULL;
-    }
-    return mtev_lua_serialize_table(L, -1);
-  } else {
-    lua_pop(L, 1);
-  }
+    case LUA_TBOOLEAN:
+      mtev_msgpack_pack_boolean(buf, lua_toboolean(L, idx) ? mtev_true : mtev_false);
+      break;
+    case LUA_TNUMBER:
+      /* integral numbers take the compact integer encodings */
+      num = lua_tonumber(L, idx);
+      if(num == floor(num) &&
+         num >= -9223372036854775808.0 && num < 9223372036854775808.0)
+        mtev_msgpack_pack_int64(buf, (int64_t)num);
+      else
+        mtev_msgpack_pack_double(buf, num);
+      break;
+    case LUA_TSTRING:
+      str = lua_tolstring(L, idx, &len);
+      mtev_msgpack_pack_str(buf, str, len);
+      break;
+    case LUA_TTABLE:
+    {
+      uint32_t count = 0;
+      lua_Number maxkey = 0;
+      mtev_boolean ok = mtev_true, is_array = mtev_true;
+
+      if(depth >= MTEV_MSGPACK_MAX_DEPTH) {
+        snprintf(err, errlen, "Cannot serialize tables nested deeper than %d",
+                 MTEV_MSGPACK_MAX_DEPTH);
+        return mtev_false;
+      }
+      if(!lua_checkstack(L, 4)) {
+        snprintf(err, errlen, "Cannot serialize: out of stack space");
+        return mtev_false;
+      }
+      lua_getfield(L, idx, "serialize");
+      if(lua_isfunction(L, -1)) {
+        lua_pushvalue(L, idx);
+        if(lua_pcall(L, 1, 1, 0) != 0) {
+          snprintf(err, errlen, "serialize() failed: %s",
+                   lua_isstring(L, -1) ? lua_tostring(L, -1) : "unknown error");
+          lua_pop(L, 1);
+          return mtev_false;
+        }
+        if(!lua_istable(L, -1)) {
+          snprintf(err, errlen, "serialize() must return a table");
+          lua_pop(L, 1);
+          return mtev_false;
+        }
+        ok = mtev_lua_msgpack_pack(L, -1, buf, depth + 1, err, errlen);
+        lua_pop(L, 1);
+        return ok;
+      }
+      lua_pop(L, 1);
 
-  table = calloc(1, sizeof(mtev_lua_table_t));
-  mtev_hash_init(&table->int_keys);
-  mtev_hash_init(&table->string_keys);
-  lua_pushnil(L); // first key
-  while (lua_next(L, index) != 0) {
-    int key_index = lua_gettop(L) - 1;
-    value = mtev_lua_serialize(L, -1);
-
-    if(lua_isnumber(L, key_index)) {
-      number_key = lua_tonumber(L, key_index);
-      number_key_str = malloc(sizeof(lua_Number));
-      memcpy(number_key_str, &number_key, sizeof(lua_Number));
-      mtev_hash_store(&table->int_keys, number_key_str, sizeof(lua_Number), value);
-
-    } else if(lua_isstring(L, key_index)) {
-      string_key = lua_tolstring(L, key_index, &string_key_len);
-      mtev_hash_store(&table->string_keys, strdup(string_key), string_key_len, value);
-    } else {
-      mtev_lua_free_table(table);
-      luaL_error(L, "Cannot serialize tables with anything but strings and numbers as keys, got %s instead\n", lua_typename(L, lua_type(L, key_index)));
-      return NULL;
+      /* a sequence 1..n is an array, anything else a map */
+      lua_pushnil(L);
+      while(lua_next(L, idx) != 0) {
+        int ktype = lua_type(L, -2);
+        if(ktype == LUA_TNUMBER) {
+          lua_Number k = lua_tonumber(L, -2);
+          if(k < 1 || k != floor(k)) is_array = mtev_false;
+          else if(k > maxkey) maxkey = k;
+        }
+        else if(ktype == LUA_TSTRING) is_array = mtev_false;
+        else {
+          snprintf(err, errlen, "Cannot serialize tables with anything but "
+                   "strings and numbers as keys, got %s instead",
+                   lua_typename(L, ktype));
+          lua_pop(L, 2);
+          return mtev_false;
+        }
+        count++;
+        lua_pop(L, 1);
+      }
+      if(is_array && maxkey == count) {
+        uint32_t i;
+        mtev_msgpack_pack_array(buf, count);
+        for(i = 1; ok && i <= count; i++) {
+          lua_rawgeti(L, idx, i);
+          ok = mtev_lua_msgpack_pack(L, -1, buf, depth + 1, err, errlen);
+          lua_pop(L, 1);
+        }
+        return ok;
+      }
+      mtev_msgpack_pack_map(buf, count);
+      lua_pushnil(L);
+      while(lua_next(L, idx) != 0) {
+        if(!mtev_lua_msgpack_pack(L, -2, buf, depth + 1, err, errlen) ||
+           !mtev_lua_msgpack_pack(L, -1, buf, depth + 1, err, errlen)) {
+          lua_pop(L, 2);
+          return mtev_false;
+        }
+        lua_pop(L, 1);
+      }
+      break;
     }
-
-    lua_pop(L, 1); //remove value, keep key for next iteration
-    lua_settop(L, index+1); // remove everything above the last key
+    default:
+      /* as nil, so the key is elided when read back */
+      mtevL(nlerr, "Cannot serialize unsupported lua type %s\n",
+            lua_typename(L, lua_type(L, idx)));
+      mtev_msgpack_pack_nil(buf);
+      break;
   }
-
-  return table;
+  return mtev_true;
 }
 
-static lua_data_t*
-mtev_lua_serialize(lua_State *L, int index){
-  lua_data_t *data;
-  int type;
-  type = lua_type(L, index);
-
-  if(type == LUA_TNIL) {
-    return NULL;
-  }
-
-  data = calloc(1, sizeof(lua_data_t));
-  data->lua_type = type;
-
-  switch(type){
-    case(LUA_TNUMBER):
-      data->value.number = lua_tonumber(L, index);
+/* Pushes one decoded value; on failure the stack above the starting top
+ * is left for the caller to discard. */
+static mtev_boolean
+mtev_lua_msgpack_unpack(lua_State *L, mtev_msgpack_reader_t *r, int depth) {
+  mtev_msgpack_item_t item;
+  uint32_t i;
+
+  if(!lua_checkstack(L, 3)) return mtev_false;
+  if(!mtev_msgpack_read(r, &item)) return mtev_false;
+  switch(item.type) {
+    case MTEV_MSGPACK_NIL:
+      lua_pushnil(L);
       break;
-    case(LUA_TSTRING):
-      data->value.string = strdup(lua_tostring(L, index));
+    case MTEV_MSGPACK_BOOLEAN:
+      lua_pushboolean(L, item.v.boolean);
       break;
-    case(LUA_TBOOLEAN):
-      data->value.boolean = lua_toboolean(L, index);
+    case MTEV_MSGPACK_INT:
+      lua_pushnumber(L, (lua_Number)item.v.i64);
       break;
-    case(LUA_TTABLE):
-      data->value.table = mtev_lua_serialize_table(L, index);
+    case MTEV_MSGPACK_UINT:
+      lua_pushnumber(L, (lua_Number)item.v.u64);
+      break;
+    case MTEV_MSGPACK_DOUBLE:
+      lua_pushnumber(L, item.v.dbl);
+      break;
+    case MTEV_MSGPACK_STR:
+    case MTEV_MSGPACK_BIN:
+      lua_pushlstring(L, item.v.str.ptr, item.v.str.len);
+      break;
+    case MTEV_MSGPACK_EXT:
+      return mtev_false;
+    case MTEV_MSGPACK_ARRAY:
+      if(depth >= MTEV_MSGPACK_MAX_DEPTH) return mtev_false;
+      lua_createtable(L, MIN(item.v.count, mtev_msgpack_reader_remaining(r)), 0);
+      for(i = 0; i < item.v.count; i++) {
+        if(!mtev_lua_msgpack_unpack(L, r, depth + 1)) return mtev_false;
+        if(lua_isnil(L, -1)) lua_pop(L, 1);
+        else lua_rawseti(L, -2, i + 1);
+      }
+      break;
+    case MTEV_MSGPACK_MAP:
+      if(depth >= MTEV_MSGPACK_MAX_DEPTH) return mtev_false;
+      lua_createtable(L, 0, MIN(item.v.count, mtev_msgpack_reader_remaining(r)));
+      for(i = 0; i < item.v.count; i++) {
+        if(!mtev_lua_msgpack_unpack(L, r, depth + 1) ||
+           !mtev_lua_msgpack_unpack(L, r, depth + 1)) return mtev_false;
+        /* lua tables hold neither nil keys or values, nor NaN keys */
+        if(lua_isnil(L, -2) || lua_isnil(L, -1) ||
+           (lua_type(L, -2) == LUA_TNUMBER && isnan(lua_tonumber(L, -2))))
+          lua_pop(L, 2);
+        else lua_rawset(L, -3);
+      }
       break;
-    case(LUA_TNIL): // we already returned NULL
-    default: 
-      free(data);
-      mtevL(nlerr, "Cannot serialize unsupported lua type %d\n", type);
   }
-
-  return data;
+  return mtev_true;
 }
 
-void
-mtev_lua_deserialize_table(lua_State *L, mtev_lua_table_t *table){
-  lua_Number number_key;
-  mtev_hash_iter int_iter = MTEV_HASH_ITER_ZERO;
-  mtev_hash_iter str_iter = MTEV_HASH_ITER_ZERO;
-
-  lua_createtable(L, 0, mtev_hash_size(&table->string_keys) + mtev_hash_size(&table->int_keys));
-
-  while(mtev_hash_adv(&table->int_keys, &int_iter)) {
-    number_key = *(lua_Number*)int_iter.key.ptr;
-    lua_pushnumber(L, number_key);
-    mtev_lua_deserialize(L, (lua_data_t *)int_iter.value.ptr);
-    lua_settable(L, -3);
-  }
+static int
+nl_tomsgpack(lua_State *L) {
+  mtev_dyn_buffer_t buf;
+  char err[256];
+  if(lua_gettop(L) != 1) luaL_error(L, "tomsgpack requires one argument");
+  mtev_dyn_buffer_init(&buf);
+  if(!mtev_lua_msgpack_pack(L, 1, &buf, 0, err, sizeof(err))) {
+    mtev_dyn_buffer_destroy(&buf);
+    luaL_error(L, "%s", err);
+  }
+  lua_pushlstring(L, (const char *)mtev_dyn_buffer_data(&buf),
+                  mtev_dyn_buffer_used(&buf));
+  mtev_dyn_buffer_destroy(&buf);
+  return 1;
+}
 
-  while(mtev_hash_adv(&table->string_keys, &str_iter)) {
-    lua_pushstring(L, str_iter.key.str);
-    mtev_lua_deserialize(L, (lua_data_t *)str_iter.value.ptr);
-    lua_settable(L, -3);
+static int
+nl_frommsgpack(lua_State *L) {
+  mtev_msgpack_reader_t r;
+  const char *in;
+  size_t inlen;
+  int top;
+  if(lua_gettop(L) != 1) luaL_error(L, "frommsgpack requires one argument");
+  in = luaL_checklstring(L, 1, &inlen);
+  mtev_msgpack_reader_init(&r, in, inlen);
+  top = lua_gettop(L);
+  if(!mtev_lua_msgpack_unpack(L, &r, 0) ||
+     mtev_msgpack_reader_remaining(&r) != 0) {
+    lua_settop(L, top);
+    lua_pushnil(L);
+    lua_pushstring(L, "invalid msgpack");
+    return 2;
   }
+  return 1;
 }
 
-void
-mtev_lua_deserialize(lua_State *L, const lua_data_t *data){
-  switch(data->lua_type){
-    case(LUA_TNUMBER):
-      lua_pushnumber(L, data->value.number);
-      break;
-    case(LUA_TSTRING):
-      lua_pushstring(L, data->value.string);
-      break;
-    case(LUA_TBOOLEAN):
-      lua_pushboolean(L, data->value.boolean);
-      break;
-    case(LUA_TTABLE):
-      // 
-      mtev_lua_deserialize_table(L, data->value.table);
-      break;
-    case(LUA_TNIL): // we already returned NULL
-    default: 
-      mtevL(nlerr, "Cannot deserialize unsupported lua type %d\n", data->lua_type);
-  }
+/* shared_get deserializes values without a lock, so values leaving
+ * the shared table are only freed once no reader can be using them. */
+static void
+shared_data_retire(void *vdata) {
+  mtev_memory_defer_free(vdata, free);
 }
 
 static int
 nl_shared_set(lua_State *L) {
-  void* vdata;
-  lua_data_t *data;
+  lua_shared_value_t *data;
+  mtev_dyn_buffer_t buf;
+  char err[256];
   size_t key_len;
   const char *key;
   if(lua_gettop(L) != 2 || !lua_isstring(L,1))
     return luaL_error(L, "bad parameters to mtev.shared_set(str, str)");
   key = lua_tolstring(L, 1, &key_len);
 
-  data = mtev_lua_serialize(L, 2);
-  pthread_mutex_lock(&shared_table_mutex);
-  if(!mtev_hash_retrieve(&shared_table, key, key_len, &vdata)) {
-    if(data != NULL) {
-      mtev_hash_store(&shared_table, strdup(key), key_len, data);
-    }
-  } else {
-    if(lua_isnil(L,2)) {
-      mtev_hash_delete(&shared_table, key, key_len, free, mtev_lua_free_data);
-    } else {
-      mtev_hash_replace(&shared_table, strdup(key), key_len, data, free, mtev_lua_free_data);
-    }
+  if(lua_isnil(L, 2)) {
+    mtev_hash_delete(&shared_table, key, key_len, free, shared_data_retire);
+    return 0;
+  }
+  mtev_dyn_buffer_init(&buf);
+  if(!mtev_lua_msgpack_pack(L, 2, &buf, 0, err, sizeof(err))) {
+    mtev_dyn_buffer_destroy(&buf);
+    return luaL_error(L, "%s", err);
   }
-  pthread_mutex_unlock(&shared_table_mutex);
+  data = malloc(sizeof(*data) + mtev_dyn_buffer_used(&buf));
+  data->len = mtev_dyn_buffer_used(&buf);
+  memcpy(data->data, mtev_dyn_buffer_data(&buf), data->len);
+  mtev_dyn_buffer_destroy(&buf);
+  mtev_hash_replace(&shared_table, strdup(key), key_len, data, free, shared_data_retire);
 
   return 0;
 }
 
 static int
 nl_shared_get(lua_State *L) {
-  lua_data_t *data;
+  lua_shared_value_t *data;
+  mtev_msgpack_reader_t r;
   size_t len;
   const char *key;
+  int top;
   if(lua_gettop(L) != 1 || !lua_isstring(L,1))
     return luaL_error(L, "bad parameters to mtev.shared_get(str)");
   key = lua_tolstring(L, 1, &len);
-  pthread_mutex_lock(&shared_table_mutex);
+  top = lua_gettop(L);
+  mtev_memory_begin();
   if(!mtev_hash_retrieve(&shared_table, key, len, (void**)&data)) {
     lua_pushnil(L);
   } else {
-    mtev_lua_deserialize(L, data);
+    mtev_msgpack_reader_init(&r, data->data, data->len);
+    if(!mtev_lua_msgpack_unpack(L, &r, 0)) {
+      /* we encoded it ourselves, so this is not expected */
+      mtevL(nlerr, "Cannot deserialize shared value '%s'\n", key);
+      lua_settop(L, top);
+      lua_pushnil(L);
+    }
   }
-  pthread_mutex_unlock(&shared_table_mutex);
+  mtev_memory_end();
 
   return 1;
 }
@@ -3957,6 +4278,224 @@ nl_cancel_coro(lua_State *L) {
   return 0;
 }
 
+struct nl_http_client_cl {
+  void (*free)(void *);
+  lua_State *L;
+  mtev_lua_resume_info_t *ci;
+  /* copied from ci: the completion path must not touch ci, which is gone
+   * once the coroutine is cancelled */
+  pthread_t bound_thread;
+  eventer_t guard;
+  mtev_http_client_request_t *req;
+  mtev_http_client_error_t err;
+  mtev_atomic32_t refcnt;
+  uint32_t cancelled;
+  mtev_boolean in_send;
+  mtev_boolean completed_inline;
+};
+
+static void
+nl_http_client_cl_release(struct nl_http_client_cl *cl) {
+  if(mtev_atomic_dec32(&cl->refcnt) == 0) {
+    mtev_http_client_request_free(cl->req);
+    free(cl);
+  }
+}
+
+/* Called when the coroutine is torn down with the request outstanding. */
+static void
+nl_http_client_cl_cancel(void *vcl) {
+  struct nl_http_client_cl *cl = vcl;
+  ck_pr_store_32(&cl->cancelled, 1);
+  nl_http_client_cl_release(cl);
+}
+
+/* Push the results for the coroutine; returns the number pushed. */
+static int
+nl_http_client_push_results(struct nl_http_client_cl *cl) {
+  lua_State *L = cl->L;
+  int nargs;
+
+  mtev_lua_deregister_event(cl->ci, cl->guard, 0);
+  eventer_free(cl->guard);
+  cl->guard = NULL;
+
+  if(cl->err != MTEV_HTTP_CLIENT_OK) {
+    lua_pushnil(L);
+    lua_pushstring(L, mtev_http_client_strerror(cl->err));
+    nargs = 2;
+  }
+  else {
+    mtev_hash_iter iter = MTEV_HASH_ITER_ZERO;
+    const struct bchain *b;
+    luaL_Buffer buf;
+
+    lua_pushinteger(L, mtev_http_client_response_status(cl->req));
+    lua_newtable(L);
+    while(mtev_hash_adv(mtev_http_client_response_headers(cl->req), &iter)) {
+      lua_pushlstring(L, iter.key.str, iter.klen);
+      lua_pushstring(L, iter.value.str);
+      lua_settable(L, -3);
+    }
+    luaL_buffinit(L, &buf);
+    for(b = mtev_http_client_response_body(cl->req, NULL); b; b = b->next)
+      luaL_addlstring(&buf, b->buff + b->start, b->size);
+    luaL_pushresult(&buf);
+    nargs = 3;
+  }
+  nl_http_client_cl_release(cl); /* the coroutine's reference */
+  nl_http_client_cl_release(cl); /* the request's reference */
+  return nargs;
+}
+
+static void
+nl_http_client_resume(struct nl_http_client_cl *cl) {
+  mtev_lua_resume_info_t *ci;
+  int nargs;
+
+  if(ck_pr_load_32(&cl->cancelled)) {
+    nl_http_client_cl_release(cl);
+    return;
+  }
+  ci = cl->ci;
+  nargs = nl_http_client_push_results(cl);
+  ci->lmc->resume(ci, nargs);
+}
+
+static int
+nl_http_client_resume_event(eventer_t e, int mask, void *closure,
+                            struct timeval *now) {
+  nl_http_client_resume(closure);
+  return 0;
+}
+
+static void
+nl_http_client_complete(mtev_http_client_request_t *req,
+                        mtev_http_client_error_t err, void *closure) {
+  struct nl_http_client_cl *cl = closure;
+  eventer_t e;
+
+  if(ck_pr_load_32(&cl->cancelled)) {
+    nl_http_client_cl_release(cl);
+    return;
+  }
+  cl->err = err;
+  if(pthread_equal(cl->bound_thread, pthread_self()) && cl->in_send) {
+    /* we haven't yielded yet, mtev.http_request will return directly */
+    cl->completed_inline = mtev_true;
+    return;
+  }
+  /* Never resume from here: we may be deep inside the connection's drive
+   * loop.  Resume from a fresh event on the thread owning the coroutine. */
+  e = eventer_alloc();
+  /* no whence, so "right now" */
+  e->thr_owner = cl->bound_thread;
+  e->closure = cl;
+  e->callback = nl_http_client_resume_event;
+  e->mask = EVENTER_TIMER;
+  eventer_add(e);
+}
+
+static int
+nl_http_client_request(lua_State *L) {
+  mtev_lua_resume_info_t *ci;
+  mtev_http_client_request_t *req;
+  struct nl_http_client_cl *cl;
+  const char *method, *address, *path, *body;
+  size_t body_len = 0;
+  int port;
+
+  ci = mtev_lua_get_resume_info(L);
+  mtevAssert(ci);
+
+  method = luaL_checkstring(L, 1);
+  address = luaL_checkstring(L, 2);
+  port = luaL_checkinteger(L, 3);
+  path = luaL_optstring(L, 4, "/");
+  if(port <= 0 || port > 0xffff) luaL_error(L, "invalid port: %d", port);
+
+  req = mtev_http_client_request_new(method, address, port, path);
+  if(!req) {
+    lua_pushnil(L);
+    lua_pushfstring(L, "invalid address: %s", address);
+    return 2;
+  }
+  if(lua_istable(L, 5)) {
+    lua_pushnil(L);
+    while(lua_next(L, 5)) {
+      if(lua_type(L, -2) == LUA_TSTRING)
+        mtev_http_client_request_header_set(req, lua_tostring(L, -2),
+                                            lua_tostring(L, -1));
+      lua_pop(L, 1);
+    }
+  }
+  body = lua_tolstring(L, 6, &body_len);
+  if(body) mtev_http_client_request_body_set(req, body, body_len);
+  if(lua_istable(L, 7)) {
+    lua_getfield(L, 7, "timeout");
+    if(lua_isnumber(L, -1))
+      mtev_http_client_request_timeout_set(req, lua_tonumber(L, -1) * 1000.0);
+    lua_pop(L, 1);
+    lua_getfield(L, 7, "decode");
+    if(!lua_isnil(L, -1))
+      mtev_http_client_request_decode_set(req, lua_toboolean(L, -1));
+    lua_pop(L, 1);
+    lua_getfield(L, 7, "ssl");
+    if(lua_toboolean(L, -1)) {
+      const char *ssl_opts[6] = { 0 };
+      static const char *ssl_keys[6] =
+        { "layer", "ca", "certificate_file", "key_file", "ciphers", "sni" };
+      int i;
+      for(i=0; i<6; i++) {
+        lua_getfield(L, 7, ssl_keys[i]);
+        ssl_opts[i] = lua_tostring(L, -1);
+        lua_pop(L, 1);
+      }
+      mtev_http_client_request_ssl_set(req, ssl_opts[0], ssl_opts[1],
+                                       ssl_opts[2], ssl_opts[3],
+                                       ssl_opts[4], ssl_opts[5]);
+    }
+    lua_pop(L, 1);
+  }
+
+  cl = calloc(1, sizeof(*cl));
+  cl->free = nl_http_client_cl_cancel;
+  cl->L = L;
+  cl->ci = ci;
+  cl->bound_thread = ci->bound_thread;
+  cl->req = req;
+  cl->refcnt = 2;
+  /* a placeholder event so coroutine cancellation can find us */
+  cl->guard = eventer_alloc();
+  cl->guard->mask = EVENTER_TIMER;
+  cl->guard->closure = cl;
+  mtev_lua_register_event(ci, cl->guard);
+
+  cl->in_send = mtev_true;
+  if(!mtev_http_client_request_send(req, nl_http_client_complete, cl)) {
+    mtev_lua_deregister_event(ci, cl->guard, 0);
+    eventer_free(cl->guard);
+    mtev_http_client_request_free(req);
+    free(cl);
+    lua_pushnil(L);
+    lua_pushstring(L, "request could not be sent");
+    return 2;
+  }
+  cl->in_send = mtev_false;
+  if(cl->completed_inline) return nl_http_client_push_results(cl);
+  return mtev_lua_yield(ci, 0);
+}
+
+static int
+nl_http_client_options(lua_State *L) {
+  int maxc = luaL_checkinteger(L, 1);
+  int maxp = luaL_checkinteger(L, 2);
+  lua_Number idle = luaL_optnumber(L, 3, 30.0);
+  if(idle < 0) luaL_error(L, "invalid idle timeout");
+  mtev_http_client_pool_options(maxc, maxp, (uint32_t)(idle * 1000.0));
+  return 0;
+}
+
 static void mtev_lua_init() {
   static int done = 0;
   if(done) return;
@@ -3964,6 +4503,7 @@ static void mtev_lua_init() {
   mtev_lua_init_globals();
   register_console_lua_commands();
   eventer_name_callback("lua/sleep", nl_sleep_complete);
+  eventer_name_callback("lua/http_client_resume", nl_http_client_resume_event);
   eventer_name_callback("lua/socket_read",
                         mtev_lua_socket_read_complete);
   eventer_name_callback("lua/socket_write",
@@ -3983,10 +4523,7 @@ static void mtev_lua_init() {
   if(!nldeb) nldeb = mtev_debug;
   mtev_lua_init_dns();
 
-  mtev_hash_init_locks(&shared_table, 8, MTEV_HASH_LOCK_MODE_NONE);
-  if(pthread_mutex_init(&shared_table_mutex, NULL) != 0) {
-    mtevL(nlerr, "Unable to initialize shared_table_mutex\n");
-  }
+  mtev_hash_init_sharded(&shared_table, MTEV_HASH_DEFAULT_SIZE, 0, MTEV_HASH_LOCK_MODE_SPIN);
 }
 
 static const luaL_Reg mtevlib[] = {
@@ -4005,7 +4542,41 @@ static const luaL_Reg mtevlib[] = {
 */
 
   { "uuid", nl_uuid },
+/*! \lua uuid = mtev.uuid()
+    \return a random (version 4) UUID as a lowercase string
+*/
+
+  { "uuid_v7", nl_uuid_v7 },
+/*! \lua uuid = mtev.uuid_v7()
+    \return a time-ordered (version 7) UUID as a lowercase string
+*/
+
   { "socket", nl_socket },
+  { "http_request", nl_http_client_request },
+/*! \lua status, headers, body = mtev.http_request(method, address, port, path, headers = nil, body = nil, opts = nil)
+    \brief Issue an HTTP request from the eventer without blocking.
+    \param method the HTTP method, e.g. "GET"
+    \param address an IPv4 or IPv6 address literal
+    \param port the TCP port
+    \param path the request path, including any querystring
+    \param headers a table of request headers
+    \param body the request payload
+    \param opts a table accepting timeout (seconds), decode (boolean), and ssl (boolean) with optional layer, ca, certificate_file, key_file, ciphers and sni
+    \return the status code, a table of lower-cased response headers, and the (decoded) body; or nil and an error string.
+
+    Connections are pooled and reused across requests to the same endpoint.
+*/
+
+  { "http_client_options", nl_http_client_options },
+/*! \lua mtev.http_client_options(max_connections, max_pipeline, idle_timeout = 30)
+    \brief Tune the connection pools used by `mtev.http_request`.
+    \param max_connections the most connections per endpoint
+    \param max_pipeline the most outstanding idempotent requests per connection
+    \param idle_timeout how long, in seconds, idle connections are kept
+
+    Settings apply process-wide; values below 1 leave the current limit as is.
+*/
+
   { "dns", nl_dns_lookup },
 /*! \lua mtev.dns = mtev.dns(nameserver = nil)
     \brief Create an `mtev.dns` object for DNS lookups.
@@ -4066,6 +4637,8 @@ static const luaL_Reg mtevlib[] = {
   { "sha1", nl_sha1 },
   { "pcre", nl_pcre },
   { "gunzip", nl_gunzip },
+  { "hyperloglog", nl_hyperloglog },
+  { "hyperloglog_deserialize", nl_hyperloglog_deserialize },
   { "conf", nl_conf_get_string },
   { "conf_get", nl_conf_get_string },
   { "conf_get_string", nl_conf_get_string },
@@ -4093,6 +4666,34 @@ static const luaL_Reg mtevlib[] = {
     implementation sets them to nil and thus elides the keys.
     If parsing fails nil is returned followed by the error and
     the byte offset into the string where the error occurred.
+    Strict JSON is only indexed here; values are decoded as they
+    are reached through `document()` or `get()`.  Input that is
+    not strict JSON (comments, single-quoted strings, trailing
+    data) is handed to the lenient parser used before, which also
+    produces the error and offset for input it rejects.
+*/
+
+  { "tomsgpack", nl_tomsgpack },
+/*! \lua str = mtev.tomsgpack(obj)
+    \brief Encode a lua object as MessagePack.
+    \param obj a lua object (usually a table).
+    \return a lua string holding the encoding.
+
+    Tables whose keys are exactly 1..n become arrays and other tables
+    become maps; keys must be strings or numbers.  Integral numbers use
+    the integer encodings.  Values without a MessagePack counterpart
+    (functions, userdata, etc.) are encoded as nil.  A table with a
+    `serialize` method is encoded as the table that method returns.
+*/
+
+  { "frommsgpack", nl_frommsgpack },
+/*! \lua obj, err = mtev.frommsgpack(str)
+    \brief Decode a MessagePack encoded lua string.
+    \param str a string produced by `mtev.tomsgpack` or any MessagePack encoder.
+    \return the decoded lua object, or nil and an error.
+
+    Map entries with nil keys or values are elided, as are nil array
+    elements.  Integers are returned as lua numbers.
 */
 
   { "tojson", nl_tojson },
@@ -4155,6 +4756,12 @@ int luaopen_mtev(lua_State *L) {
   lua_pushcfunction(L, mtev_lua_pcre_gc);
   lua_setfield(L, -2, "__gc");
 
+  luaL_newmetatable(L, "mtev.hyperloglog");
+  lua_pushcfunction(L, mtev_lua_hll_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_pushcfunction(L, mtev_lua_hll_index_func);
+  lua_setfield(L, -2, "__index");
+
   luaL_newmetatable(L, "mtev.json");
   lua_pushcfunction(L, mtev_lua_json_gc);
   lua_setfield(L, -2, "__gc");
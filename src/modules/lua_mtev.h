@@ -118,6 +118,7 @@ struct mtev_lua_resume_info {
   mtev_hash_table *events; /* Any eventers we need to cleanup */
   int context_magic;
   void *context_data;
+  mtev_arena_t *arena; /* see mtev_lua_resume_info_arena */
 };
 #define LUA_GENERAL_INFO_MAGIC 0x918243fa
 
@@ -189,6 +190,11 @@ int mtev_lua_traceback(lua_State *L);
 void mtev_lua_new_coro(mtev_lua_resume_info_t *);
 void mtev_lua_cancel_coro(mtev_lua_resume_info_t *ci);
 void mtev_lua_resume_clean_events(mtev_lua_resume_info_t *ci);
+/* Scratch memory for the life of the coroutine; for REST handlers this is
+ * the request's arena (mtev_http_rest_arena), otherwise it is owned by the
+ * resume info and released by mtev_lua_resume_clean_arena. */
+mtev_arena_t *mtev_lua_resume_info_arena(mtev_lua_resume_info_t *ci);
+void mtev_lua_resume_clean_arena(mtev_lua_resume_info_t *ci);
 void mtev_lua_pushmodule(lua_State *L, const char *m);
 void mtev_lua_init_dns();
 mtev_hash_table *mtev_lua_table_to_hash(lua_State *L, int idx);
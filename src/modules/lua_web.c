@@ -77,13 +77,9 @@ rest_lua_ctx_free(void *cl) {
   if(ri) {
     mtev_lua_cancel_coro(ri);
     mtev_lua_resume_clean_events(ri);
-    if(ri->context_data) {
-      mtev_lua_resume_rest_info_t *ctx = ri->context_data;
-      if (ctx) {
-        if(ctx->err) free(ctx->err);
-        free(ctx);
-      }
-    }
+    mtev_lua_resume_clean_arena(ri);
+    /* ctx->err lives in the request arena */
+    if(ri->context_data) free(ri->context_data);
     free(ri);
   }
 }
@@ -141,7 +137,7 @@ lua_web_resume(mtev_lua_resume_info_t *ri, int nargs) {
         if(lua_isstring(ri->coro_state, base)) {
           err = lua_tostring(ri->coro_state, base);
           mtevL(mtev_error, "lua error: %s\n", err);
-          if(!ctx->err) ctx->err = strdup(err);
+          if(!ctx->err) ctx->err = mtev_arena_strdup(mtev_lua_resume_info_arena(ri), err);
         }
       }
       rv = -1;
@@ -220,14 +216,14 @@ lua_web_handler(mtev_http_rest_closure_t *restc,
   mtev_lua_pushmodule(L, restc->closure);
   if(lua_isnil(L, -1)) {
     lua_pop(L, 1);
-    ctx->err = strdup("no such module");
+    ctx->err = mtev_arena_strdup(mtev_http_rest_arena(restc), "no such module");
     goto boom;
   }
   lua_getfield(L, -1, "handler");
   lua_remove(L, -2);
   if(!lua_isfunction(L, -1)) {
     lua_pop(L, 1);
-    ctx->err = strdup("no 'handler' function in module");
+    ctx->err = mtev_arena_strdup(mtev_http_rest_arena(restc), "no 'handler' function in module");
     goto boom;
   }
   mtev_lua_setup_restc(L, restc);
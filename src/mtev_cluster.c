@@ -75,6 +75,7 @@ struct mtev_cluster_t {
   int period;
   int timeout;
   int maturity;
+  mtev_cht_mode_t hashing;
   char *key;
   int64_t config_seq;
   int node_cnt;
@@ -432,7 +433,7 @@ mtev_cluster_compile(mtev_cluster_t *cluster) {
   cluster->cht =
     mtev_memory_safe_malloc_cleanup(sizeof(*cluster->cht),
                                     deferred_cht_free);
-  *(cluster->cht) = mtev_cht_alloc();
+  *(cluster->cht) = mtev_cht_alloc_mode(cluster->hashing);
   nodes = calloc(sizeof(*nodes), cluster->node_cnt);
   for(i=0; i<cluster->node_cnt; i++) {
     char uuid_str[UUID_STR_LEN+1];
@@ -485,7 +486,9 @@ mtev_cluster_update_config(mtev_cluster_t *cluster, mtev_boolean create) {
     xmlSetProp(parent, (xmlChar *)"timeout", (xmlChar *)timeout);
     snprintf(maturity, sizeof(maturity), "%d", cluster->maturity);
     xmlSetProp(parent, (xmlChar *)"maturity", (xmlChar *)maturity);
-
+    if(cluster->hashing != MTEV_CHT_RING)
+      xmlSetProp(parent, (xmlChar *)"hashing",
+                 (xmlChar *)mtev_cht_mode_name(cluster->hashing));
 
     xmlSetProp(parent, (xmlChar *)"key", (xmlChar *)cluster->key);
     xmlSetProp(parent, (xmlChar *)"seq", (xmlChar *)new_seq_str);
@@ -527,6 +530,7 @@ mtev_cluster_update_config(mtev_cluster_t *cluster, mtev_boolean create) {
 int mtev_cluster_update_internal(mtev_conf_section_t cluster,
     mtev_boolean booted) {
   int rv = -1, i, n_nodes, port, period, timeout, maturity;
+  mtev_cht_mode_t hashing = MTEV_CHT_RING;
   int64_t seq;
   char bufstr[1024];
   mtev_conf_section_t *nodes = NULL;
@@ -601,6 +605,20 @@ int mtev_cluster_update_internal(mtev_conf_section_t cluster,
     }
   }
 
+  if(mtev_conf_get_stringbuf(cluster, "@hashing", bufstr, sizeof(bufstr)) &&
+     bufstr[0] != '\0' && !mtev_cht_mode_from_name(bufstr, &hashing)) {
+    mtevL(mtev_error, "Cluster '%s' hashing invalid.\n", name);
+    goto bail;
+  }
+  /* Jump hashing only moves few keys when nodes join or leave at the end of
+   * the node list, but cluster nodes are ordered by uuid, so a membership
+   * change almost anywhere would move most keys. */
+  if(hashing == MTEV_CHT_JUMP) {
+    mtevL(mtev_error, "Cluster '%s' cannot use jump hashing (nodes are uuid "
+          "ordered); use ring or maglev.\n", name);
+    goto bail;
+  }
+
   nodes = mtev_conf_get_sections(cluster, "node", &n_nodes);
   if(n_nodes > 0) {
     nlist = mtev_memory_safe_calloc(n_nodes, sizeof(*nlist));
@@ -666,6 +684,7 @@ int mtev_cluster_update_internal(mtev_conf_section_t cluster,
   new_cluster->period = period;
   new_cluster->timeout = timeout;
   new_cluster->maturity = maturity;
+  new_cluster->hashing = hashing;
   qsort(nlist, n_nodes, sizeof(*nlist), mtev_cluster_node_compare);
   new_cluster->node_cnt = n_nodes;
   new_cluster->nodes = nlist; nlist = NULL;
@@ -794,7 +813,7 @@ mtev_cluster_do_i_own(mtev_cluster_t *c, void *key, size_t klen, int w) {
   if(!c || !c->cht || !(*(c->cht))) return mtev_false;
   if(w < 0) w = 1;
   if(w > c->node_cnt) w = c->node_cnt;
-  owners = alloca(sizeof(*owners) * c->node_cnt);
+  owners = alloca(sizeof(*owners) * (w ? w : 1));
   wout = mtev_cht_vlookup_n(*(c->cht), key, klen, w, owners);
   for(i=0; i<wout; i++) {
     mtev_cluster_node_t *node;
@@ -898,6 +917,8 @@ mtev_cluster_to_xmlnode(mtev_cluster_t *c) {
   xmlSetProp(cluster, (xmlChar *)"timeout", (xmlChar *)timeout);
   snprintf(maturity, sizeof(maturity), "%d", c->maturity);
   xmlSetProp(cluster, (xmlChar *)"maturity", (xmlChar *)maturity);
+  xmlSetProp(cluster, (xmlChar *)"hashing",
+             (xmlChar *)mtev_cht_mode_name(c->hashing));
 
   xmlNodePtr node;
   char uuid_str[UUID_STR_LEN+1];
@@ -44,6 +44,8 @@
 #include "mtev_console.h"
 #include "mtev_tokenizer.h"
 #include "mtev_capabilities_listener.h"
+#include "mtev_memory.h"
+#include "mtev_stacktrace.h"
 
 #include <unistd.h>
 #include <netinet/in.h>
@@ -145,6 +147,78 @@ mtev_console_eventer_memory(mtev_console_closure_t ncct, int argc, char **argv,
   return 0;
 }
 
+static void
+mtev_console_allocator_line(mtev_allocator_t a, void *closure) {
+  mtev_console_closure_t ncct = closure;
+  mtev_allocator_stats_t stats;
+  char live_bytes[32] = "-";
+  mtev_allocator_stats(a, &stats);
+  if(stats.live_bytes >= 0)
+    snprintf(live_bytes, sizeof(live_bytes), "%" PRId64, stats.live_bytes);
+  nc_printf(ncct, "%-24s %8zu %14" PRIu64 " %12" PRId64 " %14s %10" PRId64 " %6u\n",
+            stats.name, stats.fixed_size, stats.allocs, stats.live_objects,
+            live_bytes, stats.cached_objects, stats.sample_rate);
+}
+static int
+mtev_console_eventer_allocators(mtev_console_closure_t ncct, int argc, char **argv,
+                                mtev_console_state_t *dstate, void *unused) {
+  mtev_allocator_site_t sites[10];
+  mtev_allocator_t a;
+  int i, j, n;
+
+  nc_printf(ncct, "%-24s %8s %14s %12s %14s %10s %6s\n", "name", "size",
+            "allocs", "live", "live bytes", "cached", "1-in");
+  if(argc == 0) {
+    mtev_allocator_foreach(mtev_console_allocator_line, ncct);
+    return 0;
+  }
+  a = mtev_allocator_find(argv[0]);
+  if(!a) {
+    nc_printf(ncct, "No such allocator.\n");
+    return -1;
+  }
+  mtev_console_allocator_line(a, ncct);
+  n = mtev_allocator_sites(a, sites, sizeof(sites)/sizeof(*sites));
+  for(i = 0; i < n; i++) {
+    nc_printf(ncct, "\n%" PRIu64 " samples, %" PRIu64 " bytes\n",
+              sites[i].samples, sites[i].bytes);
+    for(j = 0; j < sites[i].nframes; j++) {
+      char frame[256];
+      mtev_stacktrace_symbolize(sites[i].frames[j], frame, sizeof(frame));
+      nc_printf(ncct, "    %s\n", frame);
+    }
+  }
+  return 0;
+}
+
+static int
+mtev_console_allocator(mtev_console_closure_t ncct, int argc, char **argv,
+                       mtev_console_state_t *dstate, void *unused) {
+  mtev_allocator_t a;
+  if(argc < 2) {
+    nc_printf(ncct, "<allocator> sample <n>\n<allocator> reset\n");
+    return -1;
+  }
+  a = mtev_allocator_find(argv[0]);
+  if(a == NULL) {
+    nc_printf(ncct, "No such allocator.\n");
+    return -1;
+  }
+  if(!strcmp(argv[1], "sample") && argc == 3) {
+    uint32_t rate = strtoul(argv[2], NULL, 10);
+    mtev_allocator_set_sample_rate(a, rate);
+    nc_printf(ncct, "Sampling 1 in %u allocations from '%s'\n", rate, argv[0]);
+  }
+  else if(!strcmp(argv[1], "reset")) {
+    mtev_allocator_sites_reset(a);
+  }
+  else {
+    nc_printf(ncct, "Unknown allocator command: %s\n", argv[1]);
+    return -1;
+  }
+  return 0;
+}
+
 static int
 mtev_console_jobq(mtev_console_closure_t ncct, int argc, char **argv,
                   mtev_console_state_t *dstate, void *unused) {
@@ -266,6 +340,12 @@ cmd_info_t console_command_eventer_jobq = {
 cmd_info_t console_command_eventer_memory = {
   "memory", mtev_console_eventer_memory, NULL, NULL, NULL
 };
+cmd_info_t console_command_eventer_allocators = {
+  "allocators", mtev_console_eventer_allocators, NULL, NULL, NULL
+};
+cmd_info_t console_command_allocator = {
+  "allocator", mtev_console_allocator, NULL, NULL, NULL
+};
 cmd_info_t console_command_coreclocks = {
   "coreclocks", mtev_console_coreclocks, NULL, NULL, NULL
 };
@@ -769,6 +849,7 @@ mtev_console_state_initial() {
     mtev_console_state_add_cmd(evdeb, &console_command_eventer_sockets);
     mtev_console_state_add_cmd(evdeb, &console_command_eventer_jobq);
     mtev_console_state_add_cmd(evdeb, &console_command_eventer_memory);
+    mtev_console_state_add_cmd(evdeb, &console_command_eventer_allocators);
 
     mtevdeb = mtev_console_mksubdelegate(
               mtev_console_mksubdelegate(show_state,
@@ -778,6 +859,7 @@ mtev_console_state_initial() {
 
     mtevst = mtev_console_mksubdelegate(_top_level_state, "mtev");
     mtev_console_state_add_cmd(mtevst, &console_command_jobq);
+    mtev_console_state_add_cmd(mtevst, &console_command_allocator);
     rdtsc = mtev_console_mksubdelegate(mtevst, "rdtsc");
     mtev_console_state_add_cmd(rdtsc, &console_command_rdtsc_status);
     mtev_console_state_add_cmd(rdtsc, &console_command_rdtsc_enable);
@@ -36,6 +36,9 @@
 #include "eventer/eventer.h"
 #include "eventer/eventer_impl_private.h"
 #include "mtev_json.h"
+#include "mtev_memory.h"
+#include "mtev_bufpool.h"
+#include "mtev_stacktrace.h"
 #include <errno.h>
 #include <arpa/inet.h>
 
@@ -141,34 +144,131 @@ mtev_rest_eventer_timers(mtev_http_rest_closure_t *restc, int n, char **p) {
   mtev_json_object *doc = MJ_ARR();
   eventer_foreach_timedevent(json_spit_event, doc);
 
-  mtev_http_response_ok(restc->http_ctx, "application/json");
-  mtev_http_response_append_json(restc->http_ctx, doc);
+  mtev_http_response_json(restc->http_ctx, 200, "OK", doc);
   MJ_DROP(doc);
   mtev_http_response_end(restc->http_ctx);
   return 0;
 }
+static void
+json_spit_bufpool(mtev_bufpool_t *pool, void *closure) {
+  mtev_json_object *doc = closure, *nodes, *no;
+  mtev_bufpool_node_stats_t stats[MTEV_BUFPOOL_MAX_NODES];
+  int i, n;
+
+  n = mtev_bufpool_stats(pool, stats, MTEV_BUFPOOL_MAX_NODES);
+  MJ_KV(doc, mtev_bufpool_name(pool), nodes = MJ_ARR());
+  for(i = 0; i < n; i++) {
+    MJ_ADD(nodes, no = MJ_OBJ());
+    MJ_KV(no, "node", MJ_INT(stats[i].node));
+    MJ_KV(no, "bufsize", MJ_UINT64(mtev_bufpool_bufsize(pool)));
+    MJ_KV(no, "regions", MJ_UINT64(stats[i].regions));
+    MJ_KV(no, "hugetlb_regions", MJ_UINT64(stats[i].hugetlb_regions));
+    MJ_KV(no, "allocs", MJ_UINT64(stats[i].allocs));
+    MJ_KV(no, "frees", MJ_UINT64(stats[i].frees));
+    MJ_KV(no, "remote_frees", MJ_UINT64(stats[i].remote_frees));
+    MJ_KV(no, "outstanding", MJ_INT64(stats[i].outstanding));
+    MJ_KV(no, "free", MJ_INT64(stats[i].free));
+  }
+}
 static int
 mtev_rest_eventer_memory(mtev_http_rest_closure_t *restc, int n, char **p) {
   mtev_json_object *doc = MJ_OBJ(), *eobj;
+  mtev_memory_gc_stats_t gc;
 
   MJ_KV(doc, "eventer_t", eobj = MJ_OBJ());
   MJ_KV(eobj, "current", MJ_INT64(eventer_allocations_current()));
   MJ_KV(eobj, "total", MJ_INT64(eventer_allocations_total()));
 
-  mtev_http_response_ok(restc->http_ctx, "application/json");
-  mtev_http_response_append_json(restc->http_ctx, doc);
+  mtev_memory_gc_stats(&gc);
+  MJ_KV(doc, "gc", eobj = MJ_OBJ());
+  MJ_KV(eobj, "pending", MJ_INT64(gc.pending));
+  MJ_KV(eobj, "peak", MJ_INT64(gc.peak));
+  MJ_KV(eobj, "dispatched", MJ_INT64(gc.dispatched));
+  MJ_KV(eobj, "handoffs", MJ_INT64(gc.handoffs));
+  MJ_KV(eobj, "queued", MJ_INT64(gc.queued));
+  MJ_KV(eobj, "backpressure", MJ_INT64(gc.backpressure));
+  MJ_KV(eobj, "reclaimers", MJ_INT64(gc.reclaimers));
+
+  MJ_KV(doc, "bufpools", eobj = MJ_OBJ());
+  mtev_bufpool_foreach(json_spit_bufpool, eobj);
+
+  mtev_http_response_json(restc->http_ctx, 200, "OK", doc);
   MJ_DROP(doc);
   mtev_http_response_end(restc->http_ctx);
   return 0;
 }
+struct json_allocators_closure {
+  mtev_json_object *doc;
+  const char *want;
+  int nsites;
+};
+static void
+json_spit_allocator(mtev_allocator_t a, void *closure) {
+  struct json_allocators_closure *cl = closure;
+  mtev_allocator_stats_t stats;
+  mtev_json_object *ao, *so, *fo;
+  int i, j, n;
+
+  if(cl->want && strcmp(cl->want, mtev_allocator_name(a))) return;
+  mtev_allocator_stats(a, &stats);
+  MJ_KV(cl->doc, stats.name, ao = MJ_OBJ());
+  if(stats.fixed_size) MJ_KV(ao, "fixed_size", MJ_UINT64(stats.fixed_size));
+  MJ_KV(ao, "allocs", MJ_UINT64(stats.allocs));
+  MJ_KV(ao, "frees", MJ_UINT64(stats.frees));
+  MJ_KV(ao, "live_objects", MJ_INT64(stats.live_objects));
+  if(stats.live_bytes >= 0) MJ_KV(ao, "live_bytes", MJ_INT64(stats.live_bytes));
+  MJ_KV(ao, "bytes_allocated", MJ_UINT64(stats.bytes_allocated));
+  MJ_KV(ao, "cached_objects", MJ_INT64(stats.cached_objects));
+  if(stats.reserved_bytes) MJ_KV(ao, "reserved_bytes", MJ_UINT64(stats.reserved_bytes));
+  MJ_KV(ao, "sample_rate", MJ_UINT64(stats.sample_rate));
+  MJ_KV(ao, "samples", MJ_UINT64(stats.samples));
+
+  if(cl->nsites > 0 && stats.samples) {
+    mtev_allocator_site_t *sites = calloc(cl->nsites, sizeof(*sites));
+    if(!sites) return;
+    n = mtev_allocator_sites(a, sites, cl->nsites);
+    MJ_KV(ao, "sites", so = MJ_ARR());
+    for(i = 0; i < n; i++) {
+      mtev_json_object *site;
+      MJ_ADD(so, site = MJ_OBJ());
+      MJ_KV(site, "samples", MJ_UINT64(sites[i].samples));
+      MJ_KV(site, "bytes", MJ_UINT64(sites[i].bytes));
+      MJ_KV(site, "frames", fo = MJ_ARR());
+      for(j = 0; j < sites[i].nframes; j++) {
+        char frame[256];
+        mtev_stacktrace_symbolize(sites[i].frames[j], frame, sizeof(frame));
+        MJ_ADD(fo, MJ_STR(frame));
+      }
+    }
+    free(sites);
+  }
+}
+static int
+mtev_rest_eventer_allocators(mtev_http_rest_closure_t *restc, int n, char **p) {
+  struct json_allocators_closure cl = { NULL, NULL, 0 };
+  mtev_http_request *req = mtev_http_session_request(restc->http_ctx);
+  const char *sites;
+
+  cl.doc = MJ_OBJ();
+  cl.want = mtev_http_request_querystring(req, "name");
+  sites = mtev_http_request_querystring(req, "sites");
+  if(sites) cl.nsites = atoi(sites);
+  /* no allocator has more to report, and it bounds the allocation */
+  if(cl.nsites > MTEV_ALLOCATOR_MAX_SITES) cl.nsites = MTEV_ALLOCATOR_MAX_SITES;
+  mtev_allocator_foreach(json_spit_allocator, &cl);
+
+  mtev_http_response_json(restc->http_ctx, 200, "OK", cl.doc);
+  MJ_DROP(cl.doc);
+  mtev_http_response_end(restc->http_ctx);
+  return 0;
+}
 static int
 mtev_rest_eventer_sockets(mtev_http_rest_closure_t *restc, int n, char **p) {
   mtev_json_object *doc = MJ_ARR();
 
   eventer_foreach_fdevent(json_spit_event, doc);
 
-  mtev_http_response_ok(restc->http_ctx, "application/json");
-  mtev_http_response_append_json(restc->http_ctx, doc);
+  mtev_http_response_json(restc->http_ctx, 200, "OK", doc);
   MJ_DROP(doc);
   mtev_http_response_end(restc->http_ctx);
   return 0;
@@ -179,8 +279,7 @@ mtev_rest_eventer_jobq(mtev_http_rest_closure_t *restc, int n, char **p) {
 
   eventer_jobq_process_each(json_spit_jobq, doc);
 
-  mtev_http_response_ok(restc->http_ctx, "application/json");
-  mtev_http_response_append_json(restc->http_ctx, doc);
+  mtev_http_response_json(restc->http_ctx, 200, "OK", doc);
   MJ_DROP(doc);
   mtev_http_response_end(restc->http_ctx);
   return 0;
@@ -229,8 +328,7 @@ mtev_rest_eventer_logs(mtev_http_rest_closure_t *restc, int n, char **p) {
   else
     mtev_log_memory_lines(ls, last, json_spit_log, doc);
 
-  mtev_http_response_ok(restc->http_ctx, "application/json");
-  mtev_http_response_append_json(restc->http_ctx, doc);
+  mtev_http_response_json(restc->http_ctx, 200, "OK", doc);
   MJ_DROP(doc);
   mtev_http_response_end(restc->http_ctx);
   return 0;
@@ -238,8 +336,7 @@ mtev_rest_eventer_logs(mtev_http_rest_closure_t *restc, int n, char **p) {
   doc = MJ_OBJ();
   snprintf(errbuf, sizeof(errbuf), "log '%s' not found", p[0]);
   MJ_KV(doc, "error", MJ_STR(errbuf));
-  mtev_http_response_not_found(restc->http_ctx, "application/json");
-  mtev_http_response_append_json(restc->http_ctx, doc);
+  mtev_http_response_json(restc->http_ctx, 404, "NOT FOUND", doc);
   MJ_DROP(doc);
   mtev_http_response_end(restc->http_ctx);
   return 0;
@@ -251,6 +348,10 @@ mtev_events_rest_init() {
     "GET", "/eventer/", "^memory\\.json$",
     mtev_rest_eventer_memory, mtev_http_rest_client_cert_auth
   ) == 0);
+  mtevAssert(mtev_http_rest_register_auth(
+    "GET", "/eventer/", "^allocators\\.json$",
+    mtev_rest_eventer_allocators, mtev_http_rest_client_cert_auth
+  ) == 0);
   mtevAssert(mtev_http_rest_register_auth(
     "GET", "/eventer/", "^sockets\\.json$",
     mtev_rest_eventer_sockets, mtev_http_rest_client_cert_auth
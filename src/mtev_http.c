@@ -39,9 +39,15 @@
 #include "mtev_zipkin.h"
 #include "mtev_conf.h"
 #include "mtev_compress.h"
+#include "mtev_stats.h"
+#include "mtev_websocket_frame.h"
+#include "mtev_bufpool.h"
+#include "mtev_json.h"
+#include "mtev_msgpack.h"
 
 #include <errno.h>
 #include <ctype.h>
+#include <fcntl.h>
 #include <sys/mman.h>
 #include <libxml/tree.h>
 #include <pthread.h>
@@ -83,6 +89,7 @@ struct mtev_http_request {
   struct bchain *user_data_last;  /* end of the user_data chain */
   size_t         current_offset; /* analyzing. */
   mtev_boolean freed;
+  mtev_arena_t *arena; /* reset, not freed, on release */
 
   enum { MTEV_HTTP_REQ_HEADERS = 0,
          MTEV_HTTP_REQ_EXPECT,
@@ -111,6 +118,8 @@ struct mtev_http_request {
   struct timeval start_time;
   char *orig_qs;
   mtev_stream_decompress_ctx_t *decompress_ctx;
+  mtev_boolean splice_pipe_open;
+  int splice_pipe[2];
 };
 
 struct mtev_http_response {
@@ -136,6 +145,10 @@ struct mtev_http_response {
   size_t output_chain_bytes;
   size_t output_raw_chain_bytes;
   mtev_boolean freed;
+  mtev_boolean compression_policy; /* constrain compression as below */
+  uint32_t compression_allowed;
+  int compression_level;
+  size_t compression_min_size;
 };
 
 struct mtev_http_session_ctx {
@@ -156,6 +169,9 @@ struct mtev_http_session_ctx {
   mtev_boolean did_handshake;
   wslay_event_context_ptr wslay_ctx;
   int wanted_eventer_mask;
+  mtev_ws_outq_t ws_outq; /* protected by write_lock */
+  mtev_boolean ws_close_queued; /* protected by write_lock */
+  mtev_ws_deflate_t *ws_deflate;
 #endif
 };
 
@@ -193,6 +209,32 @@ static const char *zipkin_http_bytes_in = "http.bytes_in";
 static const char *zipkin_http_bytes_out = "http.bytes_out";
 static const char *zipkin_ss_done = "ss_done";
 static struct in_addr zipkin_ip_host;
+/* bodies smaller than this aren't worth compressing */
+static size_t compression_min_size = 256;
+
+#ifdef HAVE_WSLAY
+/* permessage-deflate (RFC 7692) */
+static mtev_boolean ws_deflate_enabled = mtev_true;
+static mtev_ws_deflate_params_t ws_deflate_limits = {
+  .server_no_context_takeover = mtev_true,
+  .client_no_context_takeover = mtev_false,
+  .server_max_window_bits = 15,
+  .client_max_window_bits = 15
+};
+static size_t ws_deflate_min_size = 64;
+static int ws_deflate_level = -1;
+
+struct mtev_http_websocket_msg {
+  mtev_atomic32_t refcnt;
+  int opcode;
+  unsigned char *payload;
+  size_t len;
+  struct bchain *plain;
+  /* compressed variants, by window bits, for stateless deflate */
+  pthread_mutex_t lock;
+  struct bchain *deflated[16];
+};
+#endif
 
 #define CTX_ADD_HEADER(a,b) \
     mtev_hash_replace(&ctx->res.headers, \
@@ -242,10 +284,28 @@ static void check_realloc_request(mtev_http_request *req) {
   }
 }
 
+/* Default-sized bchains (the bulk of the I/O path) come from a NUMA-aware
+ * pool so they are local to the loop thread that fills them. */
+static mtev_bufpool_t *bchain_pool;
+static pthread_once_t bchain_pool_once = PTHREAD_ONCE_INIT;
+static void bchain_pool_init(void) {
+  bchain_pool = mtev_bufpool_create("bchain",
+                                    DEFAULT_BCHAINSIZE + offsetof(struct bchain, _buff),
+                                    MTEV_BUFPOOL_PAGES_DEFAULT);
+}
+
 struct bchain *bchain_alloc(size_t size, int line) {
-  struct bchain *n;
+  struct bchain *n = NULL;
+  if (size == DEFAULT_BCHAINSIZE) {
+    pthread_once(&bchain_pool_once, bchain_pool_init);
+    if(bchain_pool) n = mtev_bufpool_alloc(bchain_pool);
+  }
+  if (n) {
+    n->type = BCHAIN_POOL;
+    n->buff = n->_buff;
+  }
   /* mmap is greater than 1MB, inline otherwise */
-  if (size >= 1048576) {
+  else if (size >= 1048576) {
     n = malloc(offsetof(struct bchain, _buff));
     if(!n) {
       mtevL(mtev_error, "failed to alloc bchain in bchain_alloc (size %zd)\n", size);
@@ -297,6 +357,10 @@ void bchain_free(struct bchain *b, int line) {
   if(b->type == BCHAIN_MMAP) {
     munmap(b->buff, b->allocd);
   }
+  else if(b->type == BCHAIN_POOL) {
+    mtev_bufpool_free(b);
+    return;
+  }
   free(b);
 }
 #define ALLOC_BCHAIN(s) bchain_alloc(s, __LINE__)
@@ -339,6 +403,9 @@ request_compression_type(mtev_http_request *req)
   } else if (strstr(content_encoding, "gzip") != NULL) {    
     /* gzip and x-gzip */
     return MTEV_COMPRESS_GZIP;
+  } else if (strstr(content_encoding, "zstd") != NULL &&
+             mtev_compress_type_available(MTEV_COMPRESS_ZSTD)) {
+    return MTEV_COMPRESS_ZSTD;
   }
 
   return MTEV_COMPRESS_NONE;
@@ -348,6 +415,60 @@ mtev_http_request *
 mtev_http_session_request(mtev_http_session_ctx *ctx) {
   return &ctx->req;
 }
+/* The quality the Accept header gives type, from its most specific
+ * matching media range; 0 when nothing matches. */
+static double
+mtev_http_accept_quality(const char *accept, const char *type) {
+  const char *p = accept, *slash = strchr(type, '/');
+  size_t typelen = strlen(type), majorlen = slash ? (size_t)(slash - type) : typelen;
+  int best = -1;
+  double q = 0.0;
+
+  while(*p) {
+    const char *range;
+    size_t rlen;
+    int spec = -1;
+    double rq = 1.0;
+
+    while(*p == ' ' || *p == '\t' || *p == ',') p++;
+    if(!*p) break;
+    range = p;
+    while(*p && *p != ';' && *p != ',' && *p != ' ' && *p != '\t') p++;
+    rlen = p - range;
+    while(*p && *p != ',') {
+      if(*p++ != ';') continue;
+      while(*p == ' ' || *p == '\t') p++;
+      if((p[0] == 'q' || p[0] == 'Q') && p[1] == '=') rq = strtod(p + 2, NULL);
+    }
+    if(rlen == 3 && !memcmp(range, "*/*", 3)) spec = 0;
+    else if(rlen == majorlen + 2 && range[majorlen + 1] == '*' &&
+            !strncasecmp(range, type, majorlen + 1)) spec = 1;
+    else if(rlen == typelen && !strncasecmp(range, type, typelen)) spec = 2;
+    if(spec > best) {
+      best = spec;
+      q = rq;
+    }
+  }
+  return q;
+}
+const char *
+mtev_http_request_negotiate(mtev_http_request *req, const char **types, int ntypes) {
+  const char *accept = NULL, *chosen = NULL;
+  double bestq = 0.0;
+  int i;
+  if(ntypes < 1) return NULL;
+  if(!mtev_hash_retr_str(&req->headers, "accept", strlen("accept"), &accept) ||
+     !*accept)
+    return types[0];
+  for(i = 0; i < ntypes; i++) {
+    double q = mtev_http_accept_quality(accept, types[i]);
+    if(q > bestq) {
+      bestq = q;
+      chosen = types[i];
+    }
+  }
+  return chosen;
+}
 mtev_http_response *
 mtev_http_session_response(mtev_http_session_ctx *ctx) {
   return &ctx->res;
@@ -425,6 +546,10 @@ const char *mtev_http_request_querystring(mtev_http_request *req, const char *k)
 const char *mtev_http_request_orig_querystring(mtev_http_request *req) {
   return req->orig_qs;
 }
+mtev_arena_t *mtev_http_request_arena(mtev_http_request *req) {
+  if(!req->arena) req->arena = mtev_arena_create(0);
+  return req->arena;
+}
 mtev_hash_table *mtev_http_request_querystring_table(mtev_http_request *req) {
   return &req->querystring;
 }
@@ -855,6 +980,9 @@ mtev_http_request_finalize_headers(mtev_http_request *req, mtev_boolean *err) {
           if(strstr(value, "gzip")) req->opts |= MTEV_HTTP_GZIP;
           if(strstr(value, "deflate")) req->opts |= MTEV_HTTP_DEFLATE;
           if(strstr(value, "lz4f")) req->opts |= MTEV_HTTP_LZ4F;
+          if(strstr(value, "zstd") &&
+             mtev_compress_type_available(MTEV_COMPRESS_ZSTD))
+            req->opts |= MTEV_HTTP_ZSTD;
         }
         if(name)
           mtev_hash_replace(&req->headers, name, strlen(name), (void *)value,
@@ -929,7 +1057,7 @@ mtev_http_process_querystring(mtev_http_request *req) {
   cp = strchr(req->uri_str, '?');
   if(!cp) return;
   *cp++ = '\0';
-  req->orig_qs = strdup(cp);
+  req->orig_qs = mtev_arena_strdup(mtev_http_request_arena(req), cp);
   for (interest = strtok_r(cp, "&", &brk);
        interest;
        interest = strtok_r(NULL, "&", &brk)) {
@@ -1065,7 +1193,7 @@ mtev_http_request_release(mtev_http_session_ctx *ctx) {
     ctx->drainage -= drained;
   }
   RELEASE_BCHAIN(ctx->req.current_request_chain);
-  if(ctx->req.orig_qs) free(ctx->req.orig_qs);
+  if(ctx->req.arena) mtev_arena_reset(ctx->req.arena);
   /* If someone has jammed in a payload, clean that up too */
   if(ctx->req.upload.freefunc) {
     ctx->req.upload.freefunc(ctx->req.upload.data, ctx->req.upload.size,
@@ -1078,6 +1206,11 @@ mtev_http_request_release(mtev_http_session_ctx *ctx) {
     mtev_destroy_stream_decompress_ctx(ctx->req.decompress_ctx);
     ctx->req.decompress_ctx = NULL;
   }
+  if (ctx->req.splice_pipe_open) {
+    close(ctx->req.splice_pipe[0]);
+    close(ctx->req.splice_pipe[1]);
+    ctx->req.splice_pipe_open = mtev_false;
+  }
   memset(&ctx->req.state, 0,
          sizeof(ctx->req) - (unsigned long)&(((mtev_http_request *)0)->state));
   
@@ -1106,11 +1239,14 @@ mtev_http_ctx_session_release(mtev_http_session_ctx *ctx) {
     if(ctx->req.user_data) RELEASE_BCHAIN(ctx->req.user_data);
     if(ctx->req.first_input) RELEASE_BCHAIN(ctx->req.first_input);
     mtev_http_response_release(ctx);
+    mtev_arena_destroy(ctx->req.arena);
     pthread_mutex_destroy(&ctx->write_lock);
 #ifdef HAVE_WSLAY
     if (ctx->is_websocket == mtev_true) {
       wslay_event_context_free(ctx->wslay_ctx);
     }
+    mtev_ws_outq_clear(&ctx->ws_outq);
+    mtev_ws_deflate_free(ctx->ws_deflate);
 #endif
     free(ctx);
   }
@@ -1231,6 +1367,23 @@ mtev_http_session_req_consume_read(mtev_http_session_ctx *ctx,
 
  successful_chunk_size:
   {
+    if (next_chunk > 0 && ctx->req.payload_chunked == mtev_false &&
+        in == ctx->req.first_input && in->size == (size_t)next_chunk) {
+      /* The whole input link is payload, hand it over without a copy */
+      mtevL(http_debug, " ... have chunk (%d), moving\n", next_chunk);
+      ctx->req.first_input = in->next;
+      if(ctx->req.last_input == in) ctx->req.last_input = in->next;
+      in->next = in->prev = NULL;
+      in->compression = compression_type;
+      if (ctx->req.user_data_last != NULL) {
+        ctx->req.user_data_last->next = in;
+      }
+      else {
+        ctx->req.user_data = in;
+      }
+      ctx->req.user_data_last = in;
+      return next_chunk;
+    }
     if (next_chunk > 0) {
       mtevL(http_debug, " ... have chunk (%d)\n", next_chunk);
       struct bchain *data = ALLOC_BCHAIN(next_chunk);
@@ -1519,6 +1672,209 @@ mtev_http_session_req_consume(mtev_http_session_ctx *ctx,
   return bytes_read;
 }
 
+static mtev_boolean
+mtev_http_request_payload_read_all(mtev_http_request *req) {
+  if(req->payload_chunked) return req->read_last_chunk;
+  return req->content_length_read >= req->content_length;
+}
+
+/* Pull the next piece of the payload off the wire into user_data.
+ * returns 1 on progress, 0 if we'd block, -1 on error.
+ */
+static int
+mtev_http_session_req_pull(mtev_http_session_ctx *ctx,
+                           mtev_compress_type compression_type, int *mask) {
+  int rlen = mtev_http_session_req_consume_read(ctx, compression_type, mask);
+  if(rlen == -1) return 0;
+  if(rlen < 0) {
+    errno = ENOTSUP;
+    return -1;
+  }
+  if(ctx->req.payload_chunked) {
+    if(rlen == 0) {
+      ctx->req.read_last_chunk = mtev_true;
+      ctx->req.content_length = ctx->req.content_length_read;
+    }
+  }
+  else if(rlen == 0) {
+    /* no new data was read, wait for the socket */
+    *mask = EVENTER_READ | EVENTER_EXCEPTION;
+    return 0;
+  }
+  ctx->req.content_length_read += rlen;
+  return 1;
+}
+
+int
+mtev_http_session_req_consume_stream(mtev_http_session_ctx *ctx,
+                                     mtev_http_body_func f, void *closure,
+                                     int *mask) {
+  mtev_compress_type compression_type = request_compression_type(&ctx->req);
+
+  if(!ctx->req.has_payload) return 1;
+  while(1) {
+    struct bchain *in;
+    while((in = ctx->req.user_data) != NULL) {
+      if(in->size > 0 && in->compression != MTEV_COMPRESS_NONE) {
+        struct bchain *out = NULL, *last_out = NULL;
+        if(mtev_http_session_decompress(in->compression, in, ctx,
+                                        &out, &last_out) < 0) {
+          errno = EINVAL;
+          return -1;
+        }
+        /* splice the decompressed links in where the compressed one was */
+        last_out->next = in->next;
+        if(ctx->req.user_data_last == in) ctx->req.user_data_last = last_out;
+        ctx->req.user_data = out;
+        in->next = NULL;
+        RELEASE_BCHAIN(in);
+        continue;
+      }
+      if(in->size > 0) {
+        switch(f(ctx, in, closure)) {
+          case MTEV_HTTP_BODY_CONTINUE:
+            break;
+          case MTEV_HTTP_BODY_PAUSE:
+            mtevL(http_debug, " ... payload stream paused (%d)\n",
+                  ctx->conn.e ? ctx->conn.e->fd : -1);
+            *mask = EVENTER_EXCEPTION;
+            return 0;
+          default:
+            errno = ECANCELED;
+            return -1;
+        }
+      }
+      ctx->req.user_data = in->next;
+      if(ctx->req.user_data_last == in) ctx->req.user_data_last = NULL;
+      in->next = NULL;
+      RELEASE_BCHAIN(in);
+    }
+    if(mtev_http_request_payload_read_all(&ctx->req)) return 1;
+    if(ctx->conn.e == NULL) {
+      errno = ENOTCONN;
+      return -1;
+    }
+    switch(mtev_http_session_req_pull(ctx, compression_type, mask)) {
+      case 0: return 0;
+      case -1: return -1;
+      default: break;
+    }
+  }
+  /* NOT REACHED */
+}
+
+void
+mtev_http_session_resume_body(mtev_http_session_ctx *ctx) {
+  if(ctx->conn.e == NULL) return;
+  /* The socket is almost certainly writable, this will drive us promptly */
+  eventer_update(ctx->conn.e, EVENTER_READ | EVENTER_WRITE | EVENTER_EXCEPTION);
+}
+
+static int
+mtev_http_write_fully(int fd, const void *buf, size_t len) {
+  size_t off = 0;
+  while(off < len) {
+    ssize_t rv = write(fd, (const char *)buf + off, len - off);
+    if(rv < 0 && errno == EINTR) continue;
+    if(rv <= 0) return -1;
+    off += rv;
+  }
+  return 0;
+}
+
+static mtev_http_body_disposition_t
+mtev_http_body_to_fd(mtev_http_session_ctx *ctx, const struct bchain *b,
+                     void *closure) {
+  int fd = *((int *)closure);
+  if(mtev_http_write_fully(fd, b->buff + b->start, b->size) < 0) {
+    mtevL(mtev_error, "http payload write to fd %d failed: %s\n",
+          fd, strerror(errno));
+    return MTEV_HTTP_BODY_ABORT;
+  }
+  return MTEV_HTTP_BODY_CONTINUE;
+}
+
+#ifdef HAVE_SPLICE
+/* The payload is a plain, unencrypted, identity-encoded byte count:
+ * move it socket -> pipe -> fd without copying through user space.
+ */
+static int
+http_req_splice_to_fd(mtev_http_session_ctx *ctx, int fd, int *mask) {
+  int64_t remaining;
+  struct bchain *in;
+
+  /* Anything already pulled into user space goes out first */
+  while((in = ctx->req.user_data) != NULL) {
+    if(mtev_http_write_fully(fd, in->buff + in->start, in->size) < 0) return -1;
+    ctx->req.user_data = in->next;
+    if(ctx->req.user_data_last == in) ctx->req.user_data_last = NULL;
+    in->next = NULL;
+    RELEASE_BCHAIN(in);
+  }
+  while((in = ctx->req.first_input) != NULL &&
+        ctx->req.content_length_read < ctx->req.content_length) {
+    remaining = ctx->req.content_length - ctx->req.content_length_read;
+    size_t len = MIN((int64_t)in->size, remaining);
+    if(mtev_http_write_fully(fd, in->buff + in->start, len) < 0) return -1;
+    in->start += len;
+    in->size -= len;
+    ctx->req.content_length_read += len;
+    if(in->size > 0) break;
+    ctx->req.first_input = in->next;
+    if(ctx->req.last_input == in) ctx->req.last_input = in->next;
+    in->next = NULL;
+    RELEASE_BCHAIN(in);
+  }
+
+  if(ctx->req.content_length_read < ctx->req.content_length &&
+     !ctx->req.splice_pipe_open) {
+    if(pipe(ctx->req.splice_pipe) != 0) return -1;
+    ctx->req.splice_pipe_open = mtev_true;
+  }
+  while(ctx->req.content_length_read < ctx->req.content_length) {
+    ssize_t moved, drained = 0;
+    remaining = ctx->req.content_length - ctx->req.content_length_read;
+    moved = splice(ctx->conn.e->fd, NULL, ctx->req.splice_pipe[1], NULL,
+                   MIN(remaining, DEFAULT_BCHAINSIZE * 4),
+                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if(moved < 0 && errno == EINTR) continue;
+    if(moved < 0 && errno == EAGAIN) {
+      *mask = EVENTER_READ | EVENTER_EXCEPTION;
+      return 0;
+    }
+    if(moved <= 0) {
+      if(moved == 0) errno = ECONNRESET;
+      return -1;
+    }
+    while(drained < moved) {
+      ssize_t rv = splice(ctx->req.splice_pipe[0], NULL, fd, NULL,
+                          moved - drained, SPLICE_F_MOVE);
+      if(rv < 0 && errno == EINTR) continue;
+      if(rv <= 0) return -1;
+      drained += rv;
+    }
+    mtevL(http_debug, " ... spliced %d payload bytes to fd %d\n",
+          (int)moved, fd);
+    ctx->req.content_length_read += moved;
+  }
+  return 1;
+}
+#endif
+
+int
+mtev_http_session_req_consume_to_fd(mtev_http_session_ctx *ctx,
+                                    int fd, int *mask) {
+  if(!ctx->req.has_payload) return 1;
+#ifdef HAVE_SPLICE
+  if(!ctx->req.payload_chunked &&
+     request_compression_type(&ctx->req) == MTEV_COMPRESS_NONE &&
+     ctx->conn.e != NULL && ctx->conn.e->opset == eventer_POSIX_fd_opset)
+    return http_req_splice_to_fd(ctx, fd, mask);
+#endif
+  return mtev_http_session_req_consume_stream(ctx, mtev_http_body_to_fd,
+                                              &fd, mask);
+}
+
 /* this magic GUID is defined in the websocket specification and must
  * be what is used to create the accept key
  *
@@ -1592,6 +1948,19 @@ mtev_http_websocket_handshake(mtev_http_session_ctx *ctx)
   mtev_http_response_header_set(ctx, "Connection", "Upgrade");
   mtev_http_response_header_set(ctx, "Sec-WebSocket-Accept", accept_key);
   mtev_http_response_header_set(ctx, "Sec-WebSocket-Protocol", protocol);
+#ifdef HAVE_WSLAY_EVENT_CONFIG_SET_ALLOWED_RSV_BITS
+  const char *extensions = NULL;
+  mtev_ws_deflate_params_t agreed;
+  (void)mtev_hash_retr_str(headers, "sec-websocket-extensions",
+                           strlen("sec-websocket-extensions"), &extensions);
+  if (ws_deflate_enabled && extensions &&
+      mtev_ws_deflate_negotiate(extensions, &ws_deflate_limits, &agreed)) {
+    char ext_response[256];
+    mtev_ws_deflate_params_format(&agreed, ext_response, sizeof(ext_response));
+    mtev_http_response_header_set(ctx, "Sec-WebSocket-Extensions", ext_response);
+    ctx->ws_deflate = mtev_ws_deflate_new(&agreed, mtev_true, ws_deflate_level);
+  }
+#endif
   mtev_http_response_status_set(ctx, 101, "Switching Protocols");
 
   /* there is no body and this is not the final */
@@ -1599,14 +1968,15 @@ mtev_http_websocket_handshake(mtev_http_session_ctx *ctx)
   return ctx->is_websocket;
 }
 
+/* wslay only frames control messages for us (data frames are built by
+ * mtev_http_websocket_queue_msg); they join the session's write queue and
+ * go out with everything else in _websocket_flush. */
 static ssize_t
 wslay_send_callback(wslay_event_context_ptr ctx,
                     const uint8_t *data, size_t len, int flags,
                     void *user_data)
 {
-  ssize_t r;
   mtev_http_session_ctx *session_ctx = user_data;
-  session_ctx->wanted_eventer_mask = 0;
 
   pthread_mutex_lock(&session_ctx->write_lock);
   if(!session_ctx->conn.e || session_ctx->is_websocket == mtev_false) {
@@ -1614,22 +1984,26 @@ wslay_send_callback(wslay_event_context_ptr ctx,
     wslay_event_set_error(session_ctx->wslay_ctx, WSLAY_ERR_CALLBACK_FAILURE);
     return -1;
   }
+  mtev_ws_outq_append(&session_ctx->ws_outq, data, len);
+  mtevL(http_io, "   <- wslay_send_callback, queued (%d)\n", (int)len);
+  pthread_mutex_unlock(&session_ctx->write_lock);
+  return len;
+}
 
-
-  while((r = session_ctx->conn.e->opset->
-         write(session_ctx->conn.e->fd,
-               data, len, &session_ctx->wanted_eventer_mask, session_ctx->conn.e)) == -1 && errno == EINTR);
-  if (r == -1) {
-    if (errno == EAGAIN || errno == EWOULDBLOCK) {
-      wslay_event_set_error(session_ctx->wslay_ctx, WSLAY_ERR_WOULDBLOCK);
-    } else {
-      wslay_event_set_error(session_ctx->wslay_ctx, WSLAY_ERR_CALLBACK_FAILURE);
-    }
+static int
+_websocket_flush(mtev_http_session_ctx *ctx) {
+  int rv;
+  pthread_mutex_lock(&ctx->write_lock);
+  if(!ctx->conn.e) {
+    pthread_mutex_unlock(&ctx->write_lock);
+    return -1;
   }
-  mtevL(http_io, "   <- wslay_send_callback, sent (%d)\n", (int)r);
-
-  pthread_mutex_unlock(&session_ctx->write_lock);
-  return r;
+  rv = mtev_ws_outq_flush(&ctx->ws_outq, ctx->conn.e, &ctx->wanted_eventer_mask);
+  mtevL(http_io, "   <- websocket flush(%d), %zu bytes pending\n",
+        ctx->conn.e->fd, ctx->ws_outq.bytes);
+  pthread_mutex_unlock(&ctx->write_lock);
+  if(rv < 0 && errno == EAGAIN) return 0;
+  return rv;
 }
 
 static ssize_t
@@ -1671,10 +2045,30 @@ wslay_on_msg_recv_callback(wslay_event_context_ptr ctx,
   mtev_http_session_ctx *session_ctx = user_data;
   int rv = 0;
 
+  if (arg->opcode == WSLAY_CONNECTION_CLOSE) {
+    /* wslay answers with its own close; nothing may follow it */
+    pthread_mutex_lock(&session_ctx->write_lock);
+    session_ctx->ws_close_queued = mtev_true;
+    pthread_mutex_unlock(&session_ctx->write_lock);
+  }
   if (!wslay_is_ctrl_frame(arg->opcode)) {
+    const unsigned char *msg = arg->msg;
+    size_t msg_length = arg->msg_length;
+    unsigned char *inflated = NULL;
+
+    if (arg->rsv & WSLAY_RSV1_BIT) {
+      if (session_ctx->ws_deflate == NULL ||
+          mtev_ws_deflate_inflate(session_ctx->ws_deflate, msg, msg_length,
+                                  &inflated, &msg_length) != 0) {
+        mtevL(mtev_error, "websocket message could not be inflated, closing\n");
+        session_ctx->is_websocket = mtev_false;
+        return;
+      }
+      msg = inflated;
+    }
     if (session_ctx->websocket_dispatcher != NULL) {
       mtevL(http_debug, "   <- websocket_dispatch (%d)\n", session_ctx->conn.e->fd);
-      rv = session_ctx->websocket_dispatcher(session_ctx, arg->opcode, arg->msg, arg->msg_length);
+      rv = session_ctx->websocket_dispatcher(session_ctx, arg->opcode, msg, msg_length);
       mtevL(http_debug, "   <- websocket_dispatch (%d) == %d\n", session_ctx->conn.e->fd, rv);
       if (rv != 0) {
         /* force the drive loop to abandon this as a websocket */
@@ -1684,6 +2078,7 @@ wslay_on_msg_recv_callback(wslay_event_context_ptr ctx,
        mtevL(mtev_error, "session_ctx has no websocket_dispatcher function set\n");
        session_ctx->is_websocket = mtev_false;
     }
+    free(inflated);
   }
 }
 #endif //HAVE_WSLAY
@@ -1734,6 +2129,10 @@ mtev_http_session_drive(eventer_t e, int origmask, void *closure,
       mtevL(http_debug, "   ... *is* websocket(%d)\n", e->fd);
       /* init the wslay library for websocket communication */
       wslay_event_context_server_init(&ctx->wslay_ctx, &wslay_callbacks, ctx);
+#ifdef HAVE_WSLAY_EVENT_CONFIG_SET_ALLOWED_RSV_BITS
+      if (ctx->ws_deflate)
+        wslay_event_config_set_allowed_rsv_bits(ctx->wslay_ctx, WSLAY_RSV1_BIT);
+#endif
     } else {
 #endif
       _http_perform_write(ctx, &maybe_write_mask);
@@ -1776,9 +2175,13 @@ mtev_http_session_drive(eventer_t e, int origmask, void *closure,
     }
 
     mtevL(http_debug, "   <- mtev_http_session_drive, websocket send(%d)\n", e->fd);
+    ctx->wanted_eventer_mask = 0;
     if (wslay_event_send(ctx->wslay_ctx) != 0) {
       goto abort_drive;
     }
+    if (_websocket_flush(ctx) != 0) {
+      goto abort_drive;
+    }
 
     /* this could be a very long lived socket
      * return for now and await another IO event to trigger
@@ -1894,15 +2297,62 @@ mtev_http_response_header_set(mtev_http_session_ctx *ctx,
   return mtev_true;
 }
 mtev_boolean
+mtev_http_response_compression_policy(mtev_http_session_ctx *ctx,
+                                      uint32_t encodings, int level,
+                                      size_t min_size) {
+  check_realloc_response(&ctx->res);
+  if(ctx->res.output_started == mtev_true) return mtev_false;
+  ctx->res.compression_policy = mtev_true;
+  ctx->res.compression_allowed = encodings & MTEV_HTTP_COMPRESSION_MASK;
+  ctx->res.compression_level = level;
+  ctx->res.compression_min_size = min_size;
+  return mtev_true;
+}
+mtev_boolean
+mtev_http_response_compression_policy_get(mtev_http_session_ctx *ctx,
+                                          uint32_t *encodings, int *level,
+                                          size_t *min_size) {
+  if(!ctx->res.compression_policy) {
+    if(encodings) *encodings = MTEV_HTTP_COMPRESSION_MASK;
+    if(level) *level = MTEV_COMPRESS_LEVEL_DEFAULT;
+    if(min_size) *min_size = compression_min_size;
+    return mtev_false;
+  }
+  if(encodings) *encodings = ctx->res.compression_allowed;
+  if(level) *level = ctx->res.compression_level;
+  if(min_size) *min_size = ctx->res.compression_min_size;
+  return mtev_true;
+}
+/* Substitute the policy's preferred (client-accepted) encoding for the
+ * requested one.
+ */
+static uint32_t
+mtev_http_response_policy_encoding(mtev_http_session_ctx *ctx, uint32_t opt) {
+  static const uint32_t preference[] = {
+    MTEV_HTTP_ZSTD, MTEV_HTTP_GZIP, MTEV_HTTP_DEFLATE, MTEV_HTTP_LZ4F
+  };
+  uint32_t candidates = ctx->res.compression_allowed & ctx->req.opts;
+  int i;
+  opt &= ~MTEV_HTTP_COMPRESSION_MASK;
+  for(i=0; i<sizeof(preference)/sizeof(*preference); i++) {
+    if(candidates & preference[i]) return opt | preference[i];
+  }
+  return opt;
+}
+mtev_boolean
 mtev_http_response_option_set(mtev_http_session_ctx *ctx, uint32_t opt) {
   check_realloc_response(&ctx->res);
   if(ctx->res.output_started == mtev_true) return mtev_false;
+  if((opt & MTEV_HTTP_COMPRESSION_MASK) && ctx->res.compression_policy) {
+    opt = mtev_http_response_policy_encoding(ctx, opt);
+    if(opt == 0) return mtev_false;
+  }
   /* transfer and content encodings only allowed in HTTP/1.1 */
   if(ctx->res.protocol != MTEV_HTTP11 &&
      (opt & MTEV_HTTP_CHUNKED))
     return mtev_false;
   if(ctx->res.protocol != MTEV_HTTP11 &&
-     (opt & (MTEV_HTTP_GZIP | MTEV_HTTP_DEFLATE | MTEV_HTTP_LZ4F)))
+     (opt & MTEV_HTTP_COMPRESSION_MASK))
     return mtev_false;
   if(((ctx->res.output_options | opt) &
       (MTEV_HTTP_GZIP | MTEV_HTTP_DEFLATE | MTEV_HTTP_LZ4F)) ==
@@ -1915,9 +2365,11 @@ mtev_http_response_option_set(mtev_http_session_ctx *ctx, uint32_t opt) {
   ctx->res.output_options |= opt;
   if(ctx->res.output_options & MTEV_HTTP_CHUNKED)
     CTX_ADD_HEADER("Transfer-Encoding", "chunked");
-  if(ctx->res.output_options & (MTEV_HTTP_GZIP | MTEV_HTTP_DEFLATE | MTEV_HTTP_LZ4F)) {
+  if(ctx->res.output_options & MTEV_HTTP_COMPRESSION_MASK) {
     CTX_ADD_HEADER("Vary", "Accept-Encoding");
-    if(ctx->res.output_options & MTEV_HTTP_GZIP)
+    if(ctx->res.output_options & MTEV_HTTP_ZSTD)
+      CTX_ADD_HEADER("Content-Encoding", "zstd");
+    else if(ctx->res.output_options & MTEV_HTTP_GZIP)
       CTX_ADD_HEADER("Content-Encoding", "gzip");
     else if(ctx->res.output_options & MTEV_HTTP_DEFLATE)
       CTX_ADD_HEADER("Content-Encoding", "deflate");
@@ -1968,6 +2420,41 @@ mtev_boolean
 mtev_http_response_append_str(mtev_http_session_ctx *ctx, const char *b) {
   return mtev_http_response_append(ctx, b, strlen(b));
 }
+static int
+mtev_http_response_json_write(void *closure, const char *buf, int len) {
+  return mtev_http_response_append((mtev_http_session_ctx *)closure, buf, len) ? len : -1;
+}
+mtev_boolean
+mtev_http_response_append_json(mtev_http_session_ctx *ctx,
+                               struct mtev_json_object *doc) {
+  if(mtev_json_object_to_json_stream(doc, mtev_http_response_json_write, ctx) < 0)
+    return mtev_false;
+  return mtev_http_response_append(ctx, "\n", 1);
+}
+mtev_boolean
+mtev_http_response_append_msgpack(mtev_http_session_ctx *ctx,
+                                  struct mtev_json_object *doc) {
+  mtev_boolean rv;
+  mtev_dyn_buffer_t buf;
+  mtev_dyn_buffer_init(&buf);
+  mtev_msgpack_pack_json(&buf, doc);
+  rv = mtev_http_response_append(ctx, mtev_dyn_buffer_data(&buf),
+                                 mtev_dyn_buffer_used(&buf));
+  mtev_dyn_buffer_destroy(&buf);
+  return rv;
+}
+mtev_boolean
+mtev_http_response_json(mtev_http_session_ctx *ctx, int code,
+                        const char *reason, struct mtev_json_object *doc) {
+  static const char *types[] = { "application/json", MTEV_MSGPACK_CONTENT_TYPE };
+  const char *type = mtev_http_request_negotiate(&ctx->req, types, 2);
+  /* when neither is acceptable, JSON is still the better answer than a 406 */
+  if(!type) type = types[0];
+  mtev_http_response_standard(ctx, code, reason, type);
+  mtev_http_response_header_set(ctx, "Vary", "Accept, Accept-Encoding");
+  if(type == types[1]) return mtev_http_response_append_msgpack(ctx, doc);
+  return mtev_http_response_append_json(ctx, doc);
+}
 mtev_boolean
 mtev_http_response_appendf(mtev_http_session_ctx *ctx,
                            const char *format, ...) {
@@ -2059,9 +2546,12 @@ _http_construct_leader(mtev_http_session_ctx *ctx) {
   int i;
   const char **keys;
   char *static_key_array[16];
-  mtev_boolean cl_present = mtev_false;
+  mtev_boolean cl_present = mtev_false, bodiless;
 
   mtevAssert(!ctx->res.leader);
+  /* these never carry a body, so they need neither a length nor chunking */
+  bodiless = (ctx->res.status_code >= 100 && ctx->res.status_code < 200) ||
+             ctx->res.status_code == 204 || ctx->res.status_code == 304;
   ctx->res.leader = b = ALLOC_BCHAIN(DEFAULT_BCHAINSIZE);
 
   protocol_str = ctx->res.protocol == MTEV_HTTP11 ?
@@ -2106,7 +2596,7 @@ _http_construct_leader(mtev_http_session_ctx *ctx) {
     /* One of these options will necessarily be set if we come through here
      * a second time.
      */
-    if(ctx->res.output_options & (MTEV_HTTP_CHUNKED | MTEV_HTTP_CLOSE))
+    if(bodiless || (ctx->res.output_options & (MTEV_HTTP_CHUNKED | MTEV_HTTP_CLOSE)))
       cl_present = mtev_true;
 
     if(!cl_present) {
@@ -2137,6 +2627,17 @@ _http_construct_leader(mtev_http_session_ctx *ctx) {
   return len;
 }
 
+/* The order here must match the Content-Encoding choice in
+ * mtev_http_response_option_set.
+ */
+static mtev_compress_type
+response_compression_type(uint32_t opts) {
+  if(opts & MTEV_HTTP_ZSTD) return MTEV_COMPRESS_ZSTD;
+  if(opts & MTEV_HTTP_GZIP) return MTEV_COMPRESS_GZIP;
+  if(opts & MTEV_HTTP_DEFLATE) return MTEV_COMPRESS_DEFLATE;
+  if(opts & MTEV_HTTP_LZ4F) return MTEV_COMPRESS_LZ4F;
+  return MTEV_COMPRESS_NONE;
+}
 static mtev_boolean
 _http_encode_chain(mtev_http_response *res,
                    struct bchain *out, void *inbuff, size_t *inlen,
@@ -2144,16 +2645,11 @@ _http_encode_chain(mtev_http_response *res,
   int opts = res->output_options;
   if (done) *done = mtev_false;
   if (res->compress_ctx == NULL) {
+    int level = res->compression_policy ?
+                  res->compression_level : MTEV_COMPRESS_LEVEL_DEFAULT;
     res->compress_ctx = mtev_create_stream_compress_ctx();
-    if(opts & MTEV_HTTP_GZIP) {
-      mtev_stream_compress_init(res->compress_ctx, MTEV_COMPRESS_GZIP);
-    } else if(opts & MTEV_HTTP_DEFLATE) {
-      mtev_stream_compress_init(res->compress_ctx, MTEV_COMPRESS_DEFLATE);
-    } else if(opts & MTEV_HTTP_LZ4F) {
-      mtev_stream_compress_init(res->compress_ctx, MTEV_COMPRESS_LZ4F);
-    } else {
-      mtev_stream_compress_init(res->compress_ctx, MTEV_COMPRESS_NONE);
-    }
+    mtev_stream_compress_init_level(res->compress_ctx,
+                                    response_compression_type(opts), level);
   }
 
   size_t olen;
@@ -2194,7 +2690,7 @@ mtev_http_process_output_bchain(mtev_http_session_ctx *ctx,
   int opts = ctx->res.output_options;
 
   if(in->type == BCHAIN_MMAP &&
-     0 == (opts & (MTEV_HTTP_GZIP | MTEV_HTTP_DEFLATE | MTEV_HTTP_LZ4F | MTEV_HTTP_CHUNKED))) {
+     0 == (opts & (MTEV_HTTP_COMPRESSION_MASK | MTEV_HTTP_CHUNKED))) {
     out = ALLOC_BCHAIN(0);
     out->buff = in->buff;
     out->type = in->type;
@@ -2205,9 +2701,8 @@ mtev_http_process_output_bchain(mtev_http_session_ctx *ctx,
   }
   /* a chunked header looks like: hex*\r\ndata\r\n */
   /* let's assume that content never gets "larger" */
-  if(opts & MTEV_HTTP_GZIP) maxlen = mtev_compress_bound(MTEV_COMPRESS_GZIP, in->size);
-  else if(opts & MTEV_HTTP_DEFLATE) maxlen = mtev_compress_bound(MTEV_COMPRESS_DEFLATE, in->size);
-  else if(opts & MTEV_HTTP_LZ4F) maxlen = mtev_compress_bound(MTEV_COMPRESS_LZ4F, in->size);
+  if(opts & MTEV_HTTP_COMPRESSION_MASK)
+    maxlen = mtev_compress_bound(response_compression_type(opts), in->size);
 
   /* So, the link size is the len(data) + 4 + ceil(log(len(data))/log(16)) */
   ilen = maxlen;
@@ -2254,7 +2749,7 @@ mtev_http_process_output_bchain(mtev_http_session_ctx *ctx,
 }
 void
 raw_finalize_encoding(mtev_http_response *res) {
-  if(res->output_options & MTEV_HTTP_GZIP) {
+  if(res->output_options & (MTEV_HTTP_GZIP | MTEV_HTTP_ZSTD)) {
     mtev_boolean finished = mtev_false;
     struct bchain *r = res->output_raw_last;
     mtevAssert((r == NULL && res->output_raw == NULL) ||
@@ -2326,6 +2821,15 @@ _mtev_http_response_flush(mtev_http_session_ctx *ctx,
 
   if(ctx->res.closed == mtev_true) return mtev_false;
   if(ctx->res.output_started == mtev_false) {
+    size_t min_size = ctx->res.compression_policy ?
+                        ctx->res.compression_min_size : compression_min_size;
+    /* If we have the whole body and it's tiny, compressing is a waste */
+    if(final && (ctx->res.output_options & MTEV_HTTP_COMPRESSION_MASK) &&
+       ctx->res.output_chain_bytes < min_size) {
+      ctx->res.output_options &= ~MTEV_HTTP_COMPRESSION_MASK;
+      mtev_hash_delete(&ctx->res.headers, "Content-Encoding",
+                       strlen("Content-Encoding"), free, free);
+    }
     _http_construct_leader(ctx);
     ctx->res.output_started = mtev_true;
     mtev_zipkin_span_annotate(ctx->zipkin_span, NULL, ZIPKIN_SERVER_SEND, false);
@@ -2444,18 +2948,142 @@ mtev_http_websocket_queue_msg(mtev_http_session_ctx *ctx, int opcode,
                               const unsigned char *msg, size_t msg_len)
 {
 #ifdef HAVE_WSLAY
+  struct bchain *frame;
+  mtev_ws_deflate_t *d = NULL;
+
   if (ctx->is_websocket == mtev_false || ctx->wslay_ctx == NULL) {
     return mtev_false;
   }
-  struct wslay_event_msg msgarg = {
-    opcode, msg, msg_len
-  };
-  return !wslay_event_queue_msg(ctx->wslay_ctx, &msgarg);
+  pthread_mutex_lock(&ctx->write_lock);
+  /* a close frame must be the last thing we send */
+  if (ctx->ws_close_queued) {
+    pthread_mutex_unlock(&ctx->write_lock);
+    return mtev_false;
+  }
+  /* control frames are never compressed (RFC 7692 section 6) */
+  if (ctx->ws_deflate && !wslay_is_ctrl_frame(opcode) &&
+      msg_len >= ws_deflate_min_size) d = ctx->ws_deflate;
+  /* build the frame straight into the buffer we'll write from */
+  frame = mtev_ws_frame_build(opcode, d, mtev_false, msg, msg_len);
+  if (frame) {
+    mtev_ws_outq_push(&ctx->ws_outq, frame);
+    if (opcode == WSLAY_CONNECTION_CLOSE) ctx->ws_close_queued = mtev_true;
+  }
+  pthread_mutex_unlock(&ctx->write_lock);
+  return frame ? mtev_true : mtev_false;
 #else
   return mtev_false;
 #endif
 }
 
+void
+mtev_http_websocket_msg_ref(mtev_http_websocket_msg_t *m) {
+#ifdef HAVE_WSLAY
+  mtev_atomic_inc32(&m->refcnt);
+#endif
+}
+
+mtev_http_websocket_msg_t *
+mtev_http_websocket_msg_new(int opcode, const unsigned char *msg, size_t msg_len)
+{
+#ifdef HAVE_WSLAY
+  mtev_http_websocket_msg_t *m = calloc(1, sizeof(*m));
+  m->refcnt = 1;
+  m->opcode = opcode;
+  m->plain = mtev_ws_frame_build(opcode, NULL, mtev_false, msg, msg_len);
+  if (m->plain == NULL) {
+    free(m);
+    return NULL;
+  }
+  /* the payload is the tail of the plain frame */
+  m->payload = (unsigned char *)m->plain->buff + m->plain->start +
+               m->plain->size - msg_len;
+  m->len = msg_len;
+  pthread_mutex_init(&m->lock, NULL);
+  return m;
+#else
+  return NULL;
+#endif
+}
+
+void
+mtev_http_websocket_msg_release(mtev_http_websocket_msg_t *m)
+{
+#ifdef HAVE_WSLAY
+  int i;
+  if (m == NULL || mtev_atomic_dec32(&m->refcnt) != 0) return;
+  for (i = 0; i < 16; i++) {
+    if (m->deflated[i]) bchain_free(m->deflated[i], __LINE__);
+  }
+  bchain_free(m->plain, __LINE__);
+  pthread_mutex_destroy(&m->lock);
+  free(m);
+#endif
+}
+
+mtev_boolean
+mtev_http_websocket_queue_shared(mtev_http_session_ctx *ctx, mtev_http_websocket_msg_t *m)
+{
+#ifdef HAVE_WSLAY
+  struct bchain *frame = m->plain;
+
+  if (ctx->is_websocket == mtev_false || ctx->wslay_ctx == NULL) {
+    return mtev_false;
+  }
+  pthread_mutex_lock(&ctx->write_lock);
+  if (ctx->ws_close_queued) {
+    pthread_mutex_unlock(&ctx->write_lock);
+    return mtev_false;
+  }
+  if (m->opcode == WSLAY_CONNECTION_CLOSE) ctx->ws_close_queued = mtev_true;
+  if (ctx->ws_deflate && !wslay_is_ctrl_frame(m->opcode) &&
+      m->len >= ws_deflate_min_size) {
+    if (!mtev_ws_deflate_stateless(ctx->ws_deflate)) {
+      /* the compressor carries context across messages, so this session
+       * needs its own copy */
+      frame = mtev_ws_frame_build(m->opcode, ctx->ws_deflate, mtev_false,
+                                  m->payload, m->len);
+      if (frame) mtev_ws_outq_push(&ctx->ws_outq, frame);
+      pthread_mutex_unlock(&ctx->write_lock);
+      return frame ? mtev_true : mtev_false;
+    }
+    int bits = mtev_ws_deflate_window_bits(ctx->ws_deflate);
+    pthread_mutex_lock(&m->lock);
+    if (m->deflated[bits] == NULL) {
+      mtev_ws_deflate_params_t params = {
+        .server_no_context_takeover = mtev_true,
+        .server_max_window_bits = bits
+      };
+      mtev_ws_deflate_t *d = mtev_ws_deflate_new(&params, mtev_true, ws_deflate_level);
+      m->deflated[bits] = mtev_ws_frame_build(m->opcode, d, mtev_false, m->payload, m->len);
+      mtev_ws_deflate_free(d);
+    }
+    if (m->deflated[bits]) frame = m->deflated[bits];
+    pthread_mutex_unlock(&m->lock);
+  }
+  mtev_ws_outq_push_shared(&ctx->ws_outq, frame, m);
+  pthread_mutex_unlock(&ctx->write_lock);
+  return mtev_true;
+#else
+  return mtev_false;
+#endif
+}
+
+int
+mtev_http_websocket_broadcast(mtev_http_session_ctx **ctxs, int nctxs, int opcode,
+                              const unsigned char *msg, size_t msg_len)
+{
+  int i, queued = 0;
+  mtev_http_websocket_msg_t *m;
+  m = mtev_http_websocket_msg_new(opcode, msg, msg_len);
+  if (m == NULL) return 0;
+  for (i = 0; i < nctxs; i++) {
+    if (mtev_http_websocket_queue_shared(ctxs[i], m)) queued++;
+  }
+  mtev_http_websocket_msg_release(m);
+  return queued;
+}
+
 /* Helper functions */
 
 static int
@@ -2497,7 +3125,43 @@ mtev_http_init() {
   (void)mtev_conf_get_double(NULL, "//zipkin//probability/@debug", &dp);
   mtev_zipkin_sampling(np,pp,dp);
 
+  int64_t min_size;
+  if(mtev_conf_get_int64(NULL, "//http/compression/@min_size", &min_size) &&
+     min_size >= 0)
+    compression_min_size = min_size;
+
+#ifdef HAVE_WSLAY
+  int ival;
+  (void)mtev_conf_get_boolean(NULL, "//http/websocket/@permessage_deflate",
+                              &ws_deflate_enabled);
+  (void)mtev_conf_get_boolean(NULL, "//http/websocket/@server_no_context_takeover",
+                              &ws_deflate_limits.server_no_context_takeover);
+  (void)mtev_conf_get_boolean(NULL, "//http/websocket/@client_no_context_takeover",
+                              &ws_deflate_limits.client_no_context_takeover);
+  if(mtev_conf_get_int(NULL, "//http/websocket/@server_max_window_bits", &ival) &&
+     ival >= 9 && ival <= 15)
+    ws_deflate_limits.server_max_window_bits = ival;
+  if(mtev_conf_get_int64(NULL, "//http/websocket/@deflate_min_size", &min_size) &&
+     min_size >= 0)
+    ws_deflate_min_size = min_size;
+  if(mtev_conf_get_int(NULL, "//http/websocket/@deflate_level", &ival))
+    ws_deflate_level = ival;
+#endif
+
   http_debug = mtev_log_stream_find("debug/http");
   http_access = mtev_log_stream_find("http/access");
   http_io = mtev_log_stream_find("http/io");
+
+  stats_ns_t *compress_ns =
+    mtev_stats_ns(mtev_stats_ns(mtev_stats_ns(NULL, "mtev"), "http"), "compression");
+  mtev_compress_type type;
+  for(type = MTEV_COMPRESS_NONE + 1; type < MTEV_COMPRESS_MAX; type++) {
+    const mtev_compress_stats_t *live = mtev_compress_stats_live(type);
+    stats_ns_t *ns;
+    if(!mtev_compress_type_available(type)) continue;
+    ns = mtev_stats_ns(compress_ns, mtev_compress_type_name(type));
+    stats_rob_i64(ns, "bytes_in", (void *)&live->bytes_in);
+    stats_rob_i64(ns, "bytes_out", (void *)&live->bytes_out);
+    stats_rob_i64(ns, "ns", (void *)&live->ns);
+  }
 }
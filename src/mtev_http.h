@@ -39,6 +39,7 @@
 #include "eventer/eventer.h"
 #include "mtev_compress.h"
 #include "mtev_hash.h"
+#include "mtev_arena.h"
 #include "mtev_atomic.h"
 #include "mtev_hooks.h"
 #include "mtev_listener.h"
@@ -56,10 +57,14 @@ typedef enum {
 #define MTEV_HTTP_GZIP         0x0010
 #define MTEV_HTTP_DEFLATE      0x0020
 #define MTEV_HTTP_LZ4F         0x0100
+#define MTEV_HTTP_ZSTD         0x0200
+#define MTEV_HTTP_COMPRESSION_MASK \
+  (MTEV_HTTP_GZIP | MTEV_HTTP_DEFLATE | MTEV_HTTP_LZ4F | MTEV_HTTP_ZSTD)
 
 typedef enum {
   BCHAIN_INLINE = 0,
-  BCHAIN_MMAP
+  BCHAIN_MMAP,
+  BCHAIN_POOL
 } bchain_type_t;
 
 struct bchain;
@@ -82,6 +87,9 @@ struct bchain {
   char _buff[1]; /* over allocate as needed */
 };
 
+API_EXPORT(struct bchain *) bchain_alloc(size_t size, int line);
+API_EXPORT(void) bchain_free(struct bchain *b, int line);
+
 struct mtev_http_session_ctx;
 typedef struct mtev_http_session_ctx mtev_http_session_ctx;
 typedef int (*mtev_http_dispatch_func) (mtev_http_session_ctx *);
@@ -145,10 +153,23 @@ API_EXPORT(const char *)
   mtev_http_request_querystring(mtev_http_request *, const char *);
 API_EXPORT(const char *)
   mtev_http_request_orig_querystring(mtev_http_request *);
+/* An arena reset when the request is released; the querystring lives here */
+API_EXPORT(mtev_arena_t *)
+  mtev_http_request_arena(mtev_http_request *);
 API_EXPORT(mtev_hash_table *)
   mtev_http_request_querystring_table(mtev_http_request *);
 API_EXPORT(mtev_hash_table *)
   mtev_http_request_headers_table(mtev_http_request *);
+/*! \fn const char *mtev_http_request_negotiate(mtev_http_request *req, const char **types, int ntypes)
+    \brief Choose a content type using the request's Accept header.
+    \param req the HTTP request
+    \param types the content types the caller can produce, most preferred first
+    \param ntypes the number of types
+    \return the acceptable type with the highest quality (ties go to the earlier
+            type), types[0] if there is no Accept header, or NULL if none are acceptable.
+ */
+API_EXPORT(const char *)
+  mtev_http_request_negotiate(mtev_http_request *req, const char **types, int ntypes);
 API_EXPORT(void)
   mtev_http_request_set_upload(mtev_http_request *,
                                void *data, int64_t size,
@@ -179,6 +200,60 @@ API_EXPORT(mtev_boolean)
 API_EXPORT(int)
   mtev_http_session_req_consume(mtev_http_session_ctx *ctx,
                                 void *buf, size_t len, size_t blen, int *mask);
+
+typedef enum {
+  MTEV_HTTP_BODY_CONTINUE = 0, /* slice consumed, keep reading */
+  MTEV_HTTP_BODY_PAUSE,        /* slice not consumed, stop reading for now */
+  MTEV_HTTP_BODY_ABORT         /* give up on the payload */
+} mtev_http_body_disposition_t;
+
+typedef mtev_http_body_disposition_t (*mtev_http_body_func)
+  (mtev_http_session_ctx *, const struct bchain *, void *closure);
+
+/*! \fn int mtev_http_session_req_consume_stream(mtev_http_session_ctx *ctx, mtev_http_body_func f, void *closure, int *mask)
+    \brief Stream the request payload to a callback as it arrives.
+    \param ctx the http session
+    \param f called with each dechunked, decompressed slice of the payload
+    \param closure passed to `f`
+    \param mask set to the eventer mask to wait on when 0 is returned
+    \return 1 when the payload is complete, 0 if more is to come, -1 on error
+
+    Only a bounded number of bchains are held per request regardless of
+    the payload size.  If `f` returns `MTEV_HTTP_BODY_PAUSE`, the slice
+    is retained (and redelivered later), no further reads are made from
+    the socket and `mask` will not include `EVENTER_READ`.  Reading is
+    resumed via `mtev_http_session_resume_body`.  Identity-encoded,
+    unchunked payloads are handed over without copying.
+ */
+API_EXPORT(int)
+  mtev_http_session_req_consume_stream(mtev_http_session_ctx *ctx,
+                                       mtev_http_body_func f, void *closure,
+                                       int *mask);
+
+/*! \fn void mtev_http_session_resume_body(mtev_http_session_ctx *ctx)
+    \brief Resume a payload stream paused by its callback.
+    \param ctx the http session
+
+    This must be called from the thread owning the connection's event
+    (e.g. from the completion phase of an asynch job).
+ */
+API_EXPORT(void)
+  mtev_http_session_resume_body(mtev_http_session_ctx *ctx);
+
+/*! \fn int mtev_http_session_req_consume_to_fd(mtev_http_session_ctx *ctx, int fd, int *mask)
+    \brief Write the request payload directly to a file descriptor.
+    \param ctx the http session
+    \param fd a (blocking) file descriptor to receive the payload
+    \param mask set to the eventer mask to wait on when 0 is returned
+    \return 1 when the payload is complete, 0 if more is to come, -1 on error
+
+    Where possible (an unencrypted connection and an unchunked,
+    uncompressed payload) the data is moved with `splice(2)` and never
+    enters user space; otherwise this falls back to streaming.
+ */
+API_EXPORT(int)
+  mtev_http_session_req_consume_to_fd(mtev_http_session_ctx *ctx,
+                                      int fd, int *mask);
 API_EXPORT(mtev_boolean)
   mtev_http_response_status_set(mtev_http_session_ctx *, int, const char *);
 API_EXPORT(mtev_boolean)
@@ -186,6 +261,34 @@ API_EXPORT(mtev_boolean)
                                 const char *, const char *);
 API_EXPORT(mtev_boolean)
   mtev_http_response_option_set(mtev_http_session_ctx *, uint32_t);
+/*! \fn mtev_boolean mtev_http_response_compression_policy(mtev_http_session_ctx *ctx, uint32_t encodings, int level, size_t min_size)
+    \brief Constrain how the current response may be compressed.
+    \param ctx The session.
+    \param encodings A mask of MTEV_HTTP_ZSTD, MTEV_HTTP_GZIP, MTEV_HTTP_DEFLATE and MTEV_HTTP_LZ4F; 0 disables compression.
+    \param level The compression level, or MTEV_COMPRESS_LEVEL_DEFAULT.
+    \param min_size Responses whose complete body is smaller than this are sent uncompressed.
+    \return mtev_false if output has already started.
+
+    When a compression option is subsequently requested via mtev_http_response_option_set, the
+    first of zstd, gzip, deflate, lz4f that is both in `encodings` and accepted by the client is
+    used instead.
+ */
+API_EXPORT(mtev_boolean)
+  mtev_http_response_compression_policy(mtev_http_session_ctx *ctx, uint32_t encodings,
+                                        int level, size_t min_size);
+/*! \fn mtev_boolean mtev_http_response_compression_policy_get(mtev_http_session_ctx *ctx, uint32_t *encodings, int *level, size_t *min_size)
+    \brief Report how the current response may be compressed.
+    \param ctx The session.
+    \param encodings If not NULL, set to the permitted encodings (all of them without a policy).
+    \param level If not NULL, set to the compression level.
+    \param min_size If not NULL, set to the size below which bodies are sent uncompressed.
+    \return mtev_true if a policy was set with mtev_http_response_compression_policy.
+
+    Handlers that serve precompressed content use this to honour the same constraints.
+ */
+API_EXPORT(mtev_boolean)
+  mtev_http_response_compression_policy_get(mtev_http_session_ctx *ctx, uint32_t *encodings,
+                                            int *level, size_t *min_size);
 API_EXPORT(mtev_boolean)
   mtev_http_response_appendf(mtev_http_session_ctx *ctx,
                              const char *format, ...);
@@ -202,10 +305,43 @@ API_EXPORT(mtev_boolean)
   mtev_http_response_append_mmap(mtev_http_session_ctx *,
                                  int fd, size_t len, int flags, off_t offset);
 
-#define mtev_http_response_append_json(ctx, doc) (\
-  mtev_http_response_append_str(ctx, mtev_json_object_to_json_string(doc)), \
-  mtev_http_response_append_str(ctx, "\n") \
-)
+struct mtev_json_object;
+/*! \fn mtev_boolean mtev_http_response_append_json(mtev_http_session_ctx *ctx, struct mtev_json_object *doc)
+    \brief Append a JSON document (and a trailing newline) to the response.
+    \param ctx the HTTP session context
+    \param doc the document to serialize
+    \return mtev_true on success
+
+    The document is serialized directly into the response's output chain
+    without first being rendered into a single string.
+ */
+API_EXPORT(mtev_boolean)
+  mtev_http_response_append_json(mtev_http_session_ctx *ctx,
+                                 struct mtev_json_object *doc);
+/*! \fn mtev_boolean mtev_http_response_append_msgpack(mtev_http_session_ctx *ctx, struct mtev_json_object *doc)
+    \brief Append a JSON document to the response encoded as MessagePack.
+    \param ctx the HTTP session context
+    \param doc the document to encode
+    \return mtev_true on success
+ */
+API_EXPORT(mtev_boolean)
+  mtev_http_response_append_msgpack(mtev_http_session_ctx *ctx,
+                                    struct mtev_json_object *doc);
+/*! \fn mtev_boolean mtev_http_response_json(mtev_http_session_ctx *ctx, int code, const char *reason, struct mtev_json_object *doc)
+    \brief Start a response carrying a document in the format the client prefers.
+    \param ctx the HTTP session context
+    \param code the HTTP status code
+    \param reason the HTTP status reason
+    \param doc the document to send
+    \return mtev_true on success
+
+    The body is MessagePack when the request's Accept header prefers
+    application/msgpack to application/json, and JSON otherwise.  The
+    response must still be ended by the caller.
+ */
+API_EXPORT(mtev_boolean)
+  mtev_http_response_json(mtev_http_session_ctx *ctx, int code,
+                          const char *reason, struct mtev_json_object *doc);
 
 API_EXPORT(mtev_boolean)
   mtev_http_response_flush(mtev_http_session_ctx *, mtev_boolean);
@@ -215,9 +351,61 @@ API_EXPORT(mtev_boolean) mtev_http_response_end(mtev_http_session_ctx *);
 API_EXPORT(size_t)
   mtev_http_response_buffered(mtev_http_session_ctx *);
 
+/*! \fn mtev_boolean mtev_http_websocket_queue_msg(mtev_http_session_ctx *ctx, int opcode, const unsigned char *msg, size_t msg_len)
+    \brief Queue a message on a websocket session.
+    \param ctx the websocket session
+    \param opcode the websocket opcode
+    \param msg the payload
+    \param msg_len the length of the payload
+    \return mtev_true if queued; mtev_false if this isn't a websocket or a close frame has already been queued or sent.
+ */
 API_EXPORT(mtev_boolean)
   mtev_http_websocket_queue_msg(mtev_http_session_ctx *, int opcode, const unsigned char *msg, size_t msg_len);
 
+typedef struct mtev_http_websocket_msg mtev_http_websocket_msg_t;
+
+/*! \fn mtev_http_websocket_msg_t *mtev_http_websocket_msg_new(int opcode, const unsigned char *msg, size_t msg_len)
+    \brief Create a websocket message that can be queued to many sessions.
+    \param opcode the websocket opcode (e.g. WSLAY_TEXT_FRAME)
+    \param msg the payload
+    \param msg_len the length of the payload
+    \return a reference counted message; release it with mtev_http_websocket_msg_release.
+
+    The frame is serialized once, and compressed at most once per window
+    size for sessions using permessage-deflate without context takeover.
+ */
+API_EXPORT(mtev_http_websocket_msg_t *)
+  mtev_http_websocket_msg_new(int opcode, const unsigned char *msg, size_t msg_len);
+
+/*! \fn void mtev_http_websocket_msg_release(mtev_http_websocket_msg_t *m)
+    \brief Drop a reference to a shared websocket message.
+    \param m the message
+ */
+API_EXPORT(void)
+  mtev_http_websocket_msg_release(mtev_http_websocket_msg_t *m);
+
+/*! \fn mtev_boolean mtev_http_websocket_queue_shared(mtev_http_session_ctx *ctx, mtev_http_websocket_msg_t *m)
+    \brief Queue a shared message on a websocket session without copying it.
+    \param ctx the websocket session
+    \param m the message
+    \return mtev_true if queued; nothing is queued after a close frame.
+ */
+API_EXPORT(mtev_boolean)
+  mtev_http_websocket_queue_shared(mtev_http_session_ctx *ctx, mtev_http_websocket_msg_t *m);
+
+/*! \fn int mtev_http_websocket_broadcast(mtev_http_session_ctx **ctxs, int nctxs, int opcode, const unsigned char *msg, size_t msg_len)
+    \brief Send one message to many websocket sessions.
+    \param ctxs the sessions
+    \param nctxs the number of sessions
+    \param opcode the websocket opcode
+    \param msg the payload
+    \param msg_len the length of the payload
+    \return the number of sessions the message was queued to.
+ */
+API_EXPORT(int)
+  mtev_http_websocket_broadcast(mtev_http_session_ctx **ctxs, int nctxs, int opcode,
+                                const unsigned char *msg, size_t msg_len);
+
 API_EXPORT(void)
   mtev_http_create_websocket_accept_key(char *dest, size_t dest_len, const char *client_key);
 
@@ -0,0 +1,1297 @@
+/*
+ * Copyright (c) 2017, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name Circonus, Inc. nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "mtev_defines.h"
+#include "mtev_http_client.h"
+#include "mtev_http.h"
+#include "mtev_conf.h"
+#include "mtev_log.h"
+#include "mtev_compress.h"
+#include "mtev_atomic.h"
+#include "eventer/eventer.h"
+
+#include <errno.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <pthread.h>
+
+#define CLIENT_READ_CHUNK 16384
+#define CLIENT_MAX_HEADER_SIZE (64 * 1024)
+/* connections a request may be handed to before a drop fails it */
+#define CLIENT_MAX_ATTEMPTS 3
+
+typedef struct http_client_pool http_client_pool_t;
+typedef struct http_client_conn http_client_conn_t;
+
+struct mtev_http_client_request {
+  char *method;
+  char *address;
+  char *path;
+  unsigned short port;
+  mtev_hash_table headers;
+  char *body;
+  size_t body_len;
+  uint32_t timeout_ms;
+  mtev_boolean use_ssl;
+  char *ssl_layer, *ssl_ca, *ssl_cert, *ssl_key, *ssl_ciphers, *ssl_sni;
+  mtev_boolean decode;
+  mtev_boolean idempotent;
+  mtev_http_client_body_func body_cb;
+  mtev_http_client_complete_func complete_cb;
+  void *closure;
+
+  mtev_boolean submitted;
+  int attempts;
+  struct timeval deadline;
+  char *wire;
+  size_t wire_len;
+  size_t wire_off;
+
+  int status;
+  mtev_hash_table res_headers;
+  struct bchain *res_body, *res_body_last;
+  size_t res_body_len;
+
+  mtev_http_client_request_t *next;
+};
+
+struct http_client_pool {
+  char *key;
+  pthread_mutex_t lock;
+  http_client_conn_t *conns;
+  int nconns;
+  mtev_http_client_request_t *pending, *pending_tail;
+};
+
+typedef enum {
+  CONN_CONNECTING,
+  CONN_TLS_HANDSHAKE,
+  CONN_READY,
+  CONN_CLOSED
+} conn_state_t;
+
+typedef enum {
+  PARSE_HEADERS,
+  PARSE_BODY_LENGTH,
+  PARSE_BODY_UNTIL_CLOSE,
+  PARSE_CHUNK_SIZE,
+  PARSE_CHUNK_DATA,
+  PARSE_CHUNK_DATA_END,
+  PARSE_CHUNK_TRAILER
+} parse_state_t;
+
+struct http_client_conn {
+  http_client_pool_t *pool;
+  mtev_atomic32_t refcnt;
+  eventer_t e;
+  pthread_t owner;
+  /* protected by pool->lock */
+  conn_state_t state;
+  mtev_http_client_request_t *queue, *queue_tail;
+  int nqueued;
+  mtev_boolean kick_scheduled;
+  /* only touched by the owning thread */
+  char *rbuf;
+  size_t rlen, rallocd;
+  parse_state_t parse;
+  int64_t remaining;
+  mtev_boolean keepalive;
+  mtev_stream_decompress_ctx_t *dctx;
+  eventer_t timer;
+  struct timeval idle_since;
+  http_client_conn_t *next;
+};
+
+static pthread_mutex_t pools_lock = PTHREAD_MUTEX_INITIALIZER;
+static mtev_hash_table pools;
+static pthread_once_t client_once = PTHREAD_ONCE_INIT;
+static int max_connections = 8;
+static int max_pipeline = 1;
+static uint32_t idle_timeout_ms = 30000;
+static mtev_log_stream_t debug_ls;
+
+static void
+http_client_init(void) {
+  int ival;
+  mtev_hash_init(&pools);
+  debug_ls = mtev_log_stream_find("debug/http_client");
+  if(mtev_conf_get_int(NULL, "//http_client/@max_connections", &ival) && ival > 0)
+    max_connections = ival;
+  if(mtev_conf_get_int(NULL, "//http_client/@max_pipeline", &ival) && ival > 0)
+    max_pipeline = ival;
+  if(mtev_conf_get_int(NULL, "//http_client/@idle_timeout", &ival) && ival >= 0)
+    idle_timeout_ms = ival;
+}
+
+void
+mtev_http_client_pool_options(int maxc, int maxp, uint32_t idle_ms) {
+  pthread_once(&client_once, http_client_init);
+  if(maxc > 0) max_connections = maxc;
+  if(maxp > 0) max_pipeline = maxp;
+  idle_timeout_ms = idle_ms;
+}
+
+const char *
+mtev_http_client_strerror(mtev_http_client_error_t err) {
+  switch(err) {
+    case MTEV_HTTP_CLIENT_OK: return "success";
+    case MTEV_HTTP_CLIENT_ERR_CONNECT: return "connection failed";
+    case MTEV_HTTP_CLIENT_ERR_TIMEOUT: return "timed out";
+    case MTEV_HTTP_CLIENT_ERR_IO: return "I/O error";
+    case MTEV_HTTP_CLIENT_ERR_PROTOCOL: return "protocol error";
+    case MTEV_HTTP_CLIENT_ERR_DECODE: return "content decoding failed";
+    case MTEV_HTTP_CLIENT_ERR_ABORTED: return "aborted";
+  }
+  return "unknown error";
+}
+
+/* Request construction */
+
+mtev_http_client_request_t *
+mtev_http_client_request_new(const char *method, const char *address,
+                             unsigned short port, const char *path) {
+  struct in6_addr a6;
+  struct in_addr a4;
+  mtev_http_client_request_t *req;
+
+  if(inet_pton(AF_INET, address, &a4) != 1 &&
+     inet_pton(AF_INET6, address, &a6) != 1) {
+    mtevL(mtev_error, "http_client: cannot translate '%s' to IP\n", address);
+    return NULL;
+  }
+  req = calloc(1, sizeof(*req));
+  req->method = strdup(method);
+  req->address = strdup(address);
+  req->port = port;
+  req->path = strdup((path && *path) ? path : "/");
+  req->decode = mtev_true;
+  req->idempotent = (!strcmp(method, "GET") || !strcmp(method, "HEAD"));
+  mtev_hash_init(&req->headers);
+  mtev_hash_init(&req->res_headers);
+  return req;
+}
+
+void
+mtev_http_client_request_header_set(mtev_http_client_request_t *req,
+                                    const char *name, const char *value) {
+  mtev_hash_replace(&req->headers, strdup(name), strlen(name),
+                    strdup(value), free, free);
+}
+
+static mtev_boolean
+request_has_header(mtev_http_client_request_t *req, const char *name) {
+  mtev_hash_iter iter = MTEV_HASH_ITER_ZERO;
+  while(mtev_hash_adv(&req->headers, &iter)) {
+    if(!strcasecmp(iter.key.str, name)) return mtev_true;
+  }
+  return mtev_false;
+}
+
+void
+mtev_http_client_request_body_set(mtev_http_client_request_t *req,
+                                  const void *body, size_t len) {
+  free(req->body);
+  req->body = NULL;
+  req->body_len = len;
+  if(len) {
+    req->body = malloc(len);
+    memcpy(req->body, body, len);
+  }
+}
+
+void
+mtev_http_client_request_timeout_set(mtev_http_client_request_t *req,
+                                     uint32_t timeout_ms) {
+  req->timeout_ms = timeout_ms;
+}
+
+#define REPLACE_STR(field, v) do { \
+  free(field); \
+  field = (v) ? strdup(v) : NULL; \
+} while(0)
+
+void
+mtev_http_client_request_ssl_set(mtev_http_client_request_t *req,
+                                 const char *layer, const char *ca,
+                                 const char *cert, const char *key,
+                                 const char *ciphers, const char *sni) {
+  req->use_ssl = mtev_true;
+  REPLACE_STR(req->ssl_layer, layer);
+  REPLACE_STR(req->ssl_ca, ca);
+  REPLACE_STR(req->ssl_cert, cert);
+  REPLACE_STR(req->ssl_key, key);
+  REPLACE_STR(req->ssl_ciphers, ciphers);
+  REPLACE_STR(req->ssl_sni, sni);
+}
+
+void
+mtev_http_client_request_decode_set(mtev_http_client_request_t *req,
+                                    mtev_boolean decode) {
+  req->decode = decode;
+}
+
+void
+mtev_http_client_request_body_callback_set(mtev_http_client_request_t *req,
+                                           mtev_http_client_body_func f) {
+  req->body_cb = f;
+}
+
+void *
+mtev_http_client_request_closure(mtev_http_client_request_t *req) {
+  return req->closure;
+}
+
+int
+mtev_http_client_response_status(mtev_http_client_request_t *req) {
+  return req->status;
+}
+
+const char *
+mtev_http_client_response_header(mtev_http_client_request_t *req,
+                                 const char *name) {
+  const char *value = NULL;
+  if(!mtev_hash_retr_str(&req->res_headers, name, strlen(name), &value))
+    return NULL;
+  return value;
+}
+
+mtev_hash_table *
+mtev_http_client_response_headers(mtev_http_client_request_t *req) {
+  return &req->res_headers;
+}
+
+const struct bchain *
+mtev_http_client_response_body(mtev_http_client_request_t *req, size_t *len) {
+  if(len) *len = req->res_body_len;
+  return req->res_body;
+}
+
+void
+mtev_http_client_request_free(mtev_http_client_request_t *req) {
+  if(!req) return;
+  free(req->method);
+  free(req->address);
+  free(req->path);
+  free(req->body);
+  free(req->ssl_layer);
+  free(req->ssl_ca);
+  free(req->ssl_cert);
+  free(req->ssl_key);
+  free(req->ssl_ciphers);
+  free(req->ssl_sni);
+  free(req->wire);
+  mtev_hash_destroy(&req->headers, free, free);
+  mtev_hash_destroy(&req->res_headers, free, free);
+  while(req->res_body) {
+    struct bchain *n = req->res_body->next;
+    bchain_free(req->res_body, __LINE__);
+    req->res_body = n;
+  }
+  free(req);
+}
+
+/* Serialize the request line, headers and body for the wire. */
+static void
+request_serialize(mtev_http_client_request_t *req) {
+  mtev_hash_iter iter = MTEV_HASH_ITER_ZERO;
+  size_t len, off = 0;
+  char accept[64];
+
+  accept[0] = '\0';
+  if(req->decode && !request_has_header(req, "accept-encoding")) {
+    strlcat(accept, "gzip, lz4f", sizeof(accept));
+    if(mtev_compress_type_available(MTEV_COMPRESS_ZSTD))
+      strlcat(accept, ", zstd", sizeof(accept));
+  }
+
+  len = strlen(req->method) + strlen(req->path) + 16;
+  len += strlen(req->address) + 32;          /* Host */
+  len += 40;                                 /* Content-Length */
+  len += strlen(accept) + 20;                /* Accept-Encoding */
+  while(mtev_hash_adv(&req->headers, &iter))
+    len += iter.klen + strlen(iter.value.str) + 4;
+  len += 2 + req->body_len;
+
+  req->wire = malloc(len);
+#define WIRE_PRINTF(...) \
+  off += snprintf(req->wire + off, len - off, __VA_ARGS__)
+  WIRE_PRINTF("%s %s HTTP/1.1\r\n", req->method, req->path);
+  if(!request_has_header(req, "host")) {
+    if(strchr(req->address, ':')) WIRE_PRINTF("Host: [%s]", req->address);
+    else WIRE_PRINTF("Host: %s", req->address);
+    if(req->port != (req->use_ssl ? 443 : 80)) WIRE_PRINTF(":%u", req->port);
+    WIRE_PRINTF("\r\n");
+  }
+  if(accept[0]) WIRE_PRINTF("Accept-Encoding: %s\r\n", accept);
+  if((req->body_len || !req->idempotent) &&
+     !request_has_header(req, "content-length"))
+    WIRE_PRINTF("Content-Length: %zu\r\n", req->body_len);
+  memset(&iter, 0, sizeof(iter));
+  while(mtev_hash_adv(&req->headers, &iter))
+    WIRE_PRINTF("%s: %s\r\n", iter.key.str, iter.value.str);
+  WIRE_PRINTF("\r\n");
+  if(req->body_len) {
+    memcpy(req->wire + off, req->body, req->body_len);
+    off += req->body_len;
+  }
+  req->wire_len = off;
+  req->wire_off = 0;
+}
+
+static void
+request_complete(mtev_http_client_request_t *req, mtev_http_client_error_t err) {
+  mtevL(debug_ls, "http_client: %s %s -> %d (%s)\n", req->method, req->path,
+        req->status, mtev_http_client_strerror(err));
+  if(req->complete_cb) req->complete_cb(req, err, req->closure);
+}
+
+static mtev_boolean
+request_expired(mtev_http_client_request_t *req, struct timeval *now) {
+  if(req->timeout_ms == 0) return mtev_false;
+  return compare_timeval(*now, req->deadline) >= 0;
+}
+
+/* Pools */
+
+static char *
+pool_key(mtev_http_client_request_t *req) {
+  char key[4096];
+#define NN(a) ((a) ? (a) : "")
+  snprintf(key, sizeof(key), "%s|%u|%d|%s|%s|%s|%s|%s|%s",
+           req->address, req->port, req->use_ssl,
+           NN(req->ssl_layer), NN(req->ssl_ca), NN(req->ssl_cert),
+           NN(req->ssl_key), NN(req->ssl_ciphers), NN(req->ssl_sni));
+#undef NN
+  return strdup(key);
+}
+
+static http_client_pool_t *
+pool_get(mtev_http_client_request_t *req) {
+  void *vpool;
+  char *key = pool_key(req);
+  http_client_pool_t *pool;
+  pthread_mutex_lock(&pools_lock);
+  if(mtev_hash_retrieve(&pools, key, strlen(key), &vpool)) {
+    pool = vpool;
+    free(key);
+  }
+  else {
+    pool = calloc(1, sizeof(*pool));
+    pool->key = key;
+    pthread_mutex_init(&pool->lock, NULL);
+    mtev_hash_store(&pools, pool->key, strlen(pool->key), pool);
+  }
+  pthread_mutex_unlock(&pools_lock);
+  return pool;
+}
+
+static void conn_deref(http_client_conn_t *conn);
+static http_client_conn_t *conn_new(http_client_pool_t *pool,
+                                    mtev_http_client_request_t *req);
+static void conn_kick_locked(http_client_conn_t *conn);
+
+/* must hold pool->lock */
+static void
+conn_enqueue_locked(http_client_conn_t *conn, mtev_http_client_request_t *req) {
+  req->next = NULL;
+  if(conn->queue_tail) conn->queue_tail->next = req;
+  else conn->queue = req;
+  conn->queue_tail = req;
+  conn->nqueued++;
+  req->attempts++;
+}
+
+static mtev_boolean
+conn_can_pipeline_locked(http_client_conn_t *conn,
+                         mtev_http_client_request_t *req) {
+  mtev_http_client_request_t *q;
+  if(conn->state != CONN_READY || conn->nqueued >= max_pipeline) return mtev_false;
+  if(!req->idempotent) return mtev_false;
+  for(q = conn->queue; q; q = q->next) if(!q->idempotent) return mtev_false;
+  return mtev_true;
+}
+
+/* Hand pending requests to connections.  Requests that expired while
+ * waiting for a connection are chained onto *failed for the caller to
+ * complete once the lock is dropped.
+ */
+static void
+pool_dispatch_locked(http_client_pool_t *pool,
+                     mtev_http_client_request_t **failed) {
+  struct timeval now;
+  mtev_gettimeofday(&now, NULL);
+  while(pool->pending) {
+    http_client_conn_t *conn, *chosen = NULL;
+    mtev_http_client_request_t *req = pool->pending;
+
+    if(request_expired(req, &now)) {
+      pool->pending = req->next;
+      if(!pool->pending) pool->pending_tail = NULL;
+      req->next = *failed;
+      *failed = req;
+      continue;
+    }
+    /* idle first */
+    for(conn = pool->conns; conn; conn = conn->next) {
+      if(conn->state != CONN_CLOSED && conn->nqueued == 0) {
+        chosen = conn;
+        break;
+      }
+    }
+    if(!chosen && pool->nconns < max_connections) {
+      chosen = conn_new(pool, req);
+      if(!chosen) {
+        pool->pending = req->next;
+        if(!pool->pending) pool->pending_tail = NULL;
+        req->next = *failed;
+        *failed = req;
+        req->status = -MTEV_HTTP_CLIENT_ERR_CONNECT;
+        continue;
+      }
+    }
+    if(!chosen) {
+      for(conn = pool->conns; conn; conn = conn->next) {
+        if(conn_can_pipeline_locked(conn, req)) {
+          chosen = conn;
+          break;
+        }
+      }
+    }
+    if(!chosen) break; /* wait for a connection to free up */
+    pool->pending = req->next;
+    if(!pool->pending) pool->pending_tail = NULL;
+    conn_enqueue_locked(chosen, req);
+    conn_kick_locked(chosen);
+  }
+}
+
+static void
+fail_requests(mtev_http_client_request_t *failed) {
+  while(failed) {
+    mtev_http_client_request_t *next = failed->next;
+    mtev_http_client_error_t err = MTEV_HTTP_CLIENT_ERR_TIMEOUT;
+    if(failed->status < 0) {
+      err = -failed->status;
+      failed->status = 0;
+    }
+    failed->next = NULL;
+    request_complete(failed, err);
+    failed = next;
+  }
+}
+
+static void
+pool_dispatch(http_client_pool_t *pool) {
+  mtev_http_client_request_t *failed = NULL;
+  pthread_mutex_lock(&pool->lock);
+  pool_dispatch_locked(pool, &failed);
+  pthread_mutex_unlock(&pool->lock);
+  fail_requests(failed);
+}
+
+/* Put requests back at the front of the pending queue */
+static void
+pool_requeue_locked(http_client_pool_t *pool, mtev_http_client_request_t *head,
+                    mtev_http_client_request_t *tail) {
+  if(!head) return;
+  tail->next = pool->pending;
+  pool->pending = head;
+  if(!pool->pending_tail) pool->pending_tail = tail;
+}
+
+mtev_boolean
+mtev_http_client_request_send(mtev_http_client_request_t *req,
+                              mtev_http_client_complete_func f,
+                              void *closure) {
+  http_client_pool_t *pool;
+
+  pthread_once(&client_once, http_client_init);
+  if(req->submitted) return mtev_false;
+  req->submitted = mtev_true;
+  req->complete_cb = f;
+  req->closure = closure;
+  if(req->timeout_ms) {
+    struct timeval now, diff;
+    mtev_gettimeofday(&now, NULL);
+    diff.tv_sec = req->timeout_ms / 1000;
+    diff.tv_usec = (req->timeout_ms % 1000) * 1000;
+    add_timeval(now, diff, &req->deadline);
+  }
+  request_serialize(req);
+
+  pool = pool_get(req);
+  pthread_mutex_lock(&pool->lock);
+  req->next = NULL;
+  if(pool->pending_tail) pool->pending_tail->next = req;
+  else pool->pending = req;
+  pool->pending_tail = req;
+  pthread_mutex_unlock(&pool->lock);
+  pool_dispatch(pool);
+  return mtev_true;
+}
+
+/* Connections */
+
+static int conn_drive(eventer_t e, int mask, void *closure, struct timeval *now);
+
+static http_client_conn_t *
+conn_new(http_client_pool_t *pool, mtev_http_client_request_t *req) {
+  int fd, rv, family = AF_INET;
+  union {
+    struct sockaddr remote;
+    struct sockaddr_in remote_in;
+    struct sockaddr_in6 remote_in6;
+  } remote;
+  socklen_t remote_len;
+  http_client_conn_t *conn;
+  eventer_t e;
+
+  memset(&remote, 0, sizeof(remote));
+  if(inet_pton(AF_INET, req->address, &remote.remote_in.sin_addr) == 1) {
+    remote.remote_in.sin_family = AF_INET;
+    remote.remote_in.sin_port = htons(req->port);
+    remote_len = sizeof(remote.remote_in);
+  }
+  else if(inet_pton(AF_INET6, req->address, &remote.remote_in6.sin6_addr) == 1) {
+    family = AF_INET6;
+    remote.remote_in6.sin6_family = AF_INET6;
+    remote.remote_in6.sin6_port = htons(req->port);
+    remote_len = sizeof(remote.remote_in6);
+  }
+  else return NULL;
+
+  if((fd = socket(family, SOCK_STREAM, 0)) == -1) {
+    mtevL(mtev_error, "http_client: socket failed: %s\n", strerror(errno));
+    return NULL;
+  }
+  if(eventer_set_fd_nonblocking(fd)) {
+    close(fd);
+    mtevL(mtev_error, "http_client: failed to set socket non-blocking\n");
+    return NULL;
+  }
+  rv = connect(fd, &remote.remote, remote_len);
+  if(rv == -1 && errno != EINPROGRESS) {
+    mtevL(mtev_error, "http_client: connect to %s:%u failed: %s\n",
+          req->address, req->port, strerror(errno));
+    close(fd);
+    return NULL;
+  }
+
+  conn = calloc(1, sizeof(*conn));
+  conn->pool = pool;
+  conn->refcnt = 1;
+  conn->state = CONN_CONNECTING;
+  conn->parse = PARSE_HEADERS;
+
+  e = eventer_alloc();
+  e->fd = fd;
+  e->mask = EVENTER_READ | EVENTER_WRITE | EVENTER_EXCEPTION;
+  e->callback = conn_drive;
+  e->closure = conn;
+  e->thr_owner = eventer_choose_owner(lrand48());
+  conn->owner = e->thr_owner;
+
+  if(req->use_ssl) {
+    eventer_ssl_ctx_t *sslctx;
+    sslctx = eventer_ssl_ctx_new(SSL_CLIENT, req->ssl_layer, req->ssl_cert,
+                                 req->ssl_key, req->ssl_ca, req->ssl_ciphers);
+    if(!sslctx) {
+      mtevL(mtev_error, "http_client: ssl_client context creation failed\n");
+      close(fd);
+      eventer_free(e);
+      free(conn);
+      return NULL;
+    }
+    if(req->ssl_sni && *req->ssl_sni) eventer_ssl_ctx_set_sni(sslctx, req->ssl_sni);
+    eventer_ssl_ctx_set_verify(sslctx, eventer_ssl_verify_cert, NULL);
+    EVENTER_ATTACH_SSL(e, sslctx);
+  }
+  conn->e = e;
+  conn->next = pool->conns;
+  pool->conns = conn;
+  pool->nconns++;
+  /* the drive callback is our kick */
+  conn->kick_scheduled = mtev_true;
+  eventer_add(e);
+  return conn;
+}
+
+static void
+conn_deref(http_client_conn_t *conn) {
+  if(mtev_atomic_dec32(&conn->refcnt) == 0) {
+    free(conn->rbuf);
+    free(conn);
+  }
+}
+
+static int
+conn_kick_event(eventer_t e, int mask, void *closure, struct timeval *now);
+
+/* Get the owning thread to look at the connection again.  must hold
+ * pool->lock */
+static void
+conn_kick_locked(http_client_conn_t *conn) {
+  eventer_t k;
+  if(conn->kick_scheduled || conn->state == CONN_CLOSED) return;
+  conn->kick_scheduled = mtev_true;
+  mtev_atomic_inc32(&conn->refcnt);
+  k = eventer_alloc();
+  /* no whence, so "right now" on the owning thread */
+  k->thr_owner = conn->owner;
+  k->closure = conn;
+  k->callback = conn_kick_event;
+  k->mask = EVENTER_TIMER;
+  eventer_add(k);
+}
+
+static void conn_reschedule_timer(http_client_conn_t *conn);
+
+static int
+conn_kick_event(eventer_t e, int mask, void *closure, struct timeval *now) {
+  http_client_conn_t *conn = closure;
+  mtev_boolean live;
+  pthread_mutex_lock(&conn->pool->lock);
+  conn->kick_scheduled = mtev_false;
+  live = (conn->state != CONN_CLOSED);
+  pthread_mutex_unlock(&conn->pool->lock);
+  if(live) {
+    conn_reschedule_timer(conn);
+    eventer_update(conn->e, EVENTER_READ | EVENTER_WRITE | EVENTER_EXCEPTION);
+  }
+  conn_deref(conn);
+  return 0;
+}
+
+/* Tear down a connection from its owning thread.  Requests that never
+ * reached the wire are retried on another connection, as are idempotent
+ * ones caught behind another request's timeout (the server did nothing
+ * wrong with them).  Anything already written when the peer dropped us may
+ * be what made it drop, so it is not resent, and no request is handed to
+ * more than CLIENT_MAX_ATTEMPTS connections; the rest fail with err.
+ */
+static void
+conn_close(http_client_conn_t *conn, mtev_http_client_error_t err,
+           mtev_boolean in_callback) {
+  http_client_pool_t *pool = conn->pool;
+  http_client_conn_t **cp;
+  mtev_http_client_request_t *req, *retry = NULL, *retry_tail = NULL,
+                             *failed = NULL;
+  struct timeval now;
+  int mask;
+
+  mtev_gettimeofday(&now, NULL);
+  pthread_mutex_lock(&pool->lock);
+  for(cp = &pool->conns; *cp; cp = &(*cp)->next) {
+    if(*cp == conn) {
+      *cp = conn->next;
+      pool->nconns--;
+      break;
+    }
+  }
+  conn->state = CONN_CLOSED;
+  req = conn->queue;
+  conn->queue = conn->queue_tail = NULL;
+  conn->nqueued = 0;
+  while(req) {
+    mtev_http_client_request_t *next = req->next;
+    mtev_boolean untouched = (req->wire_off == 0 && req->status == 0);
+    mtev_boolean bystander = mtev_false;
+    mtev_http_client_error_t req_err = err;
+    req->next = NULL;
+    /* A timeout only belongs to the requests that actually expired; the
+     * others sharing the connection are treated as if it dropped. */
+    if(err == MTEV_HTTP_CLIENT_ERR_TIMEOUT && !request_expired(req, &now)) {
+      req_err = MTEV_HTTP_CLIENT_ERR_IO;
+      bystander = (req->status == 0 && req->idempotent);
+    }
+    if(req_err != MTEV_HTTP_CLIENT_ERR_CONNECT && req_err != MTEV_HTTP_CLIENT_ERR_TIMEOUT &&
+       req_err != MTEV_HTTP_CLIENT_ERR_ABORTED && (untouched || bystander) &&
+       req->attempts < CLIENT_MAX_ATTEMPTS) {
+      req->wire_off = 0;
+      if(retry_tail) retry_tail->next = req;
+      else retry = req;
+      retry_tail = req;
+    }
+    else {
+      req->status = -(int)req_err;
+      req->next = failed;
+      failed = req;
+    }
+    req = next;
+  }
+  pool_requeue_locked(pool, retry, retry_tail);
+  pthread_mutex_unlock(&pool->lock);
+
+  if(conn->timer) {
+    if(eventer_remove_timed(conn->timer)) eventer_free(conn->timer);
+    conn->timer = NULL;
+  }
+  if(conn->dctx) {
+    mtev_stream_decompress_finish(conn->dctx);
+    mtev_destroy_stream_decompress_ctx(conn->dctx);
+    conn->dctx = NULL;
+  }
+  eventer_remove_fd(conn->e->fd);
+  conn->e->opset->close(conn->e->fd, &mask, conn->e);
+  /* from within its own callback the eventer frees it when we return 0 */
+  if(!in_callback) eventer_free(conn->e);
+  conn->e = NULL;
+
+  /* failures are reported in order */
+  {
+    mtev_http_client_request_t *ordered = NULL;
+    while(failed) {
+      mtev_http_client_request_t *next = failed->next;
+      failed->next = ordered;
+      ordered = failed;
+      failed = next;
+    }
+    fail_requests(ordered);
+  }
+  pool_dispatch(pool);
+  conn_deref(conn);
+}
+
+static int
+conn_timer_event(eventer_t e, int mask, void *closure, struct timeval *now) {
+  http_client_conn_t *conn = closure;
+  mtev_http_client_request_t *req, **rp, *prev = NULL, *failed = NULL;
+  mtev_boolean expired = mtev_false, idle_expired = mtev_false;
+
+  conn->timer = NULL;
+  pthread_mutex_lock(&conn->pool->lock);
+  for(rp = &conn->queue; (req = *rp) != NULL; ) {
+    if(!request_expired(req, now)) {
+      prev = req;
+      rp = &req->next;
+      continue;
+    }
+    if(req->wire_off == 0) {
+      /* Nothing of it reached the server (and, as writes are in order,
+       * nothing after it either), so it can leave the pipeline alone. */
+      *rp = req->next;
+      if(conn->queue_tail == req) conn->queue_tail = prev;
+      conn->nqueued--;
+      req->next = failed;
+      failed = req;
+      continue;
+    }
+    /* the server has (part of) it; the stream must be torn down */
+    expired = mtev_true;
+    prev = req;
+    rp = &req->next;
+  }
+  if(failed && conn->nqueued == 0) mtev_gettimeofday(&conn->idle_since, NULL);
+  if(conn->nqueued == 0 && conn->state == CONN_READY) {
+    struct timeval diff;
+    sub_timeval(*now, conn->idle_since, &diff);
+    if((uint64_t)diff.tv_sec * 1000 + diff.tv_usec / 1000 >= idle_timeout_ms)
+      idle_expired = mtev_true;
+  }
+  pthread_mutex_unlock(&conn->pool->lock);
+
+  if(failed) {
+    /* fail_requests wants them in queue order */
+    mtev_http_client_request_t *ordered = NULL;
+    while(failed) {
+      mtev_http_client_request_t *next = failed->next;
+      failed->next = ordered;
+      ordered = failed;
+      failed = next;
+    }
+    mtev_atomic_inc32(&conn->refcnt);
+    fail_requests(ordered);
+    if(conn->state == CONN_CLOSED) {
+      conn_deref(conn);
+      return 0;
+    }
+    conn_deref(conn);
+  }
+  if(expired) conn_close(conn, MTEV_HTTP_CLIENT_ERR_TIMEOUT, mtev_false);
+  else if(idle_expired) conn_close(conn, MTEV_HTTP_CLIENT_OK, mtev_false);
+  else conn_reschedule_timer(conn);
+  return 0;
+}
+
+/* Keep one timer per connection at the earliest deadline of its queued
+ * requests (or its idle expiry).  Owning thread only. */
+static void
+conn_reschedule_timer(http_client_conn_t *conn) {
+  struct timeval when = { 0, 0 };
+  mtev_boolean have = mtev_false;
+  mtev_http_client_request_t *req;
+
+  pthread_mutex_lock(&conn->pool->lock);
+  for(req = conn->queue; req; req = req->next) {
+    if(req->timeout_ms == 0) continue;
+    if(!have || compare_timeval(req->deadline, when) < 0) {
+      when = req->deadline;
+      have = mtev_true;
+    }
+  }
+  if(!have && conn->nqueued == 0 && conn->state == CONN_READY) {
+    struct timeval diff = { idle_timeout_ms / 1000, (idle_timeout_ms % 1000) * 1000 };
+    add_timeval(conn->idle_since, diff, &when);
+    have = mtev_true;
+  }
+  pthread_mutex_unlock(&conn->pool->lock);
+
+  if(conn->timer) {
+    if(have && compare_timeval(conn->timer->whence, when) == 0) return;
+    if(eventer_remove_timed(conn->timer)) eventer_free(conn->timer);
+    conn->timer = NULL;
+  }
+  if(!have) return;
+  conn->timer = eventer_alloc();
+  conn->timer->whence = when;
+  conn->timer->mask = EVENTER_TIMER;
+  conn->timer->callback = conn_timer_event;
+  conn->timer->closure = conn;
+  conn->timer->thr_owner = conn->owner;
+  eventer_add(conn->timer);
+}
+
+/* Response handling, owning thread only */
+
+static mtev_http_client_request_t *
+conn_head(http_client_conn_t *conn) {
+  mtev_http_client_request_t *req;
+  pthread_mutex_lock(&conn->pool->lock);
+  req = conn->queue;
+  pthread_mutex_unlock(&conn->pool->lock);
+  return req;
+}
+
+static mtev_boolean
+deliver_bchain(mtev_http_client_request_t *req, struct bchain *b) {
+  if(b->size == 0) {
+    bchain_free(b, __LINE__);
+    return mtev_true;
+  }
+  req->res_body_len += b->size;
+  if(req->body_cb) {
+    mtev_boolean rv = req->body_cb(req, b, req->closure);
+    bchain_free(b, __LINE__);
+    return rv;
+  }
+  b->next = NULL;
+  b->prev = req->res_body_last;
+  if(req->res_body_last) req->res_body_last->next = b;
+  else req->res_body = b;
+  req->res_body_last = b;
+  return mtev_true;
+}
+
+/* Deliver body bytes, decoding them if needed */
+static mtev_http_client_error_t
+deliver_body(http_client_conn_t *conn, mtev_http_client_request_t *req,
+             const char *data, size_t len) {
+  if(len == 0) return MTEV_HTTP_CLIENT_OK;
+  if(!conn->dctx) {
+    struct bchain *b = bchain_alloc(len, __LINE__);
+    memcpy(b->buff, data, len);
+    b->size = len;
+    return deliver_bchain(req, b) ? MTEV_HTTP_CLIENT_OK : MTEV_HTTP_CLIENT_ERR_ABORTED;
+  }
+  while(len > 0) {
+    size_t in_len = len, out_len;
+    struct bchain *b = bchain_alloc(CLIENT_READ_CHUNK * 2, __LINE__);
+    out_len = b->allocd;
+    if(mtev_stream_decompress(conn->dctx, (const unsigned char *)data, &in_len,
+                              (unsigned char *)b->buff, &out_len) != 0) {
+      bchain_free(b, __LINE__);
+      return MTEV_HTTP_CLIENT_ERR_DECODE;
+    }
+    b->size = out_len;
+    data += in_len;
+    len -= in_len;
+    if(!deliver_bchain(req, b)) return MTEV_HTTP_CLIENT_ERR_ABORTED;
+    if(in_len == 0 && out_len == 0) break; /* no progress possible */
+  }
+  return MTEV_HTTP_CLIENT_OK;
+}
+
+static mtev_boolean
+request_expects_body(mtev_http_client_request_t *req) {
+  if(!strcmp(req->method, "HEAD")) return mtev_false;
+  if(req->status == 204 || req->status == 304) return mtev_false;
+  return mtev_true;
+}
+
+/* parse the status line and headers in buf (NUL terminated, without the
+ * final empty line). */
+static mtev_boolean
+parse_response_headers(http_client_conn_t *conn,
+                       mtev_http_client_request_t *req, char *buf) {
+  char *line, *eol, *last_name = NULL;
+  int minor;
+  const char *value;
+
+  eol = strstr(buf, "\r\n");
+  if(eol) *eol = '\0';
+  if(sscanf(buf, "HTTP/1.%d %d", &minor, &req->status) != 2) return mtev_false;
+  conn->keepalive = (minor >= 1);
+  mtev_hash_delete_all(&req->res_headers, free, free);
+
+  for(line = eol ? eol + 2 : NULL; line && *line; line = eol ? eol + 2 : NULL) {
+    char *colon, *cp, *v;
+    void *vexisting;
+    eol = strstr(line, "\r\n");
+    if(eol) *eol = '\0';
+    if((*line == ' ' || *line == '\t') && last_name) {
+      /* continuation of the previous header */
+      if(mtev_hash_retrieve(&req->res_headers, last_name, strlen(last_name), &vexisting)) {
+        char *joined;
+        while(*line == ' ' || *line == '\t') line++;
+        joined = malloc(strlen(vexisting) + strlen(line) + 2);
+        sprintf(joined, "%s %s", (char *)vexisting, line);
+        mtev_hash_replace(&req->res_headers, strdup(last_name), strlen(last_name),
+                          joined, free, free);
+      }
+      continue;
+    }
+    colon = strchr(line, ':');
+    if(!colon) return mtev_false;
+    *colon = '\0';
+    for(cp = line; *cp; cp++) *cp = tolower(*cp);
+    v = colon + 1;
+    while(*v == ' ' || *v == '\t') v++;
+    cp = v + strlen(v);
+    while(cp > v && (cp[-1] == ' ' || cp[-1] == '\t')) *--cp = '\0';
+    if(mtev_hash_retrieve(&req->res_headers, line, strlen(line), &vexisting)) {
+      char *joined = malloc(strlen(vexisting) + strlen(v) + 3);
+      sprintf(joined, "%s, %s", (char *)vexisting, v);
+      mtev_hash_replace(&req->res_headers, strdup(line), strlen(line),
+                        joined, free, free);
+    }
+    else {
+      mtev_hash_store(&req->res_headers, strdup(line), strlen(line), strdup(v));
+    }
+    last_name = line;
+  }
+
+  value = mtev_http_client_response_header(req, "connection");
+  if(value) {
+    if(strcasestr(value, "close")) conn->keepalive = mtev_false;
+    else if(strcasestr(value, "keep-alive")) conn->keepalive = mtev_true;
+  }
+
+  if(conn->dctx) {
+    mtev_stream_decompress_finish(conn->dctx);
+    mtev_destroy_stream_decompress_ctx(conn->dctx);
+    conn->dctx = NULL;
+  }
+  value = mtev_http_client_response_header(req, "content-encoding");
+  if(value && req->decode) {
+    mtev_compress_type type = MTEV_COMPRESS_NONE;
+    if(strstr(value, "gzip")) type = MTEV_COMPRESS_GZIP;
+    else if(strstr(value, "lz4f")) type = MTEV_COMPRESS_LZ4F;
+    else if(strstr(value, "zstd")) type = MTEV_COMPRESS_ZSTD;
+    if(type != MTEV_COMPRESS_NONE) {
+      conn->dctx = mtev_create_stream_decompress_ctx();
+      if(mtev_stream_decompress_init(conn->dctx, type) != 0) {
+        mtev_destroy_stream_decompress_ctx(conn->dctx);
+        conn->dctx = NULL;
+        return mtev_false;
+      }
+    }
+  }
+
+  if(req->status >= 100 && req->status < 200) {
+    /* interim response, the real one follows */
+    conn->parse = PARSE_HEADERS;
+    return mtev_true;
+  }
+  if(!request_expects_body(req)) {
+    conn->parse = PARSE_BODY_LENGTH;
+    conn->remaining = 0;
+  }
+  else if((value = mtev_http_client_response_header(req, "transfer-encoding")) &&
+          strcasestr(value, "chunked")) {
+    conn->parse = PARSE_CHUNK_SIZE;
+  }
+  else if((value = mtev_http_client_response_header(req, "content-length"))) {
+    conn->parse = PARSE_BODY_LENGTH;
+    conn->remaining = strtoll(value, NULL, 10);
+    if(conn->remaining < 0) return mtev_false;
+  }
+  else {
+    conn->parse = PARSE_BODY_UNTIL_CLOSE;
+    conn->keepalive = mtev_false;
+  }
+  return mtev_true;
+}
+
+/* The head request has its whole response. */
+static void
+conn_response_done(http_client_conn_t *conn) {
+  mtev_http_client_request_t *req;
+  mtev_boolean close_after;
+
+  pthread_mutex_lock(&conn->pool->lock);
+  req = conn->queue;
+  conn->queue = req->next;
+  if(!conn->queue) conn->queue_tail = NULL;
+  conn->nqueued--;
+  if(conn->nqueued == 0) mtev_gettimeofday(&conn->idle_since, NULL);
+  pthread_mutex_unlock(&conn->pool->lock);
+  req->next = NULL;
+
+  if(conn->dctx) {
+    mtev_stream_decompress_finish(conn->dctx);
+    mtev_destroy_stream_decompress_ctx(conn->dctx);
+    conn->dctx = NULL;
+  }
+  conn->parse = PARSE_HEADERS;
+  close_after = !conn->keepalive;
+  request_complete(req, MTEV_HTTP_CLIENT_OK);
+  if(close_after) conn_close(conn, MTEV_HTTP_CLIENT_ERR_IO, mtev_true);
+  else pool_dispatch(conn->pool);
+}
+
+/* Parse whatever we have buffered.  Returns OK to keep reading, or an
+ * error that should close the connection. */
+static mtev_http_client_error_t
+conn_parse(http_client_conn_t *conn, mtev_boolean eof) {
+  size_t off = 0;
+  mtev_http_client_error_t err = MTEV_HTTP_CLIENT_OK;
+
+  while(err == MTEV_HTTP_CLIENT_OK) {
+    mtev_http_client_request_t *req = conn_head(conn);
+    char *avail = conn->rbuf + off, *eol;
+    size_t alen = conn->rlen - off;
+
+    if(!req) {
+      /* unsolicited data */
+      if(alen) err = MTEV_HTTP_CLIENT_ERR_PROTOCOL;
+      break;
+    }
+    if(conn->parse == PARSE_HEADERS) {
+      char *end = NULL;
+      if(alen >= 4) end = memmem(avail, alen, "\r\n\r\n", 4);
+      if(!end) {
+        if(alen > CLIENT_MAX_HEADER_SIZE) err = MTEV_HTTP_CLIENT_ERR_PROTOCOL;
+        break;
+      }
+      end[2] = '\0';
+      if(!parse_response_headers(conn, req, avail)) {
+        err = MTEV_HTTP_CLIENT_ERR_PROTOCOL;
+        break;
+      }
+      off += (end - avail) + 4;
+      if(conn->parse == PARSE_BODY_LENGTH && conn->remaining == 0)
+        conn_response_done(conn);
+      if(conn->state == CONN_CLOSED) return MTEV_HTTP_CLIENT_OK;
+      continue;
+    }
+    if(conn->parse == PARSE_BODY_LENGTH || conn->parse == PARSE_CHUNK_DATA) {
+      size_t take = MIN((int64_t)alen, conn->remaining);
+      if(take == 0 && conn->remaining) break;
+      err = deliver_body(conn, req, avail, take);
+      off += take;
+      conn->remaining -= take;
+      if(err != MTEV_HTTP_CLIENT_OK || conn->remaining) break;
+      if(conn->parse == PARSE_CHUNK_DATA) {
+        conn->parse = PARSE_CHUNK_DATA_END;
+        continue;
+      }
+      conn_response_done(conn);
+      if(conn->state == CONN_CLOSED) return MTEV_HTTP_CLIENT_OK;
+      continue;
+    }
+    if(conn->parse == PARSE_BODY_UNTIL_CLOSE) {
+      err = deliver_body(conn, req, avail, alen);
+      off += alen;
+      if(err == MTEV_HTTP_CLIENT_OK && eof) {
+        conn_response_done(conn);
+        return MTEV_HTTP_CLIENT_OK;
+      }
+      break;
+    }
+    /* chunk framing lines */
+    eol = alen >= 2 ? memmem(avail, alen, "\r\n", 2) : NULL;
+    if(!eol) {
+      if(alen > 1024) err = MTEV_HTTP_CLIENT_ERR_PROTOCOL;
+      break;
+    }
+    *eol = '\0';
+    off += (eol - avail) + 2;
+    if(conn->parse == PARSE_CHUNK_SIZE) {
+      char *endptr;
+      conn->remaining = strtoll(avail, &endptr, 16);
+      if(endptr == avail || conn->remaining < 0) {
+        err = MTEV_HTTP_CLIENT_ERR_PROTOCOL;
+        break;
+      }
+      conn->parse = conn->remaining ? PARSE_CHUNK_DATA : PARSE_CHUNK_TRAILER;
+    }
+    else if(conn->parse == PARSE_CHUNK_DATA_END) {
+      if(*avail) err = MTEV_HTTP_CLIENT_ERR_PROTOCOL;
+      conn->parse = PARSE_CHUNK_SIZE;
+    }
+    else if(conn->parse == PARSE_CHUNK_TRAILER) {
+      /* trailers are discarded; an empty line ends the response */
+      if(*avail == '\0') {
+        conn_response_done(conn);
+        if(conn->state == CONN_CLOSED) return MTEV_HTTP_CLIENT_OK;
+      }
+    }
+  }
+
+  if(off) {
+    memmove(conn->rbuf, conn->rbuf + off, conn->rlen - off);
+    conn->rlen -= off;
+  }
+  if(err == MTEV_HTTP_CLIENT_OK && eof && conn_head(conn))
+    err = MTEV_HTTP_CLIENT_ERR_IO;
+  return err;
+}
+
+/* Write out any queued request data.  Returns mask bits we still need. */
+static int
+conn_write(http_client_conn_t *conn, mtev_http_client_error_t *err) {
+  eventer_t e = conn->e;
+  mtev_http_client_request_t *req;
+  int mask;
+
+  pthread_mutex_lock(&conn->pool->lock);
+  req = conn->queue;
+  pthread_mutex_unlock(&conn->pool->lock);
+  while(req) {
+    while(req->wire_off < req->wire_len) {
+      ssize_t len = e->opset->write(e->fd, req->wire + req->wire_off,
+                                    req->wire_len - req->wire_off, &mask, e);
+      if(len < 0) {
+        if(errno == EAGAIN) return mask;
+        *err = MTEV_HTTP_CLIENT_ERR_IO;
+        return 0;
+      }
+      req->wire_off += len;
+    }
+    pthread_mutex_lock(&conn->pool->lock);
+    req = req->next;
+    pthread_mutex_unlock(&conn->pool->lock);
+  }
+  return 0;
+}
+
+static int
+conn_drive(eventer_t e, int mask, void *closure, struct timeval *now) {
+  http_client_conn_t *conn = closure;
+  mtev_http_client_error_t err = MTEV_HTTP_CLIENT_OK;
+  int newmask = EVENTER_READ | EVENTER_EXCEPTION;
+
+  pthread_mutex_lock(&conn->pool->lock);
+  conn->kick_scheduled = mtev_false;
+  pthread_mutex_unlock(&conn->pool->lock);
+
+  if(mask & EVENTER_EXCEPTION) {
+    err = (conn->state == CONN_CONNECTING) ? MTEV_HTTP_CLIENT_ERR_CONNECT
+                                           : MTEV_HTTP_CLIENT_ERR_IO;
+    goto bail;
+  }
+
+  if(conn->state == CONN_CONNECTING) {
+    int so_error = 0;
+    socklen_t so_len = sizeof(so_error);
+    if(!(mask & EVENTER_WRITE)) return EVENTER_WRITE | EVENTER_EXCEPTION;
+    if(getsockopt(e->fd, SOL_SOCKET, SO_ERROR, &so_error, &so_len) < 0 ||
+       so_error != 0) {
+      mtevL(debug_ls, "http_client: connect failed: %s\n",
+            strerror(so_error ? so_error : errno));
+      err = MTEV_HTTP_CLIENT_ERR_CONNECT;
+      goto bail;
+    }
+    pthread_mutex_lock(&conn->pool->lock);
+    conn->state = eventer_get_eventer_ssl_ctx(e) ? CONN_TLS_HANDSHAKE : CONN_READY;
+    pthread_mutex_unlock(&conn->pool->lock);
+    mtev_gettimeofday(&conn->idle_since, NULL);
+    conn_reschedule_timer(conn);
+  }
+
+  if(conn->state == CONN_TLS_HANDSHAKE) {
+    int sslmask;
+    if(eventer_SSL_connect(e, &sslmask) <= 0) {
+      if(errno == EAGAIN) return sslmask | EVENTER_EXCEPTION;
+      err = MTEV_HTTP_CLIENT_ERR_CONNECT;
+      goto bail;
+    }
+    pthread_mutex_lock(&conn->pool->lock);
+    conn->state = CONN_READY;
+    pthread_mutex_unlock(&conn->pool->lock);
+  }
+
+  newmask |= conn_write(conn, &err);
+  if(err != MTEV_HTTP_CLIENT_OK) goto bail;
+
+  while(1) {
+    ssize_t len;
+    int rmask;
+    if(conn->rallocd - conn->rlen < CLIENT_READ_CHUNK) {
+      conn->rallocd = conn->rlen + CLIENT_READ_CHUNK;
+      conn->rbuf = realloc(conn->rbuf, conn->rallocd);
+    }
+    len = e->opset->read(e->fd, conn->rbuf + conn->rlen,
+                         conn->rallocd - conn->rlen, &rmask, e);
+    if(len < 0) {
+      if(errno == EAGAIN) {
+        newmask |= rmask;
+        break;
+      }
+      err = MTEV_HTTP_CLIENT_ERR_IO;
+      goto bail;
+    }
+    conn->rlen += len;
+    mtev_atomic_inc32(&conn->refcnt);
+    err = conn_parse(conn, len == 0);
+    if(conn->state == CONN_CLOSED) {
+      /* a completion closed us; the event is already gone */
+      conn_deref(conn);
+      return 0;
+    }
+    conn_deref(conn);
+    if(err != MTEV_HTTP_CLIENT_OK) goto bail;
+    if(len == 0) {
+      /* server closed between responses */
+      conn_close(conn, MTEV_HTTP_CLIENT_ERR_IO, mtev_true);
+      return 0;
+    }
+  }
+  conn_reschedule_timer(conn);
+  /* writes may have been queued by completions */
+  return newmask;
+
+ bail:
+  conn_close(conn, err, mtev_true);
+  return 0;
+}
@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2017, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name Circonus, Inc. nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef MTEV_HTTP_CLIENT_H
+#define MTEV_HTTP_CLIENT_H
+
+#include "mtev_defines.h"
+#include "mtev_hash.h"
+#include "mtev_http.h"
+
+/* An HTTP/1.1 client driven by the eventer.
+ *
+ * Connections are pooled per (address, port, TLS settings) and shared by
+ * all threads.  Idle connections are kept alive for reuse, and idempotent
+ * requests may be pipelined onto busy connections.  All completion and
+ * body callbacks run on the eventer thread that owns the connection (or
+ * on the submitting thread if the request fails before it is assigned a
+ * connection).
+ */
+
+typedef struct mtev_http_client_request mtev_http_client_request_t;
+
+typedef enum {
+  MTEV_HTTP_CLIENT_OK = 0,
+  MTEV_HTTP_CLIENT_ERR_CONNECT,
+  MTEV_HTTP_CLIENT_ERR_TIMEOUT,
+  MTEV_HTTP_CLIENT_ERR_IO,
+  MTEV_HTTP_CLIENT_ERR_PROTOCOL,
+  MTEV_HTTP_CLIENT_ERR_DECODE,
+  MTEV_HTTP_CLIENT_ERR_ABORTED
+} mtev_http_client_error_t;
+
+/* Return mtev_false to abort the request. The bchain is only valid
+ * for the duration of the call. */
+typedef mtev_boolean (*mtev_http_client_body_func)(mtev_http_client_request_t *,
+                                                   const struct bchain *,
+                                                   void *closure);
+typedef void (*mtev_http_client_complete_func)(mtev_http_client_request_t *,
+                                               mtev_http_client_error_t,
+                                               void *closure);
+
+/*! \fn mtev_http_client_request_t *mtev_http_client_request_new(const char *method, const char *address, unsigned short port, const char *path)
+    \brief Create a new HTTP client request.
+    \param method the HTTP method ("GET", "POST", ...)
+    \param address an IPv4 or IPv6 address literal to connect to
+    \param port the port to connect to
+    \param path the request URI (including any query string)
+    \return a new request or NULL if the address is invalid.
+
+    The Host header defaults to the address; set it explicitly with
+    mtev_http_client_request_header_set when talking to virtual hosts.
+ */
+API_EXPORT(mtev_http_client_request_t *)
+  mtev_http_client_request_new(const char *method, const char *address,
+                               unsigned short port, const char *path);
+
+API_EXPORT(void)
+  mtev_http_client_request_header_set(mtev_http_client_request_t *req,
+                                      const char *name, const char *value);
+
+/*! \fn void mtev_http_client_request_body_set(mtev_http_client_request_t *req, const void *body, size_t len)
+    \brief Set (copy) the body of the request; a Content-Length is sent.
+ */
+API_EXPORT(void)
+  mtev_http_client_request_body_set(mtev_http_client_request_t *req,
+                                    const void *body, size_t len);
+
+/*! \fn void mtev_http_client_request_timeout_set(mtev_http_client_request_t *req, uint32_t timeout_ms)
+    \brief Set the overall deadline for the request (including connecting), 0 for none.
+ */
+API_EXPORT(void)
+  mtev_http_client_request_timeout_set(mtev_http_client_request_t *req,
+                                       uint32_t timeout_ms);
+
+/*! \fn void mtev_http_client_request_ssl_set(mtev_http_client_request_t *req, const char *layer, const char *ca, const char *cert, const char *key, const char *ciphers, const char *sni)
+    \brief Use TLS for the request. Any argument may be NULL.
+
+    Requests with identical TLS settings share a connection pool.
+ */
+API_EXPORT(void)
+  mtev_http_client_request_ssl_set(mtev_http_client_request_t *req,
+                                   const char *layer, const char *ca,
+                                   const char *cert, const char *key,
+                                   const char *ciphers, const char *sni);
+
+/*! \fn void mtev_http_client_request_decode_set(mtev_http_client_request_t *req, mtev_boolean decode)
+    \brief Control transparent response decoding (on by default).
+
+    When on, the request advertises the encodings mtev_compress supports
+    in Accept-Encoding (unless the caller set one) and compressed bodies
+    are decoded before being handed to the caller.
+ */
+API_EXPORT(void)
+  mtev_http_client_request_decode_set(mtev_http_client_request_t *req,
+                                      mtev_boolean decode);
+
+/*! \fn void mtev_http_client_request_body_callback_set(mtev_http_client_request_t *req, mtev_http_client_body_func f)
+    \brief Stream the response body to `f` instead of accumulating it.
+ */
+API_EXPORT(void)
+  mtev_http_client_request_body_callback_set(mtev_http_client_request_t *req,
+                                             mtev_http_client_body_func f);
+
+/*! \fn mtev_boolean mtev_http_client_request_send(mtev_http_client_request_t *req, mtev_http_client_complete_func f, void *closure)
+    \brief Submit a request.
+    \param req the request, owned by the client until `f` is called
+    \param f called exactly once when the request completes or fails
+    \param closure passed to callbacks
+    \return mtev_false if the request was already sent.
+ */
+API_EXPORT(mtev_boolean)
+  mtev_http_client_request_send(mtev_http_client_request_t *req,
+                                mtev_http_client_complete_func f,
+                                void *closure);
+
+API_EXPORT(void *)
+  mtev_http_client_request_closure(mtev_http_client_request_t *req);
+
+API_EXPORT(int)
+  mtev_http_client_response_status(mtev_http_client_request_t *req);
+
+/*! \fn const char *mtev_http_client_response_header(mtev_http_client_request_t *req, const char *name)
+    \brief Find a response header by (lower case) name.
+ */
+API_EXPORT(const char *)
+  mtev_http_client_response_header(mtev_http_client_request_t *req,
+                                   const char *name);
+
+/*! \fn mtev_hash_table *mtev_http_client_response_headers(mtev_http_client_request_t *req)
+    \brief The response headers, keyed by lower case name.
+ */
+API_EXPORT(mtev_hash_table *)
+  mtev_http_client_response_headers(mtev_http_client_request_t *req);
+
+/*! \fn const struct bchain *mtev_http_client_response_body(mtev_http_client_request_t *req, size_t *len)
+    \brief The accumulated (decoded) response body as a chain of buffers.
+ */
+API_EXPORT(const struct bchain *)
+  mtev_http_client_response_body(mtev_http_client_request_t *req, size_t *len);
+
+API_EXPORT(const char *)
+  mtev_http_client_strerror(mtev_http_client_error_t err);
+
+/*! \fn void mtev_http_client_request_free(mtev_http_client_request_t *req)
+    \brief Free a request that was never sent, or whose completion callback has been called.
+ */
+API_EXPORT(void)
+  mtev_http_client_request_free(mtev_http_client_request_t *req);
+
+/*! \fn void mtev_http_client_pool_options(int max_connections, int max_pipeline, uint32_t idle_timeout_ms)
+    \brief Tune connection pooling.
+    \param max_connections the most connections per pool (default 8)
+    \param max_pipeline the most outstanding idempotent requests per connection (default 1, no pipelining)
+    \param idle_timeout_ms how long idle connections are kept (default 30000)
+
+    These may also be set via the `max_connections`, `max_pipeline` and
+    `idle_timeout` attributes of `//http_client` in the configuration.
+ */
+API_EXPORT(void)
+  mtev_http_client_pool_options(int max_connections, int max_pipeline,
+                                uint32_t idle_timeout_ms);
+
+#endif
@@ -37,13 +37,19 @@
 #include "mtev_rest.h"
 #include "mtev_conf.h"
 #include "mtev_json.h"
+#include "mtev_compress.h"
+#include "mtev_stats.h"
+#include "mtev_smap.h"
+#include "mtev_memory.h"
 
 #include <pcre.h>
+#include <ck_pr.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <errno.h>
 #include <dlfcn.h>
+#include <pthread.h>
 
 struct rest_xml_payload {
   char *buffer;
@@ -53,6 +59,15 @@ struct rest_xml_payload {
   int complete;
 };
 
+struct rest_json_payload {
+  char *buffer;
+  mtev_json_doc_t *doc;
+  const char *err;
+  int len;
+  int allocd;
+  int complete;
+};
+
 struct rest_raw_payload {
   char *buffer;
   int len;
@@ -72,6 +87,10 @@ struct rest_url_dispatcher {
   void *closure;
   eventer_pool_t *pool;
   int pool_rr; /* used for round-robin */
+  mtev_boolean compression_policy;
+  uint32_t compression_encodings;
+  int compression_level;
+  size_t compression_min_size;
   /* Chain to the next one */
   struct rest_url_dispatcher *next;
 };
@@ -104,6 +123,15 @@ mtev_rest_mountpoint_set_eventer_pool(mtev_rest_mountpoint_t *mountpoint,
                                 eventer_pool_t *pool) {
   mountpoint->pool = pool;
 }
+void
+mtev_rest_mountpoint_set_compression(mtev_rest_mountpoint_t *mountpoint,
+                                     uint32_t encodings, int level,
+                                     size_t min_size) {
+  mountpoint->compression_policy = mtev_true;
+  mountpoint->compression_encodings = encodings;
+  mountpoint->compression_level = level;
+  mountpoint->compression_min_size = min_size;
+}
 
 
 struct rule_container {
@@ -113,6 +141,35 @@ struct rule_container {
 };
 mtev_hash_table dispatch_points;
 
+/* A read-only copy of dispatch_points' bases for the request path.  It is
+ * rebuilt whenever a base is added and swapped in; lookups hold an epoch
+ * section so the previous copy can be retired safely. */
+struct dispatch_index {
+  mtev_smap_t *bases;
+};
+static struct dispatch_index *dispatch_index;
+static pthread_mutex_t dispatch_index_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+dispatch_index_free(void *vidx) {
+  mtev_smap_destroy(((struct dispatch_index *)vidx)->bases, NULL);
+}
+
+static void
+dispatch_index_rebuild(void) {
+  mtev_hash_iter iter = MTEV_HASH_ITER_ZERO;
+  struct dispatch_index *idx, *old;
+
+  pthread_mutex_lock(&dispatch_index_lock);
+  idx = mtev_memory_safe_malloc_cleanup(sizeof(*idx), dispatch_index_free);
+  idx->bases = mtev_smap_create(mtev_hash_size(&dispatch_points));
+  while(mtev_hash_adv(&dispatch_points, &iter))
+    mtev_smap_set(idx->bases, iter.key.str, iter.klen, iter.value.ptr, NULL);
+  old = ck_pr_fas_ptr(&dispatch_index, idx);
+  pthread_mutex_unlock(&dispatch_index_lock);
+  if(old) mtev_memory_safe_free(old);
+}
+
 struct mtev_rest_acl_rule {
   mtev_boolean allow;
   pcre *url;
@@ -131,6 +188,9 @@ struct mtev_rest_acl {
 
 static mtev_hash_table mime_type_defaults;
 
+static stats_handle_t *arena_request_bytes;
+static uint64_t arena_high_water;
+
 static struct mtev_rest_acl *global_rest_acls = NULL;
 
 static mtev_boolean
@@ -190,8 +250,7 @@ mtev_http_rest_endpoints(mtev_http_rest_closure_t *restc,
     }
   }
 
-  mtev_http_response_standard(ctx, 200, "OK", "application/json");
-  mtev_http_response_append_json(ctx, doc);
+  mtev_http_response_json(ctx, 200, "OK", doc);
   MJ_DROP(doc);
   mtev_http_response_end(ctx);
   return 0;
@@ -202,6 +261,7 @@ mtev_http_find_matching_route_rule(mtev_http_rest_closure_t *restc)
 {
   struct rule_container *cont = NULL;
   struct rest_url_dispatcher *rule;
+  struct dispatch_index *idx;
   mtev_http_request *req = mtev_http_session_request(restc->http_ctx);
   mtev_hash_table *headers;
   const char *uri_str;
@@ -212,18 +272,20 @@ mtev_http_find_matching_route_rule(mtev_http_rest_closure_t *restc)
   eob = eoq - 1;
 
   /* find the right base */
-  while(1) {
+  mtev_memory_begin();
+  idx = ck_pr_load_ptr(&dispatch_index);
+  while(idx) {
     void *vcont;
     while(eob >= uri_str && *eob != '/') eob--;
     if(eob < uri_str) break; /* off the front */
-    if(mtev_hash_retrieve(&dispatch_points, uri_str,
-                          eob - uri_str + 1, &vcont)) {
+    if(mtev_smap_retrieve(idx->bases, uri_str, eob - uri_str + 1, &vcont)) {
       cont = vcont;
       eob++; /* move past the determined base */
       break;
     }
     eob--;
   }
+  mtev_memory_end();
 
   /* no base, give up */
   if(!cont) return NULL;
@@ -246,13 +308,12 @@ mtev_http_find_matching_route_rule(mtev_http_rest_closure_t *restc)
 
       restc->nparams = cnt - 1;
       if(restc->nparams) {
-        restc->params = calloc(restc->nparams, sizeof(*restc->params));
+        mtev_arena_t *arena = mtev_http_rest_arena(restc);
+        restc->params = mtev_arena_calloc(arena, restc->nparams, sizeof(*restc->params));
         for(cnt = 0; cnt < restc->nparams; cnt++) {
           int start = ovector[(cnt+1)*2];
           int end = ovector[(cnt+1)*2+1];
-          restc->params[cnt] = malloc(end - start + 1);
-          memcpy(restc->params[cnt], eob + start, end - start);
-          restc->params[cnt][end - start] = '\0';
+          restc->params[cnt] = mtev_arena_strndup(arena, eob + start, end - start);
         }
       }
       return rule;
@@ -286,6 +347,12 @@ mtev_http_get_handler(mtev_http_rest_closure_t *restc, mtev_boolean *migrate) {
       /* We match, set 'er up */
     restc->fastpath = rule->handler;
     restc->closure = rule->closure;
+    if(rule->compression_policy) {
+      mtev_http_response_compression_policy(restc->http_ctx,
+                                            rule->compression_encodings,
+                                            rule->compression_level,
+                                            rule->compression_min_size);
+    }
     if(rule->pool) {
       eventer_t e = mtev_http_connection_event(mtev_http_session_connection(restc->http_ctx));
       if(e) {
@@ -461,6 +528,7 @@ mtev_http_rest_new_rule_auth_closure(const char *method, const char *base,
     cont = calloc(1, sizeof(*cont));
     cont->base = strdup(base);
     mtev_hash_store(&dispatch_points, cont->base, strlen(cont->base), cont);
+    dispatch_index_rebuild();
   }
   else cont = vcont;
 
@@ -480,20 +548,33 @@ mtev_http_rest_closure_alloc() {
   restc = calloc(1, sizeof(*restc));
   return restc;
 }
+mtev_arena_t *
+mtev_http_rest_arena(mtev_http_rest_closure_t *restc) {
+  if(!restc->arena) restc->arena = mtev_arena_create(0);
+  return restc->arena;
+}
+static void
+mtev_http_rest_arena_account(mtev_arena_t *arena) {
+  uint64_t used = mtev_arena_used(arena), prev;
+  if(used == 0) return;
+  stats_set_hist_intscale(arena_request_bytes, used, 0, 1);
+  while((prev = ck_pr_load_64(&arena_high_water)) < used &&
+        !ck_pr_cas_64(&arena_high_water, prev, used));
+}
 void
 mtev_http_rest_clean_request(mtev_http_rest_closure_t *restc) {
-  int i;
   if (restc) {
-    if(restc->params && restc->nparams) {
-      for(i=0;i<restc->nparams;i++) free(restc->params[i]);
-      free(restc->params);
-    }
     if(restc->call_closure_free) restc->call_closure_free(restc->call_closure);
     restc->call_closure_free = NULL;
     restc->call_closure = NULL;
     restc->nparams = 0;
     restc->params = NULL;
     restc->fastpath = NULL;
+    /* the call closure may have used the arena, so this goes last */
+    if(restc->arena) {
+      mtev_http_rest_arena_account(restc->arena);
+      mtev_arena_reset(restc->arena);
+    }
   }
 }
 void
@@ -504,6 +585,7 @@ mtev_http_rest_closure_free(void *v) {
       free(restc->remote_cn);
     }
     mtev_http_rest_clean_request(restc);
+    mtev_arena_destroy(restc->arena);
     free(restc);
   }
 }
@@ -696,6 +778,62 @@ rest_get_xml_upload(mtev_http_rest_closure_t *restc,
   return rxc->indoc;
 }
 
+static void
+rest_json_payload_free(void *f) {
+  struct rest_json_payload *jsonin = f;
+  if (jsonin) {
+    mtev_json_doc_free(jsonin->doc);
+    free(jsonin->buffer);
+    free(jsonin);
+  }
+}
+
+mtev_json_doc_t *
+rest_get_json_upload(mtev_http_rest_closure_t *restc,
+                     int *mask, int *complete, const char **err) {
+  struct rest_json_payload *rxc;
+  mtev_http_request *req = mtev_http_session_request(restc->http_ctx);
+
+  if(restc->call_closure == NULL) {
+    restc->call_closure = calloc(1, sizeof(*rxc));
+    restc->call_closure_free = rest_json_payload_free;
+  }
+  rxc = restc->call_closure;
+  while(!rxc->complete) {
+    int len;
+    if(rxc->len == rxc->allocd) {
+      char *b;
+      rxc->allocd += 32768;
+      b = rxc->buffer ? realloc(rxc->buffer, rxc->allocd) :
+                        malloc(rxc->allocd);
+      if(!b) {
+        *complete = 1;
+        return NULL;
+      }
+      rxc->buffer = b;
+    }
+    len = mtev_http_session_req_consume(restc->http_ctx,
+                                        rxc->buffer + rxc->len,
+                                        rxc->allocd - rxc->len,
+                                        rxc->allocd - rxc->len,
+                                        mask);
+    if(len > 0) rxc->len += len;
+    if(len < 0 && errno == EAGAIN) return NULL;
+    else if(len < 0) {
+      *complete = 1;
+      return NULL;
+    }
+    if(rxc->len == mtev_http_request_content_length(req)) {
+      rxc->doc = mtev_json_doc_parse(rxc->buffer, rxc->len, 0, &rxc->err, NULL);
+      rxc->complete = 1;
+    }
+  }
+
+  *complete = 1;
+  if(err) *err = rxc->err;
+  return rxc->doc;
+}
+
 static void
 rest_raw_payload_free(void *f) {
   if (f) {
@@ -773,12 +911,515 @@ rest_get_raw_upload(mtev_http_rest_closure_t *restc,
   return rxc->buffer;
 }
 
+static mtev_boolean
+rest_stream_result(int rv, int *complete) {
+  if(rv == 0) return mtev_true;
+  *complete = 1;
+  return (rv > 0) ? mtev_true : mtev_false;
+}
+
+mtev_boolean
+rest_stream_upload(mtev_http_rest_closure_t *restc,
+                   int *mask, int *complete,
+                   mtev_http_body_func f, void *closure) {
+  int rv = mtev_http_session_req_consume_stream(restc->http_ctx, f,
+                                                closure, mask);
+  return rest_stream_result(rv, complete);
+}
+
+mtev_boolean
+rest_upload_to_fd(mtev_http_rest_closure_t *restc,
+                  int *mask, int *complete, int fd) {
+  int rv = mtev_http_session_req_consume_to_fd(restc->http_ctx, fd, mask);
+  return rest_stream_result(rv, complete);
+}
+
+/* The static asset cache.
+ *
+ * Files served by mtev_rest_simple_file_handler are kept in memory keyed
+ * on the (unresolved) document path.  Each entry remembers the identity of
+ * the file it was loaded from (inode, size, mtime), a strong ETag, the
+ * preformatted Last-Modified/Content-Length header values and lazily built
+ * precompressed variants.  Entries are revalidated against the filesystem
+ * at most once every STATIC_CACHE_REVALIDATE seconds; in between, hits
+ * (including conditional GETs) never touch the disk.  Memory is bounded by
+ * evicting from the cold end of an LRU list.
+ *
+ * Caches are keyed on (static_cache_size, compression level), not on the
+ * listener: every listener configuring the same size, with mountpoints at
+ * the same level, shares one cache and one budget, so busy traffic on one
+ * can evict another's assets.  Give a listener a distinct static_cache_size
+ * to isolate it.
+ */
+#define STATIC_CACHE_DEFAULT_SIZE (32 * 1024 * 1024)
+#define STATIC_CACHE_REVALIDATE 1
+
+typedef enum {
+  STATIC_VARIANT_IDENTITY = 0,
+  STATIC_VARIANT_GZIP,
+  STATIC_VARIANT_DEFLATE,
+  STATIC_VARIANT_LZ4F,
+  STATIC_VARIANT_ZSTD,
+  STATIC_VARIANT_MAX
+} static_variant_t;
+
+static const struct {
+  mtev_compress_type type;
+  const char *encoding;
+} static_variants[STATIC_VARIANT_MAX] = {
+  { MTEV_COMPRESS_NONE, NULL },
+  { MTEV_COMPRESS_GZIP, "gzip" },
+  { MTEV_COMPRESS_DEFLATE, "deflate" },
+  { MTEV_COMPRESS_LZ4F, "lz4f" },
+  { MTEV_COMPRESS_ZSTD, "zstd" }
+};
+
+struct static_asset {
+  char *key;
+  char *rfile;
+  char *content_type;
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+  time_t validated;
+  char etag[48];
+  char last_modified[32];
+  unsigned char *body[STATIC_VARIANT_MAX];
+  size_t body_len[STATIC_VARIANT_MAX];
+  char content_length[STATIC_VARIANT_MAX][24];
+  mtev_boolean attempted[STATIC_VARIANT_MAX];
+  size_t bytes;
+  uint32_t refcnt;
+  struct static_cache *cache; /* set while cached */
+  struct static_asset *lru_prev, *lru_next;
+};
+
+struct static_cache {
+  size_t max;
+  int level;
+  size_t bytes;
+  mtev_hash_table assets;
+  struct static_asset *lru_head, *lru_tail;
+};
+
+/* protects all caches and everything in them */
+static pthread_mutex_t static_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+/* "<size>:<level>" -> struct static_cache, never freed */
+static mtev_hash_table static_caches;
+
+static struct static_cache *
+static_cache_get(size_t max, int level) {
+  char key[64];
+  void *vcache;
+  struct static_cache *cache;
+  int klen = snprintf(key, sizeof(key), "%zu:%d", max, level);
+  pthread_mutex_lock(&static_cache_lock);
+  if(mtev_hash_retrieve(&static_caches, key, klen, &vcache)) cache = vcache;
+  else {
+    cache = calloc(1, sizeof(*cache));
+    cache->max = max;
+    cache->level = level;
+    mtev_hash_init(&cache->assets);
+    mtev_hash_store(&static_caches, strdup(key), klen, cache);
+  }
+  pthread_mutex_unlock(&static_cache_lock);
+  return cache;
+}
+
+static void
+static_asset_free(struct static_asset *a) {
+  int i;
+  for(i=0; i<STATIC_VARIANT_MAX; i++) free(a->body[i]);
+  free(a->key);
+  free(a->rfile);
+  free(a->content_type);
+  free(a);
+}
+/* must hold static_cache_lock; returns true if the caller must free */
+static mtev_boolean
+static_asset_deref_locked(struct static_asset *a) {
+  return (--a->refcnt == 0);
+}
+static void
+static_asset_release(struct static_asset *a) {
+  mtev_boolean dofree;
+  pthread_mutex_lock(&static_cache_lock);
+  dofree = static_asset_deref_locked(a);
+  pthread_mutex_unlock(&static_cache_lock);
+  if(dofree) static_asset_free(a);
+}
+static void
+static_cache_lru_unlink_locked(struct static_asset *a) {
+  struct static_cache *cache = a->cache;
+  if(a->lru_prev) a->lru_prev->lru_next = a->lru_next;
+  else cache->lru_head = a->lru_next;
+  if(a->lru_next) a->lru_next->lru_prev = a->lru_prev;
+  else cache->lru_tail = a->lru_prev;
+  a->lru_prev = a->lru_next = NULL;
+}
+static void
+static_cache_lru_push_locked(struct static_asset *a) {
+  struct static_cache *cache = a->cache;
+  a->lru_prev = NULL;
+  a->lru_next = cache->lru_head;
+  if(cache->lru_head) cache->lru_head->lru_prev = a;
+  cache->lru_head = a;
+  if(!cache->lru_tail) cache->lru_tail = a;
+}
+/* Drop an entry from its cache, returning it if the last reference went */
+static struct static_asset *
+static_cache_remove_locked(struct static_asset *a) {
+  struct static_cache *cache = a->cache;
+  if(!cache) return NULL;
+  mtev_hash_delete(&cache->assets, a->key, strlen(a->key), NULL, NULL);
+  static_cache_lru_unlink_locked(a);
+  cache->bytes -= a->bytes;
+  a->cache = NULL;
+  return static_asset_deref_locked(a) ? a : NULL;
+}
+static void
+static_cache_remove(struct static_asset *a) {
+  struct static_asset *tofree;
+  pthread_mutex_lock(&static_cache_lock);
+  tofree = static_cache_remove_locked(a);
+  pthread_mutex_unlock(&static_cache_lock);
+  if(tofree) static_asset_free(tofree);
+}
+/* Evict cold entries until we fit; the victims are chained through
+ * lru_next and handed back to be freed outside of the lock.
+ */
+static struct static_asset *
+static_cache_evict_locked(struct static_cache *cache) {
+  struct static_asset *victims = NULL;
+  while(cache->bytes > cache->max && cache->lru_tail) {
+    struct static_asset *a = static_cache_remove_locked(cache->lru_tail);
+    if(a) {
+      a->lru_next = victims;
+      victims = a;
+    }
+  }
+  return victims;
+}
+static void
+static_cache_free_victims(struct static_asset *victims) {
+  while(victims) {
+    struct static_asset *next = victims->lru_next;
+    static_asset_free(victims);
+    victims = next;
+  }
+}
+static struct static_asset *
+static_cache_lookup(struct static_cache *cache, const char *key) {
+  void *vasset;
+  struct static_asset *a = NULL;
+  pthread_mutex_lock(&static_cache_lock);
+  if(mtev_hash_retrieve(&cache->assets, key, strlen(key), &vasset)) {
+    a = vasset;
+    a->refcnt++;
+    static_cache_lru_unlink_locked(a);
+    static_cache_lru_push_locked(a);
+  }
+  pthread_mutex_unlock(&static_cache_lock);
+  return a;
+}
+/* Takes ownership of the caller's reference to a; an entry for the same
+ * key that is already cached is replaced.
+ */
+static void
+static_cache_insert(struct static_cache *cache, struct static_asset *a) {
+  void *vold;
+  struct static_asset *victims, *old = NULL;
+  pthread_mutex_lock(&static_cache_lock);
+  if(mtev_hash_retrieve(&cache->assets, a->key, strlen(a->key), &vold))
+    old = static_cache_remove_locked(vold);
+  a->refcnt++;
+  a->cache = cache;
+  mtev_hash_store(&cache->assets, a->key, strlen(a->key), a);
+  static_cache_lru_push_locked(a);
+  cache->bytes += a->bytes;
+  victims = static_cache_evict_locked(cache);
+  pthread_mutex_unlock(&static_cache_lock);
+  if(old) static_asset_free(old);
+  static_cache_free_victims(victims);
+}
+static void
+static_asset_set_variant(struct static_asset *a, static_variant_t v,
+                         unsigned char *body, size_t len) {
+  a->body[v] = body;
+  a->body_len[v] = len;
+  snprintf(a->content_length[v], sizeof(a->content_length[v]), "%zu", len);
+  a->bytes += len;
+}
+/* One-shot compression at a specific level, through a stream context as
+ * the one-shot API always uses the default.  Only the gzip and zstd streams
+ * take a level; the others compress at their default.  Returns 0 on success.
+ */
+static int
+static_compress_level(mtev_compress_type type, int level, const char *in,
+                      size_t len, unsigned char **out, size_t *outlen) {
+  mtev_stream_compress_ctx_t *sctx;
+  size_t allocd = mtev_compress_bound(type, len) + 64, used = 0;
+  unsigned char *buf;
+  int rv = 0;
+
+  if(level == MTEV_COMPRESS_LEVEL_DEFAULT ||
+     (type != MTEV_COMPRESS_GZIP && type != MTEV_COMPRESS_ZSTD))
+    return mtev_compress(type, in, len, out, outlen);
+  sctx = mtev_create_stream_compress_ctx();
+  if(mtev_stream_compress_init_level(sctx, type, level) != 0) {
+    mtev_destroy_stream_compress_ctx(sctx);
+    return -1;
+  }
+  buf = malloc(allocd);
+  while(rv == 0) {
+    size_t in_len = len, chunk;
+    if(allocd - used < 1024) {
+      allocd *= 2;
+      buf = realloc(buf, allocd);
+    }
+    chunk = allocd - used;
+    if(len) {
+      rv = mtev_stream_compress(sctx, in, &in_len, buf + used, &chunk);
+      in += in_len;
+      len -= in_len;
+    }
+    else {
+      rv = mtev_stream_compress_flush(sctx, buf + used, &chunk);
+      if(rv == 0 && chunk == 0) break;
+    }
+    used += chunk;
+  }
+  mtev_stream_compress_finish(sctx);
+  mtev_destroy_stream_compress_ctx(sctx);
+  if(rv != 0) {
+    free(buf);
+    return rv;
+  }
+  *out = buf;
+  *outlen = used;
+  return 0;
+}
+/* Build a compressed variant if it hasn't been attempted yet.  Variants that
+ * don't save at least an eighth of the original are not worth their memory
+ * and are remembered as such.
+ */
+static void
+static_asset_compress(struct static_asset *a, static_variant_t v, int level) {
+  unsigned char *out = NULL;
+  size_t outlen = 0;
+  struct static_asset *victims = NULL;
+  mtev_boolean attempted;
+
+  pthread_mutex_lock(&static_cache_lock);
+  attempted = a->attempted[v];
+  pthread_mutex_unlock(&static_cache_lock);
+  if(attempted) return;
+
+  if(static_compress_level(static_variants[v].type, level,
+                           (const char *)a->body[STATIC_VARIANT_IDENTITY],
+                           a->body_len[STATIC_VARIANT_IDENTITY], &out, &outlen) != 0 ||
+     outlen > a->body_len[STATIC_VARIANT_IDENTITY] -
+              (a->body_len[STATIC_VARIANT_IDENTITY] >> 3)) {
+    free(out);
+    out = NULL;
+  }
+
+  pthread_mutex_lock(&static_cache_lock);
+  if(!a->attempted[v]) {
+    a->attempted[v] = mtev_true;
+    if(out) {
+      static_asset_set_variant(a, v, out, outlen);
+      out = NULL;
+      if(a->cache) {
+        a->cache->bytes += outlen;
+        victims = static_cache_evict_locked(a->cache);
+      }
+    }
+  }
+  pthread_mutex_unlock(&static_cache_lock);
+  free(out);
+  static_cache_free_victims(victims);
+}
+static struct static_asset *
+static_asset_load(const char *key, const char *rfile, struct stat *st,
+                  const char *content_type) {
+  int fd, i;
+  off_t off = 0;
+  struct tm tm;
+  struct static_asset *a;
+
+  if((fd = open(rfile, O_RDONLY)) < 0) return NULL;
+  a = calloc(1, sizeof(*a));
+  a->body[STATIC_VARIANT_IDENTITY] = malloc(st->st_size ? st->st_size : 1);
+  while(off < st->st_size) {
+    ssize_t rv = read(fd, a->body[STATIC_VARIANT_IDENTITY] + off,
+                      st->st_size - off);
+    if(rv < 0 && errno == EINTR) continue;
+    if(rv <= 0) break;
+    off += rv;
+  }
+  close(fd);
+  if(off != st->st_size) {
+    /* truncated underneath us, let the uncached path deal with it */
+    static_asset_free(a);
+    return NULL;
+  }
+  a->key = strdup(key);
+  a->rfile = strdup(rfile);
+  a->content_type = strdup(content_type);
+  a->dev = st->st_dev;
+  a->ino = st->st_ino;
+  a->size = st->st_size;
+  a->mtime = st->st_mtime;
+  a->validated = time(NULL);
+  a->refcnt = 1;
+  a->bytes = sizeof(*a) + strlen(key) + strlen(rfile);
+  static_asset_set_variant(a, STATIC_VARIANT_IDENTITY,
+                           a->body[STATIC_VARIANT_IDENTITY], st->st_size);
+  a->attempted[STATIC_VARIANT_IDENTITY] = mtev_true;
+  for(i=1; i<STATIC_VARIANT_MAX; i++)
+    if(st->st_size == 0) a->attempted[i] = mtev_true;
+  snprintf(a->etag, sizeof(a->etag), "\"%08x-%llx-%llx\"",
+           mtev_hash__hash((const char *)a->body[STATIC_VARIANT_IDENTITY],
+                           st->st_size, 0),
+           (unsigned long long)st->st_size,
+           (unsigned long long)st->st_mtime);
+  gmtime_r(&a->mtime, &tm);
+  strftime(a->last_modified, sizeof(a->last_modified),
+           "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  return a;
+}
+/* Make sure a cached entry still reflects the file on disk. */
+static mtev_boolean
+static_asset_revalidate(struct static_asset *a, const char *document_root) {
+  char rfile[PATH_MAX];
+  struct stat st;
+  int drlen = strlen(document_root);
+  time_t now = time(NULL), validated;
+
+  /* validated is shared by every thread serving this entry */
+  pthread_mutex_lock(&static_cache_lock);
+  validated = a->validated;
+  pthread_mutex_unlock(&static_cache_lock);
+  if(now - validated < STATIC_CACHE_REVALIDATE) return mtev_true;
+  if(realpath(a->key, rfile) == NULL) return mtev_false;
+  if(strcmp(rfile, a->rfile)) return mtev_false;
+  if(strncmp(rfile, document_root, drlen)) return mtev_false;
+  if(stat(rfile, &st) != 0) return mtev_false;
+  if(st.st_dev != a->dev || st.st_ino != a->ino ||
+     st.st_size != a->size || st.st_mtime != a->mtime) return mtev_false;
+  pthread_mutex_lock(&static_cache_lock);
+  if(a->validated < now) a->validated = now;
+  pthread_mutex_unlock(&static_cache_lock);
+  return mtev_true;
+}
+static mtev_boolean
+static_asset_not_modified(struct static_asset *a, mtev_http_request *req) {
+  const char *inm = NULL, *ims = NULL;
+  mtev_hash_table *headers = mtev_http_request_headers_table(req);
+
+  if(mtev_hash_retr_str(headers, "if-none-match", strlen("if-none-match"),
+                        &inm)) {
+    /* Our variant ETags are the base ETag with a suffix before the close
+     * quote, so matching the base sans close quote covers all of them.
+     */
+    char base[sizeof(a->etag)];
+    if(!strcmp(inm, "*")) return mtev_true;
+    strlcpy(base, a->etag, sizeof(base));
+    base[strlen(base) - 1] = '\0';
+    return strstr(inm, base) != NULL;
+  }
+  if(mtev_hash_retr_str(headers, "if-modified-since",
+                        strlen("if-modified-since"), &ims)) {
+    /* Clients echo back what we sent as Last-Modified */
+    return !strcmp(ims, a->last_modified);
+  }
+  return mtev_false;
+}
+/* Choose the encoding to serve, within the compression policy of the
+ * mountpoint (as for any other response) and the client's Accept-Encoding.
+ */
+static static_variant_t
+static_asset_pick_variant(mtev_http_session_ctx *ctx, struct static_asset *a) {
+  static const struct {
+    uint32_t opt;
+    static_variant_t v;
+  } preference[] = {
+    { MTEV_HTTP_ZSTD, STATIC_VARIANT_ZSTD },
+    { MTEV_HTTP_GZIP, STATIC_VARIANT_GZIP },
+    { MTEV_HTTP_DEFLATE, STATIC_VARIANT_DEFLATE },
+    { MTEV_HTTP_LZ4F, STATIC_VARIANT_LZ4F }
+  };
+  const char *ae = NULL;
+  mtev_http_request *req = mtev_http_session_request(ctx);
+  mtev_hash_table *headers = mtev_http_request_headers_table(req);
+  uint32_t allowed;
+  size_t min_size;
+  int i;
+
+  /* content encodings are only allowed in HTTP/1.1 */
+  if(strcmp(mtev_http_request_protocol_str(req), "HTTP/1.1")) 
+    return STATIC_VARIANT_IDENTITY;
+  if(!mtev_hash_retr_str(headers, "accept-encoding",
+                         strlen("accept-encoding"), &ae))
+    return STATIC_VARIANT_IDENTITY;
+  mtev_http_response_compression_policy_get(ctx, &allowed, NULL, &min_size);
+  if(a->body_len[STATIC_VARIANT_IDENTITY] < min_size)
+    return STATIC_VARIANT_IDENTITY;
+  for(i=0; i<sizeof(preference)/sizeof(*preference); i++) {
+    static_variant_t v = preference[i].v;
+    if(!(allowed & preference[i].opt)) continue;
+    if(!mtev_compress_type_available(static_variants[v].type)) continue;
+    if(strstr(ae, static_variants[v].encoding)) return v;
+  }
+  return STATIC_VARIANT_IDENTITY;
+}
+static void
+static_asset_respond(mtev_http_session_ctx *ctx, struct static_asset *a,
+                     int level) {
+  char etag[sizeof(a->etag) + 16];
+  mtev_http_request *req = mtev_http_session_request(ctx);
+  static_variant_t v = static_asset_pick_variant(ctx, a);
+
+  if(v != STATIC_VARIANT_IDENTITY) {
+    static_asset_compress(a, v, level);
+    if(a->body[v] == NULL) v = STATIC_VARIANT_IDENTITY;
+  }
+  strlcpy(etag, a->etag, sizeof(etag));
+  if(v != STATIC_VARIANT_IDENTITY)
+    snprintf(etag + strlen(etag) - 1, sizeof(etag) - strlen(etag) + 1,
+             "-%s\"", static_variants[v].encoding);
+
+  if(static_asset_not_modified(a, req)) {
+    mtev_http_response_status_set(ctx, 304, "NOT MODIFIED");
+    mtev_http_response_header_set(ctx, "ETag", etag);
+    mtev_http_response_header_set(ctx, "Last-Modified", a->last_modified);
+    mtev_http_response_header_set(ctx, "Vary", "Accept-Encoding");
+    mtev_http_response_end(ctx);
+    return;
+  }
+  mtev_http_response_status_set(ctx, 200, "OK");
+  mtev_http_response_header_set(ctx, "Content-Type", a->content_type);
+  mtev_http_response_header_set(ctx, "ETag", etag);
+  mtev_http_response_header_set(ctx, "Last-Modified", a->last_modified);
+  mtev_http_response_header_set(ctx, "Vary", "Accept-Encoding");
+  if(v != STATIC_VARIANT_IDENTITY)
+    mtev_http_response_header_set(ctx, "Content-Encoding",
+                                  static_variants[v].encoding);
+  mtev_http_response_header_set(ctx, "Content-Length", a->content_length[v]);
+  if(a->body_len[v] > 0)
+    mtev_http_response_append(ctx, a->body[v], a->body_len[v]);
+  mtev_http_response_end(ctx);
+}
+
 int
 mtev_rest_simple_file_handler(mtev_http_rest_closure_t *restc,
                               int npats, char **pats) {
   int drlen = 0;
   const char *document_root = NULL;
   const char *index_file = NULL;
+  const char *cache_size = NULL;
   mtev_http_session_ctx *ctx = restc->http_ctx;
   char file[PATH_MAX], rfile[PATH_MAX];
   struct stat st;
@@ -786,6 +1427,10 @@ mtev_rest_simple_file_handler(mtev_http_rest_closure_t *restc,
   void *contents = MAP_FAILED;
   const char *dot = NULL, *slash;
   const char *content_type = "application/octet-stream";
+  size_t cache_max = STATIC_CACHE_DEFAULT_SIZE;
+  struct static_cache *cache = NULL;
+  struct static_asset *asset;
+  int level;
 
   if(npats != 1 ||
      !mtev_hash_retr_str(restc->ac->config,
@@ -798,12 +1443,28 @@ mtev_rest_simple_file_handler(mtev_http_rest_closure_t *restc,
                          &index_file)) {
     index_file = "index.html";
   }
+  if(mtev_hash_retr_str(restc->ac->config,
+                        "static_cache_size", strlen("static_cache_size"),
+                        &cache_size)) {
+    cache_max = strtoull(cache_size, NULL, 10);
+  }
+  mtev_http_response_compression_policy_get(ctx, NULL, &level, NULL);
+  if(cache_max) cache = static_cache_get(cache_max, level);
   drlen = strlen(document_root);
   snprintf(file, sizeof(file), "%s/%s", document_root, pats[0]);
   if(file[strlen(file) - 1] == '/') {
     snprintf(file + strlen(file), sizeof(file) - strlen(file),
              "%s", index_file);
   }
+  if(cache && (asset = static_cache_lookup(cache, file)) != NULL) {
+    if(static_asset_revalidate(asset, document_root)) {
+      static_asset_respond(ctx, asset, level);
+      static_asset_release(asset);
+      return 0;
+    }
+    static_cache_remove(asset);
+    static_asset_release(asset);
+  }
   /* resolve */
   if(realpath(file, rfile) == NULL) goto not_found;
   /* restrict */
@@ -817,15 +1478,6 @@ mtev_rest_simple_file_handler(mtev_http_rest_closure_t *restc,
       default: goto not_found;
     }
   }
-  /* open */
-  if(st.st_size > 0) {
-    /* coverity[toctou] */
-    fd = open(rfile, O_RDONLY);
-    if(fd < 0) goto not_found;
-    contents = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
-    close(fd);
-    if(contents == MAP_FAILED) goto not_found;
-  }
   /* set content type */
   slash = strchr(rfile, '/');
   while(slash) {
@@ -854,6 +1506,24 @@ mtev_rest_simple_file_handler(mtev_http_rest_closure_t *restc,
       }
     }
   }
+  /* Regular files that are small relative to the cache get cached */
+  if(cache && S_ISREG(st.st_mode) &&
+     (size_t)st.st_size <= cache->max / 8 &&
+     (asset = static_asset_load(file, rfile, &st, content_type)) != NULL) {
+    static_cache_insert(cache, asset);
+    static_asset_respond(ctx, asset, level);
+    static_asset_release(asset);
+    return 0;
+  }
+  /* open */
+  if(st.st_size > 0) {
+    /* coverity[toctou] */
+    fd = open(rfile, O_RDONLY);
+    if(fd < 0) goto not_found;
+    contents = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(contents == MAP_FAILED) goto not_found;
+  }
   
   mtev_http_response_ok(ctx, content_type);
   if(st.st_size > 0) {
@@ -1010,7 +1680,12 @@ void mtev_http_rest_load_rules() {
   }
 }
 void mtev_http_rest_init() {
+  stats_ns_t *arena_ns;
   mtev_http_init();
+  arena_ns = mtev_stats_ns(mtev_stats_ns(mtev_stats_ns(NULL, "mtev"), "rest"), "arena");
+  arena_request_bytes = stats_register(arena_ns, "request_bytes", STATS_TYPE_HISTOGRAM_FAST);
+  stats_handle_units(arena_request_bytes, STATS_UNITS_BYTES);
+  stats_rob_u64(arena_ns, "high_water", (void *)&arena_high_water);
   eventer_name_callback("mtev_wire_rest_api/1.0", mtev_http_rest_handler);
   eventer_name_callback("http_rest_api", mtev_http_rest_raw_handler);
 
@@ -1057,5 +1732,6 @@ mtev_hash_store(&mime_type_defaults, strdup(ext), strlen(ext), strdup(type))
 void mtev_http_rest_init_globals() {
   mtev_hash_init_locks(&dispatch_points, MTEV_HASH_DEFAULT_SIZE, MTEV_HASH_LOCK_MODE_MUTEX);
   mtev_hash_init(&mime_type_defaults);
+  mtev_hash_init(&static_caches);
 }
 
@@ -35,6 +35,8 @@
 #include "mtev_listener.h"
 #include "mtev_http.h"
 #include "mtev_console.h"
+#include "mtev_arena.h"
+#include "mtev_json_ondemand.h"
 #include "eventer/eventer.h"
 
 #ifndef MTEV_REST_H
@@ -67,6 +69,7 @@ struct mtev_http_rest_closure {
   void *call_closure;
   void (*call_closure_free)(void *);
   void *closure;
+  mtev_arena_t *arena;
 };
 
 API_EXPORT(void) mtev_http_rest_init();
@@ -75,6 +78,18 @@ API_EXPORT(void) mtev_http_rest_init_globals();
 API_EXPORT(void)
   mtev_http_rest_clean_request(mtev_http_rest_closure_t *restc);
 
+/*! \fn mtev_arena_t *mtev_http_rest_arena(mtev_http_rest_closure_t *restc)
+    \brief Return the request-scoped arena for a rest closure.
+    \param restc the rest closure
+    \return an arena that is reset when the request is cleaned up
+
+    Allocations from this arena (including the captured `pats` passed to
+    handlers) remain valid until `mtev_http_rest_clean_request` is called
+    for the request; they must not be freed individually.
+ */
+API_EXPORT(mtev_arena_t *)
+  mtev_http_rest_arena(mtev_http_rest_closure_t *restc);
+
 API_EXPORT(mtev_boolean)
   mtev_http_rest_client_cert_auth(mtev_http_rest_closure_t *restc,
                                   int npats, char **pats);
@@ -171,6 +186,13 @@ API_EXPORT(void)
   mtev_rest_mountpoint_set_eventer_pool(mtev_rest_mountpoint_t *mountpoint,
                                   eventer_pool_t *pool);
 
+/* encodings is a mask of MTEV_HTTP_{ZSTD,GZIP,DEFLATE,LZ4F}, see
+ * mtev_http_response_compression_policy */
+API_EXPORT(void)
+  mtev_rest_mountpoint_set_compression(mtev_rest_mountpoint_t *mountpoint,
+                                       uint32_t encodings, int level,
+                                       size_t min_size);
+
 API_EXPORT(void)
   mtev_http_rest_disclose_endpoints(const char *base, const char *expr);
 
@@ -189,6 +211,30 @@ API_EXPORT(void *)
   rest_get_raw_upload(mtev_http_rest_closure_t *restc,
                       int *mask, int *complete, int *size);
 
+/*! \fn mtev_json_doc_t *rest_get_json_upload(mtev_http_rest_closure_t *restc, int *mask, int *complete, const char **err)
+    \brief Read a request body and index it as JSON.
+    \param restc the rest closure.
+    \param mask the event mask, updated while the body is incomplete.
+    \param complete set to 1 once the body has been read (or failed).
+    \param err if not NULL, set to a description of any parse error.
+    \return the parsed document once complete, or NULL.
+
+    The document (see mtev_json_ondemand.h) references the request body
+    in place and is owned by the rest closure; it is released with it.
+ */
+API_EXPORT(mtev_json_doc_t *)
+  rest_get_json_upload(mtev_http_rest_closure_t *restc,
+                       int *mask, int *complete, const char **err);
+
+API_EXPORT(mtev_boolean)
+  rest_stream_upload(mtev_http_rest_closure_t *restc,
+                     int *mask, int *complete,
+                     mtev_http_body_func f, void *closure);
+
+API_EXPORT(mtev_boolean)
+  rest_upload_to_fd(mtev_http_rest_closure_t *restc,
+                    int *mask, int *complete, int fd);
+
 API_EXPORT(int)
   mtev_rest_simple_file_handler(mtev_http_rest_closure_t *restc,
                                 int npats, char **pats);
@@ -1879,8 +1879,7 @@ rest_show_reverse_json(mtev_http_rest_closure_t *restc,
   pthread_rwlock_unlock(&reverse_sockets_lock);
   free(ctxs);
 
-  mtev_http_response_ok(restc->http_ctx, "application/json");
-  mtev_http_response_append_json(restc->http_ctx, doc);
+  mtev_http_response_json(restc->http_ctx, 200, "OK", doc);
   MJ_DROP(doc);
   mtev_http_response_end(restc->http_ctx);
   return 0;
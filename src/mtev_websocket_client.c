@@ -1,5 +1,6 @@
 #include "mtev_websocket_client.h"
 #include "mtev_http.h"
+#include "mtev_websocket_frame.h"
 #include "utils/mtev_log.h"
 #include "utils/mtev_b64.h"
 
@@ -32,8 +33,13 @@ struct mtev_websocket_client {
   int wanted_eventer_mask;
   char client_key[25];
   void *closure;
+  mtev_ws_outq_t outq; /* protected by lock */
+  mtev_ws_deflate_t *deflate;
 };
 
+/* messages smaller than this are sent uncompressed */
+#define WS_CLIENT_DEFLATE_MIN_SIZE 64
+
 #ifdef HAVE_WSLAY
 static ssize_t wslay_send_callback(wslay_event_context_ptr ctx,
                             const uint8_t *data, size_t len, int flags,
@@ -61,35 +67,37 @@ static struct wslay_event_callbacks wslay_callbacks = {
   wslay_on_msg_recv_callback
 };
 
+/* wslay only frames control messages for us; they are queued behind any
+ * data frames and written in mtev_websocket_client_flush */
 static ssize_t
 wslay_send_callback(wslay_event_context_ptr ctx,
                     const uint8_t *data, size_t len, int flags,
                     void *user_data)
 {
-  ssize_t r;
   mtev_websocket_client_t *client = user_data;
-  client->wanted_eventer_mask = 0;
 
   if(!client->e) {
     wslay_event_set_error(client->wslay_ctx, WSLAY_ERR_CALLBACK_FAILURE);
     return -1;
   }
+  pthread_mutex_lock(&client->lock);
+  mtev_ws_outq_append(&client->outq, data, len);
+  pthread_mutex_unlock(&client->lock);
+  return len;
+}
 
-  while((r = client->e->opset->write(client->e->fd, data, len,
-                                     &client->wanted_eventer_mask,
-                                     client->e)) == -1
-         && errno == EINTR);
-
-  if (r == -1) {
-    if (errno == EAGAIN || errno == EWOULDBLOCK) {
-      wslay_event_set_error(client->wslay_ctx, WSLAY_ERR_WOULDBLOCK);
-    } else {
-      mtevL(mtev_error, "websocket client's wslay_send_callback failed: %s\n", strerror(errno));
-      wslay_event_set_error(client->wslay_ctx, WSLAY_ERR_CALLBACK_FAILURE);
-    }
+static mtev_boolean
+mtev_websocket_client_flush(mtev_websocket_client_t *client) {
+  int rv;
+  client->wanted_eventer_mask = 0;
+  pthread_mutex_lock(&client->lock);
+  rv = mtev_ws_outq_flush(&client->outq, client->e, &client->wanted_eventer_mask);
+  pthread_mutex_unlock(&client->lock);
+  if(rv < 0 && errno != EAGAIN) {
+    mtevL(mtev_error, "websocket client write failed: %s\n", strerror(errno));
+    return mtev_false;
   }
-
-  return r;
+  return mtev_true;
 }
 
 static ssize_t
@@ -144,8 +152,22 @@ wslay_on_msg_recv_callback(wslay_event_context_ptr ctx,
   mtev_boolean rv = 0;
 
   if (!wslay_is_ctrl_frame(arg->opcode)) {
+    const unsigned char *msg = arg->msg;
+    size_t msg_length = arg->msg_length;
+    unsigned char *inflated = NULL;
+
+    if (arg->rsv & WSLAY_RSV1_BIT) {
+      if (client->deflate == NULL ||
+          mtev_ws_deflate_inflate(client->deflate, msg, msg_length,
+                                  &inflated, &msg_length) != 0) {
+        mtevL(mtev_error, "Websocket client could not inflate message, flagging for abort\n");
+        client->should_close = mtev_true;
+        return;
+      }
+      msg = inflated;
+    }
     if (client->msg_callback != NULL) {
-      rv = client->msg_callback(client, arg->opcode, arg->msg, arg->msg_length, client->closure);
+      rv = client->msg_callback(client, arg->opcode, msg, msg_length, client->closure);
       if (!rv) {
         mtevL(mtev_error, "Websocket client consumer handler failed, flagging for abort\n");
         client->should_close = mtev_true;
@@ -154,6 +176,7 @@ wslay_on_msg_recv_callback(wslay_event_context_ptr ctx,
        mtevL(mtev_error, "Websocket client has no handler function set, aborting connection\n");
        client->should_close = mtev_true;
     }
+    free(inflated);
   }
 }
 
@@ -223,6 +246,9 @@ mtev_websocket_client_send_handshake(mtev_websocket_client_t *client) {
                         "Sec-WebSocket-Key: %s\r\n"
                         "Sec-WebSocket-Protocol: %s\r\n"
                         "Sec-WebSocket-Version: 13\r\n"
+#ifdef HAVE_WSLAY_EVENT_CONFIG_SET_ALLOWED_RSV_BITS
+                        "Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits\r\n"
+#endif
                         "\r\n",
                         client->path, client->host, client->client_key, client->service);
 
@@ -238,9 +264,27 @@ mtev_websocket_client_recv_handshake(mtev_websocket_client_t *client) {
                                         mtev_b64_encode_len(SHA_DIGEST_LENGTH) + 1,
                                         client->client_key);
 
-  if(recv_resheader(client->e, resheader, sizeof(resheader), &client->wanted_eventer_mask) == -1) {
+  ssize_t reslen = recv_resheader(client->e, resheader, sizeof(resheader) - 1,
+                                 &client->wanted_eventer_mask);
+  if(reslen == -1) {
     return mtev_false;
   }
+  resheader[reslen] = '\0';
+
+  char *extensions = strcasestr(resheader, "\r\nSec-WebSocket-Extensions:");
+  if(extensions) {
+    mtev_ws_deflate_params_t agreed;
+    char *eol;
+    extensions += strlen("\r\nSec-WebSocket-Extensions:");
+    eol = strstr(extensions, "\r\n");
+    if(eol) *eol = '\0';
+    if(!mtev_ws_deflate_parse_response(extensions, &agreed)) {
+      mtevL(mtev_error, "Websocket client got unsupported extensions: %s\n", extensions);
+      return mtev_false;
+    }
+    client->deflate = mtev_ws_deflate_new(&agreed, mtev_false, -1);
+    if(eol) *eol = '\r';
+  }
 
   char *res_accept_key = strstr(resheader, "Sec-WebSocket-Accept");
   if(res_accept_key == NULL) {
@@ -286,6 +330,10 @@ abort_drive:
         goto abort_drive;
       }
       wslay_event_context_client_init(&client->wslay_ctx, &wslay_callbacks, client);
+#ifdef HAVE_WSLAY_EVENT_CONFIG_SET_ALLOWED_RSV_BITS
+      if(client->deflate)
+        wslay_event_config_set_allowed_rsv_bits(client->wslay_ctx, WSLAY_RSV1_BIT);
+#endif
       client->did_handshake = mtev_true;
       if(client->ready_callback) {
         if(!client->ready_callback(client, client->closure)) goto abort_drive;
@@ -312,6 +360,10 @@ abort_drive:
     goto abort_drive;
   }
 
+  if (!mtev_websocket_client_flush(client)) {
+    goto abort_drive;
+  }
+
   return client->wanted_eventer_mask | EVENTER_EXCEPTION | EVENTER_WRITE;
   return 0;
 }
@@ -475,18 +527,19 @@ mtev_boolean
 mtev_websocket_client_send(mtev_websocket_client_t *client, int opcode,
                            void *msg, size_t msg_len) {
 #ifdef HAVE_WSLAY
-  int rv;
+  struct bchain *frame;
+  mtev_ws_deflate_t *d = NULL;
   pthread_mutex_lock(&client->lock);
-  if (client->wslay_ctx == NULL) {
+  if (client->wslay_ctx == NULL || client->closed) {
     pthread_mutex_unlock(&client->lock);
     return mtev_false;
   }
-  struct wslay_event_msg msgarg = {
-    opcode, msg, msg_len
-  };
-  rv = wslay_event_queue_msg(client->wslay_ctx, &msgarg);
+  if (client->deflate && msg_len >= WS_CLIENT_DEFLATE_MIN_SIZE) d = client->deflate;
+  /* client frames are masked in place as they are built */
+  frame = mtev_ws_frame_build(opcode, d, mtev_true, msg, msg_len);
+  if (frame) mtev_ws_outq_push(&client->outq, frame);
   pthread_mutex_unlock(&client->lock);
-  return rv ? mtev_false : mtev_true;
+  return frame ? mtev_true : mtev_false;
 #else
   return mtev_false;
 #endif
@@ -505,6 +558,9 @@ mtev_websocket_client_cleanup(mtev_websocket_client_t *client) {
     eventer_free(client->e);
     if(client->did_handshake)
       wslay_event_context_free(client->wslay_ctx);
+    mtev_ws_outq_clear(&client->outq);
+    mtev_ws_deflate_free(client->deflate);
+    client->deflate = NULL;
     free((void *)client->path);
     free((void *)client->service);
     free((void *)client->host);
@@ -0,0 +1,473 @@
+/*
+ * Copyright (c) 2017, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name Circonus, Inc. nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "mtev_defines.h"
+#include "mtev_websocket_frame.h"
+#include "mtev_log.h"
+
+#include <errno.h>
+#include <ctype.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <zlib.h>
+
+#define WS_INFLATE_MAX (64 * 1024 * 1024)
+#define WS_OUTQ_IOV 64
+#define WS_SMALL_BCHAIN 4096
+
+struct mtev_ws_deflate {
+  mtev_boolean is_server;
+  mtev_boolean reset_deflate;
+  mtev_boolean reset_inflate;
+  int deflate_bits;
+  mtev_boolean deflate_init;
+  mtev_boolean inflate_init;
+  int level;
+  z_stream zd;
+  z_stream zi;
+};
+
+struct mtev_ws_outq_entry {
+  mtev_ws_outq_entry_t *next;
+  struct bchain *b;
+  mtev_http_websocket_msg_t *shared;
+  size_t off;
+};
+
+/* permessage-deflate negotiation */
+
+static const char *
+skip_ws(const char *cp) {
+  while(*cp == ' ' || *cp == '\t') cp++;
+  return cp;
+}
+
+/* Parse one extension offer (up to ',' or end).  Returns the position
+ * after it, or NULL at the end of input. */
+static const char *
+parse_offer(const char *cp, mtev_boolean *is_pmd, mtev_boolean *valid,
+            mtev_ws_deflate_params_t *p) {
+  const char *tok;
+  size_t toklen;
+
+  memset(p, 0, sizeof(*p));
+  p->server_max_window_bits = p->client_max_window_bits = 15;
+  *valid = mtev_true;
+  cp = skip_ws(cp);
+  if(!*cp) return NULL;
+  tok = cp;
+  while(*cp && *cp != ';' && *cp != ',' && *cp != ' ' && *cp != '\t') cp++;
+  toklen = cp - tok;
+  *is_pmd = (toklen == strlen("permessage-deflate") &&
+             !strncasecmp(tok, "permessage-deflate", toklen));
+  while(*cp && *cp != ',') {
+    char name[32], value[8];
+    size_t nlen = 0, vlen = 0;
+    cp = skip_ws(cp);
+    if(*cp == ';') cp = skip_ws(cp + 1);
+    while(*cp && *cp != '=' && *cp != ';' && *cp != ',' &&
+          *cp != ' ' && *cp != '\t') {
+      if(nlen < sizeof(name) - 1) name[nlen++] = tolower(*cp);
+      cp++;
+    }
+    name[nlen] = '\0';
+    cp = skip_ws(cp);
+    value[0] = '\0';
+    if(*cp == '=') {
+      cp = skip_ws(cp + 1);
+      if(*cp == '"') cp++;
+      while(*cp && *cp != ';' && *cp != ',' && *cp != '"' &&
+            *cp != ' ' && *cp != '\t') {
+        if(vlen < sizeof(value) - 1) value[vlen++] = *cp;
+        cp++;
+      }
+      value[vlen] = '\0';
+      if(*cp == '"') cp++;
+    }
+    if(!nlen) continue;
+    if(!strcmp(name, "server_no_context_takeover"))
+      p->server_no_context_takeover = mtev_true;
+    else if(!strcmp(name, "client_no_context_takeover"))
+      p->client_no_context_takeover = mtev_true;
+    else if(!strcmp(name, "server_max_window_bits") ||
+            !strcmp(name, "client_max_window_bits")) {
+      int bits = value[0] ? atoi(value) : 15;
+      if(bits < 8 || bits > 15) *valid = mtev_false;
+      if(name[0] == 's') p->server_max_window_bits = bits;
+      else p->client_max_window_bits = bits;
+    }
+    else *valid = mtev_false;
+  }
+  if(*cp == ',') cp++;
+  return cp;
+}
+
+mtev_boolean
+mtev_ws_deflate_negotiate(const char *offers,
+                          const mtev_ws_deflate_params_t *limits,
+                          mtev_ws_deflate_params_t *agreed) {
+  const char *cp = offers;
+  while(cp) {
+    mtev_boolean is_pmd, valid;
+    mtev_ws_deflate_params_t p;
+    cp = parse_offer(cp, &is_pmd, &valid, &p);
+    if(!cp || !is_pmd || !valid) continue;
+    /* zlib cannot produce an 8 bit window, 9 is the floor */
+    if(p.server_max_window_bits < 9) continue;
+    agreed->server_no_context_takeover =
+      p.server_no_context_takeover || limits->server_no_context_takeover;
+    agreed->client_no_context_takeover =
+      p.client_no_context_takeover || limits->client_no_context_takeover;
+    agreed->server_max_window_bits =
+      MIN(p.server_max_window_bits, limits->server_max_window_bits);
+    /* we inflate with a full window, so the client may use any size */
+    agreed->client_max_window_bits = p.client_max_window_bits;
+    return mtev_true;
+  }
+  return mtev_false;
+}
+
+mtev_boolean
+mtev_ws_deflate_parse_response(const char *header,
+                               mtev_ws_deflate_params_t *agreed) {
+  mtev_boolean is_pmd, valid;
+  if(!header) return mtev_false;
+  if(!parse_offer(header, &is_pmd, &valid, agreed)) return mtev_false;
+  if(!is_pmd || !valid) return mtev_false;
+  if(agreed->client_max_window_bits < 9) return mtev_false;
+  return mtev_true;
+}
+
+void
+mtev_ws_deflate_params_format(const mtev_ws_deflate_params_t *params,
+                              char *buf, size_t len) {
+  size_t off;
+  off = strlcpy(buf, "permessage-deflate", len);
+  if(params->server_no_context_takeover && off < len)
+    off += snprintf(buf + off, len - off, "; server_no_context_takeover");
+  if(params->client_no_context_takeover && off < len)
+    off += snprintf(buf + off, len - off, "; client_no_context_takeover");
+  if(params->server_max_window_bits < 15 && off < len)
+    off += snprintf(buf + off, len - off, "; server_max_window_bits=%d",
+                    params->server_max_window_bits);
+}
+
+/* compression state */
+
+mtev_ws_deflate_t *
+mtev_ws_deflate_new(const mtev_ws_deflate_params_t *params,
+                    mtev_boolean is_server, int level) {
+  mtev_ws_deflate_t *d = calloc(1, sizeof(*d));
+  d->is_server = is_server;
+  d->level = (level < 0) ? Z_DEFAULT_COMPRESSION : level;
+  if(is_server) {
+    d->reset_deflate = params->server_no_context_takeover;
+    d->reset_inflate = params->client_no_context_takeover;
+    d->deflate_bits = params->server_max_window_bits;
+  }
+  else {
+    d->reset_deflate = params->client_no_context_takeover;
+    d->reset_inflate = params->server_no_context_takeover;
+    d->deflate_bits = params->client_max_window_bits;
+  }
+  if(d->deflate_bits < 9) d->deflate_bits = 9;
+  if(d->deflate_bits > 15) d->deflate_bits = 15;
+  return d;
+}
+
+void
+mtev_ws_deflate_free(mtev_ws_deflate_t *d) {
+  if(!d) return;
+  if(d->deflate_init) deflateEnd(&d->zd);
+  if(d->inflate_init) inflateEnd(&d->zi);
+  free(d);
+}
+
+int
+mtev_ws_deflate_window_bits(mtev_ws_deflate_t *d) {
+  return d->deflate_bits;
+}
+
+mtev_boolean
+mtev_ws_deflate_stateless(mtev_ws_deflate_t *d) {
+  return d->reset_deflate;
+}
+
+int
+mtev_ws_deflate_inflate(mtev_ws_deflate_t *d, const unsigned char *in,
+                        size_t len, unsigned char **out, size_t *outlen) {
+  static const unsigned char tail[4] = { 0x00, 0x00, 0xff, 0xff };
+  unsigned char *buf;
+  size_t allocd, used = 0;
+  int pass, rv = Z_OK;
+
+  if(!d->inflate_init) {
+    if(inflateInit2(&d->zi, -15) != Z_OK) return -1;
+    d->inflate_init = mtev_true;
+  }
+  allocd = MAX(len * 4, 1024);
+  buf = malloc(allocd);
+  if(!buf) return -1;
+  /* the sender strips the trailing empty stored block, put it back */
+  for(pass = 0; pass < 2; pass++) {
+    d->zi.next_in = (Bytef *)(pass ? tail : in);
+    d->zi.avail_in = pass ? sizeof(tail) : len;
+    while(d->zi.avail_in > 0) {
+      if(allocd - used < 1024) {
+        unsigned char *newbuf;
+        if(allocd * 2 > WS_INFLATE_MAX) goto fail;
+        newbuf = realloc(buf, allocd * 2);
+        if(!newbuf) goto fail;
+        buf = newbuf;
+        allocd *= 2;
+      }
+      d->zi.next_out = buf + used;
+      d->zi.avail_out = allocd - used;
+      rv = inflate(&d->zi, Z_SYNC_FLUSH);
+      used = allocd - d->zi.avail_out;
+      if(rv == Z_BUF_ERROR && d->zi.avail_out > 0) break;
+      if(rv != Z_OK && rv != Z_STREAM_END && rv != Z_BUF_ERROR) goto fail;
+      if(rv == Z_STREAM_END) break;
+    }
+  }
+  if(d->reset_inflate || rv == Z_STREAM_END) inflateReset(&d->zi);
+  *out = buf;
+  *outlen = used;
+  return 0;
+
+ fail:
+  free(buf);
+  inflateReset(&d->zi);
+  return -1;
+}
+
+/* Compress payload into b starting at b->start + b->size */
+static int
+ws_deflate_into(mtev_ws_deflate_t *d, struct bchain **bp,
+                const unsigned char *payload, size_t len) {
+  struct bchain *b = *bp;
+  if(!d->deflate_init) {
+    if(deflateInit2(&d->zd, d->level, Z_DEFLATED, -d->deflate_bits,
+                    8, Z_DEFAULT_STRATEGY) != Z_OK) return -1;
+    d->deflate_init = mtev_true;
+  }
+  d->zd.next_in = (Bytef *)payload;
+  d->zd.avail_in = len;
+  while(1) {
+    size_t pos = b->start + b->size;
+    int rv;
+    d->zd.next_out = (Bytef *)b->buff + pos;
+    d->zd.avail_out = b->allocd - pos;
+    rv = deflate(&d->zd, Z_SYNC_FLUSH);
+    b->size = (b->allocd - d->zd.avail_out) - b->start;
+    if(rv != Z_OK && rv != Z_BUF_ERROR) return -1;
+    if(d->zd.avail_in == 0 && d->zd.avail_out > 0) break;
+    {
+      /* out of room; grow */
+      struct bchain *nb = bchain_alloc(b->allocd * 2, __LINE__);
+      if(!nb) return -1;
+      memcpy(nb->buff, b->buff, b->start + b->size);
+      nb->start = b->start;
+      nb->size = b->size;
+      bchain_free(b, __LINE__);
+      *bp = b = nb;
+    }
+  }
+  /* a sync flush ends with 00 00 ff ff, which the wire format omits */
+  if(b->size >= 4 &&
+     !memcmp(b->buff + b->start + b->size - 4, "\x00\x00\xff\xff", 4))
+    b->size -= 4;
+  if(d->reset_deflate) deflateReset(&d->zd);
+  return 0;
+}
+
+/* frames */
+
+struct bchain *
+mtev_ws_frame_build(int opcode, mtev_ws_deflate_t *d, mtev_boolean mask,
+                    const unsigned char *payload, size_t len) {
+  struct bchain *b;
+  unsigned char hdr[MTEV_WS_FRAME_HEADER_MAX], *cp;
+  size_t hlen = 2, plen, i;
+  uint8_t mkey[4];
+
+  /* leave room for the largest header in front; the header is written
+   * right-aligned against the payload once we know its final length */
+  b = bchain_alloc(MTEV_WS_FRAME_HEADER_MAX +
+                   (d ? len + len / 1000 + 64 : len), __LINE__);
+  if(!b) return NULL;
+  b->start = MTEV_WS_FRAME_HEADER_MAX;
+  b->size = 0;
+  if(d) {
+    if(ws_deflate_into(d, &b, payload, len) != 0) {
+      bchain_free(b, __LINE__);
+      return NULL;
+    }
+  }
+  else {
+    memcpy(b->buff + b->start, payload, len);
+    b->size = len;
+  }
+  plen = b->size;
+
+  hdr[0] = 0x80 | (opcode & 0x0f) | (d ? 0x40 : 0);
+  if(plen < 126) hdr[1] = plen;
+  else if(plen <= 0xffff) {
+    hdr[1] = 126;
+    hdr[2] = plen >> 8;
+    hdr[3] = plen & 0xff;
+    hlen = 4;
+  }
+  else {
+    hdr[1] = 127;
+    for(i = 0; i < 8; i++) hdr[2 + i] = (uint64_t)plen >> (56 - 8 * i);
+    hlen = 10;
+  }
+  if(mask) {
+    hdr[1] |= 0x80;
+    for(i = 0; i < 4; i++) mkey[i] = hdr[hlen + i] = lrand48();
+    hlen += 4;
+    cp = (unsigned char *)b->buff + b->start;
+    for(i = 0; i < plen; i++) cp[i] ^= mkey[i & 3];
+  }
+  b->start -= hlen;
+  b->size += hlen;
+  memcpy(b->buff + b->start, hdr, hlen);
+  return b;
+}
+
+/* output queue */
+
+static void
+outq_add(mtev_ws_outq_t *q, mtev_ws_outq_entry_t *ent) {
+  if(q->tail) q->tail->next = ent;
+  else q->head = ent;
+  q->tail = ent;
+  q->bytes += ent->b->size;
+}
+
+void
+mtev_ws_outq_push(mtev_ws_outq_t *q, struct bchain *b) {
+  mtev_ws_outq_entry_t *ent = calloc(1, sizeof(*ent));
+  ent->b = b;
+  outq_add(q, ent);
+}
+
+void
+mtev_ws_outq_push_shared(mtev_ws_outq_t *q, struct bchain *b,
+                         mtev_http_websocket_msg_t *m) {
+  mtev_ws_outq_entry_t *ent = calloc(1, sizeof(*ent));
+  ent->b = b;
+  ent->shared = m;
+  mtev_http_websocket_msg_ref(m);
+  outq_add(q, ent);
+}
+
+void
+mtev_ws_outq_append(mtev_ws_outq_t *q, const void *data, size_t len) {
+  mtev_ws_outq_entry_t *tail = q->tail;
+  struct bchain *b;
+  if(tail && !tail->shared &&
+     tail->b->allocd - (tail->b->start + tail->b->size) >= len) {
+    memcpy(tail->b->buff + tail->b->start + tail->b->size, data, len);
+    tail->b->size += len;
+    q->bytes += len;
+    return;
+  }
+  b = bchain_alloc(MAX(len, WS_SMALL_BCHAIN), __LINE__);
+  memcpy(b->buff, data, len);
+  b->size = len;
+  mtev_ws_outq_push(q, b);
+}
+
+static void
+outq_entry_free(mtev_ws_outq_entry_t *ent) {
+  if(ent->shared) mtev_http_websocket_msg_release(ent->shared);
+  else bchain_free(ent->b, __LINE__);
+  free(ent);
+}
+
+/* drop len written bytes from the front of the queue */
+static void
+outq_consume(mtev_ws_outq_t *q, size_t len) {
+  q->bytes -= len;
+  while(len > 0 && q->head) {
+    mtev_ws_outq_entry_t *ent = q->head;
+    size_t avail = ent->b->size - ent->off;
+    if(len < avail) {
+      ent->off += len;
+      return;
+    }
+    len -= avail;
+    q->head = ent->next;
+    if(!q->head) q->tail = NULL;
+    outq_entry_free(ent);
+  }
+}
+
+int
+mtev_ws_outq_flush(mtev_ws_outq_t *q, eventer_t e, int *mask) {
+  while(q->head) {
+    ssize_t len;
+    if(e->opset == eventer_POSIX_fd_opset) {
+      /* plain sockets get everything we have in one system call */
+      struct iovec iov[WS_OUTQ_IOV];
+      mtev_ws_outq_entry_t *ent;
+      int cnt = 0;
+      for(ent = q->head; ent && cnt < WS_OUTQ_IOV; ent = ent->next) {
+        iov[cnt].iov_base = ent->b->buff + ent->b->start + ent->off;
+        iov[cnt].iov_len = ent->b->size - ent->off;
+        cnt++;
+      }
+      while((len = writev(e->fd, iov, cnt)) == -1 && errno == EINTR);
+      if(len == -1 && errno == EAGAIN) *mask = EVENTER_WRITE | EVENTER_EXCEPTION;
+    }
+    else {
+      mtev_ws_outq_entry_t *ent = q->head;
+      while((len = e->opset->write(e->fd, ent->b->buff + ent->b->start + ent->off,
+                                   ent->b->size - ent->off, mask, e)) == -1 &&
+            errno == EINTR);
+    }
+    if(len < 0) return -1;
+    outq_consume(q, len);
+  }
+  return 0;
+}
+
+void
+mtev_ws_outq_clear(mtev_ws_outq_t *q) {
+  while(q->head) {
+    mtev_ws_outq_entry_t *ent = q->head;
+    q->head = ent->next;
+    outq_entry_free(ent);
+  }
+  q->tail = NULL;
+  q->bytes = 0;
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2017, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name Circonus, Inc. nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef MTEV_WEBSOCKET_FRAME_H
+#define MTEV_WEBSOCKET_FRAME_H
+
+/* Internal helpers shared by the websocket server (mtev_http.c) and
+ * client (mtev_websocket_client.c): RFC 7692 permessage-deflate, frame
+ * construction directly into bchains, and a write queue that goes out
+ * with writev(2).
+ */
+
+#include "mtev_defines.h"
+#include "mtev_http.h"
+#include "eventer/eventer.h"
+
+#define MTEV_WS_FRAME_HEADER_MAX 14
+
+typedef struct {
+  mtev_boolean server_no_context_takeover;
+  mtev_boolean client_no_context_takeover;
+  int server_max_window_bits;
+  int client_max_window_bits;
+} mtev_ws_deflate_params_t;
+
+typedef struct mtev_ws_deflate mtev_ws_deflate_t;
+
+/* Pick the first acceptable permessage-deflate offer from a
+ * Sec-WebSocket-Extensions request header.  limits carries the server's
+ * preferences; the result is what was agreed. */
+mtev_boolean mtev_ws_deflate_negotiate(const char *offers,
+                                       const mtev_ws_deflate_params_t *limits,
+                                       mtev_ws_deflate_params_t *agreed);
+/* Parse a server's Sec-WebSocket-Extensions response (client side) */
+mtev_boolean mtev_ws_deflate_parse_response(const char *header,
+                                            mtev_ws_deflate_params_t *agreed);
+void mtev_ws_deflate_params_format(const mtev_ws_deflate_params_t *params,
+                                   char *buf, size_t len);
+
+mtev_ws_deflate_t *mtev_ws_deflate_new(const mtev_ws_deflate_params_t *params,
+                                       mtev_boolean is_server, int level);
+void mtev_ws_deflate_free(mtev_ws_deflate_t *d);
+/* the window our side compresses with */
+int mtev_ws_deflate_window_bits(mtev_ws_deflate_t *d);
+/* true if the compressor is reset after each message, so output can be
+ * shared across connections with the same window size */
+mtev_boolean mtev_ws_deflate_stateless(mtev_ws_deflate_t *d);
+/* inflate a received message; *out is malloc'd */
+int mtev_ws_deflate_inflate(mtev_ws_deflate_t *d, const unsigned char *in,
+                            size_t len, unsigned char **out, size_t *outlen);
+
+/* Build a single (FIN) frame.  mask is NULL for server frames.  If d is
+ * non-NULL the payload is compressed and RSV1 is set. */
+struct bchain *mtev_ws_frame_build(int opcode, mtev_ws_deflate_t *d,
+                                   mtev_boolean mask,
+                                   const unsigned char *payload, size_t len);
+
+typedef struct mtev_ws_outq_entry mtev_ws_outq_entry_t;
+typedef struct {
+  mtev_ws_outq_entry_t *head, *tail;
+  size_t bytes;
+} mtev_ws_outq_t;
+
+/* Ownership of b passes to the queue */
+void mtev_ws_outq_push(mtev_ws_outq_t *q, struct bchain *b);
+/* Borrow b; the queue holds a reference on m until b is written */
+void mtev_ws_outq_push_shared(mtev_ws_outq_t *q, struct bchain *b,
+                              mtev_http_websocket_msg_t *m);
+/* Copy raw bytes in, appending to the tail buffer when there is room */
+void mtev_ws_outq_append(mtev_ws_outq_t *q, const void *data, size_t len);
+/* 0 when drained, -1 with errno EAGAIN (and *mask set) when the socket is
+ * full, -1 on error */
+int mtev_ws_outq_flush(mtev_ws_outq_t *q, eventer_t e, int *mask);
+void mtev_ws_outq_clear(mtev_ws_outq_t *q);
+
+/* shared messages (mtev_http.c) */
+void mtev_http_websocket_msg_ref(mtev_http_websocket_msg_t *m);
+
+#endif
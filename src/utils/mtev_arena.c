@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2017, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name Circonus, Inc. nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "mtev_arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_DEFAULT_CHUNK 4096
+#define ARENA_MAX_RETAINED (1024 * 1024)
+#define ARENA_ALIGN 16
+
+struct arena_chunk {
+  struct arena_chunk *next;
+  size_t size;
+  size_t used;
+  /* keep the data area aligned */
+  char pad[ARENA_ALIGN - (3 * sizeof(size_t)) % ARENA_ALIGN];
+  char data[];
+};
+
+struct mtev_arena {
+  struct arena_chunk *current;
+  struct arena_chunk *full;     /* exhausted and oversized chunks */
+  size_t chunk_size;
+  size_t used;
+  size_t high_water;
+  size_t chunk_allocs;
+};
+
+#define ALIGN_UP(x) (((x) + (ARENA_ALIGN - 1)) & ~((size_t)ARENA_ALIGN - 1))
+
+static struct arena_chunk *
+arena_chunk_new(mtev_arena_t *arena, size_t size) {
+  struct arena_chunk *c = malloc(sizeof(*c) + size);
+  if(!c) return NULL;
+  c->next = NULL;
+  c->size = size;
+  c->used = 0;
+  arena->chunk_allocs++;
+  return c;
+}
+
+static void
+arena_chunk_list_free(struct arena_chunk *c) {
+  while(c) {
+    struct arena_chunk *next = c->next;
+    free(c);
+    c = next;
+  }
+}
+
+mtev_arena_t *
+mtev_arena_create(size_t chunk_size) {
+  mtev_arena_t *arena = calloc(1, sizeof(*arena));
+  if(!arena) return NULL;
+  arena->chunk_size = chunk_size ? ALIGN_UP(chunk_size) : ARENA_DEFAULT_CHUNK;
+  return arena;
+}
+
+void
+mtev_arena_destroy(mtev_arena_t *arena) {
+  if(!arena) return;
+  arena_chunk_list_free(arena->current);
+  arena_chunk_list_free(arena->full);
+  free(arena);
+}
+
+void
+mtev_arena_reset(mtev_arena_t *arena) {
+  if(arena->full) {
+    /* We spilled last time; replace everything with one chunk that would
+     * have been big enough (within reason). */
+    size_t want = arena->chunk_size;
+    while(want < arena->used && want < ARENA_MAX_RETAINED) want <<= 1;
+    arena_chunk_list_free(arena->full);
+    arena->full = NULL;
+    if(arena->current && arena->current->size < want) {
+      free(arena->current);
+      arena->current = arena_chunk_new(arena, want);
+    }
+  }
+  if(arena->current) arena->current->used = 0;
+  arena->used = 0;
+}
+
+void *
+mtev_arena_alloc(mtev_arena_t *arena, size_t size) {
+  struct arena_chunk *c = arena->current;
+  void *ptr;
+  size = ALIGN_UP(size ? size : 1);
+  if(!c || c->size - c->used < size) {
+    size_t csize = arena->chunk_size;
+    if(c) {
+      /* grow geometrically */
+      csize = c->size < ARENA_MAX_RETAINED ? c->size * 2 : c->size;
+      if(c->size - c->used >= size / 2 && size > csize / 4) {
+        /* big request and the current chunk still has useful space:
+         * give it a chunk of its own and keep filling the current one. */
+        struct arena_chunk *big = arena_chunk_new(arena, size);
+        if(!big) return NULL;
+        big->used = size;
+        big->next = arena->full;
+        arena->full = big;
+        arena->used += size;
+        if(arena->used > arena->high_water) arena->high_water = arena->used;
+        return big->data;
+      }
+    }
+    if(csize < size) csize = size;
+    c = arena_chunk_new(arena, csize);
+    if(!c) return NULL;
+    if(arena->current) {
+      arena->current->next = arena->full;
+      arena->full = arena->current;
+    }
+    arena->current = c;
+  }
+  ptr = c->data + c->used;
+  c->used += size;
+  arena->used += size;
+  if(arena->used > arena->high_water) arena->high_water = arena->used;
+  return ptr;
+}
+
+void *
+mtev_arena_calloc(mtev_arena_t *arena, size_t nmemb, size_t size) {
+  size_t len = nmemb * size;
+  void *ptr;
+  if(nmemb && len / nmemb != size) return NULL;
+  ptr = mtev_arena_alloc(arena, len);
+  if(ptr) memset(ptr, 0, len);
+  return ptr;
+}
+
+void *
+mtev_arena_memdup(mtev_arena_t *arena, const void *src, size_t len) {
+  void *ptr = mtev_arena_alloc(arena, len);
+  if(ptr) memcpy(ptr, src, len);
+  return ptr;
+}
+
+char *
+mtev_arena_strndup(mtev_arena_t *arena, const char *src, size_t len) {
+  char *ptr;
+  const char *end = memchr(src, '\0', len);
+  if(end) len = end - src;
+  ptr = mtev_arena_alloc(arena, len + 1);
+  if(ptr) {
+    memcpy(ptr, src, len);
+    ptr[len] = '\0';
+  }
+  return ptr;
+}
+
+char *
+mtev_arena_strdup(mtev_arena_t *arena, const char *src) {
+  return mtev_arena_strndup(arena, src, strlen(src));
+}
+
+char *
+mtev_arena_vsprintf(mtev_arena_t *arena, const char *fmt, va_list ap) {
+  struct arena_chunk *c = arena->current;
+  char *ptr;
+  int len;
+  va_list copy;
+
+  /* optimistically format into the remaining space of the current chunk */
+  va_copy(copy, ap);
+  if(c && c->size > c->used) {
+    len = vsnprintf(c->data + c->used, c->size - c->used, fmt, copy);
+    va_end(copy);
+    if(len < 0) return NULL;
+    if((size_t)len < c->size - c->used) return mtev_arena_alloc(arena, len + 1);
+  }
+  else {
+    len = vsnprintf(NULL, 0, fmt, copy);
+    va_end(copy);
+    if(len < 0) return NULL;
+  }
+  ptr = mtev_arena_alloc(arena, len + 1);
+  if(ptr) vsnprintf(ptr, len + 1, fmt, ap);
+  return ptr;
+}
+
+char *
+mtev_arena_sprintf(mtev_arena_t *arena, const char *fmt, ...) {
+  char *ptr;
+  va_list ap;
+  va_start(ap, fmt);
+  ptr = mtev_arena_vsprintf(arena, fmt, ap);
+  va_end(ap);
+  return ptr;
+}
+
+size_t
+mtev_arena_used(mtev_arena_t *arena) {
+  return arena->used;
+}
+
+size_t
+mtev_arena_high_water(mtev_arena_t *arena) {
+  return arena->high_water;
+}
+
+size_t
+mtev_arena_chunk_allocs(mtev_arena_t *arena) {
+  return arena->chunk_allocs;
+}
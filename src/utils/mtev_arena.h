@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2017, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name Circonus, Inc. nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef MTEV_ARENA_H
+#define MTEV_ARENA_H
+
+#include <mtev_defines.h>
+#include <stdarg.h>
+
+/* A bump-pointer arena for short-lived allocations.
+ *
+ * Memory is carved from chunks that grow as needed and is never freed
+ * individually; everything goes at once on mtev_arena_reset or
+ * mtev_arena_destroy.  A reset keeps a single chunk sized to what the
+ * arena needed last time, so an arena reused across requests settles
+ * into making no allocations at all.
+ *
+ * Arenas are not thread-safe.
+ */
+typedef struct mtev_arena mtev_arena_t;
+
+/*! \fn mtev_arena_t *mtev_arena_create(size_t chunk_size)
+    \brief Create a new arena.
+    \param chunk_size the initial chunk size, 0 for a default of 4k.
+    \return a new arena
+ */
+API_EXPORT(mtev_arena_t *)
+  mtev_arena_create(size_t chunk_size);
+
+/*! \fn void mtev_arena_destroy(mtev_arena_t *arena)
+    \brief Free an arena and all memory allocated from it.
+    \param arena the arena to destroy, may be NULL
+ */
+API_EXPORT(void)
+  mtev_arena_destroy(mtev_arena_t *arena);
+
+/*! \fn void mtev_arena_reset(mtev_arena_t *arena)
+    \brief Release all allocations made from the arena.
+    \param arena the arena to reset
+
+    All pointers previously returned from the arena become invalid.
+ */
+API_EXPORT(void)
+  mtev_arena_reset(mtev_arena_t *arena);
+
+/*! \fn void *mtev_arena_alloc(mtev_arena_t *arena, size_t size)
+    \brief Allocate memory from an arena.
+    \param arena the arena to allocate from
+    \param size the number of bytes required
+    \return memory aligned suitably for any type, NULL on failure
+ */
+API_EXPORT(void *)
+  mtev_arena_alloc(mtev_arena_t *arena, size_t size);
+
+/*! \fn void *mtev_arena_calloc(mtev_arena_t *arena, size_t nmemb, size_t size)
+    \brief Allocate zeroed memory from an arena.
+    \param arena the arena to allocate from
+    \param nmemb the number of elements
+    \param size the size of each element
+    \return zeroed memory, NULL on failure or overflow
+ */
+API_EXPORT(void *)
+  mtev_arena_calloc(mtev_arena_t *arena, size_t nmemb, size_t size);
+
+/*! \fn void *mtev_arena_memdup(mtev_arena_t *arena, const void *src, size_t len)
+    \brief Copy a buffer into an arena.
+    \param arena the arena to allocate from
+    \param src the data to copy
+    \param len the length of src
+    \return the copy, NULL on failure
+ */
+API_EXPORT(void *)
+  mtev_arena_memdup(mtev_arena_t *arena, const void *src, size_t len);
+
+/*! \fn char *mtev_arena_strndup(mtev_arena_t *arena, const char *src, size_t len)
+    \brief Copy up to len bytes of a string into an arena, NUL terminated.
+    \param arena the arena to allocate from
+    \param src the string to copy
+    \param len the maximum number of bytes to copy
+    \return the copy, NULL on failure
+ */
+API_EXPORT(char *)
+  mtev_arena_strndup(mtev_arena_t *arena, const char *src, size_t len);
+
+/*! \fn char *mtev_arena_strdup(mtev_arena_t *arena, const char *src)
+    \brief Copy a string into an arena.
+    \param arena the arena to allocate from
+    \param src the string to copy
+    \return the copy, NULL on failure
+ */
+API_EXPORT(char *)
+  mtev_arena_strdup(mtev_arena_t *arena, const char *src);
+
+/*! \fn char *mtev_arena_sprintf(mtev_arena_t *arena, const char *fmt, ...)
+    \brief Format a string into an arena.
+    \param arena the arena to allocate from
+    \param fmt a printf style format string
+    \return the formatted string, NULL on failure
+ */
+API_EXPORT(char *)
+  mtev_arena_sprintf(mtev_arena_t *arena, const char *fmt, ...)
+  __attribute__((format (printf, 2, 3)));
+
+/*! \fn char *mtev_arena_vsprintf(mtev_arena_t *arena, const char *fmt, va_list ap)
+    \brief Format a string into an arena.
+    \param arena the arena to allocate from
+    \param fmt a printf style format string
+    \param ap the format arguments
+    \return the formatted string, NULL on failure
+ */
+API_EXPORT(char *)
+  mtev_arena_vsprintf(mtev_arena_t *arena, const char *fmt, va_list ap);
+
+/*! \fn size_t mtev_arena_used(mtev_arena_t *arena)
+    \brief Report the bytes allocated since the last reset.
+    \param arena the arena
+    \return bytes in use
+ */
+API_EXPORT(size_t)
+  mtev_arena_used(mtev_arena_t *arena);
+
+/*! \fn size_t mtev_arena_high_water(mtev_arena_t *arena)
+    \brief Report the most bytes ever in use between resets.
+    \param arena the arena
+    \return the high-water mark in bytes
+ */
+API_EXPORT(size_t)
+  mtev_arena_high_water(mtev_arena_t *arena);
+
+/*! \fn size_t mtev_arena_chunk_allocs(mtev_arena_t *arena)
+    \brief Report how many times the arena has called malloc.
+    \param arena the arena
+    \return the number of chunk allocations over the arena's lifetime
+ */
+API_EXPORT(size_t)
+  mtev_arena_chunk_allocs(mtev_arena_t *arena);
+
+#endif
@@ -33,7 +33,13 @@
 
 #include "mtev_config.h"
 #include "mtev_b64.h"
-#include <ctype.h>
+#include "mtev_cpuid.h"
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define B64_SIMD 1
+#include <immintrin.h>
+#endif
 
 static const char __b64[] = {
   'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M',
@@ -42,42 +48,462 @@ static const char __b64[] = {
   'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z',
   '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '+', '/', 0x00 };
 
+static const char __b64url[] = {
+  'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M',
+  'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z',
+  'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm',
+  'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z',
+  '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '-', '_', 0x00 };
+
+/* Decode tables: 0-63 are digits, the rest mark special characters.
+ * Every special value has both high bits set so four lookups can be
+ * validated with a single test. */
+#define B64_WS  0xfd
+#define B64_PAD 0xfe
+#define B64_BAD 0xff
+
+static const unsigned char __ub64[] = {
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xfd, 0xfd, 0xfd, 0xfd, 0xfd, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xfd, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+  0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff, 0xff, 0xfe, 0xff, 0xff,
+  0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+  0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+  0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+
+static const unsigned char __ub64url[] = {
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xfd, 0xfd, 0xfd, 0xfd, 0xfd, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xfd, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff,
+  0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff, 0xff, 0xfe, 0xff, 0xff,
+  0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+  0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0x3f,
+  0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+  0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+
+enum { B64_DATA = 0, B64_PADDING, B64_DONE, B64_ERROR };
+
+/* 0: scalar, 1: SSSE3, 2: AVX2 */
+static volatile int b64_simd = -1;
+
+static inline int
+b64_simd_level(void) {
+  int level = b64_simd;
+  if(level < 0) {
+    level = 0;
+#ifdef B64_SIMD
+    if(mtev_cpuid_feature(MTEV_CPU_FEATURE_AVX2)) level = 2;
+    else if(mtev_cpuid_feature(MTEV_CPU_FEATURE_SSSE3)) level = 1;
+#endif
+    b64_simd = level;
+  }
+  return level;
+}
+
+#ifdef B64_SIMD
+/* The vector decoders classify each character by range, turning it into
+ * its 6-bit value with a per-class offset; any lane outside the alphabet
+ * ends the vector loop and leaves that block to the scalar code. The
+ * 6-bit values are then packed four to three bytes with two multiplies. */
+__attribute__((target("ssse3")))
+static size_t
+b64_decode_ssse3(const unsigned char *src, size_t len,
+                 unsigned char *dst, size_t dcap, int url, size_t *used) {
+  const unsigned char *sp = src;
+  unsigned char *dp = dst;
+  const char c62 = url ? '-' : '+', c63 = url ? '_' : '/';
+  const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+                                     -1, -1, -1, -1);
+
+  while(len >= 16 && dcap >= 12) {
+    __m128i in = _mm_loadu_si128((const __m128i *)sp);
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('A' - 1)),
+                                  _mm_cmplt_epi8(in, _mm_set1_epi8('Z' + 1)));
+    __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('a' - 1)),
+                                  _mm_cmplt_epi8(in, _mm_set1_epi8('z' + 1)));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmplt_epi8(in, _mm_set1_epi8('9' + 1)));
+    __m128i is62 = _mm_cmpeq_epi8(in, _mm_set1_epi8(c62));
+    __m128i is63 = _mm_cmpeq_epi8(in, _mm_set1_epi8(c63));
+    __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower),
+                                 _mm_or_si128(digit, _mm_or_si128(is62, is63)));
+    __m128i off, v;
+    uint32_t tail;
+
+    if(_mm_movemask_epi8(valid) != 0xffff) break;
+    off = _mm_and_si128(upper, _mm_set1_epi8(-'A'));
+    off = _mm_or_si128(off, _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+    off = _mm_or_si128(off, _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+    off = _mm_or_si128(off, _mm_and_si128(is62, _mm_set1_epi8(62 - c62)));
+    off = _mm_or_si128(off, _mm_and_si128(is63, _mm_set1_epi8(63 - c63)));
+    v = _mm_add_epi8(in, off);
+    v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+    v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+    v = _mm_shuffle_epi8(v, pack);
+    _mm_storel_epi64((__m128i *)dp, v);
+    tail = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+    memcpy(dp + 8, &tail, 4);
+    sp += 16; len -= 16;
+    dp += 12; dcap -= 12;
+  }
+  *used = sp - src;
+  return dp - dst;
+}
+
+__attribute__((target("avx2")))
+static size_t
+b64_decode_avx2(const unsigned char *src, size_t len,
+                unsigned char *dst, size_t dcap, int url, size_t *used) {
+  const unsigned char *sp = src;
+  unsigned char *dp = dst;
+  const char c62 = url ? '-' : '+', c63 = url ? '_' : '/';
+  const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+                                        -1, -1, -1, -1,
+                                        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+                                        -1, -1, -1, -1);
+  const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+
+  while(len >= 32 && dcap >= 24) {
+    __m256i in = _mm256_loadu_si256((const __m256i *)sp);
+    __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(in, _mm256_set1_epi8('A' - 1)),
+                                     _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), in));
+    __m256i lower = _mm256_and_si256(_mm256_cmpgt_epi8(in, _mm256_set1_epi8('a' - 1)),
+                                     _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), in));
+    __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(in, _mm256_set1_epi8('0' - 1)),
+                                     _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), in));
+    __m256i is62 = _mm256_cmpeq_epi8(in, _mm256_set1_epi8(c62));
+    __m256i is63 = _mm256_cmpeq_epi8(in, _mm256_set1_epi8(c63));
+    __m256i valid = _mm256_or_si256(_mm256_or_si256(upper, lower),
+                                    _mm256_or_si256(digit, _mm256_or_si256(is62, is63)));
+    __m256i off, v;
+
+    if((uint32_t)_mm256_movemask_epi8(valid) != 0xffffffffU) break;
+    off = _mm256_and_si256(upper, _mm256_set1_epi8(-'A'));
+    off = _mm256_or_si256(off, _mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a')));
+    off = _mm256_or_si256(off, _mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')));
+    off = _mm256_or_si256(off, _mm256_and_si256(is62, _mm256_set1_epi8(62 - c62)));
+    off = _mm256_or_si256(off, _mm256_and_si256(is63, _mm256_set1_epi8(63 - c63)));
+    v = _mm256_add_epi8(in, off);
+    v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+    v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+    v = _mm256_shuffle_epi8(v, pack);
+    v = _mm256_permutevar8x32_epi32(v, lanes);
+    _mm_storeu_si128((__m128i *)dp, _mm256_castsi256_si128(v));
+    _mm_storel_epi64((__m128i *)(dp + 16), _mm256_extracti128_si256(v, 1));
+    sp += 32; len -= 32;
+    dp += 24; dcap -= 24;
+  }
+  *used = sp - src;
+  return dp - dst;
+}
+
+/* The vector encoders spread each 3 input bytes over a 32-bit lane,
+ * isolate the four 6-bit indices with shifts done as multiplies, and map
+ * indices to characters by adding an offset looked up by index range. */
+__attribute__((target("ssse3")))
+static inline __m128i
+b64_enc_translate_ssse3(__m128i in, __m128i lut) {
+  __m128i t0, t1, t2, t3, idx, reduced, less;
+
+  in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7,
+                                         4, 5, 3, 4, 1, 2, 0, 1));
+  t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+  t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+  t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+  t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+  idx = _mm_or_si128(t1, t3);
+  reduced = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+  less = _mm_cmpgt_epi8(_mm_set1_epi8(26), idx);
+  reduced = _mm_or_si128(reduced, _mm_and_si128(less, _mm_set1_epi8(13)));
+  return _mm_add_epi8(idx, _mm_shuffle_epi8(lut, reduced));
+}
+
+__attribute__((target("ssse3")))
+static size_t
+b64_encode_ssse3(const unsigned char *src, size_t len, char *dst,
+                 int url, size_t *used) {
+  const unsigned char *sp = src;
+  char *dp = dst;
+  const char c62 = url ? '-' : '+', c63 = url ? '_' : '/';
+  const __m128i lut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                                    '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                    '0' - 52, '0' - 52, '0' - 52, c62 - 62,
+                                    c63 - 63, 'A', 0, 0);
+
+  /* each step reads 16 bytes but consumes only 12 */
+  while(len >= 16) {
+    __m128i in = _mm_loadu_si128((const __m128i *)sp);
+    _mm_storeu_si128((__m128i *)dp, b64_enc_translate_ssse3(in, lut));
+    sp += 12; len -= 12;
+    dp += 16;
+  }
+  *used = sp - src;
+  return dp - dst;
+}
+
+__attribute__((target("avx2")))
+static size_t
+b64_encode_avx2(const unsigned char *src, size_t len, char *dst,
+                int url, size_t *used) {
+  const unsigned char *sp = src;
+  char *dp = dst;
+  const char c62 = url ? '-' : '+', c63 = url ? '_' : '/';
+  const __m256i lut = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                                       '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                       '0' - 52, '0' - 52, '0' - 52, c62 - 62,
+                                       c63 - 63, 'A', 0, 0,
+                                       'a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                                       '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                       '0' - 52, '0' - 52, '0' - 52, c62 - 62,
+                                       c63 - 63, 'A', 0, 0);
+  const __m256i spread = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7,
+                                         4, 5, 3, 4, 1, 2, 0, 1,
+                                         10, 11, 9, 10, 7, 8, 6, 7,
+                                         4, 5, 3, 4, 1, 2, 0, 1);
+
+  /* each step reads 28 bytes (12 in the low lane, 16 in the high lane)
+   * but consumes only 24 */
+  while(len >= 28) {
+    __m256i in = _mm256_inserti128_si256(
+      _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)sp)),
+      _mm_loadu_si128((const __m128i *)(sp + 12)), 1);
+    __m256i t0, t1, t2, t3, idx, reduced, less;
+
+    in = _mm256_shuffle_epi8(in, spread);
+    t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+    t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+    t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+    t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+    idx = _mm256_or_si256(t1, t3);
+    reduced = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+    less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx);
+    reduced = _mm256_or_si256(reduced, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+    _mm256_storeu_si256((__m256i *)dp,
+                        _mm256_add_epi8(idx, _mm256_shuffle_epi8(lut, reduced)));
+    sp += 24; len -= 24;
+    dp += 32;
+  }
+  *used = sp - src;
+  return dp - dst;
+}
+#endif
+
+static size_t
+b64_decode_quads(const unsigned char *src, size_t len,
+                 unsigned char *dst, size_t dcap,
+                 const unsigned char *tbl, size_t *used) {
+  const unsigned char *sp = src;
+  unsigned char *dp = dst;
+
+  while(len >= 4 && dcap >= 3) {
+    uint32_t a = tbl[sp[0]], b = tbl[sp[1]], c = tbl[sp[2]], d = tbl[sp[3]];
+    uint32_t v;
+    if((a | b | c | d) & 0xc0) break;
+    v = (a << 18) | (b << 12) | (c << 6) | d;
+    dp[0] = v >> 16;
+    dp[1] = v >> 8;
+    dp[2] = v;
+    sp += 4; len -= 4;
+    dp += 3; dcap -= 3;
+  }
+  *used = sp - src;
+  return dp - dst;
+}
+
+/* Decode the longest run of whole, unbroken quads at src. */
+static size_t
+b64_decode_fast(const unsigned char *src, size_t len,
+                unsigned char *dst, size_t dcap, int url, size_t *used) {
+  size_t w = 0, u = 0, step;
+#ifdef B64_SIMD
+  int level = b64_simd_level();
+  if(level >= 2) {
+    w += b64_decode_avx2(src, len, dst, dcap, url, &step);
+    u += step;
+  }
+  if(level >= 1) {
+    w += b64_decode_ssse3(src + u, len - u, dst + w, dcap - w, url, &step);
+    u += step;
+  }
+#endif
+  w += b64_decode_quads(src + u, len - u, dst + w, dcap - w,
+                        url ? __ub64url : __ub64, &step);
+  *used = u + step;
+  return w;
+}
+
+/* Encode every whole 3-byte group at src; returns characters written. */
+static size_t
+b64_encode_fast(const unsigned char *src, size_t len, char *dst, int url) {
+  const char *alpha = url ? __b64url : __b64;
+  const unsigned char *bptr;
+  char *eptr;
+  size_t u = 0, w = 0, step;
+#ifdef B64_SIMD
+  int level = b64_simd_level();
+  if(level >= 2) {
+    w += b64_encode_avx2(src, len, dst, url, &step);
+    u += step;
+  }
+  if(level >= 1) {
+    w += b64_encode_ssse3(src + u, len - u, dst + w, url, &step);
+    u += step;
+  }
+#endif
+  bptr = src + u;
+  eptr = dst + w;
+  len -= u;
+  while(len > 2) {
+    *eptr++ = alpha[bptr[0] >> 2];
+    *eptr++ = alpha[((bptr[0] & 0x03) << 4) + (bptr[1] >> 4)];
+    *eptr++ = alpha[((bptr[1] & 0x0f) << 2) + (bptr[2] >> 6)];
+    *eptr++ = alpha[bptr[2] & 0x3f];
+    bptr += 3;
+    len -= 3;
+  }
+  return eptr - dst;
+}
+
+/* Encode a final group of 1 or 2 bytes. */
+static size_t
+b64_encode_tail(const unsigned char *bptr, size_t len, char *eptr,
+                int url, int pad) {
+  const char *alpha = url ? __b64url : __b64;
+  eptr[0] = alpha[bptr[0] >> 2];
+  if(len > 1) {
+    eptr[1] = alpha[((bptr[0] & 0x03) << 4) + (bptr[1] >> 4)];
+    eptr[2] = alpha[(bptr[1] & 0x0f) << 2];
+    if(!pad) return 3;
+    eptr[3] = '=';
+  } else {
+    eptr[1] = alpha[(bptr[0] & 0x03) << 4];
+    if(!pad) return 2;
+    eptr[2] = '=';
+    eptr[3] = '=';
+  }
+  return 4;
+}
+
+/* Write the bytes of a group of n (2-4) digits. */
+static inline void
+b64_emit(const unsigned char *q, int n, unsigned char *dp) {
+  uint32_t v = ((uint32_t)q[0] << 18) | ((uint32_t)q[1] << 12) |
+               (n > 2 ? (uint32_t)q[2] << 6 : 0) | (n > 3 ? q[3] : 0);
+  dp[0] = v >> 16;
+  if(n > 2) dp[1] = v >> 8;
+  if(n > 3) dp[2] = v;
+}
+
+/* Decode as much of src as possible into dst, carrying a partial group in
+ * st.  In strict mode bad input is an error; otherwise decoding simply
+ * stops there.  Returns the number of bytes written or -1. */
+static ssize_t
+b64_decode_run(mtev_b64_stream_t *st, const unsigned char *src, size_t len,
+               unsigned char *dst, size_t dcap, mtev_boolean strict) {
+  const int url = (st->flags & MTEV_B64_URL) != 0;
+  const unsigned char *tbl = url ? __ub64url : __ub64;
+  unsigned char *dp = dst;
+  size_t i = 0, used;
+
+  while(i < len) {
+    unsigned char v;
+    if(st->n == 0 && st->state == B64_DATA) {
+      dp += b64_decode_fast(src + i, len - i, dp, dcap - (dp - dst), url, &used);
+      i += used;
+      if(i >= len) break;
+    }
+    v = tbl[src[i++]];
+    if(v == B64_WS) continue;
+    if(st->state == B64_DATA) {
+      if(v < 64) {
+        st->buf[st->n++] = v;
+        if(st->n < 4) continue;
+        if(dcap - (dp - dst) < 3) goto overflow;
+        b64_emit(st->buf, 4, dp);
+        dp += 3;
+        st->n = 0;
+        continue;
+      }
+      if(v == B64_PAD && st->n >= 2) {
+        if(dcap - (dp - dst) < st->n - 1) goto overflow;
+        b64_emit(st->buf, st->n, dp);
+        dp += st->n - 1;
+        st->n = 0;
+        st->state = B64_PADDING;
+        continue;
+      }
+    }
+    else if(st->state == B64_PADDING && v == B64_PAD) continue;
+    /* a bad character, data after padding, or padding out of place */
+    if(strict || st->state == B64_ERROR) {
+      st->state = B64_ERROR;
+      return -1;
+    }
+    st->state = B64_DONE;
+    break;
+  }
+  return dp - dst;
+
+ overflow:
+  st->state = B64_ERROR;
+  return -1;
+}
+
+/* Flush an unpadded final group. */
+static ssize_t
+b64_decode_tail(mtev_b64_stream_t *st, unsigned char *dst, size_t dcap,
+                mtev_boolean strict) {
+  int n = st->n;
+  if(st->state == B64_ERROR) return -1;
+  st->n = 0;
+  if(n == 0) return 0;
+  if(n == 1) return strict ? -1 : 0;
+  if(dcap < n - 1) return -1;
+  b64_emit(st->buf, n, dst);
+  return n - 1;
+}
+
+static int
+b64_decode_buffer(const char *src, size_t src_len,
+                  unsigned char *dest, size_t dest_len, int flags) {
+  mtev_b64_stream_t st;
+  ssize_t a, b;
+
+  mtev_b64_stream_init(&st, flags);
+  a = b64_decode_run(&st, (const unsigned char *)src, src_len,
+                     dest, dest_len, mtev_false);
+  if(a < 0) return 0;
+  b = b64_decode_tail(&st, dest + a, dest_len - a, mtev_false);
+  if(b < 0) return 0;
+  return a + b;
+}
+
 int
 mtev_b64_decode(const char *src, size_t src_len,
                 unsigned char *dest, size_t dest_len) {
-  const unsigned char *cp = (unsigned char *)src;
-  unsigned char *dcp = dest;
-  unsigned char ch, in[4], out[3];
-  int ib = 0, ob = 3, needed = (((src_len / 4) * 3) - 2);
+  size_t needed = (src_len / 4) * 3;
 
+  /* Historically sized assuming up to two bytes of padding. */
+  needed = (needed >= 2) ? needed - 2 : 0;
   if(dest_len < needed) return 0;
-  while(cp <= ((unsigned char *)src+src_len)) {
-    if((*cp >= 'A') && (*cp <= 'Z')) ch = *cp - 'A';
-    else if((*cp >= 'a') && (*cp <= 'z')) ch = *cp - 'a' + 26;
-    else if((*cp >= '0') && (*cp <= '9')) ch = *cp - '0' + 52;
-    else if(*cp == '+') ch = 62;
-    else if(*cp == '/') ch = 63;
-    else if(*cp == '=') ch = 0xff;
-    else if(isspace((int)*cp)) { cp++; continue; }
-    else break;
-    cp++;
-    if(ch == 0xff) {
-      if(ib == 0) break;
-      if(ib == 1 || ib == 2) ob = 1;
-      else ob = 2;
-      ib = 3;
-    }
-    in[ib++] = ch;
-    if(ib == 4) {
-      out[0] = (in[0] << 2) | ((in[1] & 0x30) >> 4);
-      out[1] = ((in[1] & 0x0f) << 4) | ((in[2] & 0x3c) >> 2);
-      out[2] = ((in[2] & 0x03) << 6) | (in[3] & 0x3f);
-      for(ib = 0; ib < ob; ib++)
-        *dcp++ = out[ib];
-      ib = 0;
-    }
-  }
-  return dcp - (unsigned char *)dest;
+  return b64_decode_buffer(src, src_len, dest, dest_len, 0);
 }
 
 size_t
@@ -88,32 +514,13 @@ mtev_b64_max_decode_len(size_t src_len) {
 int
 mtev_b64_encode(const unsigned char *src, size_t src_len,
                 char *dest, size_t dest_len) {
-  const unsigned char *bptr = src;
-  char *eptr = dest;
-  int len = src_len;
-  int n = (((src_len + 2) / 3) * 4);
+  size_t n = mtev_b64_encode_len(src_len), w;
 
   if(dest_len < n) return 0;
 
-  while(len > 2) {
-    *eptr++ = __b64[bptr[0] >> 2];
-    *eptr++ = __b64[((bptr[0] & 0x03) << 4) + (bptr[1] >> 4)];
-    *eptr++ = __b64[((bptr[1] & 0x0f) << 2) + (bptr[2] >> 6)];
-    *eptr++ = __b64[bptr[2] & 0x3f];
-    bptr += 3;
-    len -= 3;
-  }
-  if(len != 0) {
-    *eptr++ = __b64[bptr[0] >> 2];
-    if(len > 1) {
-      *eptr++ = __b64[((bptr[0] & 0x03) << 4) + (bptr[1] >> 4)];
-      *eptr++ = __b64[(bptr[1] & 0x0f) << 2];
-      *eptr = '=';
-    } else {
-      *eptr++ = __b64[(bptr[0] & 0x03) << 4];
-      *eptr++ = '=';
-      *eptr = '=';
-    }
+  w = b64_encode_fast(src, src_len, dest, 0);
+  if(src_len % 3) {
+    b64_encode_tail(src + (src_len - src_len % 3), src_len % 3, dest + w, 0, 1);
   }
   return n;
 }
@@ -122,3 +529,95 @@ size_t
 mtev_b64_encode_len(size_t src_len) {
   return 4 * ((src_len+2)/3);
 }
+
+int
+mtev_b64url_decode(const char *src, size_t src_len,
+                   unsigned char *dest, size_t dest_len) {
+  return b64_decode_buffer(src, src_len, dest, dest_len, MTEV_B64_URL);
+}
+
+size_t
+mtev_b64url_max_decode_len(size_t src_len) {
+  return (src_len / 4) * 3 + ((src_len % 4) * 3) / 4;
+}
+
+int
+mtev_b64url_encode(const unsigned char *src, size_t src_len,
+                   char *dest, size_t dest_len) {
+  size_t n = mtev_b64url_encode_len(src_len), w;
+
+  if(dest_len < n) return 0;
+
+  w = b64_encode_fast(src, src_len, dest, 1);
+  if(src_len % 3) {
+    b64_encode_tail(src + (src_len - src_len % 3), src_len % 3, dest + w, 1, 0);
+  }
+  return n;
+}
+
+size_t
+mtev_b64url_encode_len(size_t src_len) {
+  return (src_len / 3) * 4 + ((src_len % 3) ? (src_len % 3) + 1 : 0);
+}
+
+void
+mtev_b64_stream_init(mtev_b64_stream_t *st, int flags) {
+  memset(st, 0, sizeof(*st));
+  st->flags = flags;
+}
+
+ssize_t
+mtev_b64_decode_update(mtev_b64_stream_t *st, const char *src, size_t src_len,
+                       unsigned char *dest, size_t dest_len) {
+  if(st->state == B64_ERROR) return -1;
+  if(dest_len < mtev_b64_decode_update_len(src_len)) return -1;
+  return b64_decode_run(st, (const unsigned char *)src, src_len,
+                        dest, dest_len, mtev_true);
+}
+
+size_t
+mtev_b64_decode_update_len(size_t src_len) {
+  /* up to three digits may be carried in from the previous piece */
+  return ((src_len + 3) * 3) / 4;
+}
+
+ssize_t
+mtev_b64_decode_final(mtev_b64_stream_t *st, unsigned char *dest, size_t dest_len) {
+  return b64_decode_tail(st, dest, dest_len, mtev_true);
+}
+
+ssize_t
+mtev_b64_encode_update(mtev_b64_stream_t *st, const unsigned char *src,
+                       size_t src_len, char *dest, size_t dest_len) {
+  const int url = (st->flags & MTEV_B64_URL) != 0;
+  char *dp = dest;
+  size_t whole;
+
+  if(dest_len < mtev_b64_encode_len(src_len)) return -1;
+  if(st->n) {
+    while(st->n < 3 && src_len) {
+      st->buf[st->n++] = *src++;
+      src_len--;
+    }
+    if(st->n < 3) return 0;
+    dp += b64_encode_fast(st->buf, 3, dp, url);
+    st->n = 0;
+  }
+  dp += b64_encode_fast(src, src_len, dp, url);
+  whole = src_len - src_len % 3;
+  while(whole < src_len) st->buf[st->n++] = src[whole++];
+  return dp - dest;
+}
+
+ssize_t
+mtev_b64_encode_final(mtev_b64_stream_t *st, char *dest, size_t dest_len) {
+  const int pad = (st->flags & MTEV_B64_NOPAD) == 0;
+  size_t need;
+
+  if(st->n == 0) return 0;
+  need = pad ? 4 : st->n + 1;
+  if(dest_len < need) return -1;
+  b64_encode_tail(st->buf, st->n, dest, (st->flags & MTEV_B64_URL) != 0, pad);
+  st->n = 0;
+  return need;
+}
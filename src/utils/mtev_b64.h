@@ -51,6 +51,7 @@
     \return The size of the decoded output.  Returns zero is dest_len is too small.
     
     mtev_b64_decode decodes input until an the entire input is consumed or until an invalid base64 character is encountered.
+    Whitespace is skipped and a final group lacking its padding is still decoded.
  */
 API_EXPORT(int) mtev_b64_decode(const char *, size_t, unsigned char *, size_t);
 /*! \fn size_t mtev_b64_max_decode_len(size_t src_len)
@@ -77,4 +78,103 @@ API_EXPORT(int) mtev_b64_encode(const unsigned char *, size_t, char *, size_t);
  */
 API_EXPORT(size_t) mtev_b64_encode_len(size_t);
 
+/*! \fn int mtev_b64url_decode(const char *src, size_t src_len, unsigned char *dest, size_t dest_len)
+    \brief Decode URL-safe base64 ('-' and '_' for 62 and 63) into the provided output buffer.
+    \param src The buffer containing the encoded content.
+    \param src_len The size (in bytes) of the encoded data.
+    \param dest The destination buffer to which the function will produce.
+    \param dest_len The size of the destination buffer.
+    \return The size of the decoded output.  Returns zero if dest_len is too small.
+
+    Padding is optional.  As with mtev_b64_decode, decoding stops at the first invalid character.
+ */
+API_EXPORT(int) mtev_b64url_decode(const char *, size_t, unsigned char *, size_t);
+/*! \fn size_t mtev_b64url_max_decode_len(size_t src_len)
+    \brief Calculate how large a buffer must be to decode a (possibly unpadded) URL-safe base64 string.
+    \param src_len The size (in bytes) of the encoded string.
+    \return The size of the buffer that would be needed to decode the input string.
+ */
+API_EXPORT(size_t) mtev_b64url_max_decode_len(size_t);
+/*! \fn int mtev_b64url_encode(const unsigned char *src, size_t src_len, char *dest, size_t dest_len)
+    \brief Encode raw data as unpadded URL-safe base64 into the provided buffer.
+    \param src The buffer containing the raw data.
+    \param src_len The size (in bytes) of the raw data.
+    \param dest The destination buffer to which the function will produce.
+    \param dest_len The size of the destination buffer.
+    \return The size of the encoded output.  Returns zero if dest_len is too small.
+ */
+API_EXPORT(int) mtev_b64url_encode(const unsigned char *, size_t, char *, size_t);
+/*! \fn size_t mtev_b64url_encode_len(size_t src_len)
+    \brief Calculate the length of the unpadded URL-safe base64 encoding of a number of bytes.
+    \param src_len The size (in bytes) of the raw data buffer that might be encoded.
+    \return The exact size of the encoded output.
+ */
+API_EXPORT(size_t) mtev_b64url_encode_len(size_t);
+
+#define MTEV_B64_URL   0x1 /* use the URL-safe alphabet */
+#define MTEV_B64_NOPAD 0x2 /* omit padding when encoding */
+
+/* State for incremental encoding or decoding; treat as opaque. */
+typedef struct {
+  unsigned char buf[4];
+  unsigned char n;
+  unsigned char state;
+  unsigned short flags;
+} mtev_b64_stream_t;
+
+/*! \fn void mtev_b64_stream_init(mtev_b64_stream_t *st, int flags)
+    \brief Prepare a stream for incremental encoding or decoding.
+    \param st The stream state.
+    \param flags A bitwise or of MTEV_B64_URL and MTEV_B64_NOPAD.
+ */
+API_EXPORT(void) mtev_b64_stream_init(mtev_b64_stream_t *, int);
+/*! \fn ssize_t mtev_b64_decode_update(mtev_b64_stream_t *st, const char *src, size_t src_len, unsigned char *dest, size_t dest_len)
+    \brief Decode the next piece of a base64 stream.
+    \param st The stream state.
+    \param src The next piece of encoded content; it may split groups anywhere.
+    \param src_len The size (in bytes) of this piece.
+    \param dest The destination buffer, at least mtev_b64_decode_update_len(src_len) bytes.
+    \param dest_len The size of the destination buffer.
+    \return The number of bytes decoded, or -1 on invalid input or too small a buffer.
+
+    Whitespace is skipped and padding is optional.  Pieces of a payload
+    being streamed in (e.g. the bchains handed to a
+    mtev_http_session_req_consume_stream callback) can be fed directly.
+ */
+API_EXPORT(ssize_t) mtev_b64_decode_update(mtev_b64_stream_t *, const char *, size_t,
+                                           unsigned char *, size_t);
+/*! \fn size_t mtev_b64_decode_update_len(size_t src_len)
+    \brief Calculate how large a buffer mtev_b64_decode_update needs for a piece of a given length.
+    \param src_len The size (in bytes) of the piece of encoded content.
+    \return The size of the buffer needed.
+ */
+API_EXPORT(size_t) mtev_b64_decode_update_len(size_t);
+/*! \fn ssize_t mtev_b64_decode_final(mtev_b64_stream_t *st, unsigned char *dest, size_t dest_len)
+    \brief Finish a base64 decoding stream, flushing an unpadded final group.
+    \param st The stream state.
+    \param dest The destination buffer (2 bytes suffice).
+    \param dest_len The size of the destination buffer.
+    \return The number of bytes decoded, or -1 if the stream was invalid.
+ */
+API_EXPORT(ssize_t) mtev_b64_decode_final(mtev_b64_stream_t *, unsigned char *, size_t);
+/*! \fn ssize_t mtev_b64_encode_update(mtev_b64_stream_t *st, const unsigned char *src, size_t src_len, char *dest, size_t dest_len)
+    \brief Encode the next piece of a stream of raw data.
+    \param st The stream state.
+    \param src The next piece of raw data.
+    \param src_len The size (in bytes) of this piece.
+    \param dest The destination buffer, at least mtev_b64_encode_len(src_len) bytes.
+    \param dest_len The size of the destination buffer.
+    \return The number of characters produced, or -1 if dest_len is too small.
+ */
+API_EXPORT(ssize_t) mtev_b64_encode_update(mtev_b64_stream_t *, const unsigned char *, size_t,
+                                           char *, size_t);
+/*! \fn ssize_t mtev_b64_encode_final(mtev_b64_stream_t *st, char *dest, size_t dest_len)
+    \brief Finish a base64 encoding stream, writing the final group.
+    \param st The stream state.
+    \param dest The destination buffer (4 bytes suffice).
+    \param dest_len The size of the destination buffer.
+    \return The number of characters produced, or -1 if dest_len is too small.
+ */
+API_EXPORT(ssize_t) mtev_b64_encode_final(mtev_b64_stream_t *, char *, size_t);
+
 #endif
@@ -34,6 +34,8 @@
 #include "mtev_defines.h"
 #include "mtev_btrie.h"
 #include "mtev_log.h"
+#include "mtev_memory.h"
+#include <ck_pr.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -318,3 +320,309 @@ void mtev_add_route_ipv6(btrie *tree, struct in6_addr *a,
   mtev_add_route(tree, ia, prefix_len, data);
 }
 
+
+/* Compiled (poptrie-style) lookup tables.
+ *
+ * The first DIRECT_BITS of the key index a flat table; each entry is either
+ * a leaf (leaf index with PT_LEAF set) or the index of a 6-bit stride node.
+ * A node's `vector` marks which of its 64 slots descend into child nodes
+ * (stored contiguously from base1) and `leafvec` marks where a new run of
+ * identical leaves begins (stored contiguously from base0), so a child or
+ * leaf is found with a single popcount.  Leaves carry the route's data
+ * directly; the prefix length lives in a parallel array that is only read
+ * when asked for, with PT_NOMATCH marking addresses no route covers.
+ */
+#define DIRECT_BITS 18
+#define PT_STRIDE 6
+#define PT_LEAF 0x80000000U
+#define PT_NOMATCH 0xff
+
+typedef struct {
+  uint64_t vector;
+  uint64_t leafvec;
+  uint32_t base0;
+  uint32_t base1;
+} pt_node;
+
+struct mtev_btrie_compiled {
+  int width;
+  uint32_t nnodes;
+  uint32_t nleaves;
+  uint32_t nroutes;
+  uint32_t *direct;
+  pt_node *nodes;
+  void **leaves;
+  unsigned char *leaf_plen;
+};
+
+struct pt_build {
+  int width;
+  btrie_node **routes;
+  uint32_t nroutes, aroutes;
+  pt_node *nodes;
+  uint32_t nnodes, anodes;
+  uint32_t *leaves; /* route index + 1, 0 for no match */
+  uint32_t nleaves, aleaves;
+};
+
+static inline uint32_t
+pt_chunk(const uint32_t *k, int off, int n) {
+  int w = off / 32, b = off % 32;
+  uint64_t x = (uint64_t)k[w] << 32;
+  if(w + 1 < MAXBITS/32) x |= k[w+1];
+  return (uint32_t)((x << b) >> (64 - n));
+}
+
+static void
+pt_collect(struct pt_build *b, btrie_node *node) {
+  /* pre-order, 0 before 1: lexicographic with covering prefixes first */
+  if(node == NULL) return;
+  if(!node->incidental && node->prefix_len <= b->width) {
+    if(b->nroutes == b->aroutes) {
+      b->aroutes = b->aroutes ? b->aroutes * 2 : 1024;
+      b->routes = realloc(b->routes, b->aroutes * sizeof(*b->routes));
+      mtevAssert(b->routes);
+    }
+    b->routes[b->nroutes++] = node;
+  }
+  pt_collect(b, node->bit[0]);
+  pt_collect(b, node->bit[1]);
+}
+
+/* Spread the routes in [lo,hi) -- all beneath the same `off`-bit prefix --
+ * across the 2^k slots of a stride starting at `off`.  best[v] receives the
+ * longest route ending within the stride (or `def`) and [clo[v],chi[v]) the
+ * routes continuing below slot v, which are contiguous in pre-order.
+ */
+static void
+pt_expand(struct pt_build *b, int off, int k, uint32_t lo, uint32_t hi,
+          uint32_t def, uint32_t *best, uint32_t *clo, uint32_t *chi) {
+  uint32_t i, j, v, n = 1U << k;
+  for(v=0; v<n; v++) {
+    best[v] = def;
+    clo[v] = chi[v] = 0;
+  }
+  for(i=lo; i<hi; i++) {
+    btrie_node *r = b->routes[i];
+    int l = r->prefix_len;
+    if(l <= off) continue;
+    if(l <= off + k) {
+      uint32_t span = 1U << (off + k - l);
+      v = pt_chunk(r->bits, off, l - off) << (off + k - l);
+      for(j=0; j<span; j++) best[v+j] = i + 1;
+    }
+    else {
+      v = pt_chunk(r->bits, off, k);
+      if(clo[v] == chi[v]) clo[v] = i;
+      chi[v] = i + 1;
+    }
+  }
+}
+
+static uint32_t
+pt_alloc_nodes(struct pt_build *b, uint32_t cnt) {
+  uint32_t base = b->nnodes;
+  if(b->nnodes + cnt > b->anodes) {
+    while(b->nnodes + cnt > b->anodes)
+      b->anodes = b->anodes ? b->anodes * 2 : 1024;
+    b->nodes = realloc(b->nodes, b->anodes * sizeof(*b->nodes));
+    mtevAssert(b->nodes);
+  }
+  memset(&b->nodes[base], 0, cnt * sizeof(*b->nodes));
+  b->nnodes += cnt;
+  return base;
+}
+
+static uint32_t
+pt_add_leaf(struct pt_build *b, uint32_t route) {
+  if(b->nleaves == b->aleaves) {
+    b->aleaves = b->aleaves ? b->aleaves * 2 : 1024;
+    b->leaves = realloc(b->leaves, b->aleaves * sizeof(*b->leaves));
+    mtevAssert(b->leaves);
+  }
+  b->leaves[b->nleaves] = route;
+  return b->nleaves++;
+}
+
+static void
+pt_fill_node(struct pt_build *b, uint32_t idx, int off,
+             uint32_t lo, uint32_t hi, uint32_t def) {
+  uint32_t best[1 << PT_STRIDE], clo[1 << PT_STRIDE], chi[1 << PT_STRIDE];
+  uint32_t v, nchildren = 0, base0, base1, last = 0;
+  uint64_t vector = 0, leafvec = 0;
+  mtev_boolean have_leaf = mtev_false;
+
+  pt_expand(b, off, PT_STRIDE, lo, hi, def, best, clo, chi);
+  base0 = b->nleaves;
+  for(v=0; v<(1 << PT_STRIDE); v++) {
+    if(clo[v] != chi[v]) {
+      vector |= 1ULL << v;
+      nchildren++;
+    }
+    else if(!have_leaf || best[v] != last) {
+      leafvec |= 1ULL << v;
+      pt_add_leaf(b, best[v]);
+      last = best[v];
+      have_leaf = mtev_true;
+    }
+  }
+  base1 = pt_alloc_nodes(b, nchildren);
+  /* b->nodes may have moved */
+  b->nodes[idx].vector = vector;
+  b->nodes[idx].leafvec = leafvec;
+  b->nodes[idx].base0 = base0;
+  b->nodes[idx].base1 = base1;
+  for(v=0; v<(1 << PT_STRIDE); v++) {
+    if(clo[v] == chi[v]) continue;
+    pt_fill_node(b, base1++, off + PT_STRIDE, clo[v], chi[v], best[v]);
+  }
+}
+
+static size_t
+pt_footprint(uint32_t nnodes, uint32_t nleaves) {
+  return sizeof(mtev_btrie_compiled_t) + (sizeof(uint32_t) << DIRECT_BITS) +
+         nnodes * sizeof(pt_node) + nleaves * (sizeof(void *) + 1);
+}
+
+static mtev_btrie_compiled_t *
+pt_compile(btrie *tree, int width) {
+  struct pt_build b;
+  uint32_t *best, *clo, *chi, *direct, v, def = 0, i, last = 0;
+  mtev_boolean in_run = mtev_false;
+  mtev_btrie_compiled_t *c;
+  char *p;
+
+  memset(&b, 0, sizeof(b));
+  b.width = width;
+  pt_collect(&b, *tree);
+  if(b.nroutes && b.routes[0]->prefix_len == 0) def = 1;
+
+  best = malloc(4 * sizeof(*best) << DIRECT_BITS);
+  mtevAssert(best);
+  clo = best + (1 << DIRECT_BITS);
+  chi = clo + (1 << DIRECT_BITS);
+  direct = chi + (1 << DIRECT_BITS);
+  pt_expand(&b, 0, DIRECT_BITS, 0, b.nroutes, def, best, clo, chi);
+  for(v=0; v<(1 << DIRECT_BITS); v++) {
+    if(clo[v] == chi[v]) {
+      /* runs of the same leaf share one entry */
+      if(!in_run || best[v] != b.leaves[last]) last = pt_add_leaf(&b, best[v]);
+      direct[v] = PT_LEAF | last;
+      in_run = mtev_true;
+    }
+    else {
+      direct[v] = pt_alloc_nodes(&b, 1);
+      pt_fill_node(&b, direct[v], DIRECT_BITS, clo[v], chi[v], best[v]);
+      in_run = mtev_false;
+    }
+  }
+  mtevAssert(b.nleaves < PT_LEAF && b.nnodes < PT_LEAF);
+
+  /* Lay everything out in one block so a swap retires it with one free. */
+  c = malloc(pt_footprint(b.nnodes, b.nleaves));
+  mtevAssert(c);
+  p = (char *)(c + 1);
+  c->width = width;
+  c->nnodes = b.nnodes;
+  c->nleaves = b.nleaves;
+  c->nroutes = b.nroutes;
+  c->nodes = (pt_node *)p;
+  p += b.nnodes * sizeof(pt_node);
+  c->leaves = (void **)p;
+  p += b.nleaves * sizeof(void *);
+  c->direct = (uint32_t *)p;
+  p += sizeof(uint32_t) << DIRECT_BITS;
+  c->leaf_plen = (unsigned char *)p;
+  if(b.nnodes) memcpy(c->nodes, b.nodes, b.nnodes * sizeof(pt_node));
+  memcpy(c->direct, direct, sizeof(uint32_t) << DIRECT_BITS);
+  for(i=0; i<b.nleaves; i++) {
+    btrie_node *r = b.leaves[i] ? b.routes[b.leaves[i] - 1] : NULL;
+    c->leaves[i] = r ? r->data : NULL;
+    c->leaf_plen[i] = r ? r->prefix_len : PT_NOMATCH;
+  }
+  free(best);
+  free(b.routes);
+  free(b.nodes);
+  free(b.leaves);
+  return c;
+}
+
+mtev_btrie_compiled_t *
+mtev_btrie_compile_ipv4(btrie *tree) {
+  return pt_compile(tree, 32);
+}
+mtev_btrie_compiled_t *
+mtev_btrie_compile_ipv6(btrie *tree) {
+  return pt_compile(tree, 128);
+}
+void
+mtev_btrie_compiled_free(mtev_btrie_compiled_t *c) {
+  free(c);
+}
+static void
+mtev_btrie_compiled_free_void(void *c) {
+  mtev_btrie_compiled_free(c);
+}
+void
+mtev_btrie_compiled_swap(mtev_btrie_compiled_t **slot,
+                         mtev_btrie_compiled_t *c) {
+  mtev_btrie_compiled_t *old = ck_pr_fas_ptr(slot, c);
+  mtev_memory_defer_free(old, mtev_btrie_compiled_free_void);
+}
+size_t
+mtev_btrie_compiled_size(const mtev_btrie_compiled_t *c) {
+  if(!c) return 0;
+  return pt_footprint(c->nnodes, c->nleaves);
+}
+
+static inline void *
+pt_result(const mtev_btrie_compiled_t *c, uint32_t leaf, unsigned char *pl) {
+  if(pl && c->leaf_plen[leaf] != PT_NOMATCH) *pl = c->leaf_plen[leaf];
+  return c->leaves[leaf];
+}
+
+void *
+mtev_btrie_compiled_find_ipv4(const mtev_btrie_compiled_t *c,
+                              struct in_addr *a, unsigned char *pl) {
+  const pt_node *n;
+  uint64_t key, bit;
+  uint32_t ia, d;
+  int off;
+
+  if(!c || c->width != 32) return NULL;
+  ia = ntohl(a->s_addr);
+  d = c->direct[ia >> (32 - DIRECT_BITS)];
+  if(d & PT_LEAF) return pt_result(c, d & ~PT_LEAF, pl);
+  n = &c->nodes[d];
+  key = (uint64_t)ia << 32;
+  for(off = DIRECT_BITS; ; off += PT_STRIDE) {
+    bit = 1ULL << ((key >> (64 - PT_STRIDE - off)) & 0x3f);
+    if(!(n->vector & bit)) break;
+    n = &c->nodes[n->base1 + __builtin_popcountll(n->vector & ((bit << 1) - 1)) - 1];
+  }
+  return pt_result(c, n->base0 +
+                   __builtin_popcountll(n->leafvec & ((bit << 1) - 1)) - 1, pl);
+}
+
+void *
+mtev_btrie_compiled_find_ipv6(const mtev_btrie_compiled_t *c,
+                              struct in6_addr *a, unsigned char *pl) {
+  const pt_node *n;
+  uint32_t ia[4], d, i;
+  uint64_t bit;
+  int off;
+
+  if(!c || c->width != 128) return NULL;
+  memcpy(ia, &a->s6_addr, sizeof(ia));
+  for(i=0;i<4;i++) ia[i] = ntohl(ia[i]);
+  d = c->direct[ia[0] >> (32 - DIRECT_BITS)];
+  if(d & PT_LEAF) return pt_result(c, d & ~PT_LEAF, pl);
+  n = &c->nodes[d];
+  for(off = DIRECT_BITS; ; off += PT_STRIDE) {
+    bit = 1ULL << pt_chunk(ia, off, PT_STRIDE);
+    if(!(n->vector & bit)) break;
+    n = &c->nodes[n->base1 + __builtin_popcountll(n->vector & ((bit << 1) - 1)) - 1];
+  }
+  return pt_result(c, n->base0 +
+                   __builtin_popcountll(n->leafvec & ((bit << 1) - 1)) - 1, pl);
+}
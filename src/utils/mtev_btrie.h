@@ -34,6 +34,7 @@
 #ifndef UTILS_MTEV_BTRIE_H
 #define UTILS_MTEV_BTRIE_H
 
+#include "mtev_defines.h"
 #include <arpa/inet.h>
 #include <netinet/in.h>
 
@@ -50,4 +51,74 @@ int mtev_del_route_ipv6(btrie *, struct in6_addr *, unsigned char,
 void *mtev_find_bpm_route_ipv4(btrie *tree, struct in_addr *a, unsigned char *);
 void *mtev_find_bpm_route_ipv6(btrie *tree, struct in6_addr *a, unsigned char *);
 
+typedef struct mtev_btrie_compiled mtev_btrie_compiled_t;
+
+/*! \fn mtev_btrie_compiled_t *mtev_btrie_compile_ipv4(btrie *tree)
+    \brief Build a read-optimized longest-prefix-match table from an IPv4 btrie.
+    \param tree the btrie to snapshot
+    \return a new compiled table, independent of later changes to tree
+
+    The compiled form is a poptrie: an 18-bit direct-indexed head followed by
+    6-bit stride nodes addressed by bitmap popcount.  Lookups are read-only
+    and may run concurrently with each other.  Data pointers are copied, not
+    owned; they must outlive every table that references them.
+
+    The head alone is 1MB, so every compiled table costs at least that much
+    however few routes it holds (and compiling briefly needs 4MB more);
+    keep a plain btrie for small route sets.
+ */
+API_EXPORT(mtev_btrie_compiled_t *) mtev_btrie_compile_ipv4(btrie *tree);
+
+/*! \fn mtev_btrie_compiled_t *mtev_btrie_compile_ipv6(btrie *tree)
+    \brief Build a read-optimized longest-prefix-match table from an IPv6 btrie.
+    \param tree the btrie to snapshot
+    \return a new compiled table, independent of later changes to tree
+ */
+API_EXPORT(mtev_btrie_compiled_t *) mtev_btrie_compile_ipv6(btrie *tree);
+
+/*! \fn void mtev_btrie_compiled_free(mtev_btrie_compiled_t *c)
+    \brief Immediately free a compiled table no reader can be using.
+    \param c the table, NULL is ignored
+ */
+API_EXPORT(void) mtev_btrie_compiled_free(mtev_btrie_compiled_t *c);
+
+/*! \fn void mtev_btrie_compiled_swap(mtev_btrie_compiled_t **slot, mtev_btrie_compiled_t *c)
+    \brief Atomically publish a compiled table, retiring the previous one.
+    \param slot the shared location readers load the table from
+    \param c the new table (may be NULL)
+
+    Readers should load `*slot` with `ck_pr_load_ptr` between
+    `mtev_memory_begin()` and `mtev_memory_end()`; the replaced table is freed
+    only once no such section can still reference it.
+ */
+API_EXPORT(void) mtev_btrie_compiled_swap(mtev_btrie_compiled_t **slot,
+                                          mtev_btrie_compiled_t *c);
+
+/*! \fn size_t mtev_btrie_compiled_size(const mtev_btrie_compiled_t *c)
+    \brief Report the memory footprint of a compiled table in bytes.
+ */
+API_EXPORT(size_t) mtev_btrie_compiled_size(const mtev_btrie_compiled_t *c);
+
+/*! \fn void *mtev_btrie_compiled_find_ipv4(const mtev_btrie_compiled_t *c, struct in_addr *a, unsigned char *pl)
+    \brief Longest-prefix match against a table from mtev_btrie_compile_ipv4.
+    \param c the compiled table (NULL matches nothing)
+    \param a the address
+    \param pl if not NULL, set to the matching prefix length on a match
+    \return the data of the most specific route covering a, or NULL
+ */
+API_EXPORT(void *) mtev_btrie_compiled_find_ipv4(const mtev_btrie_compiled_t *c,
+                                                 struct in_addr *a,
+                                                 unsigned char *pl);
+
+/*! \fn void *mtev_btrie_compiled_find_ipv6(const mtev_btrie_compiled_t *c, struct in6_addr *a, unsigned char *pl)
+    \brief Longest-prefix match against a table from mtev_btrie_compile_ipv6.
+    \param c the compiled table (NULL matches nothing)
+    \param a the address
+    \param pl if not NULL, set to the matching prefix length on a match
+    \return the data of the most specific route covering a, or NULL
+ */
+API_EXPORT(void *) mtev_btrie_compiled_find_ipv6(const mtev_btrie_compiled_t *c,
+                                                 struct in6_addr *a,
+                                                 unsigned char *pl);
+
 #endif
@@ -0,0 +1,433 @@
+/*
+ * Copyright (c) 2017, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name Circonus, Inc. nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "mtev_bufpool.h"
+#include "mtev_log.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#include <ck_pr.h>
+
+#define REGION_SIZE (2 * 1024 * 1024)
+#define BUF_ALIGN 64
+#define MAX_BUFSIZE (REGION_SIZE / 4)
+#define TCACHE_MAX 8
+#define TCACHE_POOLS 32
+#define REFILL 4
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+/* The region header lives at the start of each 2MB-aligned region, so
+ * a buffer finds its pool and home node by masking its address. */
+struct bufpool_region {
+  mtev_bufpool_t *pool;
+  struct bufpool_region *next;
+  int node;
+  int hugetlb;
+  char *carve;
+  char *end;
+};
+#define REGION_HDR (((sizeof(struct bufpool_region) + BUF_ALIGN - 1) / BUF_ALIGN) * BUF_ALIGN)
+#define REGION_OF(b) ((struct bufpool_region *)((uintptr_t)(b) & ~(uintptr_t)(REGION_SIZE - 1)))
+
+struct bufpool_free {
+  struct bufpool_free *next;
+};
+
+struct bufpool_node {
+  pthread_mutex_t lock;
+  struct bufpool_free *freelist;
+  struct bufpool_region *regions; /* head is the one being carved */
+  int64_t nfree;
+  int64_t carved;
+  uint64_t nregions;
+  uint64_t hugetlb_regions;
+  uint64_t allocs;
+  uint64_t frees;
+  uint64_t remote_frees;
+} __attribute__((aligned(64)));
+
+struct mtev_bufpool {
+  char name[32];
+  int id;
+  size_t bufsize;
+  size_t stride;
+  mtev_bufpool_pages_t pages;
+  mtev_bufpool_t *next_registered;
+  struct bufpool_node nodes[];
+};
+
+/* A thread's cache holds buffers from a single node: the one it was
+ * running on when it last refilled. */
+struct bufpool_tcache {
+  int node;
+  int n;
+  void *bufs[TCACHE_MAX];
+};
+
+static pthread_once_t topo_once = PTHREAD_ONCE_INIT;
+static int numa_nnodes = 1;
+static int ncpu_map;
+static uint8_t *cpu_to_node;
+static int default_pages = MTEV_BUFPOOL_PAGES_NORMAL;
+static int hugetlb_warned;
+static pthread_key_t tcache_key;
+static __thread struct bufpool_tcache *tcaches;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static mtev_bufpool_t *registry;
+static int npools;
+
+static void node_put(mtev_bufpool_t *, int, void **, int, mtev_boolean);
+
+static void
+tcache_release(void *vtc) {
+  struct bufpool_tcache *tc = vtc;
+  int i, j;
+  for(i = 0; i < TCACHE_POOLS; i++) {
+    for(j = 0; j < tc[i].n; j++) {
+      struct bufpool_region *r = REGION_OF(tc[i].bufs[j]);
+      node_put(r->pool, r->node, &tc[i].bufs[j], 1, mtev_false);
+    }
+  }
+  free(tc);
+}
+
+#if defined(__linux__)
+/* Walk a sysfs id list such as "0-3,8-11", calling f for each id. */
+static void
+sysfs_list_walk(const char *path, void (*f)(int, void *), void *closure) {
+  char buf[4096], *cp, *end;
+  FILE *fp = fopen(path, "r");
+  if(!fp) return;
+  if(!fgets(buf, sizeof(buf), fp)) {
+    fclose(fp);
+    return;
+  }
+  fclose(fp);
+  cp = buf;
+  while(*cp && *cp != '\n') {
+    long lo, hi, i;
+    lo = hi = strtol(cp, &end, 10);
+    if(end == cp) break;
+    cp = end;
+    if(*cp == '-') {
+      hi = strtol(cp + 1, &end, 10);
+      cp = end;
+    }
+    for(i = lo; i <= hi; i++) f((int)i, closure);
+    if(*cp == ',') cp++;
+  }
+}
+static void
+note_node(int id, void *closure) {
+  int *nodes = closure;
+  if(id + 1 > *nodes) *nodes = id + 1;
+}
+static void
+note_cpu(int cpu, void *closure) {
+  if(cpu >= 0 && cpu < ncpu_map) cpu_to_node[cpu] = (uint8_t)(intptr_t)closure;
+}
+#endif
+
+static void
+bufpool_topology_init(void) {
+  pthread_key_create(&tcache_key, tcache_release);
+#if defined(__linux__)
+  {
+    char path[128];
+    int nodes = 0, i;
+    long ncpus = sysconf(_SC_NPROCESSORS_CONF);
+    sysfs_list_walk("/sys/devices/system/node/online", note_node, &nodes);
+    if(nodes > MTEV_BUFPOOL_MAX_NODES) nodes = MTEV_BUFPOOL_MAX_NODES;
+    if(nodes > 1 && ncpus > 0 && (cpu_to_node = calloc(ncpus, 1)) != NULL) {
+      ncpu_map = ncpus;
+      numa_nnodes = nodes;
+      for(i = 0; i < nodes; i++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", i);
+        sysfs_list_walk(path, note_cpu, (void *)(intptr_t)i);
+      }
+    }
+  }
+#endif
+  mtevL(mtev_debug, "bufpool: %d NUMA node(s)\n", numa_nnodes);
+}
+
+int
+mtev_bufpool_numa_nodes(void) {
+  pthread_once(&topo_once, bufpool_topology_init);
+  return numa_nnodes;
+}
+
+int
+mtev_bufpool_current_node(void) {
+  pthread_once(&topo_once, bufpool_topology_init);
+  if(numa_nnodes == 1) return 0;
+#if defined(HAVE_SCHED_GETCPU)
+  {
+    int cpu = sched_getcpu();
+    if(cpu >= 0 && cpu < ncpu_map) return cpu_to_node[cpu];
+  }
+#endif
+  return 0;
+}
+
+void
+mtev_bufpool_pages_default(mtev_bufpool_pages_t pages) {
+  if(pages == MTEV_BUFPOOL_PAGES_DEFAULT) pages = MTEV_BUFPOOL_PAGES_NORMAL;
+  ck_pr_store_int(&default_pages, pages);
+}
+
+static void
+region_bind(void *base, int node) {
+#if defined(__linux__) && defined(SYS_mbind)
+  unsigned long mask[MTEV_BUFPOOL_MAX_NODES / (8 * sizeof(unsigned long))];
+  if(numa_nnodes < 2) return;
+  memset(mask, 0, sizeof(mask));
+  mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+  /* Advisory; first touch from the owning thread already places pages
+   * locally, this keeps them there if someone else touches first. */
+  (void)syscall(SYS_mbind, base, REGION_SIZE, MPOL_PREFERRED, mask,
+                MTEV_BUFPOOL_MAX_NODES + 1, 0);
+#else
+  (void)base;
+  (void)node;
+#endif
+}
+
+static struct bufpool_region *
+region_create(mtev_bufpool_t *pool, int node) {
+  struct bufpool_region *r;
+  char *base = MAP_FAILED;
+  int hugetlb = 0;
+  int pages = pool->pages;
+
+  if(pages == MTEV_BUFPOOL_PAGES_DEFAULT) pages = ck_pr_load_int(&default_pages);
+#if defined(MAP_HUGETLB)
+  if(pages == MTEV_BUFPOOL_PAGES_HUGETLB) {
+    int flags = MAP_PRIVATE|MAP_ANON|MAP_HUGETLB;
+#if defined(MAP_HUGE_2MB)
+    flags |= MAP_HUGE_2MB;
+#endif
+    base = mmap(NULL, REGION_SIZE, PROT_READ|PROT_WRITE, flags, -1, 0);
+    if(base != MAP_FAILED) hugetlb = 1;
+    else if(ck_pr_fas_int(&hugetlb_warned, 1) == 0)
+      mtevL(mtev_error, "bufpool: no 2MB hugepages available, using transparent hugepages\n");
+  }
+#endif
+  if(base == MAP_FAILED) {
+    char *raw = mmap(NULL, 2 * REGION_SIZE, PROT_READ|PROT_WRITE,
+                     MAP_PRIVATE|MAP_ANON, -1, 0);
+    if(raw == MAP_FAILED) return NULL;
+    base = (char *)(((uintptr_t)raw + REGION_SIZE - 1) & ~(uintptr_t)(REGION_SIZE - 1));
+    if(base > raw) munmap(raw, base - raw);
+    if(raw + 2 * REGION_SIZE > base + REGION_SIZE)
+      munmap(base + REGION_SIZE, (raw + 2 * REGION_SIZE) - (base + REGION_SIZE));
+#if defined(MADV_HUGEPAGE)
+    if(pages == MTEV_BUFPOOL_PAGES_TRANSPARENT || pages == MTEV_BUFPOOL_PAGES_HUGETLB)
+      madvise(base, REGION_SIZE, MADV_HUGEPAGE);
+#endif
+  }
+  region_bind(base, node);
+
+  /* first touch happens here, on the thread that wants the memory */
+  r = (struct bufpool_region *)base;
+  r->pool = pool;
+  r->next = NULL;
+  r->node = node;
+  r->hugetlb = hugetlb;
+  r->carve = base + REGION_HDR;
+  r->end = base + REGION_SIZE;
+  return r;
+}
+
+static int
+node_take(mtev_bufpool_t *pool, int node, void **out, int want) {
+  struct bufpool_node *bn = &pool->nodes[node];
+  int n = 0;
+
+  pthread_mutex_lock(&bn->lock);
+  while(n < want && bn->freelist) {
+    out[n++] = bn->freelist;
+    bn->freelist = bn->freelist->next;
+    bn->nfree--;
+  }
+  while(n < want) {
+    struct bufpool_region *r = bn->regions;
+    if(r == NULL || r->carve + pool->stride > r->end) {
+      if((r = region_create(pool, node)) == NULL) break;
+      r->next = bn->regions;
+      bn->regions = r;
+      bn->nregions++;
+      if(r->hugetlb) bn->hugetlb_regions++;
+    }
+    out[n++] = r->carve;
+    r->carve += pool->stride;
+    bn->carved++;
+  }
+  bn->allocs += n;
+  pthread_mutex_unlock(&bn->lock);
+  return n;
+}
+
+static void
+node_put(mtev_bufpool_t *pool, int node, void **bufs, int n, mtev_boolean remote) {
+  struct bufpool_node *bn = &pool->nodes[node];
+  int i;
+
+  pthread_mutex_lock(&bn->lock);
+  for(i = 0; i < n; i++) {
+    struct bufpool_free *f = bufs[i];
+    f->next = bn->freelist;
+    bn->freelist = f;
+  }
+  bn->nfree += n;
+  bn->frees += n;
+  if(remote) bn->remote_frees += n;
+  pthread_mutex_unlock(&bn->lock);
+}
+
+static inline struct bufpool_tcache *
+tcache_get(mtev_bufpool_t *pool) {
+  int i;
+  if(pool->id >= TCACHE_POOLS) return NULL;
+  if(tcaches == NULL) {
+    if((tcaches = calloc(TCACHE_POOLS, sizeof(*tcaches))) == NULL) return NULL;
+    for(i = 0; i < TCACHE_POOLS; i++) tcaches[i].node = -1;
+    pthread_setspecific(tcache_key, tcaches);
+  }
+  return &tcaches[pool->id];
+}
+
+mtev_bufpool_t *
+mtev_bufpool_create(const char *name, size_t bufsize, mtev_bufpool_pages_t pages) {
+  mtev_bufpool_t *pool;
+  size_t len;
+  int i;
+
+  if(bufsize == 0 || bufsize > MAX_BUFSIZE) return NULL;
+  pthread_once(&topo_once, bufpool_topology_init);
+  len = sizeof(*pool) + numa_nnodes * sizeof(struct bufpool_node);
+  if(posix_memalign((void **)&pool, BUF_ALIGN, len)) return NULL;
+  memset(pool, 0, len);
+  strlcpy(pool->name, name ? name : "bufpool", sizeof(pool->name));
+  pool->bufsize = bufsize;
+  pool->stride = ((bufsize + BUF_ALIGN - 1) / BUF_ALIGN) * BUF_ALIGN;
+  pool->pages = pages;
+  for(i = 0; i < numa_nnodes; i++) pthread_mutex_init(&pool->nodes[i].lock, NULL);
+
+  pthread_mutex_lock(&registry_lock);
+  pool->id = npools++;
+  pool->next_registered = registry;
+  registry = pool;
+  pthread_mutex_unlock(&registry_lock);
+  return pool;
+}
+
+void *
+mtev_bufpool_alloc(mtev_bufpool_t *pool) {
+  struct bufpool_tcache *tc = tcache_get(pool);
+  void *bufs[REFILL];
+  int i, n, node;
+
+  if(tc && tc->n > 0) return tc->bufs[--tc->n];
+  node = mtev_bufpool_current_node();
+  n = node_take(pool, node, bufs, tc ? REFILL : 1);
+  if(n == 0) return NULL;
+  if(tc) {
+    tc->node = node;
+    for(i = 1; i < n; i++) tc->bufs[tc->n++] = bufs[i];
+  }
+  return bufs[0];
+}
+
+void
+mtev_bufpool_free(void *buf) {
+  struct bufpool_region *r;
+  struct bufpool_tcache *tc;
+
+  if(buf == NULL) return;
+  r = REGION_OF(buf);
+  tc = tcache_get(r->pool);
+  if(tc && tc->node == r->node) {
+    if(tc->n == TCACHE_MAX) {
+      node_put(r->pool, r->node, tc->bufs + TCACHE_MAX / 2, TCACHE_MAX / 2, mtev_false);
+      tc->n = TCACHE_MAX / 2;
+    }
+    tc->bufs[tc->n++] = buf;
+    return;
+  }
+  node_put(r->pool, r->node, &buf, 1, r->node != mtev_bufpool_current_node());
+}
+
+size_t
+mtev_bufpool_bufsize(mtev_bufpool_t *pool) {
+  return pool->bufsize;
+}
+
+const char *
+mtev_bufpool_name(mtev_bufpool_t *pool) {
+  return pool->name;
+}
+
+int
+mtev_bufpool_stats(mtev_bufpool_t *pool, mtev_bufpool_node_stats_t *stats, int nstats) {
+  int i;
+  for(i = 0; i < numa_nnodes && i < nstats; i++) {
+    struct bufpool_node *bn = &pool->nodes[i];
+    pthread_mutex_lock(&bn->lock);
+    stats[i].node = i;
+    stats[i].regions = bn->nregions;
+    stats[i].hugetlb_regions = bn->hugetlb_regions;
+    stats[i].allocs = bn->allocs;
+    stats[i].frees = bn->frees;
+    stats[i].remote_frees = bn->remote_frees;
+    stats[i].outstanding = bn->carved - bn->nfree;
+    stats[i].free = bn->nfree;
+    pthread_mutex_unlock(&bn->lock);
+  }
+  return i;
+}
+
+void
+mtev_bufpool_foreach(void (*f)(mtev_bufpool_t *, void *), void *closure) {
+  mtev_bufpool_t *pool;
+  pthread_mutex_lock(&registry_lock);
+  for(pool = registry; pool; pool = pool->next_registered) f(pool, closure);
+  pthread_mutex_unlock(&registry_lock);
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2017, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name Circonus, Inc. nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef MTEV_BUFPOOL_H
+#define MTEV_BUFPOOL_H
+
+#include <mtev_defines.h>
+
+/* Fixed-size I/O buffers from NUMA-local memory.
+ *
+ * A pool carves buffers out of 2MB regions.  Each region belongs to one
+ * NUMA node: it is created by (and first touched from) a thread running
+ * on that node and, where the kernel allows, bound to it.  Threads
+ * allocate from their own node, keep a few buffers in a thread-local
+ * cache, and a buffer freed elsewhere is returned to its home node.
+ * Regions may be backed by transparent or explicit (MAP_HUGETLB) 2MB
+ * pages.  On machines with one node, or without NUMA support, all of
+ * this collapses to a single node.
+ *
+ * Pools are never destroyed.
+ */
+typedef struct mtev_bufpool mtev_bufpool_t;
+
+typedef enum {
+  MTEV_BUFPOOL_PAGES_DEFAULT = 0, /* the process default, see mtev_bufpool_pages_default */
+  MTEV_BUFPOOL_PAGES_NORMAL,      /* ordinary pages */
+  MTEV_BUFPOOL_PAGES_TRANSPARENT, /* madvise(MADV_HUGEPAGE) */
+  MTEV_BUFPOOL_PAGES_HUGETLB      /* mmap(MAP_HUGETLB), falling back to transparent */
+} mtev_bufpool_pages_t;
+
+#define MTEV_BUFPOOL_MAX_NODES 64
+
+typedef struct {
+  int node;
+  uint64_t regions;         /* 2MB regions reserved on this node */
+  uint64_t hugetlb_regions; /* of those, backed by explicit hugepages */
+  uint64_t allocs;          /* buffers handed to threads */
+  uint64_t frees;           /* buffers returned to the node */
+  uint64_t remote_frees;    /* of those, freed from another node */
+  int64_t outstanding;      /* carved and not on the node's free list */
+  int64_t free;             /* on the node's free list */
+} mtev_bufpool_node_stats_t;
+
+/*! \fn mtev_bufpool_t *mtev_bufpool_create(const char *name, size_t bufsize, mtev_bufpool_pages_t pages)
+    \brief Create a NUMA-aware pool of fixed-size buffers.
+    \param name a name for reporting
+    \param bufsize the size of each buffer, at most 512k
+    \param pages the kind of pages backing the pool
+    \return a new pool, or NULL if bufsize is out of range
+
+    Buffers are aligned to 64 bytes.
+ */
+API_EXPORT(mtev_bufpool_t *)
+  mtev_bufpool_create(const char *name, size_t bufsize,
+                      mtev_bufpool_pages_t pages);
+
+/*! \fn void *mtev_bufpool_alloc(mtev_bufpool_t *pool)
+    \brief Allocate a buffer local to the calling thread's NUMA node.
+    \param pool the pool
+    \return a buffer of the pool's size, or NULL if memory is exhausted
+ */
+API_EXPORT(void *)
+  mtev_bufpool_alloc(mtev_bufpool_t *pool);
+
+/*! \fn void mtev_bufpool_free(void *buf)
+    \brief Return a buffer to the pool it came from.
+    \param buf a buffer from mtev_bufpool_alloc, may be NULL
+
+    Any thread may free any buffer.
+ */
+API_EXPORT(void)
+  mtev_bufpool_free(void *buf);
+
+/*! \fn size_t mtev_bufpool_bufsize(mtev_bufpool_t *pool)
+    \brief Return the size of the buffers in a pool.
+ */
+API_EXPORT(size_t)
+  mtev_bufpool_bufsize(mtev_bufpool_t *pool);
+
+/*! \fn const char *mtev_bufpool_name(mtev_bufpool_t *pool)
+    \brief Return the name of a pool.
+ */
+API_EXPORT(const char *)
+  mtev_bufpool_name(mtev_bufpool_t *pool);
+
+/*! \fn int mtev_bufpool_stats(mtev_bufpool_t *pool, mtev_bufpool_node_stats_t *stats, int nstats)
+    \brief Report per-node statistics for a pool.
+    \param pool the pool
+    \param stats an array to fill
+    \param nstats the length of the array
+    \return the number of entries filled, one per NUMA node
+ */
+API_EXPORT(int)
+  mtev_bufpool_stats(mtev_bufpool_t *pool, mtev_bufpool_node_stats_t *stats,
+                     int nstats);
+
+/*! \fn void mtev_bufpool_foreach(void (*f)(mtev_bufpool_t *, void *), void *closure)
+    \brief Call a function for each pool that has been created.
+ */
+API_EXPORT(void)
+  mtev_bufpool_foreach(void (*f)(mtev_bufpool_t *, void *), void *closure);
+
+/*! \fn void mtev_bufpool_pages_default(mtev_bufpool_pages_t pages)
+    \brief Set the page type used by pools created with MTEV_BUFPOOL_PAGES_DEFAULT.
+    \param pages the page type; MTEV_BUFPOOL_PAGES_DEFAULT restores normal pages
+
+    This applies to regions reserved after the call, so it may be set
+    after pools exist.
+ */
+API_EXPORT(void)
+  mtev_bufpool_pages_default(mtev_bufpool_pages_t pages);
+
+/*! \fn int mtev_bufpool_numa_nodes(void)
+    \brief Return the number of NUMA nodes buffers are spread across.
+ */
+API_EXPORT(int)
+  mtev_bufpool_numa_nodes(void);
+
+/*! \fn int mtev_bufpool_current_node(void)
+    \brief Return the NUMA node the calling thread is running on.
+ */
+API_EXPORT(int)
+  mtev_bufpool_current_node(void);
+
+#endif
@@ -36,6 +36,11 @@
 #define DEFAULT_WEIGHT 32
 #define CHT_INITVAL 20021010
 #define CHT_MAX_W 16
+#define MAGLEV_MIN_SIZE 65537
+#define MAGLEV_SLOTS_PER_NODE 100
+#define MAGLEV_OFFSET_SEED 0x6d61676c
+#define MAGLEV_SKIP_SEED 0x736b6970
+#define MAGLEV_EMPTY 0xffff
 
 struct ring_pos {
   uint32_t pos;
@@ -43,12 +48,16 @@ struct ring_pos {
   unsigned short vnode;
 };
 struct mtev_cht {
+  mtev_cht_mode_t mode;
   uint8_t nbits;
   uint16_t weight;
   int node_cnt;
   int collisions;
   mtev_cht_node_t *nodes;
   struct ring_pos *ring;
+  /* MTEV_CHT_MAGLEV: table_size (prime) slots each holding a node index */
+  uint32_t table_size;
+  uint16_t *table;
 };
 
 static inline uint32_t
@@ -61,6 +70,30 @@ mtev_cht_hash(mtev_cht_t *cht, const void *key, size_t keylen, int ival) {
   return hv & mask;
 }
 
+/* murmur3's 64bit finalizer; spreads a 32bit key hash for jump hashing */
+static inline uint64_t
+mtev_cht_mix64(uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+/* Lamping & Veach, "A Fast, Minimal Memory, Consistent Hash Algorithm" */
+static inline int
+mtev_cht_jump(uint64_t key, int n) {
+  int64_t b = -1, j = 0;
+  while(j < n) {
+    b = j;
+    key = key * 2862933555777941757ULL + 1;
+    j = (int64_t)((double)(b + 1) *
+                  ((double)(1LL << 31) / (double)((key >> 33) + 1)));
+  }
+  return (int)b;
+}
+
 static inline int iarrcontains(int n, int *ids, int what) {
   int i;
   for(i=0;i<n;i++) if(ids[i] == what) return i;
@@ -158,6 +191,83 @@ mtev_cht_calculate_ring(mtev_cht_t *cht) {
     ((double)(max - s->pos) + 1.0 + (double)(e->pos))/((double)max + 1.0);
 }
 
+static mtev_boolean
+is_prime(uint32_t n) {
+  uint32_t i;
+  if(n < 2) return mtev_false;
+  if(n % 2 == 0) return n == 2;
+  for(i=3; i <= n / i; i+=2) if(n % i == 0) return mtev_false;
+  return mtev_true;
+}
+
+struct maglev_order {
+  const char *name;
+  int idx;
+};
+static int
+maglev_name_cmp(const void *a, const void *b) {
+  const struct maglev_order *ao = a;
+  const struct maglev_order *bo = b;
+  return strcmp(ao->name, bo->name);
+}
+
+/* Populate the Maglev lookup table: each node walks its own permutation of
+ * the slots (offset + k * skip mod M, M prime) and the nodes take turns
+ * claiming the next free slot in theirs until the table is full.  Nodes take
+ * turns in name order so the table does not depend on the order in which
+ * the caller supplied them.
+ */
+static void
+mtev_cht_calculate_maglev(mtev_cht_t *cht) {
+  uint32_t M, filled = 0, target;
+  uint32_t *pos, *skip;
+  uint32_t *counts;
+  struct maglev_order *order;
+  int i, n = cht->node_cnt;
+
+  target = (uint32_t)n * MAGLEV_SLOTS_PER_NODE;
+  if(target < MAGLEV_MIN_SIZE) target = MAGLEV_MIN_SIZE;
+  for(M = target; !is_prime(M); M++);
+  if(cht->table_size != M) {
+    free(cht->table);
+    cht->table = malloc(M * sizeof(*cht->table));
+    cht->table_size = M;
+  }
+  memset(cht->table, 0xff, M * sizeof(*cht->table));
+
+  pos = calloc(n, sizeof(*pos));
+  skip = calloc(n, sizeof(*skip));
+  counts = calloc(n, sizeof(*counts));
+  order = calloc(n, sizeof(*order));
+  for(i=0;i<n;i++) {
+    size_t len = strlen(cht->nodes[i].name);
+    order[i].name = cht->nodes[i].name;
+    order[i].idx = i;
+    pos[i] = mtev_hash__hash(cht->nodes[i].name, len, MAGLEV_OFFSET_SEED) % M;
+    skip[i] = mtev_hash__hash(cht->nodes[i].name, len, MAGLEV_SKIP_SEED) % (M - 1) + 1;
+  }
+  qsort(order, n, sizeof(*order), maglev_name_cmp);
+
+  while(filled < M) {
+    for(i=0;i<n && filled < M;i++) {
+      int idx = order[i].idx;
+      while(cht->table[pos[idx]] != MAGLEV_EMPTY) {
+        pos[idx] += skip[idx];
+        if(pos[idx] >= M) pos[idx] -= M;
+      }
+      cht->table[pos[idx]] = idx;
+      counts[idx]++;
+      filled++;
+    }
+  }
+
+  for(i=0;i<n;i++) cht->nodes[i].owned = (double)counts[i] / (double)M;
+  free(order);
+  free(counts);
+  free(skip);
+  free(pos);
+}
+
 mtev_cht_t *
 mtev_cht_alloc_custom(uint16_t weight, uint8_t nbits) {
   mtev_cht_t *cht;
@@ -174,9 +284,45 @@ mtev_cht_t *
 mtev_cht_alloc() {
   return mtev_cht_alloc_custom(DEFAULT_WEIGHT, 0);
 }
+mtev_cht_t *
+mtev_cht_alloc_mode(mtev_cht_mode_t mode) {
+  mtev_cht_t *cht = mtev_cht_alloc();
+  switch(mode) {
+    case MTEV_CHT_MAGLEV:
+    case MTEV_CHT_JUMP:
+      cht->mode = mode;
+      break;
+    default:
+      cht->mode = MTEV_CHT_RING;
+  }
+  return cht;
+}
+mtev_cht_mode_t
+mtev_cht_get_mode(mtev_cht_t *cht) {
+  return cht->mode;
+}
+const char *
+mtev_cht_mode_name(mtev_cht_mode_t mode) {
+  switch(mode) {
+    case MTEV_CHT_MAGLEV: return "maglev";
+    case MTEV_CHT_JUMP: return "jump";
+    default: break;
+  }
+  return "ring";
+}
+mtev_boolean
+mtev_cht_mode_from_name(const char *name, mtev_cht_mode_t *mode) {
+  if(!name) return mtev_false;
+  if(!strcasecmp(name, "ring")) *mode = MTEV_CHT_RING;
+  else if(!strcasecmp(name, "maglev")) *mode = MTEV_CHT_MAGLEV;
+  else if(!strcasecmp(name, "jump")) *mode = MTEV_CHT_JUMP;
+  else return mtev_false;
+  return mtev_true;
+}
 void
 mtev_cht_free(mtev_cht_t *cht) {
   mtev_cht_set_nodes(cht, 0, NULL);
+  free(cht->table);
   free(cht);
 }
 int
@@ -190,18 +336,60 @@ mtev_cht_set_nodes(mtev_cht_t *cht, int node_cnt, mtev_cht_node_t *nodes) {
   if(cht->nodes) free(cht->nodes);
 
   if(node_cnt < 0) node_cnt = 0;
-  if(cht->nbits < 32) while(node_cnt * cht->weight > (1 << cht->nbits)) node_cnt--;
+  if(cht->mode == MTEV_CHT_RING && cht->nbits < 32)
+    while(node_cnt * cht->weight > (1 << cht->nbits)) node_cnt--;
+  if(cht->mode == MTEV_CHT_MAGLEV && node_cnt > MAGLEV_EMPTY)
+    node_cnt = MAGLEV_EMPTY;
   cht->node_cnt = node_cnt;
   cht->nodes = nodes;
   if(cht->ring) free(cht->ring);
   cht->ring = NULL;
   if(node_cnt) {
-    cht->ring = calloc(node_cnt * cht->weight, sizeof(*cht->ring));
-    mtev_cht_calculate_ring(cht);
+    switch(cht->mode) {
+      case MTEV_CHT_MAGLEV:
+        mtev_cht_calculate_maglev(cht);
+        break;
+      case MTEV_CHT_JUMP:
+        for(i=0; i<node_cnt; i++) cht->nodes[i].owned = 1.0 / (double)node_cnt;
+        break;
+      default:
+        cht->ring = calloc(node_cnt * cht->weight, sizeof(*cht->ring));
+        mtev_cht_calculate_ring(cht);
+    }
   }
   return node_cnt;
 }
 
+/* Replicas are the distinct nodes found walking forward from the key's
+ * slot; the table is a well mixed permutation, so this is short. */
+static int
+mtev_cht_maglev_lookup_n(mtev_cht_t *cht, uint32_t hash, int w, int *found) {
+  uint32_t slot, i;
+  int w_out = 0;
+  slot = (uint32_t)(((uint64_t)hash * cht->table_size) >> 32);
+  for(i=0; w_out < w && i < cht->table_size; i++) {
+    int id = cht->table[slot];
+    if(iarrcontains(w_out, found, id) < 0) found[w_out++] = id;
+    if(++slot == cht->table_size) slot = 0;
+  }
+  return w_out;
+}
+
+/* The primary is plain jump hash; each further replica jumps again on a
+ * rehash of the key and probes past nodes already chosen. */
+static int
+mtev_cht_jump_lookup_n(mtev_cht_t *cht, uint32_t hash, int w, int *found) {
+  int r, w_out = 0;
+  for(r=0; r<w; r++) {
+    int id = mtev_cht_jump(mtev_cht_mix64(hash + ((uint64_t)r << 32)),
+                           cht->node_cnt);
+    while(iarrcontains(w_out, found, id) >= 0)
+      if(++id == cht->node_cnt) id = 0;
+    found[w_out++] = id;
+  }
+  return w_out;
+}
+
 int
 mtev_cht_vlookup_n(mtev_cht_t *cht, const void *key, size_t keylen,
                    int w, mtev_cht_node_t **nodes) {
@@ -213,6 +401,16 @@ mtev_cht_vlookup_n(mtev_cht_t *cht, const void *key, size_t keylen,
   if(w > CHT_MAX_W) w = CHT_MAX_W;
   if(w < 0) w = 0;
   if(cht->node_cnt < 1) return -1;
+  if(w > cht->node_cnt) w = cht->node_cnt;
+  if(cht->mode != MTEV_CHT_RING) {
+    hash = mtev_hash__hash(key, (uint32_t)keylen, CHT_INITVAL);
+    if(cht->mode == MTEV_CHT_MAGLEV)
+      w_out = mtev_cht_maglev_lookup_n(cht, hash, w, found);
+    else
+      w_out = mtev_cht_jump_lookup_n(cht, hash, w, found);
+    for(i=0;i<w_out;i++) nodes[i] = &cht->nodes[found[i]];
+    return w_out;
+  }
   hash = mtev_cht_hash(cht, key, keylen, CHT_INITVAL);
 
   /* binary search for the node */
@@ -232,13 +430,12 @@ mtev_cht_vlookup_n(mtev_cht_t *cht, const void *key, size_t keylen,
     mtevAssert(m == 0);
     m = rsize - 1;
   }
-  for(i=m;w_out < cht->node_cnt && i < rsize+m;i++) {
+  for(i=m;w_out < w && i < rsize+m;i++) {
     int id = cht->ring[i % rsize].node_idx;
     if(iarrcontains(w_out, found, id) < 0) {
       found[w_out++] = id;
     }
   }
-  found[w_out++] = cht->ring[m].node_idx;
   for(i=0;i<w && i<w_out;i++)
     nodes[i] = &cht->nodes[found[i]];
   return i;
@@ -35,6 +35,24 @@
 
 typedef struct mtev_cht mtev_cht_t;
 
+/*! \brief The placement algorithm backing an mtev_cht_t.
+
+    MTEV_CHT_RING is the classic ring of virtual nodes searched with a
+    binary search.  MTEV_CHT_MAGLEV fills a prime-sized lookup table from
+    per-node permutations (Maglev) giving O(1) lookups and near-minimal
+    disruption on membership changes regardless of node order.
+    MTEV_CHT_JUMP uses jump consistent hashing, which needs no table at all
+    but only moves a minimal set of keys when nodes are added to or removed
+    from the end of the node list; a change anywhere else moves most keys.
+    Clusters order their nodes by uuid, so they accept only "ring" and
+    "maglev" for their hashing attribute.
+ */
+typedef enum {
+  MTEV_CHT_RING = 0,
+  MTEV_CHT_MAGLEV,
+  MTEV_CHT_JUMP
+} mtev_cht_mode_t;
+
 typedef struct {
   /* Caller supplied */
   char *name;
@@ -48,6 +66,36 @@ typedef struct {
 API_EXPORT(mtev_cht_t *) mtev_cht_alloc();
 API_EXPORT(mtev_cht_t *)
   mtev_cht_alloc_custom(uint16_t vnodes_per_node, uint8_t nbits);
+/*! \fn mtev_cht_t *mtev_cht_alloc_mode(mtev_cht_mode_t mode)
+    \brief Allocate a consistent hash using a specific placement algorithm.
+    \param mode The algorithm to use.
+    \return A new, empty, mtev_cht_t.
+ */
+API_EXPORT(mtev_cht_t *) mtev_cht_alloc_mode(mtev_cht_mode_t mode);
+
+/*! \fn mtev_cht_mode_t mtev_cht_get_mode(mtev_cht_t *cht)
+    \brief Report the placement algorithm of a consistent hash.
+    \param cht The consistent hash.
+    \return The mode it was allocated with.
+ */
+API_EXPORT(mtev_cht_mode_t) mtev_cht_get_mode(mtev_cht_t *);
+
+/*! \fn const char *mtev_cht_mode_name(mtev_cht_mode_t mode)
+    \brief Name a placement algorithm.
+    \param mode The algorithm.
+    \return One of "ring", "maglev" or "jump".
+ */
+API_EXPORT(const char *) mtev_cht_mode_name(mtev_cht_mode_t);
+
+/*! \fn mtev_boolean mtev_cht_mode_from_name(const char *name, mtev_cht_mode_t *mode)
+    \brief Parse the name of a placement algorithm.
+    \param name One of "ring", "maglev" or "jump" (case insensitive).
+    \param mode Set to the parsed algorithm on success.
+    \return mtev_true if the name was recognized, mtev_false otherwise.
+ */
+API_EXPORT(mtev_boolean)
+  mtev_cht_mode_from_name(const char *, mtev_cht_mode_t *);
+
 API_EXPORT(void) mtev_cht_free(mtev_cht_t *);
 API_EXPORT(int)
   mtev_cht_set_nodes(mtev_cht_t *, int node_cnt, mtev_cht_node_t *nodes);
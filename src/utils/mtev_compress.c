@@ -1,18 +1,31 @@
 #include "mtev_compress.h"
 
 #include "mtev_log.h"
+#include "mtev_time.h"
+#include <ck_pr.h>
 #include <zlib.h>
 #include <lz4frame.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 #define GZIP_WINDOW_BITS 15
 #define GZIP_ENCODING 16
+#define ZLIB_DEFAULT_LEVEL 9
+#define ZSTD_DEFAULT_LEVEL 3
 
 struct mtev_stream_compress_ctx
 {
   mtev_compress_type type;
   mtev_boolean begun;
+  int level;
   LZ4F_compressionContext_t lz4_compress_ctx;
   z_stream zlib_compress_ctx;
+#ifdef HAVE_ZSTD
+  ZSTD_CStream *zstd_compress_ctx;
+  /* the frame is complete; ZSTD_endStream would start another */
+  mtev_boolean zstd_ended;
+#endif
 };
 
 struct mtev_stream_decompress_ctx
@@ -20,8 +33,84 @@ struct mtev_stream_decompress_ctx
   mtev_compress_type type;
   LZ4F_decompressionContext_t lz4_decompress_ctx;
   z_stream zlib_decompress_ctx;
+#ifdef HAVE_ZSTD
+  ZSTD_DStream *zstd_decompress_ctx;
+#endif
 };
 
+struct mtev_compress_dictionary
+{
+#ifdef HAVE_ZSTD
+  ZSTD_CDict *cdict;
+  ZSTD_DDict *ddict;
+#else
+  int unused;
+#endif
+};
+
+static mtev_compress_stats_t compress_stats[MTEV_COMPRESS_MAX];
+
+static inline void
+mtev_compress_account(mtev_compress_type type, size_t in, size_t out,
+                      mtev_hrtime_t start) {
+  mtev_compress_stats_t *s;
+  if(type <= MTEV_COMPRESS_NONE || type >= MTEV_COMPRESS_MAX) return;
+  s = &compress_stats[type];
+  ck_pr_add_64((uint64_t *)&s->bytes_in, in);
+  ck_pr_add_64((uint64_t *)&s->bytes_out, out);
+  ck_pr_add_64((uint64_t *)&s->ns, mtev_gethrtime() - start);
+}
+
+int
+mtev_compress_stats(mtev_compress_type type, mtev_compress_stats_t *stats)
+{
+  if(type < MTEV_COMPRESS_NONE || type >= MTEV_COMPRESS_MAX) return -1;
+  stats->bytes_in = ck_pr_load_64((uint64_t *)&compress_stats[type].bytes_in);
+  stats->bytes_out = ck_pr_load_64((uint64_t *)&compress_stats[type].bytes_out);
+  stats->ns = ck_pr_load_64((uint64_t *)&compress_stats[type].ns);
+  return 0;
+}
+
+const mtev_compress_stats_t *
+mtev_compress_stats_live(mtev_compress_type type)
+{
+  if(type < MTEV_COMPRESS_NONE || type >= MTEV_COMPRESS_MAX) return NULL;
+  return &compress_stats[type];
+}
+
+mtev_boolean
+mtev_compress_type_available(mtev_compress_type type)
+{
+  switch(type) {
+  case MTEV_COMPRESS_NONE:
+  case MTEV_COMPRESS_LZ4F:
+  case MTEV_COMPRESS_GZIP:
+  case MTEV_COMPRESS_DEFLATE:
+    return mtev_true;
+  case MTEV_COMPRESS_ZSTD:
+#ifdef HAVE_ZSTD
+    return mtev_true;
+#else
+    return mtev_false;
+#endif
+  default:
+    return mtev_false;
+  }
+}
+
+const char *
+mtev_compress_type_name(mtev_compress_type type)
+{
+  switch(type) {
+  case MTEV_COMPRESS_NONE: return "identity";
+  case MTEV_COMPRESS_LZ4F: return "lz4f";
+  case MTEV_COMPRESS_GZIP: return "gzip";
+  case MTEV_COMPRESS_DEFLATE: return "deflate";
+  case MTEV_COMPRESS_ZSTD: return "zstd";
+  default: return "unknown";
+  }
+}
+
 size_t
 mtev_compress_bound(mtev_compress_type type, size_t source_len)
 {
@@ -32,8 +121,16 @@ mtev_compress_bound(mtev_compress_type type, size_t source_len)
     return deflateBound(NULL, source_len);
   case MTEV_COMPRESS_DEFLATE:
     return compressBound(source_len);
+  case MTEV_COMPRESS_ZSTD:
+#ifdef HAVE_ZSTD
+    return ZSTD_compressBound(source_len);
+#else
+    return 0;
+#endif
   case MTEV_COMPRESS_NONE:
     return source_len;
+  default:
+    break;
   };
   return 0;
 }
@@ -146,10 +243,38 @@ mtev_compress_deflate(const char *data, size_t len, unsigned char **compressed,
   return err;
 }
 
-
 int
-mtev_compress(mtev_compress_type type, const char *data, size_t len, 
-              unsigned char **compressed, size_t *compressed_len)
+mtev_compress_zstd(const char *data, size_t len, unsigned char **compressed, size_t *compressed_len)
+{
+#ifdef HAVE_ZSTD
+  size_t max_compressed_len, rv;
+
+  max_compressed_len = ZSTD_compressBound(len);
+  *compressed = malloc(max_compressed_len);
+  if (*compressed == NULL) {
+    mtevL(mtev_error, "mtev_compress_zstd: Cannot allocate compression dest\n");
+    return -1;
+  }
+  rv = ZSTD_compress(*compressed, max_compressed_len, data, len, ZSTD_DEFAULT_LEVEL);
+  if (ZSTD_isError(rv)) {
+    mtevL(mtev_error, "mtev_compress_zstd: %s\n", ZSTD_getErrorName(rv));
+    free(*compressed);
+    *compressed = NULL;
+    return -1;
+  }
+  *compressed_len = rv;
+  return 0;
+#else
+  *compressed = NULL;
+  *compressed_len = 0;
+  mtevL(mtev_error, "mtev_compress_zstd: zstd support not compiled in\n");
+  return -1;
+#endif
+}
+
+static int
+_mtev_compress(mtev_compress_type type, const char *data, size_t len, 
+               unsigned char **compressed, size_t *compressed_len)
 {
   switch(type) {
   case MTEV_COMPRESS_LZ4F:
@@ -158,6 +283,8 @@ mtev_compress(mtev_compress_type type, const char *data, size_t len,
     return mtev_compress_gzip(data, len, compressed, compressed_len);
   case MTEV_COMPRESS_DEFLATE:
     return mtev_compress_deflate(data, len, compressed, compressed_len);
+  case MTEV_COMPRESS_ZSTD:
+    return mtev_compress_zstd(data, len, compressed, compressed_len);
   case MTEV_COMPRESS_NONE:
     {
       *compressed = malloc(len);
@@ -165,11 +292,23 @@ mtev_compress(mtev_compress_type type, const char *data, size_t len,
       memcpy(*compressed, data, len);
       return 0;
     }
+  default:
+    break;
   };
   /* unreached */
   return -1;
 }
 
+int
+mtev_compress(mtev_compress_type type, const char *data, size_t len, 
+              unsigned char **compressed, size_t *compressed_len)
+{
+  mtev_hrtime_t start = mtev_gethrtime();
+  int rv = _mtev_compress(type, data, len, compressed, compressed_len);
+  if(rv == 0) mtev_compress_account(type, len, *compressed_len, start);
+  return rv;
+}
+
 mtev_stream_compress_ctx_t *
 mtev_create_stream_compress_ctx()
 {
@@ -198,13 +337,22 @@ mtev_destroy_stream_decompress_ctx(mtev_stream_decompress_ctx_t *ctx)
 
 int
 mtev_stream_compress_init(mtev_stream_compress_ctx_t *ctx, mtev_compress_type type)
+{
+  return mtev_stream_compress_init_level(ctx, type, MTEV_COMPRESS_LEVEL_DEFAULT);
+}
+
+int
+mtev_stream_compress_init_level(mtev_stream_compress_ctx_t *ctx, mtev_compress_type type,
+                                int level)
 {
   memset(ctx, 0, sizeof(*ctx));
   ctx->type = type;
+  ctx->level = level;
   switch (type) {
   case MTEV_COMPRESS_GZIP:
     {
-      int err = deflateInit2(&ctx->zlib_compress_ctx, 9, Z_DEFLATED, GZIP_WINDOW_BITS | GZIP_ENCODING, 
+      if (level < 0 || level > 9) level = ZLIB_DEFAULT_LEVEL;
+      int err = deflateInit2(&ctx->zlib_compress_ctx, level, Z_DEFLATED, GZIP_WINDOW_BITS | GZIP_ENCODING, 
                              8, Z_DEFAULT_STRATEGY);
       if (err != Z_OK) {
         mtevL(mtev_error, "mtev_stream_compress_init: Error creating gzip compression context: %d\n", err);
@@ -224,6 +372,31 @@ mtev_stream_compress_init(mtev_stream_compress_ctx_t *ctx, mtev_compress_type ty
   case MTEV_COMPRESS_DEFLATE:
     /* deflate has no stream init */
     return 0;
+  case MTEV_COMPRESS_ZSTD:
+#ifdef HAVE_ZSTD
+    {
+      size_t rv;
+      if (level < 0) level = ZSTD_DEFAULT_LEVEL;
+      ctx->level = level;
+      ctx->zstd_compress_ctx = ZSTD_createCStream();
+      if (ctx->zstd_compress_ctx == NULL) {
+        mtevL(mtev_error, "mtev_stream_compress_init: Error creating zstd compression context\n");
+        return -1;
+      }
+      rv = ZSTD_initCStream(ctx->zstd_compress_ctx, level);
+      if (ZSTD_isError(rv)) {
+        mtevL(mtev_error, "mtev_stream_compress_init: Error initializing zstd stream: %s\n",
+              ZSTD_getErrorName(rv));
+        ZSTD_freeCStream(ctx->zstd_compress_ctx);
+        ctx->zstd_compress_ctx = NULL;
+        return -1;
+      }
+      return 0;
+    }
+#else
+    mtevL(mtev_error, "mtev_stream_compress_init: zstd support not compiled in\n");
+    return -1;
+#endif
   default:
     return -1;
   };
@@ -231,6 +404,55 @@ mtev_stream_compress_init(mtev_stream_compress_ctx_t *ctx, mtev_compress_type ty
   return -1;
 }
 
+mtev_compress_dictionary_t *
+mtev_compress_dictionary_create(const void *dict, size_t len, int level)
+{
+#ifdef HAVE_ZSTD
+  mtev_compress_dictionary_t *d = calloc(1, sizeof(*d));
+  if (level < 0) level = ZSTD_DEFAULT_LEVEL;
+  d->cdict = ZSTD_createCDict(dict, len, level);
+  d->ddict = ZSTD_createDDict(dict, len);
+  if (d->cdict == NULL || d->ddict == NULL) {
+    mtevL(mtev_error, "mtev_compress_dictionary_create: bad zstd dictionary\n");
+    mtev_compress_dictionary_destroy(d);
+    return NULL;
+  }
+  return d;
+#else
+  mtevL(mtev_error, "mtev_compress_dictionary_create: zstd support not compiled in\n");
+  return NULL;
+#endif
+}
+
+void
+mtev_compress_dictionary_destroy(mtev_compress_dictionary_t *dict)
+{
+  if (dict == NULL) return;
+#ifdef HAVE_ZSTD
+  if (dict->cdict) ZSTD_freeCDict(dict->cdict);
+  if (dict->ddict) ZSTD_freeDDict(dict->ddict);
+#endif
+  free(dict);
+}
+
+int
+mtev_stream_compress_set_dictionary(mtev_stream_compress_ctx_t *ctx,
+                                    mtev_compress_dictionary_t *dict)
+{
+#ifdef HAVE_ZSTD
+  size_t rv;
+  if (ctx->type != MTEV_COMPRESS_ZSTD || ctx->begun || dict == NULL) return -1;
+  rv = ZSTD_initCStream_usingCDict(ctx->zstd_compress_ctx, dict->cdict);
+  if (ZSTD_isError(rv)) {
+    mtevL(mtev_error, "mtev_stream_compress_set_dictionary: %s\n", ZSTD_getErrorName(rv));
+    return -1;
+  }
+  return 0;
+#else
+  return -1;
+#endif
+}
+
 static int
 mtev_stream_compress_lz4f(mtev_stream_compress_ctx_t *ctx, const char *source_data,
                           size_t *source_len, unsigned char *out, size_t *out_len)
@@ -283,9 +505,32 @@ mtev_stream_compress_gzip(mtev_stream_compress_ctx_t *ctx, const char *source_da
   return 0;
 }
 
-int  
-mtev_stream_compress(mtev_stream_compress_ctx_t *ctx, const char *source_data, 
-                     size_t *len, unsigned char *out, size_t *out_len)
+#ifdef HAVE_ZSTD
+static int
+mtev_stream_compress_zstd(mtev_stream_compress_ctx_t *ctx, const char *source_data,
+                          size_t *source_len, unsigned char *out, size_t *out_len)
+{
+  ZSTD_inBuffer in = { source_data, *source_len, 0 };
+  ZSTD_outBuffer o = { out, *out_len, 0 };
+  size_t rv;
+
+  ctx->begun = mtev_true;
+  rv = ZSTD_compressStream(ctx->zstd_compress_ctx, &o, &in);
+  if (ZSTD_isError(rv)) {
+    mtevL(mtev_error, "mtev_stream_compress_zstd: error compressing: %s\n",
+          ZSTD_getErrorName(rv));
+    return -1;
+  }
+  /* like gzip, the len is left holding what wasn't consumed */
+  *source_len = in.size - in.pos;
+  *out_len = o.pos;
+  return 0;
+}
+#endif
+
+static int
+_mtev_stream_compress(mtev_stream_compress_ctx_t *ctx, const char *source_data, 
+                      size_t *len, unsigned char *out, size_t *out_len)
 {
   switch (ctx->type) {
   case MTEV_COMPRESS_LZ4F:
@@ -298,6 +543,10 @@ mtev_stream_compress(mtev_stream_compress_ctx_t *ctx, const char *source_data,
       *len = 0;
       return x;
     }
+#ifdef HAVE_ZSTD
+  case MTEV_COMPRESS_ZSTD:
+    return mtev_stream_compress_zstd(ctx, source_data, len, out, out_len);
+#endif
   case MTEV_COMPRESS_NONE:
     {
       if (*out_len < *len) {
@@ -315,6 +564,18 @@ mtev_stream_compress(mtev_stream_compress_ctx_t *ctx, const char *source_data,
   return -1;
 }
 
+int  
+mtev_stream_compress(mtev_stream_compress_ctx_t *ctx, const char *source_data, 
+                     size_t *len, unsigned char *out, size_t *out_len)
+{
+  mtev_hrtime_t start = mtev_gethrtime();
+  size_t in_len = *len;
+  int rv = _mtev_stream_compress(ctx, source_data, len, out, out_len);
+  /* for gzip and zstd, *len is what's left over */
+  if (rv == 0) mtev_compress_account(ctx->type, in_len - *len, *out_len, start);
+  return rv;
+}
+
 static int
 mtev_stream_compress_flush_lz4f(mtev_stream_compress_ctx_t *ctx, 
                                 unsigned char *out, size_t *out_len)
@@ -359,15 +620,51 @@ mtev_stream_compress_flush_gzip(mtev_stream_compress_ctx_t *ctx,
   return 0;
 }
 
-int
-mtev_stream_compress_flush(mtev_stream_compress_ctx_t *ctx, 
-                           unsigned char *out, size_t *out_len)
+#ifdef HAVE_ZSTD
+static int
+mtev_stream_compress_flush_zstd(mtev_stream_compress_ctx_t *ctx, 
+                                unsigned char *out, size_t *out_len)
+{
+  ZSTD_outBuffer o = { out, *out_len, 0 };
+  size_t rv;
+
+  if (ctx->begun == mtev_false) {
+    return -1;
+  }
+  if (ctx->zstd_ended) {
+    *out_len = 0;
+    return 0;
+  }
+  /* ZSTD_endStream returns the amount still left to flush; repeated
+   * calls with fresh output space drain it.  Once it reaches 0 the frame
+   * is done, and calling it again would emit a new, empty frame, so we
+   * stop there and report nothing more to flush.
+   */
+  rv = ZSTD_endStream(ctx->zstd_compress_ctx, &o);
+  if (ZSTD_isError(rv)) {
+    mtevL(mtev_error, "mtev_stream_compress_flush_zstd: flush failed %s\n",
+          ZSTD_getErrorName(rv));
+    return -1;
+  }
+  if (rv == 0) ctx->zstd_ended = mtev_true;
+  *out_len = o.pos;
+  return 0;
+}
+#endif
+
+static int
+_mtev_stream_compress_flush(mtev_stream_compress_ctx_t *ctx, 
+                            unsigned char *out, size_t *out_len)
 {
   switch(ctx->type) {
   case MTEV_COMPRESS_LZ4F:
     return mtev_stream_compress_flush_lz4f(ctx, out, out_len);
   case MTEV_COMPRESS_GZIP:
     return mtev_stream_compress_flush_gzip(ctx, out, out_len);
+#ifdef HAVE_ZSTD
+  case MTEV_COMPRESS_ZSTD:
+    return mtev_stream_compress_flush_zstd(ctx, out, out_len);
+#endif
   case MTEV_COMPRESS_DEFLATE:
   case MTEV_COMPRESS_NONE:
     return 0;
@@ -377,6 +674,16 @@ mtev_stream_compress_flush(mtev_stream_compress_ctx_t *ctx,
   return -1;
 }
 
+int
+mtev_stream_compress_flush(mtev_stream_compress_ctx_t *ctx, 
+                           unsigned char *out, size_t *out_len)
+{
+  mtev_hrtime_t start = mtev_gethrtime();
+  int rv = _mtev_stream_compress_flush(ctx, out, out_len);
+  if (rv == 0) mtev_compress_account(ctx->type, 0, *out_len, start);
+  return rv;
+}
+
 int
 mtev_stream_compress_finish_lz4f(mtev_stream_compress_ctx_t *ctx)
 {
@@ -410,6 +717,12 @@ mtev_stream_compress_finish(mtev_stream_compress_ctx_t *ctx)
     return mtev_stream_compress_finish_lz4f(ctx);
   case MTEV_COMPRESS_GZIP:
     return mtev_stream_compress_finish_gzip(ctx);
+#ifdef HAVE_ZSTD
+  case MTEV_COMPRESS_ZSTD:
+    ZSTD_freeCStream(ctx->zstd_compress_ctx);
+    ctx->zstd_compress_ctx = NULL;
+    return 0;
+#endif
   case MTEV_COMPRESS_DEFLATE:
   case MTEV_COMPRESS_NONE:
     return 0;
@@ -445,12 +758,50 @@ mtev_stream_decompress_init(mtev_stream_decompress_ctx_t *ctx,
       }      
       return 0;
     }
+#ifdef HAVE_ZSTD
+  case MTEV_COMPRESS_ZSTD:
+    {
+      size_t rv;
+      ctx->zstd_decompress_ctx = ZSTD_createDStream();
+      if (ctx->zstd_decompress_ctx == NULL) {
+        mtevL(mtev_error, "mtev_stream_decompress_init: error creating zstd decompression context\n");
+        return -1;
+      }
+      rv = ZSTD_initDStream(ctx->zstd_decompress_ctx);
+      if (ZSTD_isError(rv)) {
+        mtevL(mtev_error, "mtev_stream_decompress_init: zstd error: %s\n",
+              ZSTD_getErrorName(rv));
+        ZSTD_freeDStream(ctx->zstd_decompress_ctx);
+        ctx->zstd_decompress_ctx = NULL;
+        return -1;
+      }
+      return 0;
+    }
+#endif
   default:
     return -1;
   };
   return -1;
 }
 
+int
+mtev_stream_decompress_set_dictionary(mtev_stream_decompress_ctx_t *ctx,
+                                      mtev_compress_dictionary_t *dict)
+{
+#ifdef HAVE_ZSTD
+  size_t rv;
+  if (ctx->type != MTEV_COMPRESS_ZSTD || dict == NULL) return -1;
+  rv = ZSTD_initDStream_usingDDict(ctx->zstd_decompress_ctx, dict->ddict);
+  if (ZSTD_isError(rv)) {
+    mtevL(mtev_error, "mtev_stream_decompress_set_dictionary: %s\n", ZSTD_getErrorName(rv));
+    return -1;
+  }
+  return 0;
+#else
+  return -1;
+#endif
+}
+
 static int
 mtev_stream_decompress_lz4f(mtev_stream_decompress_ctx_t *ctx, 
                             const unsigned char *compressed,
@@ -506,6 +857,27 @@ mtev_stream_decompress_gzip(mtev_stream_decompress_ctx_t *ctx,
   return 0;
 }
 
+#ifdef HAVE_ZSTD
+static int
+mtev_stream_decompress_zstd(mtev_stream_decompress_ctx_t *ctx, 
+                            const unsigned char *compressed,
+                            size_t *compressed_len,
+                            unsigned char *decompressed,
+                            size_t *decompressed_len)
+{
+  ZSTD_inBuffer in = { compressed, *compressed_len, 0 };
+  ZSTD_outBuffer out = { decompressed, *decompressed_len, 0 };
+  size_t rv = ZSTD_decompressStream(ctx->zstd_decompress_ctx, &out, &in);
+  if (ZSTD_isError(rv)) {
+    mtevL(mtev_error, "mtev_stream_decompress_zstd: error decompressing: %s\n",
+          ZSTD_getErrorName(rv));
+    return -1;
+  }
+  *compressed_len = in.pos;
+  *decompressed_len = out.pos;
+  return 0;
+}
+#endif
 
 int
 mtev_stream_decompress(mtev_stream_decompress_ctx_t *ctx, 
@@ -521,6 +893,11 @@ mtev_stream_decompress(mtev_stream_decompress_ctx_t *ctx,
   case MTEV_COMPRESS_GZIP:
     return mtev_stream_decompress_gzip(ctx, compressed, compressed_len,
                                        decompressed, decompressed_len);
+#ifdef HAVE_ZSTD
+  case MTEV_COMPRESS_ZSTD:
+    return mtev_stream_decompress_zstd(ctx, compressed, compressed_len,
+                                       decompressed, decompressed_len);
+#endif
   default:
     return -1;
   };
@@ -537,6 +914,12 @@ mtev_stream_decompress_finish(mtev_stream_decompress_ctx_t *ctx)
   case MTEV_COMPRESS_GZIP:
     inflateEnd(&ctx->zlib_decompress_ctx);
     break;
+#ifdef HAVE_ZSTD
+  case MTEV_COMPRESS_ZSTD:
+    ZSTD_freeDStream(ctx->zstd_decompress_ctx);
+    ctx->zstd_decompress_ctx = NULL;
+    break;
+#endif
   default:
     return 0;
   };
@@ -38,11 +38,26 @@ typedef enum {
   MTEV_COMPRESS_NONE = 0,
   MTEV_COMPRESS_LZ4F,
   MTEV_COMPRESS_GZIP,
-  MTEV_COMPRESS_DEFLATE
+  MTEV_COMPRESS_DEFLATE,
+  MTEV_COMPRESS_ZSTD,
+  MTEV_COMPRESS_MAX /* not a type, the number of types */
 } mtev_compress_type;
 
+/* Use the algorithm's default level (gzip/deflate 9, zstd 3) */
+#define MTEV_COMPRESS_LEVEL_DEFAULT -1
+
 typedef struct mtev_stream_compress_ctx mtev_stream_compress_ctx_t;
 typedef struct mtev_stream_decompress_ctx mtev_stream_decompress_ctx_t;
+typedef struct mtev_compress_dictionary mtev_compress_dictionary_t;
+
+/* Running totals for an algorithm, across all threads.  The compression
+ * ratio is bytes_in/bytes_out and the cost is ns/bytes_in.
+ */
+typedef struct {
+  int64_t bytes_in;
+  int64_t bytes_out;
+  int64_t ns;
+} mtev_compress_stats_t;
 
 /**
  * @return worst case destination size for source_len
@@ -100,6 +115,49 @@ API_EXPORT(int)
   mtev_compress_deflate(const char *data, size_t len, unsigned char **compressed, size_t *compressed_len);
 
 
+/**
+ * Will zstd compress 'data' of size 'len' and fill 'compressed' with the
+ * compressed version after it allocates space.  'compressed_len' will
+ * hold the new length.
+ *
+ * It is up to caller to free compressed data;
+ *
+ * Comparable or better ratios than gzip at a fraction of the CPU.  Only
+ * available if libmtev was built with zstd support.
+ *
+ * @return 0 on success
+ * @return non-zero on error
+ */
+API_EXPORT(int)
+  mtev_compress_zstd(const char *data, size_t len, unsigned char **compressed, size_t *compressed_len);
+
+/**
+ * @return true if the compression type is supported by this build
+ */
+API_EXPORT(mtev_boolean)
+  mtev_compress_type_available(mtev_compress_type type);
+
+/**
+ * @return the name of the type as used in Content-Encoding ("gzip", "zstd", ...)
+ */
+API_EXPORT(const char *)
+  mtev_compress_type_name(mtev_compress_type type);
+
+/**
+ * Copy out the running totals for a compression type.
+ *
+ * @return 0 on success, non-zero if the type is unknown
+ */
+API_EXPORT(int)
+  mtev_compress_stats(mtev_compress_type type, mtev_compress_stats_t *stats);
+
+/**
+ * @return a pointer to the live counters for a type, suitable for
+ * exposing as read-only stats.  NULL if the type is unknown.
+ */
+API_EXPORT(const mtev_compress_stats_t *)
+  mtev_compress_stats_live(mtev_compress_type type);
+
 /** 
  * Wrapper function for the above.  If you pass MTEV_COMPRESS_NONE as type, 
  * this is effectively an allocation and memcpy.
@@ -139,6 +197,54 @@ API_EXPORT(void)
 API_EXPORT(int)
   mtev_stream_compress_init(mtev_stream_compress_ctx_t *ctx, mtev_compress_type type);
 
+/**
+ * Like mtev_stream_compress_init, but at a specific compression level
+ * (MTEV_COMPRESS_LEVEL_DEFAULT for the algorithm default).  Ignored by
+ * lz4f.
+ *
+ * @return 0 on success, non-zero on error
+ */
+API_EXPORT(int)
+  mtev_stream_compress_init_level(mtev_stream_compress_ctx_t *ctx,
+                                  mtev_compress_type type, int level);
+
+/**
+ * Build a zstd dictionary (e.g. the output of `zstd --train` over sample
+ * payloads) for use by both sides of a stream.  The compression level is
+ * fixed when the dictionary is built.  Both peers must agree on the
+ * dictionary out of band, so it is never used for HTTP content encoding.
+ *
+ * @return a dictionary or NULL on error (or if zstd is unavailable)
+ */
+API_EXPORT(mtev_compress_dictionary_t *)
+  mtev_compress_dictionary_create(const void *dict, size_t len, int level);
+
+/**
+ * Free a dictionary; no stream may still be using it.
+ */
+API_EXPORT(void)
+  mtev_compress_dictionary_destroy(mtev_compress_dictionary_t *dict);
+
+/**
+ * Use a dictionary for a zstd compression stream.  Must be called after
+ * init and before any data is compressed.
+ *
+ * @return 0 on success, non-zero on error
+ */
+API_EXPORT(int)
+  mtev_stream_compress_set_dictionary(mtev_stream_compress_ctx_t *ctx,
+                                      mtev_compress_dictionary_t *dict);
+
+/**
+ * Use a dictionary for a zstd decompression stream.  Must be called after
+ * init and before any data is decompressed.
+ *
+ * @return 0 on success, non-zero on error
+ */
+API_EXPORT(int)
+  mtev_stream_decompress_set_dictionary(mtev_stream_decompress_ctx_t *ctx,
+                                        mtev_compress_dictionary_t *dict);
+
 /**
  * To be called multiple times to compress a stream of data.  You must first call
  * mtev_stream_compress_init to initialize the stream compression structure
@@ -154,7 +260,8 @@ API_EXPORT(int)
 
 /**
  * Flush any internal data cached during the stream compress.  You might
- * have to call repeatedly until out_len contains zero.
+ * have to call repeatedly until out_len contains zero; once it has, later
+ * flushes keep reporting zero.
  * 
  * @return 0 on success, non-zero on error
  */
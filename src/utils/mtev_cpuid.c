@@ -48,7 +48,7 @@ enum {
 };
 
 static inline void
-mtev_cpuid(struct cpuid *r, uint32_t eax)
+mtev_cpuid_count(struct cpuid *r, uint32_t eax, uint32_t ecx)
 {
 
   __asm__ __volatile__("cpuid"
@@ -56,12 +56,32 @@ mtev_cpuid(struct cpuid *r, uint32_t eax)
                          "=b" (r->ebx),
                          "=c" (r->ecx),
                          "=d" (r->edx)
-                       : "a"  (eax)
+                       : "a"  (eax), "c" (ecx)
                        : "memory");
 
   return;
 }
 
+static inline void
+mtev_cpuid(struct cpuid *r, uint32_t eax)
+{
+  mtev_cpuid_count(r, eax, 0);
+}
+
+/* AVX state must be enabled by the OS (XCR0 bits 1 and 2) to be usable. */
+static inline mtev_boolean
+mtev_os_saves_ymm(void)
+{
+  struct cpuid id;
+  uint32_t xcr0_lo, xcr0_hi;
+
+  mtev_cpuid(&id, 1);
+  if ((id.ecx & BIT(27)) == 0) /* OSXSAVE */
+    return mtev_false;
+  __asm__ __volatile__("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+  return (xcr0_lo & 0x6) == 0x6 ? mtev_true : mtev_false;
+}
+
 static inline int
 mtev_cpu_vendor() 
 {
@@ -110,5 +130,19 @@ mtev_cpuid_feature(int feature)
 
     return (id.edx & BIT(27)) != 0 ? mtev_true : mtev_false;
   }
+
+  if (feature == MTEV_CPU_FEATURE_SSSE3) {
+    mtev_cpuid(&id, 1);
+    return (id.ecx & BIT(9)) != 0 ? mtev_true : mtev_false;
+  }
+
+  if (feature == MTEV_CPU_FEATURE_AVX2) {
+    mtev_cpuid(&id, 0);
+    if (id.eax < 7 || !mtev_os_saves_ymm()) {
+      return mtev_false;
+    }
+    mtev_cpuid_count(&id, 7, 0);
+    return (id.ebx & BIT(5)) != 0 ? mtev_true : mtev_false;
+  }
   return mtev_false;
 }
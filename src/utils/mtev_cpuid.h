@@ -38,6 +38,8 @@ enum {
   MTEV_CPU_FEATURE_RDTSC,
   MTEV_CPU_FEATURE_RDTSCP,
   MTEV_CPU_FEATURE_INVARIANT_TSC,
+  MTEV_CPU_FEATURE_SSSE3,
+  MTEV_CPU_FEATURE_AVX2,
   MTEV_CPU_FEATURE_LENGTH
 };
 
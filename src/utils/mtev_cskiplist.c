@@ -0,0 +1,365 @@
+/*
+ * Copyright (c) 2017, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name Circonus, Inc. nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "mtev_defines.h"
+#include "mtev_cskiplist.h"
+#include "mtev_memory.h"
+#include <ck_pr.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* This is the Herlihy/Shavit lock-free skiplist: the low bit of a next
+ * pointer marks the node owning it as deleted at that level.  A node is
+ * logically removed once its level 0 pointer is marked; any thread that
+ * walks past a marked node unlinks it.
+ *
+ * A node can be linked into an upper level by a slow inserter after its
+ * remover has already swept it out, so both the inserter and the remover
+ * hold a reference and each sweeps the node out before dropping theirs.
+ * The last one returns the node to mtev_memory.
+ */
+
+#define CSL_MAX_HEIGHT 32
+
+#define CSL_MARKED(p) (((uintptr_t)(p)) & 1)
+#define CSL_MARK(p) ((mtev_cskiplist_node_t *)(((uintptr_t)(p)) | 1))
+#define CSL_UNMARK(p) ((mtev_cskiplist_node_t *)(((uintptr_t)(p)) & ~(uintptr_t)1))
+
+struct mtev_cskiplist_node {
+  void *data;
+  uint32_t refs;
+  uint32_t height;
+  mtev_cskiplist_node_t *next[];
+};
+
+struct mtev_cskiplist {
+  mtev_skiplist_comparator_t compare;
+  mtev_skiplist_comparator_t comparek;
+  int size;
+  mtev_cskiplist_node_t *head;
+};
+
+static __thread uint64_t csl_rand_state;
+
+static int
+csl_random_height(void) {
+  uint64_t x = csl_rand_state;
+  if(x == 0) x = ((uint64_t)(uintptr_t)&csl_rand_state * 0x9e3779b97f4a7c15ULL) | 1;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  csl_rand_state = x;
+  /* geometric, p = 1/2 */
+  return __builtin_ctzll(x | (1ULL << (CSL_MAX_HEIGHT - 1))) + 1;
+}
+
+static inline mtev_cskiplist_node_t *
+csl_next(mtev_cskiplist_node_t *node, int level) {
+  return ck_pr_load_ptr(&node->next[level]);
+}
+
+/* The first successor of node at level that is not being removed. */
+static inline mtev_cskiplist_node_t *
+csl_live_next(mtev_cskiplist_node_t *node, int level) {
+  mtev_cskiplist_node_t *n = CSL_UNMARK(csl_next(node, level)), *s;
+  while(n && CSL_MARKED(s = csl_next(n, level))) n = CSL_UNMARK(s);
+  return n;
+}
+
+/* Locate key on every level, unlinking marked nodes along the way.  When
+ * target is given, equal nodes other than target are stepped over so that
+ * target itself is reached (and swept out if marked).
+ */
+static int
+csl_find(mtev_cskiplist_t *sl, const void *key, mtev_skiplist_comparator_t cmp,
+         mtev_cskiplist_node_t *target,
+         mtev_cskiplist_node_t **preds, mtev_cskiplist_node_t **succs) {
+  mtev_cskiplist_node_t *pred, *curr, *succ;
+  int level, c = -1;
+
+ retry:
+  pred = sl->head;
+  for(level = CSL_MAX_HEIGHT - 1; level >= 0; level--) {
+    curr = CSL_UNMARK(csl_next(pred, level));
+    while(curr) {
+      succ = csl_next(curr, level);
+      while(CSL_MARKED(succ)) {
+        if(!ck_pr_cas_ptr(&pred->next[level], curr, CSL_UNMARK(succ))) goto retry;
+        curr = CSL_UNMARK(succ);
+        if(!curr) break;
+        succ = csl_next(curr, level);
+      }
+      if(!curr) break;
+      c = cmp(key, curr->data);
+      if(c < 0 || (c == 0 && (!target || curr == target))) break;
+      pred = curr;
+      curr = CSL_UNMARK(succ);
+    }
+    preds[level] = pred;
+    succs[level] = curr;
+  }
+  return succs[0] != NULL && c == 0;
+}
+
+/* Read-only search: the first live node not ordered before key, and the
+ * last node ordered before it.  Never writes shared memory.
+ */
+static mtev_cskiplist_node_t *
+csl_search(mtev_cskiplist_t *sl, const void *key, mtev_cskiplist_node_t **predp,
+           int *cp) {
+  mtev_cskiplist_node_t *pred = sl->head, *curr = NULL;
+  int level, c = -1;
+
+  for(level = CSL_MAX_HEIGHT - 1; level >= 0; level--) {
+    curr = csl_live_next(pred, level);
+    while(curr) {
+      c = sl->comparek(key, curr->data);
+      if(c <= 0) break;
+      pred = curr;
+      curr = csl_live_next(curr, level);
+    }
+  }
+  if(predp) *predp = (pred == sl->head) ? NULL : pred;
+  if(cp) *cp = curr ? c : -1;
+  return curr;
+}
+
+static void
+csl_release(mtev_cskiplist_node_t *node) {
+  bool zero;
+  ck_pr_dec_32_zero(&node->refs, &zero);
+  if(zero) mtev_memory_safe_free(node);
+}
+
+static int
+csl_delete(mtev_cskiplist_t *sl, mtev_cskiplist_node_t *victim,
+           mtev_freefunc_t myfree) {
+  mtev_cskiplist_node_t *preds[CSL_MAX_HEIGHT], *succs[CSL_MAX_HEIGHT], *succ;
+  int level;
+
+  for(level = victim->height - 1; level >= 1; level--) {
+    succ = csl_next(victim, level);
+    while(!CSL_MARKED(succ)) {
+      if(ck_pr_cas_ptr_value(&victim->next[level], succ, CSL_MARK(succ), &succ))
+        break;
+    }
+  }
+  succ = csl_next(victim, 0);
+  for(;;) {
+    if(CSL_MARKED(succ)) return 0; /* someone else removed it */
+    if(ck_pr_cas_ptr_value(&victim->next[0], succ, CSL_MARK(succ), &succ))
+      break;
+  }
+  ck_pr_dec_int(&sl->size);
+  csl_find(sl, victim->data, sl->compare, victim, preds, succs);
+  if(myfree) mtev_memory_defer_free(victim->data, myfree);
+  csl_release(victim);
+  return 1;
+}
+
+mtev_cskiplist_t *
+mtev_cskiplist_alloc(mtev_skiplist_comparator_t compare,
+                     mtev_skiplist_comparator_t comparek) {
+  mtev_cskiplist_t *sl = calloc(1, sizeof(*sl));
+  sl->compare = compare;
+  sl->comparek = comparek;
+  sl->head = calloc(1, sizeof(*sl->head) +
+                       CSL_MAX_HEIGHT * sizeof(mtev_cskiplist_node_t *));
+  sl->head->height = CSL_MAX_HEIGHT;
+  return sl;
+}
+
+void
+mtev_cskiplist_destroy(mtev_cskiplist_t *sl, mtev_freefunc_t myfree) {
+  mtev_cskiplist_node_t *node, *next;
+  if(!sl) return;
+  for(node = CSL_UNMARK(sl->head->next[0]); node; node = next) {
+    next = CSL_UNMARK(node->next[0]);
+    if(myfree && !CSL_MARKED(node->next[0])) myfree(node->data);
+    mtev_memory_safe_free(node);
+  }
+  free(sl->head);
+  free(sl);
+}
+
+int
+mtev_cskiplist_size(mtev_cskiplist_t *sl) {
+  return ck_pr_load_int(&sl->size);
+}
+
+mtev_boolean
+mtev_cskiplist_insert(mtev_cskiplist_t *sl, const void *data) {
+  mtev_cskiplist_node_t *preds[CSL_MAX_HEIGHT], *succs[CSL_MAX_HEIGHT];
+  mtev_cskiplist_node_t *node = NULL, *old;
+  int i, height = csl_random_height();
+
+  mtev_memory_begin();
+  for(;;) {
+    if(csl_find(sl, data, sl->compare, NULL, preds, succs)) {
+      if(node) mtev_memory_safe_free(node);
+      mtev_memory_end();
+      return mtev_false;
+    }
+    if(!node) {
+      node = mtev_memory_safe_malloc(sizeof(*node) +
+                                     height * sizeof(mtev_cskiplist_node_t *));
+      node->data = (void *)data;
+      node->refs = 2; /* ours until linked, and the list's */
+      node->height = height;
+    }
+    for(i = 0; i < height; i++) node->next[i] = succs[i];
+    ck_pr_fence_store();
+    if(ck_pr_cas_ptr(&preds[0]->next[0], succs[0], node)) break;
+  }
+  ck_pr_inc_int(&sl->size);
+
+  for(i = 1; i < height; i++) {
+    for(;;) {
+      old = csl_next(node, i);
+      if(CSL_MARKED(old)) goto done;
+      /* only a remover marking this level can make this fail */
+      if(old != succs[i] && !ck_pr_cas_ptr(&node->next[i], old, succs[i]))
+        goto done;
+      if(ck_pr_cas_ptr(&preds[i]->next[i], succs[i], node)) break;
+      csl_find(sl, data, sl->compare, node, preds, succs);
+    }
+  }
+ done:
+  /* A remover may have swept before we finished linking; sweep again. */
+  if(CSL_MARKED(csl_next(node, 0)))
+    csl_find(sl, data, sl->compare, node, preds, succs);
+  csl_release(node);
+  mtev_memory_end();
+  return mtev_true;
+}
+
+int
+mtev_cskiplist_remove(mtev_cskiplist_t *sl, const void *key,
+                      mtev_freefunc_t myfree) {
+  mtev_cskiplist_node_t *node;
+  int c, rv = 0;
+  mtev_memory_begin();
+  node = csl_search(sl, key, NULL, &c);
+  if(node && c == 0) rv = csl_delete(sl, node, myfree);
+  mtev_memory_end();
+  return rv;
+}
+
+int
+mtev_cskiplist_remove_node(mtev_cskiplist_t *sl, mtev_cskiplist_node_t *node,
+                           mtev_freefunc_t myfree) {
+  int rv;
+  mtev_memory_begin();
+  rv = csl_delete(sl, node, myfree);
+  mtev_memory_end();
+  return rv;
+}
+
+void *
+mtev_cskiplist_find(mtev_cskiplist_t *sl, const void *key,
+                    mtev_cskiplist_node_t **iter) {
+  return mtev_cskiplist_find_neighbors(sl, key, iter, NULL, NULL);
+}
+
+void *
+mtev_cskiplist_find_neighbors(mtev_cskiplist_t *sl, const void *key,
+                              mtev_cskiplist_node_t **iter,
+                              mtev_cskiplist_node_t **prev,
+                              mtev_cskiplist_node_t **next) {
+  mtev_cskiplist_node_t *node, *pred;
+  int c;
+  node = csl_search(sl, key, &pred, &c);
+  if(prev) *prev = pred;
+  if(node && c == 0) {
+    if(iter) *iter = node;
+    if(next) *next = csl_live_next(node, 0);
+    return node->data;
+  }
+  if(iter) *iter = NULL;
+  if(next) *next = node;
+  return NULL;
+}
+
+mtev_cskiplist_node_t *
+mtev_cskiplist_seek(mtev_cskiplist_t *sl, const void *key) {
+  if(key == NULL) return csl_live_next(sl->head, 0);
+  return csl_search(sl, key, NULL, NULL);
+}
+
+mtev_cskiplist_node_t *
+mtev_cskiplist_next(mtev_cskiplist_t *sl, mtev_cskiplist_node_t *node) {
+  if(!node) return NULL;
+  return csl_live_next(node, 0);
+}
+
+void *
+mtev_cskiplist_data(mtev_cskiplist_node_t *node) {
+  return node ? node->data : NULL;
+}
+
+int
+mtev_cskiplist_range(mtev_cskiplist_t *sl, const void *lo, const void *hi,
+                     int (*f)(void *data, void *closure), void *closure) {
+  mtev_cskiplist_node_t *node;
+  int cnt = 0;
+  mtev_memory_begin();
+  for(node = mtev_cskiplist_seek(sl, lo); node; node = csl_live_next(node, 0)) {
+    if(hi && sl->comparek(hi, node->data) < 0) break;
+    cnt++;
+    if(!f(node->data, closure)) break;
+  }
+  mtev_memory_end();
+  return cnt;
+}
+
+void *
+mtev_cskiplist_peek(mtev_cskiplist_t *sl) {
+  mtev_cskiplist_node_t *node;
+  void *data;
+  mtev_memory_begin();
+  node = csl_live_next(sl->head, 0);
+  data = node ? node->data : NULL;
+  mtev_memory_end();
+  return data;
+}
+
+void *
+mtev_cskiplist_pop(mtev_cskiplist_t *sl, mtev_freefunc_t myfree) {
+  mtev_cskiplist_node_t *node;
+  void *data = NULL;
+  mtev_memory_begin();
+  while((node = csl_live_next(sl->head, 0)) != NULL) {
+    data = node->data;
+    if(csl_delete(sl, node, myfree)) break;
+    data = NULL;
+  }
+  mtev_memory_end();
+  return data;
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2017, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name Circonus, Inc. nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _UTILS_MTEV_CSKIPLIST_H
+#define _UTILS_MTEV_CSKIPLIST_H
+
+#include "mtev_defines.h"
+#include "mtev_skiplist.h"
+
+/* A concurrent, ordered skiplist.
+ *
+ * Inserts and removals are lock-free (compare-and-swap on marked next
+ * pointers) and lookups never write shared memory.  Each node is a single
+ * allocation holding its data pointer and a tower of next pointers whose
+ * height is chosen at insert.  Unlinked nodes are reclaimed through
+ * mtev_memory epochs, so nodes and data found by one thread remain valid
+ * until that thread leaves its mtev_memory_begin()/mtev_memory_end()
+ * section even if another thread removes them.
+ *
+ * Ordering uses the same comparator pair as mtev_skiplist: `compare`
+ * orders two data items and `comparek` orders a key against a data item.
+ * Keys are unique; secondary indexes are not supported (keep a second list
+ * ordered by another comparator instead).  Iteration is forward only.
+ *
+ * The node-returning functions must be called, and their results used,
+ * inside an mtev_memory_begin()/mtev_memory_end() section.
+ */
+
+typedef struct mtev_cskiplist mtev_cskiplist_t;
+typedef struct mtev_cskiplist_node mtev_cskiplist_node_t;
+
+/*! \fn mtev_cskiplist_t *mtev_cskiplist_alloc(mtev_skiplist_comparator_t compare, mtev_skiplist_comparator_t comparek)
+    \brief Allocate an empty concurrent skiplist.
+    \param compare orders two data items (used on insert)
+    \param comparek orders a key against a data item (used on find/remove)
+    \return a new skiplist
+ */
+API_EXPORT(mtev_cskiplist_t *)
+  mtev_cskiplist_alloc(mtev_skiplist_comparator_t compare,
+                       mtev_skiplist_comparator_t comparek);
+
+/*! \fn void mtev_cskiplist_destroy(mtev_cskiplist_t *sl, mtev_freefunc_t myfree)
+    \brief Free a skiplist and, optionally, its data.
+    \param sl the skiplist, which no other thread may still be using
+    \param myfree if not NULL, called on each data item
+ */
+API_EXPORT(void) mtev_cskiplist_destroy(mtev_cskiplist_t *sl, mtev_freefunc_t myfree);
+
+/*! \fn int mtev_cskiplist_size(mtev_cskiplist_t *sl)
+    \brief Return the number of items in the skiplist.
+ */
+API_EXPORT(int) mtev_cskiplist_size(mtev_cskiplist_t *sl);
+
+/*! \fn mtev_boolean mtev_cskiplist_insert(mtev_cskiplist_t *sl, const void *data)
+    \brief Insert data into the skiplist.
+    \param sl the skiplist
+    \param data the item to insert
+    \return mtev_true if inserted, mtev_false if an equal item is present
+ */
+API_EXPORT(mtev_boolean) mtev_cskiplist_insert(mtev_cskiplist_t *sl, const void *data);
+
+/*! \fn int mtev_cskiplist_remove(mtev_cskiplist_t *sl, const void *key, mtev_freefunc_t myfree)
+    \brief Remove the item matching key.
+    \param sl the skiplist
+    \param key the key, compared with `comparek`
+    \param myfree if not NULL, called on the removed data once no reader can hold it
+    \return 1 if this call removed an item, 0 otherwise
+ */
+API_EXPORT(int) mtev_cskiplist_remove(mtev_cskiplist_t *sl, const void *key,
+                                      mtev_freefunc_t myfree);
+
+/*! \fn int mtev_cskiplist_remove_node(mtev_cskiplist_t *sl, mtev_cskiplist_node_t *node, mtev_freefunc_t myfree)
+    \brief Remove a node previously found in the skiplist.
+    \param sl the skiplist
+    \param node the node (from a find or iteration in the current memory section)
+    \param myfree if not NULL, called on the removed data once no reader can hold it
+    \return 1 if this call removed the node, 0 if it was already removed
+ */
+API_EXPORT(int) mtev_cskiplist_remove_node(mtev_cskiplist_t *sl,
+                                           mtev_cskiplist_node_t *node,
+                                           mtev_freefunc_t myfree);
+
+/*! \fn void *mtev_cskiplist_find(mtev_cskiplist_t *sl, const void *key, mtev_cskiplist_node_t **iter)
+    \brief Find the item matching key.
+    \param sl the skiplist
+    \param key the key, compared with `comparek`
+    \param iter if not NULL, set to the matching node or NULL
+    \return the matching data or NULL
+ */
+API_EXPORT(void *) mtev_cskiplist_find(mtev_cskiplist_t *sl, const void *key,
+                                       mtev_cskiplist_node_t **iter);
+
+/*! \fn void *mtev_cskiplist_find_neighbors(mtev_cskiplist_t *sl, const void *key, mtev_cskiplist_node_t **iter, mtev_cskiplist_node_t **prev, mtev_cskiplist_node_t **next)
+    \brief Find the item matching key and the items on either side of it.
+    \param sl the skiplist
+    \param key the key, compared with `comparek`
+    \param iter if not NULL, set to the matching node or NULL
+    \param prev if not NULL, set to the last node ordered before key or NULL
+    \param next if not NULL, set to the first node ordered after key or NULL
+    \return the matching data or NULL
+
+    As with mtev_skiplist_find_neighbors, prev and next are set whether or
+    not key itself is present.
+ */
+API_EXPORT(void *)
+  mtev_cskiplist_find_neighbors(mtev_cskiplist_t *sl, const void *key,
+                                mtev_cskiplist_node_t **iter,
+                                mtev_cskiplist_node_t **prev,
+                                mtev_cskiplist_node_t **next);
+
+/*! \fn mtev_cskiplist_node_t *mtev_cskiplist_seek(mtev_cskiplist_t *sl, const void *key)
+    \brief Find the first node not ordered before key.
+    \param sl the skiplist
+    \param key the key, or NULL for the first node
+    \return the node or NULL
+ */
+API_EXPORT(mtev_cskiplist_node_t *) mtev_cskiplist_seek(mtev_cskiplist_t *sl, const void *key);
+
+/*! \fn mtev_cskiplist_node_t *mtev_cskiplist_next(mtev_cskiplist_t *sl, mtev_cskiplist_node_t *node)
+    \brief Return the next node in order that has not been removed.
+ */
+API_EXPORT(mtev_cskiplist_node_t *) mtev_cskiplist_next(mtev_cskiplist_t *sl,
+                                                        mtev_cskiplist_node_t *node);
+
+/*! \fn void *mtev_cskiplist_data(mtev_cskiplist_node_t *node)
+    \brief Return the data held by a node.
+ */
+API_EXPORT(void *) mtev_cskiplist_data(mtev_cskiplist_node_t *node);
+
+/*! \fn int mtev_cskiplist_range(mtev_cskiplist_t *sl, const void *lo, const void *hi, int (*f)(void *data, void *closure), void *closure)
+    \brief Visit items between two keys in order.
+    \param sl the skiplist
+    \param lo the inclusive lower bound key, or NULL for the start
+    \param hi the inclusive upper bound key, or NULL for the end
+    \param f called per item; returning 0 stops the scan
+    \param closure passed to f
+    \return the number of items visited
+
+    The scan is not a snapshot: items inserted or removed concurrently may
+    or may not be seen, but every item present for the whole scan is.
+ */
+API_EXPORT(int) mtev_cskiplist_range(mtev_cskiplist_t *sl, const void *lo, const void *hi,
+                                     int (*f)(void *data, void *closure),
+                                     void *closure);
+
+/*! \fn void *mtev_cskiplist_peek(mtev_cskiplist_t *sl)
+    \brief Return the first item without removing it.
+ */
+API_EXPORT(void *) mtev_cskiplist_peek(mtev_cskiplist_t *sl);
+
+/*! \fn void *mtev_cskiplist_pop(mtev_cskiplist_t *sl, mtev_freefunc_t myfree)
+    \brief Remove and return the first item.
+    \param sl the skiplist
+    \param myfree if not NULL, called on the data once no reader can hold it
+    \return the removed data or NULL if the list is empty
+
+    When myfree is given, the returned pointer is only valid until the
+    caller leaves its current mtev_memory section.
+ */
+API_EXPORT(void *) mtev_cskiplist_pop(mtev_cskiplist_t *sl, mtev_freefunc_t myfree);
+
+#endif
@@ -34,6 +34,7 @@
 #include "mtev_config.h"
 #include "mtev_hash.h"
 #include "mtev_log.h"
+#include "mtev_memory.h"
 #include "mtev_watchdog.h"
 #include <time.h>
 #include <stdio.h>
@@ -103,6 +104,42 @@ uint32_t mtev_hash__hash(const char *k, uint32_t length, uint32_t initval) {
   return __hash(k,length,initval);
 }
 
+/* MurmurHash64A, reading input as little-endian on every platform so
+ * hashes (and anything derived from them) are portable between hosts. */
+static inline uint64_t
+le64(const unsigned char *p) {
+  return (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) |
+         ((uint64_t)p[3] << 24) | ((uint64_t)p[4] << 32) |
+         ((uint64_t)p[5] << 40) | ((uint64_t)p[6] << 48) |
+         ((uint64_t)p[7] << 56);
+}
+uint64_t mtev_hash__hash64(const void *key, size_t length, uint64_t seed) {
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  const unsigned char *data = key;
+  const unsigned char *end = data + (length & ~(size_t)7);
+  uint64_t h = seed ^ (length * m);
+
+  while(data != end) {
+    uint64_t k = le64(data);
+    data += 8;
+    k *= m; k ^= k >> r; k *= m;
+    h ^= k; h *= m;
+  }
+  switch(length & 7) {   /* all the case statements fall through */
+  case 7: h ^= (uint64_t)data[6] << 48;
+  case 6: h ^= (uint64_t)data[5] << 40;
+  case 5: h ^= (uint64_t)data[4] << 32;
+  case 4: h ^= (uint64_t)data[3] << 24;
+  case 3: h ^= (uint64_t)data[2] << 16;
+  case 2: h ^= (uint64_t)data[1] << 8;
+  case 1: h ^= (uint64_t)data[0];
+          h *= m;
+  }
+  h ^= h >> r; h *= m; h ^= h >> r;
+  return h;
+}
+
 static unsigned long
 hs_hash(const void *object, unsigned long seed)
 {
@@ -151,6 +188,13 @@ static struct ck_malloc my_allocator = {
   .free = ht_free
 };
 
+/* Sharded tables are read and iterated while other threads write, so
+ * their maps and key containers are reclaimed through epochs. */
+static struct ck_malloc safe_allocator = {
+  .malloc = mtev_memory_ck_malloc,
+  .free = mtev_memory_ck_free
+};
+
 #define CK_HS_EMPTY     NULL
 #define CK_HS_TOMBSTONE ((void *)~(uintptr_t)0)
 #define CK_HS_G     (2)
@@ -175,6 +219,8 @@ static struct ck_malloc my_allocator = {
 #error "ck_hs is not supported on your platform."
 #endif
 
+struct hash_shard;
+
 struct locks_container {
   void (*lock)(struct locks_container *h);
   void (*unlock)(struct locks_container *h);
@@ -182,8 +228,38 @@ struct locks_container {
     pthread_mutex_t hs_lock;
     mtev_spinlock_t hs_spinlock;
   } locks;  
+  /* non-NULL only for tables from mtev_hash_init_sharded */
+  struct hash_shard *shards;
+  int nshards;
+  /* the capacity asked for at init; delete_all won't shrink below it */
+  unsigned long presize;
+  /* Incremental resize: while resizing, entries are copied from the
+   * table into resize_hs a few at a time by writers.  Readers look in
+   * resize_hs first.  resize_dups counts the keys present in both. */
+  int resizing;
+  ck_hs_t resize_hs;
+  ck_hs_iterator_t resize_iter;
+  unsigned long resize_dups;
 };
 
+struct hash_shard {
+  ck_hs_t hs;
+  struct locks_container lc;
+} CK_CC_CACHELINE;
+
+#define MAX_SHARDS 256
+/* Tables below this many slots let ck_hs grow them in one go. */
+#define INCREMENTAL_MIN_CAPACITY 65536
+/* Larger ones start migrating to a table twice the size at 3/8 load,
+ * ahead of ck_hs's own growth at 1/2, moving this many entries per
+ * write.  That finishes well before the new table reaches its own
+ * threshold. */
+#define RESIZE_STEP 16
+/* Iterators over sharded tables carry the shard in the top byte of the
+ * ck_hs_iterator_t offset, leaving the rest for the slot in the shard. */
+#define ITER_SHARD_SHIFT ((sizeof(unsigned long) * 8) - 8)
+#define ITER_OFFSET_MASK ((1UL << ITER_SHARD_SHIFT) - 1)
+
 static inline void
 none_lock(struct locks_container *h) {
   (void)h;
@@ -214,14 +290,11 @@ mutex_unlock(struct locks_container *h) {
   pthread_mutex_unlock(&h->locks.hs_lock);
 }
 
+#define LOCK(lc) do { (lc)->lock(lc); } while (0)
+#define UNLOCK(lc) do { (lc)->unlock(lc); } while (0)
 
-#define LOCK(h) do { \
-  ((struct locks_container *)h->u.locks.locks)->lock(h->u.locks.locks); \
-  } while (0)
-
-#define UNLOCK(h) do { \
-  ((struct locks_container *)h->u.locks.locks)->unlock(h->u.locks.locks); \
-  } while (0)
+#define IS_SHARDED(h) \
+  (((struct locks_container *)(h)->u.locks.locks)->shards != NULL)
 
 struct ck_hs_map {
   unsigned int generation[CK_HS_G];
@@ -238,9 +311,8 @@ struct ck_hs_map {
 };
 
 static void
-mtev_hash_set_lock_mode_funcs(mtev_hash_table *h, mtev_hash_lock_mode_t lock_mode)
+mtev_hash_set_lock_mode_funcs(struct locks_container *lc, mtev_hash_lock_mode_t lock_mode)
 {
-  struct locks_container *lc = h->u.locks.locks;
   switch (lock_mode) {
   case MTEV_HASH_LOCK_MODE_NONE:
     lc->lock = &none_lock;
@@ -260,20 +332,231 @@ mtev_hash_set_lock_mode_funcs(mtev_hash_table *h, mtev_hash_lock_mode_t lock_mod
 }
 
 static void
-mtev_hash_destroy_locks(mtev_hash_table *h)
+mtev_hash_destroy_locks(struct locks_container *lc)
 {
-  struct locks_container *lc = h->u.locks.locks;
   if (lc->lock == mutex_lock) {
     pthread_mutex_destroy(&lc->locks.hs_lock);
   }
 }
 
+/* Find the ck_hs (and the lock guarding it) a hash value lives in.
+ * ck_hs places entries by the low bits, so shards are picked from a
+ * multiplicative mix of the whole value instead.
+ */
+static inline ck_hs_t *
+hash_route(mtev_hash_table *h, unsigned long hashv, struct locks_container **lcp) {
+  struct locks_container *lc = h->u.locks.locks;
+  struct hash_shard *shard;
+
+  if(lc->shards == NULL) {
+    *lcp = lc;
+    return &h->u.hs;
+  }
+  shard = &lc->shards[((uint64_t)((uint32_t)hashv * 2654435761u) *
+                       (uint64_t)lc->nshards) >> 32];
+  *lcp = &shard->lc;
+  return &shard->hs;
+}
+
+static inline ck_hash_attr_t *
+attr_alloc(mtev_hash_table *h, int klen) {
+  if(IS_SHARDED(h)) {
+    mtev_memory_init_thread();
+    return mtev_memory_safe_calloc(1, sizeof(ck_hash_attr_t) + klen + 1);
+  }
+  return calloc(1, sizeof(ck_hash_attr_t) + klen + 1);
+}
+
+/* free a container that readers may still be looking at */
+static inline void
+attr_retire(mtev_hash_table *h, ck_hash_attr_t *attr) {
+  if(IS_SHARDED(h)) {
+    mtev_memory_init_thread();
+    mtev_memory_safe_free(attr);
+  }
+  else free(attr);
+}
+
+/* Free a key handed to us by the caller.  Sharded tables give keys out
+ * from lock-free reads (iteration in particular), so the caller's free
+ * waits for the current epoch to pass just like the container does.
+ */
+static inline void
+key_retire(mtev_hash_table *h, NoitHashFreeFunc keyfree, void *key) {
+  if(!keyfree) return;
+  if(IS_SHARDED(h)) {
+    mtev_memory_init_thread();
+    mtev_memory_defer_free(key, keyfree);
+  }
+  else keyfree(key);
+}
+
+/* free a container that was never published */
+static inline void
+attr_discard(mtev_hash_table *h, ck_hash_attr_t *attr) {
+  if(IS_SHARDED(h)) mtev_memory_ck_free(attr, 0, false);
+  else free(attr);
+}
+
+static inline mtev_boolean
+read_begin(mtev_hash_table *h) {
+  if(!IS_SHARDED(h)) return mtev_false;
+  mtev_memory_init_thread();
+  mtev_memory_begin();
+  return mtev_true;
+}
+
+static inline void
+read_end(mtev_boolean in_section) {
+  if(in_section) mtev_memory_end();
+}
+
+/* Called by writers, with the lock held, before adding a key. */
+static void
+hash_resize_maybe_start(ck_hs_t *hs, struct locks_container *lc) {
+  struct ck_hs_map *map = hs->map;
+
+  if(lc->resizing) return;
+  if(map->capacity < INCREMENTAL_MIN_CAPACITY) return;
+  if((map->n_entries + 1) * 8 <= map->capacity * 3) return;
+  /* If we can't get the memory now, ck_hs will grow the table itself. */
+  if(!ck_hs_init(&lc->resize_hs, hs->mode, hs->hf, hs->compare, hs->m,
+                 map->capacity * 2, hs->seed)) return;
+  memset(&lc->resize_iter, 0, sizeof(lc->resize_iter));
+  lc->resize_dups = 0;
+  ck_pr_fence_store();
+  ck_pr_store_int(&lc->resizing, 1);
+}
+
+/* Make the new table the table.  The caller holds the lock. */
+static void
+hash_resize_finish(ck_hs_t *hs, struct locks_container *lc) {
+  struct ck_hs_map *old = hs->map;
+  void *entry;
+
+  if(hs->m == &safe_allocator) mtev_memory_init_thread();
+  while(ck_hs_next(hs, &lc->resize_iter, &entry))
+    ck_hs_put(&lc->resize_hs, CK_HS_HASH(hs, hs_hash, entry), entry);
+  ck_pr_store_ptr(&hs->map, lc->resize_hs.map);
+  ck_pr_fence_store();
+  ck_pr_store_int(&lc->resizing, 0);
+  hs->m->free(old, old->size, true);
+}
+
+/* Copy up to n entries into the new table. */
+static void
+hash_resize_step(ck_hs_t *hs, struct locks_container *lc, int n) {
+  void *entry;
+
+  if(!lc->resizing) return;
+  if(hs->m == &safe_allocator) mtev_memory_init_thread();
+  while(n-- > 0) {
+    if(!ck_hs_next(hs, &lc->resize_iter, &entry)) {
+      hash_resize_finish(hs, lc);
+      return;
+    }
+    /* Already there if it was replaced since the resize began. */
+    if(ck_hs_put(&lc->resize_hs, CK_HS_HASH(hs, hs_hash, entry), entry))
+      lc->resize_dups++;
+  }
+}
+
+/* The ck_hs_* operations, aware of a resize in progress.  Everything
+ * but hash_get requires the lock. */
+static inline void *
+hash_get(ck_hs_t *hs, struct locks_container *lc, unsigned long hashv, const void *key) {
+  void *found;
+  if(ck_pr_load_int(&lc->resizing)) {
+    ck_pr_fence_load();
+    if((found = ck_hs_get(&lc->resize_hs, hashv, key)) != NULL) return found;
+  }
+  return ck_hs_get(hs, hashv, key);
+}
+
+static bool
+hash_put(ck_hs_t *hs, struct locks_container *lc, unsigned long hashv, const void *key) {
+  bool rv;
+
+  hash_resize_maybe_start(hs, lc);
+  if(!lc->resizing) return ck_hs_put(hs, hashv, key);
+  if(ck_hs_get(hs, hashv, key)) rv = false;
+  else rv = ck_hs_put(&lc->resize_hs, hashv, key);
+  hash_resize_step(hs, lc, RESIZE_STEP);
+  return rv;
+}
+
+static bool
+hash_set(ck_hs_t *hs, struct locks_container *lc, unsigned long hashv, const void *key,
+         void **previous) {
+  bool rv;
+
+  hash_resize_maybe_start(hs, lc);
+  if(!lc->resizing) return ck_hs_set(hs, hashv, key, previous);
+  *previous = NULL;
+  if(ck_hs_get(&lc->resize_hs, hashv, key)) {
+    rv = ck_hs_set(&lc->resize_hs, hashv, key, previous);
+    if(rv && ck_hs_remove(hs, hashv, key)) lc->resize_dups--;
+  }
+  else if(ck_hs_get(hs, hashv, key)) {
+    /* Not yet copied.  Publish it in the new table before replacing it
+     * in the old one so that readers always find one or the other; the
+     * old one may move within its table, but it no longer needs copying. */
+    rv = ck_hs_put(&lc->resize_hs, hashv, key);
+    if(rv) {
+      ck_hs_set(hs, hashv, key, previous);
+      lc->resize_dups++;
+    }
+  }
+  else {
+    rv = ck_hs_put(&lc->resize_hs, hashv, key);
+  }
+  hash_resize_step(hs, lc, RESIZE_STEP);
+  return rv;
+}
+
+static void *
+hash_remove(ck_hs_t *hs, struct locks_container *lc, unsigned long hashv, const void *key) {
+  void *from_old, *from_new;
+
+  if(!lc->resizing) return ck_hs_remove(hs, hashv, key);
+  /* old first: a reader missing it in the new table won't find it there */
+  from_old = ck_hs_remove(hs, hashv, key);
+  from_new = ck_hs_remove(&lc->resize_hs, hashv, key);
+  if(from_old && from_new) lc->resize_dups--;
+  hash_resize_step(hs, lc, RESIZE_STEP);
+  return from_new ? from_new : from_old;
+}
+
+static unsigned long
+hash_count(ck_hs_t *hs, struct locks_container *lc) {
+  if(!ck_pr_load_int(&lc->resizing)) return ck_hs_count(hs);
+  return ck_hs_count(hs) + ck_hs_count(&lc->resize_hs) - lc->resize_dups;
+}
+
+/* Iterating a table mid-resize would see copied entries twice. */
+static void
+hash_resize_settle(ck_hs_t *hs, struct locks_container *lc) {
+  if(!ck_pr_load_int(&lc->resizing)) return;
+  LOCK(lc);
+  if(lc->resizing) hash_resize_finish(hs, lc);
+  UNLOCK(lc);
+}
+
+/* Room for size entries without either kind of growth.  Tables asking
+ * for no more than the default get exactly what they ask for. */
+static unsigned long
+hash_presize(int size) {
+  if(size <= MTEV_HASH_DEFAULT_SIZE) return size;
+  return ((unsigned long)size * 8 + 2) / 3;
+}
 
 void mtev_hash_init_size(mtev_hash_table *h, int size) {
   mtev_hash_init_locks(h, size, MTEV_HASH_LOCK_MODE_NONE);
 }
 
 void mtev_hash_init_locks(mtev_hash_table *h, int size, mtev_hash_lock_mode_t lock_mode) {
+  struct locks_container *lc;
+
   if(!rand_init) {
     srand48((long int)time(NULL));
     rand_init = 1;
@@ -282,21 +565,73 @@ void mtev_hash_init_locks(mtev_hash_table *h, int size, mtev_hash_lock_mode_t lo
   if(size < 8) size = 8;
 
   mtevAssert(ck_hs_init(&h->u.hs, CK_HS_MODE_OBJECT | CK_HS_MODE_SPMC, hs_hash, hs_compare, &my_allocator,
-                         size, lrand48()));
+                         hash_presize(size), lrand48()));
   mtevAssert(h->u.hs.hf != NULL);
 
-  h->u.locks.locks = calloc(1, sizeof(struct locks_container));
+  lc = h->u.locks.locks = calloc(1, sizeof(struct locks_container));
+  lc->presize = hash_presize(size);
 
-  mtev_hash_set_lock_mode_funcs(h, lock_mode);
+  mtev_hash_set_lock_mode_funcs(lc, lock_mode);
+}
+
+void mtev_hash_init_sharded(mtev_hash_table *h, int size, int nshards,
+                            mtev_hash_lock_mode_t lock_mode) {
+  struct locks_container *lc;
+  unsigned long seed;
+  int i, shard_size;
+
+  if(!rand_init) {
+    srand48((long int)time(NULL));
+    rand_init = 1;
+  }
+
+  if(nshards <= 0) {
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    nshards = 4;
+    while(nshards < ncpus * 2 && nshards < 64) nshards <<= 1;
+  }
+  if(nshards > MAX_SHARDS) nshards = MAX_SHARDS;
+  /* Sharding buys nothing without locks to stripe. */
+  if(lock_mode == MTEV_HASH_LOCK_MODE_NONE) lock_mode = MTEV_HASH_LOCK_MODE_SPIN;
+  shard_size = size / nshards;
+  if(shard_size < 8) shard_size = 8;
+
+  /* Every shard must hash with the same seed: the table's own ck_hs
+   * computes the hash that routes to the shard and ck_hs rehashes with
+   * its seed when a shard grows. */
+  seed = lrand48();
+  mtev_memory_init_thread();
+  mtevAssert(ck_hs_init(&h->u.hs, CK_HS_MODE_OBJECT | CK_HS_MODE_SPMC, hs_hash, hs_compare, &my_allocator,
+                         8, seed));
+  mtevAssert(h->u.hs.hf != NULL);
+
+  lc = h->u.locks.locks = calloc(1, sizeof(struct locks_container));
+  mtev_hash_set_lock_mode_funcs(lc, MTEV_HASH_LOCK_MODE_NONE);
+  mtevAssert(posix_memalign((void **)&lc->shards, CK_MD_CACHELINE,
+                            nshards * sizeof(*lc->shards)) == 0);
+  memset(lc->shards, 0, nshards * sizeof(*lc->shards));
+  for(i=0; i<nshards; i++) {
+    mtevAssert(ck_hs_init(&lc->shards[i].hs, CK_HS_MODE_OBJECT | CK_HS_MODE_SPMC, hs_hash, hs_compare,
+                           &safe_allocator, hash_presize(shard_size), seed));
+    lc->shards[i].lc.presize = hash_presize(shard_size);
+    mtev_hash_set_lock_mode_funcs(&lc->shards[i].lc, lock_mode);
+  }
+  lc->nshards = nshards;
 }
 
 int mtev_hash_size(mtev_hash_table *h) {
+  struct locks_container *lc;
+  int i, size = 0;
+
   if(h->u.hs.hf == NULL) {
     mtevL(mtev_error, "warning: null hashtable in mtev_hash_size... initializing\n");
     mtev_stacktrace(mtev_error);
     mtev_hash_init(h);
   }
-  return ck_hs_count(&h->u.hs);
+  lc = h->u.locks.locks;
+  if(lc->shards == NULL) return hash_count(&h->u.hs, lc);
+  for(i=0; i<lc->nshards; i++) size += hash_count(&lc->shards[i].hs, &lc->shards[i].lc);
+  return size;
 }
 int mtev_hash_replace(mtev_hash_table *h, const char *k, int klen, void *data,
                       NoitHashFreeFunc keyfree, NoitHashFreeFunc datafree) {
@@ -304,7 +639,9 @@ int mtev_hash_replace(mtev_hash_table *h, const char *k, int klen, void *data,
   int ret;
   void *retrieved_key = NULL;
   ck_hash_attr_t *data_struct;
-  ck_hash_attr_t *attr = calloc(1, sizeof(ck_hash_attr_t) + klen + 1);
+  ck_hash_attr_t *attr;
+  struct locks_container *lc;
+  ck_hs_t *hs;
 
   if(h->u.hs.hf == NULL) {
     mtevL(mtev_error, "warning: null hashtable in mtev_hash_replace... initializing\n");
@@ -312,34 +649,38 @@ int mtev_hash_replace(mtev_hash_table *h, const char *k, int klen, void *data,
     mtev_hash_init(h);
   }
 
+  attr = attr_alloc(h, klen);
   memcpy(attr->key.label, k, klen);
   attr->key.label[klen] = 0;
   attr->key.len = klen + sizeof(uint32_t);
   attr->data = data;
   attr->key_ptr = (char*)k;
   hashv = CK_HS_HASH(&h->u.hs, hs_hash, &attr->key);
-  LOCK(h);
-  ret = ck_hs_set(&h->u.hs, hashv, &attr->key, &retrieved_key);
-  UNLOCK(h);
+  hs = hash_route(h, hashv, &lc);
+  LOCK(lc);
+  ret = hash_set(hs, lc, hashv, &attr->key, &retrieved_key);
+  UNLOCK(lc);
   if (ret) {
     if (retrieved_key) {
       data_struct = index_attribute_container(retrieved_key);
       if (data_struct) {
-        if (keyfree) keyfree(data_struct->key_ptr);
+        key_retire(h, keyfree, data_struct->key_ptr);
         if (datafree) datafree(data_struct->data);
       }
-      free(data_struct);
+      attr_retire(h, data_struct);
     }
   }
   else {
-    free(attr);
+    attr_discard(h, attr);
   }
   return 1;
 }
 int mtev_hash_store(mtev_hash_table *h, const char *k, int klen, void *data) {
   long hashv;
   int ret = 0;
-  ck_hash_attr_t *attr = calloc(1, sizeof(ck_hash_attr_t) + klen + 1);
+  ck_hash_attr_t *attr;
+  struct locks_container *lc;
+  ck_hs_t *hs;
 
   if(h->u.hs.hf == NULL) {
     mtevL(mtev_error, "warning: null hashtable in mtev_hash_store... initializing\n");
@@ -347,16 +688,18 @@ int mtev_hash_store(mtev_hash_table *h, const char *k, int klen, void *data) {
     mtev_hash_init(h);
   }
 
+  attr = attr_alloc(h, klen);
   memcpy(attr->key.label, k, klen);
   attr->key.label[klen] = 0;
   attr->key.len = klen + sizeof(uint32_t);
   attr->key_ptr = (char*)k;
   attr->data = data;
   hashv = CK_HS_HASH(&h->u.hs, hs_hash, &attr->key);
-  LOCK(h);
-  ret = ck_hs_put(&h->u.hs, hashv, &attr->key);
-  UNLOCK(h);
-  if (!ret) free(attr);
+  hs = hash_route(h, hashv, &lc);
+  LOCK(lc);
+  ret = hash_put(hs, lc, hashv, &attr->key);
+  UNLOCK(lc);
+  if (!ret) attr_discard(h, attr);
   return ret;
 }
 int mtev_hash_retrieve(mtev_hash_table *h, const char *k, int klen, void **data) {
@@ -368,6 +711,9 @@ int mtev_hash_retrieve(mtev_hash_table *h, const char *k, int klen, void **data)
   } onstack_key;
   ck_key_t *key = &onstack_key.key;
   ck_hash_attr_t *data_struct;
+  struct locks_container *lc;
+  ck_hs_t *hs;
+  mtev_boolean in_section;
 
   if(!h) return 0;
   if(h->u.hs.hf == NULL) {
@@ -381,20 +727,24 @@ int mtev_hash_retrieve(mtev_hash_table *h, const char *k, int klen, void **data)
   key->label[klen] = 0;
   key->len = klen + sizeof(uint32_t);;
   hashv = CK_HS_HASH(&h->u.hs, hs_hash, key);
-  retrieved_key = ck_hs_get(&h->u.hs, hashv, key);
+  hs = hash_route(h, hashv, &lc);
+  in_section = read_begin(h);
+  retrieved_key = hash_get(hs, lc, hashv, key);
   if (retrieved_key) {
     data_struct = index_attribute_container(retrieved_key);
     if (data) {
       if (data_struct) {
-        *data = data_struct->data;
+        *data = ck_pr_load_ptr(&data_struct->data);
       }
       else {
         *data = NULL;
       }
     }
+    read_end(in_section);
     if(key != &onstack_key.key) free(key);
     return 1;
   }
+  read_end(in_section);
   if(key != &onstack_key.key) free(key);
   return 0;
 }
@@ -417,6 +767,8 @@ int mtev_hash_delete(mtev_hash_table *h, const char *k, int klen,
     char pad[sizeof(ck_key_t) + ONSTACK_KEY_SIZE];
   } onstack_key;
   ck_key_t *key = &onstack_key.key;
+  struct locks_container *lc;
+  ck_hs_t *hs;
 
   if(!h) return 0;
   if(h->u.hs.hf == NULL) {
@@ -430,15 +782,16 @@ int mtev_hash_delete(mtev_hash_table *h, const char *k, int klen,
   key->label[klen] = 0;
   key->len = klen + sizeof(uint32_t);
   hashv = CK_HS_HASH(&h->u.hs, hs_hash, key);
-  LOCK(h);
-  retrieved_key = ck_hs_remove(&h->u.hs, hashv, key);
-  UNLOCK(h);
+  hs = hash_route(h, hashv, &lc);
+  LOCK(lc);
+  retrieved_key = hash_remove(hs, lc, hashv, key);
+  UNLOCK(lc);
   if (retrieved_key) {
     data_struct = index_attribute_container(retrieved_key);
     if (data_struct) {
-      if (keyfree) keyfree(data_struct->key_ptr);
+      key_retire(h, keyfree, data_struct->key_ptr);
       if (datafree) datafree(data_struct->data);
-      free(data_struct);
+      attr_retire(h, data_struct);
       if(key != &onstack_key.key) free(key);
       return 1;
     }
@@ -447,33 +800,138 @@ int mtev_hash_delete(mtev_hash_table *h, const char *k, int klen,
   return 0;
 }
 
-void mtev_hash_delete_all(mtev_hash_table *h, NoitHashFreeFunc keyfree, NoitHashFreeFunc datafree) {
-  void *entry = NULL;
-  ck_hs_iterator_t iterator = CK_HS_ITERATOR_INITIALIZER;
+int mtev_hash_cas(mtev_hash_table *h, const char *k, int klen,
+                  void *expected, void *data, void **current) {
+  long hashv;
+  int rv = 0;
+  void *found = NULL;
+  ck_key_t *retrieved_key;
+  union {
+    ck_key_t key;
+    char pad[sizeof(ck_key_t) + ONSTACK_KEY_SIZE];
+  } onstack_key;
+  ck_key_t *key = &onstack_key.key;
   ck_hash_attr_t *data_struct;
+  struct locks_container *lc;
+  ck_hs_t *hs;
 
-  if(!h) return;
+  if(!h) return 0;
   if(h->u.hs.hf == NULL) {
-    mtevL(mtev_error, "warning: null hashtable in mtev_hash_delete_all... initializing\n");
+    mtevL(mtev_error, "warning: null hashtable in mtev_hash_cas... initializing\n");
+    mtev_stacktrace(mtev_error);
+    mtev_hash_init(h);
+  }
+
+  if(klen > ONSTACK_KEY_SIZE) key = calloc(1, sizeof(ck_key_t) + klen + 1);
+  memcpy(key->label, k, klen);
+  key->label[klen] = 0;
+  key->len = klen + sizeof(uint32_t);
+  hashv = CK_HS_HASH(&h->u.hs, hs_hash, key);
+  hs = hash_route(h, hashv, &lc);
+  LOCK(lc);
+  retrieved_key = hash_get(hs, lc, hashv, key);
+  if (retrieved_key) {
+    data_struct = index_attribute_container(retrieved_key);
+    found = data_struct->data;
+    if (found == expected) {
+      ck_pr_store_ptr(&data_struct->data, data);
+      rv = 1;
+    }
+  }
+  UNLOCK(lc);
+  if(!rv && current) *current = found;
+  if(key != &onstack_key.key) free(key);
+  return rv;
+}
+
+int mtev_hash_upsert(mtev_hash_table *h, const char *k, int klen,
+                     mtev_hash_upsert_func f, void *closure) {
+  long hashv;
+  int inserted = 0;
+  ck_key_t *retrieved_key;
+  ck_hash_attr_t *data_struct;
+  ck_hash_attr_t *attr;
+  struct locks_container *lc;
+  ck_hs_t *hs;
+
+  if(h->u.hs.hf == NULL) {
+    mtevL(mtev_error, "warning: null hashtable in mtev_hash_upsert... initializing\n");
     mtev_stacktrace(mtev_error);
     mtev_hash_init(h);
   }
 
-  int count = mtev_hash_size(h);
-  LOCK(h);
-  while(ck_hs_next(&h->u.hs, &iterator, &entry)) {
+  /* The container doubles as the lookup key and is only kept if the
+   * key is new. */
+  attr = attr_alloc(h, klen);
+  memcpy(attr->key.label, k, klen);
+  attr->key.label[klen] = 0;
+  attr->key.len = klen + sizeof(uint32_t);
+  attr->key_ptr = (char*)k;
+  hashv = CK_HS_HASH(&h->u.hs, hs_hash, &attr->key);
+  hs = hash_route(h, hashv, &lc);
+  LOCK(lc);
+  retrieved_key = hash_get(hs, lc, hashv, &attr->key);
+  if (retrieved_key) {
+    data_struct = index_attribute_container(retrieved_key);
+    ck_pr_store_ptr(&data_struct->data, f(data_struct->data, mtev_true, closure));
+  }
+  else {
+    attr->data = f(NULL, mtev_false, closure);
+    inserted = hash_put(hs, lc, hashv, &attr->key);
+  }
+  UNLOCK(lc);
+  if (!inserted) attr_discard(h, attr);
+  return inserted;
+}
+
+static void
+hash_delete_all_hs(mtev_hash_table *h, ck_hs_t *hs, struct locks_container *lc,
+                   NoitHashFreeFunc keyfree, NoitHashFreeFunc datafree) {
+  void *entry = NULL;
+  ck_hs_iterator_t iterator = CK_HS_ITERATOR_INITIALIZER;
+  ck_hash_attr_t *data_struct;
+  unsigned long count;
+
+  LOCK(lc);
+  if(lc->resizing) hash_resize_finish(hs, lc);
+  count = ck_hs_count(hs);
+  while(ck_hs_next(hs, &iterator, &entry)) {
     data_struct = index_attribute_container((ck_key_t*)entry);
     if (data_struct) {
-      if (keyfree) keyfree(data_struct->key_ptr);
+      key_retire(h, keyfree, data_struct->key_ptr);
       if (datafree) datafree(data_struct->data);
-      free(data_struct);
+      attr_retire(h, data_struct);
     }
   }
-  ck_hs_reset_size(&h->u.hs, count);
-  UNLOCK(h);
+  ck_hs_reset_size(hs, count > lc->presize ? count : lc->presize);
+  UNLOCK(lc);
+}
+
+void mtev_hash_delete_all(mtev_hash_table *h, NoitHashFreeFunc keyfree, NoitHashFreeFunc datafree) {
+  struct locks_container *lc;
+  int i;
+
+  if(!h) return;
+  if(h->u.hs.hf == NULL) {
+    mtevL(mtev_error, "warning: null hashtable in mtev_hash_delete_all... initializing\n");
+    mtev_stacktrace(mtev_error);
+    mtev_hash_init(h);
+  }
+
+  lc = h->u.locks.locks;
+  if(lc->shards == NULL) {
+    hash_delete_all_hs(h, &h->u.hs, lc, keyfree, datafree);
+    return;
+  }
+  mtev_memory_init_thread();
+  for(i=0; i<lc->nshards; i++)
+    hash_delete_all_hs(h, &lc->shards[i].hs, &lc->shards[i].lc, keyfree, datafree);
 }
 
 void mtev_hash_destroy(mtev_hash_table *h, NoitHashFreeFunc keyfree, NoitHashFreeFunc datafree) {
+  struct locks_container *lc;
+  int i;
+
   if(!h) return;
   if(h->u.hs.hf == NULL) {
     mtevL(mtev_error, "warning: null hashtable in mtev_hash_destroy... initializing\n");
@@ -481,11 +939,19 @@ void mtev_hash_destroy(mtev_hash_table *h, NoitHashFreeFunc keyfree, NoitHashFre
     mtev_hash_init(h);
   }
   mtev_hash_delete_all(h, keyfree, datafree);
-  LOCK(h);
+  lc = h->u.locks.locks;
+  for(i=0; i<lc->nshards; i++) {
+    LOCK(&lc->shards[i].lc);
+    ck_hs_destroy(&lc->shards[i].hs);
+    UNLOCK(&lc->shards[i].lc);
+    mtev_hash_destroy_locks(&lc->shards[i].lc);
+  }
+  free(lc->shards);
+  LOCK(lc);
   ck_hs_destroy(&h->u.hs);
-  UNLOCK(h);
-  mtev_hash_destroy_locks(h);
-  free(h->u.locks.locks);
+  UNLOCK(lc);
+  mtev_hash_destroy_locks(lc);
+  free(lc);
 }
 
 void mtev_hash_merge_as_dict(mtev_hash_table *dst, mtev_hash_table *src) {
@@ -501,6 +967,42 @@ int mtev_hash_adv(mtev_hash_table *h, mtev_hash_iter *iter) {
   return mtev_hash_next(h, iter, &iter->key.str, &iter->klen, &iter->value.ptr);
 }
 
+/* Walk the shards in order; the position within the current shard is
+ * kept below ITER_SHARD_SHIFT.  Everything read from a container is
+ * copied out inside an epoch section as writers may retire it at any
+ * time.  The key itself is freed through the epoch too (key_retire), so
+ * it stays valid for a caller iterating inside its own epoch section.
+ */
+static int
+hash_next_sharded(struct locks_container *lc, mtev_hash_iter *iter,
+                  const char **k, int *klen, void **data) {
+  unsigned long shard = iter->iter.offset >> ITER_SHARD_SHIFT;
+  ck_hs_iterator_t sub = iter->iter;
+  void *cursor = NULL;
+  ck_hash_attr_t *data_struct;
+  int rv = 0;
+
+  mtev_memory_init_thread();
+  mtev_memory_begin();
+  sub.offset = iter->iter.offset & ITER_OFFSET_MASK;
+  while(shard < (unsigned long)lc->nshards) {
+    if(sub.offset == 0) hash_resize_settle(&lc->shards[shard].hs, &lc->shards[shard].lc);
+    if(ck_hs_next(&lc->shards[shard].hs, &sub, &cursor)) {
+      data_struct = index_attribute_container((ck_key_t *)cursor);
+      *k = data_struct->key_ptr;
+      *klen = data_struct->key.len - sizeof(uint32_t);
+      *data = ck_pr_load_ptr(&data_struct->data);
+      rv = 1;
+      break;
+    }
+    shard++;
+    sub.offset = 0;
+  }
+  mtev_memory_end();
+  iter->iter.offset = (shard << ITER_SHARD_SHIFT) | (sub.offset & ITER_OFFSET_MASK);
+  return rv;
+}
+
 /* mtev_hash_next(_str) should not use anything in iter past the
  * ck_hs_iterator_t b/c older consumers could have the smaller
  * version of the mtev_hash_iter allocated on stack.
@@ -517,6 +1019,9 @@ int mtev_hash_next(mtev_hash_table *h, mtev_hash_iter *iter,
     mtev_hash_init(h);
   }
 
+  if(IS_SHARDED(h)) return hash_next_sharded(h->u.locks.locks, iter, k, klen, data);
+  if(iter->iter.offset == 0) hash_resize_settle(&h->u.hs, h->u.locks.locks);
+
   if(!ck_hs_next(&h->u.hs, &iter->iter, &cursor)) return 0;
   key = (ck_key_t *)cursor;
   data_struct = index_attribute_container(key);
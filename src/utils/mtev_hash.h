@@ -107,6 +107,12 @@ CK_CC_CONTAINER(ck_key_t, struct ck_hash_attr, key,
 void mtev_hash_init(mtev_hash_table *h);
 /**
  * will default to LOCK_MODE_MUTEX
+ *
+ * A size above MTEV_HASH_DEFAULT_SIZE is the number of entries the
+ * table holds without growing, and mtev_hash_delete_all won't shrink
+ * it below that.  Tables of 64k slots or more grow incrementally: a
+ * table twice the size is filled a few entries per write while lookups
+ * consult both, so no single write pays for rehashing everything.
  */
 void mtev_hash_init_size(mtev_hash_table *h, int size);
 /**
@@ -117,6 +123,25 @@ void mtev_hash_init_size(mtev_hash_table *h, int size);
  */
 void mtev_hash_init_locks(mtev_hash_table *h, int size, mtev_hash_lock_mode_t lock_mode);
 
+/*! \fn void mtev_hash_init_sharded(mtev_hash_table *h, int size, int nshards, mtev_hash_lock_mode_t lock_mode)
+    \brief Initialize a hash table that many threads can write at once.
+    \param h the table
+    \param size the expected number of entries
+    \param nshards the number of shards, or 0 to size from the number of CPUs (at most 256)
+    \param lock_mode the lock guarding each shard (NONE is promoted to SPIN)
+
+    The table is split into shards, each a ck_hs with its own lock, so
+    writers only contend when they hash to the same shard.  Reads stay
+    lock-free.  Internal memory is reclaimed through mtev_memory epochs,
+    so lookups and iteration are safe while other threads write; every
+    thread using the table is registered with mtev_memory_init_thread
+    on first use, and mtev_memory_init must have been called.  Key free
+    functions passed to delete, replace and destroy run only once the
+    current epoch has passed.  The rest of the API is unchanged.
+ */
+void mtev_hash_init_sharded(mtev_hash_table *h, int size, int nshards,
+                            mtev_hash_lock_mode_t lock_mode);
+
 /* NOTE! "k" and "data" MUST NOT be transient buffers, as the hash table
  * implementation does not duplicate them.  You provide a pair of
  * NoitHashFreeFunc functions to free up their storage when you call
@@ -129,6 +154,40 @@ int mtev_hash_retrieve(mtev_hash_table *h, const char *k, int klen, void **data)
 int mtev_hash_retr_str(mtev_hash_table *h, const char *k, int klen, const char **dstr);
 int mtev_hash_delete(mtev_hash_table *h, const char *k, int klen,
                      NoitHashFreeFunc keyfree, NoitHashFreeFunc datafree);
+
+/*! \fn int mtev_hash_cas(mtev_hash_table *h, const char *k, int klen, void *expected, void *data, void **current)
+    \brief Atomically replace the value of an existing key if it is unchanged.
+    \param h the table
+    \param k the key (not retained)
+    \param klen the length of the key
+    \param expected the value the key must currently have
+    \param data the new value
+    \param current if not NULL, set to the value found when the swap fails (NULL if the key is absent)
+    \return 1 if the value was replaced, 0 otherwise
+
+    The caller takes back ownership of `expected` on success; readers
+    may still hold it until they leave their epoch section.
+ */
+int mtev_hash_cas(mtev_hash_table *h, const char *k, int klen,
+                  void *expected, void *data, void **current);
+
+typedef void *(*mtev_hash_upsert_func)(void *current, mtev_boolean exists, void *closure);
+
+/*! \fn int mtev_hash_upsert(mtev_hash_table *h, const char *k, int klen, mtev_hash_upsert_func f, void *closure)
+    \brief Atomically insert or update a key with a value computed from the current one.
+    \param h the table
+    \param k the key
+    \param klen the length of the key
+    \param f called with the current value (and whether the key exists); returns the value to store
+    \param closure passed to f
+    \return 1 if the key was inserted and `k` is now owned by the table, 0 if it existed (or could not be inserted) and `k` is still the caller's
+
+    `f` runs with the writer lock for the key held and must not use the
+    table.  Disposing of the value it replaces is up to `f`.
+ */
+int mtev_hash_upsert(mtev_hash_table *h, const char *k, int klen,
+                     mtev_hash_upsert_func f, void *closure);
+
 void mtev_hash_delete_all(mtev_hash_table *h, NoitHashFreeFunc keyfree,
                           NoitHashFreeFunc datafree);
 void mtev_hash_destroy(mtev_hash_table *h, NoitHashFreeFunc keyfree,
@@ -144,6 +203,14 @@ void mtev_hash_merge_as_dict(mtev_hash_table *dst, mtev_hash_table *src);
 
 /* This is an iterator and requires the hash to not be written to during the
    iteration process.
+   Tables from mtev_hash_init_sharded are the exception: they may be
+   written to while iterating, but the walk is not a snapshot.  Entries
+   added or removed meanwhile may or may not be seen, and if a shard grows
+   while it is being walked, entries in it may be skipped or returned
+   twice.  Keys are freed through the epoch, so wrap the loop in
+   mtev_memory_begin()/mtev_memory_end() to keep each key valid while you
+   use it (or copy it).  Values are freed by the datafree of whoever
+   removes them; guarding them is up to the caller.
    To use:
      mtev_hash_iter iter = MTEV_HASH_ITER_ZERO;
 
@@ -161,5 +228,7 @@ int mtev_hash_next_str(mtev_hash_table *h, mtev_hash_iter *iter,
                        const char **k, int *klen, const char **dstr);
 
 uint32_t mtev_hash__hash(const char *k, uint32_t length, uint32_t initval);
+/* A 64bit hash of arbitrary bytes, stable across platforms. */
+uint64_t mtev_hash__hash64(const void *k, size_t length, uint64_t seed);
 
 #endif
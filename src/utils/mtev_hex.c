@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2017, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name Circonus, Inc. nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "mtev_config.h"
+#include "mtev_hex.h"
+#include "mtev_cpuid.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HEX_SIMD 1
+#include <immintrin.h>
+#endif
+
+static const char __hex[] = "0123456789abcdef";
+
+/* 0-15 are digits; 0xff marks everything else */
+static const unsigned char __unhex[] = {
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+
+static volatile int hex_simd = -1;
+
+static inline int
+hex_use_simd(void) {
+  int level = hex_simd;
+  if(level < 0) {
+    level = 0;
+#ifdef HEX_SIMD
+    if(mtev_cpuid_feature(MTEV_CPU_FEATURE_SSSE3)) level = 1;
+#endif
+    hex_simd = level;
+  }
+  return level;
+}
+
+#ifdef HEX_SIMD
+__attribute__((target("ssse3")))
+static size_t
+hex_encode_ssse3(const unsigned char *src, size_t len, char *dst) {
+  const __m128i lut = _mm_loadu_si128((const __m128i *)__hex);
+  const __m128i nib = _mm_set1_epi8(0x0f);
+  size_t i;
+
+  for(i = 0; i + 16 <= len; i += 16) {
+    __m128i in = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i hi = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(in, 4), nib));
+    __m128i lo = _mm_shuffle_epi8(lut, _mm_and_si128(in, nib));
+    _mm_storeu_si128((__m128i *)(dst + 2 * i), _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128((__m128i *)(dst + 2 * i + 16), _mm_unpackhi_epi8(hi, lo));
+  }
+  return i;
+}
+
+/* Map 16 characters to nibble values; *ok is cleared on any non-digit. */
+__attribute__((target("ssse3")))
+static inline __m128i
+hex_nibbles_ssse3(__m128i in, int *ok) {
+  __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('0' - 1)),
+                                _mm_cmplt_epi8(in, _mm_set1_epi8('9' + 1)));
+  __m128i lc = _mm_or_si128(in, _mm_set1_epi8(0x20));
+  __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lc, _mm_set1_epi8('a' - 1)),
+                                _mm_cmplt_epi8(lc, _mm_set1_epi8('f' + 1)));
+  if(_mm_movemask_epi8(_mm_or_si128(digit, alpha)) != 0xffff) *ok = 0;
+  return _mm_or_si128(_mm_and_si128(digit, _mm_sub_epi8(in, _mm_set1_epi8('0'))),
+                      _mm_and_si128(alpha, _mm_sub_epi8(lc, _mm_set1_epi8('a' - 10))));
+}
+
+__attribute__((target("ssse3")))
+static size_t
+hex_decode_ssse3(const unsigned char *src, size_t len, unsigned char *dst) {
+  const __m128i weights = _mm_set1_epi16(0x0110);
+  size_t i;
+
+  for(i = 0; i + 32 <= len; i += 32) {
+    int ok = 1;
+    __m128i a = hex_nibbles_ssse3(_mm_loadu_si128((const __m128i *)(src + i)), &ok);
+    __m128i b = hex_nibbles_ssse3(_mm_loadu_si128((const __m128i *)(src + i + 16)), &ok);
+    if(!ok) break;
+    /* (hi << 4) + lo per pair, then narrow the 16-bit sums to bytes */
+    a = _mm_maddubs_epi16(a, weights);
+    b = _mm_maddubs_epi16(b, weights);
+    _mm_storeu_si128((__m128i *)(dst + i / 2), _mm_packus_epi16(a, b));
+  }
+  return i;
+}
+#endif
+
+int
+mtev_hex_decode(const char *src, size_t src_len,
+                unsigned char *dest, size_t dest_len) {
+  const unsigned char *cp = (const unsigned char *)src;
+  size_t i = 0;
+
+  if(dest_len < src_len / 2) return 0;
+#ifdef HEX_SIMD
+  if(hex_use_simd()) i = hex_decode_ssse3(cp, src_len, dest);
+#endif
+  for(; i + 1 < src_len; i += 2) {
+    unsigned char hi = __unhex[cp[i]], lo = __unhex[cp[i+1]];
+    if((hi | lo) == 0xff) break;
+    dest[i / 2] = (hi << 4) | lo;
+  }
+  return i / 2;
+}
+
+size_t
+mtev_hex_max_decode_len(size_t src_len) {
+  return src_len / 2;
+}
+
+int
+mtev_hex_encode(const unsigned char *src, size_t src_len,
+                char *dest, size_t dest_len) {
+  size_t i = 0;
+
+  if(dest_len < 2 * src_len) return 0;
+#ifdef HEX_SIMD
+  if(hex_use_simd()) i = hex_encode_ssse3(src, src_len, dest);
+#endif
+  for(; i < src_len; i++) {
+    dest[2*i] = __hex[src[i] >> 4];
+    dest[2*i+1] = __hex[src[i] & 0xf];
+  }
+  return 2 * src_len;
+}
+
+size_t
+mtev_hex_encode_len(size_t src_len) {
+  return 2 * src_len;
+}
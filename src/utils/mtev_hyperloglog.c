@@ -5,27 +5,104 @@
 
 #include <math.h>
 
-#define HLL_NUMERATOR 16777216 /* 1 << 24 */
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define HLL_SEED 0x6F61567A
+/* Precision used while sparse: each entry keeps the top SPARSE_P bits of the
+ * hash as its index, so small sets are counted almost exactly. */
+#define SPARSE_P 25
+#define SPARSE_TMP 64
+#define SERIAL_VERSION 1
+#define SERIAL_SPARSE 0
+#define SERIAL_DENSE 1
 
 struct mtev_hyperloglog {
   uint8_t bitcount;
   size_t size;
+  /* dense: one byte per register, NULL while sparse */
   uint8_t *regs;
+  /* sparse: sorted (index << 6 | rho) entries, one per index, plus a small
+   * unsorted buffer of recent insertions folded in when full */
+  uint32_t *sparse;
+  uint32_t n_sparse;
+  uint32_t sparse_alloc;
+  uint32_t n_tmp;
+  uint32_t tmp[SPARSE_TMP];
 };
 
-/* from the hyperloglog paper */
-static double 
-mtev_hyperloglog_alpha(uint8_t bitcount) {
-  switch (bitcount) {
-  case 4:
-    return 0.673;
-  case 5:
-    return 0.697;
-  case 6:
-    return 0.709;
-  default:
-    return 0.7213 / (1 + 1.079 / (1 << bitcount));
+static inline uint8_t
+hll_rho(uint64_t w, int bits) {
+  /* position of the first 1 bit in the top 'bits' bits of w */
+  if(w == 0) return bits + 1;
+  return __builtin_clzll(w) + 1;
+}
+
+static inline void
+hll_dense_set(mtev_hyperloglog_t *hll, uint32_t index, uint8_t rho) {
+  if(rho > hll->regs[index]) hll->regs[index] = rho;
+}
+
+static inline void
+hll_dense_set_sparse_entry(mtev_hyperloglog_t *hll, uint32_t e) {
+  int shift = SPARSE_P - hll->bitcount;
+  uint32_t sidx = e >> 6, low = sidx & ((1U << shift) - 1);
+  uint8_t rho;
+  if(low) rho = __builtin_clz(low) - (32 - shift) + 1;
+  else rho = (e & 0x3f) + shift;
+  hll_dense_set(hll, sidx >> shift, rho);
+}
+
+static void
+hll_to_dense(mtev_hyperloglog_t *hll) {
+  uint32_t i;
+  if(hll->regs) return;
+  hll->regs = calloc(hll->size, 1);
+  for(i=0; i<hll->n_sparse; i++) hll_dense_set_sparse_entry(hll, hll->sparse[i]);
+  for(i=0; i<hll->n_tmp; i++) hll_dense_set_sparse_entry(hll, hll->tmp[i]);
+  free(hll->sparse);
+  hll->sparse = NULL;
+  hll->n_sparse = hll->sparse_alloc = hll->n_tmp = 0;
+}
+
+static int
+u32_cmp(const void *a, const void *b) {
+  uint32_t av = *(const uint32_t *)a, bv = *(const uint32_t *)b;
+  return (av < bv) ? -1 : (av > bv);
+}
+
+/* Fold the insertion buffer into the sorted list, keeping the largest rho
+ * per index, and go dense once the list costs as much as the registers. */
+static void
+hll_sparse_flush(mtev_hyperloglog_t *hll) {
+  uint32_t i = 0, j = 0, n = 0, *out;
+  if(hll->regs || hll->n_tmp == 0) return;
+  qsort(hll->tmp, hll->n_tmp, sizeof(*hll->tmp), u32_cmp);
+  out = malloc((hll->n_sparse + hll->n_tmp) * sizeof(*out));
+  while(i < hll->n_sparse || j < hll->n_tmp) {
+    uint32_t e;
+    if(j >= hll->n_tmp || (i < hll->n_sparse && hll->sparse[i] <= hll->tmp[j]))
+      e = hll->sparse[i++];
+    else
+      e = hll->tmp[j++];
+    /* sorted by index then rho: a later entry for the same index wins */
+    if(n > 0 && (out[n-1] >> 6) == (e >> 6)) out[n-1] = e;
+    else out[n++] = e;
   }
+  free(hll->sparse);
+  hll->sparse = out;
+  hll->n_sparse = n;
+  hll->sparse_alloc = n;
+  hll->n_tmp = 0;
+  if((size_t)hll->n_sparse * sizeof(*hll->sparse) >= hll->size) hll_to_dense(hll);
+}
+
+static inline void
+hll_sparse_add(mtev_hyperloglog_t *hll, uint32_t e) {
+  hll->tmp[hll->n_tmp++] = e;
+  if(hll->n_tmp == SPARSE_TMP) hll_sparse_flush(hll);
 }
 
 mtev_hyperloglog_t *
@@ -40,7 +117,10 @@ mtev_hyperloglog_alloc(int bitcount)
 
   hll->bitcount = bitcount;
   hll->size = (size_t)1 << bitcount;
-  hll->regs = calloc(hll->size, 1);
+  /* too small for a sparse list to ever pay off */
+  if (hll->size / sizeof(*hll->sparse) <= SPARSE_TMP) {
+    hll->regs = calloc(hll->size, 1);
+  }
   
   return hll;
 }
@@ -49,77 +129,238 @@ void
 mtev_hyperloglog_destroy(mtev_hyperloglog_t *hll)
 {
   free(hll->regs);
+  free(hll->sparse);
   free(hll);
 }
 
+void
+mtev_hyperloglog_add_hash(mtev_hyperloglog_t *hll, uint64_t hash)
+{
+  if (hll->regs) {
+    hll_dense_set(hll, hash >> (64 - hll->bitcount),
+                  hll_rho(hash << hll->bitcount, 64 - hll->bitcount));
+  } else {
+    hll_sparse_add(hll, (uint32_t)(hash >> (64 - SPARSE_P)) << 6 |
+                        hll_rho(hash << SPARSE_P, 64 - SPARSE_P));
+  }
+}
+
 void 
 mtev_hyperloglog_add(mtev_hyperloglog_t *hll, const void *data, size_t len)
 {
-  uint32_t hash, index;
-  uint8_t bitarea;
+  /* share the hash function from the mtev_hash_table */
+  mtev_hyperloglog_add_hash(hll, mtev_hash__hash64(data, len, HLL_SEED));
+}
 
-  /* shift size */
-  bitarea = 32 - hll->bitcount;
+/* Ertl, "New cardinality estimation algorithms for HyperLogLog sketches"
+ * (2017): an estimator from the register histogram that is unbiased over the
+ * whole range without HLL++'s empirical bias tables. */
+static double
+hll_sigma(double x) {
+  double y = 1.0, z = x, zprev;
+  if (x == 1.0) return INFINITY;
+  do {
+    x *= x;
+    zprev = z;
+    z += x * y;
+    y += y;
+  } while (z != zprev);
+  return z;
+}
 
-  /* share the hash function from the mtev_hash_table */
-  hash = mtev_hash__hash(data, len, 0x6F61567A);
+static double
+hll_tau(double x) {
+  double y = 1.0, z = 1.0 - x, zprev;
+  if (x == 0.0 || x == 1.0) return 0.0;
+  do {
+    x = sqrt(x);
+    zprev = z;
+    y *= 0.5;
+    z -= (1.0 - x) * (1.0 - x) * y;
+  } while (z != zprev);
+  return z / 3.0;
+}
 
-  /* pick initial index based on precision */
-  index = (hash >> bitarea);
+static double
+hll_dense_estimate(mtev_hyperloglog_t *hll) {
+  uint32_t hist[66] = { 0 };
+  int q = 64 - hll->bitcount, k;
+  double m = (double)hll->size, z;
+  size_t i;
 
-  /* shift out the index bits from the hash */
-  hash = hash << hll->bitcount | (1 << (hll->bitcount -1 ));
+  for (i = 0; i < hll->size; i++) hist[hll->regs[i]]++;
+  z = m * hll_tau(1.0 - (double)hist[q + 1] / m);
+  for (k = q; k >= 1; k--) z = 0.5 * (z + hist[k]);
+  z += m * hll_sigma((double)hist[0] / m);
+  return (0.5 / log(2.0)) * m * m / z;
+}
+
+double 
+mtev_hyperloglog_size(mtev_hyperloglog_t *hll) 
+{
+  if (hll->regs) return hll_dense_estimate(hll);
 
-  /* count leading zeroes */
-  int l = __builtin_clz(hash) + 1;
+  /* linear counting over the 2^SPARSE_P sparse registers */
+  hll_sparse_flush(hll);
+  if (hll->regs) return hll_dense_estimate(hll);
+  double m = (double)(1 << SPARSE_P);
+  return m * log(m / (m - (double)hll->n_sparse));
+}
 
-  uint8_t y = hll->regs[index];
+int
+mtev_hyperloglog_merge(mtev_hyperloglog_t *tgt, mtev_hyperloglog_t *src)
+{
+  uint32_t i;
+  if (tgt->bitcount != src->bitcount) return -1;
+  if (tgt == src) return 0;
+  if (!src->regs) {
+    for (i = 0; i < src->n_sparse; i++) {
+      if (tgt->regs) hll_dense_set_sparse_entry(tgt, src->sparse[i]);
+      else hll_sparse_add(tgt, src->sparse[i]);
+    }
+    for (i = 0; i < src->n_tmp; i++) {
+      if (tgt->regs) hll_dense_set_sparse_entry(tgt, src->tmp[i]);
+      else hll_sparse_add(tgt, src->tmp[i]);
+    }
+    return 0;
+  }
 
-  /* save the register if we got bigger */
-  if (l > y) {
-    hll->regs[index] = l;
+  hll_to_dense(tgt);
+  i = 0;
+#ifdef __SSE2__
+  for (; i + 16 <= tgt->size; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(tgt->regs + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(src->regs + i));
+    _mm_storeu_si128((__m128i *)(tgt->regs + i), _mm_max_epu8(a, b));
   }
+#endif
+  for (; i < tgt->size; i++) {
+    if (src->regs[i] > tgt->regs[i]) tgt->regs[i] = src->regs[i];
+  }
+  return 0;
 }
 
-static inline double 
-mtev_hyperloglog_estimate(mtev_hyperloglog_t *hll, int *zero_register_count)
-{
-  uint64_t int_sum = 0;
-  double m, sum = 0;
-  int c = (1 << hll->bitcount);
+/* Serialized form: version, bitcount, encoding, then either a varint entry
+ * count followed by varint deltas between the sorted sparse entries, or the
+ * dense registers packed six bits apiece. */
+static size_t
+varint_size(uint32_t v) {
+  size_t n = 1;
+  while (v >= 0x80) { v >>= 7; n++; }
+  return n;
+}
 
-  m = mtev_hyperloglog_alpha(hll->bitcount) * c * c;
+static uint8_t *
+varint_put(uint8_t *p, uint32_t v) {
+  while (v >= 0x80) { *p++ = (v & 0x7f) | 0x80; v >>= 7; }
+  *p++ = v;
+  return p;
+}
 
-  /* do scaled integer math */
-  for (int i = 0; i < c; i++) {
-    uint8_t x = hll->regs[i];
-    *zero_register_count += x == 0;
-    int_sum += HLL_NUMERATOR / (1 << x);
+static const uint8_t *
+varint_get(const uint8_t *p, const uint8_t *end, uint32_t *v) {
+  int shift = 0;
+  *v = 0;
+  while (p < end && shift < 32) {
+    *v |= (uint32_t)(*p & 0x7f) << shift;
+    if (!(*p++ & 0x80)) return p;
+    shift += 7;
   }
+  return NULL;
+}
 
-  /* unscale */
-  sum = ((double) int_sum / (double)HLL_NUMERATOR);
-  return m / sum;
+size_t
+mtev_hyperloglog_serialized_size(mtev_hyperloglog_t *hll)
+{
+  size_t len = 3;
+  uint32_t i, prev = 0;
+  hll_sparse_flush(hll);
+  if (hll->regs) return len + (hll->size * 6 + 7) / 8;
+  len += varint_size(hll->n_sparse);
+  for (i = 0; i < hll->n_sparse; i++) {
+    len += varint_size(hll->sparse[i] - prev);
+    prev = hll->sparse[i];
+  }
+  return len;
 }
 
-double 
-mtev_hyperloglog_size(mtev_hyperloglog_t *hll) 
+ssize_t
+mtev_hyperloglog_serialize(mtev_hyperloglog_t *hll, void *buf, size_t len)
 {
-  int zc = 0;
-  double est = mtev_hyperloglog_estimate(hll, &zc);
+  size_t need = mtev_hyperloglog_serialized_size(hll), i;
+  uint8_t *p = buf;
+  uint32_t prev = 0;
 
-  if (est <= (5.0 / 2.0 * (double)hll->size)) {
-    if(zc > 0) {
-      est = (double)hll->size * log((double)hll->size / zc);
+  if (len < need) return -1;
+  *p++ = SERIAL_VERSION;
+  *p++ = hll->bitcount;
+  if (!hll->regs) {
+    *p++ = SERIAL_SPARSE;
+    p = varint_put(p, hll->n_sparse);
+    for (i = 0; i < hll->n_sparse; i++) {
+      p = varint_put(p, hll->sparse[i] - prev);
+      prev = hll->sparse[i];
     }
-  } else if (est > (1.0 / 30.0) * 4294967296.0) {
-    est = -4294967296.0 * log(1.0 - (est / 4294967296.0));
+    return need;
   }
-
-  return est;
+  *p++ = SERIAL_DENSE;
+  memset(p, 0, need - 3);
+  for (i = 0; i < hll->size; i++) {
+    size_t bit = i * 6;
+    uint16_t v = (uint16_t)hll->regs[i] << (bit & 7);
+    p[bit / 8] |= v & 0xff;
+    if ((bit & 7) > 2) p[bit / 8 + 1] |= v >> 8;
+  }
+  return need;
 }
 
+mtev_hyperloglog_t *
+mtev_hyperloglog_deserialize(const void *buf, size_t len)
+{
+  const uint8_t *p = buf, *end = p + len;
+  mtev_hyperloglog_t *hll;
+  uint32_t n, i, delta, prev = 0;
 
+  if (len < 3 || p[0] != SERIAL_VERSION) return NULL;
+  if (NULL == (hll = mtev_hyperloglog_alloc(p[1]))) return NULL;
+  if (p[2] == SERIAL_DENSE) {
+    if (len != 3 + (hll->size * 6 + 7) / 8) goto bad;
+    hll_to_dense(hll);
+    p += 3;
+    for (i = 0; i < hll->size; i++) {
+      size_t bit = i * 6;
+      uint16_t v = p[bit / 8];
+      if ((bit & 7) > 2) v |= (uint16_t)p[bit / 8 + 1] << 8;
+      hll->regs[i] = (v >> (bit & 7)) & 0x3f;
+      if (hll->regs[i] > 65 - hll->bitcount) goto bad;
+    }
+    return hll;
+  }
+  if (p[2] != SERIAL_SPARSE) goto bad;
+  if (NULL == (p = varint_get(p + 3, end, &n))) goto bad;
+  /* a sparse list never grows past the size of the dense registers */
+  if ((size_t)n * sizeof(*hll->sparse) > hll->size) goto bad;
+  if (!hll->regs) {
+    hll->sparse = malloc((n ? n : 1) * sizeof(*hll->sparse));
+    hll->sparse_alloc = n;
+  }
+  for (i = 0; i < n; i++) {
+    uint32_t e;
+    if (NULL == (p = varint_get(p, end, &delta))) goto bad;
+    e = prev + delta;
+    /* strictly increasing indices, each within range, with a sane rho */
+    if (e < prev || (i > 0 && (e >> 6) == (prev >> 6)) ||
+        (e >> 6) >= (1U << SPARSE_P) || (e & 0x3f) == 0 ||
+        (e & 0x3f) > 64 - SPARSE_P + 1) goto bad;
+    prev = e;
+    /* tiny hyperloglogs are always dense */
+    if (hll->regs) hll_dense_set_sparse_entry(hll, e);
+    else hll->sparse[hll->n_sparse++] = e;
+  }
+  if (p != end) goto bad;
+  return hll;
 
-
-
+ bad:
+  mtev_hyperloglog_destroy(hll);
+  return NULL;
+}
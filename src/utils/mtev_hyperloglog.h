@@ -2,6 +2,8 @@
 #define MTEV_HYPER_LOG_LOG_H
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 typedef struct mtev_hyperloglog mtev_hyperloglog_t;
 
@@ -11,4 +13,52 @@ void mtev_hyperloglog_destroy(mtev_hyperloglog_t *hll);
 void mtev_hyperloglog_add(mtev_hyperloglog_t *hll, const void *data, size_t len);
 double mtev_hyperloglog_size(mtev_hyperloglog_t *hll);
 
+/*! \fn void mtev_hyperloglog_add_hash(mtev_hyperloglog_t *hll, uint64_t hash)
+    \brief Add an item by its (well mixed) 64bit hash.
+    \param hll The hyperloglog.
+    \param hash A hash of the item, such as one from mtev_hash__hash64.
+
+    mtev_hyperloglog_add(hll, data, len) is the same as adding
+    mtev_hash__hash64(data, len, ...) with the hyperloglog's own seed.
+    A hyperloglog starts with a sparse representation, exact up to a few
+    thousand items, and converts itself to dense registers once those
+    would be smaller.
+ */
+void mtev_hyperloglog_add_hash(mtev_hyperloglog_t *hll, uint64_t hash);
+
+/*! \fn int mtev_hyperloglog_merge(mtev_hyperloglog_t *tgt, mtev_hyperloglog_t *src)
+    \brief Merge one hyperloglog into another.
+    \param tgt The hyperloglog updated to count the union of both.
+    \param src The hyperloglog merged in (not modified in content).
+    \return 0 on success, -1 if the two do not have the same bitcount.
+ */
+int mtev_hyperloglog_merge(mtev_hyperloglog_t *tgt, mtev_hyperloglog_t *src);
+
+/*! \fn size_t mtev_hyperloglog_serialized_size(mtev_hyperloglog_t *hll)
+    \brief Report the number of bytes needed to serialize a hyperloglog.
+    \param hll The hyperloglog.
+    \return The exact size mtev_hyperloglog_serialize will write.
+ */
+size_t mtev_hyperloglog_serialized_size(mtev_hyperloglog_t *hll);
+
+/*! \fn ssize_t mtev_hyperloglog_serialize(mtev_hyperloglog_t *hll, void *buf, size_t len)
+    \brief Write a compact, portable encoding of a hyperloglog.
+    \param hll The hyperloglog.
+    \param buf The output buffer.
+    \param len The size of buf.
+    \return The number of bytes written or -1 if buf is too small.
+
+    Sparse hyperloglogs are delta/varint encoded; dense ones pack each
+    register into six bits.
+ */
+ssize_t mtev_hyperloglog_serialize(mtev_hyperloglog_t *hll, void *buf, size_t len);
+
+/*! \fn mtev_hyperloglog_t *mtev_hyperloglog_deserialize(const void *buf, size_t len)
+    \brief Recreate a hyperloglog from mtev_hyperloglog_serialize output.
+    \param buf The serialized bytes.
+    \param len The number of bytes.
+    \return A new hyperloglog or NULL if the input is malformed.
+ */
+mtev_hyperloglog_t *mtev_hyperloglog_deserialize(const void *buf, size_t len);
+
 #endif
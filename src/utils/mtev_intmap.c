@@ -0,0 +1,396 @@
+/*
+ * Copyright (c) 2017, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name Circonus, Inc. nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "mtev_defines.h"
+#include "mtev_intmap.h"
+#include "mtev_memory.h"
+#include "mtev_atomic.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ck_pr.h>
+
+/* All three maps share one engine: open addressing with linear probing
+ * over slots holding the key (as two 64-bit words) and the value.
+ *
+ * A slot's ctrl word is EMPTY, DELETED, or a tag taken from the high
+ * bits of the hash.  Writers fill in the key and value before storing
+ * the tag, and once a slot carries a key it is never reused for another
+ * key in the same table: deletes leave a DELETED marker and the table
+ * is rebuilt (and the old one retired through an epoch) when markers
+ * and entries together pass 3/4 of the slots.  That lets readers probe
+ * without locks or retries.
+ */
+
+#define SLOT_EMPTY   0
+#define SLOT_DELETED 1
+#define SLOT_TAG(h)  ((uint32_t)((h) >> 32) | 2)
+#define MIN_SLOTS    16
+
+struct imap_slot {
+  uint64_t k0;
+  uint64_t k1;
+  void *value;
+  uint32_t ctrl;
+};
+
+struct imap_table {
+  uint64_t mask;
+  uint64_t used; /* live entries plus DELETED markers */
+  struct imap_slot slots[];
+};
+
+struct imap {
+  struct imap_table *table;
+  uint64_t count;
+  uint64_t seed;
+  mtev_boolean wide;
+  mtev_spinlock_t lock;
+};
+
+static inline uint64_t
+fmix64(uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+static inline uint64_t
+imap_hash(struct imap *m, uint64_t k0, uint64_t k1) {
+  uint64_t h = fmix64(k0 ^ m->seed);
+  if(m->wide) h = fmix64(h ^ k1);
+  return h;
+}
+
+static struct imap_table *
+imap_table_alloc(uint64_t nslots) {
+  struct imap_table *t;
+  size_t len = sizeof(*t) + nslots * sizeof(struct imap_slot);
+  t = mtev_memory_safe_malloc(len);
+  memset(t, 0, len);
+  t->mask = nslots - 1;
+  return t;
+}
+
+static struct imap *
+imap_create(size_t size_hint, mtev_boolean wide) {
+  struct imap *m;
+  uint64_t nslots = MIN_SLOTS;
+
+  mtev_memory_init_thread();
+  while(nslots * 3 / 4 < size_hint) nslots <<= 1;
+  m = calloc(1, sizeof(*m));
+  m->wide = wide;
+  m->seed = fmix64((uint64_t)(uintptr_t)m ^ ((uint64_t)time(NULL) << 32));
+  m->table = imap_table_alloc(nslots);
+  return m;
+}
+
+static void
+imap_destroy(struct imap *m, void (*valfree)(void *)) {
+  struct imap_table *t = m->table;
+  uint64_t i;
+  if(valfree) {
+    for(i=0; i<=t->mask; i++)
+      if(t->slots[i].ctrl > SLOT_DELETED) valfree(t->slots[i].value);
+  }
+  mtev_memory_init_thread();
+  mtev_memory_safe_free(t);
+  free(m);
+}
+
+/* Find the slot holding a key.  Stops at the first EMPTY slot, which
+ * is returned through empty for inserts. */
+static inline struct imap_slot *
+imap_probe(struct imap_table *t, uint64_t h, uint64_t k0, uint64_t k1,
+           struct imap_slot **empty) {
+  uint32_t tag = SLOT_TAG(h);
+  uint64_t i = h & t->mask;
+  for(;;) {
+    struct imap_slot *s = &t->slots[i];
+    uint32_t ctrl = ck_pr_load_32(&s->ctrl);
+    if(ctrl == SLOT_EMPTY) {
+      if(empty) *empty = s;
+      return NULL;
+    }
+    if(ctrl == tag) {
+      ck_pr_fence_load();
+      if(s->k0 == k0 && s->k1 == k1) return s;
+    }
+    i = (i + 1) & t->mask;
+  }
+}
+
+static mtev_boolean
+imap_get(struct imap *m, uint64_t k0, uint64_t k1, void **value) {
+  uint64_t h = imap_hash(m, k0, k1);
+  struct imap_slot *s;
+
+  mtev_memory_init_thread();
+  mtev_memory_begin();
+  s = imap_probe(ck_pr_load_ptr(&m->table), h, k0, k1, NULL);
+  if(s && value) *value = ck_pr_load_ptr(&s->value);
+  mtev_memory_end();
+  return s ? mtev_true : mtev_false;
+}
+
+static void
+imap_place(struct imap_table *t, struct imap_slot *s, uint64_t h,
+           uint64_t k0, uint64_t k1, void *value) {
+  s->k0 = k0;
+  s->k1 = k1;
+  s->value = value;
+  ck_pr_fence_store();
+  ck_pr_store_32(&s->ctrl, SLOT_TAG(h));
+  t->used++;
+}
+
+/* Called with the lock held when one more slot is about to be used.
+ * Doubles when live entries are over half of the slots, otherwise
+ * rebuilds at the same size to drop DELETED markers. */
+static void
+imap_make_room(struct imap *m) {
+  struct imap_table *t = m->table, *nt;
+  uint64_t nslots = t->mask + 1, i;
+
+  if((t->used + 1) * 4 <= nslots * 3) return;
+  if((m->count + 1) * 2 > nslots) nslots <<= 1;
+  nt = imap_table_alloc(nslots);
+  for(i=0; i<=t->mask; i++) {
+    struct imap_slot *s = &t->slots[i], *e = NULL;
+    uint64_t h;
+    if(s->ctrl <= SLOT_DELETED) continue;
+    h = imap_hash(m, s->k0, s->k1);
+    imap_probe(nt, h, s->k0, s->k1, &e);
+    imap_place(nt, e, h, s->k0, s->k1, s->value);
+  }
+  ck_pr_fence_store();
+  ck_pr_store_ptr(&m->table, nt);
+  mtev_memory_safe_free(t);
+}
+
+static mtev_boolean
+imap_set(struct imap *m, uint64_t k0, uint64_t k1, void *value,
+         mtev_boolean replace, void **old) {
+  uint64_t h = imap_hash(m, k0, k1);
+  struct imap_slot *s, *e = NULL;
+  mtev_boolean existed = mtev_false;
+
+  mtev_memory_init_thread();
+  mtev_spinlock_lock(&m->lock);
+  s = imap_probe(m->table, h, k0, k1, NULL);
+  if(s) {
+    existed = mtev_true;
+    if(old) *old = s->value;
+    if(replace) ck_pr_store_ptr(&s->value, value);
+  }
+  else {
+    if(old) *old = NULL;
+    imap_make_room(m);
+    imap_probe(m->table, h, k0, k1, &e);
+    imap_place(m->table, e, h, k0, k1, value);
+    ck_pr_store_64(&m->count, m->count + 1);
+  }
+  mtev_spinlock_unlock(&m->lock);
+  return existed;
+}
+
+static mtev_boolean
+imap_delete(struct imap *m, uint64_t k0, uint64_t k1, void (*valfree)(void *)) {
+  uint64_t h = imap_hash(m, k0, k1);
+  struct imap_slot *s;
+  void *value = NULL;
+
+  mtev_memory_init_thread();
+  mtev_spinlock_lock(&m->lock);
+  s = imap_probe(m->table, h, k0, k1, NULL);
+  if(s) {
+    value = s->value;
+    ck_pr_store_32(&s->ctrl, SLOT_DELETED);
+    ck_pr_store_64(&m->count, m->count - 1);
+  }
+  mtev_spinlock_unlock(&m->lock);
+  if(s && valfree) mtev_memory_defer_free(value, valfree);
+  return s ? mtev_true : mtev_false;
+}
+
+static mtev_boolean
+imap_next(struct imap *m, mtev_intmap_iter_t *iter, uint64_t *k0, uint64_t *k1,
+          void **value) {
+  struct imap_table *t;
+  mtev_boolean found = mtev_false;
+
+  mtev_memory_init_thread();
+  mtev_memory_begin();
+  t = ck_pr_load_ptr(&m->table);
+  while(iter->pos <= t->mask) {
+    struct imap_slot *s = &t->slots[iter->pos++];
+    if(ck_pr_load_32(&s->ctrl) <= SLOT_DELETED) continue;
+    ck_pr_fence_load();
+    *k0 = s->k0;
+    *k1 = s->k1;
+    if(value) *value = ck_pr_load_ptr(&s->value);
+    found = mtev_true;
+    break;
+  }
+  mtev_memory_end();
+  return found;
+}
+
+static inline size_t
+imap_size(struct imap *m) {
+  return (size_t)ck_pr_load_64(&m->count);
+}
+
+#define U64(m) ((struct imap *)(m))
+
+mtev_u64map_t *
+mtev_u64map_create(size_t size_hint) {
+  return (mtev_u64map_t *)imap_create(size_hint, mtev_false);
+}
+void
+mtev_u64map_destroy(mtev_u64map_t *m, void (*valfree)(void *)) {
+  imap_destroy(U64(m), valfree);
+}
+size_t
+mtev_u64map_size(mtev_u64map_t *m) {
+  return imap_size(U64(m));
+}
+mtev_boolean
+mtev_u64map_get(mtev_u64map_t *m, uint64_t key, void **value) {
+  return imap_get(U64(m), key, 0, value);
+}
+mtev_boolean
+mtev_u64map_put(mtev_u64map_t *m, uint64_t key, void *value) {
+  return !imap_set(U64(m), key, 0, value, mtev_false, NULL);
+}
+mtev_boolean
+mtev_u64map_set(mtev_u64map_t *m, uint64_t key, void *value, void **old) {
+  return imap_set(U64(m), key, 0, value, mtev_true, old);
+}
+mtev_boolean
+mtev_u64map_delete(mtev_u64map_t *m, uint64_t key, void (*valfree)(void *)) {
+  return imap_delete(U64(m), key, 0, valfree);
+}
+mtev_boolean
+mtev_u64map_next(mtev_u64map_t *m, mtev_intmap_iter_t *iter, uint64_t *key, void **value) {
+  uint64_t k1;
+  return imap_next(U64(m), iter, key, &k1, value);
+}
+
+mtev_ptrmap_t *
+mtev_ptrmap_create(size_t size_hint) {
+  return (mtev_ptrmap_t *)imap_create(size_hint, mtev_false);
+}
+void
+mtev_ptrmap_destroy(mtev_ptrmap_t *m, void (*valfree)(void *)) {
+  imap_destroy(U64(m), valfree);
+}
+size_t
+mtev_ptrmap_size(mtev_ptrmap_t *m) {
+  return imap_size(U64(m));
+}
+mtev_boolean
+mtev_ptrmap_get(mtev_ptrmap_t *m, const void *key, void **value) {
+  return imap_get(U64(m), (uintptr_t)key, 0, value);
+}
+mtev_boolean
+mtev_ptrmap_put(mtev_ptrmap_t *m, const void *key, void *value) {
+  return !imap_set(U64(m), (uintptr_t)key, 0, value, mtev_false, NULL);
+}
+mtev_boolean
+mtev_ptrmap_set(mtev_ptrmap_t *m, const void *key, void *value, void **old) {
+  return imap_set(U64(m), (uintptr_t)key, 0, value, mtev_true, old);
+}
+mtev_boolean
+mtev_ptrmap_delete(mtev_ptrmap_t *m, const void *key, void (*valfree)(void *)) {
+  return imap_delete(U64(m), (uintptr_t)key, 0, valfree);
+}
+mtev_boolean
+mtev_ptrmap_next(mtev_ptrmap_t *m, mtev_intmap_iter_t *iter, const void **key, void **value) {
+  uint64_t k0, k1;
+  if(!imap_next(U64(m), iter, &k0, &k1, value)) return mtev_false;
+  *key = (const void *)(uintptr_t)k0;
+  return mtev_true;
+}
+
+#define UUID_WORDS(u, k0, k1) do { \
+  memcpy(&(k0), (u), sizeof(uint64_t)); \
+  memcpy(&(k1), (const unsigned char *)(u) + sizeof(uint64_t), sizeof(uint64_t)); \
+} while(0)
+
+mtev_uuidmap_t *
+mtev_uuidmap_create(size_t size_hint) {
+  return (mtev_uuidmap_t *)imap_create(size_hint, mtev_true);
+}
+void
+mtev_uuidmap_destroy(mtev_uuidmap_t *m, void (*valfree)(void *)) {
+  imap_destroy(U64(m), valfree);
+}
+size_t
+mtev_uuidmap_size(mtev_uuidmap_t *m) {
+  return imap_size(U64(m));
+}
+mtev_boolean
+mtev_uuidmap_get(mtev_uuidmap_t *m, const uuid_t key, void **value) {
+  uint64_t k0, k1;
+  UUID_WORDS(key, k0, k1);
+  return imap_get(U64(m), k0, k1, value);
+}
+mtev_boolean
+mtev_uuidmap_put(mtev_uuidmap_t *m, const uuid_t key, void *value) {
+  uint64_t k0, k1;
+  UUID_WORDS(key, k0, k1);
+  return !imap_set(U64(m), k0, k1, value, mtev_false, NULL);
+}
+mtev_boolean
+mtev_uuidmap_set(mtev_uuidmap_t *m, const uuid_t key, void *value, void **old) {
+  uint64_t k0, k1;
+  UUID_WORDS(key, k0, k1);
+  return imap_set(U64(m), k0, k1, value, mtev_true, old);
+}
+mtev_boolean
+mtev_uuidmap_delete(mtev_uuidmap_t *m, const uuid_t key, void (*valfree)(void *)) {
+  uint64_t k0, k1;
+  UUID_WORDS(key, k0, k1);
+  return imap_delete(U64(m), k0, k1, valfree);
+}
+mtev_boolean
+mtev_uuidmap_next(mtev_uuidmap_t *m, mtev_intmap_iter_t *iter, uuid_t key, void **value) {
+  uint64_t k0, k1;
+  if(!imap_next(U64(m), iter, &k0, &k1, value)) return mtev_false;
+  memcpy(key, &k0, sizeof(k0));
+  memcpy(key + sizeof(k0), &k1, sizeof(k1));
+  return mtev_true;
+}
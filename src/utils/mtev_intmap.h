@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2017, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name Circonus, Inc. nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _UTILS_MTEV_INTMAP_H
+#define _UTILS_MTEV_INTMAP_H
+
+#include "mtev_defines.h"
+#include <uuid/uuid.h>
+
+/* Hash maps keyed by 64-bit integers, pointers and uuids.
+ *
+ * Keys are stored inline in the slot and hashed with an integer mixer,
+ * so nothing is allocated or copied per key.  Reads and iteration are
+ * lock-free and may run concurrently with writes; writers take a
+ * per-map lock.  Tables and deleted values are reclaimed through
+ * mtev_memory epochs, so every thread using a map is registered with
+ * mtev_memory_init_thread on first use.  Iteration during writes
+ * returns every entry present throughout, but a resize in the middle
+ * can cause entries to be skipped or repeated.
+ */
+
+typedef struct mtev_u64map mtev_u64map_t;
+typedef struct mtev_ptrmap mtev_ptrmap_t;
+typedef struct mtev_uuidmap mtev_uuidmap_t;
+
+typedef struct {
+  uint64_t pos;
+} mtev_intmap_iter_t;
+
+#define MTEV_INTMAP_ITER_ZERO { 0 }
+
+/*! \fn mtev_u64map_t *mtev_u64map_create(size_t size_hint)
+    \brief Create a map keyed by uint64_t.
+    \param size_hint the expected number of entries
+    \return a new map
+ */
+API_EXPORT(mtev_u64map_t *)
+  mtev_u64map_create(size_t size_hint);
+
+/*! \fn void mtev_u64map_destroy(mtev_u64map_t *m, void (*valfree)(void *))
+    \brief Destroy a map.  No other thread may be using it.
+    \param m the map
+    \param valfree called on each value if not NULL
+ */
+API_EXPORT(void)
+  mtev_u64map_destroy(mtev_u64map_t *m, void (*valfree)(void *));
+
+/*! \fn size_t mtev_u64map_size(mtev_u64map_t *m)
+    \brief Return the number of entries in a map.
+ */
+API_EXPORT(size_t)
+  mtev_u64map_size(mtev_u64map_t *m);
+
+/*! \fn mtev_boolean mtev_u64map_get(mtev_u64map_t *m, uint64_t key, void **value)
+    \brief Look up a key.
+    \param m the map
+    \param key the key
+    \param value set to the value if found (may be NULL)
+    \return mtev_true if the key is present
+ */
+API_EXPORT(mtev_boolean)
+  mtev_u64map_get(mtev_u64map_t *m, uint64_t key, void **value);
+
+/*! \fn mtev_boolean mtev_u64map_put(mtev_u64map_t *m, uint64_t key, void *value)
+    \brief Insert a key if it is not present.
+    \return mtev_true if inserted, mtev_false if the key already existed
+ */
+API_EXPORT(mtev_boolean)
+  mtev_u64map_put(mtev_u64map_t *m, uint64_t key, void *value);
+
+/*! \fn mtev_boolean mtev_u64map_set(mtev_u64map_t *m, uint64_t key, void *value, void **old)
+    \brief Insert a key or replace its value.
+    \param old set to the replaced value (NULL if none) if not NULL
+    \return mtev_true if an existing value was replaced
+
+    Readers may still be using the replaced value; free it with
+    mtev_memory_defer_free.
+ */
+API_EXPORT(mtev_boolean)
+  mtev_u64map_set(mtev_u64map_t *m, uint64_t key, void *value, void **old);
+
+/*! \fn mtev_boolean mtev_u64map_delete(mtev_u64map_t *m, uint64_t key, void (*valfree)(void *))
+    \brief Remove a key.
+    \param valfree if not NULL, called on the value once no reader can hold it
+    \return mtev_true if the key was present
+ */
+API_EXPORT(mtev_boolean)
+  mtev_u64map_delete(mtev_u64map_t *m, uint64_t key, void (*valfree)(void *));
+
+/*! \fn mtev_boolean mtev_u64map_next(mtev_u64map_t *m, mtev_intmap_iter_t *iter, uint64_t *key, void **value)
+    \brief Advance an iterator initialized with MTEV_INTMAP_ITER_ZERO.
+    \return mtev_true if key and value were set, mtev_false at the end
+ */
+API_EXPORT(mtev_boolean)
+  mtev_u64map_next(mtev_u64map_t *m, mtev_intmap_iter_t *iter, uint64_t *key, void **value);
+
+/* Pointer keys; same semantics as the u64 map. */
+API_EXPORT(mtev_ptrmap_t *)
+  mtev_ptrmap_create(size_t size_hint);
+API_EXPORT(void)
+  mtev_ptrmap_destroy(mtev_ptrmap_t *m, void (*valfree)(void *));
+API_EXPORT(size_t)
+  mtev_ptrmap_size(mtev_ptrmap_t *m);
+API_EXPORT(mtev_boolean)
+  mtev_ptrmap_get(mtev_ptrmap_t *m, const void *key, void **value);
+API_EXPORT(mtev_boolean)
+  mtev_ptrmap_put(mtev_ptrmap_t *m, const void *key, void *value);
+API_EXPORT(mtev_boolean)
+  mtev_ptrmap_set(mtev_ptrmap_t *m, const void *key, void *value, void **old);
+API_EXPORT(mtev_boolean)
+  mtev_ptrmap_delete(mtev_ptrmap_t *m, const void *key, void (*valfree)(void *));
+API_EXPORT(mtev_boolean)
+  mtev_ptrmap_next(mtev_ptrmap_t *m, mtev_intmap_iter_t *iter, const void **key, void **value);
+
+/* uuid keys; same semantics as the u64 map. */
+API_EXPORT(mtev_uuidmap_t *)
+  mtev_uuidmap_create(size_t size_hint);
+API_EXPORT(void)
+  mtev_uuidmap_destroy(mtev_uuidmap_t *m, void (*valfree)(void *));
+API_EXPORT(size_t)
+  mtev_uuidmap_size(mtev_uuidmap_t *m);
+API_EXPORT(mtev_boolean)
+  mtev_uuidmap_get(mtev_uuidmap_t *m, const uuid_t key, void **value);
+API_EXPORT(mtev_boolean)
+  mtev_uuidmap_put(mtev_uuidmap_t *m, const uuid_t key, void *value);
+API_EXPORT(mtev_boolean)
+  mtev_uuidmap_set(mtev_uuidmap_t *m, const uuid_t key, void *value, void **old);
+API_EXPORT(mtev_boolean)
+  mtev_uuidmap_delete(mtev_uuidmap_t *m, const uuid_t key, void (*valfree)(void *));
+API_EXPORT(mtev_boolean)
+  mtev_uuidmap_next(mtev_uuidmap_t *m, mtev_intmap_iter_t *iter, uuid_t key, void **value);
+
+#endif
@@ -31,27 +31,108 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sched.h>
+#include <time.h>
 #include <ck_epoch.h>
 #include <ck_fifo.h>
+#include <ck_spinlock.h>
+#ifdef HAVE_MALLOC_USABLE_SIZE
+#include <malloc.h>
+#endif
 #include "mtev_log.h"
 #include "mtev_memory.h"
 #include "mtev_thread.h"
+#include "mtev_stacktrace.h"
 
 #if defined(HAVE_LIBUMEM) && defined(HAVE_UMEM_H)
 #include <umem.h>
 #endif
 #define MTEV_EPOCH_SAFE_MAGIC 0x5afe5afe
 
+/* Each thread hands its deferred frees to the reclaimers once it has
+ * accumulated this many of them. */
+#define GC_DEFAULT_BATCH 4096
+/* Deferred frees outstanding process-wide before freeing threads are
+ * made to wait on reclamation. */
+#define GC_DEFAULT_MAX_PENDING (1 << 20)
+/* Thread-local deferrals are folded into the global pending count this
+ * often, to keep the shared counter off the free path. */
+#define GC_ACCOUNT_INTERVAL 256
+/* Most batches one reclaimer takes per grace period; more than this
+ * queued (with no idle reclaimer) grows the pool. */
+#define GC_GRAB_MAX 32
+#define GC_AUTO_MAX_THREADS 8
+#define GC_MAX_THREADS 32
+#define GC_BACKPRESSURE_USEC 100
+#define GC_BACKPRESSURE_ROUNDS 100
+
+struct asynch_reclaim;
+
 static int initialized = 0;
 static int asynch_gc = 0;
-static ck_fifo_spsc_t gc_queue;
+static pthread_mutex_t gc_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gc_queue_cv = PTHREAD_COND_INITIALIZER;
+static struct asynch_reclaim *gc_queue_head;
+static struct asynch_reclaim **gc_queue_tail = &gc_queue_head;
+static int gc_queue_len;
+static int gc_threads_idle;
+static int gc_threads_max;
+static uint32_t gc_batch = GC_DEFAULT_BATCH;
+static int64_t gc_max_pending = GC_DEFAULT_MAX_PENDING;
+static mtev_memory_gc_stats_t gc_stats;
 static __thread ck_fifo_spsc_t *return_gc_queue;
+static __thread uint32_t tls_deferred; /* not yet in gc_stats.pending */
+static __thread uint32_t tls_batch;    /* deferred since last handoff */
+static __thread mtev_boolean tls_reclaim_wanted;
+static __thread mtev_boolean tls_in_reclaim;
 static ck_epoch_t epoch_ht;
 static __thread ck_epoch_record_t *epoch_rec;
 static void *mtev_memory_gc(void *unused);
 static mtev_log_stream_t mem_debug = NULL;
 static pthread_mutex_t mem_debug_lock = PTHREAD_MUTEX_INITIALIZER;
 
+#define GC_STAT(f) ((uint64_t *)&gc_stats.f)
+
+static inline void
+gc_account_flush(void) {
+  int64_t pending, peak;
+  if(tls_deferred == 0) return;
+  pending = (int64_t)ck_pr_faa_64(GC_STAT(pending), tls_deferred) + tls_deferred;
+  tls_deferred = 0;
+  while(pending > (peak = (int64_t)ck_pr_load_64(GC_STAT(peak)))) {
+    if(ck_pr_cas_64(GC_STAT(peak), (uint64_t)peak, (uint64_t)pending)) break;
+  }
+}
+
+static inline void
+gc_account_dispatch(unsigned long n) {
+  if(n == 0) return;
+  ck_pr_sub_64(GC_STAT(pending), n);
+  ck_pr_add_64(GC_STAT(dispatched), n);
+}
+
+static int
+gc_auto_threads(void) {
+  long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int n = (ncpus > 0) ? (int)(ncpus / 8) : 1;
+  if(n < 1) n = 1;
+  if(n > GC_AUTO_MAX_THREADS) n = GC_AUTO_MAX_THREADS;
+  return n;
+}
+
+static mtev_boolean
+gc_spawn_reclaimer(void) {
+  pthread_attr_t tattr;
+  pthread_t tid;
+  int rv;
+  pthread_attr_init(&tattr);
+  pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED);
+  rv = pthread_create(&tid, &tattr, mtev_memory_gc, NULL);
+  pthread_attr_destroy(&tattr);
+  return (rv == 0) ? mtev_true : mtev_false;
+}
+
 void mtev_memory_init_thread() {
   if(epoch_rec == NULL) {
     epoch_rec = malloc(sizeof(*epoch_rec));
@@ -60,26 +141,52 @@ void mtev_memory_init_thread() {
 }
 
 void mtev_memory_init() {
-  pthread_attr_t tattr;
-  pthread_t tid;
   if(initialized) return;
   initialized = 1;
   ck_epoch_init(&epoch_ht);
   mtev_memory_init_thread();
 
-  ck_fifo_spsc_init(&gc_queue, malloc(sizeof(ck_fifo_spsc_entry_t)));
-  pthread_attr_init(&tattr);
-  pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED);
+  if(gc_threads_max == 0) gc_threads_max = gc_auto_threads();
   asynch_gc = 1;
-  if(pthread_create(&tid, &tattr, mtev_memory_gc, NULL) == 0) {
-    mtevL(mem_debug, "mtev_memory starting gc thread\n");
+  ck_pr_inc_64(GC_STAT(reclaimers));
+  if(gc_spawn_reclaimer()) {
+    mtevL(mem_debug, "mtev_memory starting gc thread (max %d)\n", gc_threads_max);
   }
   else {
     mtevL(mem_debug, "mtev_memory failed to spawn gc thread\n");
+    ck_pr_dec_64(GC_STAT(reclaimers));
     asynch_gc = 0;
   }
 }
 
+void mtev_memory_gc_threads(int n) {
+  if(n <= 0) n = gc_auto_threads();
+  if(n > GC_MAX_THREADS) n = GC_MAX_THREADS;
+  ck_pr_store_int(&gc_threads_max, n);
+}
+
+void mtev_memory_gc_batch(uint32_t n) {
+  ck_pr_store_32(&gc_batch, n ? n : GC_DEFAULT_BATCH);
+}
+
+void mtev_memory_gc_max_pending(int64_t n) {
+  ck_pr_store_64((uint64_t *)&gc_max_pending, (uint64_t)n);
+}
+
+void mtev_memory_gc_stats(mtev_memory_gc_stats_t *out) {
+  out->pending = ck_pr_load_64(GC_STAT(pending));
+  out->peak = ck_pr_load_64(GC_STAT(peak));
+  out->dispatched = ck_pr_load_64(GC_STAT(dispatched));
+  out->handoffs = ck_pr_load_64(GC_STAT(handoffs));
+  out->queued = ck_pr_load_64(GC_STAT(queued));
+  out->backpressure = ck_pr_load_64(GC_STAT(backpressure));
+  out->reclaimers = ck_pr_load_64(GC_STAT(reclaimers));
+}
+
+const mtev_memory_gc_stats_t *mtev_memory_gc_stats_live(void) {
+  return &gc_stats;
+}
+
 typedef bool (*e_sweep_t)(ck_epoch_record_t *);
 static e_sweep_t do_cleanup = NULL;
 
@@ -104,8 +211,10 @@ void mtev_memory_maintenance() {
       mem_debug = mtev_log_stream_find("debug/memory");
     pthread_mutex_unlock(&mem_debug_lock);
   }
+  gc_account_flush();
   if(do_cleanup == NULL) do_cleanup = ck_epoch_poll;
   if(do_cleanup(epoch_rec)) {
+    gc_account_dispatch(epoch_rec->n_dispatch - epoch_temporary.n_dispatch);
     if(epoch_temporary.n_pending != epoch_rec->n_pending ||
        epoch_temporary.n_peak != epoch_rec->n_peak ||
        epoch_temporary.n_dispatch != epoch_rec->n_dispatch) {
@@ -121,6 +230,7 @@ void mtev_memory_maintenance() {
 }
 
 struct asynch_reclaim {
+  struct asynch_reclaim *next;
   ck_epoch_record_t *owner;
   ck_stack_t pending[CK_EPOCH_LENGTH];
   unsigned int n_pending;
@@ -154,6 +264,7 @@ mtev_gc_sync_complete(struct asynch_reclaim *ar) {
 
   epoch_rec->n_dispatch += n_dispatch;
   epoch_rec->n_pending -= n_dispatch;
+  gc_account_dispatch(n_dispatch);
 
   if(!mem_debug) {
     pthread_mutex_lock(&mem_debug_lock);
@@ -176,34 +287,94 @@ mtev_gc_sync_complete(struct asynch_reclaim *ar) {
   free(ar);
 }
 
+static void
+gc_enqueue(struct asynch_reclaim *ar) {
+  mtev_boolean grow = mtev_false;
+
+  ar->next = NULL;
+  pthread_mutex_lock(&gc_queue_lock);
+  *gc_queue_tail = ar;
+  gc_queue_tail = &ar->next;
+  gc_queue_len++;
+  ck_pr_store_64(GC_STAT(queued), gc_queue_len);
+  if(gc_threads_idle > 0) pthread_cond_signal(&gc_queue_cv);
+  else if(gc_queue_len > GC_GRAB_MAX &&
+          ck_pr_load_64(GC_STAT(reclaimers)) < (uint64_t)ck_pr_load_int(&gc_threads_max)) {
+    /* Everyone is busy and work is piling up; add a reclaimer.  The
+     * count is bumped before we drop the lock so that concurrent
+     * producers don't all spawn one. */
+    ck_pr_inc_64(GC_STAT(reclaimers));
+    grow = mtev_true;
+  }
+  pthread_mutex_unlock(&gc_queue_lock);
+  if(grow) {
+    if(gc_spawn_reclaimer())
+      mtevL(mem_debug, "mtev_memory adding gc thread\n");
+    else
+      ck_pr_dec_64(GC_STAT(reclaimers));
+  }
+}
+
 static void *
 mtev_memory_gc(void *unused) {
   (void)unused;
   mtev_memory_init_thread();
   while(1) {
-    struct asynch_reclaim *ar;
-    ck_epoch_begin(epoch_rec, NULL);
-    ck_epoch_end(epoch_rec, NULL);
-    ck_fifo_spsc_dequeue_lock(&gc_queue);
-    while(ck_fifo_spsc_dequeue(&gc_queue, &ar)) {
-      ck_epoch_synchronize(epoch_rec);
+    struct asynch_reclaim *ar, *batch, *last, *next;
+    int n;
+
+    pthread_mutex_lock(&gc_queue_lock);
+    while(gc_queue_head == NULL) {
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_nsec += 500000000;
+      if(deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+      }
+      gc_threads_idle++;
+      pthread_cond_timedwait(&gc_queue_cv, &gc_queue_lock, &deadline);
+      gc_threads_idle--;
+    }
+    /* Take a run of batches and leave the rest for our peers. */
+    batch = last = gc_queue_head;
+    for(n = 1; last->next && n < GC_GRAB_MAX; n++) last = last->next;
+    gc_queue_head = last->next;
+    if(gc_queue_head == NULL) gc_queue_tail = &gc_queue_head;
+    last->next = NULL;
+    gc_queue_len -= n;
+    ck_pr_store_64(GC_STAT(queued), gc_queue_len);
+    if(gc_queue_head && gc_threads_idle > 0) pthread_cond_signal(&gc_queue_cv);
+    pthread_mutex_unlock(&gc_queue_lock);
+
+    /* Every batch we hold was queued before we looked, so one grace
+     * period covers all of them. */
+    ck_epoch_synchronize(epoch_rec);
+    for(ar = batch; ar; ar = next) {
+      next = ar->next;
       ck_fifo_spsc_enqueue_lock(ar->backq);
       ck_fifo_spsc_entry_t *fifo_entry = ck_fifo_spsc_recycle(ar->backq);
       if(fifo_entry == NULL) fifo_entry = malloc(sizeof(*fifo_entry));
       ck_fifo_spsc_enqueue(ar->backq, fifo_entry, ar);
       ck_fifo_spsc_enqueue_unlock(ar->backq);
     }
-    ck_fifo_spsc_dequeue_unlock(&gc_queue);
-    usleep(500000);
   }
   return NULL;
 }
 
+static mtev_boolean
+epoch_rec_has_pending(void) {
+  int i;
+  for(i=0;i<CK_EPOCH_LENGTH;i++)
+    if(CK_STACK_FIRST(&epoch_rec->pending[i]) != NULL) return mtev_true;
+  return mtev_false;
+}
+
 int
 mtev_memory_maintenance_ex(mtev_memory_maintenance_method_t method) {
   static int error_once = 1;
   struct asynch_reclaim *ar;
-  unsigned long n_dispatch = 0;
+  unsigned long n_dispatch = 0, sync_dispatch = 0;
   mtev_boolean success = mtev_false;
   ck_epoch_record_t epoch_temporary =  *epoch_rec;
 
@@ -214,6 +385,7 @@ mtev_memory_maintenance_ex(mtev_memory_maintenance_method_t method) {
     pthread_mutex_unlock(&mem_debug_lock);
   }
 
+  gc_account_flush();
   /* regardless of invocation intent, we cleanup our backq */
   if(!return_gc_queue) {
     return_gc_queue = calloc(1, sizeof(*return_gc_queue));
@@ -224,6 +396,7 @@ mtev_memory_maintenance_ex(mtev_memory_maintenance_method_t method) {
     mtev_gc_sync_complete(ar);
   }
   ck_fifo_spsc_dequeue_unlock(return_gc_queue);
+  sync_dispatch = epoch_rec->n_dispatch;
 
   if(!asynch_gc && method == MTEV_MM_BARRIER_ASYNCH) {
     if(error_once) {
@@ -242,22 +415,22 @@ mtev_memory_maintenance_ex(mtev_memory_maintenance_method_t method) {
       success = ck_epoch_poll(epoch_rec);
       break;
     case MTEV_MM_BARRIER_ASYNCH:
+      success = mtev_true;
+      if(!epoch_rec_has_pending()) break;
       ar = malloc(sizeof(*ar));
       ar->owner = epoch_rec;
       ar->backq = return_gc_queue;
       memcpy(ar->pending, epoch_rec->pending, sizeof(ar->pending));
       ar->n_pending = epoch_rec->n_pending;
       memset(epoch_rec->pending, 0, sizeof(ar->pending));
-      ck_fifo_spsc_enqueue_lock(&gc_queue);
-      ck_fifo_spsc_entry_t *fifo_entry = ck_fifo_spsc_recycle(&gc_queue);
-      if(fifo_entry == NULL) fifo_entry = malloc(sizeof(*fifo_entry));
-      ck_fifo_spsc_enqueue(&gc_queue, fifo_entry, ar);
-      ck_fifo_spsc_enqueue_unlock(&gc_queue);
-      success = mtev_true;
+      ck_pr_inc_64(GC_STAT(handoffs));
+      gc_enqueue(ar);
       break;
   }
 
+  if(success) tls_batch = 0;
   if(success && method != MTEV_MM_BARRIER_ASYNCH) {
+    gc_account_dispatch(epoch_rec->n_dispatch - sync_dispatch);
     if(epoch_temporary.n_pending != epoch_rec->n_pending ||
        epoch_temporary.n_peak != epoch_rec->n_peak ||
        epoch_temporary.n_dispatch != epoch_rec->n_dispatch) {
@@ -276,11 +449,41 @@ mtev_memory_maintenance_ex(mtev_memory_maintenance_method_t method) {
   return success ? n_dispatch : -1;
 }
 
+/* Called on a thread whose batch of deferred frees is full and that is
+ * outside any epoch section.  The batch goes to the reclaimers; if the
+ * process as a whole is over its pending limit, we also hold this thread
+ * for a bounded time, reclaiming its own returned batches as they arrive.
+ * The bound matters: the caller may hold a lock that some thread inside
+ * an epoch section is waiting on, so we can't wait out a grace period
+ * unconditionally. */
+static void
+gc_reclaim_batch(void) {
+  int i;
+  int64_t limit;
+
+  tls_reclaim_wanted = mtev_false;
+  tls_in_reclaim = mtev_true;
+  mtev_memory_maintenance_ex(asynch_gc ? MTEV_MM_BARRIER_ASYNCH : MTEV_MM_TRY);
+  tls_batch = 0;
+  limit = (int64_t)ck_pr_load_64((uint64_t *)&gc_max_pending);
+  if(limit > 0 && (int64_t)ck_pr_load_64(GC_STAT(pending)) > limit) {
+    ck_pr_inc_64(GC_STAT(backpressure));
+    for(i = 0; i < GC_BACKPRESSURE_ROUNDS; i++) {
+      usleep(GC_BACKPRESSURE_USEC);
+      mtev_memory_maintenance_ex(MTEV_MM_TRY);
+      if((int64_t)ck_pr_load_64(GC_STAT(pending)) <= limit) break;
+    }
+  }
+  tls_in_reclaim = mtev_false;
+}
+
 void mtev_memory_begin() {
   ck_epoch_begin(epoch_rec, NULL);
 }
 void mtev_memory_end() {
   ck_epoch_end(epoch_rec, NULL);
+  if(tls_reclaim_wanted && epoch_rec->active == 0 && !tls_in_reclaim)
+    gc_reclaim_batch();
 }
 
 struct safe_epoch {
@@ -348,6 +551,12 @@ mtev_memory_ck_free_func(void *p, size_t b, bool r,
   if (r == true) {
     /* Destruction requires safe memory reclamation. */
     ck_epoch_call(epoch_rec, &e->epoch_entry, f);
+    if(++tls_deferred >= GC_ACCOUNT_INTERVAL) gc_account_flush();
+    if(++tls_batch >= ck_pr_load_32(&gc_batch) && !tls_in_reclaim) {
+      /* Inside a section we can't hand off; mtev_memory_end will. */
+      if(epoch_rec->active) tls_reclaim_wanted = mtev_true;
+      else gc_reclaim_batch();
+    }
   } else {
     f(&e->epoch_entry);
   }
@@ -363,6 +572,26 @@ void mtev_memory_safe_free(void *p) {
   mtev_memory_ck_free_func(p, 0, true, mtev_memory_real_free);
 }
 
+struct deferred_free {
+  void (*f)(void *);
+  void *p;
+};
+
+static void
+mtev_memory_deferred_free_cleanup(void *vd) {
+  struct deferred_free *d = vd;
+  d->f(d->p);
+}
+
+void mtev_memory_defer_free(void *p, void (*f)(void *)) {
+  struct deferred_free *d;
+  if(p == NULL || f == NULL) return;
+  d = mtev_memory_safe_malloc_cleanup(sizeof(*d), mtev_memory_deferred_free_cleanup);
+  d->f = f;
+  d->p = p;
+  mtev_memory_safe_free(d);
+}
+
 static mtev_atomic32_t nallocators;
 struct mtev_allocator_options {
   char name[32];
@@ -372,6 +601,9 @@ struct mtev_allocator_options {
   size_t alignment;
   size_t fixed_size;
   uint32_t hints;
+  mtev_allocator_backend_t backend;
+  int magazine_rounds;
+  uint32_t sample_rate;
 };
 
 struct tls_data_container {
@@ -379,8 +611,38 @@ struct tls_data_container {
   /* overalloc an put impl specific stuff later */
 };
 
+/* Accounting counters, one per thread per allocator.  Only the owning
+ * thread writes; readers sum them.  Blocks outlive their thread and are
+ * adopted by new threads, which is fine as everything in them is a sum. */
+struct alloc_counters {
+  struct alloc_counters *next;
+  int in_use;
+  uint64_t allocs;
+  uint64_t frees;
+  uint64_t bytes_allocated;
+  uint64_t bytes_freed;
+  uint32_t sample_countdown;
+  uint32_t rand_state;
+} __attribute__((aligned(64)));
+
+#define ALLOC_SITES MTEV_ALLOCATOR_MAX_SITES
+struct alloc_site {
+  uint32_t hash;
+  mtev_allocator_site_t site;
+};
+
 struct mtev_allocator {
   struct mtev_allocator_options options;
+  int id;
+  struct mtev_allocator *next_registered;
+  mtev_boolean sizes_known;
+  pthread_mutex_t counters_lock;
+  struct alloc_counters *counters;
+  mtev_atomic64_t freelist_objects;
+  uint32_t sample_rate;
+  pthread_mutex_t sites_lock;
+  struct alloc_site *sites;
+  uint64_t samples;
   pthread_key_t tls;
   void *impl_data;
   struct tls_data_container *(*tls_setup)(struct mtev_allocator *);
@@ -391,8 +653,241 @@ struct mtev_allocator {
   void *(*reallocf_impl)(struct mtev_allocator *, void *, size_t);
   void (*free_impl)(struct mtev_allocator *, void *);
   void (*release_impl)(struct mtev_allocator *, void *);
+  size_t (*reap_impl)(struct mtev_allocator *);
+  void (*stats_impl)(struct mtev_allocator *, mtev_allocator_stats_t *);
 };
 
+static pthread_mutex_t allocators_lock = PTHREAD_MUTEX_INITIALIZER;
+static mtev_allocator_t allocators;
+static int allocators_next_id;
+
+static pthread_once_t alloc_counters_once = PTHREAD_ONCE_INIT;
+static pthread_key_t alloc_counters_key;
+static __thread struct alloc_counters **tls_counters;
+static __thread int tls_ncounters;
+
+static void
+alloc_counters_thread_exit(void *vblocks) {
+  struct alloc_counters **blocks = vblocks;
+  int i;
+  if(blocks != tls_counters) return;
+  for(i = 0; i < tls_ncounters; i++)
+    if(blocks[i]) ck_pr_store_int(&blocks[i]->in_use, mtev_false);
+  free(blocks);
+  tls_counters = NULL;
+  tls_ncounters = 0;
+}
+static void
+alloc_counters_key_create(void) {
+  pthread_key_create(&alloc_counters_key, alloc_counters_thread_exit);
+}
+
+static struct alloc_counters *
+alloc_counters_attach(mtev_allocator_t a) {
+  struct alloc_counters *c;
+  if(a->id >= tls_ncounters) {
+    int n = MAX(a->id + 1, tls_ncounters * 2);
+    struct alloc_counters **nc = calloc(n, sizeof(*nc));
+    if(!nc) return NULL;
+    if(tls_counters) memcpy(nc, tls_counters, tls_ncounters * sizeof(*nc));
+    free(tls_counters);
+    tls_counters = nc;
+    tls_ncounters = n;
+    pthread_once(&alloc_counters_once, alloc_counters_key_create);
+    pthread_setspecific(alloc_counters_key, tls_counters);
+  }
+  pthread_mutex_lock(&a->counters_lock);
+  for(c = a->counters; c; c = c->next) if(!c->in_use) break;
+  if(!c) {
+    if(posix_memalign((void **)&c, 64, sizeof(*c)) != 0) {
+      pthread_mutex_unlock(&a->counters_lock);
+      return NULL;
+    }
+    memset(c, 0, sizeof(*c));
+    c->next = a->counters;
+    ck_pr_store_ptr(&a->counters, c);
+  }
+  c->in_use = mtev_true;
+  c->rand_state = (uint32_t)(uintptr_t)&tls_counters ^ (uint32_t)a->id ^ 0x9e3779b9;
+  if(c->rand_state == 0) c->rand_state = 1;
+  pthread_mutex_unlock(&a->counters_lock);
+  tls_counters[a->id] = c;
+  return c;
+}
+static inline struct alloc_counters *
+alloc_counters_get(mtev_allocator_t a) {
+  if(a->id < tls_ncounters && tls_counters[a->id]) return tls_counters[a->id];
+  return alloc_counters_attach(a);
+}
+
+static inline size_t
+alloc_usable_size(mtev_allocator_t a, void *ptr) {
+  if(a->options.fixed_size) return a->options.fixed_size;
+#ifdef HAVE_MALLOC_USABLE_SIZE
+  if(a->sizes_known) return malloc_usable_size(ptr);
+#endif
+  return 0;
+}
+
+/* The next sample is uniformly 1..2n-1 allocations away, so we don't alias
+ * with periodic allocation patterns. */
+static inline uint32_t
+alloc_sample_interval(struct alloc_counters *c, uint32_t rate) {
+  uint32_t x = c->rand_state;
+  x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+  c->rand_state = x;
+  if(rate <= 1) return 1;
+  return 1 + x % (2 * rate - 1);
+}
+
+static void __attribute__((noinline))
+alloc_sample(mtev_allocator_t a, size_t size) {
+  void *frames[MTEV_ALLOCATOR_SAMPLE_DEPTH + 2];
+  int nframes, i, skip = 2; /* alloc_sample and the mtev_* entry point */
+  uint32_t hash = 2166136261u;
+  struct alloc_site *site = NULL;
+
+  nframes = mtev_backtrace(frames, MTEV_ALLOCATOR_SAMPLE_DEPTH + skip);
+  if(nframes <= skip) return;
+  nframes -= skip;
+  for(i = 0; i < nframes; i++) {
+    uintptr_t pc = (uintptr_t)frames[i + skip];
+    hash = (hash ^ (uint32_t)pc ^ (uint32_t)(pc >> 32)) * 16777619u;
+  }
+  if(hash == 0) hash = 1;
+
+  pthread_mutex_lock(&a->sites_lock);
+  if(!a->sites) a->sites = calloc(ALLOC_SITES, sizeof(*a->sites));
+  if(a->sites) {
+    for(i = 0; i < ALLOC_SITES; i++) {
+      struct alloc_site *s = &a->sites[(hash + i) % ALLOC_SITES];
+      if(s->hash == 0) {
+        s->hash = hash;
+        s->site.nframes = nframes;
+        memcpy(s->site.frames, frames + skip, nframes * sizeof(void *));
+        site = s;
+        break;
+      }
+      if(s->hash == hash && s->site.nframes == nframes &&
+         !memcmp(s->site.frames, frames + skip, nframes * sizeof(void *))) {
+        site = s;
+        break;
+      }
+    }
+  }
+  if(site) {
+    site->site.samples++;
+    site->site.bytes += size;
+  }
+  a->samples++;
+  pthread_mutex_unlock(&a->sites_lock);
+}
+
+/* always inlined so sampled backtraces start at the mtev_* entry point */
+static inline __attribute__((always_inline)) void
+alloc_account_alloc(mtev_allocator_t a, void *ptr, size_t size) {
+  struct alloc_counters *c = alloc_counters_get(a);
+  size_t usable = alloc_usable_size(a, ptr);
+  uint32_t rate;
+  if(!c) return;
+  c->allocs++;
+  c->bytes_allocated += usable ? usable : size;
+  rate = ck_pr_load_32(&a->sample_rate);
+  if(rate && (c->sample_countdown == 0 || --c->sample_countdown == 0)) {
+    c->sample_countdown = alloc_sample_interval(c, rate);
+    alloc_sample(a, size);
+  }
+}
+static inline void
+alloc_account_free(mtev_allocator_t a, size_t usable) {
+  struct alloc_counters *c = alloc_counters_get(a);
+  if(!c) return;
+  c->frees++;
+  c->bytes_freed += usable;
+}
+
+mtev_allocator_t
+mtev_allocator_find(const char *name) {
+  mtev_allocator_t a;
+  pthread_mutex_lock(&allocators_lock);
+  for(a = allocators; a; a = a->next_registered)
+    if(!strcmp(a->options.name, name)) break;
+  pthread_mutex_unlock(&allocators_lock);
+  return a;
+}
+void
+mtev_allocator_foreach(void (*f)(mtev_allocator_t, void *), void *closure) {
+  mtev_allocator_t a, head;
+  /* allocators are never destroyed, so walk without holding the lock */
+  pthread_mutex_lock(&allocators_lock);
+  head = allocators;
+  pthread_mutex_unlock(&allocators_lock);
+  for(a = head; a; a = a->next_registered) f(a, closure);
+}
+const char *
+mtev_allocator_name(mtev_allocator_t a) {
+  return a->options.name;
+}
+void
+mtev_allocator_set_sample_rate(mtev_allocator_t a, uint32_t n) {
+  ck_pr_store_32(&a->sample_rate, n);
+}
+void
+mtev_allocator_stats(mtev_allocator_t a, mtev_allocator_stats_t *stats) {
+  struct alloc_counters *c;
+  uint64_t bytes_freed = 0;
+  memset(stats, 0, sizeof(*stats));
+  stats->name = a->options.name;
+  stats->fixed_size = a->options.fixed_size;
+  for(c = ck_pr_load_ptr(&a->counters); c; c = c->next) {
+    stats->allocs += ck_pr_load_64(&c->allocs);
+    stats->frees += ck_pr_load_64(&c->frees);
+    stats->bytes_allocated += ck_pr_load_64(&c->bytes_allocated);
+    bytes_freed += ck_pr_load_64(&c->bytes_freed);
+  }
+  stats->live_objects = stats->allocs - stats->frees;
+  stats->live_bytes = a->sizes_known ? (int64_t)(stats->bytes_allocated - bytes_freed) : -1;
+  stats->cached_objects = a->freelist_objects;
+  stats->sample_rate = ck_pr_load_32(&a->sample_rate);
+  pthread_mutex_lock(&a->sites_lock);
+  stats->samples = a->samples;
+  pthread_mutex_unlock(&a->sites_lock);
+  if(a->stats_impl) a->stats_impl(a, stats);
+}
+static int
+alloc_site_cmp(const void *av, const void *bv) {
+  const mtev_allocator_site_t *a = av, *b = bv;
+  if(a->samples < b->samples) return 1;
+  if(a->samples > b->samples) return -1;
+  return 0;
+}
+int
+mtev_allocator_sites(mtev_allocator_t a, mtev_allocator_site_t *sites, int max) {
+  mtev_allocator_site_t *all;
+  int i, n = 0;
+  if(max <= 0) return 0;
+  all = malloc(ALLOC_SITES * sizeof(*all));
+  if(!all) return 0;
+  pthread_mutex_lock(&a->sites_lock);
+  if(a->sites) {
+    for(i = 0; i < ALLOC_SITES; i++)
+      if(a->sites[i].hash) all[n++] = a->sites[i].site;
+  }
+  pthread_mutex_unlock(&a->sites_lock);
+  qsort(all, n, sizeof(*all), alloc_site_cmp);
+  if(n > max) n = max;
+  memcpy(sites, all, n * sizeof(*all));
+  free(all);
+  return n;
+}
+void
+mtev_allocator_sites_reset(mtev_allocator_t a) {
+  pthread_mutex_lock(&a->sites_lock);
+  if(a->sites) memset(a->sites, 0, ALLOC_SITES * sizeof(*a->sites));
+  a->samples = 0;
+  pthread_mutex_unlock(&a->sites_lock);
+}
+
 mtev_allocator_options_t mtev_allocator_options_create() {
   return calloc(1, sizeof(struct mtev_allocator_options));
 }
@@ -424,6 +919,19 @@ void
 mtev_allocator_options_hints(mtev_allocator_options_t opt, uint32_t hints) {
   opt->hints = hints;
 }
+void
+mtev_allocator_options_backend(mtev_allocator_options_t opt,
+                               mtev_allocator_backend_t backend) {
+  opt->backend = backend;
+}
+void
+mtev_allocator_options_magazine_size(mtev_allocator_options_t opt, int rounds) {
+  opt->magazine_rounds = rounds;
+}
+void
+mtev_allocator_options_sample_rate(mtev_allocator_options_t opt, uint32_t n) {
+  opt->sample_rate = n;
+}
 
 static inline void *
 mtev_memory_fill(mtev_allocator_t a, void *ptr, size_t size) {
@@ -439,19 +947,47 @@ mtev_memory_fill(mtev_allocator_t a, void *ptr, size_t size) {
 }
 
 void *mtev_malloc(mtev_allocator_t a, size_t size) {
+  void *ptr;
   assert(a);
   if(a->options.fixed_size && a->options.fixed_size < size) return NULL;
-  return mtev_memory_fill(a, a->malloc_impl(a, size), size);
+  ptr = a->malloc_impl(a, size);
+  if(!ptr) return NULL;
+  alloc_account_alloc(a, ptr, size);
+  return mtev_memory_fill(a, ptr, size);
 }
 void *mtev_calloc(mtev_allocator_t a, size_t nmemb, size_t elemsize) {
+  void *ptr;
   assert(a);
   if(a->options.fixed_size && a->options.fixed_size < (nmemb*elemsize)) return NULL;
-  return a->calloc_impl(a, nmemb, elemsize);
+  ptr = a->calloc_impl(a, nmemb, elemsize);
+  if(ptr) alloc_account_alloc(a, ptr, nmemb * elemsize);
+  return ptr;
+}
+static void *
+mtev_realloc_accounted(mtev_allocator_t a, void *ptr, size_t size,
+                       void *(*impl)(mtev_allocator_t, void *, size_t)) {
+  size_t oldsize;
+  void *newptr;
+  if(ptr == NULL) return mtev_malloc(a, size);
+  oldsize = alloc_usable_size(a, ptr);
+  newptr = impl(a, ptr, size);
+  if(newptr) {
+    struct alloc_counters *c = alloc_counters_get(a);
+    size_t newsize = alloc_usable_size(a, newptr);
+    if(c) {
+      c->bytes_freed += oldsize;
+      c->bytes_allocated += newsize ? newsize : size;
+    }
+  }
+  else if(impl == a->reallocf_impl && size) {
+    alloc_account_free(a, oldsize);
+  }
+  return newptr;
 }
 void *mtev_realloc(mtev_allocator_t a, void *ptr, size_t size) {
   assert(a);
   if(a->options.fixed_size && a->options.fixed_size < size) return NULL;
-  return a->realloc_impl(a, ptr, size);
+  return mtev_realloc_accounted(a, ptr, size, a->realloc_impl);
 }
 void *mtev_reallocf(mtev_allocator_t a, void *ptr, size_t size) {
   assert(a);
@@ -459,12 +995,19 @@ void *mtev_reallocf(mtev_allocator_t a, void *ptr, size_t size) {
     mtev_free(a, ptr);
     return NULL;
   }
-  return a->reallocf_impl(a, ptr, size);
+  return mtev_realloc_accounted(a, ptr, size, a->reallocf_impl);
 }
 void mtev_free(mtev_allocator_t a, void *ptr) {
   assert(a);
+  if(ptr == NULL) return;
+  alloc_account_free(a, alloc_usable_size(a, ptr));
   a->free_impl(a, ptr);
 }
+size_t mtev_allocator_reap(mtev_allocator_t a) {
+  assert(a);
+  if(a->reap_impl == NULL) return 0;
+  return a->reap_impl(a);
+}
 
 struct mtev_alloc_freelist_node {
   struct mtev_alloc_freelist_node *next;
@@ -496,6 +1039,7 @@ default_allocator_tls_teardown(mtev_allocator_t a, struct tls_data_container *td
   dadc = (struct default_allocator_data_container *)tdc;
   while(NULL != (tofree = dadc->freelist)) {
     dadc->freelist = tofree->next;
+    mtev_atomic_dec64(&a->freelist_objects);
     a->release_impl(a, tofree);
   }
   free(tdc);
@@ -527,6 +1071,7 @@ default_allocator_malloc(mtev_allocator_t a, size_t size) {
       void *ptr = dadc->freelist;
       dadc->freelist = dadc->freelist->next;
       dadc->freelist_size--;
+      mtev_atomic_dec64(&a->freelist_objects);
       return ptr;
     }
     return malloc(a->options.fixed_size);
@@ -569,11 +1114,13 @@ default_allocator_free(mtev_allocator_t a, void *ptr) {
     /* freelists */
     struct default_allocator_data_container *dadc =
       (struct default_allocator_data_container *)generic_allocator_gettls(a);
-    if(a->options.freelist_limit < dadc->freelist_size) {
+    if(dadc->freelist_size < a->options.freelist_limit) {
       struct mtev_alloc_freelist_node *node = ptr;
       node->next = dadc->freelist;
       dadc->freelist = node;
       dadc->freelist_size++;
+      mtev_atomic_inc64(&a->freelist_objects);
+      return;
     }
   }
   a->release_impl(a,ptr);
@@ -598,6 +1145,453 @@ static void
 default_allocator_init(struct mtev_allocator *a, mtev_allocator_options_t opt) {
   memcpy(a, &default_allocator, sizeof(default_allocator));
   memcpy(&a->options, opt, sizeof(*opt));
+#ifdef HAVE_MALLOC_USABLE_SIZE
+  a->sizes_known = mtev_true;
+#endif
+}
+
+/* Slab allocator implementation
+ *
+ * After Bonwick's slab and magazine allocators: fixed size objects are
+ * carved out of slabs (page multiples, aligned to their size so an object
+ * finds its slab by masking), with each new slab offset by a different
+ * cache color.  In front of the slabs, each CPU holds two magazines of
+ * cached objects so the common alloc/free is a short critical section on
+ * a CPU-local lock.  Full and empty magazines are exchanged through a
+ * depot.  An object freed on another CPU simply lands in that CPU's
+ * magazine and the depot rebalances.
+ */
+#define SLAB_MIN_OBJS 8
+#define SLAB_MAX_FREE 2
+#define SLAB_CACHE_LINE 64
+#define SLAB_DEFAULT_ROUNDS 32
+#define SLAB_DEPOT_MAX_PER_CPU 4
+
+struct slab_magazine {
+  struct slab_magazine *next;
+  int rounds;
+  void *objs[1];
+};
+
+struct slab_cpu {
+  ck_spinlock_t lock;
+  struct slab_magazine *loaded;
+  struct slab_magazine *previous;
+  char pad[SLAB_CACHE_LINE - sizeof(ck_spinlock_t) - 2 * sizeof(void *)];
+};
+
+struct slab_cache;
+struct slab {
+  struct slab *next, *prev;
+  struct slab_cache *cache;
+  struct mtev_alloc_freelist_node *freelist;
+  int inuse;
+};
+
+struct slab_cache {
+  size_t objsize;
+  size_t slabsize;
+  size_t first_offset;
+  int per_slab;
+  int ncolors;
+  int next_color;
+  int rounds;
+  int ncpus;
+  struct slab_cpu *cpus;
+
+  pthread_mutex_t depot_lock;
+  struct slab_magazine *depot_full;
+  struct slab_magazine *depot_empty;
+  int ndepot_full;
+
+  pthread_mutex_t slab_lock;
+  struct slab *partial; /* slabs with at least one free object */
+  struct slab *partial_tail;
+  int nslabs;
+  int nfree_slabs;
+  int64_t slab_free_objs; /* free objects inside slabs */
+};
+
+static inline struct slab_cpu *
+slab_cpu_get(struct slab_cache *c) {
+  static __thread int thread_slot = -1;
+  static mtev_atomic32_t next_slot;
+#ifdef HAVE_SCHED_GETCPU
+  int cpu = sched_getcpu();
+  if(cpu >= 0) return &c->cpus[cpu % c->ncpus];
+#endif
+  if(thread_slot < 0) thread_slot = mtev_atomic_inc32(&next_slot);
+  return &c->cpus[thread_slot % c->ncpus];
+}
+
+static void
+slab_list_remove(struct slab_cache *c, struct slab *s) {
+  if(s->prev) s->prev->next = s->next;
+  else c->partial = s->next;
+  if(s->next) s->next->prev = s->prev;
+  else c->partial_tail = s->prev;
+  s->next = s->prev = NULL;
+}
+static void
+slab_list_push_head(struct slab_cache *c, struct slab *s) {
+  s->prev = NULL;
+  s->next = c->partial;
+  if(c->partial) c->partial->prev = s;
+  else c->partial_tail = s;
+  c->partial = s;
+}
+static void
+slab_list_push_tail(struct slab_cache *c, struct slab *s) {
+  s->next = NULL;
+  s->prev = c->partial_tail;
+  if(c->partial_tail) c->partial_tail->next = s;
+  else c->partial = s;
+  c->partial_tail = s;
+}
+
+/* must hold slab_lock */
+static struct slab *
+slab_create(struct slab_cache *c) {
+  char *region, *aligned;
+  size_t lead, i;
+  struct slab *s;
+  char *obj;
+
+  /* over-map so we can trim to a slabsize aligned region */
+  region = mmap(NULL, c->slabsize * 2, PROT_READ|PROT_WRITE,
+                MAP_PRIVATE|MAP_ANON, -1, 0);
+  if(region == MAP_FAILED) return NULL;
+  aligned = (char *)(((uintptr_t)region + c->slabsize - 1) & ~(c->slabsize - 1));
+  lead = aligned - region;
+  if(lead) munmap(region, lead);
+  munmap(aligned + c->slabsize, c->slabsize - lead);
+
+  s = (struct slab *)aligned;
+  memset(s, 0, sizeof(*s));
+  s->cache = c;
+  obj = aligned + c->first_offset +
+        (c->next_color++ % c->ncolors) * SLAB_CACHE_LINE;
+  for(i = c->per_slab; i > 0; i--) {
+    struct mtev_alloc_freelist_node *node =
+      (struct mtev_alloc_freelist_node *)(obj + (i - 1) * c->objsize);
+    node->next = s->freelist;
+    s->freelist = node;
+  }
+  c->nslabs++;
+  c->nfree_slabs++;
+  c->slab_free_objs += c->per_slab;
+  return s;
+}
+
+static void *
+slab_obj_alloc(struct slab_cache *c) {
+  struct slab *s;
+  void *ptr;
+  pthread_mutex_lock(&c->slab_lock);
+  s = c->partial;
+  if(!s) {
+    s = slab_create(c);
+    if(!s) {
+      pthread_mutex_unlock(&c->slab_lock);
+      return NULL;
+    }
+    slab_list_push_head(c, s);
+  }
+  ptr = s->freelist;
+  s->freelist = s->freelist->next;
+  c->slab_free_objs--;
+  if(s->inuse++ == 0) c->nfree_slabs--;
+  if(!s->freelist) slab_list_remove(c, s);
+  pthread_mutex_unlock(&c->slab_lock);
+  return ptr;
+}
+
+/* must hold slab_lock */
+static void
+slab_obj_free_locked(struct slab_cache *c, void *ptr) {
+  struct slab *s = (struct slab *)((uintptr_t)ptr & ~(c->slabsize - 1));
+  struct mtev_alloc_freelist_node *node = ptr;
+  mtevAssert(s->cache == c);
+  if(!s->freelist) slab_list_push_head(c, s);
+  node->next = s->freelist;
+  s->freelist = node;
+  c->slab_free_objs++;
+  if(--s->inuse == 0) {
+    c->nfree_slabs++;
+    slab_list_remove(c, s);
+    if(c->nfree_slabs > SLAB_MAX_FREE) {
+      c->nfree_slabs--;
+      c->nslabs--;
+      c->slab_free_objs -= c->per_slab;
+      munmap(s, c->slabsize);
+    }
+    else {
+      /* allocate from fuller slabs first so this one can be reclaimed */
+      slab_list_push_tail(c, s);
+    }
+  }
+}
+
+static void
+slab_obj_free(struct slab_cache *c, void *ptr) {
+  pthread_mutex_lock(&c->slab_lock);
+  slab_obj_free_locked(c, ptr);
+  pthread_mutex_unlock(&c->slab_lock);
+}
+
+static struct slab_magazine *
+slab_magazine_new(struct slab_cache *c) {
+  struct slab_magazine *m;
+  m = malloc(sizeof(*m) + (c->rounds - 1) * sizeof(void *));
+  if(m) {
+    m->next = NULL;
+    m->rounds = 0;
+  }
+  return m;
+}
+
+static void *
+slab_allocator_malloc(mtev_allocator_t a, size_t size) {
+  struct slab_cache *c = a->impl_data;
+  struct slab_cpu *cpu;
+  void *ptr = NULL;
+
+  if(size > c->objsize) return NULL;
+  cpu = slab_cpu_get(c);
+  ck_spinlock_lock(&cpu->lock);
+  if(cpu->loaded && cpu->loaded->rounds > 0) {
+    ptr = cpu->loaded->objs[--cpu->loaded->rounds];
+  }
+  else if(cpu->previous && cpu->previous->rounds > 0) {
+    struct slab_magazine *tmp = cpu->loaded;
+    cpu->loaded = cpu->previous;
+    cpu->previous = tmp;
+    ptr = cpu->loaded->objs[--cpu->loaded->rounds];
+  }
+  else {
+    struct slab_magazine *full;
+    pthread_mutex_lock(&c->depot_lock);
+    full = c->depot_full;
+    if(full) {
+      c->depot_full = full->next;
+      c->ndepot_full--;
+      if(cpu->previous) {
+        cpu->previous->next = c->depot_empty;
+        c->depot_empty = cpu->previous;
+      }
+    }
+    pthread_mutex_unlock(&c->depot_lock);
+    if(full) {
+      cpu->previous = cpu->loaded;
+      cpu->loaded = full;
+      ptr = full->objs[--full->rounds];
+    }
+  }
+  ck_spinlock_unlock(&cpu->lock);
+  if(!ptr) ptr = slab_obj_alloc(c);
+  return ptr;
+}
+
+static void
+slab_allocator_free(mtev_allocator_t a, void *ptr) {
+  struct slab_cache *c = a->impl_data;
+  struct slab_cpu *cpu;
+  mtev_boolean cached = mtev_false;
+
+  if(ptr == NULL) return;
+  cpu = slab_cpu_get(c);
+  ck_spinlock_lock(&cpu->lock);
+  if(!cpu->loaded || cpu->loaded->rounds == c->rounds) {
+    if(cpu->previous && cpu->previous->rounds == 0) {
+      struct slab_magazine *tmp = cpu->loaded;
+      cpu->loaded = cpu->previous;
+      cpu->previous = tmp;
+    }
+    else {
+      struct slab_magazine *empty = NULL;
+      pthread_mutex_lock(&c->depot_lock);
+      /* a bounded depot bounds what we hold onto */
+      if(!cpu->previous || c->ndepot_full < c->ncpus * SLAB_DEPOT_MAX_PER_CPU) {
+        empty = c->depot_empty;
+        if(empty) c->depot_empty = empty->next;
+        else empty = slab_magazine_new(c);
+        if(empty && cpu->previous) {
+          cpu->previous->next = c->depot_full;
+          c->depot_full = cpu->previous;
+          c->ndepot_full++;
+        }
+      }
+      pthread_mutex_unlock(&c->depot_lock);
+      if(empty) {
+        empty->rounds = 0;
+        cpu->previous = cpu->loaded;
+        cpu->loaded = empty;
+      }
+    }
+  }
+  if(cpu->loaded && cpu->loaded->rounds < c->rounds) {
+    cpu->loaded->objs[cpu->loaded->rounds++] = ptr;
+    cached = mtev_true;
+  }
+  ck_spinlock_unlock(&cpu->lock);
+  if(!cached) slab_obj_free(c, ptr);
+}
+
+static void
+slab_allocator_release(mtev_allocator_t a, void *ptr) {
+  slab_allocator_free(a, ptr);
+}
+
+static void *
+slab_allocator_calloc(mtev_allocator_t a, size_t nmemb, size_t elemsize) {
+  size_t s = nmemb * elemsize;
+  void *ptr;
+  if(nmemb && s / nmemb != elemsize) return NULL;
+  ptr = slab_allocator_malloc(a, s);
+  if(ptr) memset(ptr, 0, s);
+  return ptr;
+}
+
+static void *
+slab_allocator_realloc(mtev_allocator_t a, void *ptr, size_t s) {
+  if(ptr == NULL) return slab_allocator_malloc(a, s);
+  if(s > a->options.fixed_size) return NULL;
+  return ptr;
+}
+
+static void *
+slab_allocator_reallocf(mtev_allocator_t a, void *ptr, size_t s) {
+  if(ptr == NULL) return slab_allocator_malloc(a, s);
+  if(s > a->options.fixed_size) {
+    slab_allocator_free(a, ptr);
+    return NULL;
+  }
+  return ptr;
+}
+
+/* must hold slab_lock */
+static void
+slab_magazine_drain(struct slab_cache *c, struct slab_magazine *m) {
+  while(m->rounds > 0) slab_obj_free_locked(c, m->objs[--m->rounds]);
+}
+
+/* Give cached objects back to their slabs and unmap every empty slab. */
+static size_t
+slab_allocator_reap(mtev_allocator_t a) {
+  struct slab_cache *c = a->impl_data;
+  struct slab_magazine *full, *empty, *m;
+  struct slab *s, *next;
+  int i, nslabs;
+
+  pthread_mutex_lock(&c->depot_lock);
+  full = c->depot_full;
+  empty = c->depot_empty;
+  c->depot_full = c->depot_empty = NULL;
+  c->ndepot_full = 0;
+  pthread_mutex_unlock(&c->depot_lock);
+
+  pthread_mutex_lock(&c->slab_lock);
+  nslabs = c->nslabs;
+  for(i = 0; i < c->ncpus; i++) {
+    struct slab_cpu *cpu = &c->cpus[i];
+    ck_spinlock_lock(&cpu->lock);
+    if(cpu->loaded) slab_magazine_drain(c, cpu->loaded);
+    if(cpu->previous) slab_magazine_drain(c, cpu->previous);
+    ck_spinlock_unlock(&cpu->lock);
+  }
+  while(NULL != (m = full)) {
+    full = m->next;
+    slab_magazine_drain(c, m);
+    free(m);
+  }
+  while(NULL != (m = empty)) {
+    empty = m->next;
+    free(m);
+  }
+  for(s = c->partial; s; s = next) {
+    next = s->next;
+    if(s->inuse == 0) {
+      slab_list_remove(c, s);
+      c->nfree_slabs--;
+      c->nslabs--;
+      c->slab_free_objs -= c->per_slab;
+      munmap(s, c->slabsize);
+    }
+  }
+  nslabs -= c->nslabs;
+  pthread_mutex_unlock(&c->slab_lock);
+  return nslabs * c->slabsize;
+}
+
+static void
+slab_allocator_stats(mtev_allocator_t a, mtev_allocator_stats_t *stats) {
+  struct slab_cache *c = a->impl_data;
+  int64_t cached = 0;
+  int i;
+  for(i = 0; i < c->ncpus; i++) {
+    struct slab_cpu *cpu = &c->cpus[i];
+    ck_spinlock_lock(&cpu->lock);
+    if(cpu->loaded) cached += cpu->loaded->rounds;
+    if(cpu->previous) cached += cpu->previous->rounds;
+    ck_spinlock_unlock(&cpu->lock);
+  }
+  pthread_mutex_lock(&c->depot_lock);
+  cached += (int64_t)c->ndepot_full * c->rounds;
+  pthread_mutex_unlock(&c->depot_lock);
+  pthread_mutex_lock(&c->slab_lock);
+  cached += c->slab_free_objs;
+  stats->reserved_bytes = (uint64_t)c->nslabs * c->slabsize;
+  pthread_mutex_unlock(&c->slab_lock);
+  stats->cached_objects += cached;
+}
+
+static struct mtev_allocator slab_allocator = {
+  .tls_setup = NULL,
+  .tls_teardown = NULL,
+  .malloc_impl = slab_allocator_malloc,
+  .calloc_impl = slab_allocator_calloc,
+  .realloc_impl = slab_allocator_realloc,
+  .reallocf_impl = slab_allocator_reallocf,
+  .free_impl = slab_allocator_free,
+  .release_impl = slab_allocator_release,
+  .reap_impl = slab_allocator_reap,
+  .stats_impl = slab_allocator_stats,
+};
+
+static void
+slab_allocator_init(struct mtev_allocator *a, mtev_allocator_options_t opt) {
+  struct slab_cache *c;
+  size_t align, pagesize, leftover;
+  long ncpus;
+  int i;
+
+  memcpy(a, &slab_allocator, sizeof(slab_allocator));
+  memcpy(&a->options, opt, sizeof(*opt));
+
+  c = calloc(1, sizeof(*c));
+  align = MAX(opt->alignment, sizeof(void *));
+  c->objsize = (MAX(opt->fixed_size, sizeof(void *)) + align - 1) & ~(align - 1);
+  c->first_offset = (sizeof(struct slab) + align - 1) & ~(align - 1);
+  pagesize = sysconf(_SC_PAGESIZE);
+  c->slabsize = pagesize;
+  while((c->slabsize - c->first_offset) / c->objsize < SLAB_MIN_OBJS)
+    c->slabsize <<= 1;
+  c->per_slab = (c->slabsize - c->first_offset) / c->objsize;
+  leftover = c->slabsize - c->first_offset - c->per_slab * c->objsize;
+  c->ncolors = 1;
+  if(align <= SLAB_CACHE_LINE) c->ncolors += leftover / SLAB_CACHE_LINE;
+  c->rounds = opt->magazine_rounds > 0 ? opt->magazine_rounds : SLAB_DEFAULT_ROUNDS;
+  ncpus = sysconf(_SC_NPROCESSORS_CONF);
+  c->ncpus = (ncpus > 0) ? ncpus : 1;
+  if(posix_memalign((void **)&c->cpus, SLAB_CACHE_LINE,
+                    c->ncpus * sizeof(*c->cpus)) != 0) {
+    mtevFatal(mtev_error, "Failed to allocate slab cpu caches\n");
+  }
+  memset(c->cpus, 0, c->ncpus * sizeof(*c->cpus));
+  for(i = 0; i < c->ncpus; i++) ck_spinlock_init(&c->cpus[i].lock);
+  pthread_mutex_init(&c->depot_lock, NULL);
+  pthread_mutex_init(&c->slab_lock, NULL);
+  a->impl_data = c;
 }
 
 #if defined(HAVE_LIBUMEM) && defined(HAVE_UMEM_H)
@@ -661,12 +1655,16 @@ fixed_umem_allocator_init(struct mtev_allocator *a, mtev_allocator_options_t opt
 #endif
 mtev_allocator_t mtev_allocator_create(mtev_allocator_options_t opt) {
   mtev_allocator_t allocator = calloc(1, sizeof(*allocator));
+  int id;
   if(opt->name[0] == '\0') {
     int id = mtev_atomic_inc32(&nallocators);
     snprintf(opt->name, sizeof(opt->name), "mtev_umem_n%d_%d",
              id, (int)opt->fixed_size);
   }
   if(0) { }
+  else if(opt->fixed_size && opt->backend == MTEV_ALLOCATOR_SLAB) {
+    slab_allocator_init(allocator, opt);
+  }
 #if defined(HAVE_LIBUMEM) && defined(HAVE_UMEM_H)
   else if(opt->fixed_size) {
     fixed_umem_allocator_init(allocator, opt);
@@ -675,6 +1673,16 @@ mtev_allocator_t mtev_allocator_create(mtev_allocator_options_t opt) {
   else {
     default_allocator_init(allocator, opt);
   }
+  if(allocator->options.fixed_size) allocator->sizes_known = mtev_true;
+  allocator->sample_rate = opt->sample_rate;
+  pthread_mutex_init(&allocator->counters_lock, NULL);
+  pthread_mutex_init(&allocator->sites_lock, NULL);
+  pthread_mutex_lock(&allocators_lock);
+  id = allocators_next_id++;
+  allocator->id = id;
+  allocator->next_registered = allocators;
+  allocators = allocator;
+  pthread_mutex_unlock(&allocators_lock);
   if(allocator->tls_setup) {
     pthread_key_create(&allocator->tls, mtev_allocator_thread_teardown);
     struct tls_data_container *tdc = allocator->tls_setup(allocator);
@@ -47,12 +47,68 @@ API_EXPORT(int) mtev_memory_maintenance_ex(mtev_memory_maintenance_method_t meth
 API_EXPORT(void) mtev_memory_begin(); /* being a block */
 API_EXPORT(void) mtev_memory_end(); /* end a block */
 API_EXPORT(mtev_boolean) mtev_memory_barriers(mtev_boolean *); /* do or try */
+
+/* Deferred-free reclamation statistics.  All are process-wide. */
+typedef struct {
+  int64_t pending;      /* deferred frees not yet reclaimed */
+  int64_t peak;         /* high-water mark of pending */
+  int64_t dispatched;   /* deferred frees reclaimed */
+  int64_t handoffs;     /* batches handed to reclaimer threads */
+  int64_t queued;       /* batches waiting on a reclaimer */
+  int64_t backpressure; /* times a freeing thread was held back */
+  int64_t reclaimers;   /* reclaimer threads running */
+} mtev_memory_gc_stats_t;
+
+/*! \fn void mtev_memory_gc_threads(int n)
+    \brief Set the maximum number of asynchronous reclaimer threads.
+    \param n the maximum, or 0 to size from the number of CPUs
+
+    One reclaimer starts with `mtev_memory_init`; more are started on
+    demand, up to this limit, when handed-off batches back up.
+ */
+API_EXPORT(void) mtev_memory_gc_threads(int n);
+/*! \fn void mtev_memory_gc_batch(uint32_t n)
+    \brief Set how many deferred frees a thread accumulates before handing them off.
+    \param n the batch size, or 0 for the default (4096)
+
+    When a thread's batch fills outside of a `mtev_memory_begin` section the
+    batch is handed to the reclaimer threads immediately; inside a section,
+    the handoff happens at the closing `mtev_memory_end`.
+ */
+API_EXPORT(void) mtev_memory_gc_batch(uint32_t n);
+/*! \fn void mtev_memory_gc_max_pending(int64_t n)
+    \brief Set the process-wide pending limit above which freeing threads are held back.
+    \param n the number of outstanding deferred frees, or 0 to disable
+
+    A thread handing off a batch while more than `n` frees are pending
+    waits (for at most about 10ms) while reclaiming its own returned
+    batches.  The default is 1048576.
+ */
+API_EXPORT(void) mtev_memory_gc_max_pending(int64_t n);
+/*! \fn void mtev_memory_gc_stats(mtev_memory_gc_stats_t *stats)
+    \brief Take a snapshot of deferred-free reclamation statistics.
+    \param stats the structure to fill
+ */
+API_EXPORT(void) mtev_memory_gc_stats(mtev_memory_gc_stats_t *stats);
+/*! \fn const mtev_memory_gc_stats_t *mtev_memory_gc_stats_live(void)
+    \brief Return the live reclamation statistics.
+    \return a pointer whose fields are updated in place, suitable for registering as read-only stats
+ */
+API_EXPORT(const mtev_memory_gc_stats_t *) mtev_memory_gc_stats_live(void);
+
 API_EXPORT(void *) mtev_memory_safe_malloc(size_t r);
 API_EXPORT(void *) mtev_memory_safe_malloc_cleanup(size_t r, void (*)(void *));
 API_EXPORT(void *) mtev_memory_safe_calloc(size_t nelem, size_t elsize);
 API_EXPORT(char *) mtev_memory_safe_strdup(const char *in);
 API_EXPORT(void) mtev_memory_safe_free(void *p);
 
+/*! \fn void mtev_memory_defer_free(void *p, void (*f)(void *))
+    \brief Call a destructor on memory not allocated with mtev_memory_safe_* once no reader can hold it.
+    \param p the object, NULL is ignored
+    \param f the destructor, called as f(p) after the current epoch passes
+ */
+API_EXPORT(void) mtev_memory_defer_free(void *p, void (*f)(void *));
+
 /* Used to power ck functions requiring allocation */
 API_EXPORT(void *) mtev_memory_ck_malloc(size_t r);
 API_EXPORT(void) mtev_memory_ck_free(void *p, size_t b, bool r);
@@ -63,8 +119,15 @@ API_EXPORT(void) mtev_memory_ck_free(void *p, size_t b, bool r);
 typedef struct mtev_allocator_options *mtev_allocator_options_t;
 typedef struct mtev_allocator *mtev_allocator_t;
 
+typedef enum {
+  MTEV_ALLOCATOR_DEFAULT = 0, /* malloc, or umem for fixed sizes if present */
+  MTEV_ALLOCATOR_SLAB         /* slabs with per-CPU magazines (fixed size) */
+} mtev_allocator_backend_t;
+
 API_EXPORT(mtev_allocator_options_t) mtev_allocator_options_create();
 API_EXPORT(void) mtev_allocator_options_free(mtev_allocator_options_t);
+API_EXPORT(void)
+  mtev_allocator_options_name(mtev_allocator_options_t, char *name);
 API_EXPORT(void)
   mtev_allocator_options_alignment(mtev_allocator_options_t, size_t alignment);
 API_EXPORT(void)
@@ -75,6 +138,15 @@ API_EXPORT(void)
   mtev_allocator_options_freelist_perthreadlimit(mtev_allocator_options_t, int items);
 API_EXPORT(void)
   mtev_allocator_options_hints(mtev_allocator_options_t, uint32_t hints);
+/* Select the implementation; MTEV_ALLOCATOR_SLAB requires a fixed_size */
+API_EXPORT(void)
+  mtev_allocator_options_backend(mtev_allocator_options_t, mtev_allocator_backend_t);
+/* Objects cached per magazine by the slab backend (default 32) */
+API_EXPORT(void)
+  mtev_allocator_options_magazine_size(mtev_allocator_options_t, int rounds);
+/* Record the call site of roughly 1 in n allocations (0 disables) */
+API_EXPORT(void)
+  mtev_allocator_options_sample_rate(mtev_allocator_options_t, uint32_t n);
 API_EXPORT(mtev_allocator_t)
   mtev_allocator_create(mtev_allocator_options_t);
 
@@ -86,5 +158,94 @@ API_EXPORT(void *)
   mtev_realloc(mtev_allocator_t, void *ptr, size_t size);
 API_EXPORT(void)
   mtev_free(mtev_allocator_t, void *ptr);
+/* Return cached free memory to the OS; returns the bytes released */
+API_EXPORT(size_t)
+  mtev_allocator_reap(mtev_allocator_t);
+
+/* Accounting: counters are kept per thread and merged when read. */
+typedef struct {
+  const char *name;
+  size_t fixed_size;
+  uint64_t allocs;           /* lifetime allocations */
+  uint64_t frees;            /* lifetime frees */
+  int64_t live_objects;
+  int64_t live_bytes;        /* -1 if this allocator can't size frees */
+  uint64_t bytes_allocated;  /* lifetime bytes */
+  int64_t cached_objects;    /* free objects held by freelists/magazines */
+  uint64_t reserved_bytes;   /* memory held by the backend (slabs) */
+  uint32_t sample_rate;
+  uint64_t samples;
+} mtev_allocator_stats_t;
+
+#define MTEV_ALLOCATOR_SAMPLE_DEPTH 8
+typedef struct {
+  int nframes;
+  void *frames[MTEV_ALLOCATOR_SAMPLE_DEPTH];
+  uint64_t samples;
+  uint64_t bytes;  /* sampled bytes; multiply by the sample rate to estimate */
+} mtev_allocator_site_t;
+
+/*! \fn const char *mtev_allocator_name(mtev_allocator_t a)
+    \brief Return the name of an allocator.
+    \param a the allocator
+    \return the name given by mtev_allocator_options_name or a generated one
+ */
+API_EXPORT(const char *)
+  mtev_allocator_name(mtev_allocator_t a);
+
+/*! \fn void mtev_allocator_stats(mtev_allocator_t a, mtev_allocator_stats_t *stats)
+    \brief Read the accounting for an allocator.
+    \param a the allocator
+    \param stats filled with the current totals
+
+    The totals are summed from per-thread counters without stopping
+    writers, so they are approximate while the allocator is busy.
+ */
+API_EXPORT(void)
+  mtev_allocator_stats(mtev_allocator_t a, mtev_allocator_stats_t *stats);
+
+/*! \fn void mtev_allocator_set_sample_rate(mtev_allocator_t a, uint32_t n)
+    \brief Change the allocation site sampling rate of an allocator.
+    \param a the allocator
+    \param n record roughly 1 in n allocations, 0 to disable
+ */
+API_EXPORT(void)
+  mtev_allocator_set_sample_rate(mtev_allocator_t a, uint32_t n);
+
+/* The most distinct allocation sites an allocator tracks. */
+#define MTEV_ALLOCATOR_MAX_SITES 512
+
+/*! \fn int mtev_allocator_sites(mtev_allocator_t a, mtev_allocator_site_t *sites, int max)
+    \brief Retrieve the most sampled allocation sites.
+    \param a the allocator
+    \param sites an array to fill
+    \param max the size of the array
+    \return the number of sites filled, most sampled first
+ */
+API_EXPORT(int)
+  mtev_allocator_sites(mtev_allocator_t a, mtev_allocator_site_t *sites, int max);
+
+/*! \fn void mtev_allocator_sites_reset(mtev_allocator_t a)
+    \brief Discard the sampled allocation sites of an allocator.
+    \param a the allocator
+ */
+API_EXPORT(void)
+  mtev_allocator_sites_reset(mtev_allocator_t a);
+
+/*! \fn mtev_allocator_t mtev_allocator_find(const char *name)
+    \brief Find an allocator by name.
+    \param name the allocator name
+    \return the allocator or NULL
+ */
+API_EXPORT(mtev_allocator_t)
+  mtev_allocator_find(const char *name);
+
+/*! \fn void mtev_allocator_foreach(void (*f)(mtev_allocator_t, void *), void *closure)
+    \brief Call a function for every allocator created.
+    \param f the function to call
+    \param closure passed to f
+ */
+API_EXPORT(void)
+  mtev_allocator_foreach(void (*f)(mtev_allocator_t, void *), void *closure);
 
 #endif
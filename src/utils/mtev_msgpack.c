@@ -0,0 +1,530 @@
+/*
+ * Copyright (c) 2017, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name Circonus, Inc. nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "mtev_defines.h"
+#include "mtev_log.h"
+#include "mtev_msgpack.h"
+#include "mtev_json.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <float.h>
+
+static inline void
+mp_put(mtev_dyn_buffer_t *buf, const uint8_t *d, size_t len) {
+  /* mtev_dyn_buffer_ensure grows to exactly what is asked for, so ask for
+   * at least double to keep appends amortized constant time */
+  if(buf->size - (size_t)(buf->pos - buf->data) < len) {
+    size_t used = buf->pos - buf->data;
+    mtev_dyn_buffer_ensure(buf, len > used ? len : used);
+  }
+  memcpy(buf->pos, d, len);
+  buf->pos += len;
+}
+
+/* a one byte tag followed by a big-endian value of width bytes */
+static inline void
+mp_put_tagged(mtev_dyn_buffer_t *buf, uint8_t tag, uint64_t v, int width) {
+  uint8_t d[9];
+  int i;
+  d[0] = tag;
+  for(i = width; i > 0; i--) {
+    d[i] = v & 0xff;
+    v >>= 8;
+  }
+  mp_put(buf, d, width + 1);
+}
+
+void
+mtev_msgpack_pack_nil(mtev_dyn_buffer_t *buf) {
+  uint8_t c = 0xc0;
+  mp_put(buf, &c, 1);
+}
+
+void
+mtev_msgpack_pack_boolean(mtev_dyn_buffer_t *buf, mtev_boolean b) {
+  uint8_t c = b ? 0xc3 : 0xc2;
+  mp_put(buf, &c, 1);
+}
+
+void
+mtev_msgpack_pack_uint64(mtev_dyn_buffer_t *buf, uint64_t v) {
+  if(v < 0x80) {
+    uint8_t c = v;
+    mp_put(buf, &c, 1);
+  }
+  else if(v <= UINT8_MAX) mp_put_tagged(buf, 0xcc, v, 1);
+  else if(v <= UINT16_MAX) mp_put_tagged(buf, 0xcd, v, 2);
+  else if(v <= UINT32_MAX) mp_put_tagged(buf, 0xce, v, 4);
+  else mp_put_tagged(buf, 0xcf, v, 8);
+}
+
+void
+mtev_msgpack_pack_int64(mtev_dyn_buffer_t *buf, int64_t v) {
+  if(v >= 0) {
+    mtev_msgpack_pack_uint64(buf, (uint64_t)v);
+    return;
+  }
+  if(v >= -32) {
+    uint8_t c = (uint8_t)(int8_t)v;
+    mp_put(buf, &c, 1);
+  }
+  else if(v >= INT8_MIN) mp_put_tagged(buf, 0xd0, (uint64_t)v, 1);
+  else if(v >= INT16_MIN) mp_put_tagged(buf, 0xd1, (uint64_t)v, 2);
+  else if(v >= INT32_MIN) mp_put_tagged(buf, 0xd2, (uint64_t)v, 4);
+  else mp_put_tagged(buf, 0xd3, (uint64_t)v, 8);
+}
+
+void
+mtev_msgpack_pack_double(mtev_dyn_buffer_t *buf, double v) {
+  union { double d; uint64_t u; } d64;
+  union { float f; uint32_t u; } d32;
+  /* converting a finite double outside float's range is undefined */
+  if(fabs(v) <= FLT_MAX || isinf(v)) {
+    d32.f = (float)v;
+    if((double)d32.f == v) {
+      mp_put_tagged(buf, 0xca, d32.u, 4);
+      return;
+    }
+  }
+  d64.d = v;
+  mp_put_tagged(buf, 0xcb, d64.u, 8);
+}
+
+static inline void
+mp_pack_raw(mtev_dyn_buffer_t *buf, uint8_t tag8, const void *b, size_t len) {
+  /* tag8 is str 8 or bin 8; the 16 and 32 bit forms follow it */
+  if(len <= UINT8_MAX) mp_put_tagged(buf, tag8, len, 1);
+  else if(len <= UINT16_MAX) mp_put_tagged(buf, tag8 + 1, len, 2);
+  else mp_put_tagged(buf, tag8 + 2, len, 4);
+  mp_put(buf, b, len);
+}
+
+void
+mtev_msgpack_pack_str(mtev_dyn_buffer_t *buf, const char *s, size_t len) {
+  mtevAssert(len <= UINT32_MAX);
+  if(len < 32) {
+    uint8_t d[32];
+    d[0] = 0xa0 | len;
+    memcpy(d + 1, s, len);
+    mp_put(buf, d, len + 1);
+    return;
+  }
+  mp_pack_raw(buf, 0xd9, s, len);
+}
+
+void
+mtev_msgpack_pack_bin(mtev_dyn_buffer_t *buf, const void *b, size_t len) {
+  mtevAssert(len <= UINT32_MAX);
+  mp_pack_raw(buf, 0xc4, b, len);
+}
+
+void
+mtev_msgpack_pack_array(mtev_dyn_buffer_t *buf, uint32_t count) {
+  if(count < 16) {
+    uint8_t c = 0x90 | count;
+    mp_put(buf, &c, 1);
+  }
+  else if(count <= UINT16_MAX) mp_put_tagged(buf, 0xdc, count, 2);
+  else mp_put_tagged(buf, 0xdd, count, 4);
+}
+
+void
+mtev_msgpack_pack_map(mtev_dyn_buffer_t *buf, uint32_t count) {
+  if(count < 16) {
+    uint8_t c = 0x80 | count;
+    mp_put(buf, &c, 1);
+  }
+  else if(count <= UINT16_MAX) mp_put_tagged(buf, 0xde, count, 2);
+  else mp_put_tagged(buf, 0xdf, count, 4);
+}
+
+void
+mtev_msgpack_reader_init(mtev_msgpack_reader_t *r, const void *buf, size_t len) {
+  r->pos = buf;
+  r->end = r->pos + len;
+}
+
+size_t
+mtev_msgpack_reader_remaining(const mtev_msgpack_reader_t *r) {
+  return r->end - r->pos;
+}
+
+static inline uint64_t
+mp_get_be(const uint8_t *p, int width) {
+  uint64_t v = 0;
+  int i;
+  for(i = 0; i < width; i++) v = (v << 8) | p[i];
+  return v;
+}
+
+mtev_boolean
+mtev_msgpack_read(mtev_msgpack_reader_t *r, mtev_msgpack_item_t *item) {
+  const uint8_t *p = r->pos;
+  size_t avail = r->end - p;
+  uint64_t v;
+  int width = 0;
+  uint8_t c;
+
+  if(avail < 1) return mtev_false;
+  c = *p++;
+  avail--;
+  item->ext_type = 0;
+
+  /* single byte forms */
+  if(c <= 0x7f) {
+    item->type = MTEV_MSGPACK_UINT;
+    item->v.u64 = c;
+    goto done;
+  }
+  if(c >= 0xe0) {
+    item->type = MTEV_MSGPACK_INT;
+    item->v.i64 = (int8_t)c;
+    goto done;
+  }
+  if(c <= 0x8f) {
+    item->type = MTEV_MSGPACK_MAP;
+    item->v.count = c & 0x0f;
+    goto done;
+  }
+  if(c <= 0x9f) {
+    item->type = MTEV_MSGPACK_ARRAY;
+    item->v.count = c & 0x0f;
+    goto done;
+  }
+  if(c <= 0xbf) {
+    item->type = MTEV_MSGPACK_STR;
+    v = c & 0x1f;
+    goto raw;
+  }
+
+  switch(c) {
+  case 0xc0: item->type = MTEV_MSGPACK_NIL; goto done;
+  case 0xc2: case 0xc3:
+    item->type = MTEV_MSGPACK_BOOLEAN;
+    item->v.boolean = (c == 0xc3);
+    goto done;
+  case 0xc4: case 0xc5: case 0xc6:
+    item->type = MTEV_MSGPACK_BIN;
+    width = 1 << (c - 0xc4);
+    break;
+  case 0xd9: case 0xda: case 0xdb:
+    item->type = MTEV_MSGPACK_STR;
+    width = 1 << (c - 0xd9);
+    break;
+  case 0xc7: case 0xc8: case 0xc9:
+    item->type = MTEV_MSGPACK_EXT;
+    width = 1 << (c - 0xc7);
+    if(avail < (size_t)width + 1) return mtev_false;
+    v = mp_get_be(p, width);
+    item->ext_type = (int8_t)p[width];
+    p += width + 1;
+    avail -= width + 1;
+    goto raw;
+  case 0xd4: case 0xd5: case 0xd6: case 0xd7: case 0xd8:
+    item->type = MTEV_MSGPACK_EXT;
+    if(avail < 1) return mtev_false;
+    item->ext_type = (int8_t)*p++;
+    avail--;
+    v = 1 << (c - 0xd4);
+    goto raw;
+  case 0xca: case 0xcb:
+    width = (c == 0xca) ? 4 : 8;
+    if(avail < (size_t)width) return mtev_false;
+    v = mp_get_be(p, width);
+    p += width;
+    item->type = MTEV_MSGPACK_DOUBLE;
+    if(width == 4) {
+      union { float f; uint32_t u; } d32;
+      d32.u = (uint32_t)v;
+      item->v.dbl = d32.f;
+    }
+    else {
+      union { double d; uint64_t u; } d64;
+      d64.u = v;
+      item->v.dbl = d64.d;
+    }
+    goto done;
+  case 0xcc: case 0xcd: case 0xce: case 0xcf:
+    width = 1 << (c - 0xcc);
+    if(avail < (size_t)width) return mtev_false;
+    item->type = MTEV_MSGPACK_UINT;
+    item->v.u64 = mp_get_be(p, width);
+    p += width;
+    goto done;
+  case 0xd0: case 0xd1: case 0xd2: case 0xd3:
+    width = 1 << (c - 0xd0);
+    if(avail < (size_t)width) return mtev_false;
+    v = mp_get_be(p, width);
+    p += width;
+    /* sign extend */
+    if(width < 8 && (v & ((uint64_t)1 << (width * 8 - 1))))
+      v |= ~(uint64_t)0 << (width * 8);
+    if((int64_t)v >= 0) {
+      item->type = MTEV_MSGPACK_UINT;
+      item->v.u64 = v;
+    }
+    else {
+      item->type = MTEV_MSGPACK_INT;
+      item->v.i64 = (int64_t)v;
+    }
+    goto done;
+  case 0xdc: case 0xdd: case 0xde: case 0xdf:
+    width = (c & 1) ? 4 : 2;
+    if(avail < (size_t)width) return mtev_false;
+    item->type = (c <= 0xdd) ? MTEV_MSGPACK_ARRAY : MTEV_MSGPACK_MAP;
+    item->v.count = mp_get_be(p, width);
+    p += width;
+    goto done;
+  default: /* 0xc1 is never used */
+    return mtev_false;
+  }
+
+  /* str, bin and ext with an explicit length */
+  if(avail < (size_t)width) return mtev_false;
+  v = mp_get_be(p, width);
+  p += width;
+  avail -= width;
+ raw:
+  if(avail < v) return mtev_false;
+  item->v.str.ptr = (const char *)p;
+  item->v.str.len = v;
+  p += v;
+ done:
+  r->pos = p;
+  return mtev_true;
+}
+
+mtev_boolean
+mtev_msgpack_skip(mtev_msgpack_reader_t *r) {
+  mtev_msgpack_reader_t save = *r;
+  mtev_msgpack_item_t item;
+  uint64_t pending = 1;
+
+  /* containers just add to the count of values still to be read, so
+   * nesting needs no stack */
+  while(pending) {
+    if(!mtev_msgpack_read(r, &item)) {
+      *r = save;
+      return mtev_false;
+    }
+    pending--;
+    if(item.type == MTEV_MSGPACK_ARRAY) pending += item.v.count;
+    else if(item.type == MTEV_MSGPACK_MAP) pending += 2 * (uint64_t)item.v.count;
+    /* every value needs at least a byte */
+    if(pending > mtev_msgpack_reader_remaining(r)) {
+      *r = save;
+      return mtev_false;
+    }
+  }
+  return mtev_true;
+}
+
+void
+mtev_msgpack_pack_json(mtev_dyn_buffer_t *buf, struct mtev_json_object *obj) {
+  const char *str;
+  if(!obj) {
+    mtev_msgpack_pack_nil(buf);
+    return;
+  }
+  switch(mtev_json_object_get_type(obj)) {
+  case mtev_json_type_null:
+    mtev_msgpack_pack_nil(buf);
+    break;
+  case mtev_json_type_boolean:
+    mtev_msgpack_pack_boolean(buf, mtev_json_object_get_boolean(obj) ? mtev_true : mtev_false);
+    break;
+  case mtev_json_type_double:
+    mtev_msgpack_pack_double(buf, mtev_json_object_get_double(obj));
+    break;
+  case mtev_json_type_int:
+    switch(mtev_json_object_get_int_overflow(obj)) {
+    case mtev_json_overflow_int:
+      mtev_msgpack_pack_int64(buf, mtev_json_object_get_int(obj));
+      break;
+    case mtev_json_overflow_int64:
+      mtev_msgpack_pack_int64(buf, mtev_json_object_get_int64(obj));
+      break;
+    case mtev_json_overflow_uint64:
+      mtev_msgpack_pack_uint64(buf, mtev_json_object_get_uint64(obj));
+      break;
+    }
+    break;
+  case mtev_json_type_string:
+    str = mtev_json_object_get_string(obj);
+    mtev_msgpack_pack_str(buf, str, strlen(str));
+    break;
+  case mtev_json_type_array:
+  {
+    int i, cnt = mtev_json_object_array_length(obj);
+    mtev_msgpack_pack_array(buf, cnt);
+    for(i = 0; i < cnt; i++)
+      mtev_msgpack_pack_json(buf, mtev_json_object_array_get_idx(obj, i));
+    break;
+  }
+  case mtev_json_type_object:
+  {
+    struct jl_lh_table *lh = mtev_json_object_get_object(obj);
+    struct jl_lh_entry *el;
+    mtev_msgpack_pack_map(buf, lh->count);
+    jl_lh_foreach(lh, el) {
+      mtev_msgpack_pack_str(buf, el->k, strlen(el->k));
+      mtev_msgpack_pack_json(buf, (struct mtev_json_object *)el->v);
+    }
+    break;
+  }
+  }
+}
+
+/* JSON keys are strings; scalar keys are rendered as text */
+static const char *
+mp_json_key(const mtev_msgpack_item_t *item, char *tmp, size_t tmplen,
+            char **heap) {
+  *heap = NULL;
+  switch(item->type) {
+  case MTEV_MSGPACK_STR:
+  case MTEV_MSGPACK_BIN:
+    if(item->v.str.len < tmplen) {
+      memcpy(tmp, item->v.str.ptr, item->v.str.len);
+      tmp[item->v.str.len] = '\0';
+      return tmp;
+    }
+    *heap = malloc(item->v.str.len + 1);
+    if(!*heap) return NULL;
+    memcpy(*heap, item->v.str.ptr, item->v.str.len);
+    (*heap)[item->v.str.len] = '\0';
+    return *heap;
+  case MTEV_MSGPACK_NIL:
+    return "null";
+  case MTEV_MSGPACK_BOOLEAN:
+    return item->v.boolean ? "true" : "false";
+  case MTEV_MSGPACK_INT:
+    snprintf(tmp, tmplen, "%" PRId64, item->v.i64);
+    return tmp;
+  case MTEV_MSGPACK_UINT:
+    snprintf(tmp, tmplen, "%" PRIu64, item->v.u64);
+    return tmp;
+  case MTEV_MSGPACK_DOUBLE:
+    snprintf(tmp, tmplen, "%.17g", item->v.dbl);
+    return tmp;
+  default:
+    return NULL;
+  }
+}
+
+static mtev_boolean
+mp_unpack_json(mtev_msgpack_reader_t *r, struct mtev_json_object **out, int depth) {
+  mtev_msgpack_item_t item;
+  struct mtev_json_object *o = NULL, *child;
+  uint32_t i;
+
+  *out = NULL;
+  if(!mtev_msgpack_read(r, &item)) return mtev_false;
+  switch(item.type) {
+  case MTEV_MSGPACK_NIL:
+    return mtev_true;
+  case MTEV_MSGPACK_BOOLEAN:
+    o = mtev_json_object_new_boolean(item.v.boolean);
+    break;
+  case MTEV_MSGPACK_INT:
+    /* as mtev_json_tokener: an int when it fits, with the 64-bit value
+     * alongside */
+    if(item.v.i64 >= INT_MIN) {
+      o = mtev_json_object_new_int((int)item.v.i64);
+      mtev_json_object_set_int64(o, item.v.i64);
+    }
+    else o = mtev_json_object_new_int64(item.v.i64);
+    break;
+  case MTEV_MSGPACK_UINT:
+    if(item.v.u64 <= INT_MAX) {
+      o = mtev_json_object_new_int((int)item.v.u64);
+      mtev_json_object_set_uint64(o, item.v.u64);
+    }
+    else if(item.v.u64 <= INT64_MAX) o = mtev_json_object_new_int64((int64_t)item.v.u64);
+    else o = mtev_json_object_new_uint64(item.v.u64);
+    break;
+  case MTEV_MSGPACK_DOUBLE:
+    o = mtev_json_object_new_double(item.v.dbl);
+    break;
+  case MTEV_MSGPACK_STR:
+  case MTEV_MSGPACK_BIN:
+    o = mtev_json_object_new_string_len(item.v.str.ptr, item.v.str.len);
+    break;
+  case MTEV_MSGPACK_EXT:
+    return mtev_false;
+  case MTEV_MSGPACK_ARRAY:
+    if(depth >= MTEV_MSGPACK_MAX_DEPTH) return mtev_false;
+    o = mtev_json_object_new_array();
+    for(i = 0; i < item.v.count; i++) {
+      if(!mp_unpack_json(r, &child, depth + 1)) goto fail;
+      mtev_json_object_array_add(o, child);
+    }
+    break;
+  case MTEV_MSGPACK_MAP:
+    if(depth >= MTEV_MSGPACK_MAX_DEPTH) return mtev_false;
+    o = mtev_json_object_new_object();
+    for(i = 0; i < item.v.count; i++) {
+      mtev_msgpack_item_t key;
+      char tmp[256], *heap;
+      const char *k;
+      if(!mtev_msgpack_read(r, &key)) goto fail;
+      if(!(k = mp_json_key(&key, tmp, sizeof(tmp), &heap))) goto fail;
+      if(!mp_unpack_json(r, &child, depth + 1)) {
+        free(heap);
+        goto fail;
+      }
+      mtev_json_object_object_add(o, k, child);
+      free(heap);
+    }
+    break;
+  }
+  *out = o;
+  return mtev_true;
+
+ fail:
+  mtev_json_object_put(o);
+  return mtev_false;
+}
+
+mtev_boolean
+mtev_msgpack_unpack_json(const void *buf, size_t len,
+                         struct mtev_json_object **out) {
+  mtev_msgpack_reader_t r;
+  mtev_msgpack_reader_init(&r, buf, len);
+  if(!mp_unpack_json(&r, out, 0)) return mtev_false;
+  if(mtev_msgpack_reader_remaining(&r) != 0) {
+    mtev_json_object_put(*out);
+    *out = NULL;
+    return mtev_false;
+  }
+  return mtev_true;
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2017, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name Circonus, Inc. nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _MTEV_MSGPACK_H
+#define _MTEV_MSGPACK_H
+
+/*!  \file mtev_msgpack.h
+
+     A MessagePack encoder and decoder.  Values are appended to an
+     mtev_dyn_buffer_t and read back with a cursor whose strings and
+     binary blobs point into the input rather than being copied.
+     mtev_json_object trees convert directly in both directions.
+ */
+
+#include "mtev_defines.h"
+#include "mtev_dyn_buffer.h"
+
+#define MTEV_MSGPACK_CONTENT_TYPE "application/msgpack"
+/* The deepest nesting the tree conversions accept. */
+#define MTEV_MSGPACK_MAX_DEPTH 1024
+
+typedef enum {
+  MTEV_MSGPACK_NIL,
+  MTEV_MSGPACK_BOOLEAN,
+  MTEV_MSGPACK_INT,     /* a negative integer, v.i64 */
+  MTEV_MSGPACK_UINT,    /* a non-negative integer, v.u64 */
+  MTEV_MSGPACK_DOUBLE,  /* float 32 or 64, v.dbl */
+  MTEV_MSGPACK_STR,     /* v.str */
+  MTEV_MSGPACK_BIN,     /* v.str */
+  MTEV_MSGPACK_EXT,     /* v.str, with ext_type */
+  MTEV_MSGPACK_ARRAY,   /* v.count elements follow */
+  MTEV_MSGPACK_MAP      /* v.count key/value pairs follow */
+} mtev_msgpack_type_t;
+
+typedef struct {
+  mtev_msgpack_type_t type;
+  int8_t ext_type;
+  union {
+    mtev_boolean boolean;
+    int64_t i64;
+    uint64_t u64;
+    double dbl;
+    struct {
+      const char *ptr;  /* into the input, not NUL terminated */
+      uint32_t len;
+    } str;
+    uint32_t count;
+  } v;
+} mtev_msgpack_item_t;
+
+typedef struct {
+  const uint8_t *pos;
+  const uint8_t *end;
+} mtev_msgpack_reader_t;
+
+/*! \fn void mtev_msgpack_pack_nil(mtev_dyn_buffer_t *buf)
+    \brief Append a nil.
+ */
+API_EXPORT(void) mtev_msgpack_pack_nil(mtev_dyn_buffer_t *buf);
+
+/*! \fn void mtev_msgpack_pack_boolean(mtev_dyn_buffer_t *buf, mtev_boolean b)
+    \brief Append a boolean.
+ */
+API_EXPORT(void) mtev_msgpack_pack_boolean(mtev_dyn_buffer_t *buf, mtev_boolean b);
+
+/*! \fn void mtev_msgpack_pack_int64(mtev_dyn_buffer_t *buf, int64_t v)
+    \brief Append a signed integer in its smallest encoding.
+ */
+API_EXPORT(void) mtev_msgpack_pack_int64(mtev_dyn_buffer_t *buf, int64_t v);
+
+/*! \fn void mtev_msgpack_pack_uint64(mtev_dyn_buffer_t *buf, uint64_t v)
+    \brief Append an unsigned integer in its smallest encoding.
+ */
+API_EXPORT(void) mtev_msgpack_pack_uint64(mtev_dyn_buffer_t *buf, uint64_t v);
+
+/*! \fn void mtev_msgpack_pack_double(mtev_dyn_buffer_t *buf, double v)
+    \brief Append a floating point number.
+
+    The value is written as a float 32 when that loses nothing.
+ */
+API_EXPORT(void) mtev_msgpack_pack_double(mtev_dyn_buffer_t *buf, double v);
+
+/*! \fn void mtev_msgpack_pack_str(mtev_dyn_buffer_t *buf, const char *s, size_t len)
+    \brief Append a string.
+ */
+API_EXPORT(void) mtev_msgpack_pack_str(mtev_dyn_buffer_t *buf, const char *s, size_t len);
+
+/*! \fn void mtev_msgpack_pack_bin(mtev_dyn_buffer_t *buf, const void *b, size_t len)
+    \brief Append a binary blob.
+ */
+API_EXPORT(void) mtev_msgpack_pack_bin(mtev_dyn_buffer_t *buf, const void *b, size_t len);
+
+/*! \fn void mtev_msgpack_pack_array(mtev_dyn_buffer_t *buf, uint32_t count)
+    \brief Start an array; the next count values appended are its elements.
+ */
+API_EXPORT(void) mtev_msgpack_pack_array(mtev_dyn_buffer_t *buf, uint32_t count);
+
+/*! \fn void mtev_msgpack_pack_map(mtev_dyn_buffer_t *buf, uint32_t count)
+    \brief Start a map; the next 2 * count values appended are its keys and values.
+ */
+API_EXPORT(void) mtev_msgpack_pack_map(mtev_dyn_buffer_t *buf, uint32_t count);
+
+/*! \fn void mtev_msgpack_reader_init(mtev_msgpack_reader_t *r, const void *buf, size_t len)
+    \brief Prepare to read MessagePack data.
+    \param r the reader.
+    \param buf the encoded data, which must outlive any items read.
+    \param len the length of buf.
+ */
+API_EXPORT(void)
+  mtev_msgpack_reader_init(mtev_msgpack_reader_t *r, const void *buf, size_t len);
+
+/*! \fn size_t mtev_msgpack_reader_remaining(const mtev_msgpack_reader_t *r)
+    \brief Return the number of bytes not yet read.
+ */
+API_EXPORT(size_t)
+  mtev_msgpack_reader_remaining(const mtev_msgpack_reader_t *r);
+
+/*! \fn mtev_boolean mtev_msgpack_read(mtev_msgpack_reader_t *r, mtev_msgpack_item_t *item)
+    \brief Read the next item.
+    \param r the reader.
+    \param item filled with the item read.
+    \return mtev_true on success, mtev_false on truncated or invalid input.
+
+    Arrays and maps yield only their header; their contents are read by
+    subsequent calls.  The reader does not move on failure.
+ */
+API_EXPORT(mtev_boolean)
+  mtev_msgpack_read(mtev_msgpack_reader_t *r, mtev_msgpack_item_t *item);
+
+/*! \fn mtev_boolean mtev_msgpack_skip(mtev_msgpack_reader_t *r)
+    \brief Skip the next value, including everything within it.
+    \return mtev_true on success, mtev_false on truncated or invalid input.
+ */
+API_EXPORT(mtev_boolean)
+  mtev_msgpack_skip(mtev_msgpack_reader_t *r);
+
+struct mtev_json_object;
+
+/*! \fn void mtev_msgpack_pack_json(mtev_dyn_buffer_t *buf, struct mtev_json_object *obj)
+    \brief Append a JSON object tree.
+
+    Integers keep their 64-bit value and signedness; a NULL object is
+    written as nil.
+ */
+API_EXPORT(void)
+  mtev_msgpack_pack_json(mtev_dyn_buffer_t *buf, struct mtev_json_object *obj);
+
+/*! \fn mtev_boolean mtev_msgpack_unpack_json(const void *buf, size_t len, struct mtev_json_object **out)
+    \brief Decode exactly one value into a JSON object tree.
+    \param buf the encoded data.
+    \param len the length of buf.
+    \param out set to the new tree (NULL for nil), to be released with mtev_json_object_put.
+    \return mtev_true on success.
+
+    Binary blobs become strings and non-string map keys are rendered as
+    text.  Extension types, trailing data and nesting beyond
+    MTEV_MSGPACK_MAX_DEPTH are rejected.
+ */
+API_EXPORT(mtev_boolean)
+  mtev_msgpack_unpack_json(const void *buf, size_t len,
+                           struct mtev_json_object **out);
+
+#endif
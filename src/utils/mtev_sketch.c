@@ -0,0 +1,1065 @@
+/*
+ * Copyright (c) 2017, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name Circonus, Inc. nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "mtev_defines.h"
+#include "mtev_sketch.h"
+#include "mtev_hash.h"
+#include "mtev_cpuid.h"
+
+#include <ck_pr.h>
+#include <ck_spinlock.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#define BLOOM_SIMD 1
+#include <immintrin.h>
+#endif
+
+#define SKETCH_VERSION 1
+#define SKETCH_CMS 'C'
+#define SKETCH_TDIGEST 'T'
+#define SKETCH_BLOOM 'B'
+#define SKETCH_CUCKOO 'F'
+#define SKETCH_SEED 0x736b65746368ULL
+#define IS_CONCURRENT(s) ((s)->flags & MTEV_SKETCH_CONCURRENT)
+
+static inline uint8_t *
+put_u32(uint8_t *p, uint32_t v) {
+  p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+  return p + 4;
+}
+static inline uint8_t *
+put_u64(uint8_t *p, uint64_t v) {
+  p = put_u32(p, (uint32_t)v);
+  return put_u32(p, (uint32_t)(v >> 32));
+}
+static inline uint8_t *
+put_double(uint8_t *p, double d) {
+  uint64_t v;
+  memcpy(&v, &d, sizeof(v));
+  return put_u64(p, v);
+}
+static inline uint32_t
+get_u32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+         ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+static inline uint64_t
+get_u64(const uint8_t *p) {
+  return (uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+static inline double
+get_double(const uint8_t *p) {
+  uint64_t v = get_u64(p);
+  double d;
+  memcpy(&d, &v, sizeof(d));
+  return d;
+}
+static inline uint64_t
+sketch_hash(const void *key, size_t len) {
+  return mtev_hash__hash64(key, len, SKETCH_SEED);
+}
+
+/* Count-Min
+ *
+ * Row r uses counter (h1 + r * h2) mod width from a single 64bit hash.
+ * Conservative update is only correct if two updates of the same key do
+ * not interleave (both would raise the counters from the same minimum), so
+ * concurrent sketches serialize updates on a lock striped by key hash;
+ * counters themselves only ever grow, via CAS, so estimates need no lock.
+ */
+#define CMS_MAX_DEPTH 32
+#define CMS_STRIPES 64
+
+struct mtev_cms {
+  uint32_t width;
+  uint32_t depth;
+  uint32_t mask;
+  int flags;
+  uint64_t total;
+  uint32_t *counters;
+  ck_spinlock_t stripes[CMS_STRIPES];
+};
+
+static inline uint32_t
+sat_add32(uint32_t a, uint32_t b) {
+  uint32_t s = a + b;
+  return (s < a) ? UINT32_MAX : s;
+}
+
+static inline uint32_t *
+cms_counter(mtev_cms_t *cms, uint64_t hash, uint32_t row) {
+  uint32_t h1 = (uint32_t)hash, h2 = (uint32_t)(hash >> 32) | 1;
+  return &cms->counters[(size_t)row * cms->width + ((h1 + row * h2) & cms->mask)];
+}
+
+mtev_cms_t *
+mtev_cms_alloc(uint32_t width, uint32_t depth, int flags) {
+  mtev_cms_t *cms;
+  uint32_t w = 1, i;
+  if(width == 0 || width > (1U << 30) || depth == 0 || depth > CMS_MAX_DEPTH)
+    return NULL;
+  while(w < width) w <<= 1;
+  cms = calloc(1, sizeof(*cms));
+  cms->width = w;
+  cms->mask = w - 1;
+  cms->depth = depth;
+  cms->flags = flags;
+  cms->counters = calloc((size_t)w * depth, sizeof(*cms->counters));
+  for(i=0; i<CMS_STRIPES; i++) ck_spinlock_init(&cms->stripes[i]);
+  return cms;
+}
+
+mtev_cms_t *
+mtev_cms_alloc_error(double epsilon, double delta, int flags) {
+  if(!(epsilon > 0 && epsilon < 1) || !(delta > 0 && delta < 1)) return NULL;
+  return mtev_cms_alloc((uint32_t)ceil(M_E / epsilon),
+                        (uint32_t)ceil(log(1.0 / delta)), flags);
+}
+
+void
+mtev_cms_destroy(mtev_cms_t *cms) {
+  if(!cms) return;
+  free(cms->counters);
+  free(cms);
+}
+
+uint32_t
+mtev_cms_estimate_hash(mtev_cms_t *cms, uint64_t hash) {
+  uint32_t r, v, min = UINT32_MAX;
+  for(r=0; r<cms->depth; r++) {
+    v = ck_pr_load_32(cms_counter(cms, hash, r));
+    if(v < min) min = v;
+  }
+  return min;
+}
+
+uint32_t
+mtev_cms_estimate(mtev_cms_t *cms, const void *key, size_t len) {
+  return mtev_cms_estimate_hash(cms, sketch_hash(key, len));
+}
+
+uint32_t
+mtev_cms_add_hash(mtev_cms_t *cms, uint64_t hash, uint32_t count) {
+  uint32_t *c[CMS_MAX_DEPTH];
+  uint32_t r, v, min = UINT32_MAX, target;
+
+  if(!IS_CONCURRENT(cms)) {
+    for(r=0; r<cms->depth; r++) {
+      c[r] = cms_counter(cms, hash, r);
+      if(*c[r] < min) min = *c[r];
+    }
+    target = sat_add32(min, count);
+    for(r=0; r<cms->depth; r++) if(*c[r] < target) *c[r] = target;
+    cms->total += count;
+    return target;
+  }
+
+  ck_spinlock_t *stripe = &cms->stripes[(hash >> 26) % CMS_STRIPES];
+  ck_spinlock_lock(stripe);
+  for(r=0; r<cms->depth; r++) {
+    c[r] = cms_counter(cms, hash, r);
+    v = ck_pr_load_32(c[r]);
+    if(v < min) min = v;
+  }
+  target = sat_add32(min, count);
+  for(r=0; r<cms->depth; r++) {
+    /* other keys sharing this counter may raise it concurrently */
+    v = ck_pr_load_32(c[r]);
+    while(v < target && !ck_pr_cas_32_value(c[r], v, target, &v));
+  }
+  ck_spinlock_unlock(stripe);
+  ck_pr_add_64(&cms->total, count);
+  return target;
+}
+
+uint32_t
+mtev_cms_add(mtev_cms_t *cms, const void *key, size_t len, uint32_t count) {
+  return mtev_cms_add_hash(cms, sketch_hash(key, len), count);
+}
+
+uint64_t
+mtev_cms_total(mtev_cms_t *cms) {
+  return ck_pr_load_64(&cms->total);
+}
+
+int
+mtev_cms_merge(mtev_cms_t *tgt, mtev_cms_t *src) {
+  size_t i, n;
+  if(tgt->width != src->width || tgt->depth != src->depth) return -1;
+  n = (size_t)tgt->width * tgt->depth;
+  for(i=0; i<n; i++) {
+    uint32_t add = ck_pr_load_32(&src->counters[i]), v;
+    if(add == 0) continue;
+    if(!IS_CONCURRENT(tgt)) {
+      tgt->counters[i] = sat_add32(tgt->counters[i], add);
+      continue;
+    }
+    v = ck_pr_load_32(&tgt->counters[i]);
+    while(!ck_pr_cas_32_value(&tgt->counters[i], v, sat_add32(v, add), &v));
+  }
+  ck_pr_add_64(&tgt->total, ck_pr_load_64(&src->total));
+  return 0;
+}
+
+size_t
+mtev_cms_serialized_size(mtev_cms_t *cms) {
+  return 2 + 4 + 4 + 8 + (size_t)cms->width * cms->depth * 4;
+}
+
+ssize_t
+mtev_cms_serialize(mtev_cms_t *cms, void *buf, size_t len) {
+  size_t need = mtev_cms_serialized_size(cms), i, n;
+  uint8_t *p = buf;
+  if(len < need) return -1;
+  *p++ = SKETCH_CMS;
+  *p++ = SKETCH_VERSION;
+  p = put_u32(p, cms->width);
+  p = put_u32(p, cms->depth);
+  p = put_u64(p, ck_pr_load_64(&cms->total));
+  n = (size_t)cms->width * cms->depth;
+  for(i=0; i<n; i++) p = put_u32(p, ck_pr_load_32(&cms->counters[i]));
+  return need;
+}
+
+mtev_cms_t *
+mtev_cms_deserialize(const void *buf, size_t len, int flags) {
+  const uint8_t *p = buf;
+  mtev_cms_t *cms;
+  uint32_t width, depth;
+  size_t i, n;
+  if(len < 18 || p[0] != SKETCH_CMS || p[1] != SKETCH_VERSION) return NULL;
+  width = get_u32(p + 2);
+  depth = get_u32(p + 6);
+  if(width == 0 || (width & (width - 1)) || width > (1U << 30) ||
+     depth == 0 || depth > CMS_MAX_DEPTH) return NULL;
+  if(len != 18 + (size_t)width * depth * 4) return NULL;
+  if(NULL == (cms = mtev_cms_alloc(width, depth, flags))) return NULL;
+  cms->total = get_u64(p + 10);
+  p += 18;
+  n = (size_t)width * depth;
+  for(i=0; i<n; i++, p += 4) cms->counters[i] = get_u32(p);
+  return cms;
+}
+
+/* t-digest
+ *
+ * The merging variant: samples land in a buffer which, when full (or before
+ * any query), is sorted together with the existing centroids and compacted
+ * left to right, growing each centroid while its span of the quantile range
+ * stays within one unit of the k1 scale function
+ * k(q) = compression / (2 pi) * asin(2q - 1).
+ */
+struct centroid {
+  double mean;
+  double weight;
+};
+
+struct mtev_tdigest {
+  double compression;
+  int flags;
+  pthread_mutex_t lock;
+  double min;
+  double max;
+  double total;
+  uint32_t n_centroids;
+  uint32_t n_buffered;
+  uint32_t cap;
+  uint32_t buffer_cap;
+  struct centroid *c;
+};
+
+#define TD_LOCK(td) do { \
+  if(IS_CONCURRENT(td)) pthread_mutex_lock(&(td)->lock); \
+} while(0)
+#define TD_UNLOCK(td) do { \
+  if(IS_CONCURRENT(td)) pthread_mutex_unlock(&(td)->lock); \
+} while(0)
+
+static int
+centroid_cmp(const void *a, const void *b) {
+  const struct centroid *ac = a, *bc = b;
+  return (ac->mean < bc->mean) ? -1 : (ac->mean > bc->mean);
+}
+
+static inline double
+td_k(mtev_tdigest_t *td, double q) {
+  return td->compression / (2.0 * M_PI) * asin(2.0 * q - 1.0);
+}
+static inline double
+td_k_inv(mtev_tdigest_t *td, double k) {
+  if(k >= td->compression / 4.0) return 1.0;
+  return (sin(k * 2.0 * M_PI / td->compression) + 1.0) / 2.0;
+}
+
+static void
+td_compress(mtev_tdigest_t *td) {
+  uint32_t i, n = td->n_centroids + td->n_buffered, out = 0;
+  double so_far = 0, qlimit;
+  struct centroid cur;
+
+  if(td->n_buffered == 0) return;
+  qsort(td->c, n, sizeof(*td->c), centroid_cmp);
+  cur = td->c[0];
+  qlimit = td_k_inv(td, td_k(td, 0) + 1.0);
+  for(i=1; i<n; i++) {
+    double proposed = cur.weight + td->c[i].weight;
+    if((so_far + proposed) / td->total <= qlimit) {
+      cur.mean += (td->c[i].mean - cur.mean) * td->c[i].weight / proposed;
+      cur.weight = proposed;
+    }
+    else {
+      so_far += cur.weight;
+      td->c[out++] = cur;
+      qlimit = td_k_inv(td, td_k(td, so_far / td->total) + 1.0);
+      cur = td->c[i];
+    }
+  }
+  td->c[out++] = cur;
+  td->n_centroids = out;
+  td->n_buffered = 0;
+}
+
+mtev_tdigest_t *
+mtev_tdigest_alloc(double compression, int flags) {
+  mtev_tdigest_t *td;
+  if(!(compression >= 20)) compression = 20;
+  if(compression > 1000) compression = 1000;
+  td = calloc(1, sizeof(*td));
+  td->compression = compression;
+  td->flags = flags;
+  pthread_mutex_init(&td->lock, NULL);
+  td->min = INFINITY;
+  td->max = -INFINITY;
+  /* k1 compacts to at most compression + 1 centroids (usually about half) */
+  td->cap = (uint32_t)ceil(compression) + 1;
+  td->buffer_cap = (uint32_t)ceil(compression * 4);
+  td->c = calloc(td->cap + td->buffer_cap, sizeof(*td->c));
+  return td;
+}
+
+void
+mtev_tdigest_destroy(mtev_tdigest_t *td) {
+  if(!td) return;
+  pthread_mutex_destroy(&td->lock);
+  free(td->c);
+  free(td);
+}
+
+static void
+td_add_locked(mtev_tdigest_t *td, double value, double weight) {
+  if(td->n_centroids + td->n_buffered == td->cap + td->buffer_cap)
+    td_compress(td);
+  td->c[td->n_centroids + td->n_buffered].mean = value;
+  td->c[td->n_centroids + td->n_buffered].weight = weight;
+  td->n_buffered++;
+  td->total += weight;
+  if(value < td->min) td->min = value;
+  if(value > td->max) td->max = value;
+}
+
+void
+mtev_tdigest_add(mtev_tdigest_t *td, double value, double weight) {
+  if(isnan(value) || !(weight > 0)) return;
+  TD_LOCK(td);
+  td_add_locked(td, value, weight);
+  TD_UNLOCK(td);
+}
+
+double
+mtev_tdigest_count(mtev_tdigest_t *td) {
+  double total;
+  TD_LOCK(td);
+  total = td->total;
+  TD_UNLOCK(td);
+  return total;
+}
+
+/* Each centroid is taken to sit at the middle of the weight it covers;
+ * values are interpolated between neighbouring centroids and out to the
+ * observed min and max at the ends. */
+double
+mtev_tdigest_quantile(mtev_tdigest_t *td, double q) {
+  double rv, index, t = 0, next;
+  uint32_t i, n;
+  struct centroid *c;
+
+  if(q < 0) q = 0;
+  if(q > 1) q = 1;
+  TD_LOCK(td);
+  td_compress(td);
+  n = td->n_centroids;
+  c = td->c;
+  if(n == 0) { rv = NAN; goto out; }
+  index = q * td->total;
+  if(index <= c[0].weight / 2) {
+    rv = td->min + (c[0].mean - td->min) * index / (c[0].weight / 2);
+    goto out;
+  }
+  for(i=0; i<n-1; i++) {
+    double here = t + c[i].weight / 2;
+    next = t + c[i].weight + c[i+1].weight / 2;
+    if(index < next) {
+      rv = c[i].mean + (c[i+1].mean - c[i].mean) * (index - here) / (next - here);
+      goto out;
+    }
+    t += c[i].weight;
+  }
+  next = t + c[n-1].weight / 2;
+  rv = c[n-1].mean + (td->max - c[n-1].mean) *
+       (index - next) / (td->total - next);
+ out:
+  TD_UNLOCK(td);
+  return rv;
+}
+
+double
+mtev_tdigest_cdf(mtev_tdigest_t *td, double value) {
+  double rv, t = 0;
+  uint32_t i, n;
+  struct centroid *c;
+
+  TD_LOCK(td);
+  td_compress(td);
+  n = td->n_centroids;
+  c = td->c;
+  if(n == 0) { rv = NAN; goto out; }
+  if(value < td->min) { rv = 0; goto out; }
+  if(value >= td->max) { rv = 1; goto out; }
+  if(value < c[0].mean) {
+    rv = (c[0].weight / 2) * (value - td->min) / (c[0].mean - td->min);
+    goto div;
+  }
+  for(i=0; i<n-1; i++) {
+    if(value < c[i+1].mean) {
+      double here = t + c[i].weight / 2;
+      double next = t + c[i].weight + c[i+1].weight / 2;
+      rv = here + (next - here) * (value - c[i].mean) / (c[i+1].mean - c[i].mean);
+      goto div;
+    }
+    t += c[i].weight;
+  }
+  t += c[n-1].weight / 2;
+  rv = t + (td->total - t) * (value - c[n-1].mean) / (td->max - c[n-1].mean);
+ div:
+  rv /= td->total;
+ out:
+  TD_UNLOCK(td);
+  return rv;
+}
+
+int
+mtev_tdigest_merge(mtev_tdigest_t *tgt, mtev_tdigest_t *src) {
+  struct centroid *copy;
+  double min, max;
+  uint32_t i, n;
+
+  /* snapshot src so the two locks are never held together */
+  TD_LOCK(src);
+  td_compress(src);
+  n = src->n_centroids;
+  min = src->min;
+  max = src->max;
+  copy = malloc((n ? n : 1) * sizeof(*copy));
+  memcpy(copy, src->c, n * sizeof(*copy));
+  TD_UNLOCK(src);
+
+  TD_LOCK(tgt);
+  for(i=0; i<n; i++) td_add_locked(tgt, copy[i].mean, copy[i].weight);
+  if(n) {
+    if(min < tgt->min) tgt->min = min;
+    if(max > tgt->max) tgt->max = max;
+  }
+  TD_UNLOCK(tgt);
+  free(copy);
+  return 0;
+}
+
+size_t
+mtev_tdigest_serialized_size(mtev_tdigest_t *td) {
+  size_t n;
+  TD_LOCK(td);
+  td_compress(td);
+  n = td->n_centroids;
+  TD_UNLOCK(td);
+  return 2 + 8 * 3 + 4 + n * 16;
+}
+
+ssize_t
+mtev_tdigest_serialize(mtev_tdigest_t *td, void *buf, size_t len) {
+  uint8_t *p = buf;
+  size_t need;
+  uint32_t i;
+  TD_LOCK(td);
+  td_compress(td);
+  need = 2 + 8 * 3 + 4 + (size_t)td->n_centroids * 16;
+  if(len < need) {
+    TD_UNLOCK(td);
+    return -1;
+  }
+  *p++ = SKETCH_TDIGEST;
+  *p++ = SKETCH_VERSION;
+  p = put_double(p, td->compression);
+  p = put_double(p, td->min);
+  p = put_double(p, td->max);
+  p = put_u32(p, td->n_centroids);
+  for(i=0; i<td->n_centroids; i++) {
+    p = put_double(p, td->c[i].mean);
+    p = put_double(p, td->c[i].weight);
+  }
+  TD_UNLOCK(td);
+  return need;
+}
+
+mtev_tdigest_t *
+mtev_tdigest_deserialize(const void *buf, size_t len, int flags) {
+  const uint8_t *p = buf;
+  mtev_tdigest_t *td;
+  uint32_t i, n;
+  double prev = -INFINITY;
+
+  if(len < 30 || p[0] != SKETCH_TDIGEST || p[1] != SKETCH_VERSION) return NULL;
+  n = get_u32(p + 26);
+  if(len != 30 + (size_t)n * 16) return NULL;
+  td = mtev_tdigest_alloc(get_double(p + 2), flags);
+  /* the writer compacted to this compression; a corrupt count won't fit */
+  if(n > td->cap) goto bad;
+  p += 30;
+  for(i=0; i<n; i++, p += 16) {
+    double mean = get_double(p), weight = get_double(p + 8);
+    if(isnan(mean) || mean < prev || !(weight > 0) || isinf(weight)) goto bad;
+    td->c[i].mean = prev = mean;
+    td->c[i].weight = weight;
+    td->total += weight;
+  }
+  td->n_centroids = n;
+  if(n) {
+    td->min = get_double((const uint8_t *)buf + 10);
+    td->max = get_double((const uint8_t *)buf + 18);
+    if(!(td->min <= td->c[0].mean) || !(td->max >= td->c[n-1].mean)) goto bad;
+  }
+  return td;
+ bad:
+  mtev_tdigest_destroy(td);
+  return NULL;
+}
+
+/* Blocked Bloom filter
+ *
+ * A "split block" layout: the key picks one 256bit block and sets one bit
+ * in each of its eight 32bit words, the bit chosen by multiplying the key
+ * by a per-word odd constant and keeping the top five bits.
+ */
+#define BLOOM_WORDS 8
+
+struct mtev_bloom {
+  uint64_t nblocks;
+  int flags;
+  uint32_t *words;
+};
+
+static const uint32_t bloom_salt[BLOOM_WORDS] CK_CC_ALIGN(32) = {
+  0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+  0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+static inline uint32_t *
+bloom_block(mtev_bloom_t *bf, uint64_t hash) {
+  return bf->words + ((hash >> 32) * bf->nblocks >> 32) * BLOOM_WORDS;
+}
+
+mtev_bloom_t *
+mtev_bloom_alloc(uint64_t items, double fpp, int flags) {
+  mtev_bloom_t *bf;
+  double bits;
+  void *mem;
+  if(items == 0 || !(fpp > 0 && fpp < 1)) return NULL;
+  /* k = 8 classic sizing, plus 20% for the variance blocking adds */
+  bits = -8.0 * (double)items / log(1.0 - pow(fpp, 1.0 / 8.0)) * 1.2;
+  if(bits / 256 > (double)UINT32_MAX) return NULL;
+  bf = calloc(1, sizeof(*bf));
+  bf->nblocks = (uint64_t)ceil(bits / 256);
+  if(bf->nblocks == 0) bf->nblocks = 1;
+  bf->flags = flags;
+  if(posix_memalign(&mem, 64, bf->nblocks * BLOOM_WORDS * sizeof(uint32_t))) {
+    free(bf);
+    return NULL;
+  }
+  memset(mem, 0, bf->nblocks * BLOOM_WORDS * sizeof(uint32_t));
+  bf->words = mem;
+  return bf;
+}
+
+void
+mtev_bloom_destroy(mtev_bloom_t *bf) {
+  if(!bf) return;
+  free(bf->words);
+  free(bf);
+}
+
+void
+mtev_bloom_add_hash(mtev_bloom_t *bf, uint64_t hash) {
+  uint32_t *block = bloom_block(bf, hash), key = (uint32_t)hash;
+  int i;
+  if(IS_CONCURRENT(bf)) {
+    for(i=0; i<BLOOM_WORDS; i++)
+      ck_pr_or_32(&block[i], 1U << ((key * bloom_salt[i]) >> 27));
+    return;
+  }
+  for(i=0; i<BLOOM_WORDS; i++) block[i] |= 1U << ((key * bloom_salt[i]) >> 27);
+}
+
+void
+mtev_bloom_add(mtev_bloom_t *bf, const void *key, size_t len) {
+  mtev_bloom_add_hash(bf, sketch_hash(key, len));
+}
+
+static mtev_boolean
+bloom_contains_scalar(const uint32_t *block, uint32_t key) {
+  uint32_t missing = 0;
+  int i;
+  for(i=0; i<BLOOM_WORDS; i++)
+    missing |= ~block[i] & (1U << ((key * bloom_salt[i]) >> 27));
+  return missing ? mtev_false : mtev_true;
+}
+
+#ifdef BLOOM_SIMD
+__attribute__((target("avx2")))
+static mtev_boolean
+bloom_contains_avx2(const uint32_t *block, uint32_t key) {
+  __m256i salt = _mm256_load_si256((const __m256i *)bloom_salt);
+  __m256i shift = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(key), salt), 27);
+  __m256i mask = _mm256_sllv_epi32(_mm256_set1_epi32(1), shift);
+  __m256i have = _mm256_load_si256((const __m256i *)block);
+  return _mm256_testc_si256(have, mask) ? mtev_true : mtev_false;
+}
+#endif
+
+typedef mtev_boolean (*bloom_contains_fn)(const uint32_t *, uint32_t);
+
+static bloom_contains_fn
+bloom_contains_impl(void) {
+  static volatile bloom_contains_fn impl = NULL;
+  if(impl == NULL) {
+#ifdef BLOOM_SIMD
+    impl = mtev_cpuid_feature(MTEV_CPU_FEATURE_AVX2) ? bloom_contains_avx2 : bloom_contains_scalar;
+#else
+    impl = bloom_contains_scalar;
+#endif
+  }
+  return impl;
+}
+
+mtev_boolean
+mtev_bloom_contains_hash(mtev_bloom_t *bf, uint64_t hash) {
+  return bloom_contains_impl()(bloom_block(bf, hash), (uint32_t)hash);
+}
+
+mtev_boolean
+mtev_bloom_contains(mtev_bloom_t *bf, const void *key, size_t len) {
+  return mtev_bloom_contains_hash(bf, sketch_hash(key, len));
+}
+
+int
+mtev_bloom_merge(mtev_bloom_t *tgt, mtev_bloom_t *src) {
+  uint64_t i, n;
+  if(tgt->nblocks != src->nblocks) return -1;
+  n = tgt->nblocks * BLOOM_WORDS;
+  if(IS_CONCURRENT(tgt)) {
+    for(i=0; i<n; i++) {
+      uint32_t v = ck_pr_load_32(&src->words[i]);
+      if(v) ck_pr_or_32(&tgt->words[i], v);
+    }
+    return 0;
+  }
+  for(i=0; i<n; i++) tgt->words[i] |= ck_pr_load_32(&src->words[i]);
+  return 0;
+}
+
+size_t
+mtev_bloom_serialized_size(mtev_bloom_t *bf) {
+  return 2 + 8 + bf->nblocks * BLOOM_WORDS * 4;
+}
+
+ssize_t
+mtev_bloom_serialize(mtev_bloom_t *bf, void *buf, size_t len) {
+  size_t need = mtev_bloom_serialized_size(bf);
+  uint64_t i, n = bf->nblocks * BLOOM_WORDS;
+  uint8_t *p = buf;
+  if(len < need) return -1;
+  *p++ = SKETCH_BLOOM;
+  *p++ = SKETCH_VERSION;
+  p = put_u64(p, bf->nblocks);
+  for(i=0; i<n; i++) p = put_u32(p, ck_pr_load_32(&bf->words[i]));
+  return need;
+}
+
+mtev_bloom_t *
+mtev_bloom_deserialize(const void *buf, size_t len, int flags) {
+  const uint8_t *p = buf;
+  mtev_bloom_t *bf;
+  uint64_t nblocks, i;
+  void *mem;
+  if(len < 10 || p[0] != SKETCH_BLOOM || p[1] != SKETCH_VERSION) return NULL;
+  nblocks = get_u64(p + 2);
+  if(nblocks == 0 || nblocks > UINT32_MAX ||
+     len - 10 != nblocks * BLOOM_WORDS * 4) return NULL;
+  if(posix_memalign(&mem, 64, nblocks * BLOOM_WORDS * sizeof(uint32_t)))
+    return NULL;
+  bf = calloc(1, sizeof(*bf));
+  bf->nblocks = nblocks;
+  bf->flags = flags;
+  bf->words = mem;
+  p += 10;
+  for(i=0; i<nblocks * BLOOM_WORDS; i++, p += 4) bf->words[i] = get_u32(p);
+  return bf;
+}
+
+/* Cuckoo filter
+ *
+ * Partial-key cuckoo hashing (Fan et al.): a key's 16bit fingerprint lives
+ * in bucket i1 or i2 = i1 ^ h(fingerprint), each bucket a single 64bit word
+ * of four fingerprints (0 is empty) probed with word-parallel arithmetic.
+ * When both buckets are full, resident fingerprints are kicked to their
+ * alternate bucket; a fingerprint that still has nowhere to go is kept as
+ * the "victim" and the filter reports full.
+ *
+ * Concurrent writers serialize on a spinlock and store whole bucket words.
+ * A plain insert or delete is a single store, but a kick chain briefly
+ * leaves a fingerprint out of the table, so it runs inside an odd
+ * version (a sequence lock) and readers that overlap one retry.
+ */
+#define CUCKOO_SLOTS 4
+#define CUCKOO_MAX_KICKS 500
+#define CUCKOO_LOAD 0.95
+#define CUCKOO_LANES 0x0001000100010001ULL
+#define CUCKOO_HIGHS 0x8000800080008000ULL
+
+struct mtev_cuckoo {
+  uint64_t nbuckets;
+  uint64_t mask;
+  uint64_t count;
+  int flags;
+  uint32_t version;
+  uint64_t rng;
+  /* (bucket << 16 | fingerprint) of the victim, or 0 */
+  uint64_t victim;
+  ck_spinlock_t lock;
+  uint64_t *buckets;
+};
+
+static inline uint16_t
+cuckoo_fp(uint64_t hash) {
+  uint16_t fp = (uint16_t)(hash >> 48);
+  return fp ? fp : 1;
+}
+static inline uint64_t
+cuckoo_alt(mtev_cuckoo_t *cf, uint64_t i, uint16_t fp) {
+  return (i ^ ((uint64_t)fp * 0x5bd1e995U)) & cf->mask;
+}
+static inline mtev_boolean
+bucket_has(uint64_t bucket, uint16_t fp) {
+  uint64_t x = bucket ^ (CUCKOO_LANES * fp);
+  return ((x - CUCKOO_LANES) & ~x & CUCKOO_HIGHS) ? mtev_true : mtev_false;
+}
+static inline uint16_t
+lane_get(uint64_t bucket, int lane) {
+  return (uint16_t)(bucket >> (lane * 16));
+}
+static inline uint64_t
+lane_set(uint64_t bucket, int lane, uint16_t fp) {
+  return (bucket & ~(0xffffULL << (lane * 16))) | ((uint64_t)fp << (lane * 16));
+}
+
+static mtev_boolean
+cuckoo_put(mtev_cuckoo_t *cf, uint64_t i, uint16_t fp) {
+  uint64_t b = cf->buckets[i];
+  int lane;
+  for(lane=0; lane<CUCKOO_SLOTS; lane++) {
+    if(lane_get(b, lane) == 0) {
+      ck_pr_store_64(&cf->buckets[i], lane_set(b, lane, fp));
+      return mtev_true;
+    }
+  }
+  return mtev_false;
+}
+
+static mtev_boolean
+cuckoo_remove(mtev_cuckoo_t *cf, uint64_t i, uint16_t fp) {
+  uint64_t b = cf->buckets[i];
+  int lane;
+  for(lane=0; lane<CUCKOO_SLOTS; lane++) {
+    if(lane_get(b, lane) == fp) {
+      ck_pr_store_64(&cf->buckets[i], lane_set(b, lane, 0));
+      return mtev_true;
+    }
+  }
+  return mtev_false;
+}
+
+static inline uint64_t
+cuckoo_rand(mtev_cuckoo_t *cf) {
+  cf->rng ^= cf->rng << 13;
+  cf->rng ^= cf->rng >> 7;
+  cf->rng ^= cf->rng << 17;
+  return cf->rng;
+}
+
+/* Walk fingerprints to their alternate buckets until one lands in a free
+ * slot; failing that, the last one evicted becomes the victim.  The caller
+ * holds the lock and has made the version odd. */
+static void
+cuckoo_kick(mtev_cuckoo_t *cf, uint64_t i, uint16_t fp) {
+  int n;
+  if(cuckoo_rand(cf) & 1) i = cuckoo_alt(cf, i, fp);
+  for(n=0; n<CUCKOO_MAX_KICKS; n++) {
+    int lane = cuckoo_rand(cf) % CUCKOO_SLOTS;
+    uint64_t b = cf->buckets[i];
+    uint16_t evicted = lane_get(b, lane);
+    ck_pr_store_64(&cf->buckets[i], lane_set(b, lane, fp));
+    fp = evicted;
+    i = cuckoo_alt(cf, i, fp);
+    if(cuckoo_put(cf, i, fp)) return;
+  }
+  ck_pr_store_64(&cf->victim, i << 16 | fp);
+}
+
+static inline void
+cuckoo_write_begin(mtev_cuckoo_t *cf) {
+  ck_pr_store_32(&cf->version, cf->version + 1);
+  ck_pr_fence_store();
+}
+static inline void
+cuckoo_write_end(mtev_cuckoo_t *cf) {
+  ck_pr_fence_store();
+  ck_pr_store_32(&cf->version, cf->version + 1);
+}
+
+/* caller holds the lock */
+static mtev_boolean
+cuckoo_insert(mtev_cuckoo_t *cf, uint64_t i, uint16_t fp) {
+  if(cf->victim) return mtev_false;
+  if(!cuckoo_put(cf, i, fp) && !cuckoo_put(cf, cuckoo_alt(cf, i, fp), fp)) {
+    cuckoo_write_begin(cf);
+    cuckoo_kick(cf, i, fp);
+    cuckoo_write_end(cf);
+  }
+  ck_pr_store_64(&cf->count, cf->count + 1);
+  return mtev_true;
+}
+
+mtev_cuckoo_t *
+mtev_cuckoo_alloc(uint64_t items, int flags) {
+  mtev_cuckoo_t *cf;
+  uint64_t n = 1, want;
+  if(items == 0 || items > (1ULL << 46)) return NULL;
+  want = (uint64_t)ceil((double)items / (CUCKOO_SLOTS * CUCKOO_LOAD));
+  while(n < want) n <<= 1;
+  cf = calloc(1, sizeof(*cf));
+  cf->nbuckets = n;
+  cf->mask = n - 1;
+  cf->flags = flags;
+  cf->rng = 0x2545f4914f6cdd1dULL;
+  ck_spinlock_init(&cf->lock);
+  cf->buckets = calloc(n, sizeof(*cf->buckets));
+  return cf;
+}
+
+void
+mtev_cuckoo_destroy(mtev_cuckoo_t *cf) {
+  if(!cf) return;
+  free(cf->buckets);
+  free(cf);
+}
+
+mtev_boolean
+mtev_cuckoo_add_hash(mtev_cuckoo_t *cf, uint64_t hash) {
+  mtev_boolean rv;
+  if(IS_CONCURRENT(cf)) ck_spinlock_lock(&cf->lock);
+  rv = cuckoo_insert(cf, hash & cf->mask, cuckoo_fp(hash));
+  if(IS_CONCURRENT(cf)) ck_spinlock_unlock(&cf->lock);
+  return rv;
+}
+
+mtev_boolean
+mtev_cuckoo_add(mtev_cuckoo_t *cf, const void *key, size_t len) {
+  return mtev_cuckoo_add_hash(cf, sketch_hash(key, len));
+}
+
+mtev_boolean
+mtev_cuckoo_contains_hash(mtev_cuckoo_t *cf, uint64_t hash) {
+  uint16_t fp = cuckoo_fp(hash);
+  uint64_t i1 = hash & cf->mask, i2 = cuckoo_alt(cf, i1, fp), victim;
+  uint32_t version;
+  mtev_boolean found;
+
+  do {
+    while((version = ck_pr_load_32(&cf->version)) & 1) ck_pr_stall();
+    ck_pr_fence_load();
+    found = bucket_has(ck_pr_load_64(&cf->buckets[i1]), fp) ||
+            bucket_has(ck_pr_load_64(&cf->buckets[i2]), fp);
+    if(!found && (victim = ck_pr_load_64(&cf->victim)) != 0) {
+      found = (uint16_t)victim == fp &&
+              ((victim >> 16) == i1 || (victim >> 16) == i2);
+    }
+    ck_pr_fence_load();
+  } while(!found && ck_pr_load_32(&cf->version) != version);
+  return found;
+}
+
+mtev_boolean
+mtev_cuckoo_contains(mtev_cuckoo_t *cf, const void *key, size_t len) {
+  return mtev_cuckoo_contains_hash(cf, sketch_hash(key, len));
+}
+
+mtev_boolean
+mtev_cuckoo_delete_hash(mtev_cuckoo_t *cf, uint64_t hash) {
+  uint16_t fp = cuckoo_fp(hash);
+  uint64_t i1 = hash & cf->mask, i2 = cuckoo_alt(cf, i1, fp);
+  mtev_boolean rv = mtev_true;
+
+  if(IS_CONCURRENT(cf)) ck_spinlock_lock(&cf->lock);
+  if(cf->victim && (uint16_t)cf->victim == fp &&
+     ((cf->victim >> 16) == i1 || (cf->victim >> 16) == i2)) {
+    ck_pr_store_64(&cf->victim, 0);
+  }
+  else if(!cuckoo_remove(cf, i1, fp) && !cuckoo_remove(cf, i2, fp)) {
+    rv = mtev_false;
+  }
+  if(rv) ck_pr_store_64(&cf->count, cf->count - 1);
+  if(rv && cf->victim) {
+    /* there's room now; try to bring the victim back into the table */
+    uint64_t vi = cf->victim >> 16;
+    uint16_t vfp = (uint16_t)cf->victim;
+    if(cuckoo_put(cf, vi, vfp) || cuckoo_put(cf, cuckoo_alt(cf, vi, vfp), vfp)) {
+      ck_pr_store_64(&cf->victim, 0);
+    }
+    else {
+      cuckoo_write_begin(cf);
+      ck_pr_store_64(&cf->victim, 0);
+      cuckoo_kick(cf, vi, vfp);
+      cuckoo_write_end(cf);
+    }
+  }
+  if(IS_CONCURRENT(cf)) ck_spinlock_unlock(&cf->lock);
+  return rv;
+}
+
+mtev_boolean
+mtev_cuckoo_delete(mtev_cuckoo_t *cf, const void *key, size_t len) {
+  return mtev_cuckoo_delete_hash(cf, sketch_hash(key, len));
+}
+
+uint64_t
+mtev_cuckoo_count(mtev_cuckoo_t *cf) {
+  return ck_pr_load_64(&cf->count);
+}
+
+int
+mtev_cuckoo_merge(mtev_cuckoo_t *tgt, mtev_cuckoo_t *src) {
+  uint64_t *snap, i, victim;
+  int lane, rv = 0;
+  if(tgt->nbuckets != src->nbuckets) return -1;
+  /* a snapshot lets a filter be merged with itself */
+  snap = malloc(src->nbuckets * sizeof(*snap));
+  if(IS_CONCURRENT(src)) ck_spinlock_lock(&src->lock);
+  memcpy(snap, src->buckets, src->nbuckets * sizeof(*snap));
+  victim = src->victim;
+  if(IS_CONCURRENT(src)) ck_spinlock_unlock(&src->lock);
+
+  if(IS_CONCURRENT(tgt)) ck_spinlock_lock(&tgt->lock);
+  for(i=0; i<tgt->nbuckets && rv == 0; i++) {
+    for(lane=0; lane<CUCKOO_SLOTS; lane++) {
+      uint16_t fp = lane_get(snap[i], lane);
+      if(fp && !cuckoo_insert(tgt, i, fp)) {
+        rv = -1;
+        break;
+      }
+    }
+  }
+  if(rv == 0 && victim && !cuckoo_insert(tgt, victim >> 16, (uint16_t)victim))
+    rv = -1;
+  if(IS_CONCURRENT(tgt)) ck_spinlock_unlock(&tgt->lock);
+  free(snap);
+  return rv;
+}
+
+size_t
+mtev_cuckoo_serialized_size(mtev_cuckoo_t *cf) {
+  return 2 + 8 + 8 + cf->nbuckets * 8;
+}
+
+ssize_t
+mtev_cuckoo_serialize(mtev_cuckoo_t *cf, void *buf, size_t len) {
+  size_t need = mtev_cuckoo_serialized_size(cf);
+  uint8_t *p = buf;
+  uint64_t i;
+  if(len < need) return -1;
+  if(IS_CONCURRENT(cf)) ck_spinlock_lock(&cf->lock);
+  *p++ = SKETCH_CUCKOO;
+  *p++ = SKETCH_VERSION;
+  p = put_u64(p, cf->nbuckets);
+  p = put_u64(p, cf->victim);
+  for(i=0; i<cf->nbuckets; i++) p = put_u64(p, cf->buckets[i]);
+  if(IS_CONCURRENT(cf)) ck_spinlock_unlock(&cf->lock);
+  return need;
+}
+
+mtev_cuckoo_t *
+mtev_cuckoo_deserialize(const void *buf, size_t len, int flags) {
+  const uint8_t *p = buf;
+  mtev_cuckoo_t *cf;
+  uint64_t nbuckets, i;
+  int lane;
+  if(len < 18 || p[0] != SKETCH_CUCKOO || p[1] != SKETCH_VERSION) return NULL;
+  nbuckets = get_u64(p + 2);
+  if(nbuckets == 0 || (nbuckets & (nbuckets - 1)) || nbuckets > (1ULL << 44) ||
+     (len - 18) / 8 != nbuckets || (len - 18) % 8) return NULL;
+  cf = mtev_cuckoo_alloc(1, flags);
+  free(cf->buckets);
+  cf->nbuckets = nbuckets;
+  cf->mask = nbuckets - 1;
+  cf->buckets = malloc(nbuckets * sizeof(*cf->buckets));
+  cf->victim = get_u64(p + 10);
+  if(cf->victim && ((uint16_t)cf->victim == 0 || (cf->victim >> 16) >= nbuckets)) {
+    mtev_cuckoo_destroy(cf);
+    return NULL;
+  }
+  cf->count = cf->victim ? 1 : 0;
+  p += 18;
+  for(i=0; i<nbuckets; i++, p += 8) {
+    cf->buckets[i] = get_u64(p);
+    for(lane=0; lane<CUCKOO_SLOTS; lane++)
+      if(lane_get(cf->buckets[i], lane)) cf->count++;
+  }
+  return cf;
+}
@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) 2017, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name Circonus, Inc. nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _UTILS_MTEV_SKETCH_H
+#define _UTILS_MTEV_SKETCH_H
+
+#include "mtev_defines.h"
+#include <sys/types.h>
+
+/* Streaming sketches: frequency (Count-Min), quantiles (t-digest) and
+ * set membership (blocked Bloom and cuckoo filters).
+ *
+ * Every sketch can be merged with another of the same shape and has a
+ * compact, portable serialization (a type byte, a version byte, then
+ * little-endian fields) suitable for shipping between nodes.  Keys are
+ * hashed with mtev_hash__hash64; the _hash variants take a precomputed
+ * 64bit hash instead.
+ *
+ * Sketches allocated with MTEV_SKETCH_CONCURRENT may be updated and read
+ * from any number of threads at once; otherwise the caller serializes
+ * access.  Merging into and serializing a concurrent sketch is safe while
+ * other threads update it, but the result reflects some point during the
+ * call.
+ */
+
+#define MTEV_SKETCH_CONCURRENT 0x1
+
+/* Count-Min sketch */
+typedef struct mtev_cms mtev_cms_t;
+
+/*! \fn mtev_cms_t *mtev_cms_alloc(uint32_t width, uint32_t depth, int flags)
+    \brief Allocate a Count-Min sketch.
+    \param width The number of counters per row (rounded up to a power of 2).
+    \param depth The number of rows (1 to 32).
+    \param flags 0 or MTEV_SKETCH_CONCURRENT.
+    \return A new sketch or NULL if the dimensions are invalid.
+ */
+API_EXPORT(mtev_cms_t *)
+  mtev_cms_alloc(uint32_t width, uint32_t depth, int flags);
+
+/*! \fn mtev_cms_t *mtev_cms_alloc_error(double epsilon, double delta, int flags)
+    \brief Allocate a Count-Min sketch sized for an error bound.
+    \param epsilon Estimates exceed true counts by at most epsilon * total...
+    \param delta ...except with probability delta.
+    \param flags 0 or MTEV_SKETCH_CONCURRENT.
+    \return A new sketch or NULL if the bounds are invalid.
+ */
+API_EXPORT(mtev_cms_t *)
+  mtev_cms_alloc_error(double epsilon, double delta, int flags);
+
+API_EXPORT(void) mtev_cms_destroy(mtev_cms_t *);
+
+/*! \fn uint32_t mtev_cms_add(mtev_cms_t *cms, const void *key, size_t len, uint32_t count)
+    \brief Count occurrences of a key.
+    \param cms The sketch.
+    \param key The key.
+    \param len The length of the key.
+    \param count The number of occurrences to add.
+    \return The key's estimated count after the update.
+
+    Updates are conservative: only the counters at the current minimum
+    are raised, which greatly reduces overestimation.  Counters saturate
+    rather than wrap.
+ */
+API_EXPORT(uint32_t)
+  mtev_cms_add(mtev_cms_t *, const void *key, size_t len, uint32_t count);
+API_EXPORT(uint32_t)
+  mtev_cms_add_hash(mtev_cms_t *, uint64_t hash, uint32_t count);
+
+/*! \fn uint32_t mtev_cms_estimate(mtev_cms_t *cms, const void *key, size_t len)
+    \brief Estimate the count of a key; never an underestimate.
+ */
+API_EXPORT(uint32_t)
+  mtev_cms_estimate(mtev_cms_t *, const void *key, size_t len);
+API_EXPORT(uint32_t)
+  mtev_cms_estimate_hash(mtev_cms_t *, uint64_t hash);
+
+/*! \fn uint64_t mtev_cms_total(mtev_cms_t *cms)
+    \brief Report the sum of all counts added.
+ */
+API_EXPORT(uint64_t) mtev_cms_total(mtev_cms_t *);
+
+/*! \fn int mtev_cms_merge(mtev_cms_t *tgt, mtev_cms_t *src)
+    \brief Add the counts of one sketch into another.
+    \return 0 on success, -1 if the sketches have different dimensions.
+ */
+API_EXPORT(int) mtev_cms_merge(mtev_cms_t *tgt, mtev_cms_t *src);
+
+API_EXPORT(size_t) mtev_cms_serialized_size(mtev_cms_t *);
+API_EXPORT(ssize_t) mtev_cms_serialize(mtev_cms_t *, void *buf, size_t len);
+API_EXPORT(mtev_cms_t *)
+  mtev_cms_deserialize(const void *buf, size_t len, int flags);
+
+/* t-digest quantile sketch */
+typedef struct mtev_tdigest mtev_tdigest_t;
+
+/*! \fn mtev_tdigest_t *mtev_tdigest_alloc(double compression, int flags)
+    \brief Allocate a merging t-digest.
+    \param compression Bounds the number of centroids kept (about
+           compression / 2 after compaction); 100 is a good default.  Values
+           are clamped to [20, 1000].
+    \param flags 0 or MTEV_SKETCH_CONCURRENT.
+    \return A new digest.
+
+    Accuracy is best at the tails: the relative rank error near q is
+    proportional to sqrt(q * (1 - q)) / compression.
+ */
+API_EXPORT(mtev_tdigest_t *)
+  mtev_tdigest_alloc(double compression, int flags);
+API_EXPORT(void) mtev_tdigest_destroy(mtev_tdigest_t *);
+
+/*! \fn void mtev_tdigest_add(mtev_tdigest_t *td, double value, double weight)
+    \brief Add a sample (NaN is ignored).
+ */
+API_EXPORT(void)
+  mtev_tdigest_add(mtev_tdigest_t *, double value, double weight);
+
+/*! \fn double mtev_tdigest_quantile(mtev_tdigest_t *td, double q)
+    \brief Estimate the value at quantile q (0 <= q <= 1).
+    \return The estimate, or NaN if the digest is empty.
+ */
+API_EXPORT(double) mtev_tdigest_quantile(mtev_tdigest_t *, double q);
+
+/*! \fn double mtev_tdigest_cdf(mtev_tdigest_t *td, double value)
+    \brief Estimate the fraction of samples less than or equal to value.
+    \return The estimate, or NaN if the digest is empty.
+ */
+API_EXPORT(double) mtev_tdigest_cdf(mtev_tdigest_t *, double value);
+
+/*! \fn double mtev_tdigest_count(mtev_tdigest_t *td)
+    \brief Report the total weight added.
+ */
+API_EXPORT(double) mtev_tdigest_count(mtev_tdigest_t *);
+
+/*! \fn int mtev_tdigest_merge(mtev_tdigest_t *tgt, mtev_tdigest_t *src)
+    \brief Fold the samples of one digest into another.
+    \return 0 (digests of any compression may be merged).
+ */
+API_EXPORT(int) mtev_tdigest_merge(mtev_tdigest_t *tgt, mtev_tdigest_t *src);
+
+API_EXPORT(size_t) mtev_tdigest_serialized_size(mtev_tdigest_t *);
+API_EXPORT(ssize_t)
+  mtev_tdigest_serialize(mtev_tdigest_t *, void *buf, size_t len);
+API_EXPORT(mtev_tdigest_t *)
+  mtev_tdigest_deserialize(const void *buf, size_t len, int flags);
+
+/* Blocked Bloom filter */
+typedef struct mtev_bloom mtev_bloom_t;
+
+/*! \fn mtev_bloom_t *mtev_bloom_alloc(uint64_t items, double fpp, int flags)
+    \brief Allocate a blocked Bloom filter.
+    \param items The number of distinct keys expected.
+    \param fpp The desired false positive probability at that many keys.
+    \param flags 0 or MTEV_SKETCH_CONCURRENT.
+    \return A new filter or NULL if the parameters are invalid.
+
+    Each key sets eight bits, one per 32bit word, within a single 32 byte
+    block, so an insertion or probe touches one cache line and is checked
+    with a single vector comparison where AVX2 is available.
+ */
+API_EXPORT(mtev_bloom_t *)
+  mtev_bloom_alloc(uint64_t items, double fpp, int flags);
+API_EXPORT(void) mtev_bloom_destroy(mtev_bloom_t *);
+API_EXPORT(void) mtev_bloom_add(mtev_bloom_t *, const void *key, size_t len);
+API_EXPORT(void) mtev_bloom_add_hash(mtev_bloom_t *, uint64_t hash);
+API_EXPORT(mtev_boolean)
+  mtev_bloom_contains(mtev_bloom_t *, const void *key, size_t len);
+API_EXPORT(mtev_boolean) mtev_bloom_contains_hash(mtev_bloom_t *, uint64_t hash);
+
+/*! \fn int mtev_bloom_merge(mtev_bloom_t *tgt, mtev_bloom_t *src)
+    \brief Union one filter into another.
+    \return 0 on success, -1 if the filters are not the same size.
+ */
+API_EXPORT(int) mtev_bloom_merge(mtev_bloom_t *tgt, mtev_bloom_t *src);
+
+API_EXPORT(size_t) mtev_bloom_serialized_size(mtev_bloom_t *);
+API_EXPORT(ssize_t) mtev_bloom_serialize(mtev_bloom_t *, void *buf, size_t len);
+API_EXPORT(mtev_bloom_t *)
+  mtev_bloom_deserialize(const void *buf, size_t len, int flags);
+
+/* Cuckoo filter */
+typedef struct mtev_cuckoo mtev_cuckoo_t;
+
+/*! \fn mtev_cuckoo_t *mtev_cuckoo_alloc(uint64_t items, int flags)
+    \brief Allocate a cuckoo filter.
+    \param items The number of keys it must hold.
+    \param flags 0 or MTEV_SKETCH_CONCURRENT.
+    \return A new filter or NULL if items is 0.
+
+    Keys are stored as 16bit fingerprints in buckets of four (a false
+    positive rate of about 0.012%) and, unlike a Bloom filter, can be
+    deleted.  The table is sized for a load of at most 95%.  Readers of a
+    concurrent filter never block; writers serialize on a spinlock.
+ */
+API_EXPORT(mtev_cuckoo_t *) mtev_cuckoo_alloc(uint64_t items, int flags);
+API_EXPORT(void) mtev_cuckoo_destroy(mtev_cuckoo_t *);
+
+/*! \fn mtev_boolean mtev_cuckoo_add(mtev_cuckoo_t *cf, const void *key, size_t len)
+    \brief Add a key.
+    \return mtev_false if the filter is full; the key was not added.
+
+    Adding a key twice stores it twice; each copy needs its own delete.
+ */
+API_EXPORT(mtev_boolean)
+  mtev_cuckoo_add(mtev_cuckoo_t *, const void *key, size_t len);
+API_EXPORT(mtev_boolean) mtev_cuckoo_add_hash(mtev_cuckoo_t *, uint64_t hash);
+API_EXPORT(mtev_boolean)
+  mtev_cuckoo_contains(mtev_cuckoo_t *, const void *key, size_t len);
+API_EXPORT(mtev_boolean)
+  mtev_cuckoo_contains_hash(mtev_cuckoo_t *, uint64_t hash);
+
+/*! \fn mtev_boolean mtev_cuckoo_delete(mtev_cuckoo_t *cf, const void *key, size_t len)
+    \brief Remove a key previously added.
+    \return mtev_true if a matching fingerprint was removed.
+
+    Deleting a key that was never added may remove another key that
+    shares its fingerprint.
+ */
+API_EXPORT(mtev_boolean)
+  mtev_cuckoo_delete(mtev_cuckoo_t *, const void *key, size_t len);
+API_EXPORT(mtev_boolean) mtev_cuckoo_delete_hash(mtev_cuckoo_t *, uint64_t hash);
+API_EXPORT(uint64_t) mtev_cuckoo_count(mtev_cuckoo_t *);
+
+/*! \fn int mtev_cuckoo_merge(mtev_cuckoo_t *tgt, mtev_cuckoo_t *src)
+    \brief Add every fingerprint of one filter to another.
+    \return 0 on success, -1 if the filters are not the same size or tgt
+            filled up (in which case it holds a partial merge).
+ */
+API_EXPORT(int) mtev_cuckoo_merge(mtev_cuckoo_t *tgt, mtev_cuckoo_t *src);
+
+API_EXPORT(size_t) mtev_cuckoo_serialized_size(mtev_cuckoo_t *);
+API_EXPORT(ssize_t)
+  mtev_cuckoo_serialize(mtev_cuckoo_t *, void *buf, size_t len);
+API_EXPORT(mtev_cuckoo_t *)
+  mtev_cuckoo_deserialize(const void *buf, size_t len, int flags);
+
+#endif
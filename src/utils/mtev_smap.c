@@ -0,0 +1,488 @@
+/*
+ * Copyright (c) 2017, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name Circonus, Inc. nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "mtev_smap.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Control bytes: the top bit set means the slot holds no entry. */
+#define CTRL_EMPTY   ((int8_t)-128) /* 0x80 */
+#define CTRL_DELETED ((int8_t)-2)   /* 0xfe */
+#define H1(h) ((h) >> 7)
+#define H2(h) ((int8_t)((h) & 0x7f))
+#define MIN_CAPACITY 16
+
+#if defined(__SSE2__)
+#define GROUP_WIDTH 16
+typedef uint32_t group_mask_t;
+static inline group_mask_t
+group_match(const int8_t *ctrl, int8_t h2) {
+  __m128i g = _mm_loadu_si128((const __m128i *)ctrl);
+  return (group_mask_t)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(h2)));
+}
+static inline group_mask_t
+group_match_empty(const int8_t *ctrl) {
+  return group_match(ctrl, CTRL_EMPTY);
+}
+static inline group_mask_t
+group_match_free(const int8_t *ctrl) {
+  /* empty and deleted both have the sign bit set */
+  __m128i g = _mm_loadu_si128((const __m128i *)ctrl);
+  return (group_mask_t)_mm_movemask_epi8(g);
+}
+#define MASK_FIRST(m) ((size_t)__builtin_ctz(m))
+#define MASK_LAST_GAP(m) ((size_t)__builtin_clz(m) - 16)
+#define MASK_NEXT(m) ((m) & ((m) - 1))
+#else
+/* Eight control bytes at a time in a word, SWAR style.  Matches are
+ * reported as the high bit of each matching byte. */
+#define GROUP_WIDTH 8
+typedef uint64_t group_mask_t;
+#define LSBS 0x0101010101010101ULL
+#define MSBS 0x8080808080808080ULL
+static inline uint64_t
+group_load(const int8_t *ctrl) {
+  uint64_t g;
+  memcpy(&g, ctrl, sizeof(g));
+  return g;
+}
+static inline group_mask_t
+group_match(const int8_t *ctrl, int8_t h2) {
+  uint64_t x = group_load(ctrl) ^ (LSBS * (uint8_t)h2);
+  /* may report a false positive on a byte following a match; the key
+   * comparison that always follows takes care of that */
+  return (x - LSBS) & ~x & MSBS;
+}
+static inline group_mask_t
+group_match_empty(const int8_t *ctrl) {
+  uint64_t g = group_load(ctrl);
+  /* 0x80 is the only control byte with the top bit set and bit 1 clear */
+  return g & ~(g << 6) & MSBS;
+}
+static inline group_mask_t
+group_match_free(const int8_t *ctrl) {
+  return group_load(ctrl) & MSBS;
+}
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define MASK_FIRST(m) ((size_t)__builtin_clzll(m) >> 3)
+#define MASK_LAST_GAP(m) ((size_t)__builtin_ctzll(m) >> 3)
+#define MASK_NEXT(m) ((m) & ~(0x8000000000000000ULL >> __builtin_clzll(m)))
+#else
+#define MASK_FIRST(m) ((size_t)__builtin_ctzll(m) >> 3)
+#define MASK_LAST_GAP(m) ((size_t)__builtin_clzll(m) >> 3)
+#define MASK_NEXT(m) ((m) & ((m) - 1))
+#endif
+#endif
+
+struct smap_slot {
+  uint64_t hash;
+  void *value;
+  union {
+    char inl[MTEV_SMAP_INLINE_KEY + 1];
+    char *ptr;
+  } key;
+  uint32_t klen;
+};
+
+struct mtev_smap {
+  int8_t *ctrl;             /* capacity + GROUP_WIDTH bytes */
+  struct smap_slot *slots;
+  size_t capacity;          /* a power of two */
+  size_t size;
+  size_t growth_left;
+};
+
+static uint64_t smap_seed;
+
+/* wyhash (final version 4), by Wang Yi; released into the public domain. */
+static const uint64_t wyp[4] = {
+  0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+  0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL
+};
+static inline uint64_t
+wy_r8(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+static inline uint64_t
+wy_r4(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+static inline uint64_t
+wy_r3(const uint8_t *p, size_t k) {
+  return (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) | p[k - 1];
+}
+static inline void
+wy_mum(uint64_t *a, uint64_t *b) {
+#if defined(__SIZEOF_INT128__)
+  __uint128_t r = *a;
+  r *= *b;
+  *a = (uint64_t)r;
+  *b = (uint64_t)(r >> 64);
+#else
+  uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+  uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64_t t = rl + (rm0 << 32), c = t < rl, lo, hi;
+  lo = t + (rm1 << 32);
+  c += lo < t;
+  hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+  *a = lo;
+  *b = hi;
+#endif
+}
+static inline uint64_t
+wy_mix(uint64_t a, uint64_t b) {
+  wy_mum(&a, &b);
+  return a ^ b;
+}
+static inline uint64_t
+wyhash(const void *key, size_t len, uint64_t seed) {
+  const uint8_t *p = key;
+  uint64_t a, b;
+
+  seed ^= wy_mix(seed ^ wyp[0], wyp[1]);
+  if(len <= 16) {
+    if(len >= 4) {
+      a = (wy_r4(p) << 32) | wy_r4(p + ((len >> 3) << 2));
+      b = (wy_r4(p + len - 4) << 32) | wy_r4(p + len - 4 - ((len >> 3) << 2));
+    }
+    else if(len > 0) {
+      a = wy_r3(p, len);
+      b = 0;
+    }
+    else a = b = 0;
+  }
+  else {
+    size_t i = len;
+    if(i > 48) {
+      uint64_t see1 = seed, see2 = seed;
+      do {
+        seed = wy_mix(wy_r8(p) ^ wyp[1], wy_r8(p + 8) ^ seed);
+        see1 = wy_mix(wy_r8(p + 16) ^ wyp[2], wy_r8(p + 24) ^ see1);
+        see2 = wy_mix(wy_r8(p + 32) ^ wyp[3], wy_r8(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while(i > 48);
+      seed ^= see1 ^ see2;
+    }
+    while(i > 16) {
+      seed = wy_mix(wy_r8(p) ^ wyp[1], wy_r8(p + 8) ^ seed);
+      i -= 16;
+      p += 16;
+    }
+    a = wy_r8(p + i - 16);
+    b = wy_r8(p + i - 8);
+  }
+  a ^= wyp[1];
+  b ^= seed;
+  wy_mum(&a, &b);
+  return wy_mix(a ^ wyp[0] ^ len, b ^ wyp[1]);
+}
+
+static void smap_seed_init(void) __attribute__((constructor));
+static void
+smap_seed_init(void) {
+  uint64_t seed = 0;
+  int fd = open("/dev/urandom", O_RDONLY);
+  if(fd >= 0) {
+    if(read(fd, &seed, sizeof(seed)) != sizeof(seed)) seed = 0;
+    close(fd);
+  }
+  if(seed == 0) seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32) ^ (uintptr_t)&seed;
+  smap_seed = seed;
+}
+
+uint64_t
+mtev_smap_hash(const void *key, size_t klen) {
+  return wyhash(key, klen, smap_seed);
+}
+
+static inline const char *
+slot_key(const struct smap_slot *s) {
+  return (s->klen <= MTEV_SMAP_INLINE_KEY) ? s->key.inl : s->key.ptr;
+}
+
+static inline void
+set_ctrl(mtev_smap_t *map, size_t i, int8_t c) {
+  map->ctrl[i] = c;
+  /* the first group is mirrored past the end so probes never wrap mid-group */
+  if(i < GROUP_WIDTH) map->ctrl[map->capacity + i] = c;
+}
+
+static size_t
+capacity_for(size_t n) {
+  size_t cap = MIN_CAPACITY;
+  while(cap - cap / 8 < n) cap <<= 1;
+  return cap;
+}
+
+static mtev_boolean
+smap_alloc(mtev_smap_t *map, size_t capacity) {
+  int8_t *ctrl = malloc(capacity + GROUP_WIDTH);
+  struct smap_slot *slots = malloc(capacity * sizeof(*slots));
+  if(!ctrl || !slots) {
+    free(ctrl);
+    free(slots);
+    return mtev_false;
+  }
+  memset(ctrl, CTRL_EMPTY, capacity + GROUP_WIDTH);
+  map->ctrl = ctrl;
+  map->slots = slots;
+  map->capacity = capacity;
+  map->size = 0;
+  map->growth_left = capacity - capacity / 8;
+  return mtev_true;
+}
+
+/* Probe for key; returns the slot index or (size_t)-1. */
+static inline size_t
+smap_find(const mtev_smap_t *map, const void *key, size_t klen, uint64_t hash) {
+  size_t mask = map->capacity - 1;
+  size_t pos = H1(hash) & mask, stride = 0;
+  int8_t h2 = H2(hash);
+
+  while(1) {
+    const int8_t *g = map->ctrl + pos;
+    group_mask_t m;
+    for(m = group_match(g, h2); m; m = MASK_NEXT(m)) {
+      size_t i = (pos + MASK_FIRST(m)) & mask;
+      const struct smap_slot *s = &map->slots[i];
+      if(s->hash == hash && s->klen == klen && !memcmp(slot_key(s), key, klen))
+        return i;
+    }
+    if(group_match_empty(g)) return (size_t)-1;
+    stride += GROUP_WIDTH;
+    pos = (pos + stride) & mask;
+  }
+}
+
+/* First empty or deleted slot on the probe path for hash. */
+static inline size_t
+smap_find_free(const mtev_smap_t *map, uint64_t hash) {
+  size_t mask = map->capacity - 1;
+  size_t pos = H1(hash) & mask, stride = 0;
+  while(1) {
+    group_mask_t m = group_match_free(map->ctrl + pos);
+    if(m) return (pos + MASK_FIRST(m)) & mask;
+    stride += GROUP_WIDTH;
+    pos = (pos + stride) & mask;
+  }
+}
+
+static mtev_boolean
+smap_resize(mtev_smap_t *map, size_t capacity) {
+  mtev_smap_t old = *map;
+  size_t i;
+
+  if(!smap_alloc(map, capacity)) {
+    *map = old;
+    return mtev_false;
+  }
+  for(i = 0; i < old.capacity; i++) {
+    size_t j;
+    if(old.ctrl[i] < 0) continue;
+    j = smap_find_free(map, old.slots[i].hash);
+    set_ctrl(map, j, H2(old.slots[i].hash));
+    map->slots[j] = old.slots[i];
+  }
+  map->size = old.size;
+  map->growth_left -= old.size;
+  free(old.ctrl);
+  free(old.slots);
+  return mtev_true;
+}
+
+mtev_smap_t *
+mtev_smap_create(size_t size_hint) {
+  mtev_smap_t *map = calloc(1, sizeof(*map));
+  if(!map) return NULL;
+  if(!smap_alloc(map, capacity_for(size_hint))) {
+    free(map);
+    return NULL;
+  }
+  return map;
+}
+
+static void
+smap_free_entries(mtev_smap_t *map, void (*valfree)(void *)) {
+  size_t i;
+  for(i = 0; i < map->capacity; i++) {
+    if(map->ctrl[i] < 0) continue;
+    if(map->slots[i].klen > MTEV_SMAP_INLINE_KEY) free(map->slots[i].key.ptr);
+    if(valfree) valfree(map->slots[i].value);
+  }
+}
+
+void
+mtev_smap_destroy(mtev_smap_t *map, void (*valfree)(void *)) {
+  if(!map) return;
+  smap_free_entries(map, valfree);
+  free(map->ctrl);
+  free(map->slots);
+  free(map);
+}
+
+void
+mtev_smap_clear(mtev_smap_t *map, void (*valfree)(void *)) {
+  smap_free_entries(map, valfree);
+  memset(map->ctrl, CTRL_EMPTY, map->capacity + GROUP_WIDTH);
+  map->size = 0;
+  map->growth_left = map->capacity - map->capacity / 8;
+}
+
+size_t
+mtev_smap_size(mtev_smap_t *map) {
+  return map->size;
+}
+
+mtev_boolean
+mtev_smap_retrieve_hashed(mtev_smap_t *map, const void *key, size_t klen,
+                          uint64_t hash, void **value) {
+  size_t i = smap_find(map, key, klen, hash);
+  if(i == (size_t)-1) return mtev_false;
+  if(value) *value = map->slots[i].value;
+  return mtev_true;
+}
+
+mtev_boolean
+mtev_smap_retrieve(mtev_smap_t *map, const void *key, size_t klen, void **value) {
+  return mtev_smap_retrieve_hashed(map, key, klen, mtev_smap_hash(key, klen), value);
+}
+
+static mtev_boolean
+smap_insert(mtev_smap_t *map, const void *key, size_t klen, uint64_t hash,
+            void *value, void **old, mtev_boolean replace) {
+  struct smap_slot *s;
+  size_t i = smap_find(map, key, klen, hash);
+  char *keycopy = NULL;
+
+  if(i != (size_t)-1) {
+    if(old) *old = map->slots[i].value;
+    if(replace) map->slots[i].value = value;
+    return mtev_false;
+  }
+  if(klen > MTEV_SMAP_INLINE_KEY) {
+    if((keycopy = malloc(klen + 1)) == NULL) return mtev_false;
+    memcpy(keycopy, key, klen);
+    keycopy[klen] = '\0';
+  }
+  i = smap_find_free(map, hash);
+  if(map->growth_left == 0 && map->ctrl[i] == CTRL_EMPTY) {
+    /* Full of entries and tombstones; if tombstones are most of it a
+     * same-size rehash clears them, otherwise grow. */
+    size_t cap = (map->size * 2 < map->capacity - map->capacity / 8) ?
+                 map->capacity : map->capacity * 2;
+    if(!smap_resize(map, cap)) {
+      free(keycopy);
+      return mtev_false;
+    }
+    i = smap_find_free(map, hash);
+  }
+  if(map->ctrl[i] == CTRL_EMPTY) map->growth_left--;
+  set_ctrl(map, i, H2(hash));
+  s = &map->slots[i];
+  s->hash = hash;
+  s->value = value;
+  s->klen = klen;
+  if(keycopy) s->key.ptr = keycopy;
+  else {
+    memcpy(s->key.inl, key, klen);
+    s->key.inl[klen] = '\0';
+  }
+  map->size++;
+  return mtev_true;
+}
+
+mtev_boolean
+mtev_smap_set_hashed(mtev_smap_t *map, const void *key, size_t klen,
+                     uint64_t hash, void *value, void **old) {
+  return smap_insert(map, key, klen, hash, value, old, mtev_true);
+}
+
+mtev_boolean
+mtev_smap_set(mtev_smap_t *map, const void *key, size_t klen, void *value, void **old) {
+  return smap_insert(map, key, klen, mtev_smap_hash(key, klen), value, old, mtev_true);
+}
+
+mtev_boolean
+mtev_smap_store(mtev_smap_t *map, const void *key, size_t klen, void *value) {
+  return smap_insert(map, key, klen, mtev_smap_hash(key, klen), value, NULL, mtev_false);
+}
+
+mtev_boolean
+mtev_smap_delete_hashed(mtev_smap_t *map, const void *key, size_t klen,
+                        uint64_t hash, void **old) {
+  size_t i = smap_find(map, key, klen, hash);
+  size_t mask = map->capacity - 1;
+  group_mask_t before, after;
+  if(i == (size_t)-1) return mtev_false;
+  if(old) *old = map->slots[i].value;
+  if(map->slots[i].klen > MTEV_SMAP_INLINE_KEY) free(map->slots[i].key.ptr);
+  /* If every group-sized window covering this slot also holds an empty
+   * slot, no probe can ever have continued past it, so it can go back to
+   * empty; otherwise it must become a tombstone. */
+  before = group_match_empty(map->ctrl + ((i - GROUP_WIDTH) & mask));
+  after = group_match_empty(map->ctrl + i);
+  if(before && after && MASK_FIRST(after) + MASK_LAST_GAP(before) < GROUP_WIDTH) {
+    set_ctrl(map, i, CTRL_EMPTY);
+    map->growth_left++;
+  }
+  else set_ctrl(map, i, CTRL_DELETED);
+  map->size--;
+  return mtev_true;
+}
+
+mtev_boolean
+mtev_smap_delete(mtev_smap_t *map, const void *key, size_t klen, void **old) {
+  return mtev_smap_delete_hashed(map, key, klen, mtev_smap_hash(key, klen), old);
+}
+
+mtev_boolean
+mtev_smap_next(mtev_smap_t *map, mtev_smap_iter_t *iter) {
+  while(iter->pos < map->capacity) {
+    size_t i = iter->pos++;
+    if(map->ctrl[i] < 0) continue;
+    iter->key = slot_key(&map->slots[i]);
+    iter->klen = map->slots[i].klen;
+    iter->value = map->slots[i].value;
+    return mtev_true;
+  }
+  return mtev_false;
+}
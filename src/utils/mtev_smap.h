@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2017, Circonus, Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *     * Neither the name Circonus, Inc. nor the names of its contributors
+ *       may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef MTEV_SMAP_H
+#define MTEV_SMAP_H
+
+#include <mtev_defines.h>
+
+/* An open-addressing map from byte-string keys to pointers.
+ *
+ * Slots are probed a group at a time against a parallel array of control
+ * bytes (one per slot, holding 7 bits of the key's hash), using SSE2
+ * where available.  Each slot caches the key's full 64-bit hash, and keys
+ * of up to MTEV_SMAP_INLINE_KEY bytes are stored in the slot itself, so a
+ * lookup touches one control group and usually one slot and never copies
+ * the key.  Keys are always copied into the map; callers keep ownership of
+ * what they pass in.
+ *
+ * Lookups can be given a hash precomputed with mtev_smap_hash, which is
+ * stable for the life of the process (and seeded randomly per process).
+ *
+ * A map is not thread-safe: concurrent readers are fine, but any writer
+ * needs exclusive access.
+ */
+typedef struct mtev_smap mtev_smap_t;
+
+#define MTEV_SMAP_INLINE_KEY 23
+
+typedef struct {
+  size_t pos;
+  const char *key;   /* NUL terminated */
+  size_t klen;
+  void *value;
+} mtev_smap_iter_t;
+
+#define MTEV_SMAP_ITER_ZERO { 0, NULL, 0, NULL }
+
+/*! \fn uint64_t mtev_smap_hash(const void *key, size_t klen)
+    \brief Hash a key the way mtev_smap does.
+    \param key the key bytes
+    \param klen the length of the key
+    \return a 64-bit hash for use with the `_hashed` functions
+ */
+API_EXPORT(uint64_t)
+  mtev_smap_hash(const void *key, size_t klen);
+
+/*! \fn mtev_smap_t *mtev_smap_create(size_t size_hint)
+    \brief Create a new map.
+    \param size_hint the number of entries to size for without growing
+    \return a new, empty map
+ */
+API_EXPORT(mtev_smap_t *)
+  mtev_smap_create(size_t size_hint);
+
+/*! \fn void mtev_smap_destroy(mtev_smap_t *map, void (*valfree)(void *))
+    \brief Free a map.
+    \param map the map, may be NULL
+    \param valfree if not NULL, called on every value
+ */
+API_EXPORT(void)
+  mtev_smap_destroy(mtev_smap_t *map, void (*valfree)(void *));
+
+/*! \fn void mtev_smap_clear(mtev_smap_t *map, void (*valfree)(void *))
+    \brief Remove every entry, keeping the map's capacity.
+    \param map the map
+    \param valfree if not NULL, called on every value
+ */
+API_EXPORT(void)
+  mtev_smap_clear(mtev_smap_t *map, void (*valfree)(void *));
+
+/*! \fn size_t mtev_smap_size(mtev_smap_t *map)
+    \brief Return the number of entries in a map.
+ */
+API_EXPORT(size_t)
+  mtev_smap_size(mtev_smap_t *map);
+
+/*! \fn mtev_boolean mtev_smap_retrieve(mtev_smap_t *map, const void *key, size_t klen, void **value)
+    \brief Look up a key.
+    \param map the map
+    \param key the key bytes
+    \param klen the length of the key
+    \param value if not NULL, set to the value found
+    \return mtev_true if the key is present
+ */
+API_EXPORT(mtev_boolean)
+  mtev_smap_retrieve(mtev_smap_t *map, const void *key, size_t klen,
+                     void **value);
+
+/*! \fn mtev_boolean mtev_smap_retrieve_hashed(mtev_smap_t *map, const void *key, size_t klen, uint64_t hash, void **value)
+    \brief Look up a key whose hash is already known.
+    \param hash the key's hash, from mtev_smap_hash
+    \return mtev_true if the key is present
+ */
+API_EXPORT(mtev_boolean)
+  mtev_smap_retrieve_hashed(mtev_smap_t *map, const void *key, size_t klen,
+                            uint64_t hash, void **value);
+
+/*! \fn mtev_boolean mtev_smap_set(mtev_smap_t *map, const void *key, size_t klen, void *value, void **old)
+    \brief Insert or replace an entry.
+    \param map the map
+    \param key the key bytes, copied into the map
+    \param klen the length of the key
+    \param value the value to store
+    \param old if not NULL and the key was present, set to the value replaced
+    \return mtev_true if the key was newly added, mtev_false if it was replaced
+ */
+API_EXPORT(mtev_boolean)
+  mtev_smap_set(mtev_smap_t *map, const void *key, size_t klen,
+                void *value, void **old);
+
+/*! \fn mtev_boolean mtev_smap_set_hashed(mtev_smap_t *map, const void *key, size_t klen, uint64_t hash, void *value, void **old)
+    \brief Insert or replace an entry whose key hash is already known.
+    \return mtev_true if the key was newly added, mtev_false if it was replaced
+ */
+API_EXPORT(mtev_boolean)
+  mtev_smap_set_hashed(mtev_smap_t *map, const void *key, size_t klen,
+                       uint64_t hash, void *value, void **old);
+
+/*! \fn mtev_boolean mtev_smap_store(mtev_smap_t *map, const void *key, size_t klen, void *value)
+    \brief Insert an entry if the key is not already present.
+    \return mtev_true if stored, mtev_false if the key was already present
+ */
+API_EXPORT(mtev_boolean)
+  mtev_smap_store(mtev_smap_t *map, const void *key, size_t klen, void *value);
+
+/*! \fn mtev_boolean mtev_smap_delete(mtev_smap_t *map, const void *key, size_t klen, void **old)
+    \brief Remove an entry.
+    \param old if not NULL and the key was present, set to its value
+    \return mtev_true if the key was present
+ */
+API_EXPORT(mtev_boolean)
+  mtev_smap_delete(mtev_smap_t *map, const void *key, size_t klen, void **old);
+
+/*! \fn mtev_boolean mtev_smap_delete_hashed(mtev_smap_t *map, const void *key, size_t klen, uint64_t hash, void **old)
+    \brief Remove an entry whose key hash is already known.
+    \return mtev_true if the key was present
+ */
+API_EXPORT(mtev_boolean)
+  mtev_smap_delete_hashed(mtev_smap_t *map, const void *key, size_t klen,
+                          uint64_t hash, void **old);
+
+/*! \fn mtev_boolean mtev_smap_next(mtev_smap_t *map, mtev_smap_iter_t *iter)
+    \brief Advance an iterator.
+    \param map the map
+    \param iter an iterator initialized with MTEV_SMAP_ITER_ZERO
+    \return mtev_true if iter now describes an entry, mtev_false at the end
+
+    The map must not be modified during iteration, except by deleting
+    the entry the iterator is on.
+ */
+API_EXPORT(mtev_boolean)
+  mtev_smap_next(mtev_smap_t *map, mtev_smap_iter_t *iter);
+
+#endif
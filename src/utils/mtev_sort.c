@@ -1,4 +1,7 @@
 #include <mtev_sort.h>
+#include "eventer/eventer.h"
+#include "mtev_sem.h"
+#include <ck_pr.h>
 
 #ifndef NULL
 #define NULL 0x0
@@ -73,3 +76,319 @@ void mtev_merge_sort(void **head_ptr_ptr,
   } while (num_merges > 1); 
   *head_ptr_ptr = head;
 }
+
+/*
+ * Array sorts
+ */
+
+static inline uint64_t
+double_to_key(uint64_t bits) {
+  return (bits & 0x8000000000000000ULL) ? ~bits : bits ^ 0x8000000000000000ULL;
+}
+static inline uint64_t
+key_to_double(uint64_t key) {
+  return (key & 0x8000000000000000ULL) ? key ^ 0x8000000000000000ULL : ~key;
+}
+/* A total order (NaNs included) matching mtev_sort_double. */
+static inline int
+double_less(double a, double b) {
+  uint64_t x, y;
+  memcpy(&x, &a, sizeof(x));
+  memcpy(&y, &b, sizeof(y));
+  return double_to_key(x) < double_to_key(y);
+}
+
+#define NUM_LESS(a, b) ((a) < (b))
+MTEV_SORT_DEFINE(sort_u64_, uint64_t, NUM_LESS)
+MTEV_SORT_DEFINE(sort_u32_, uint32_t, NUM_LESS)
+MTEV_SORT_DEFINE(sort_dbl_, double, double_less)
+
+/* Below this, a comparison sort beats the fixed cost of the passes. */
+#define RADIX_MIN 256
+
+/* LSD radix sort on 8bit digits.  All histograms come from one read of
+ * the input, and passes where every key shares the digit are skipped. */
+#define RADIX_SORT_IMPL(fname, type, bytes) \
+static int fname(type *a, size_t n) { \
+  size_t (*hist)[256], i, b, sum; \
+  type *src = a, *dst, *tmp; \
+  if(n < 2) return 1; \
+  tmp = malloc(n * sizeof(type)); \
+  hist = calloc(bytes, sizeof(*hist)); \
+  if(!tmp || !hist) { \
+    free(tmp); \
+    free(hist); \
+    return 0; \
+  } \
+  for(i = 0; i < n; i++) { \
+    type v = a[i]; \
+    for(b = 0; b < bytes; b++) hist[b][(v >> (b * 8)) & 0xff]++; \
+  } \
+  dst = tmp; \
+  for(b = 0; b < bytes; b++) { \
+    size_t *h = hist[b]; \
+    int shift = b * 8; \
+    if(h[(src[0] >> shift) & 0xff] == n) continue; \
+    for(sum = 0, i = 0; i < 256; i++) { \
+      size_t c = h[i]; \
+      h[i] = sum; \
+      sum += c; \
+    } \
+    for(i = 0; i < n; i++) { \
+      type v = src[i]; \
+      dst[h[(v >> shift) & 0xff]++] = v; \
+    } \
+    { type *t = src; src = dst; dst = t; } \
+  } \
+  if(src != a) memcpy(a, src, n * sizeof(type)); \
+  free(tmp); \
+  free(hist); \
+  return 1; \
+}
+
+RADIX_SORT_IMPL(radix_u32, uint32_t, 4)
+RADIX_SORT_IMPL(radix_u64, uint64_t, 8)
+
+void
+mtev_sort_uint32(uint32_t *a, size_t n) {
+  if(n < RADIX_MIN || !radix_u32(a, n)) sort_u32__sort(a, n);
+}
+
+void
+mtev_sort_uint64(uint64_t *a, size_t n) {
+  if(n < RADIX_MIN || !radix_u64(a, n)) sort_u64__sort(a, n);
+}
+
+void
+mtev_sort_int64(int64_t *a, size_t n) {
+  uint64_t *u = (uint64_t *)a;
+  size_t i;
+  /* flipping the sign bit makes two's complement order unsigned */
+  for(i = 0; i < n; i++) u[i] ^= 0x8000000000000000ULL;
+  mtev_sort_uint64(u, n);
+  for(i = 0; i < n; i++) u[i] ^= 0x8000000000000000ULL;
+}
+
+void
+mtev_sort_double(double *a, size_t n) {
+  uint64_t *u = (uint64_t *)a;
+  size_t i;
+  /* IEEE754 bits, with negatives inverted, order as unsigned integers */
+  for(i = 0; i < n; i++) u[i] = double_to_key(u[i]);
+  mtev_sort_uint64(u, n);
+  for(i = 0; i < n; i++) u[i] = key_to_double(u[i]);
+}
+
+void
+mtev_sort_fixed(void *base, size_t nmemb, size_t size,
+                size_t keyoff, size_t keylen) {
+  unsigned char *src = base, *dst, *tmp, *t;
+  size_t hist[256], i, k, sum;
+
+  if(nmemb < 2 || keylen == 0) return;
+  tmp = malloc(nmemb * size);
+  if(!tmp) {
+    /* fall back on a stable in-place insertion sort */
+    unsigned char *rec = alloca(size);
+    for(i = 1; i < nmemb; i++) {
+      size_t j = i;
+      memcpy(rec, src + i * size, size);
+      while(j > 0 && memcmp(src + (j - 1) * size + keyoff, rec + keyoff, keylen) > 0) {
+        memcpy(src + j * size, src + (j - 1) * size, size);
+        j--;
+      }
+      memcpy(src + j * size, rec, size);
+    }
+    return;
+  }
+  dst = tmp;
+  for(k = keylen; k-- > 0; ) {
+    memset(hist, 0, sizeof(hist));
+    for(i = 0; i < nmemb; i++) hist[src[i * size + keyoff + k]]++;
+    if(hist[src[keyoff + k]] == nmemb) continue;
+    for(sum = 0, i = 0; i < 256; i++) {
+      size_t c = hist[i];
+      hist[i] = sum;
+      sum += c;
+    }
+    for(i = 0; i < nmemb; i++) {
+      unsigned char *rec = src + i * size;
+      memcpy(dst + hist[rec[keyoff + k]]++ * size, rec, size);
+    }
+    t = src; src = dst; dst = t;
+  }
+  if(src != base) memcpy(base, src, nmemb * size);
+  free(tmp);
+}
+
+double
+mtev_sort_select_double(double *a, size_t n, size_t k) {
+  if(k >= n) return 0.0;
+  sort_dbl__select(a, n, k);
+  return a[k];
+}
+
+uint64_t
+mtev_sort_select_uint64(uint64_t *a, size_t n, size_t k) {
+  if(k >= n) return 0;
+  sort_u64__select(a, n, k);
+  return a[k];
+}
+
+/* Parallel execution: tasks are claimed from a shared counter by the
+ * caller and by helper events queued on the jobq.  The state is reference
+ * counted because helpers that start after the work is gone still look
+ * at it. */
+struct sort_parallel {
+  void (*task)(void *, int);
+  void *closure;
+  int ntasks;
+  int next;
+  int done;
+  uint32_t refcnt;
+  mtev_sem_t sem;
+};
+
+static void
+sort_parallel_deref(struct sort_parallel *sp) {
+  bool zero;
+  ck_pr_dec_32_zero(&sp->refcnt, &zero);
+  if(zero) {
+    mtev_sem_destroy(&sp->sem);
+    free(sp);
+  }
+}
+
+/* returns the number of tasks this thread completed */
+static int
+sort_parallel_work(struct sort_parallel *sp) {
+  int idx, cnt = 0;
+  while((idx = ck_pr_faa_int(&sp->next, 1)) < sp->ntasks) {
+    sp->task(sp->closure, idx);
+    ck_pr_inc_int(&sp->done);
+    cnt++;
+  }
+  return cnt;
+}
+
+static int
+sort_parallel_helper(eventer_t e, int mask, void *closure, struct timeval *now) {
+  struct sort_parallel *sp = closure;
+  int i, cnt;
+  if(mask == EVENTER_ASYNCH_WORK) {
+    cnt = sort_parallel_work(sp);
+    for(i = 0; i < cnt; i++) mtev_sem_post(&sp->sem);
+  }
+  if(mask == EVENTER_ASYNCH_CLEANUP) sort_parallel_deref(sp);
+  return 0;
+}
+
+int
+mtev_sort_parallel_parts(struct _eventer_jobq_t *jobq, size_t n) {
+  int parts = 1, max;
+  if(!jobq) return 1;
+  max = eventer_jobq_get_concurrency(jobq) + 1; /* the caller helps */
+  /* pieces smaller than this don't repay the merge */
+  while(parts * 2 <= max && parts < 64 && n / (parts * 2) >= 16384) parts *= 2;
+  return parts;
+}
+
+void
+mtev_sort_run_parallel(struct _eventer_jobq_t *jobq, int ntasks,
+                       void (*task)(void *closure, int idx), void *closure) {
+  struct sort_parallel *sp;
+  int i, helpers;
+
+  helpers = 0;
+  if(jobq) {
+    helpers = ntasks - 1;
+    if(helpers > (int)eventer_jobq_get_concurrency(jobq))
+      helpers = eventer_jobq_get_concurrency(jobq);
+  }
+  if(helpers <= 0 || (sp = calloc(1, sizeof(*sp))) == NULL) {
+    for(i = 0; i < ntasks; i++) task(closure, i);
+    return;
+  }
+  sp->task = task;
+  sp->closure = closure;
+  sp->ntasks = ntasks;
+  sp->refcnt = helpers + 1;
+  mtev_sem_init(&sp->sem, 0, 0);
+  for(i = 0; i < helpers; i++) {
+    eventer_t e = eventer_alloc();
+    e->mask = EVENTER_ASYNCH;
+    e->callback = sort_parallel_helper;
+    e->closure = sp;
+    eventer_add_asynch(jobq, e);
+  }
+  sort_parallel_work(sp);
+  while(ck_pr_load_int(&sp->done) < ntasks) mtev_sem_wait(&sp->sem);
+  sort_parallel_deref(sp);
+}
+
+struct generic_psort {
+  unsigned char *src, *dst;
+  size_t n, size;
+  int parts, width;
+  int (*compar)(const void *, const void *);
+};
+
+static inline size_t
+generic_psort_off(struct generic_psort *ps, int c) {
+  if(c > ps->parts) c = ps->parts;
+  return (size_t)((uint64_t)c * ps->n / ps->parts);
+}
+
+static void
+generic_psort_chunk(void *closure, int idx) {
+  struct generic_psort *ps = closure;
+  size_t lo = generic_psort_off(ps, idx), hi = generic_psort_off(ps, idx + 1);
+  qsort(ps->src + lo * ps->size, hi - lo, ps->size, ps->compar);
+}
+
+static void
+generic_psort_merge(void *closure, int idx) {
+  struct generic_psort *ps = closure;
+  size_t sz = ps->size,
+         l = generic_psort_off(ps, 2 * idx * ps->width),
+         m = generic_psort_off(ps, (2 * idx + 1) * ps->width),
+         r = generic_psort_off(ps, (2 * idx + 2) * ps->width),
+         i = l, j = m, o = l;
+  while(i < m && j < r) {
+    if(ps->compar(ps->src + j * sz, ps->src + i * sz) < 0)
+      memcpy(ps->dst + o++ * sz, ps->src + j++ * sz, sz);
+    else
+      memcpy(ps->dst + o++ * sz, ps->src + i++ * sz, sz);
+  }
+  if(i < m) memcpy(ps->dst + o * sz, ps->src + i * sz, (m - i) * sz);
+  if(j < r) memcpy(ps->dst + o * sz, ps->src + j * sz, (r - j) * sz);
+}
+
+void
+mtev_sort_parallel(void *base, size_t nmemb, size_t size,
+                   int (*compar)(const void *, const void *),
+                   struct _eventer_jobq_t *jobq, int parts) {
+  struct generic_psort ps;
+  unsigned char *tmp, *t;
+
+  if(parts <= 0) parts = mtev_sort_parallel_parts(jobq, nmemb);
+  while(parts & (parts - 1)) parts &= parts - 1;
+  if(parts < 2 || nmemb < (size_t)parts * 2 ||
+     (tmp = malloc(nmemb * size)) == NULL) {
+    qsort(base, nmemb, size, compar);
+    return;
+  }
+  ps.src = base;
+  ps.dst = tmp;
+  ps.n = nmemb;
+  ps.size = size;
+  ps.parts = parts;
+  ps.compar = compar;
+  mtev_sort_run_parallel(jobq, parts, generic_psort_chunk, &ps);
+  for(ps.width = 1; ps.width < parts; ps.width *= 2) {
+    mtev_sort_run_parallel(jobq, parts / (2 * ps.width), generic_psort_merge, &ps);
+    t = ps.src; ps.src = ps.dst; ps.dst = t;
+  }
+  if(ps.src != (unsigned char *)base) memcpy(base, ps.src, nmemb * size);
+  free(tmp);
+}
@@ -1,6 +1,12 @@
 #ifndef MTEV_SORT_H
 #define MTEV_SORT_H
 
+#include "mtev_defines.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
 /*! \file mtev_sort.h
  * 
  * Interface to call for a merge sort.
@@ -74,4 +80,359 @@ void mtev_merge_sort(void **head_ptr_ptr,
                             mtev_sort_next_function next,
                             mtev_sort_set_next_function set_next,
                             mtev_sort_compare_function compare);
+
+/* Array sorting.
+ *
+ * Integer and floating point arrays are best sorted with the radix sorts
+ * below, which make a fixed number of sequential passes regardless of
+ * input order.  For other element types, MTEV_SORT_DEFINE instantiates a
+ * pattern-defeating quicksort (and selection, partial sort and a parallel
+ * sort) specialized for one type, so comparisons are inlined rather than
+ * called through a function pointer.
+ */
+
+struct _eventer_jobq_t;
+
+/*! \fn void mtev_sort_uint32(uint32_t *a, size_t n)
+    \brief Radix sort an array of unsigned 32bit integers ascending.
+*/
+API_EXPORT(void) mtev_sort_uint32(uint32_t *a, size_t n);
+
+/*! \fn void mtev_sort_uint64(uint64_t *a, size_t n)
+    \brief Radix sort an array of unsigned 64bit integers ascending.
+*/
+API_EXPORT(void) mtev_sort_uint64(uint64_t *a, size_t n);
+
+/*! \fn void mtev_sort_int64(int64_t *a, size_t n)
+    \brief Radix sort an array of signed 64bit integers ascending.
+*/
+API_EXPORT(void) mtev_sort_int64(int64_t *a, size_t n);
+
+/*! \fn void mtev_sort_double(double *a, size_t n)
+    \brief Radix sort an array of doubles ascending.
+
+    -0.0 sorts before 0.0; NaNs sort to the end (or, with the sign bit
+    set, the beginning).
+*/
+API_EXPORT(void) mtev_sort_double(double *a, size_t n);
+
+/*! \fn void mtev_sort_fixed(void *base, size_t nmemb, size_t size, size_t keyoff, size_t keylen)
+    \brief Stable radix sort of fixed-size records by a fixed-width byte key.
+    \param base the records
+    \param nmemb the number of records
+    \param size the size of each record
+    \param keyoff the offset of the key within each record
+    \param keylen the length of the key, compared as with memcmp
+
+    Store integers big-endian in the key to sort them numerically.
+*/
+API_EXPORT(void) mtev_sort_fixed(void *base, size_t nmemb, size_t size,
+                                 size_t keyoff, size_t keylen);
+
+/*! \fn double mtev_sort_select_double(double *a, size_t n, size_t k)
+    \brief Partially reorder an array so a[k] holds its k-th smallest value.
+    \return a[k], with a[0..k) no larger and a(k..n) no smaller.
+*/
+API_EXPORT(double) mtev_sort_select_double(double *a, size_t n, size_t k);
+
+/*! \fn uint64_t mtev_sort_select_uint64(uint64_t *a, size_t n, size_t k)
+    \brief Partially reorder an array so a[k] holds its k-th smallest value.
+    \return a[k], with a[0..k) no larger and a(k..n) no smaller.
+*/
+API_EXPORT(uint64_t) mtev_sort_select_uint64(uint64_t *a, size_t n, size_t k);
+
+/*! \fn int mtev_sort_parallel_parts(struct _eventer_jobq_t *jobq, size_t n)
+    \brief Choose how many pieces to split a parallel sort of n items into.
+    \return a power of two no larger than the jobq's concurrency (1 if jobq is NULL)
+*/
+API_EXPORT(int) mtev_sort_parallel_parts(struct _eventer_jobq_t *jobq, size_t n);
+
+/*! \fn void mtev_sort_run_parallel(struct _eventer_jobq_t *jobq, int ntasks, void (*task)(void *closure, int idx), void *closure)
+    \brief Run task(closure, 0..ntasks-1) across a jobq and wait for all of them.
+    \param jobq the jobq to use, or NULL to run every task on the caller
+
+    The caller runs tasks too, so this completes even if the jobq is busy.
+*/
+API_EXPORT(void) mtev_sort_run_parallel(struct _eventer_jobq_t *jobq, int ntasks,
+                                        void (*task)(void *closure, int idx),
+                                        void *closure);
+
+/*! \fn void mtev_sort_parallel(void *base, size_t nmemb, size_t size, int (*compar)(const void *, const void *), struct _eventer_jobq_t *jobq, int parts)
+    \brief Sort an array with qsort semantics, splitting the work across a jobq.
+    \param parts the number of pieces (rounded down to a power of two), or 0 to
+           use mtev_sort_parallel_parts
+
+    Pieces are sorted concurrently and then merged pairwise, also
+    concurrently; the merges need nmemb * size bytes of scratch space.
+*/
+API_EXPORT(void) mtev_sort_parallel(void *base, size_t nmemb, size_t size,
+                                    int (*compar)(const void *, const void *),
+                                    struct _eventer_jobq_t *jobq, int parts);
+
+/*! \fn MTEV_SORT_DEFINE(name, type, less)
+    \brief Instantiate static array sorting functions for one element type.
+    \param name the prefix for the generated functions
+    \param type the element type
+    \param less a function or function-like macro, less(a, b), taking two
+           values of type and returning non-zero if a orders before b
+
+    Generates:
+
+     * `void name_sort(type *a, size_t n)`: unstable pdqsort.
+     * `void name_heapsort(type *a, size_t n)`
+     * `void name_select(type *a, size_t n, size_t k)`: reorders a so that
+       a[k] holds the k-th smallest element with no larger elements before
+       it and no smaller after it (nth_element).
+     * `void name_partial_sort(type *a, size_t n, size_t k)`: sorts the k
+       smallest elements into a[0..k); use a reversed `less` for top-K.
+     * `void name_sort_parallel(type *a, size_t n, eventer_jobq_t *jobq, int parts)`:
+       as mtev_sort_parallel.
+
+    ```
+    #define LESS_BY_SCORE(a, b) ((a).score < (b).score)
+    MTEV_SORT_DEFINE(results, struct result, LESS_BY_SCORE)
+    ...
+    results_sort(array, cnt);
+    ```
+*/
+#define MTEV_SORT_INSERTION_THRESHOLD 24
+#define MTEV_SORT_NINTHER_THRESHOLD 128
+
+#define MTEV_SORT_DEFINE(name, type, less) \
+static inline void name##_swap_(type *x, type *y) { \
+  type t = *x; *x = *y; *y = t; \
+} \
+static inline void name##_sort2_(type *x, type *y) { \
+  if(less(*y, *x)) name##_swap_(x, y); \
+} \
+static inline void name##_sort3_(type *x, type *y, type *z) { \
+  name##_sort2_(x, y); name##_sort2_(y, z); name##_sort2_(x, y); \
+} \
+static inline void name##_insertion_(type *begin, type *end, int guarded) { \
+  type *cur, *sift, *sift_1, tmp; \
+  if(begin == end) return; \
+  for(cur = begin + 1; cur != end; cur++) { \
+    sift = cur; sift_1 = cur - 1; \
+    if(less(*sift, *sift_1)) { \
+      tmp = *sift; \
+      do { *sift-- = *sift_1; } \
+      while((!guarded || sift != begin) && less(tmp, *--sift_1)); \
+      *sift = tmp; \
+    } \
+  } \
+} \
+static inline int name##_partial_insertion_(type *begin, type *end) { \
+  type *cur, *sift, *sift_1, tmp; \
+  size_t limit = 0; \
+  if(begin == end) return 1; \
+  for(cur = begin + 1; cur != end; cur++) { \
+    sift = cur; sift_1 = cur - 1; \
+    if(less(*sift, *sift_1)) { \
+      tmp = *sift; \
+      do { *sift-- = *sift_1; } \
+      while(sift != begin && less(tmp, *--sift_1)); \
+      *sift = tmp; \
+      limit += cur - sift; \
+    } \
+    if(limit > 8) return 0; \
+  } \
+  return 1; \
+} \
+static inline void name##_siftdown_(type *a, size_t i, size_t n) { \
+  type tmp = a[i]; \
+  size_t c; \
+  while((c = 2 * i + 1) < n) { \
+    if(c + 1 < n && less(a[c], a[c + 1])) c++; \
+    if(!less(tmp, a[c])) break; \
+    a[i] = a[c]; \
+    i = c; \
+  } \
+  a[i] = tmp; \
+} \
+static inline __attribute__((unused)) void name##_heapsort(type *a, size_t n) { \
+  size_t i; \
+  if(n < 2) return; \
+  for(i = n / 2; i-- > 0; ) name##_siftdown_(a, i, n); \
+  for(i = n - 1; i > 0; i--) { \
+    name##_swap_(&a[0], &a[i]); \
+    name##_siftdown_(a, 0, i); \
+  } \
+} \
+/* Partition around *begin; elements equal to the pivot go right. */ \
+static inline type *name##_partition_right_(type *begin, type *end, int *done) { \
+  type pivot = *begin, *first = begin, *last = end, *pivot_pos; \
+  while(less(*++first, pivot)); \
+  if(first - 1 == begin) while(first < last && !less(*--last, pivot)); \
+  else while(!less(*--last, pivot)); \
+  *done = first >= last; \
+  while(first < last) { \
+    name##_swap_(first, last); \
+    while(less(*++first, pivot)); \
+    while(!less(*--last, pivot)); \
+  } \
+  pivot_pos = first - 1; \
+  *begin = *pivot_pos; \
+  *pivot_pos = pivot; \
+  return pivot_pos; \
+} \
+/* Partition around *begin; elements equal to the pivot go left. */ \
+static inline type *name##_partition_left_(type *begin, type *end) { \
+  type pivot = *begin, *first = begin, *last = end, *pivot_pos; \
+  while(less(pivot, *--last)); \
+  if(last + 1 == end) while(first < last && !less(pivot, *++first)); \
+  else while(!less(pivot, *++first)); \
+  while(first < last) { \
+    name##_swap_(first, last); \
+    while(less(pivot, *--last)); \
+    while(!less(pivot, *++first)); \
+  } \
+  pivot_pos = last; \
+  *begin = *pivot_pos; \
+  *pivot_pos = pivot; \
+  return pivot_pos; \
+} \
+static inline void name##_choose_pivot_(type *begin, type *end) { \
+  size_t size = end - begin, s2 = size / 2; \
+  if(size > MTEV_SORT_NINTHER_THRESHOLD) { \
+    name##_sort3_(begin, begin + s2, end - 1); \
+    name##_sort3_(begin + 1, begin + (s2 - 1), end - 2); \
+    name##_sort3_(begin + 2, begin + (s2 + 1), end - 3); \
+    name##_sort3_(begin + (s2 - 1), begin + s2, begin + (s2 + 1)); \
+    name##_swap_(begin, begin + s2); \
+  } \
+  else name##_sort3_(begin + s2, begin, end - 1); \
+} \
+static void name##_pdqsort_(type *begin, type *end, int bad_allowed, int leftmost) { \
+  while(1) { \
+    size_t size = end - begin, l_size, r_size; \
+    type *pivot_pos; \
+    int already_partitioned; \
+    if(size < MTEV_SORT_INSERTION_THRESHOLD) { \
+      name##_insertion_(begin, end, leftmost); \
+      return; \
+    } \
+    name##_choose_pivot_(begin, end); \
+    if(!leftmost && !less(*(begin - 1), *begin)) { \
+      begin = name##_partition_left_(begin, end) + 1; \
+      continue; \
+    } \
+    pivot_pos = name##_partition_right_(begin, end, &already_partitioned); \
+    l_size = pivot_pos - begin; \
+    r_size = end - (pivot_pos + 1); \
+    if(l_size < size / 8 || r_size < size / 8) { \
+      if(--bad_allowed == 0) { \
+        name##_heapsort(begin, size); \
+        return; \
+      } \
+      /* break up patterns that defeat the pivot choice */ \
+      if(l_size >= MTEV_SORT_INSERTION_THRESHOLD) { \
+        name##_swap_(begin, begin + l_size / 4); \
+        name##_swap_(pivot_pos - 1, pivot_pos - l_size / 4); \
+        if(l_size > MTEV_SORT_NINTHER_THRESHOLD) { \
+          name##_swap_(begin + 1, begin + (l_size / 4 + 1)); \
+          name##_swap_(begin + 2, begin + (l_size / 4 + 2)); \
+          name##_swap_(pivot_pos - 2, pivot_pos - (l_size / 4 + 1)); \
+          name##_swap_(pivot_pos - 3, pivot_pos - (l_size / 4 + 2)); \
+        } \
+      } \
+      if(r_size >= MTEV_SORT_INSERTION_THRESHOLD) { \
+        name##_swap_(pivot_pos + 1, pivot_pos + (1 + r_size / 4)); \
+        name##_swap_(end - 1, end - r_size / 4); \
+        if(r_size > MTEV_SORT_NINTHER_THRESHOLD) { \
+          name##_swap_(pivot_pos + 2, pivot_pos + (2 + r_size / 4)); \
+          name##_swap_(pivot_pos + 3, pivot_pos + (3 + r_size / 4)); \
+          name##_swap_(end - 2, end - (1 + r_size / 4)); \
+          name##_swap_(end - 3, end - (2 + r_size / 4)); \
+        } \
+      } \
+    } \
+    else if(already_partitioned && \
+            name##_partial_insertion_(begin, pivot_pos) && \
+            name##_partial_insertion_(pivot_pos + 1, end)) { \
+      return; \
+    } \
+    name##_pdqsort_(begin, pivot_pos, bad_allowed, leftmost); \
+    begin = pivot_pos + 1; \
+    leftmost = 0; \
+  } \
+} \
+static inline __attribute__((unused)) void name##_sort(type *a, size_t n) { \
+  int log2n = 0; \
+  size_t m = n; \
+  while(m >>= 1) log2n++; \
+  if(n > 1) name##_pdqsort_(a, a + n, log2n + 1, 1); \
+} \
+static inline __attribute__((unused)) void name##_select(type *a, size_t n, size_t k) { \
+  type *lo = a, *hi = a + n, *p; \
+  int depth = 0, done; \
+  size_t m = n; \
+  if(k >= n) return; \
+  while(m >>= 1) depth += 2; \
+  while(hi - lo > MTEV_SORT_INSERTION_THRESHOLD) { \
+    if(depth-- == 0) { \
+      name##_heapsort(lo, hi - lo); \
+      return; \
+    } \
+    name##_choose_pivot_(lo, hi); \
+    p = name##_partition_right_(lo, hi, &done); \
+    if(p == a + k) return; \
+    if(a + k < p) hi = p; \
+    else lo = p + 1; \
+  } \
+  name##_insertion_(lo, hi, 1); \
+} \
+static inline __attribute__((unused)) void name##_partial_sort(type *a, size_t n, size_t k) { \
+  if(k == 0) return; \
+  if(k < n) name##_select(a, n, k - 1); \
+  else k = n; \
+  name##_sort(a, k); \
+} \
+struct name##_psort_ { \
+  type *src, *dst; \
+  size_t n; \
+  int parts, width; \
+}; \
+static inline size_t name##_psort_off_(struct name##_psort_ *ps, int c) { \
+  if(c > ps->parts) c = ps->parts; \
+  return (size_t)((uint64_t)c * ps->n / ps->parts); \
+} \
+static void name##_psort_chunk_(void *closure, int idx) { \
+  struct name##_psort_ *ps = closure; \
+  size_t lo = name##_psort_off_(ps, idx), hi = name##_psort_off_(ps, idx + 1); \
+  name##_sort(ps->src + lo, hi - lo); \
+} \
+static void name##_psort_merge_(void *closure, int idx) { \
+  struct name##_psort_ *ps = closure; \
+  size_t l = name##_psort_off_(ps, 2 * idx * ps->width), \
+         m = name##_psort_off_(ps, (2 * idx + 1) * ps->width), \
+         r = name##_psort_off_(ps, (2 * idx + 2) * ps->width), \
+         i = l, j = m, o = l; \
+  while(i < m && j < r) { \
+    if(less(ps->src[j], ps->src[i])) ps->dst[o++] = ps->src[j++]; \
+    else ps->dst[o++] = ps->src[i++]; \
+  } \
+  if(i < m) memcpy(ps->dst + o, ps->src + i, (m - i) * sizeof(type)); \
+  if(j < r) memcpy(ps->dst + o, ps->src + j, (r - j) * sizeof(type)); \
+} \
+static inline __attribute__((unused)) void \
+name##_sort_parallel(type *a, size_t n, struct _eventer_jobq_t *jobq, int parts) { \
+  struct name##_psort_ ps; \
+  type *tmp, *t; \
+  if(parts <= 0) parts = mtev_sort_parallel_parts(jobq, n); \
+  while(parts & (parts - 1)) parts &= parts - 1; \
+  if(parts < 2 || n < (size_t)parts * 2 || \
+     (tmp = malloc(n * sizeof(type))) == NULL) { \
+    name##_sort(a, n); \
+    return; \
+  } \
+  ps.src = a; ps.dst = tmp; ps.n = n; ps.parts = parts; \
+  mtev_sort_run_parallel(jobq, parts, name##_psort_chunk_, &ps); \
+  for(ps.width = 1; ps.width < parts; ps.width *= 2) { \
+    mtev_sort_run_parallel(jobq, parts / (2 * ps.width), name##_psort_merge_, &ps); \
+    t = ps.src; ps.src = ps.dst; ps.dst = t; \
+  } \
+  if(ps.src != a) memcpy(a, ps.src, n * sizeof(type)); \
+  free(tmp); \
+}
+
 #endif
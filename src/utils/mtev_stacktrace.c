@@ -40,6 +40,7 @@
 #include <sys/mman.h>
 #include <dirent.h>
 #include <execinfo.h>
+#include <dlfcn.h>
 #if defined(__sun__)
 #include <ucontext.h>
 #include <sys/lwp.h>
@@ -62,6 +63,47 @@ int mtev_simple_stack_print(uintptr_t pc, int sig, void *usrarg) {
 static int _global_stack_trace_fd = -1;
 #endif
 
+#if defined(__sun__)
+struct backtrace_walk {
+  void **callstack;
+  int frames;
+  int n;
+};
+static int
+mtev_backtrace_walker(uintptr_t pc, int sig, void *usrarg) {
+  struct backtrace_walk *w = usrarg;
+  if(w->n >= w->frames) return 1;
+  w->callstack[w->n++] = (void *)pc;
+  return 0;
+}
+#endif
+
+int mtev_backtrace(void **callstack, int frames) {
+#if defined(__sun__)
+  ucontext_t ucp;
+  struct backtrace_walk w = { callstack, frames, 0 };
+  getcontext(&ucp);
+  walkcontext(&ucp, mtev_backtrace_walker, &w);
+  return w.n;
+#else
+  return backtrace(callstack, frames);
+#endif
+}
+
+int mtev_stacktrace_symbolize(void *pc, char *buf, size_t len) {
+  Dl_info info;
+  const char *obj;
+  if(dladdr(pc, &info) == 0 || info.dli_fname == NULL)
+    return snprintf(buf, len, "%p", pc);
+  obj = strrchr(info.dli_fname, '/');
+  obj = obj ? obj + 1 : info.dli_fname;
+  if(info.dli_sname)
+    return snprintf(buf, len, "%s(%s+0x%lx)", obj, info.dli_sname,
+                    (unsigned long)((char *)pc - (char *)info.dli_saddr));
+  return snprintf(buf, len, "%s(+0x%lx)", obj,
+                  (unsigned long)((char *)pc - (char *)info.dli_fbase));
+}
+
 void mtev_stacktrace(mtev_log_stream_t ls) {
 #if defined(__sun__)
   ucontext_t ucp;
@@ -37,6 +37,25 @@
 API_EXPORT(void)
   mtev_stacktrace(mtev_log_stream_t ls);
 
+/*! \fn int mtev_backtrace(void **callstack, int frames)
+    \brief Capture the program counters of the calling thread's stack.
+    \param callstack an array to fill, innermost frame first
+    \param frames the size of callstack
+    \return the number of frames captured
+ */
+API_EXPORT(int)
+  mtev_backtrace(void **callstack, int frames);
+
+/*! \fn int mtev_stacktrace_symbolize(void *pc, char *buf, size_t len)
+    \brief Describe a program counter as `object(symbol+offset)`.
+    \param pc the program counter
+    \param buf a buffer for the description
+    \param len the size of buf
+    \return the length of the description
+ */
+API_EXPORT(int)
+  mtev_stacktrace_symbolize(void *pc, char *buf, size_t len);
+
 #if defined(__sun__)
 API_EXPORT(int)
   mtev_simple_stack_print(uintptr_t pc, int sig, void *usrarg);
@@ -1,10 +1,20 @@
 
 #include "mtev_uuid_parse.h"
+#include "mtev_cpuid.h"
+#include "mtev_time.h"
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define UUID_SIMD 1
+#include <immintrin.h>
+#endif
 
 static unsigned char lut[256] = {
   0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, // gap before first hex digit
@@ -20,7 +30,113 @@ static unsigned char lut[256] = {
 
 #define hexvalue(c) ((unsigned long)lut[(unsigned char)(c)])
 
+static int mtev_uuid_parse_scalar(const char *in, uuid_t uu);
+
+static volatile int uuid_simd = -1;
+
+static inline int
+uuid_use_simd(void) {
+  int level = uuid_simd;
+  if(level < 0) {
+    level = 0;
+#ifdef UUID_SIMD
+    if(mtev_cpuid_feature(MTEV_CPU_FEATURE_SSSE3)) level = 1;
+#endif
+    uuid_simd = level;
+  }
+  return level;
+}
+
+#ifdef UUID_SIMD
+/* Map 16 hex characters to nibbles; *ok is cleared on any non-digit. */
+__attribute__((target("ssse3")))
+static inline __m128i
+uuid_nibbles(__m128i in, int *ok) {
+  __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('0' - 1)),
+                                _mm_cmplt_epi8(in, _mm_set1_epi8('9' + 1)));
+  __m128i lc = _mm_or_si128(in, _mm_set1_epi8(0x20));
+  __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lc, _mm_set1_epi8('a' - 1)),
+                                _mm_cmplt_epi8(lc, _mm_set1_epi8('f' + 1)));
+  if(_mm_movemask_epi8(_mm_or_si128(digit, alpha)) != 0xffff) *ok = 0;
+  return _mm_or_si128(_mm_and_si128(digit, _mm_sub_epi8(in, _mm_set1_epi8('0'))),
+                      _mm_and_si128(alpha, _mm_sub_epi8(lc, _mm_set1_epi8('a' - 10))));
+}
+
+/* The caller guarantees 36 readable characters.  The 32 hex digits are
+ * gathered around the dashes with byte shuffles, then paired into bytes. */
+__attribute__((target("ssse3")))
+static int
+uuid_parse_ssse3(const char *in, uuid_t uu) {
+  __m128i v0 = _mm_loadu_si128((const __m128i *)in);
+  __m128i v1 = _mm_loadu_si128((const __m128i *)(in + 16));
+  __m128i v2 = _mm_loadu_si128((const __m128i *)(in + 20));
+  __m128i lo, hi;
+  int ok = 1;
+
+  if(in[8] != '-' || in[13] != '-' || in[18] != '-' || in[23] != '-') return -1;
+  lo = _mm_or_si128(
+    _mm_shuffle_epi8(v0, _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 9, 10, 11, 12,
+                                       14, 15, -1, -1)),
+    _mm_shuffle_epi8(v1, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+                                       -1, -1, -1, -1, -1, -1, 0, 1)));
+  hi = _mm_or_si128(
+    _mm_shuffle_epi8(v1, _mm_setr_epi8(3, 4, 5, 6, -1, -1, -1, -1,
+                                       -1, -1, -1, -1, -1, -1, -1, -1)),
+    _mm_shuffle_epi8(v2, _mm_setr_epi8(-1, -1, -1, -1, 4, 5, 6, 7,
+                                       8, 9, 10, 11, 12, 13, 14, 15)));
+  lo = uuid_nibbles(lo, &ok);
+  hi = uuid_nibbles(hi, &ok);
+  if(!ok) return -1;
+  lo = _mm_maddubs_epi16(lo, _mm_set1_epi16(0x0110));
+  hi = _mm_maddubs_epi16(hi, _mm_set1_epi16(0x0110));
+  _mm_storeu_si128((__m128i *)uu, _mm_packus_epi16(lo, hi));
+  return 0;
+}
+
+/* Spread 16 bytes into 32 hex digits, then open gaps for the dashes. */
+__attribute__((target("ssse3")))
+static void
+uuid_unparse_ssse3(const uuid_t uu, char *out, const char *digits) {
+  const __m128i lut = _mm_loadu_si128((const __m128i *)digits);
+  const __m128i nib = _mm_set1_epi8(0x0f);
+  __m128i in = _mm_loadu_si128((const __m128i *)uu);
+  __m128i h = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(in, 4), nib));
+  __m128i l = _mm_shuffle_epi8(lut, _mm_and_si128(in, nib));
+  __m128i a = _mm_unpacklo_epi8(h, l), b = _mm_unpackhi_epi8(h, l);
+  __m128i o0, o1;
+  uint32_t tail;
+
+  o0 = _mm_or_si128(
+    _mm_shuffle_epi8(a, _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, -1, 8, 9, 10, 11,
+                                      -1, 12, 13)),
+    _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, '-', 0, 0, 0, 0, '-', 0, 0));
+  o1 = _mm_or_si128(
+    _mm_or_si128(
+      _mm_shuffle_epi8(a, _mm_setr_epi8(14, 15, -1, -1, -1, -1, -1, -1,
+                                        -1, -1, -1, -1, -1, -1, -1, -1)),
+      _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, 0, 1, 2, 3, -1,
+                                        4, 5, 6, 7, 8, 9, 10, 11))),
+    _mm_setr_epi8(0, 0, '-', 0, 0, 0, 0, '-', 0, 0, 0, 0, 0, 0, 0, 0));
+  _mm_storeu_si128((__m128i *)out, o0);
+  _mm_storeu_si128((__m128i *)(out + 16), o1);
+  tail = _mm_cvtsi128_si32(_mm_srli_si128(b, 12));
+  memcpy(out + 32, &tail, 4);
+  out[36] = '\0';
+}
+#endif
+
 int mtev_uuid_parse(const char *in, uuid_t uu)
+{
+#ifdef UUID_SIMD
+  /* Malformed input is left to the scalar parser, which rejects it while
+   * filling uu as far as it got, as mtev_uuid_parse always has. */
+  if(uuid_use_simd() && strnlen(in, 37) == 36 && uuid_parse_ssse3(in, uu) == 0)
+    return 0;
+#endif
+  return mtev_uuid_parse_scalar(in, uu);
+}
+
+static int mtev_uuid_parse_scalar(const char *in, uuid_t uu)
 {
   const char *p;
   int len;
@@ -49,3 +165,219 @@ int mtev_uuid_parse(const char *in, uuid_t uu)
   if (*p != '\0') return -1;
   return 0;
 }
+
+static void
+uuid_format(const uuid_t uu, char *out, const char *digits) {
+  int i;
+#ifdef UUID_SIMD
+  if(uuid_use_simd()) {
+    uuid_unparse_ssse3(uu, out, digits);
+    return;
+  }
+#endif
+  for(i = 0; i < 16; i++) {
+    if(i == 4 || i == 6 || i == 8 || i == 10) *out++ = '-';
+    *out++ = digits[uu[i] >> 4];
+    *out++ = digits[uu[i] & 0xf];
+  }
+  *out = '\0';
+}
+
+void
+mtev_uuid_unparse_lower(const uuid_t uu, char *out) {
+  uuid_format(uu, out, "0123456789abcdef");
+}
+
+void
+mtev_uuid_unparse_upper(const uuid_t uu, char *out) {
+  uuid_format(uu, out, "0123456789ABCDEF");
+}
+
+/* UUID randomness comes from a per-thread ChaCha20 generator keyed from
+ * the kernel.  Each refill rekeys from its own output and handed-out bytes
+ * are wiped, so earlier UUIDs cannot be recovered from a thread's state.
+ * Generators reseed after UUID_RNG_RESEED bytes and in a forked child. */
+#define UUID_RNG_BLOCKS 8
+#define UUID_RNG_RESEED (1 << 20)
+
+struct uuid_rng {
+  uint32_t key[8];
+  uint64_t counter;
+  uint32_t fork_gen;
+  mtev_boolean seeded;
+  size_t avail;
+  size_t since_seed;
+  unsigned char buf[64 * UUID_RNG_BLOCKS];
+};
+
+static __thread struct uuid_rng uuid_rng;
+static volatile uint32_t uuid_fork_gen;
+static pthread_once_t uuid_atfork_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t uuid_urandom_lock = PTHREAD_MUTEX_INITIALIZER;
+static int uuid_urandom_fd = -1;
+
+static void uuid_atfork_child(void) { uuid_fork_gen++; }
+static void uuid_atfork_init(void) { pthread_atfork(NULL, NULL, uuid_atfork_child); }
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define QR(a, b, c, d) do { \
+  a += b; d ^= a; d = ROTL32(d, 16); \
+  c += d; b ^= c; b = ROTL32(b, 12); \
+  a += b; d ^= a; d = ROTL32(d, 8); \
+  c += d; b ^= c; b = ROTL32(b, 7); \
+} while(0)
+
+static void
+chacha20_block(const uint32_t key[8], uint64_t counter, unsigned char out[64]) {
+  uint32_t in[16] = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+                      key[0], key[1], key[2], key[3],
+                      key[4], key[5], key[6], key[7],
+                      (uint32_t)counter, (uint32_t)(counter >> 32), 0, 0 };
+  uint32_t x[16];
+  int i;
+
+  memcpy(x, in, sizeof(x));
+  for(i = 0; i < 10; i++) {
+    QR(x[0], x[4], x[8], x[12]);
+    QR(x[1], x[5], x[9], x[13]);
+    QR(x[2], x[6], x[10], x[14]);
+    QR(x[3], x[7], x[11], x[15]);
+    QR(x[0], x[5], x[10], x[15]);
+    QR(x[1], x[6], x[11], x[12]);
+    QR(x[2], x[7], x[8], x[13]);
+    QR(x[3], x[4], x[9], x[14]);
+  }
+  for(i = 0; i < 16; i++) {
+    uint32_t v = x[i] + in[i];
+    out[4*i] = v;
+    out[4*i+1] = v >> 8;
+    out[4*i+2] = v >> 16;
+    out[4*i+3] = v >> 24;
+  }
+}
+
+static void
+uuid_rng_seed(struct uuid_rng *r) {
+  size_t got = 0;
+
+  /* The descriptor stays open so seeding still works after a chroot. */
+  pthread_mutex_lock(&uuid_urandom_lock);
+  if(uuid_urandom_fd < 0) uuid_urandom_fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+  while(uuid_urandom_fd >= 0 && got < sizeof(r->key)) {
+    ssize_t rv = read(uuid_urandom_fd, (char *)r->key + got, sizeof(r->key) - got);
+    if(rv <= 0) break;
+    got += rv;
+  }
+  pthread_mutex_unlock(&uuid_urandom_lock);
+  if(got < sizeof(r->key)) {
+    /* libuuid has its own fallbacks when the kernel source is unavailable */
+    uuid_t a, b;
+    uuid_generate(a);
+    uuid_generate(b);
+    memcpy(r->key, a, sizeof(a));
+    memcpy((char *)r->key + sizeof(a), b, sizeof(b));
+  }
+  r->counter = 0;
+  r->avail = 0;
+  r->since_seed = 0;
+  r->fork_gen = uuid_fork_gen;
+  r->seeded = mtev_true;
+}
+
+static void
+uuid_rng_refill(struct uuid_rng *r) {
+  int i;
+  if(!r->seeded || r->fork_gen != uuid_fork_gen || r->since_seed >= UUID_RNG_RESEED) {
+    pthread_once(&uuid_atfork_once, uuid_atfork_init);
+    uuid_rng_seed(r);
+  }
+  for(i = 0; i < UUID_RNG_BLOCKS; i++) {
+    chacha20_block(r->key, r->counter++, r->buf + 64 * i);
+  }
+  /* the first 32 bytes become the next key and are never handed out */
+  memcpy(r->key, r->buf, sizeof(r->key));
+  memset(r->buf, 0, sizeof(r->key));
+  r->avail = sizeof(r->buf) - sizeof(r->key);
+  r->since_seed += r->avail;
+}
+
+static void
+uuid_rng_bytes(void *out, size_t len) {
+  struct uuid_rng *r = &uuid_rng;
+  unsigned char *dp = out;
+
+  if(r->fork_gen != uuid_fork_gen) r->avail = 0;
+  while(len > 0) {
+    size_t take;
+    unsigned char *src;
+    if(r->avail == 0) uuid_rng_refill(r);
+    take = len < r->avail ? len : r->avail;
+    src = r->buf + sizeof(r->buf) - r->avail;
+    memcpy(dp, src, take);
+    memset(src, 0, take);
+    r->avail -= take;
+    dp += take;
+    len -= take;
+  }
+}
+
+static inline void
+uuid_set_version(uuid_t uu, int version) {
+  uu[6] = (uu[6] & 0x0f) | (version << 4);
+  uu[8] = (uu[8] & 0x3f) | 0x80;
+}
+
+void
+mtev_uuid_generate(uuid_t uu) {
+  uuid_rng_bytes(uu, sizeof(uuid_t));
+  uuid_set_version(uu, 4);
+}
+
+void
+mtev_uuid_generate_bulk(uuid_t *uus, size_t n) {
+  size_t i;
+  uuid_rng_bytes(uus, n * sizeof(uuid_t));
+  for(i = 0; i < n; i++) uuid_set_version(uus[i], 4);
+}
+
+/* v7 keeps a per-thread 12-bit sequence in rand_a so UUIDs made by one
+ * thread within a millisecond stay ordered.  A fresh millisecond restarts
+ * the sequence at a random value below 2048, leaving room to count up;
+ * if it does run out, the timestamp is advanced by a millisecond. */
+static __thread uint64_t uuid_v7_last_ms;
+static __thread uint32_t uuid_v7_seq;
+
+void
+mtev_uuid_generate_v7(uuid_t uu) {
+  uint64_t ms = mtev_now_ms();
+  unsigned char rnd[10];
+
+  uuid_rng_bytes(rnd, sizeof(rnd));
+  if(ms > uuid_v7_last_ms) {
+    uuid_v7_last_ms = ms;
+    uuid_v7_seq = ((rnd[0] << 8) | rnd[1]) & 0x7ff;
+  }
+  else if(++uuid_v7_seq > 0xfff) {
+    /* the clock stood still (or stepped back); stay monotonic */
+    uuid_v7_last_ms++;
+    uuid_v7_seq = ((rnd[0] << 8) | rnd[1]) & 0x7ff;
+  }
+  ms = uuid_v7_last_ms;
+  uu[0] = ms >> 40;
+  uu[1] = ms >> 32;
+  uu[2] = ms >> 24;
+  uu[3] = ms >> 16;
+  uu[4] = ms >> 8;
+  uu[5] = ms;
+  uu[6] = 0x70 | (uuid_v7_seq >> 8);
+  uu[7] = uuid_v7_seq;
+  memcpy(uu + 8, rnd + 2, 8);
+  uu[8] = (uu[8] & 0x3f) | 0x80;
+}
+
+uint64_t
+mtev_uuid_v7_timestamp_ms(const uuid_t uu) {
+  return ((uint64_t)uu[0] << 40) | ((uint64_t)uu[1] << 32) |
+         ((uint64_t)uu[2] << 24) | ((uint64_t)uu[3] << 16) |
+         ((uint64_t)uu[4] << 8) | uu[5];
+}
@@ -40,4 +40,57 @@
 API_EXPORT(int)
   mtev_uuid_parse(const char *in, uuid_t uu);
 
+/*! \fn void mtev_uuid_unparse_lower(const uuid_t uu, char *out)
+    \brief Format a UUID as 36 lowercase characters.
+    \param uu the UUID
+    \param out a buffer of at least UUID_STR_LEN + 1 bytes, NUL terminated on return
+ */
+API_EXPORT(void)
+  mtev_uuid_unparse_lower(const uuid_t uu, char *out);
+
+/*! \fn void mtev_uuid_unparse_upper(const uuid_t uu, char *out)
+    \brief Format a UUID as 36 uppercase characters.
+    \param uu the UUID
+    \param out a buffer of at least UUID_STR_LEN + 1 bytes, NUL terminated on return
+ */
+API_EXPORT(void)
+  mtev_uuid_unparse_upper(const uuid_t uu, char *out);
+
+/*! \fn void mtev_uuid_generate(uuid_t uu)
+    \brief Generate a random (version 4) UUID.
+    \param uu receives the UUID
+
+    Randomness comes from a per-thread CSPRNG seeded from the kernel, so
+    no system call is made for most UUIDs.  It is reseeded in forked children.
+ */
+API_EXPORT(void)
+  mtev_uuid_generate(uuid_t uu);
+
+/*! \fn void mtev_uuid_generate_bulk(uuid_t *uus, size_t n)
+    \brief Generate a number of random (version 4) UUIDs at once.
+    \param uus an array receiving the UUIDs
+    \param n the number of UUIDs to generate
+ */
+API_EXPORT(void)
+  mtev_uuid_generate_bulk(uuid_t *uus, size_t n);
+
+/*! \fn void mtev_uuid_generate_v7(uuid_t uu)
+    \brief Generate a time-ordered (version 7) UUID.
+    \param uu receives the UUID
+
+    The leading 48 bits are milliseconds since the epoch, so UUIDs sort
+    (bytewise or as strings) in creation order, which keeps indexes keyed
+    by them append-mostly.  UUIDs from one thread are strictly increasing.
+ */
+API_EXPORT(void)
+  mtev_uuid_generate_v7(uuid_t uu);
+
+/*! \fn uint64_t mtev_uuid_v7_timestamp_ms(const uuid_t uu)
+    \brief Extract the creation time of a version 7 UUID.
+    \param uu the UUID
+    \return milliseconds since the epoch
+ */
+API_EXPORT(uint64_t)
+  mtev_uuid_v7_timestamp_ms(const uuid_t uu);
+
 #endif
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <mtev_defines.h>
+#include <mtev_memory.h>
+
+#define NTHREADS 4
+#define NOBJS 50000
+#define OBJSIZE 56
+
+static mtev_allocator_t slab;
+static void *objs[NTHREADS][NOBJS];
+
+static void *
+alloc_thread(void *vid) {
+  long id = (long)vid;
+  int i;
+  for(i = 0; i < NOBJS; i++) {
+    objs[id][i] = mtev_malloc(slab, OBJSIZE);
+    assert(objs[id][i]);
+    assert(((uintptr_t)objs[id][i] & 15) == 0);
+    memset(objs[id][i], (int)id, OBJSIZE);
+  }
+  return NULL;
+}
+
+/* free what a different thread allocated */
+static void *
+free_thread(void *vid) {
+  long id = (long)vid, owner = (id + 1) % NTHREADS;
+  int i;
+  for(i = 0; i < NOBJS; i++) {
+    unsigned char *cp = objs[owner][i];
+    assert(cp[0] == owner && cp[OBJSIZE-1] == owner);
+    mtev_free(slab, cp);
+  }
+  return NULL;
+}
+
+static void
+run(void *(*f)(void *)) {
+  pthread_t tids[NTHREADS];
+  long i;
+  for(i = 0; i < NTHREADS; i++) pthread_create(&tids[i], NULL, f, (void *)i);
+  for(i = 0; i < NTHREADS; i++) pthread_join(tids[i], NULL);
+}
+
+int main() {
+  int round, i;
+  void *keep[1000];
+  mtev_allocator_t sampled;
+  mtev_allocator_stats_t stats;
+  mtev_allocator_site_t sites[4];
+  mtev_allocator_options_t opts = mtev_allocator_options_create();
+  mtev_allocator_options_fixed_size(opts, OBJSIZE);
+  mtev_allocator_options_alignment(opts, 16);
+  mtev_allocator_options_backend(opts, MTEV_ALLOCATOR_SLAB);
+  mtev_allocator_options_magazine_size(opts, 16);
+  slab = mtev_allocator_create(opts);
+  mtev_allocator_options_free(opts);
+
+  assert(mtev_malloc(slab, OBJSIZE + 1) == NULL);
+  for(round = 0; round < 3; round++) {
+    run(alloc_thread);
+    run(free_thread);
+    assert(mtev_allocator_reap(slab) > 0);
+  }
+
+  /* frees happened on other threads; the merged counters must balance */
+  mtev_allocator_stats(slab, &stats);
+  assert(stats.allocs == 3 * NTHREADS * NOBJS);
+  assert(stats.frees == stats.allocs);
+  assert(stats.live_objects == 0 && stats.live_bytes == 0);
+
+  opts = mtev_allocator_options_create();
+  mtev_allocator_options_name(opts, "allocator_test_sampled");
+  mtev_allocator_options_sample_rate(opts, 10);
+  sampled = mtev_allocator_create(opts);
+  mtev_allocator_options_free(opts);
+  assert(mtev_allocator_find("allocator_test_sampled") == sampled);
+  for(i = 0; i < 1000; i++) keep[i] = mtev_malloc(sampled, 100);
+  for(i = 0; i < 500; i++) mtev_free(sampled, keep[i]);
+  mtev_allocator_stats(sampled, &stats);
+  assert(stats.live_objects == 500);
+  assert(stats.samples > 0);
+  assert(mtev_allocator_sites(sampled, sites, 4) >= 1);
+  assert(sites[0].samples > 0 && sites[0].nframes > 0);
+  printf("ok\n");
+  return 0;
+}
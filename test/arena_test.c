@@ -0,0 +1,35 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <mtev_defines.h>
+#include <mtev_arena.h>
+
+int main() {
+  int round, i;
+  size_t allocs = 0;
+  mtev_arena_t *arena = mtev_arena_create(256);
+
+  for(round = 0; round < 4; round++) {
+    char expected[32], *big;
+    for(i = 0; i < 2000; i++) {
+      char *s = mtev_arena_sprintf(arena, "key%d=%s", i, "value");
+      snprintf(expected, sizeof(expected), "key%d=value", i);
+      assert(s && !strcmp(s, expected));
+      assert(((uintptr_t)s & (sizeof(void *) - 1)) == 0);
+    }
+    big = mtev_arena_calloc(arena, 1, 65536);
+    assert(big && big[0] == 0 && big[65535] == 0);
+    assert(!strcmp(mtev_arena_strndup(arena, "abcdef", 3), "abc"));
+    assert(mtev_arena_used(arena) > 65536);
+    mtev_arena_reset(arena);
+    assert(mtev_arena_used(arena) == 0);
+    /* after the first round the arena should be sized to fit */
+    if(round > 1) assert(mtev_arena_chunk_allocs(arena) == allocs);
+    allocs = mtev_arena_chunk_allocs(arena);
+  }
+  assert(mtev_arena_high_water(arena) > 65536);
+  mtev_arena_destroy(arena);
+  printf("ok\n");
+  return 0;
+}
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <mtev_defines.h>
+#include <mtev_btrie.h>
+#include <mtev_memory.h>
+#include <mtev_time.h>
+#include <ck_pr.h>
+
+#define NROUTES4 900000
+#define NROUTES6 100000
+#define NPROBES 1000000
+#define NLOOKUPS 2000000
+
+static uint64_t rstate = 0x9e3779b97f4a7c15ULL;
+static uint32_t rnd32(void) {
+  rstate ^= rstate << 13;
+  rstate ^= rstate >> 7;
+  rstate ^= rstate << 17;
+  return (uint32_t)(rstate >> 16);
+}
+
+/* Roughly the shape of a full BGP table: mostly /24, a long tail up to /8. */
+static unsigned char rnd_plen4(void) {
+  uint32_t r = rnd32() % 1000;
+  if(r < 600) return 24;
+  if(r < 900) return 16 + rnd32() % 8;
+  if(r < 990) return 8 + rnd32() % 8;
+  return 25 + rnd32() % 8;
+}
+
+static void check4(btrie *tree, mtev_btrie_compiled_t *c, uint32_t addr) {
+  struct in_addr a;
+  unsigned char pl1 = 0xff, pl2 = 0xff;
+  void *d1, *d2;
+  a.s_addr = htonl(addr);
+  d1 = mtev_find_bpm_route_ipv4(tree, &a, &pl1);
+  d2 = mtev_btrie_compiled_find_ipv4(c, &a, &pl2);
+  assert(d1 == d2);
+  if(d1) assert(pl1 == pl2);
+}
+
+static void check6(btrie *tree, mtev_btrie_compiled_t *c, struct in6_addr *a) {
+  unsigned char pl1 = 0xff, pl2 = 0xff;
+  void *d1, *d2;
+  d1 = mtev_find_bpm_route_ipv6(tree, a, &pl1);
+  d2 = mtev_btrie_compiled_find_ipv6(c, a, &pl2);
+  assert(d1 == d2);
+  if(d1) assert(pl1 == pl2);
+}
+
+static void test_small(void) {
+  btrie tree = NULL;
+  mtev_btrie_compiled_t *c;
+  struct in_addr a;
+  unsigned char pl;
+  const char *routes[] = { "0.0.0.0", "10.0.0.0", "192.168.0.0",
+                           "199.15.220.0", "199.15.221.0", "199.15.222.0" };
+  unsigned char plens[] = { 0, 8, 16, 22, 24, 23 };
+  int i;
+
+  for(i=0; i<6; i++) {
+    inet_pton(AF_INET, routes[i], &a);
+    mtev_add_route_ipv4(&tree, &a, plens[i], (void *)(uintptr_t)(i + 1));
+  }
+  c = mtev_btrie_compile_ipv4(&tree);
+  inet_pton(AF_INET, "1.2.3.4", &a);
+  assert(mtev_btrie_compiled_find_ipv4(c, &a, &pl) == (void *)1 && pl == 0);
+  inet_pton(AF_INET, "199.15.221.1", &a);
+  assert(mtev_btrie_compiled_find_ipv4(c, &a, &pl) == (void *)5 && pl == 24);
+  inet_pton(AF_INET, "199.15.223.1", &a);
+  assert(mtev_btrie_compiled_find_ipv4(c, &a, &pl) == (void *)6 && pl == 23);
+  inet_pton(AF_INET, "199.15.220.1", &a);
+  assert(mtev_btrie_compiled_find_ipv4(c, &a, &pl) == (void *)4 && pl == 22);
+  /* an IPv4 table never answers IPv6 lookups */
+  assert(mtev_btrie_compiled_find_ipv6(c, &(struct in6_addr){{{0}}}, NULL) == NULL);
+  mtev_btrie_compiled_free(c);
+
+  inet_pton(AF_INET, "0.0.0.0", &a);
+  assert(mtev_del_route_ipv4(&tree, &a, 0, NULL));
+  c = mtev_btrie_compile_ipv4(&tree);
+  inet_pton(AF_INET, "1.2.3.4", &a);
+  assert(mtev_btrie_compiled_find_ipv4(c, &a, NULL) == NULL);
+  mtev_btrie_compiled_free(c);
+  mtev_drop_tree(&tree, NULL);
+}
+
+static void test_ipv4(void) {
+  btrie tree = NULL;
+  mtev_btrie_compiled_t *c, *slot = NULL;
+  uint32_t *addrs, i, sum = 0;
+  unsigned char *plens;
+  struct in_addr a;
+  mtev_hrtime_t start, elapsed;
+
+  addrs = malloc(NROUTES4 * sizeof(*addrs));
+  plens = malloc(NROUTES4);
+  for(i=0; i<NROUTES4; i++) {
+    addrs[i] = rnd32();
+    plens[i] = rnd_plen4();
+    a.s_addr = htonl(addrs[i]);
+    mtev_add_route_ipv4(&tree, &a, plens[i], (void *)(uintptr_t)(i + 1));
+  }
+  start = mtev_gethrtime();
+  c = mtev_btrie_compile_ipv4(&tree);
+  elapsed = mtev_gethrtime() - start;
+  printf("ipv4: %d routes compiled in %.1fms, %zu bytes\n", NROUTES4,
+         (double)elapsed / 1000000.0, mtev_btrie_compiled_size(c));
+
+  for(i=0; i<NROUTES4; i++) {
+    check4(&tree, c, addrs[i]);
+    check4(&tree, c, addrs[i] ^ (1U << (rnd32() % 32)));
+  }
+  for(i=0; i<NPROBES; i++) check4(&tree, c, rnd32());
+  mtev_btrie_compiled_swap(&slot, c);
+
+  /* remove a tenth of the routes, republish and re-verify */
+  for(i=0; i<NROUTES4; i += 10) {
+    a.s_addr = htonl(addrs[i]);
+    mtev_del_route_ipv4(&tree, &a, plens[i], NULL);
+  }
+  c = mtev_btrie_compile_ipv4(&tree);
+  mtev_btrie_compiled_swap(&slot, c);
+  mtev_memory_begin();
+  c = ck_pr_load_ptr(&slot);
+  for(i=0; i<NROUTES4; i++) check4(&tree, c, addrs[i]);
+  for(i=0; i<NPROBES; i++) check4(&tree, c, rnd32());
+  mtev_memory_end();
+
+  for(i=0; i<NPROBES; i++) addrs[i % NROUTES4] = rnd32();
+  start = mtev_gethrtime();
+  for(i=0; i<NLOOKUPS; i++) {
+    a.s_addr = addrs[i % NROUTES4];
+    sum += (uintptr_t)mtev_find_bpm_route_ipv4(&tree, &a, NULL);
+  }
+  elapsed = mtev_gethrtime() - start;
+  printf("ipv4: btrie    %.1f ns/lookup\n", (double)elapsed / NLOOKUPS);
+  start = mtev_gethrtime();
+  for(i=0; i<NLOOKUPS; i++) {
+    a.s_addr = addrs[i % NROUTES4];
+    sum -= (uintptr_t)mtev_btrie_compiled_find_ipv4(c, &a, NULL);
+  }
+  elapsed = mtev_gethrtime() - start;
+  printf("ipv4: compiled %.1f ns/lookup\n", (double)elapsed / NLOOKUPS);
+  assert(sum == 0);
+  /* a working set that fits in cache, as with a busy set of peers */
+  start = mtev_gethrtime();
+  for(i=0; i<NLOOKUPS * 10; i++) {
+    a.s_addr = addrs[i % 4096];
+    sum += (uintptr_t)mtev_btrie_compiled_find_ipv4(c, &a, NULL);
+  }
+  elapsed = mtev_gethrtime() - start;
+  printf("ipv4: compiled %.1f ns/lookup (4096 hot addresses)\n",
+         (double)elapsed / (NLOOKUPS * 10));
+
+  mtev_btrie_compiled_swap(&slot, NULL);
+  mtev_drop_tree(&tree, NULL);
+  free(addrs);
+  free(plens);
+}
+
+static void rnd_addr6(struct in6_addr *a) {
+  uint32_t w[4];
+  int i;
+  /* cluster in a few /16s so that routes actually nest */
+  w[0] = htonl(0x20010000 | (rnd32() % 8));
+  for(i=1; i<4; i++) w[i] = rnd32();
+  memcpy(a->s6_addr, w, sizeof(w));
+}
+
+static void test_ipv6(void) {
+  btrie tree = NULL;
+  mtev_btrie_compiled_t *c;
+  struct in6_addr *addrs, a;
+  unsigned char pl;
+  uint32_t i;
+
+  addrs = malloc(NROUTES6 * sizeof(*addrs));
+  for(i=0; i<NROUTES6; i++) {
+    rnd_addr6(&addrs[i]);
+    pl = (i % 10 == 0) ? 1 + rnd32() % 128 : 32 + rnd32() % 33;
+    mtev_add_route_ipv6(&tree, &addrs[i], pl, (void *)(uintptr_t)(i + 1));
+  }
+  c = mtev_btrie_compile_ipv6(&tree);
+  printf("ipv6: %d routes compiled, %zu bytes\n", NROUTES6,
+         mtev_btrie_compiled_size(c));
+  for(i=0; i<NROUTES6; i++) check6(&tree, c, &addrs[i]);
+  for(i=0; i<NPROBES; i++) {
+    rnd_addr6(&a);
+    check6(&tree, c, &a);
+  }
+  mtev_btrie_compiled_free(c);
+  mtev_drop_tree(&tree, NULL);
+  free(addrs);
+}
+
+int main(int argc, char **argv) {
+  mtev_memory_init();
+  test_small();
+  test_ipv4();
+  test_ipv6();
+  return 0;
+}
@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <pthread.h>
+#include <mtev_defines.h>
+#include <mtev_bufpool.h>
+
+#define NBUFS 500
+
+static mtev_bufpool_t *pool;
+static void *bufs[NBUFS];
+
+static void *
+free_elsewhere(void *unused) {
+  int i;
+  for(i = 0; i < NBUFS; i++) mtev_bufpool_free(bufs[i]);
+  return NULL;
+}
+
+static int64_t
+total(int which) {
+  mtev_bufpool_node_stats_t stats[MTEV_BUFPOOL_MAX_NODES];
+  int64_t sum = 0;
+  int i, n = mtev_bufpool_stats(pool, stats, MTEV_BUFPOOL_MAX_NODES);
+  assert(n == mtev_bufpool_numa_nodes());
+  for(i = 0; i < n; i++) {
+    if(which == 0) sum += stats[i].outstanding;
+    else if(which == 1) sum += stats[i].regions;
+    else sum += stats[i].free;
+  }
+  return sum;
+}
+
+int main() {
+  pthread_t tid;
+  int i, round;
+
+  assert(mtev_bufpool_create("too big", 4 * 1024 * 1024, MTEV_BUFPOOL_PAGES_NORMAL) == NULL);
+  pool = mtev_bufpool_create("test", 32768, MTEV_BUFPOOL_PAGES_DEFAULT);
+  assert(pool);
+  assert(mtev_bufpool_bufsize(pool) == 32768);
+  assert(mtev_bufpool_current_node() < mtev_bufpool_numa_nodes());
+
+  for(round = 0; round < 3; round++) {
+    for(i = 0; i < NBUFS; i++) {
+      bufs[i] = mtev_bufpool_alloc(pool);
+      assert(bufs[i]);
+      assert(((uintptr_t)bufs[i] & 63) == 0);
+      memset(bufs[i], i & 0xff, 32768);
+    }
+    for(i = 0; i < NBUFS; i++)
+      assert(((unsigned char *)bufs[i])[32767] == (i & 0xff));
+    assert(total(0) >= NBUFS);
+    /* frees from a thread that never allocated go straight to the node */
+    pthread_create(&tid, NULL, free_elsewhere, NULL);
+    pthread_join(tid, NULL);
+    assert(total(2) >= NBUFS);
+  }
+  /* freed buffers are reused rather than reserving more regions */
+  assert(total(1) <= (NBUFS + 63) / 63 + 1);
+
+  /* the thread cache returns what it just freed */
+  bufs[0] = mtev_bufpool_alloc(pool);
+  mtev_bufpool_free(bufs[0]);
+  assert(mtev_bufpool_alloc(pool) == bufs[0]);
+  printf("ok\n");
+  return 0;
+}
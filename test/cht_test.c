@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <assert.h>
+#include <mtev_defines.h>
+#include <mtev_cht.h>
+#include <mtev_time.h>
+
+#define NKEYS 100000
+#define NLOOKUPS 2000000
+
+static char keys[NKEYS][16];
+
+static mtev_cht_node_t *mknodes(int cnt) {
+  int i;
+  char name[32];
+  mtev_cht_node_t *nodes = calloc(cnt, sizeof(*nodes));
+  for(i = 0; i < cnt; i++) {
+    snprintf(name, sizeof(name), "node%d", i + 1);
+    nodes[i].name = strdup(name);
+  }
+  return nodes;
+}
+
+static mtev_cht_t *build(mtev_cht_mode_t mode, int cnt) {
+  mtev_cht_t *cht = mtev_cht_alloc_mode(mode);
+  mtev_cht_node_t *nodes = mknodes(cnt);
+  double total = 0;
+  int i;
+  assert(mtev_cht_get_mode(cht) == mode);
+  assert(mtev_cht_set_nodes(cht, cnt, nodes) == cnt);
+  for(i = 0; i < cnt; i++) {
+    total += nodes[i].owned;
+    assert(fabs(nodes[i].owned - 1.0 / cnt) < 1.0 / cnt);
+  }
+  assert(fabs(total - 1.0) < 1e-9);
+  return cht;
+}
+
+static void assign(mtev_cht_t *cht, int *out) {
+  mtev_cht_node_t *node;
+  int i;
+  for(i = 0; i < NKEYS; i++) {
+    assert(mtev_cht_lookup(cht, keys[i], &node) == 1);
+    out[i] = atoi(node->name + 4);
+  }
+}
+
+/* Fraction of keys that moved between two assignments, and of those how
+ * many did not need to (neither their old nor new node was the one that
+ * joined or left). */
+static int movement(const char *what, int *a, int *b, int changed) {
+  int i, moved = 0, extra = 0;
+  for(i = 0; i < NKEYS; i++) {
+    if(a[i] == b[i]) continue;
+    moved++;
+    if(a[i] != changed && b[i] != changed) extra++;
+  }
+  printf("    %-8s moved %5.2f%% of keys (%5.2f%% unnecessarily)\n",
+         what, 100.0 * moved / NKEYS, 100.0 * extra / NKEYS);
+  return extra;
+}
+
+static void test_replicas(mtev_cht_t *cht, int cnt) {
+  mtev_cht_node_t *nodes[16], *primary;
+  int i, j, k, w = cnt < 3 ? cnt : 3;
+  for(i = 0; i < 1000; i++) {
+    assert(mtev_cht_lookup_n(cht, keys[i], w, nodes) == w);
+    assert(mtev_cht_lookup(cht, keys[i], &primary) == 1);
+    assert(nodes[0] == primary);
+    for(j = 0; j < w; j++)
+      for(k = j + 1; k < w; k++) assert(nodes[j] != nodes[k]);
+  }
+  assert(mtev_cht_lookup_n(cht, keys[0], 16, nodes) == (cnt < 16 ? cnt : 16));
+}
+
+static void test_mode(mtev_cht_mode_t mode) {
+  int cnt, i, *a, *b;
+  mtev_cht_t *cht;
+  mtev_cht_node_t *node;
+  mtev_hrtime_t start, elapsed;
+
+  printf("%s:\n", mtev_cht_mode_name(mode));
+  for(cnt = 1; cnt <= 20; cnt++) {
+    cht = build(mode, cnt);
+    test_replicas(cht, cnt);
+    mtev_cht_free(cht);
+  }
+
+  a = calloc(NKEYS, sizeof(*a));
+  b = calloc(NKEYS, sizeof(*b));
+  for(cnt = 8; cnt <= 64; cnt *= 8) {
+    cht = build(mode, cnt);
+    assign(cht, a);
+    mtev_cht_free(cht);
+
+    cht = build(mode, cnt + 1);
+    assign(cht, b);
+    mtev_cht_free(cht);
+    printf("  %d -> %d nodes\n", cnt, cnt + 1);
+    i = movement("add", a, b, cnt + 1);
+    assert(i < NKEYS / 50);
+    if(mode != MTEV_CHT_MAGLEV) {
+      for(i = 0; i < NKEYS; i++) assert(a[i] == b[i] || b[i] == cnt + 1);
+    }
+
+    cht = build(mode, cnt - 1);
+    assign(cht, b);
+    mtev_cht_free(cht);
+    printf("  %d -> %d nodes\n", cnt, cnt - 1);
+    i = movement("remove", a, b, cnt);
+    assert(i < NKEYS / 50);
+    if(mode != MTEV_CHT_MAGLEV) {
+      for(i = 0; i < NKEYS; i++) assert(a[i] == b[i] || a[i] == cnt);
+    }
+
+    cht = build(mode, cnt);
+    start = mtev_gethrtime();
+    for(i = 0; i < NLOOKUPS; i++)
+      mtev_cht_lookup(cht, keys[i % NKEYS], &node);
+    elapsed = mtev_gethrtime() - start;
+    printf("  %d nodes: %.0f lookups/sec\n", cnt,
+           (double)NLOOKUPS * 1000000000.0 / (double)elapsed);
+    mtev_cht_free(cht);
+  }
+  free(a);
+  free(b);
+}
+
+int main(int argc, char **argv) {
+  int i;
+  for(i = 0; i < NKEYS; i++) snprintf(keys[i], sizeof(keys[i]), "key%d", i);
+
+  assert(mtev_cht_mode_from_name("Maglev", &(mtev_cht_mode_t){0}));
+  assert(!mtev_cht_mode_from_name("rendezvous", &(mtev_cht_mode_t){0}));
+  test_mode(MTEV_CHT_RING);
+  test_mode(MTEV_CHT_MAGLEV);
+  test_mode(MTEV_CHT_JUMP);
+  return 0;
+}
@@ -0,0 +1,245 @@
+#include <mtev_b64.h>
+#include <mtev_hex.h>
+#include <mtev_time.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#define FAIL(...)                           \
+  printf("** ");                            \
+  printf( __VA_ARGS__);                     \
+  printf("\n** FAILURE\n"); \
+  exit(1);
+
+#define MAXLEN 1024
+
+/* Straightforward reference implementations to check against. */
+static size_t
+ref_b64_encode(const unsigned char *src, size_t len, char *dst, int url, int pad) {
+  const char *alpha = url ?
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_" :
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  size_t i, o = 0;
+  for(i = 0; i < len; i += 3) {
+    uint32_t v = src[i] << 16;
+    if(i + 1 < len) v |= src[i+1] << 8;
+    if(i + 2 < len) v |= src[i+2];
+    dst[o++] = alpha[(v >> 18) & 0x3f];
+    dst[o++] = alpha[(v >> 12) & 0x3f];
+    if(i + 1 < len) dst[o++] = alpha[(v >> 6) & 0x3f];
+    else if(pad) dst[o++] = '=';
+    if(i + 2 < len) dst[o++] = alpha[v & 0x3f];
+    else if(pad) dst[o++] = '=';
+  }
+  return o;
+}
+
+static void
+random_bytes(unsigned char *buf, size_t len) {
+  size_t i;
+  for(i = 0; i < len; i++) buf[i] = rand();
+}
+
+static void
+test_b64_roundtrip(void) {
+  unsigned char raw[MAXLEN], out[MAXLEN + 8];
+  char enc[MAXLEN * 2], ref[MAXLEN * 2];
+  int iter;
+
+  for(iter = 0; iter < 200000; iter++) {
+    size_t len = rand() % (iter < 100000 ? 100 : MAXLEN);
+    size_t rlen, elen;
+    int dlen;
+
+    random_bytes(raw, len);
+
+    rlen = ref_b64_encode(raw, len, ref, 0, 1);
+    elen = mtev_b64_encode(raw, len, enc, sizeof(enc));
+    if(elen != rlen || elen != mtev_b64_encode_len(len) || memcmp(enc, ref, rlen)) {
+      FAIL("b64 encode mismatch at len %zu", len);
+    }
+    dlen = mtev_b64_decode(enc, elen, out, mtev_b64_max_decode_len(elen));
+    if(dlen != len || memcmp(raw, out, len)) {
+      FAIL("b64 decode mismatch at len %zu (%d)", len, dlen);
+    }
+
+    rlen = ref_b64_encode(raw, len, ref, 1, 0);
+    elen = mtev_b64url_encode(raw, len, enc, sizeof(enc));
+    if(elen != rlen || elen != mtev_b64url_encode_len(len) || memcmp(enc, ref, rlen)) {
+      FAIL("b64url encode mismatch at len %zu", len);
+    }
+    dlen = mtev_b64url_decode(enc, elen, out, mtev_b64url_max_decode_len(elen));
+    if(dlen != len || memcmp(raw, out, len)) {
+      FAIL("b64url decode mismatch at len %zu (%d)", len, dlen);
+    }
+  }
+}
+
+static void
+test_b64_decode_edges(void) {
+  unsigned char out[64];
+  const char *wrapped = "VGhpcyBp\ncyBhIHN0\r\ncmluZw==";
+  int rv;
+
+  rv = mtev_b64_decode(wrapped, strlen(wrapped), out, sizeof(out));
+  if(rv != 16 || memcmp(out, "This is a string", 16)) { FAIL("whitespace decode"); }
+  /* decoding stops at an invalid character */
+  rv = mtev_b64_decode("QUJD*QUJD", 9, out, sizeof(out));
+  if(rv != 3 || memcmp(out, "ABC", 3)) { FAIL("stop at invalid (%d)", rv); }
+  /* and after padding */
+  rv = mtev_b64_decode("QQ==QUJD", 8, out, sizeof(out));
+  if(rv != 1 || out[0] != 'A') { FAIL("stop at padding (%d)", rv); }
+  /* a trailing unpadded group still decodes */
+  rv = mtev_b64_decode("QUJDQQ", 6, out, sizeof(out));
+  if(rv != 4 || memcmp(out, "ABCA", 4)) { FAIL("unpadded tail (%d)", rv); }
+  /* never write past dest_len */
+  memset(out, 0xee, sizeof(out));
+  rv = mtev_b64_decode("QUJDQUJD", 8, out, 4);
+  if(rv != 0 || out[4] != 0xee) { FAIL("overflowed dest"); }
+  /* the alphabets do not mix */
+  rv = mtev_b64url_decode("-_-_", 4, out, sizeof(out));
+  if(rv != 3 || memcmp(out, "\xfb\xff\xbf", 3)) { FAIL("url alphabet"); }
+  rv = mtev_b64_decode("-_-_", 4, out, sizeof(out));
+  if(rv != 0) { FAIL("url characters accepted by standard decode"); }
+}
+
+static void
+test_b64_stream(void) {
+  unsigned char raw[MAXLEN * 4], out[MAXLEN * 4];
+  char enc[MAXLEN * 8], ref[MAXLEN * 8];
+  mtev_b64_stream_t st;
+  int iter;
+
+  for(iter = 0; iter < 20000; iter++) {
+    size_t len = rand() % sizeof(raw), rlen, off, o;
+    int flags = rand() % 4;
+    ssize_t rv;
+
+    random_bytes(raw, len);
+    rlen = ref_b64_encode(raw, len, ref, flags & MTEV_B64_URL, !(flags & MTEV_B64_NOPAD));
+
+    /* encode in random pieces */
+    mtev_b64_stream_init(&st, flags);
+    for(off = 0, o = 0; off < len; ) {
+      size_t piece = 1 + rand() % (1 + (len - off) / (1 + rand() % 8));
+      if(piece > len - off) piece = len - off;
+      rv = mtev_b64_encode_update(&st, raw + off, piece, enc + o,
+                                  mtev_b64_encode_len(piece));
+      if(rv < 0) { FAIL("encode_update failed"); }
+      off += piece;
+      o += rv;
+    }
+    rv = mtev_b64_encode_final(&st, enc + o, 4);
+    if(rv < 0) { FAIL("encode_final failed"); }
+    o += rv;
+    if(o != rlen || memcmp(enc, ref, rlen)) { FAIL("stream encode mismatch, len %zu", len); }
+
+    /* decode in random pieces */
+    mtev_b64_stream_init(&st, flags);
+    for(off = 0, o = 0; off < rlen; ) {
+      size_t piece = 1 + rand() % (1 + (rlen - off) / (1 + rand() % 8));
+      if(piece > rlen - off) piece = rlen - off;
+      rv = mtev_b64_decode_update(&st, enc + off, piece, out + o,
+                                  mtev_b64_decode_update_len(piece));
+      if(rv < 0) { FAIL("decode_update failed"); }
+      off += piece;
+      o += rv;
+    }
+    rv = mtev_b64_decode_final(&st, out + o, 2);
+    if(rv < 0) { FAIL("decode_final failed"); }
+    o += rv;
+    if(o != len || memcmp(raw, out, len)) { FAIL("stream decode mismatch, len %zu", len); }
+  }
+
+  /* streaming decode is strict */
+  mtev_b64_stream_init(&st, 0);
+  if(mtev_b64_decode_update(&st, "QUJD*", 5, out, 6) != -1) { FAIL("strict invalid"); }
+  mtev_b64_stream_init(&st, 0);
+  if(mtev_b64_decode_update(&st, "QQ==", 4, out, 6) != 1) { FAIL("strict pad"); }
+  if(mtev_b64_decode_update(&st, "\n=", 2, out, 3) != 0) { FAIL("strict trailing pad"); }
+  if(mtev_b64_decode_update(&st, "QQ", 2, out, 3) != -1) { FAIL("strict data after pad"); }
+  mtev_b64_stream_init(&st, 0);
+  if(mtev_b64_decode_update(&st, "QUJDQ", 5, out, 6) != 3) { FAIL("strict partial"); }
+  if(mtev_b64_decode_final(&st, out, 2) != -1) { FAIL("strict lone digit"); }
+}
+
+static void
+test_hex(void) {
+  unsigned char raw[MAXLEN], out[MAXLEN];
+  char enc[MAXLEN * 2];
+  int iter, rv;
+
+  for(iter = 0; iter < 100000; iter++) {
+    size_t len = rand() % (iter < 50000 ? 100 : MAXLEN), i;
+    random_bytes(raw, len);
+    if(mtev_hex_encode(raw, len, enc, sizeof(enc)) != 2 * len) { FAIL("hex encode len"); }
+    for(i = 0; i < len; i++) {
+      char expect[3];
+      snprintf(expect, sizeof(expect), "%02x", raw[i]);
+      if(memcmp(enc + 2 * i, expect, 2)) { FAIL("hex encode mismatch"); }
+    }
+    /* mixed case decodes the same */
+    for(i = 0; i < 2 * len; i++) if(rand() & 1) enc[i] = toupper(enc[i]);
+    rv = mtev_hex_decode(enc, 2 * len, out, mtev_hex_max_decode_len(2 * len));
+    if(rv != len || memcmp(raw, out, len)) { FAIL("hex decode mismatch"); }
+    if(len > 0) {
+      size_t bad = rand() % (2 * len);
+      enc[bad] = 'g';
+      rv = mtev_hex_decode(enc, 2 * len, out, len);
+      if(rv != bad / 2) { FAIL("hex decode did not stop at %zu (%d)", bad, rv); }
+    }
+  }
+  if(mtev_hex_encode(raw, 4, enc, 7) != 0) { FAIL("hex short buffer"); }
+}
+
+#define BENCH_LEN (1024 * 1024)
+#define BENCH_ITERS 200
+
+static double
+gbps(size_t bytes, mtev_hrtime_t start) {
+  return (double)bytes / (double)(mtev_gethrtime() - start);
+}
+
+static void
+bench(void) {
+  unsigned char *raw = malloc(BENCH_LEN), *out = malloc(BENCH_LEN);
+  char *enc = malloc(2 * BENCH_LEN);
+  size_t elen;
+  mtev_hrtime_t start;
+  int i;
+
+  random_bytes(raw, BENCH_LEN);
+  start = mtev_gethrtime();
+  for(i = 0; i < BENCH_ITERS; i++) elen = mtev_b64_encode(raw, BENCH_LEN, enc, 2 * BENCH_LEN);
+  printf("b64 encode: %.2f GB/s\n", gbps((size_t)BENCH_LEN * BENCH_ITERS, start));
+  start = mtev_gethrtime();
+  for(i = 0; i < BENCH_ITERS; i++) mtev_b64_decode(enc, elen, out, BENCH_LEN);
+  printf("b64 decode: %.2f GB/s\n", gbps(elen * BENCH_ITERS, start));
+  if(memcmp(raw, out, BENCH_LEN)) { FAIL("bench b64 round trip"); }
+
+  start = mtev_gethrtime();
+  for(i = 0; i < BENCH_ITERS; i++) elen = mtev_hex_encode(raw, BENCH_LEN, enc, 2 * BENCH_LEN);
+  printf("hex encode: %.2f GB/s\n", gbps((size_t)BENCH_LEN * BENCH_ITERS, start));
+  start = mtev_gethrtime();
+  for(i = 0; i < BENCH_ITERS; i++) mtev_hex_decode(enc, elen, out, BENCH_LEN);
+  printf("hex decode: %.2f GB/s\n", gbps(elen * BENCH_ITERS, start));
+  if(memcmp(raw, out, BENCH_LEN)) { FAIL("bench hex round trip"); }
+  free(raw);
+  free(out);
+  free(enc);
+}
+
+int main(int argc, char **argv)
+{
+  srand(time(NULL));
+  test_b64_roundtrip();
+  test_b64_decode_edges();
+  test_b64_stream();
+  test_hex();
+  bench();
+  printf("SUCCESS\n");
+  return 0;
+}
@@ -0,0 +1,214 @@
+#include <mtev_defines.h>
+#include <mtev_compress.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define FAIL(...)                           \
+  printf("** ");                            \
+  printf( __VA_ARGS__);                     \
+  printf("\n** FAILURE\n"); \
+  exit(1);
+
+/* Somewhat compressible: words from a small vocabulary with random noise. */
+static void
+fill(unsigned char *buf, size_t len) {
+  static const char *words[] = { "metric ", "check ", "uuid ", "value ", "12345 " };
+  size_t i = 0;
+  while(i < len) {
+    const char *w = words[rand() % 5];
+    while(*w && i < len) buf[i++] = *w++;
+    if(i < len && rand() % 8 == 0) buf[i++] = rand();
+  }
+}
+
+/* Decompress everything in small, irregular steps so partial input and
+ * partial output are both exercised. */
+static unsigned char *
+decompress_all(mtev_compress_type type, mtev_compress_dictionary_t *dict,
+               const unsigned char *in, size_t len, size_t *outlen) {
+  mtev_stream_decompress_ctx_t *ctx = mtev_create_stream_decompress_ctx();
+  size_t allocd = 1024, used = 0;
+  unsigned char *out = malloc(allocd);
+
+  if(mtev_stream_decompress_init(ctx, type) != 0) {
+    FAIL("%s: decompress init", mtev_compress_type_name(type));
+  }
+  if(dict && mtev_stream_decompress_set_dictionary(ctx, dict) != 0) {
+    FAIL("%s: decompress dictionary", mtev_compress_type_name(type));
+  }
+  while(1) {
+    size_t in_len = len < 37 ? len : 1 + rand() % 37;
+    size_t out_len = 1 + rand() % 257;
+    if(allocd - used < out_len) {
+      allocd *= 2;
+      out = realloc(out, allocd);
+    }
+    if(mtev_stream_decompress(ctx, in, &in_len, out + used, &out_len) != 0) {
+      FAIL("%s: decompress failed at %zu", mtev_compress_type_name(type), used);
+    }
+    in += in_len;
+    len -= in_len;
+    used += out_len;
+    if(len == 0 && out_len == 0) break;
+  }
+  mtev_stream_decompress_finish(ctx);
+  mtev_destroy_stream_decompress_ctx(ctx);
+  *outlen = used;
+  return out;
+}
+
+static void
+check_same(const char *what, mtev_compress_type type, const unsigned char *a,
+           size_t alen, const unsigned char *b, size_t blen) {
+  if(alen != blen || memcmp(a, b, alen)) {
+    FAIL("%s %s: round trip mismatch (%zu != %zu)", mtev_compress_type_name(type),
+         what, alen, blen);
+  }
+}
+
+static void
+test_oneshot(mtev_compress_type type) {
+  static const size_t sizes[] = { 0, 1, 100, 4096, 65536 + 7, 1024 * 1024 };
+  int i;
+  for(i=0; i<sizeof(sizes)/sizeof(*sizes); i++) {
+    unsigned char *raw = malloc(sizes[i] + 1), *comp = NULL, *back;
+    size_t clen = 0, blen;
+    fill(raw, sizes[i]);
+    if(mtev_compress(type, (const char *)raw, sizes[i], &comp, &clen) != 0) {
+      FAIL("%s: compress of %zu failed", mtev_compress_type_name(type), sizes[i]);
+    }
+    if(sizes[i] >= 4096 && clen >= sizes[i]) {
+      FAIL("%s: %zu bytes grew to %zu", mtev_compress_type_name(type), sizes[i], clen);
+    }
+    back = decompress_all(type, NULL, comp, clen, &blen);
+    check_same("one-shot", type, raw, sizes[i], back, blen);
+    free(back);
+    free(comp);
+    free(raw);
+  }
+}
+
+/* Compress in irregular chunks into a tight output buffer, then drain the
+ * stream with flush until it has nothing left. */
+static unsigned char *
+stream_compress_all(mtev_compress_type type, int level,
+                    mtev_compress_dictionary_t *dict,
+                    const unsigned char *in, size_t len, size_t *outlen) {
+  mtev_stream_compress_ctx_t *ctx = mtev_create_stream_compress_ctx();
+  size_t allocd = mtev_compress_bound(type, len) + 1024, used = 0;
+  unsigned char *out = malloc(allocd);
+  int i;
+
+  if(mtev_stream_compress_init_level(ctx, type, level) != 0) {
+    FAIL("%s: compress init at level %d", mtev_compress_type_name(type), level);
+  }
+  if(dict && mtev_stream_compress_set_dictionary(ctx, dict) != 0) {
+    FAIL("%s: compress dictionary", mtev_compress_type_name(type));
+  }
+  while(len) {
+    size_t in_len = len < 4099 ? len : 1 + rand() % 4099;
+    size_t want = in_len, out_len;
+    if(allocd - used < 65536) {
+      allocd *= 2;
+      out = realloc(out, allocd);
+    }
+    out_len = allocd - used;
+    if(mtev_stream_compress(ctx, (const char *)in, &in_len, out + used, &out_len) != 0) {
+      FAIL("%s: stream compress failed", mtev_compress_type_name(type));
+    }
+    /* gzip and zstd leave *len holding what wasn't consumed */
+    in += want - in_len;
+    len -= want - in_len;
+    used += out_len;
+  }
+  while(1) {
+    size_t out_len = 512;
+    if(allocd - used < out_len) {
+      allocd *= 2;
+      out = realloc(out, allocd);
+    }
+    if(mtev_stream_compress_flush(ctx, out + used, &out_len) != 0) {
+      FAIL("%s: flush failed", mtev_compress_type_name(type));
+    }
+    if(out_len == 0) break;
+    used += out_len;
+  }
+  /* an ended stream has nothing more to give, however often we ask */
+  for(i=0; i<3; i++) {
+    unsigned char extra[64];
+    size_t out_len = sizeof(extra);
+    if(mtev_stream_compress_flush(ctx, extra, &out_len) != 0) {
+      FAIL("%s: flush after end failed", mtev_compress_type_name(type));
+    }
+    if(out_len != 0) {
+      FAIL("%s: flush after end wrote %zu bytes", mtev_compress_type_name(type), out_len);
+    }
+  }
+  mtev_stream_compress_finish(ctx);
+  mtev_destroy_stream_compress_ctx(ctx);
+  *outlen = used;
+  return out;
+}
+
+static void
+test_stream(mtev_compress_type type) {
+  static const int levels[] = { MTEV_COMPRESS_LEVEL_DEFAULT, 1, 9 };
+  size_t len = 3 * 1024 * 1024 + 11;
+  unsigned char *raw = malloc(len);
+  int i;
+
+  fill(raw, len);
+  for(i=0; i<sizeof(levels)/sizeof(*levels); i++) {
+    size_t clen, blen;
+    unsigned char *comp = stream_compress_all(type, levels[i], NULL, raw, len, &clen);
+    unsigned char *back = decompress_all(type, NULL, comp, clen, &blen);
+    check_same("stream", type, raw, len, back, blen);
+    free(back);
+    free(comp);
+  }
+  free(raw);
+}
+
+static void
+test_zstd_dictionary(void) {
+  unsigned char sample[8192], msg[600], *comp, *plain, *back;
+  size_t clen, plen, blen;
+  mtev_compress_dictionary_t *dict;
+
+  fill(sample, sizeof(sample));
+  /* a message resembling the dictionary content */
+  memcpy(msg, sample + 1000, sizeof(msg));
+  dict = mtev_compress_dictionary_create(sample, sizeof(sample), 3);
+  if(!dict) {
+    FAIL("zstd: dictionary create");
+  }
+  comp = stream_compress_all(MTEV_COMPRESS_ZSTD, 3, dict, msg, sizeof(msg), &clen);
+  plain = stream_compress_all(MTEV_COMPRESS_ZSTD, 3, NULL, msg, sizeof(msg), &plen);
+  if(clen >= plen) {
+    FAIL("zstd: dictionary didn't help (%zu >= %zu)", clen, plen);
+  }
+  back = decompress_all(MTEV_COMPRESS_ZSTD, dict, comp, clen, &blen);
+  check_same("dictionary", MTEV_COMPRESS_ZSTD, msg, sizeof(msg), back, blen);
+  free(back);
+  free(plain);
+  free(comp);
+  mtev_compress_dictionary_destroy(dict);
+}
+
+int main(int argc, char **argv)
+{
+  srand(time(NULL));
+  test_oneshot(MTEV_COMPRESS_GZIP);
+  test_stream(MTEV_COMPRESS_GZIP);
+  if(mtev_compress_type_available(MTEV_COMPRESS_ZSTD)) {
+    test_oneshot(MTEV_COMPRESS_ZSTD);
+    test_stream(MTEV_COMPRESS_ZSTD);
+    test_zstd_dictionary();
+  }
+  else printf("zstd not available, skipping zstd tests\n");
+  printf("SUCCESS\n");
+  return 0;
+}
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <pthread.h>
+#include <mtev_defines.h>
+#include <mtev_cskiplist.h>
+#include <mtev_skiplist.h>
+#include <mtev_memory.h>
+#include <mtev_time.h>
+#include <ck_pr.h>
+
+#define NTHREADS 4
+#define NKEYS 4096
+#define NOPS 200000
+
+/* Items are small integers smuggled through the data pointer; 0 is never
+ * used so NULL still means "not found". */
+static int cmp_int(const void *a, const void *b) {
+  uintptr_t x = (uintptr_t)a, y = (uintptr_t)b;
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+#define K(i) ((void *)(uintptr_t)(i))
+#define I(p) ((int)(uintptr_t)(p))
+
+static int collect(void *data, void *closure) {
+  int *out = closure;
+  out[++out[0]] = I(data);
+  return out[0] < 5;
+}
+
+static void test_basic(void) {
+  mtev_cskiplist_t *sl = mtev_cskiplist_alloc(cmp_int, cmp_int);
+  mtev_cskiplist_node_t *iter, *prev, *next;
+  int i, out[16];
+
+  for(i = 2; i <= 200; i += 2) assert(mtev_cskiplist_insert(sl, K(i)));
+  assert(!mtev_cskiplist_insert(sl, K(10)));
+  assert(mtev_cskiplist_size(sl) == 100);
+  assert(I(mtev_cskiplist_peek(sl)) == 2);
+
+  mtev_memory_begin();
+  assert(I(mtev_cskiplist_find(sl, K(50), &iter)) == 50);
+  assert(I(mtev_cskiplist_data(mtev_cskiplist_next(sl, iter))) == 52);
+  assert(mtev_cskiplist_find_neighbors(sl, K(51), &iter, &prev, &next) == NULL);
+  assert(iter == NULL);
+  assert(I(mtev_cskiplist_data(prev)) == 50 && I(mtev_cskiplist_data(next)) == 52);
+  assert(I(mtev_cskiplist_find_neighbors(sl, K(2), &iter, &prev, &next)) == 2);
+  assert(prev == NULL && I(mtev_cskiplist_data(next)) == 4);
+  mtev_cskiplist_find_neighbors(sl, K(300), &iter, &prev, &next);
+  assert(I(mtev_cskiplist_data(prev)) == 200 && next == NULL);
+  assert(I(mtev_cskiplist_data(mtev_cskiplist_seek(sl, K(33)))) == 34);
+  assert(mtev_cskiplist_seek(sl, K(201)) == NULL);
+  mtev_memory_end();
+
+  out[0] = 0;
+  assert(mtev_cskiplist_range(sl, K(9), K(15), collect, out) == 3);
+  assert(out[1] == 10 && out[2] == 12 && out[3] == 14);
+  out[0] = 0;
+  assert(mtev_cskiplist_range(sl, NULL, NULL, collect, out) == 5);
+  assert(out[5] == 10);
+
+  assert(mtev_cskiplist_remove(sl, K(10), NULL) == 1);
+  assert(mtev_cskiplist_remove(sl, K(10), NULL) == 0);
+  assert(mtev_cskiplist_find(sl, K(10), NULL) == NULL);
+  assert(I(mtev_cskiplist_pop(sl, NULL)) == 2);
+  assert(mtev_cskiplist_size(sl) == 98);
+  for(i = 0; i < 98; i++) assert(mtev_cskiplist_pop(sl, NULL) != NULL);
+  assert(mtev_cskiplist_pop(sl, NULL) == NULL);
+  assert(mtev_cskiplist_size(sl) == 0);
+  mtev_cskiplist_destroy(sl, NULL);
+}
+
+static mtev_cskiplist_t *shared;
+static int present[NKEYS + 1];
+
+static int check_order(void *data, void *closure) {
+  uintptr_t *last = closure;
+  assert((uintptr_t)data > *last);
+  *last = (uintptr_t)data;
+  return 1;
+}
+
+/* Each writer owns the keys congruent to its id, so it can track exactly
+ * which of them should be present when everyone is done. */
+static void *writer(void *closure) {
+  int id = (int)(intptr_t)closure, i;
+  uint64_t r = 0x9e3779b97f4a7c15ULL * (id + 1);
+  mtev_memory_init_thread();
+  for(i = 0; i < NOPS; i++) {
+    int k;
+    r ^= r << 13; r ^= r >> 7; r ^= r << 17;
+    k = (int)((r >> 8) % (NKEYS / NTHREADS)) * NTHREADS + id + 1;
+    if(present[k]) {
+      assert(mtev_cskiplist_remove(shared, K(k), NULL) == 1);
+      present[k] = 0;
+    }
+    else {
+      assert(mtev_cskiplist_insert(shared, K(k)));
+      present[k] = 1;
+    }
+    if((i % 1024) == 0) {
+      uintptr_t last = 0;
+      mtev_cskiplist_range(shared, NULL, NULL, check_order, &last);
+    }
+  }
+  return NULL;
+}
+
+static void test_concurrent(void) {
+  pthread_t tids[NTHREADS];
+  mtev_cskiplist_node_t *node;
+  int i, cnt = 0, last = 0;
+
+  shared = mtev_cskiplist_alloc(cmp_int, cmp_int);
+  for(i = 0; i < NTHREADS; i++)
+    pthread_create(&tids[i], NULL, writer, (void *)(intptr_t)i);
+  for(i = 0; i < NTHREADS; i++) pthread_join(tids[i], NULL);
+
+  mtev_memory_begin();
+  for(node = mtev_cskiplist_seek(shared, NULL); node;
+      node = mtev_cskiplist_next(shared, node)) {
+    int k = I(mtev_cskiplist_data(node));
+    assert(k > last && present[k]);
+    last = k;
+    cnt++;
+  }
+  mtev_memory_end();
+  for(i = 1; i <= NKEYS; i++) cnt -= present[i];
+  assert(cnt == 0);
+  for(i = 1; i <= NKEYS; i++) cnt += present[i];
+  assert(mtev_cskiplist_size(shared) == cnt);
+  mtev_cskiplist_destroy(shared, NULL);
+}
+
+static int popped[NOPS + 1];
+
+static void *popper(void *closure) {
+  void *data;
+  mtev_memory_init_thread();
+  while((data = mtev_cskiplist_pop(shared, NULL)) != NULL)
+    ck_pr_inc_int(&popped[I(data)]);
+  return NULL;
+}
+
+/* Competing pops must hand out every item exactly once. */
+static void test_concurrent_pop(void) {
+  pthread_t tids[NTHREADS];
+  int i;
+
+  shared = mtev_cskiplist_alloc(cmp_int, cmp_int);
+  for(i = 1; i <= NOPS; i++) assert(mtev_cskiplist_insert(shared, K(i)));
+  for(i = 0; i < NTHREADS; i++) pthread_create(&tids[i], NULL, popper, NULL);
+  for(i = 0; i < NTHREADS; i++) pthread_join(tids[i], NULL);
+  for(i = 1; i <= NOPS; i++) assert(popped[i] == 1);
+  assert(mtev_cskiplist_size(shared) == 0);
+  mtev_cskiplist_destroy(shared, NULL);
+}
+
+static void bench(void) {
+  mtev_cskiplist_t *sl = mtev_cskiplist_alloc(cmp_int, cmp_int);
+  mtev_skiplist ssl;
+  mtev_hrtime_t start, elapsed;
+  int i, n = 1000000;
+
+  mtev_skiplist_init(&ssl);
+  mtev_skiplist_set_compare(&ssl, cmp_int, cmp_int);
+  start = mtev_gethrtime();
+  for(i = 1; i <= n; i++) mtev_skiplist_insert(&ssl, K(((uint64_t)i * 7919) % n + 1));
+  for(i = 1; i <= n; i++) assert(mtev_skiplist_find(&ssl, K(i), NULL));
+  elapsed = mtev_gethrtime() - start;
+  printf("mtev_skiplist:  %.0f ns/op\n", (double)elapsed / (2 * n));
+  mtev_skiplist_destroy(&ssl, NULL);
+
+  start = mtev_gethrtime();
+  for(i = 1; i <= n; i++) mtev_cskiplist_insert(sl, K(((uint64_t)i * 7919) % n + 1));
+  for(i = 1; i <= n; i++) assert(mtev_cskiplist_find(sl, K(i), NULL));
+  elapsed = mtev_gethrtime() - start;
+  printf("mtev_cskiplist: %.0f ns/op\n", (double)elapsed / (2 * n));
+  mtev_cskiplist_destroy(sl, NULL);
+}
+
+int main(int argc, char **argv) {
+  mtev_memory_init();
+  test_basic();
+  test_concurrent();
+  test_concurrent_pop();
+  bench();
+  return 0;
+}
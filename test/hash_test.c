@@ -1,8 +1,13 @@
 #include <mtev_hash.h>
+#include <mtev_memory.h>
+#include <mtev_time.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 int failed;
@@ -24,14 +29,10 @@ void *thread_func(void *arg)
 
 #define THREAD_COUNT 4
 
-static int do_test(mtev_hash_lock_mode_t lock_mode) {
-  mtev_hash_table hash;
-
-  mtev_hash_init_locks(&hash, 400, lock_mode);
-
+static int do_test_table(mtev_hash_table *h) {
   pthread_t threads[THREAD_COUNT];
   for (int i = 0; i < THREAD_COUNT; i++) {
-    pthread_create(&threads[i], NULL, thread_func, &hash);
+    pthread_create(&threads[i], NULL, thread_func, h);
   }
 
   for (int i = 0; i < THREAD_COUNT; i++) {
@@ -44,20 +45,280 @@ static int do_test(mtev_hash_lock_mode_t lock_mode) {
   int klen;
   void *data;
 
-  while(mtev_hash_next(&hash, &iter, &k, &klen, &data)) {
+  while(mtev_hash_next(h, &iter, &k, &klen, &data)) {
     printf("%s\n", k);
   }
 
-  mtev_hash_destroy(&hash, free, NULL);
+  mtev_hash_destroy(h, free, NULL);
   return 0;
 }
 
+static int do_test(mtev_hash_lock_mode_t lock_mode) {
+  mtev_hash_table hash;
+  mtev_hash_init_locks(&hash, 400, lock_mode);
+  return do_test_table(&hash);
+}
+
+#define UPSERT_KEYS 500
+#define UPSERT_ROUNDS 4
+
+static void *incr(void *current, mtev_boolean exists, void *closure) {
+  (void)exists;
+  (void)closure;
+  return (void *)((uintptr_t)current + 1);
+}
+
+static void *upsert_func(void *arg)
+{
+  mtev_hash_table *h = arg;
+  char *key;
+  for (int i = 0; i < UPSERT_KEYS * UPSERT_ROUNDS; i++) {
+    asprintf(&key, "key-%d", i % UPSERT_KEYS);
+    if(!mtev_hash_upsert(h, key, strlen(key), incr, NULL)) free(key);
+  }
+  return NULL;
+}
+
+static void *cas_func(void *arg)
+{
+  mtev_hash_table *h = arg;
+  void *cur = NULL;
+  for (int i = 0; i < 1000; i++) {
+    mtev_hash_retrieve(h, "counter", 7, &cur);
+    while(!mtev_hash_cas(h, "counter", 7, cur, (void *)((uintptr_t)cur + 1), &cur));
+  }
+  return NULL;
+}
+
+static void check(int cond, const char *what) {
+  if(!cond) {
+    printf("FAILED: %s\n", what);
+    failed++;
+  }
+}
+
+static void do_atomic_test(mtev_hash_table *h) {
+  pthread_t threads[THREAD_COUNT];
+  mtev_hash_iter iter = MTEV_HASH_ITER_ZERO;
+  uintptr_t total = 0;
+  void *data;
+  int n = 0;
+
+  for (int i = 0; i < THREAD_COUNT; i++)
+    pthread_create(&threads[i], NULL, upsert_func, h);
+  for (int i = 0; i < THREAD_COUNT; i++)
+    pthread_join(threads[i], NULL);
+  while(mtev_hash_adv(h, &iter)) {
+    n++;
+    total += (uintptr_t)iter.value.ptr;
+  }
+  check(n == UPSERT_KEYS, "upsert key count");
+  check(mtev_hash_size(h) == UPSERT_KEYS, "upsert size");
+  check(total == UPSERT_KEYS * UPSERT_ROUNDS * THREAD_COUNT, "upsert total");
+  mtev_hash_delete_all(h, free, NULL);
+
+  mtev_hash_store(h, strdup("counter"), 7, NULL);
+  for (int i = 0; i < THREAD_COUNT; i++)
+    pthread_create(&threads[i], NULL, cas_func, h);
+  for (int i = 0; i < THREAD_COUNT; i++)
+    pthread_join(threads[i], NULL);
+  check(mtev_hash_retrieve(h, "counter", 7, &data) &&
+        (uintptr_t)data == 1000 * THREAD_COUNT, "cas counter");
+  check(!mtev_hash_cas(h, "missing", 7, NULL, h, &data) && data == NULL,
+        "cas on missing key");
+  mtev_hash_destroy(h, free, NULL);
+}
+
+/* Large tables are resized incrementally; every key must stay
+ * visible throughout and no single store should stall. */
+#define LARGE_KEYS 500000
+
+static void do_large_test(mtev_hash_table *h, const char *name) {
+  mtev_hrtime_t start, worst = 0, elapsed;
+  mtev_hash_iter iter = MTEV_HASH_ITER_ZERO;
+  char **keys = calloc(LARGE_KEYS, sizeof(*keys));
+  void *data;
+  int i, n = 0;
+
+  for (i = 0; i < LARGE_KEYS; i++) {
+    asprintf(&keys[i], "large-%d", i);
+    start = mtev_gethrtime();
+    mtev_hash_store(h, keys[i], strlen(keys[i]), (void *)(uintptr_t)i);
+    elapsed = mtev_gethrtime() - start;
+    if(elapsed > worst) worst = elapsed;
+    if((i % 1009) == 0) {
+      int j = i / 2;
+      check(mtev_hash_retrieve(h, keys[j], strlen(keys[j]), &data) &&
+            (uintptr_t)data == (uintptr_t)j, "key visible while growing");
+    }
+  }
+  printf("%-8s %d stores, slowest %.3f ms\n", name, LARGE_KEYS, (double)worst / 1000000.0);
+  check(mtev_hash_size(h) == LARGE_KEYS, "large size");
+  for (i = 0; i < LARGE_KEYS; i += 2)
+    mtev_hash_replace(h, strdup(keys[i]), strlen(keys[i]), (void *)(uintptr_t)(i + 1), NULL, NULL);
+  for (i = 0; i < LARGE_KEYS; i += 4)
+    mtev_hash_delete(h, keys[i], strlen(keys[i]), free, NULL);
+  check(mtev_hash_size(h) == LARGE_KEYS - LARGE_KEYS / 4, "large size after deletes");
+  for (i = 0; i < LARGE_KEYS; i++) {
+    int present = mtev_hash_retrieve(h, keys[i], strlen(keys[i]), &data);
+    if((i % 4) == 0) check(!present, "deleted key gone");
+    else check(present && (uintptr_t)data == (uintptr_t)(i + ((i % 2) ? 0 : 1)), "large value");
+  }
+  while(mtev_hash_adv(h, &iter)) n++;
+  check(n == LARGE_KEYS - LARGE_KEYS / 4, "large iteration");
+  mtev_hash_destroy(h, free, NULL);
+  for (i = 0; i < LARGE_KEYS; i += 2) free(keys[i]);
+  free(keys);
+}
+
+/* Iterate a sharded table while other threads delete from it, freeing
+ * their keys; every key seen must still be intact while we hold the
+ * epoch (under ASan, a premature free shows up here). */
+#define CHURN_KEYS 20000
+static volatile int churn_done;
+
+static void *churn_func(void *arg)
+{
+  mtev_hash_table *h = arg;
+  uint32_t x = (uint32_t)(uintptr_t)&x;
+  char key[32];
+  while(!churn_done) {
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    snprintf(key, sizeof(key), "churn-%u", x % CHURN_KEYS);
+    if(!mtev_hash_delete(h, key, strlen(key), free, NULL)) {
+      char *k = strdup(key);
+      if(!mtev_hash_store(h, k, strlen(k), NULL)) free(k);
+    }
+  }
+  return NULL;
+}
+
+static void do_churn_test(mtev_hash_table *h) {
+  pthread_t threads[THREAD_COUNT];
+  int i, pass;
+  for (i = 0; i < CHURN_KEYS; i++) {
+    char *k;
+    asprintf(&k, "churn-%d", i);
+    mtev_hash_store(h, k, strlen(k), NULL);
+  }
+  churn_done = 0;
+  for (i = 0; i < THREAD_COUNT; i++)
+    pthread_create(&threads[i], NULL, churn_func, h);
+  for (pass = 0; pass < 50; pass++) {
+    mtev_hash_iter iter = MTEV_HASH_ITER_ZERO;
+    mtev_memory_begin();
+    while(mtev_hash_adv(h, &iter)) {
+      check(iter.klen > 6 && !strncmp(iter.key.str, "churn-", 6) &&
+            (int)strlen(iter.key.str) == iter.klen, "key intact during churn");
+    }
+    mtev_memory_end();
+  }
+  churn_done = 1;
+  for (i = 0; i < THREAD_COUNT; i++)
+    pthread_join(threads[i], NULL);
+  mtev_hash_destroy(h, free, NULL);
+  mtev_memory_maintenance();
+}
+
+/* Mixed read/write benchmark: 90% lookups, 10% compare-and-swap
+ * increments over a prepopulated table. */
+#define BENCH_KEYS 10000
+#define BENCH_OPS 100000
+static char *bench_keys[BENCH_KEYS];
+
+struct bench {
+  mtev_hash_table *h;
+  uint32_t seed;
+};
+
+static void *bench_func(void *arg)
+{
+  struct bench *b = arg;
+  uint32_t x = b->seed;
+  void *cur;
+  for (int i = 0; i < BENCH_OPS; i++) {
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    const char *k = bench_keys[x % BENCH_KEYS];
+    int klen = strlen(k);
+    if((x >> 24) < 26) {
+      mtev_hash_retrieve(b->h, k, klen, &cur);
+      while(!mtev_hash_cas(b->h, k, klen, cur, (void *)((uintptr_t)cur + 1), &cur));
+    }
+    else {
+      mtev_hash_retrieve(b->h, k, klen, &cur);
+    }
+  }
+  return NULL;
+}
+
+static void do_bench(const char *name, mtev_hash_table *h) {
+  pthread_t threads[64];
+  struct bench b[64];
+
+  for (int i = 0; i < BENCH_KEYS; i++)
+    mtev_hash_store(h, bench_keys[i], strlen(bench_keys[i]), NULL);
+  for (int nthreads = 1; nthreads <= 64; nthreads *= 2) {
+    mtev_hrtime_t start = mtev_gethrtime();
+    for (int i = 0; i < nthreads; i++) {
+      b[i].h = h;
+      b[i].seed = 2463534242u + i;
+      pthread_create(&threads[i], NULL, bench_func, &b[i]);
+    }
+    for (int i = 0; i < nthreads; i++)
+      pthread_join(threads[i], NULL);
+    double secs = (double)(mtev_gethrtime() - start) / 1000000000.0;
+    printf("%-8s %2d threads: %8.2f Mops/s\n", name, nthreads,
+           (double)nthreads * BENCH_OPS / secs / 1000000.0);
+  }
+  mtev_hash_destroy(h, NULL, NULL);
+}
+
 int main(int argc, char **argv) 
 {
   printf("MUTEX TEST\n");
   do_test(MTEV_HASH_LOCK_MODE_MUTEX);
   printf("SPIN TEST\n");
   do_test(MTEV_HASH_LOCK_MODE_SPIN);
+  printf("SHARDED TEST\n");
+  /* sharded tables reclaim through mtev_memory epochs */
+  mtev_memory_init();
+  mtev_hash_table sharded;
+  mtev_hash_init_sharded(&sharded, 400, 0, MTEV_HASH_LOCK_MODE_SPIN);
+  do_test_table(&sharded);
+
+  printf("UPSERT/CAS TEST\n");
+  mtev_hash_table atomic;
+  mtev_hash_init_locks(&atomic, 400, MTEV_HASH_LOCK_MODE_MUTEX);
+  do_atomic_test(&atomic);
+  mtev_hash_init_sharded(&atomic, 400, 0, MTEV_HASH_LOCK_MODE_MUTEX);
+  do_atomic_test(&atomic);
+
+  printf("LARGE TABLE TEST\n");
+  mtev_hash_table large;
+  mtev_hash_init_locks(&large, MTEV_HASH_DEFAULT_SIZE, MTEV_HASH_LOCK_MODE_MUTEX);
+  do_large_test(&large, "grown");
+  mtev_hash_init_size(&large, LARGE_KEYS);
+  do_large_test(&large, "presized");
+  mtev_hash_init_sharded(&large, MTEV_HASH_DEFAULT_SIZE, 4, MTEV_HASH_LOCK_MODE_SPIN);
+  do_large_test(&large, "sharded");
+
+  printf("SHARDED CHURN TEST\n");
+  mtev_hash_table churn;
+  mtev_hash_init_sharded(&churn, CHURN_KEYS, 0, MTEV_HASH_LOCK_MODE_SPIN);
+  do_churn_test(&churn);
+
+  printf("MIXED READ/WRITE BENCHMARK\n");
+  for (int i = 0; i < BENCH_KEYS; i++)
+    asprintf(&bench_keys[i], "bench-key-%d", i);
+  mtev_hash_table bench;
+  mtev_hash_init_locks(&bench, BENCH_KEYS, MTEV_HASH_LOCK_MODE_MUTEX);
+  do_bench("mutex", &bench);
+  mtev_hash_init_locks(&bench, BENCH_KEYS, MTEV_HASH_LOCK_MODE_SPIN);
+  do_bench("spin", &bench);
+  mtev_hash_init_sharded(&bench, BENCH_KEYS, 0, MTEV_HASH_LOCK_MODE_SPIN);
+  do_bench("sharded", &bench);
+  for (int i = 0; i < BENCH_KEYS; i++)
+    free(bench_keys[i]);
 
   if(sysconf(_SC_NPROCESSORS_ONLN) <= 1) {
     printf("crash test skipped as it is hard to do on single cpu machines\n");
@@ -13,6 +13,115 @@
   exit(1);
 
 
+static void
+check_close(const char *what, double est, double actual, double tolerance)
+{
+  double err = (est - actual) / actual;
+  if (err < -tolerance || err > tolerance) {
+    FAIL("%s: estimate %f for %f is too far off", what, est, actual);
+  }
+}
+
+static void
+add_range(mtev_hyperloglog_t *hll, int from, int to)
+{
+  char s[32];
+  for (int i = from; i < to; i++) {
+    int len = snprintf(s, sizeof(s), "series-%d", i);
+    mtev_hyperloglog_add(hll, s, len);
+  }
+}
+
+static void
+test_range_accuracy(void)
+{
+  /* sparse up to a few thousand, dense beyond; no bias hump between */
+  for (int n = 1; n <= 2000000; n *= 3) {
+    mtev_hyperloglog_t *hll = mtev_hyperloglog_alloc(14);
+    add_range(hll, 0, n);
+    check_close("range", mtev_hyperloglog_size(hll), n, n < 1000 ? 0.01 : 0.04);
+    mtev_hyperloglog_destroy(hll);
+  }
+  printf("SUCCESS, range accuracy\n");
+}
+
+static mtev_hyperloglog_t *
+roundtrip(mtev_hyperloglog_t *hll)
+{
+  size_t len = mtev_hyperloglog_serialized_size(hll);
+  char *buf = malloc(len);
+  mtev_hyperloglog_t *copy;
+  if (mtev_hyperloglog_serialize(hll, buf, len - 1) != -1) {
+    FAIL("serialized into a short buffer");
+  }
+  if (mtev_hyperloglog_serialize(hll, buf, len) != (ssize_t)len) {
+    FAIL("serialize length mismatch");
+  }
+  copy = mtev_hyperloglog_deserialize(buf, len);
+  if (!copy) {
+    FAIL("deserialize failed");
+  }
+  if (mtev_hyperloglog_size(copy) != mtev_hyperloglog_size(hll)) {
+    FAIL("roundtrip changed estimate");
+  }
+  if (mtev_hyperloglog_deserialize(buf, len - 1) != NULL) {
+    FAIL("deserialized a truncated buffer");
+  }
+  free(buf);
+  return copy;
+}
+
+static void
+test_merge_serialize(void)
+{
+  mtev_hyperloglog_t *a = mtev_hyperloglog_alloc(14);
+  mtev_hyperloglog_t *b = mtev_hyperloglog_alloc(14);
+  mtev_hyperloglog_t *c = mtev_hyperloglog_alloc(14);
+  mtev_hyperloglog_t *other = mtev_hyperloglog_alloc(12);
+  mtev_hyperloglog_t *copy;
+
+  /* sparse into sparse */
+  add_range(a, 0, 300);
+  add_range(b, 200, 500);
+  if (mtev_hyperloglog_merge(a, b) != 0) {
+    FAIL("merge failed");
+  }
+  check_close("sparse merge", mtev_hyperloglog_size(a), 500, 0.01);
+  if (mtev_hyperloglog_merge(a, other) != -1) {
+    FAIL("merged mismatched bitcounts");
+  }
+  copy = roundtrip(a);
+  printf("sparse 500 items serialize to %zu bytes\n",
+         mtev_hyperloglog_serialized_size(a));
+  mtev_hyperloglog_destroy(copy);
+
+  /* dense into sparse and sparse into dense */
+  add_range(c, 100000, 600000);
+  if (mtev_hyperloglog_merge(a, c) != 0 || mtev_hyperloglog_merge(c, b) != 0) {
+    FAIL("merge failed");
+  }
+  check_close("dense merge", mtev_hyperloglog_size(a), 500500, 0.04);
+  check_close("dense merge", mtev_hyperloglog_size(c), 500300, 0.04);
+  copy = roundtrip(c);
+  printf("dense serialize to %zu bytes\n", mtev_hyperloglog_serialized_size(c));
+
+  /* merging dense registers is a register-wise max */
+  mtev_hrtime_t start = mtev_gethrtime();
+  for (int i = 0; i < 1000; i++) mtev_hyperloglog_merge(copy, a);
+  mtev_hrtime_t end = mtev_gethrtime();
+  printf("Dense merge took %llu nanos\n", (end - start) / 1000);
+  if (mtev_hyperloglog_size(copy) != mtev_hyperloglog_size(a)) {
+    FAIL("merge of supersets changed the estimate");
+  }
+
+  mtev_hyperloglog_destroy(copy);
+  mtev_hyperloglog_destroy(other);
+  mtev_hyperloglog_destroy(c);
+  mtev_hyperloglog_destroy(b);
+  mtev_hyperloglog_destroy(a);
+  printf("SUCCESS, merge and serialize\n");
+}
+
 int main(int argc, char **argv) 
 {
   uuid_t uuid;
@@ -67,4 +176,8 @@ int main(int argc, char **argv)
   }
 
   mtev_hyperloglog_destroy(hll);
+
+  test_range_accuracy();
+  test_merge_serialize();
+  return 0;
 }
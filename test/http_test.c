@@ -0,0 +1,546 @@
+#include <mtev_defines.h>
+#include <mtev_main.h>
+#include <mtev_conf.h>
+#include <mtev_dso.h>
+#include <mtev_listener.h>
+#include <mtev_memory.h>
+#include <mtev_http.h>
+#include <mtev_rest.h>
+#include <mtev_compress.h>
+#include <mtev_json.h>
+#include <mtev_msgpack.h>
+#include <eventer/eventer.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define APPNAME "http_test"
+
+#define FAIL(...)                           \
+  printf("** ");                            \
+  printf( __VA_ARGS__);                     \
+  printf("\n** FAILURE\n"); \
+  exit(1);
+
+static char dir[PATH_MAX], docroot[PATH_MAX], config_file[PATH_MAX];
+static unsigned short port;
+
+static const char *config_tmpl =
+"<?xml version=\"1.0\" encoding=\"utf8\" standalone=\"yes\"?>\n"
+"<" APPNAME " lockfile=\"%s/lock\">\n"
+"  <logs>\n"
+"    <console_output>\n"
+"      <outlet name=\"stderr\"/>\n"
+"      <log name=\"error\"/>\n"
+"    </console_output>\n"
+"  </logs>\n"
+"  <listeners>\n"
+"    <listener type=\"control_dispatch\" address=\"127.0.0.1\" port=\"%d\">\n"
+"      <config>\n"
+"        <document_root>%s</document_root>\n"
+"      </config>\n"
+"    </listener>\n"
+"  </listeners>\n"
+"  <rest>\n"
+"    <acl>\n"
+"      <rule type=\"allow\"/>\n"
+"    </acl>\n"
+"  </rest>\n"
+"</" APPNAME ">\n";
+
+struct response {
+  int status;
+  char head[4096];
+  char *body;
+  size_t body_len;
+};
+
+static void
+write_file(const char *name, const char *data, size_t len, time_t mtime) {
+  char path[PATH_MAX];
+  struct timeval tv[2] = { { mtime, 0 }, { mtime, 0 } };
+  int fd;
+  snprintf(path, sizeof(path), "%s/%s", docroot, name);
+  /* rewrite in place so the inode is kept */
+  fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+  if(fd < 0 || write(fd, data, len) != (ssize_t)len) {
+    FAIL("writing %s: %s", path, strerror(errno));
+  }
+  close(fd);
+  if(utimes(path, tv) != 0) {
+    FAIL("utimes %s: %s", path, strerror(errno));
+  }
+}
+
+/* Find a header value (case-insensitively) in the response head. */
+static mtev_boolean
+header(struct response *r, const char *name, char *out, size_t outlen) {
+  size_t nlen = strlen(name);
+  const char *line = strstr(r->head, "\r\n");
+  while(line && line[2] != '\r') {
+    const char *eol;
+    line += 2;
+    eol = strstr(line, "\r\n");
+    if(!eol) break;
+    if(!strncasecmp(line, name, nlen) && line[nlen] == ':') {
+      const char *v = line + nlen + 1;
+      while(*v == ' ') v++;
+      if(out) snprintf(out, outlen, "%.*s", (int)(eol - v), v);
+      return mtev_true;
+    }
+    line = eol;
+  }
+  return mtev_false;
+}
+
+static void
+request_body(const char *method, const char *path, const char *extra_headers,
+             const void *body, size_t body_len, struct response *r) {
+  struct sockaddr_in sin;
+  struct timeval tv = { 5, 0 };
+  char req[1024], *buf = NULL, *eoh;
+  size_t len = 0, allocd = 0;
+  int fd, reqlen, tries;
+  ssize_t rv;
+
+  memset(r, 0, sizeof(*r));
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons(port);
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  /* the listener may still be coming up */
+  for(tries = 0; ; tries++) {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(connect(fd, (struct sockaddr *)&sin, sizeof(sin)) == 0) break;
+    close(fd);
+    if(tries > 100) {
+      FAIL("connect to port %d: %s", port, strerror(errno));
+    }
+    usleep(50000);
+  }
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  reqlen = snprintf(req, sizeof(req),
+                    "%s %s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n%s\r\n",
+                    method, path, extra_headers ? extra_headers : "");
+  if(write(fd, req, reqlen) != reqlen) {
+    FAIL("write request: %s", strerror(errno));
+  }
+  while(body_len > 0) {
+    ssize_t w = write(fd, body, body_len);
+    if(w <= 0) {
+      FAIL("write request body: %s", strerror(errno));
+    }
+    body = (const char *)body + w;
+    body_len -= w;
+  }
+  do {
+    if(allocd - len < 4096) {
+      allocd = allocd ? allocd * 2 : 16384;
+      buf = realloc(buf, allocd);
+    }
+    rv = read(fd, buf + len, allocd - len - 1);
+    if(rv > 0) len += rv;
+  } while(rv > 0);
+  close(fd);
+  if(rv < 0) {
+    FAIL("read response for %s: %s", path, strerror(errno));
+  }
+  buf[len] = '\0';
+  eoh = strstr(buf, "\r\n\r\n");
+  if(!eoh || sscanf(buf, "HTTP/1.1 %d", &r->status) != 1) {
+    FAIL("malformed response for %s", path);
+  }
+  eoh += 2;
+  snprintf(r->head, sizeof(r->head), "%.*s", (int)(eoh - buf) + 2, buf);
+  r->body_len = len - (eoh + 2 - buf);
+  r->body = malloc(r->body_len + 1);
+  memcpy(r->body, eoh + 2, r->body_len + 1);
+  free(buf);
+}
+
+static void
+request(const char *path, const char *extra_headers, struct response *r) {
+  request_body("GET", path, extra_headers, NULL, 0, r);
+}
+
+static void
+expect_body(struct response *r, const char *what, const char *body) {
+  if(r->status != 200) {
+    FAIL("%s: status %d", what, r->status);
+  }
+  if(r->body_len != strlen(body) || memcmp(r->body, body, r->body_len)) {
+    FAIL("%s: body '%.*s' != '%s'", what, (int)r->body_len, r->body, body);
+  }
+}
+
+static void
+test_static_cache(void) {
+  struct response r;
+  char etag[128], etag2[128], hdr[256], big[8192];
+  time_t then = time(NULL) - 60;
+  int i;
+
+  write_file("a.txt", "version one", 11, then);
+  request("/a.txt", NULL, &r);
+  expect_body(&r, "initial fetch", "version one");
+  if(!header(&r, "ETag", etag, sizeof(etag))) {
+    FAIL("no ETag on cached response");
+  }
+  if(!header(&r, "Last-Modified", NULL, 0)) {
+    FAIL("no Last-Modified on cached response");
+  }
+  free(r.body);
+
+  /* Same size, inode and mtime: the filesystem check can't see the change,
+   * so a cache hit serves the original bytes. */
+  write_file("a.txt", "VERSION ONE", 11, then);
+  sleep(2);
+  request("/a.txt", NULL, &r);
+  expect_body(&r, "cache hit", "version one");
+  if(!header(&r, "ETag", etag2, sizeof(etag2)) || strcmp(etag, etag2)) {
+    FAIL("ETag changed on a cache hit");
+  }
+  free(r.body);
+
+  /* If-None-Match answers from memory with a bodiless 304 */
+  snprintf(hdr, sizeof(hdr), "If-None-Match: %s\r\n", etag);
+  request("/a.txt", hdr, &r);
+  if(r.status != 304) {
+    FAIL("If-None-Match: status %d", r.status);
+  }
+  if(r.body_len != 0) {
+    FAIL("304 carried a %zu byte body", r.body_len);
+  }
+  if(header(&r, "Content-Length", NULL, 0)) {
+    FAIL("304 carried a Content-Length");
+  }
+  if(header(&r, "Transfer-Encoding", NULL, 0)) {
+    FAIL("304 carried a Transfer-Encoding");
+  }
+  if(!header(&r, "ETag", etag2, sizeof(etag2)) || strcmp(etag, etag2)) {
+    FAIL("304 ETag mismatch");
+  }
+  free(r.body);
+
+  /* A real change is noticed once the revalidation interval passes */
+  write_file("a.txt", "version two!", 12, then + 10);
+  sleep(2);
+  request("/a.txt", NULL, &r);
+  expect_body(&r, "revalidated", "version two!");
+  if(!header(&r, "ETag", etag2, sizeof(etag2)) || !strcmp(etag, etag2)) {
+    FAIL("ETag unchanged after the file changed");
+  }
+  free(r.body);
+
+  /* and the old validator no longer matches */
+  request("/a.txt", hdr, &r);
+  expect_body(&r, "stale If-None-Match", "version two!");
+  free(r.body);
+
+  /* A compressible file is served from a gzip variant */
+  for(i=0; i<sizeof(big); i++) big[i] = 'a' + (i % 7);
+  write_file("big.txt", big, sizeof(big), then);
+  request("/big.txt", "Accept-Encoding: gzip\r\n", &r);
+  if(r.status != 200) {
+    FAIL("gzip fetch: status %d", r.status);
+  }
+  if(!header(&r, "Content-Encoding", hdr, sizeof(hdr)) || strcmp(hdr, "gzip")) {
+    FAIL("expected a gzip variant");
+  }
+  if(r.body_len == 0 || r.body_len >= sizeof(big)) {
+    FAIL("gzip variant is %zu bytes", r.body_len);
+  }
+  free(r.body);
+}
+
+static uint32_t
+fnv1a(const unsigned char *p, size_t len) {
+  uint32_t h = 2166136261u;
+  while(len--) h = (h ^ *p++) * 16777619u;
+  return h;
+}
+
+/* Uploads are written to a file with rest_upload_to_fd (spliced when the
+ * body is plain) and answered with the size and hash of what landed. */
+struct upload {
+  int fd;
+};
+
+static void
+upload_free(void *vu) {
+  struct upload *u = vu;
+  if(u->fd >= 0) close(u->fd);
+  free(u);
+}
+
+static int
+upload_handler(mtev_http_rest_closure_t *restc, int npats, char **pats) {
+  mtev_http_session_ctx *ctx = restc->http_ctx;
+  struct upload *u = restc->call_closure;
+  int mask, complete = 0;
+  char path[PATH_MAX], answer[64];
+  unsigned char *data;
+  struct stat st;
+
+  if(!u) {
+    snprintf(path, sizeof(path), "%s/upload.XXXXXX", dir);
+    u = calloc(1, sizeof(*u));
+    u->fd = mkstemp(path);
+    unlink(path);
+    restc->call_closure = u;
+    restc->call_closure_free = upload_free;
+    if(u->fd < 0) goto error;
+  }
+  if(!rest_upload_to_fd(restc, &mask, &complete, u->fd)) goto error;
+  if(!complete) return mask;
+
+  if(fstat(u->fd, &st) != 0) goto error;
+  data = malloc(st.st_size + 1);
+  if(pread(u->fd, data, st.st_size, 0) != st.st_size) {
+    free(data);
+    goto error;
+  }
+  snprintf(answer, sizeof(answer), "%zu %08x", (size_t)st.st_size,
+           fnv1a(data, st.st_size));
+  free(data);
+  mtev_http_response_ok(ctx, "text/plain");
+  mtev_http_response_append_str(ctx, answer);
+  mtev_http_response_end(ctx);
+  return 0;
+
+ error:
+  mtev_http_response_server_error(ctx, "text/plain");
+  mtev_http_response_end(ctx);
+  return 0;
+}
+
+static void
+expect_upload(struct response *r, const char *what, const unsigned char *body,
+              size_t len) {
+  char answer[64];
+  snprintf(answer, sizeof(answer), "%zu %08x", len, fnv1a(body, len));
+  expect_body(r, what, answer);
+}
+
+static void
+test_upload_to_fd(void) {
+  struct response r;
+  size_t len = 3 * 1024 * 1024 + 17, clen = 0, off, chunked_len = 0;
+  unsigned char *body = malloc(len), *comp = NULL;
+  char *chunked, hdr[128];
+  int i;
+
+  for(i=0; i<len; i++) body[i] = (i % 251) ^ (i >> 13);
+
+  /* plain Content-Length body over a plain socket: the splice path */
+  snprintf(hdr, sizeof(hdr), "Content-Length: %zu\r\n", len);
+  request_body("PUT", "/upload", hdr, body, len, &r);
+  expect_upload(&r, "spliced upload", body, len);
+  free(r.body);
+
+  /* a small one, likely already read along with the headers */
+  snprintf(hdr, sizeof(hdr), "Content-Length: %d\r\n", 100);
+  request_body("PUT", "/upload", hdr, body, 100, &r);
+  expect_upload(&r, "small spliced upload", body, 100);
+  free(r.body);
+
+  /* chunked bodies fall back to streaming */
+  chunked = malloc(len + len / 1000 * 16 + 64);
+  for(off = 0; off < len; ) {
+    size_t n = MIN(len - off, 1000 + (off % 3000));
+    chunked_len += sprintf(chunked + chunked_len, "%zx\r\n", n);
+    memcpy(chunked + chunked_len, body + off, n);
+    chunked_len += n;
+    memcpy(chunked + chunked_len, "\r\n", 2);
+    chunked_len += 2;
+    off += n;
+  }
+  memcpy(chunked + chunked_len, "0\r\n\r\n", 5);
+  chunked_len += 5;
+  request_body("PUT", "/upload", "Transfer-Encoding: chunked\r\n",
+               chunked, chunked_len, &r);
+  expect_upload(&r, "chunked upload", body, len);
+  free(r.body);
+  free(chunked);
+
+  /* so do compressed ones, which land decompressed */
+  if(mtev_compress_gzip((const char *)body, len, &comp, &clen) != 0) {
+    FAIL("gzip upload body");
+  }
+  snprintf(hdr, sizeof(hdr), "Content-Encoding: gzip\r\nContent-Length: %zu\r\n", clen);
+  request_body("PUT", "/upload", hdr, comp, clen, &r);
+  expect_upload(&r, "gzip upload", body, len);
+  free(r.body);
+  free(comp);
+  free(body);
+}
+
+/* Answers with the type mtev_http_request_negotiate picks among three,
+ * or "none"; the same Accept header also drives mtev_http_response_json
+ * on ?json. */
+static int
+negotiate_handler(mtev_http_rest_closure_t *restc, int npats, char **pats) {
+  static const char *types[] = { "text/html", "application/json", "text/plain" };
+  mtev_http_session_ctx *ctx = restc->http_ctx;
+  mtev_http_request *req = mtev_http_session_request(ctx);
+  const char *chosen;
+
+  if(mtev_http_request_querystring(req, "json")) {
+    struct mtev_json_object *doc = mtev_json_object_new_object();
+    mtev_json_object_object_add(doc, "ok", mtev_json_object_new_boolean(1));
+    mtev_http_response_json(ctx, 200, "OK", doc);
+    mtev_json_object_put(doc);
+    mtev_http_response_end(ctx);
+    return 0;
+  }
+  chosen = mtev_http_request_negotiate(req, types, 3);
+  mtev_http_response_ok(ctx, "text/plain");
+  mtev_http_response_append_str(ctx, chosen ? chosen : "none");
+  mtev_http_response_end(ctx);
+  return 0;
+}
+
+static void
+expect_negotiated(const char *accept, const char *expected) {
+  struct response r;
+  char hdr[512];
+  if(accept) snprintf(hdr, sizeof(hdr), "Accept: %s\r\n", accept);
+  request("/negotiate", accept ? hdr : NULL, &r);
+  expect_body(&r, accept ? accept : "no Accept", expected);
+  free(r.body);
+}
+
+static void
+test_negotiate(void) {
+  struct response r;
+  char type[128];
+
+  /* no header, or an empty one: the first type */
+  expect_negotiated(NULL, "text/html");
+  expect_negotiated("", "text/html");
+  /* plain matches, case-insensitively */
+  expect_negotiated("application/json", "application/json");
+  expect_negotiated("TEXT/Plain", "text/plain");
+  /* q-values pick the winner; equal q goes to the earlier type */
+  expect_negotiated("text/html;q=0.2, application/json;q=0.9, text/plain;q=0.5",
+                    "application/json");
+  expect_negotiated("text/plain, application/json", "application/json");
+  expect_negotiated("text/*", "text/html");
+  expect_negotiated("text/*;q=0.5, text/plain", "text/plain");
+  expect_negotiated("*/*", "text/html");
+  /* the most specific range decides a type's quality, not the best q */
+  expect_negotiated("*/*;q=1, text/html;q=0.1, application/json;q=0.5",
+                    "text/plain");
+  expect_negotiated("text/*;q=0.8, text/html;q=0.1", "text/plain");
+  expect_negotiated("text/*;q=0.3, */*;q=0.9", "application/json");
+  /* q=0 means "not acceptable", with or without whitespace */
+  expect_negotiated("text/html; q=0, */*;q=0.1", "application/json");
+  expect_negotiated("*/*;q=0", "none");
+  expect_negotiated("image/png, application/xml", "none");
+  /* a range that only shares a prefix is no match */
+  expect_negotiated("application/jsonx, text/htm", "none");
+
+  /* mtev_http_response_json follows the same choice */
+  request("/negotiate?json=1", "Accept: application/msgpack\r\n", &r);
+  if(r.status != 200 || !header(&r, "Content-Type", type, sizeof(type)) ||
+     strcmp(type, MTEV_MSGPACK_CONTENT_TYPE)) {
+    FAIL("msgpack negotiation: %d %s", r.status, type);
+  }
+  free(r.body);
+  request("/negotiate?json=1", "Accept: image/png\r\n", &r);
+  if(r.status != 200 || !header(&r, "Content-Type", type, sizeof(type)) ||
+     strncmp(type, "application/json", strlen("application/json"))) {
+    FAIL("json fallback: %d %s", r.status, type);
+  }
+  free(r.body);
+}
+
+static void *
+client_main(void *unused) {
+  (void)unused;
+  test_static_cache();
+  test_upload_to_fd();
+  test_negotiate();
+  printf("SUCCESS\n");
+  exit(0);
+  return NULL;
+}
+
+static int
+child_main(void) {
+  pthread_t tid;
+  if(mtev_conf_load(NULL) == -1) {
+    FAIL("cannot load config: %s", config_file);
+  }
+  eventer_init();
+  mtev_http_rest_init();
+  mtev_listener_init(APPNAME);
+  mtev_dso_init();
+  mtev_dso_post_init();
+  mtev_http_rest_register("PUT", "/", "^upload$", upload_handler);
+  mtev_http_rest_register("GET", "/", "^negotiate$", negotiate_handler);
+  mtev_http_rest_register("GET", "/", "^(.*)$", mtev_rest_simple_file_handler);
+  pthread_create(&tid, NULL, client_main, NULL);
+  eventer_loop();
+  return 0;
+}
+
+/* Ask the kernel for a port nobody is using. */
+static unsigned short
+free_port(void) {
+  struct sockaddr_in sin;
+  socklen_t slen = sizeof(sin);
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if(bind(fd, (struct sockaddr *)&sin, sizeof(sin)) != 0 ||
+     getsockname(fd, (struct sockaddr *)&sin, &slen) != 0) {
+    FAIL("finding a free port: %s", strerror(errno));
+  }
+  close(fd);
+  return ntohs(sin.sin_port);
+}
+
+int main(int argc, char **argv)
+{
+  FILE *fp;
+
+  char tmpl[] = "/tmp/http_test.XXXXXX";
+
+  /* document_root is compared against resolved paths */
+  if(!mkdtemp(tmpl) || !realpath(tmpl, dir)) {
+    FAIL("mkdtemp: %s", strerror(errno));
+  }
+  snprintf(docroot, sizeof(docroot), "%s/docroot", dir);
+  snprintf(config_file, sizeof(config_file), "%s/" APPNAME ".conf", dir);
+  if(mkdir(docroot, 0755) != 0) {
+    FAIL("mkdir: %s", strerror(errno));
+  }
+  port = free_port();
+  fp = fopen(config_file, "w");
+  if(!fp) {
+    FAIL("fopen: %s", strerror(errno));
+  }
+  fprintf(fp, config_tmpl, dir, port, docroot);
+  fclose(fp);
+
+  /* don't hang the suite if the server wedges */
+  alarm(60);
+  mtev_memory_init();
+  mtev_main(APPNAME, config_file, 0, 1, MTEV_LOCK_OP_NONE, NULL, NULL, NULL,
+            child_main);
+  return 1;
+}
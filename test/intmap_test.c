@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <pthread.h>
+#include <mtev_defines.h>
+#include <mtev_intmap.h>
+#include <mtev_hash.h>
+#include <mtev_time.h>
+
+#define NKEYS 100000
+
+static int freed;
+static void count_free(void *v) { (void)v; __sync_fetch_and_add(&freed, 1); }
+
+static void test_u64(void) {
+  mtev_u64map_t *m = mtev_u64map_create(0);
+  mtev_intmap_iter_t iter = MTEV_INTMAP_ITER_ZERO;
+  uint64_t i, k, sum = 0;
+  void *v, *old;
+  size_t n = 0;
+
+  for(i = 0; i < NKEYS; i++) assert(mtev_u64map_put(m, i * 7919, (void *)(uintptr_t)(i + 1)));
+  assert(!mtev_u64map_put(m, 7919, NULL));
+  assert(mtev_u64map_size(m) == NKEYS);
+  for(i = 0; i < NKEYS; i++) {
+    assert(mtev_u64map_get(m, i * 7919, &v));
+    assert((uintptr_t)v == i + 1);
+  }
+  assert(!mtev_u64map_get(m, 1, &v));
+  /* deletes leave markers; keep churning to force same-size rebuilds */
+  for(i = 0; i < NKEYS; i += 2) assert(mtev_u64map_delete(m, i * 7919, NULL));
+  assert(!mtev_u64map_delete(m, 0, NULL));
+  for(i = 0; i < NKEYS; i += 2) assert(mtev_u64map_put(m, i * 7919, (void *)(uintptr_t)(i + 1)));
+  assert(mtev_u64map_size(m) == NKEYS);
+  assert(mtev_u64map_set(m, 0, (void *)42, &old) && (uintptr_t)old == 1);
+  assert(!mtev_u64map_set(m, UINT64_MAX, (void *)43, &old) && old == NULL);
+  while(mtev_u64map_next(m, &iter, &k, &v)) {
+    n++;
+    sum += (uintptr_t)v;
+  }
+  assert(n == NKEYS + 1);
+  assert(sum == (uint64_t)NKEYS * (NKEYS + 1) / 2 - 1 + 42 + 43);
+  mtev_u64map_destroy(m, NULL);
+}
+
+static void test_ptr_uuid(void) {
+  mtev_ptrmap_t *pm = mtev_ptrmap_create(16);
+  mtev_uuidmap_t *um = mtev_uuidmap_create(16);
+  mtev_intmap_iter_t iter = MTEV_INTMAP_ITER_ZERO;
+  uuid_t ids[1000], id;
+  const void *pk;
+  void *v;
+  int i, n = 0;
+
+  for(i = 0; i < 1000; i++) {
+    uuid_generate(ids[i]);
+    assert(mtev_uuidmap_put(um, ids[i], &ids[i]));
+    assert(mtev_ptrmap_put(pm, &ids[i], ids[i]));
+  }
+  for(i = 0; i < 1000; i++) {
+    assert(mtev_uuidmap_get(um, ids[i], &v) && v == &ids[i]);
+    assert(mtev_ptrmap_get(pm, &ids[i], &v) && v == ids[i]);
+  }
+  /* uuids differing only in the second half are distinct keys */
+  memcpy(id, ids[0], sizeof(uuid_t));
+  id[15] ^= 1;
+  assert(!mtev_uuidmap_get(um, id, NULL));
+  while(mtev_uuidmap_next(um, &iter, id, &v)) {
+    assert(!memcmp(id, v, sizeof(uuid_t)));
+    n++;
+  }
+  assert(n == 1000);
+  memset(&iter, 0, sizeof(iter));
+  n = 0;
+  while(mtev_ptrmap_next(pm, &iter, &pk, &v)) {
+    assert(pk == (const void *)v);
+    n++;
+  }
+  assert(n == 1000);
+  freed = 0;
+  for(i = 0; i < 500; i++) assert(mtev_uuidmap_delete(um, ids[i], NULL));
+  assert(mtev_uuidmap_size(um) == 500);
+  mtev_uuidmap_destroy(um, count_free);
+  assert(freed == 500);
+  mtev_ptrmap_destroy(pm, NULL);
+}
+
+/* readers run against a writer that keeps inserting and deleting */
+static mtev_u64map_t *shared;
+static volatile int stop;
+
+static void *reader(void *unused) {
+  void *v;
+  uint64_t i = 0;
+  (void)unused;
+  while(!stop) {
+    /* even keys are never deleted */
+    uint64_t k = (i++ % 1000) * 2;
+    if(!mtev_u64map_get(shared, k, &v) || (uintptr_t)v != k + 1) {
+      printf("reader lost key %llu\n", (unsigned long long)k);
+      abort();
+    }
+  }
+  return NULL;
+}
+
+static void test_concurrent(void) {
+  pthread_t tids[4];
+  uint64_t i, round;
+  shared = mtev_u64map_create(0);
+  for(i = 0; i < 1000; i++) mtev_u64map_put(shared, i * 2, (void *)(uintptr_t)(i * 2 + 1));
+  for(i = 0; i < 4; i++) pthread_create(&tids[i], NULL, reader, NULL);
+  for(round = 0; round < 50; round++) {
+    for(i = 0; i < 2000; i++) mtev_u64map_put(shared, i * 2 + 1, malloc(8));
+    for(i = 0; i < 2000; i++) mtev_u64map_delete(shared, i * 2 + 1, free);
+  }
+  stop = 1;
+  for(i = 0; i < 4; i++) pthread_join(tids[i], NULL);
+  assert(mtev_u64map_size(shared) == 1000);
+  mtev_u64map_destroy(shared, NULL);
+}
+
+#define BENCH_KEYS 10000
+#define BENCH_LOOKUPS 10000000
+
+static void bench(void) {
+  mtev_u64map_t *m = mtev_u64map_create(BENCH_KEYS);
+  mtev_hash_table h;
+  uint64_t *keys = malloc(sizeof(*keys) * BENCH_KEYS);
+  uint64_t i, found = 0;
+  mtev_hrtime_t start;
+  void *v;
+
+  mtev_hash_init_locks(&h, BENCH_KEYS, MTEV_HASH_LOCK_MODE_MUTEX);
+  for(i = 0; i < BENCH_KEYS; i++) {
+    keys[i] = i * 0x9e3779b97f4a7c15ULL;
+    mtev_u64map_put(m, keys[i], &keys[i]);
+    mtev_hash_store(&h, (const char *)&keys[i], sizeof(keys[i]), &keys[i]);
+  }
+
+  start = mtev_gethrtime();
+  for(i = 0; i < BENCH_LOOKUPS; i++)
+    found += mtev_hash_retrieve(&h, (const char *)&keys[i % BENCH_KEYS], sizeof(uint64_t), &v);
+  printf("mtev_hash   %6.1f ns/lookup\n", (double)(mtev_gethrtime() - start) / BENCH_LOOKUPS);
+
+  start = mtev_gethrtime();
+  for(i = 0; i < BENCH_LOOKUPS; i++)
+    found += mtev_u64map_get(m, keys[i % BENCH_KEYS], &v);
+  printf("mtev_u64map %6.1f ns/lookup\n", (double)(mtev_gethrtime() - start) / BENCH_LOOKUPS);
+
+  assert(found == 2 * BENCH_LOOKUPS);
+  mtev_hash_destroy(&h, NULL, NULL);
+  mtev_u64map_destroy(m, NULL);
+  free(keys);
+}
+
+int main() {
+  test_u64();
+  test_ptr_uuid();
+  test_concurrent();
+  bench();
+  printf("SUCCESS\n");
+  return 0;
+}
@@ -0,0 +1,604 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include <mtev_json.h>
+#include <mtev_printbuf.h>
+#include <mtev_json_ondemand.h>
+#include <mtev_time.h>
+
+#define FAIL(...)                           \
+  printf("** ");                            \
+  printf( __VA_ARGS__);                     \
+  printf("\n** FAILURE\n"); \
+  exit(1);
+
+static uint64_t
+rand64(void) {
+  return ((uint64_t)rand() << 62) ^ ((uint64_t)rand() << 31) ^ (uint64_t)rand();
+}
+
+static void
+test_integers(void) {
+  static const int64_t fixed[] = { 0, 1, -1, 9, 10, 99, 100, INT_MIN, INT_MAX,
+                                   INT64_MIN, INT64_MAX, 1000000000000000000LL };
+  char buf[JL_FORMAT_NUMBER_MAX], ref[64];
+  int i, len;
+
+  for(i = 0; i < (int)(sizeof(fixed)/sizeof(*fixed)); i++) {
+    len = jl_format_int64(buf, fixed[i]);
+    snprintf(ref, sizeof(ref), "%" PRId64, fixed[i]);
+    if(len != (int)strlen(ref) || strcmp(buf, ref)) {
+      FAIL("int64 %s formatted as %s", ref, buf);
+    }
+  }
+  len = jl_format_uint64(buf, UINT64_MAX);
+  if(len != 20 || strcmp(buf, "18446744073709551615")) {
+    FAIL("uint64 max formatted as %s", buf);
+  }
+  for(i = 0; i < 1000000; i++) {
+    uint64_t v = rand64() >> (rand() % 64);
+    len = jl_format_uint64(buf, v);
+    snprintf(ref, sizeof(ref), "%" PRIu64, v);
+    if(len != (int)strlen(ref) || strcmp(buf, ref)) {
+      FAIL("uint64 %s formatted as %s", ref, buf);
+    }
+  }
+}
+
+static int
+shortest_digits(double v) {
+  char ref[64];
+  int p;
+  for(p = 1; p < 17; p++) {
+    snprintf(ref, sizeof(ref), "%.*e", p - 1, v);
+    if(strtod(ref, NULL) == v) break;
+  }
+  return p;
+}
+
+static int
+output_digits(const char *s) {
+  int n = 0, lead = 1;
+  const char *last = NULL;
+  for(; *s && *s != 'e'; s++) {
+    if(*s < '0' || *s > '9') continue;
+    if(lead && *s == '0') continue;
+    lead = 0;
+    n++;
+    if(*s != '0') last = s;
+  }
+  /* trailing zeros of an integer part are not significant digits */
+  if(last) {
+    for(s = last + 1; *s && *s != 'e'; s++) if(*s >= '0' && *s <= '9') n--;
+  }
+  return n ? n : 1;
+}
+
+static void
+test_doubles(void) {
+  static const struct { double v; const char *s; } fixed[] = {
+    { 0.0, "0.0" }, { -0.0, "-0.0" }, { 1.0, "1.0" }, { -2.5, "-2.5" },
+    { 0.1, "0.1" }, { 1.0/3, "0.3333333333333333" }, { 123.456, "123.456" },
+    { 1e20, "100000000000000000000.0" }, { 1e21, "1e21" },
+    { 1.5e-7, "1.5e-7" }, { 0.000001, "0.000001" }, { 1e30, "1e30" },
+    { 5e-324, "5e-324" }, { 1.7976931348623157e308, "1.7976931348623157e308" },
+    { 2.2250738585072014e-308, "2.2250738585072014e-308" },
+  };
+  char buf[JL_FORMAT_NUMBER_MAX];
+  int i, len, longer = 0;
+
+  for(i = 0; i < (int)(sizeof(fixed)/sizeof(*fixed)); i++) {
+    len = jl_format_double(buf, fixed[i].v);
+    if(len != (int)strlen(fixed[i].s) || strcmp(buf, fixed[i].s)) {
+      FAIL("double %s formatted as %s", fixed[i].s, buf);
+    }
+  }
+  for(i = 0; i < 2000000; i++) {
+    uint64_t bits = rand64();
+    double v, back;
+    memcpy(&v, &bits, sizeof(v));
+    if(isnan(v) || isinf(v)) continue;
+    if(i & 1) v = (double)(rand64() >> (rand() % 64)) / (1 << (rand() % 20));
+    len = jl_format_double(buf, v);
+    if(len >= JL_FORMAT_NUMBER_MAX || len != (int)strlen(buf)) {
+      FAIL("double %.17g bad length %d", v, len);
+    }
+    if(!strchr(buf, '.') && !strchr(buf, 'e')) {
+      FAIL("double %.17g formatted as integer %s", v, buf);
+    }
+    back = strtod(buf, NULL);
+    if(memcmp(&back, &v, sizeof(v))) {
+      FAIL("double %.17g formatted as %s reads back as %.17g", v, buf, back);
+    }
+    if(output_digits(buf) > shortest_digits(v)) longer++;
+  }
+  /* Grisu2 is shortest in all but a small fraction of cases */
+  if(longer > 20000) {
+    FAIL("%d of 2000000 doubles not formatted shortest", longer);
+  }
+}
+
+static int
+collect(void *closure, const char *buf, int len) {
+  struct jl_printbuf *pb = closure;
+  if(len <= 0) return -1;
+  jl_printbuf_memappend(pb, buf, len);
+  return len;
+}
+
+static int
+fail_after(void *closure, const char *buf, int len) {
+  int *budget = closure;
+  (void)buf;
+  if(--(*budget) < 0) return -1;
+  return len;
+}
+
+static void
+test_serialize(void) {
+  struct mtev_json_object *doc, *arr, *parsed;
+  struct jl_printbuf *pb;
+  char raw[64], big[40000];
+  const char *str;
+  int i, budget;
+
+  doc = mtev_json_object_new_object();
+  for(i = 0; i < 63; i++) raw[i] = i + 1;
+  raw[63] = '\0';
+  mtev_json_object_object_add(doc, "ctl", mtev_json_object_new_string(raw));
+  mtev_json_object_object_add(doc, "t", mtev_json_object_new_boolean(1));
+  mtev_json_object_object_add(doc, "n", NULL);
+  mtev_json_object_object_add(doc, "d", mtev_json_object_new_double(0.5));
+  mtev_json_object_object_add(doc, "i", mtev_json_object_new_int(-42));
+  mtev_json_object_object_add(doc, "u", mtev_json_object_new_uint64(UINT64_MAX));
+  str = mtev_json_object_to_json_string(doc);
+  if(strcmp(str, "{ \"ctl\": \"\\u0001\\u0002\\u0003\\u0004\\u0005\\u0006\\u0007"
+                 "\\b\\t\\n\\u000b\\u000c\\r\\u000e\\u000f\\u0010\\u0011\\u0012"
+                 "\\u0013\\u0014\\u0015\\u0016\\u0017\\u0018\\u0019\\u001a\\u001b"
+                 "\\u001c\\u001d\\u001e\\u001f !\\\"#$%&'()*+,-.\\/0123456789:;<=>?\", "
+                 "\"t\": true, \"n\": null, \"d\": 0.5, \"i\": -42, "
+                 "\"u\": 18446744073709551615 }")) {
+    FAIL("unexpected serialization: %s", str);
+  }
+  parsed = mtev_json_tokener_parse(str);
+  if(!parsed || strcmp(mtev_json_object_get_string(mtev_json_object_object_get(parsed, "ctl")), raw)) {
+    FAIL("escaped string did not round-trip");
+  }
+  mtev_json_object_put(parsed);
+
+  /* a document larger than the stream window, with a string that can
+   * never fit in it, must stream to exactly the same bytes */
+  arr = mtev_json_object_new_array();
+  for(i = 0; i < 5000; i++) {
+    mtev_json_object_array_add(arr, mtev_json_object_new_double(i * 1.25));
+  }
+  memset(big, 'x', sizeof(big) - 1);
+  big[sizeof(big) - 1] = '\0';
+  big[100] = '"';
+  mtev_json_object_array_add(arr, mtev_json_object_new_string(big));
+  mtev_json_object_object_add(doc, "arr", arr);
+  str = mtev_json_object_to_json_string(doc);
+
+  pb = jl_printbuf_new();
+  if(mtev_json_object_to_json_stream(doc, collect, pb) != 0) {
+    FAIL("stream failed");
+  }
+  if(pb->bpos != (int)strlen(str) || memcmp(pb->buf, str, pb->bpos)) {
+    FAIL("streamed output differs from string output");
+  }
+  jl_printbuf_free(pb);
+
+  budget = 1;
+  if(mtev_json_object_to_json_stream(doc, fail_after, &budget) != -1) {
+    FAIL("stream did not report writer failure");
+  }
+  mtev_json_object_put(doc);
+}
+
+
+/* random documents, written out by hand so they contain the spellings a
+ * serializer never produces: escapes, exponents, odd whitespace */
+static void
+gen_ws(struct jl_printbuf *pb) {
+  static const char *ws[] = { "", "", "", " ", "\n", "\t ", "\r\n  " };
+  const char *w = ws[rand() % 7];
+  jl_printbuf_memappend(pb, w, strlen(w));
+}
+
+static void
+gen_string(struct jl_printbuf *pb) {
+  static const char *pieces[] = { "a", "bc", "\\\\", "\\\"", "\\/", "\\n", "\\t",
+    "\\u0041", "\\u00e9", "\\u20ac", "\\\\\\\\", "\\\\\\\"", "x\\\\", "{", "}",
+    "[", "]", ":", ",", " ", "\xc3\xa9", "\\b\\r", "0", "true" };
+  int i, n = rand() % 8;
+  jl_printbuf_memappend(pb, "\"", 1);
+  for(i = 0; i < n; i++) {
+    const char *p = pieces[rand() % (sizeof(pieces)/sizeof(*pieces))];
+    jl_printbuf_memappend(pb, p, strlen(p));
+  }
+  jl_printbuf_memappend(pb, "\"", 1);
+}
+
+static void
+gen_value(struct jl_printbuf *pb, int depth) {
+  static const char *nums[] = { "0", "-0", "1", "-17", "123456789", "2147483647",
+    "-2147483648", "2147483648", "-2147483649", "9223372036854775807",
+    "-9223372036854775808", "0.5", "-1.25", "3.14159", "1e10", "1e-7",
+    "6.02214076e23", "-2.5e+3", "0.000001", "123456789012345678.9",
+    "1.7976931348623157e308", "4.9e-324", "0.1", "100" };
+  int i, n, r = rand() % (depth > 6 ? 4 : 7);
+  switch(r) {
+  case 0: jl_printbuf_memappend(pb, "true", 4); break;
+  case 1: jl_printbuf_memappend(pb, "false", 5); break;
+  case 2: {
+    const char *num = nums[rand() % (sizeof(nums)/sizeof(*nums))];
+    jl_printbuf_memappend(pb, num, strlen(num));
+    break;
+  }
+  case 3: gen_string(pb); break;
+  case 4: jl_printbuf_memappend(pb, "null", 4); break;
+  case 5:
+    n = rand() % 6;
+    jl_printbuf_memappend(pb, "[", 1);
+    for(i = 0; i < n; i++) {
+      if(i) jl_printbuf_memappend(pb, ",", 1);
+      gen_ws(pb);
+      gen_value(pb, depth + 1);
+      gen_ws(pb);
+    }
+    jl_printbuf_memappend(pb, "]", 1);
+    break;
+  default:
+    n = rand() % 6;
+    jl_printbuf_memappend(pb, "{", 1);
+    for(i = 0; i < n; i++) {
+      char key[16];
+      if(i) jl_printbuf_memappend(pb, ",", 1);
+      gen_ws(pb);
+      snprintf(key, sizeof(key), "\"k%d\"", rand() % 8);
+      jl_printbuf_memappend(pb, key, strlen(key));
+      gen_ws(pb);
+      jl_printbuf_memappend(pb, ":", 1);
+      gen_ws(pb);
+      gen_value(pb, depth + 1);
+    }
+    gen_ws(pb);
+    jl_printbuf_memappend(pb, "}", 1);
+    break;
+  }
+}
+
+static void
+test_ondemand_differential(void) {
+  int iter;
+  for(iter = 0; iter < 20000; iter++) {
+    struct jl_printbuf *pb = jl_printbuf_new();
+    struct mtev_json_object *expect, *got;
+    struct mtev_json_tokener *tok;
+    mtev_json_doc_t *doc;
+    const char *err;
+    char *estr;
+    size_t off;
+
+    gen_ws(pb);
+    gen_value(pb, iter % 3 ? 0 : 5);
+    gen_ws(pb);
+    tok = mtev_json_tokener_new();
+    expect = mtev_json_tokener_parse_ex(tok, pb->buf, pb->bpos + 1);
+    if(tok->err != mtev_json_tokener_success) {
+      FAIL("tokener rejected %s: %s", pb->buf, mtev_json_tokener_errors[tok->err]);
+    }
+    mtev_json_tokener_free(tok);
+    doc = mtev_json_doc_parse(pb->buf, pb->bpos, 0, &err, &off);
+    if(!doc) {
+      FAIL("ondemand rejected %s: %s at %zu", pb->buf, err, off);
+    }
+    if(!mtev_json_value_to_object(mtev_json_doc_root(doc), &got)) {
+      FAIL("ondemand could not convert %s", pb->buf);
+    }
+    estr = strdup(mtev_json_object_to_json_string(expect));
+    if(strcmp(estr, mtev_json_object_to_json_string(got))) {
+      FAIL("ondemand parsed %s\n   as %s\n   expected %s", pb->buf,
+           mtev_json_object_to_json_string(got), estr);
+    }
+    free(estr);
+    if(expect) mtev_json_object_put(expect);
+    if(got) mtev_json_object_put(got);
+    mtev_json_doc_free(doc);
+    jl_printbuf_free(pb);
+  }
+}
+
+static void
+test_ondemand_validation(void) {
+  static const char *bad[] = { "", "  ", "[", "]", "[1,]", "[,1]", "{\"a\" 1}",
+    "{\"a\":1,}", "{\"a\"}", "{1:2}", "[1 2]", "tru", "truex", "nul", "01", "1.",
+    ".5", "-", "1e", "+1", "\"abc", "[}", "{]", "{} {}", "[\"a\\\"]", "[1]x",
+    "{\"a\":}", "[:]", "\\\"a\"", "NaN", "[1,,2]", "\"\\\\\\\"" };
+  static const char *good[] = { "1", " 1 ", "\"\"", "[]", "{}", "[[[[]]]]",
+    "-0", "1e5", "1E-5", "\"a\\\\\"", "[\"\\\\\",\"\\\"\"]", "{\"\":null}",
+    "\"\\\\\\\\\\\"\"", "[true,false,null]" };
+  char deep[MTEV_JSON_DOC_MAX_DEPTH * 2 + 4];
+  mtev_json_doc_t *doc;
+  size_t i;
+
+  for(i = 0; i < sizeof(bad)/sizeof(*bad); i++) {
+    if((doc = mtev_json_doc_parse(bad[i], strlen(bad[i]), 0, NULL, NULL)) != NULL) {
+      FAIL("ondemand accepted invalid '%s'", bad[i]);
+    }
+  }
+  for(i = 0; i < sizeof(good)/sizeof(*good); i++) {
+    if((doc = mtev_json_doc_parse(good[i], strlen(good[i]), 0, NULL, NULL)) == NULL) {
+      FAIL("ondemand rejected valid '%s'", good[i]);
+    }
+    mtev_json_doc_free(doc);
+  }
+  memset(deep, '[', MTEV_JSON_DOC_MAX_DEPTH);
+  memset(deep + MTEV_JSON_DOC_MAX_DEPTH, ']', MTEV_JSON_DOC_MAX_DEPTH);
+  if(!(doc = mtev_json_doc_parse(deep, MTEV_JSON_DOC_MAX_DEPTH * 2, 0, NULL, NULL))) {
+    FAIL("ondemand rejected maximum depth");
+  }
+  mtev_json_doc_free(doc);
+  memset(deep, '[', MTEV_JSON_DOC_MAX_DEPTH + 1);
+  memset(deep + MTEV_JSON_DOC_MAX_DEPTH + 1, ']', MTEV_JSON_DOC_MAX_DEPTH + 1);
+  if(mtev_json_doc_parse(deep, MTEV_JSON_DOC_MAX_DEPTH * 2 + 2, 0, NULL, NULL)) {
+    FAIL("ondemand accepted excessive depth");
+  }
+}
+
+static void
+test_ondemand_cursor(void) {
+  const char *text =
+    "{ \"name\": \"caf\\u00e9 \\ud83d\\ude00\", \"a.b\": 1,\n"
+    "  \"checks\": [ { \"id\": 1, \"metrics\": { \"duration\": 12.5 } },\n"
+    "                { \"id\": -9223372036854775808, \"big\": 18446744073709551615 } ],\n"
+    "  \"flag\": false, \"nothing\": null, \"exp\": -2.5E-7, \"esc\\\"key\": \"v\", \"dup\": 1, \"dup\": 2 }";
+  char *copy = strdup(text);
+  mtev_json_doc_t *doc = mtev_json_doc_parse(copy, strlen(copy), MTEV_JSON_DOC_COPY, NULL, NULL);
+  mtev_json_value_t root, v, key, val;
+  mtev_json_iter_t it;
+  const mtev_json_node_t *n;
+  mtev_json_node_t *dom;
+  mtev_boolean b;
+  int64_t i64;
+  uint64_t u64;
+  double d;
+  const char *s;
+  size_t len;
+  int cnt = 0;
+
+  if(!doc) {
+    FAIL("ondemand rejected cursor document");
+  }
+  memset(copy, ' ', strlen(copy)); /* the document holds its own copy */
+  free(copy);
+  root = mtev_json_doc_root(doc);
+  if(mtev_json_value_type(root) != mtev_json_type_object || mtev_json_value_length(root) != 9) {
+    FAIL("bad root");
+  }
+  s = mtev_json_value_string(mtev_json_value_get(root, "name"), &len);
+  if(!s || len != 10 || strcmp(s, "caf\xc3\xa9 \xf0\x9f\x98\x80")) {
+    FAIL("bad unescaped string");
+  }
+  v = mtev_json_value_path(root, "checks[0].metrics.duration");
+  if(mtev_json_value_type(v) != mtev_json_type_double || !mtev_json_value_double(v, &d) || d != 12.5) {
+    FAIL("bad path lookup");
+  }
+  v = mtev_json_value_path(root, "checks[1].id");
+  if(!mtev_json_value_int64(v, &i64) || i64 != INT64_MIN || mtev_json_value_uint64(v, &u64)) {
+    FAIL("bad int64");
+  }
+  v = mtev_json_value_path(root, "checks[1].big");
+  if(mtev_json_value_int64(v, &i64) || !mtev_json_value_uint64(v, &u64) || u64 != UINT64_MAX) {
+    FAIL("bad uint64");
+  }
+  if(mtev_json_value_exists(mtev_json_value_path(root, "checks[2]")) ||
+     mtev_json_value_exists(mtev_json_value_path(root, "missing.x")) ||
+     mtev_json_value_exists(mtev_json_value_get(root, "a.b")) == mtev_false) {
+    FAIL("bad missing lookups");
+  }
+  if(mtev_json_value_type(mtev_json_value_get(root, "exp")) != mtev_json_type_double ||
+     !mtev_json_value_double(mtev_json_value_get(root, "exp"), &d) || d != -2.5e-7) {
+    FAIL("bad exponent");
+  }
+  if(!mtev_json_value_boolean(mtev_json_value_get(root, "flag"), &b) || b) {
+    FAIL("bad boolean");
+  }
+  if(mtev_json_value_type(mtev_json_value_get(root, "nothing")) != mtev_json_type_null ||
+     !mtev_json_value_exists(mtev_json_value_get(root, "nothing"))) {
+    FAIL("bad null");
+  }
+  if(!mtev_json_value_exists(mtev_json_value_get(root, "esc\"key"))) {
+    FAIL("escaped key not found");
+  }
+  if(!mtev_json_value_int64(mtev_json_value_get(root, "dup"), &i64) || i64 != 2) {
+    FAIL("duplicate key should resolve to the last");
+  }
+  s = mtev_json_value_raw(mtev_json_value_path(root, "checks[0]"), &len);
+  if(len != strlen("{ \"id\": 1, \"metrics\": { \"duration\": 12.5 } }") ||
+     memcmp(s, "{ \"id\": 1, \"metrics\": { \"duration\": 12.5 } }", len)) {
+    FAIL("bad raw container: %.*s", (int)len, s);
+  }
+  it = mtev_json_value_iter(root);
+  while(mtev_json_iter_next(&it, &key, &val)) {
+    if(mtev_json_value_type(key) != mtev_json_type_string) {
+      FAIL("bad iteration key");
+    }
+    cnt++;
+  }
+  if(cnt != 9) {
+    FAIL("iterated %d members", cnt);
+  }
+
+  dom = mtev_json_value_dom(root, NULL);
+  if(!dom || dom->type != mtev_json_type_object || dom->length != 9) {
+    FAIL("bad dom root");
+  }
+  n = mtev_json_node_get(mtev_json_node_index(mtev_json_node_get(dom, "checks"), 1), "big");
+  if(!n || n->type != mtev_json_type_int || n->overflow != mtev_json_overflow_uint64 ||
+     n->v.u64 != UINT64_MAX) {
+    FAIL("bad dom uint64");
+  }
+  n = mtev_json_node_get(dom, "name");
+  if(!n || n->type != mtev_json_type_string || n->length != 10) {
+    FAIL("bad dom string");
+  }
+  n = mtev_json_node_get(dom, "dup");
+  if(!n || n->overflow != mtev_json_overflow_int || n->v.i64 != 2) {
+    FAIL("bad dom int");
+  }
+  mtev_json_doc_free(doc);
+
+  /* strings are only checked when read */
+  doc = mtev_json_doc_parse("[\"\\x\", \"a\tb\"]", 13, 0, NULL, NULL);
+  if(!doc || mtev_json_value_string(mtev_json_value_index(mtev_json_doc_root(doc), 0), NULL) ||
+     mtev_json_value_string(mtev_json_value_index(mtev_json_doc_root(doc), 1), NULL) ||
+     mtev_json_value_dom(mtev_json_doc_root(doc), NULL)) {
+    FAIL("invalid strings should fail when read");
+  }
+  mtev_json_doc_free(doc);
+}
+
+static void
+test_ondemand_validate_strings(void) {
+  static const struct { const char *in; size_t off; } bad[] = {
+    { "[\"\\x\"]", 2 }, { "[\"ok\", \"a\tb\"]", 9 }, { "{\"k\\q\":1}", 3 },
+    { "{\"a\":\"\\u12g4\"}", 6 }, { "\"\\u12\"", 1 }
+  };
+  static const char *good[] = { "[\"\\u00e9\\n\\\"\\/\"]", "{\"\\t\":\"x\"}", "\"\"" };
+  const char *err;
+  size_t i, off;
+  mtev_json_doc_t *doc;
+
+  for(i = 0; i < sizeof(bad)/sizeof(*bad); i++) {
+    off = 0;
+    doc = mtev_json_doc_parse(bad[i].in, strlen(bad[i].in), MTEV_JSON_DOC_VALIDATE,
+                              &err, &off);
+    if(doc) {
+      FAIL("validating parse accepted '%s'", bad[i].in);
+    }
+    if(off != bad[i].off) {
+      FAIL("'%s' failed at %zu (%s), expected %zu", bad[i].in, off, err, bad[i].off);
+    }
+    /* without validation the grammar alone is fine */
+    if(!(doc = mtev_json_doc_parse(bad[i].in, strlen(bad[i].in), 0, NULL, NULL))) {
+      FAIL("lazy parse rejected '%s'", bad[i].in);
+    }
+    mtev_json_doc_free(doc);
+  }
+  for(i = 0; i < sizeof(good)/sizeof(*good); i++) {
+    if(!(doc = mtev_json_doc_parse(good[i], strlen(good[i]), MTEV_JSON_DOC_VALIDATE,
+                                   NULL, NULL))) {
+      FAIL("validating parse rejected '%s'", good[i]);
+    }
+    if(!mtev_json_value_dom(mtev_json_doc_root(doc), NULL)) {
+      FAIL("validated document '%s' failed to read", good[i]);
+    }
+    mtev_json_doc_free(doc);
+  }
+}
+
+static void
+bench_ondemand(void) {
+  struct jl_printbuf *pb = jl_printbuf_new();
+  struct mtev_json_object *o;
+  mtev_json_doc_t *doc;
+  uint64_t start, elapsed;
+  double sum = 0;
+  int i, j;
+
+  jl_printbuf_memappend(pb, "[", 1);
+  for(i = 0; i < 20000; i++) {
+    char item[256];
+    snprintf(item, sizeof(item), "%s{ \"name\": \"metric %d with \\\"quotes\\\"\", "
+             "\"value\": %d.%d, \"tags\": [ \"a:b\", \"c:d\" ], \"ok\": true }",
+             i ? ", " : "", i, i, i % 97);
+    jl_printbuf_memappend(pb, item, strlen(item));
+  }
+  jl_printbuf_memappend(pb, "]", 1);
+
+  start = mtev_now_us();
+  for(j = 0; j < 10; j++) {
+    o = mtev_json_tokener_parse(pb->buf);
+    mtev_json_object_put(o);
+  }
+  elapsed = mtev_now_us() - start;
+  printf("tokener parse: %.1f MB/s\n", (double)pb->bpos * 10 / (elapsed ? elapsed : 1));
+
+  start = mtev_now_us();
+  for(j = 0; j < 10; j++) {
+    mtev_json_value_t v;
+    mtev_json_iter_t it;
+    doc = mtev_json_doc_parse(pb->buf, pb->bpos, 0, NULL, NULL);
+    it = mtev_json_value_iter(mtev_json_doc_root(doc));
+    while(mtev_json_iter_next(&it, NULL, &v)) {
+      double d;
+      if(mtev_json_value_double(mtev_json_value_get(v, "value"), &d)) sum += d;
+    }
+    mtev_json_doc_free(doc);
+  }
+  elapsed = mtev_now_us() - start;
+  printf("ondemand parse + field scan: %.1f MB/s\n", (double)pb->bpos * 10 / (elapsed ? elapsed : 1));
+
+  start = mtev_now_us();
+  for(j = 0; j < 10; j++) {
+    doc = mtev_json_doc_parse(pb->buf, pb->bpos, 0, NULL, NULL);
+    if(!mtev_json_value_dom(mtev_json_doc_root(doc), NULL)) sum = -1;
+    mtev_json_doc_free(doc);
+  }
+  elapsed = mtev_now_us() - start;
+  printf("ondemand parse + arena dom: %.1f MB/s\n", (double)pb->bpos * 10 / (elapsed ? elapsed : 1));
+  if(sum < 0) {
+    FAIL("benchmark document failed to parse");
+  }
+  jl_printbuf_free(pb);
+}
+
+static void
+bench(void) {
+  struct mtev_json_object *doc = mtev_json_object_new_array();
+  char buf[JL_FORMAT_NUMBER_MAX];
+  uint64_t start, elapsed;
+  size_t total = 0;
+  int i;
+
+  for(i = 0; i < 10000; i++) {
+    struct mtev_json_object *o = mtev_json_object_new_object();
+    mtev_json_object_object_add(o, "name", mtev_json_object_new_string("metric/name with \"quotes\""));
+    mtev_json_object_object_add(o, "value", mtev_json_object_new_double(i * 3.14159));
+    mtev_json_object_object_add(o, "count", mtev_json_object_new_int64(i * 1234567LL));
+    mtev_json_object_array_add(doc, o);
+  }
+  start = mtev_now_us();
+  for(i = 0; i < 20; i++) total += strlen(mtev_json_object_to_json_string(doc));
+  elapsed = mtev_now_us() - start;
+  printf("serialize: %.1f MB/s\n", (double)total / (elapsed ? elapsed : 1));
+
+  start = mtev_now_us();
+  for(i = 0; i < 1000000; i++) total += jl_format_double(buf, i * 0.001);
+  elapsed = mtev_now_us() - start;
+  printf("jl_format_double: %.1f ns/op\n", elapsed * 1000.0 / 1000000);
+  mtev_json_object_put(doc);
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  srand(time(NULL));
+  test_integers();
+  test_doubles();
+  test_serialize();
+  test_ondemand_validation();
+  test_ondemand_cursor();
+  test_ondemand_validate_strings();
+  test_ondemand_differential();
+  bench();
+  bench_ondemand();
+  printf("SUCCESS\n");
+  return 0;
+}
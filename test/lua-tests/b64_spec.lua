@@ -47,3 +47,40 @@ describe("mtev_b64", function()
     assert.are.equal(rv, 16)
   end)
 end)
+
+ffi.cdef([=[
+  int mtev_b64url_decode(const char *, size_t, unsigned char *, size_t);
+  int mtev_b64url_encode(const unsigned char *, size_t, char *, size_t);
+  size_t mtev_b64url_encode_len(size_t);
+  size_t mtev_b64url_max_decode_len(size_t);
+]=])
+
+describe("mtev_b64url", function()
+  it("A == decode(encode(A)) without padding", function()
+    local str = ""
+    local buf = charstar(1400)
+    local buf2 = charstar(1001)
+    for i=1,1000 do
+      str = str .. string.char(i % 256)
+
+      local str_len = string.len(str)
+      local encode_len = tonumber(libmtev.mtev_b64url_encode_len(str_len))
+      local rv = libmtev.mtev_b64url_encode(str, str_len, buf, encode_len)
+      assert.are.equal(rv, encode_len)
+      local encoded = ffi.string(buf, rv)
+      assert.is_nil(encoded:find("[=+/]"))
+
+      local decode_len = libmtev.mtev_b64url_max_decode_len(encode_len)
+      assert.is_true(str_len <= decode_len)
+      rv = libmtev.mtev_b64url_decode(buf, encode_len, buf2, decode_len)
+      assert.are.equal(rv, i)
+      assert.are.equal(str, ffi.string(buf2, rv))
+    end
+  end)
+
+  it("uses the URL-safe alphabet", function()
+    local buf = charstar(8)
+    local rv = libmtev.mtev_b64url_encode("\251\255\191", 3, buf, 8)
+    assert.are.equal("-_-_", ffi.string(buf, rv))
+  end)
+end)
@@ -12,6 +12,13 @@ int mtev_del_route_ipv4(btrie *, struct in_addr *, unsigned char, void (*)(void
 int mtev_del_route_ipv6(btrie *, struct in6_addr *, unsigned char, void (*)(void *));
 void *mtev_find_bpm_route_ipv4(btrie *tree, struct in_addr *a, unsigned char *);
 void *mtev_find_bpm_route_ipv6(btrie *tree, struct in6_addr *a, unsigned char *);
+
+typedef struct mtev_btrie_compiled mtev_btrie_compiled_t;
+mtev_btrie_compiled_t *mtev_btrie_compile_ipv4(btrie *);
+mtev_btrie_compiled_t *mtev_btrie_compile_ipv6(btrie *);
+void mtev_btrie_compiled_free(mtev_btrie_compiled_t *);
+void *mtev_btrie_compiled_find_ipv4(const mtev_btrie_compiled_t *, struct in_addr *, unsigned char *);
+void *mtev_btrie_compiled_find_ipv6(const mtev_btrie_compiled_t *, struct in6_addr *, unsigned char *);
 ]=])
 
 -- This is for Illumos where inet_pton comes from libnsl, not libc
@@ -88,6 +95,30 @@ describe("btrie", function()
     libmtev.mtev_drop_tree(btrie, nil)
   end)
 
+  it("should compile ipv4", function()
+    local btrie = ffi.new("btrie[?]", 1, ffi.cast("void *", 0))
+    local mask_out = ffi.new("unsigned char[?]", 1)
+    for k,v in pairs(_ip4s) do
+      add_ip4_route(btrie, k, v)
+    end
+    local compiled = libmtev.mtev_btrie_compile_ipv4(btrie)
+    local function test(addr, v, mask)
+      local o = ffi.cast("int", libmtev.mtev_btrie_compiled_find_ipv4(compiled, mkip(addr), mask_out))
+      assert.are.equal(o,v)
+      assert.are.equal(mask_out[0],mask)
+    end
+    test("1.2.3.4", 10, 0)
+    test("10.10.2.1", 1918, 8)
+    test("192.168.12.1", 1918, 16)
+    test("199.15.219.123", 10, 0)
+    test("199.15.220.11", 100, 22)
+    test("199.15.221.11", 101, 24)
+    test("199.15.222.11", 102, 23)
+    test("199.15.223.11", 102, 23)
+    libmtev.mtev_btrie_compiled_free(compiled)
+    libmtev.mtev_drop_tree(btrie, nil)
+  end)
+
   it("should handle ipv6", function()
     local btrie6 = ffi.new("btrie[?]", 1, ffi.cast("void *", 0))
     local mask_out = ffi.new("unsigned char[?]", 1)
@@ -99,6 +130,11 @@ describe("btrie", function()
       add_ip6_route(btrie6, k, v)
     end
     test("::1", 127)
+    local compiled = libmtev.mtev_btrie_compile_ipv6(btrie6)
+    local o = ffi.cast("int", libmtev.mtev_btrie_compiled_find_ipv6(compiled, mkip("::1"), mask_out))
+    assert.are.equal(o,127)
+    assert.are.equal(mask_out[0],48)
+    libmtev.mtev_btrie_compiled_free(compiled)
     libmtev.mtev_drop_tree(btrie6, nil)
   end)
 end)
@@ -10,6 +10,7 @@ typedef struct {
 
 mtev_cht_t *mtev_cht_alloc();
 mtev_cht_t *mtev_cht_alloc_custom(uint16_t weight, uint8_t nbits);
+mtev_cht_t *mtev_cht_alloc_mode(int mode);
 void mtev_cht_free(mtev_cht_t *);
 int mtev_cht_set_nodes(mtev_cht_t *, int node_cnt, mtev_cht_node_t *nodes);
 int mtev_cht_lookup(mtev_cht_t *, const char *key, mtev_cht_node_t **node);
@@ -32,7 +33,7 @@ local function mknodes(names)
   return Cnodes
 end
 
-local function test_ring_builds(cht, cnt, rsize)
+local function test_ring_builds(cht, cnt, rsize, eps)
   local node_names = {}
   for i = 1,cnt do table.insert(node_names, "node" .. i) end
   local nodes = mknodes(node_names)
@@ -46,12 +47,13 @@ local function test_ring_builds(cht, cnt, rsize)
     --print(ffi.string(nodes[i].name), nodes[i].owned)
   end
   assert.is_true(mdev < (1/cnt))
-  assert.is.equal(total,1)
+  if eps then assert.is_true(math.abs(total - 1) < eps)
+  else assert.is.equal(total,1) end
 end
 
-local function run_scenario(cht, input, cnt)
+local function run_scenario(cht, input, cnt, eps)
   local node = ffi.new("mtev_cht_node_t *[?]", 1)
-  test_ring_builds(cht, cnt, rsize)
+  test_ring_builds(cht, cnt, rsize, eps)
   local bcnt, out = {}, {}
   for key,v in pairs(input) do
     assert.is.equal(1, libmtev.mtev_cht_lookup(cht, charstar(key), node))
@@ -92,3 +94,30 @@ describe("cht", function()
   end)
 
 end)
+
+for mode, mname in pairs({ [1] = "maglev", [2] = "jump" }) do
+  describe("cht " .. mname, function()
+    local cht = libmtev.mtev_cht_alloc_mode(mode)
+
+    for node_cnt = 1,20 do
+      it("should balance relatively well: nodes=" .. node_cnt, function()
+        test_ring_builds(cht,node_cnt,0,1e-9)
+      end)
+    end
+
+    local scenario = {}
+    for i = 1,1000 do scenario["shart"..i] = true end
+
+    it("should mostly move keys to a new node when growing", function()
+      local scenario8 = run_scenario(cht, scenario, 8, 1e-9)
+      local scenario9 = run_scenario(cht, scenario, 9, 1e-9)
+      local stray = 0
+      for key,v in pairs(scenario) do
+        if scenario8[key] ~= scenario9[key] and scenario9[key] ~= "node9" then
+          stray = stray + 1
+        end
+      end
+      assert.is_true(stray < 20)
+    end)
+  end)
+end
@@ -0,0 +1,142 @@
+describe("mtev.http_request", function()
+
+  local port = 48080 + math.random(0, 999)
+  local served = 0
+  -- the most requests read but not yet answered on any one connection
+  local max_in_flight = 0
+
+  -- A tiny keep-alive server: the response body is the request path and
+  -- "/slow" paths are answered late.  Requests on one connection are
+  -- answered in order, so pipelined requests exercise the client's queue.
+  -- A "/pair" request isn't answered until the next request has arrived
+  -- on the same connection, which only happens if the client pipelines.
+  local function handle(sock)
+    sock = sock:own()
+    local queue = {}
+    while true do
+      local head = sock:read("\r\n\r\n")
+      if head == nil then break end
+      local path = head:match("^%u+ (%S+) HTTP/1%.1")
+      if path == nil then break end
+      queue[#queue+1] = path
+      if #queue > max_in_flight then max_in_flight = #queue end
+      if not (path:find("^/pair") and #queue < 2) then
+        local rv
+        for _, p in ipairs(queue) do
+          if p:find("^/slow") then mtev.sleep(0.5) end
+          served = served + 1
+          rv = sock:write("HTTP/1.1 200 OK\r\nContent-Length: " .. #p ..
+                          "\r\nX-Served: " .. served .. "\r\n\r\n" .. p)
+          if rv ~= nil and rv < 0 then break end
+        end
+        queue = {}
+        if rv ~= nil and rv < 0 then break end
+      end
+    end
+    sock:close()
+  end
+
+  -- notify() is lost when nobody is waiting yet, so collect results in a
+  -- table and poll for them.
+  local function await(results, n, timeout)
+    local waited = 0
+    while #results < n and waited < timeout do
+      waited = waited + mtev.sleep(0.01)
+    end
+  end
+
+  it("starts a server", function()
+    -- a single connection, so concurrent requests can only be pipelined
+    mtev.http_client_options(1, 8)
+    local s = mtev.socket("127.0.0.1")
+    s:setsockopt("SO_REUSEADDR", 1)
+    assert.are.equal(0, s:bind("127.0.0.1", port))
+    assert.are.equal(0, s:listen(128))
+    mtev.coroutine_spawn(function()
+      s = s:own()
+      while true do
+        local c = s:accept()
+        if c ~= nil then mtev.coroutine_spawn(handle, c) end
+      end
+    end)
+  end)
+
+  it("completes a request", function()
+    local status, headers, body = mtev.http_request("GET", "127.0.0.1", port, "/hello")
+    assert.are.equal(200, status)
+    assert.are.equal("/hello", body)
+    assert.truthy(headers["x-served"])
+  end)
+
+  it("reports connection failures", function()
+    local status, err = mtev.http_request("GET", "127.0.0.1", 1, "/")
+    assert.is_nil(status)
+    assert.are.equal("connection failed", err)
+  end)
+
+  it("keeps more than one request in flight on a connection", function()
+    local results = {}
+    for i = 1, 2 do
+      mtev.coroutine_spawn(function()
+        local status, _, body = mtev.http_request("GET", "127.0.0.1", port, "/pair/" .. i,
+                                                  nil, nil, { timeout = 2 })
+        results[#results+1] = status == 200 and body == "/pair/" .. i
+      end)
+    end
+    await(results, 2, 5)
+    assert.are.equal(2, #results)
+    for i = 1, 2 do assert.is_true(results[i]) end
+    assert.is_true(max_in_flight > 1)
+  end)
+
+  it("matches pipelined responses to their requests", function()
+    mtev.http_client_options(4, 8)
+    local results, n = {}, 40
+    for i = 1, n do
+      mtev.coroutine_spawn(function()
+        local status, _, body = mtev.http_request("GET", "127.0.0.1", port, "/p/" .. i)
+        results[#results+1] = status == 200 and body == "/p/" .. i
+      end)
+    end
+    await(results, n, 5)
+    assert.are.equal(n, #results)
+    for i = 1, n do assert.is_true(results[i]) end
+  end)
+
+  it("times out only the expired request", function()
+    local results, slow = {}, nil
+    mtev.coroutine_spawn(function()
+      local status, err = mtev.http_request("GET", "127.0.0.1", port, "/slow",
+                                            nil, nil, { timeout = 0.1 })
+      slow = { status = status, err = err }
+      results[#results+1] = true
+    end)
+    for i = 1, 20 do
+      mtev.coroutine_spawn(function()
+        local status, _, body = mtev.http_request("GET", "127.0.0.1", port, "/f/" .. i,
+                                                  nil, nil, { timeout = 5 })
+        results[#results+1] = status == 200 and body == "/f/" .. i
+      end)
+    end
+    await(results, 21, 5)
+    assert.are.equal(21, #results)
+    for i = 1, 21 do assert.is_true(results[i]) end
+    assert.is_not_nil(slow)
+    assert.is_nil(slow.status)
+    assert.are.equal("timed out", slow.err)
+  end)
+
+  it("survives a response arriving after the caller has gone", function()
+    -- We give up (timeout) while the server is still working; the late
+    -- response must not resume anything and the pool must stay usable.
+    local status, err = mtev.http_request("GET", "127.0.0.1", port, "/slow/late",
+                                          nil, nil, { timeout = 0.05 })
+    assert.is_nil(status)
+    assert.are.equal("timed out", err)
+    mtev.sleep(0.6)
+    local _, body
+    status, _, body = mtev.http_request("GET", "127.0.0.1", port, "/after")
+    assert.are.equal(200, status)
+    assert.are.equal("/after", body)
+  end)
+end)
@@ -0,0 +1,84 @@
+describe("mtev.hyperloglog", function()
+
+  -- 14 bits is about 0.8% standard error; allow several of those.
+  local function near(expected, actual, tolerance)
+    tolerance = tolerance or 0.05
+    assert.is_true(math.abs(actual - expected) <= expected * tolerance,
+                   "expected ~" .. expected .. ", got " .. actual)
+  end
+
+  local function filled(prefix, n, bits)
+    local hll = mtev.hyperloglog(bits)
+    for i = 1, n do hll:add(prefix .. i) end
+    return hll
+  end
+
+  it("starts empty", function()
+    assert.are.equal(0, mtev.hyperloglog():size())
+  end)
+
+  it("rejects bad bitcounts", function()
+    assert.has_error(function() mtev.hyperloglog(3) end)
+    assert.has_error(function() mtev.hyperloglog(21) end)
+  end)
+
+  it("counts distinct items", function()
+    local hll = filled("item", 50000)
+    near(50000, hll:size())
+    -- repeats don't count again
+    for i = 1, 50000 do hll:add("item" .. i) end
+    near(50000, hll:size())
+  end)
+
+  it("adds several items at once", function()
+    local hll = mtev.hyperloglog()
+    hll:add("a", "b", "c")
+    hll:add("c", "d")
+    assert.are.equal(4, math.floor(hll:size() + 0.5))
+  end)
+
+  it("must be called as a method", function()
+    local hll = mtev.hyperloglog()
+    assert.has_error(function() hll.add("x") end)
+    assert.has_error(function() hll:nope() end)
+  end)
+
+  it("merges", function()
+    local a = filled("a", 20000)
+    local b = filled("b", 30000)
+    local overlap = filled("a", 10000)
+    a:merge(b)
+    near(50000, a:size())
+    -- merging items already counted changes nothing
+    a:merge(overlap)
+    near(50000, a:size())
+    -- b is untouched
+    near(30000, b:size())
+  end)
+
+  it("refuses to merge different bitcounts", function()
+    local a, b = mtev.hyperloglog(10), mtev.hyperloglog(12)
+    assert.has_error(function() a:merge(b) end)
+  end)
+
+  it("round trips through serialize", function()
+    for _, bits in ipairs({ 4, 10, 14, 20 }) do
+      local hll = filled("s", 10000, bits)
+      local copy = mtev.hyperloglog_deserialize(hll:serialize())
+      assert.is_not_nil(copy)
+      assert.are.equal(hll:size(), copy:size())
+      assert.are.equal(hll:serialize(), copy:serialize())
+      -- the copy is independent and keeps working
+      copy:add("one more", "and another")
+      assert.are.equal(hll:size(), mtev.hyperloglog_deserialize(hll:serialize()):size())
+      copy:merge(hll)
+    end
+  end)
+
+  it("rejects garbage", function()
+    assert.is_nil(mtev.hyperloglog_deserialize(""))
+    assert.is_nil(mtev.hyperloglog_deserialize("not a hyperloglog"))
+    local s = filled("t", 100, 10):serialize()
+    assert.is_nil(mtev.hyperloglog_deserialize(s:sub(1, #s - 1)))
+  end)
+end)
@@ -0,0 +1,59 @@
+describe("mtev.parsejson", function()
+
+  it("parses documents", function()
+    local doc = mtev.parsejson('{"a":{"b":[1,"two",{"c":true}]},"n":null,"big":9223372036854775807,"s":"x\\u00e9y"}')
+    assert.truthy(doc ~= nil)
+    local t = doc:document()
+    assert.are.equal(1, t.a.b[1])
+    assert.are.equal("two", t.a.b[2])
+    assert.is_true(t.a.b[3].c)
+    assert.is_nil(t.n)
+    assert.are.equal("9223372036854775807", t.big)
+    assert.are.equal("x\195\169y", t.s)
+  end)
+
+  it("reports errors", function()
+    local doc, err, offset = mtev.parsejson('{"a":[1,2,}')
+    assert.is_nil(doc)
+    assert.truthy(err ~= nil)
+    assert.are.equal(10, offset)
+  end)
+
+  it("reports bad strings at parse time", function()
+    local doc, err, offset = mtev.parsejson('{"a":"x\\q"}')
+    assert.is_nil(doc)
+    assert.truthy(err ~= nil)
+    assert.are.equal(8, offset)
+  end)
+
+  it("accepts lenient input", function()
+    local doc = mtev.parsejson("/* c */ {'a': [1, 2] // tail\n}")
+    assert.truthy(doc ~= nil)
+    assert.are.equal(2, doc:document().a[2])
+    assert.are.equal(1, doc:get("a[0]"))
+    -- raw control characters in strings were always tolerated
+    assert.are.equal("a\tb", mtev.parsejson('["a\tb"]'):document()[1])
+  end)
+
+  it("converts deep documents", function()
+    local deep = string.rep("[", 1000) .. "1" .. string.rep("]", 1000)
+    local t = mtev.parsejson(deep):document()
+    for i = 1, 1000 do t = t[1] end
+    assert.are.equal(1, t)
+  end)
+
+  it("fetches paths", function()
+    local doc = mtev.parsejson('{"a":{"b":[1,"two",{"c":2.5}]}}')
+    assert.are.equal(2.5, doc:get("a.b[2].c"))
+    assert.are.equal("two", doc:get("a.b[1]"))
+    assert.is_nil(doc:get("a.x"))
+    assert.are.equal(3, #doc:get("a.b"))
+  end)
+
+  it("round trips through tostring", function()
+    local doc = mtev.parsejson('{"a":[1,2,3]}')
+    local again = mtev.parsejson(doc:tostring())
+    assert.are.equal(3, again:get("a[2]"))
+    assert.are.equal(2, mtev.tojson({ x = { 1, 2 } }):get("x[1]"))
+  end)
+end)
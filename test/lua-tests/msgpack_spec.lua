@@ -0,0 +1,33 @@
+describe("mtev.msgpack", function()
+
+  it("round trips values", function()
+    local t = { a = 1, b = { 1, 2, 3 }, c = "x\0y", d = true, e = -2.5,
+                f = 9007199254740992, [7] = "seven" }
+    local back = mtev.frommsgpack(mtev.tomsgpack(t))
+    assert.are.same(t, back)
+    assert.are.equal(42, mtev.frommsgpack(mtev.tomsgpack(42)))
+    assert.are.equal("str", mtev.frommsgpack(mtev.tomsgpack("str")))
+  end)
+
+  it("encodes sequences as arrays", function()
+    assert.are.equal("\147\1\2\3", mtev.tomsgpack({ 1, 2, 3 }))
+    assert.are.equal("\129\161\97\1", mtev.tomsgpack({ a = 1 }))
+  end)
+
+  it("rejects bad input", function()
+    local v, err = mtev.frommsgpack("\146\1")
+    assert.is_nil(v)
+    assert.truthy(err ~= nil)
+    assert.has_error(function() mtev.tomsgpack({ [true] = 1 }) end)
+    local loop = {}
+    loop.self = loop
+    assert.has_error(function() mtev.tomsgpack(loop) end)
+  end)
+
+  it("stores shared values", function()
+    mtev.shared_set("msgpack_spec", { x = { "y", 2 } })
+    assert.are.same({ x = { "y", 2 } }, mtev.shared_get("msgpack_spec"))
+    mtev.shared_set("msgpack_spec", nil)
+    assert.is_nil(mtev.shared_get("msgpack_spec"))
+  end)
+end)
@@ -0,0 +1,135 @@
+#include <mtev_defines.h>
+#include <mtev_memory.h>
+#include <mtev_time.h>
+#include <ck_pr.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#define FAIL(...)                           \
+  printf("** ");                            \
+  printf( __VA_ARGS__);                     \
+  printf("\n** FAILURE\n"); \
+  exit(1);
+
+#define THREAD_COUNT 8
+#define PER_THREAD 200000
+#define GC_BATCH 64
+#define GC_MAX_PENDING 4096
+#define PIN_USEC 300000
+
+static uint64_t allocated;
+static uint64_t freed;
+static int pinned;
+
+static void
+counted_cleanup(void *p) {
+  (void)p;
+  ck_pr_inc_64(&freed);
+}
+
+/* Holds an epoch section open while the workers free, so nothing can
+ * complete a grace period: pending climbs past the limit (backpressure)
+ * and handed-off batches pile up in the queue (reclaimer growth). */
+static void *
+pin_thread(void *unused) {
+  (void)unused;
+  mtev_memory_init_thread();
+  mtev_memory_begin();
+  ck_pr_store_int(&pinned, 1);
+  usleep(PIN_USEC);
+  mtev_memory_end();
+  return NULL;
+}
+
+static void *
+free_thread(void *unused) {
+  int i;
+  uint64_t mine;
+  (void)unused;
+  mtev_memory_init_thread();
+  for(i = 0; i < PER_THREAD; i++) {
+    void *p = mtev_memory_safe_malloc_cleanup(32, counted_cleanup);
+    ck_pr_inc_64(&allocated);
+    /* Half inside a section (handoff waits for mtev_memory_end), half
+     * outside (handoff happens on the free itself). */
+    if(i & 1) {
+      mtev_memory_begin();
+      mtev_memory_safe_free(p);
+      mtev_memory_end();
+    }
+    else mtev_memory_safe_free(p);
+  }
+  /* Returned batches are reclaimed by their owner, so drain our own. */
+  mine = mtev_now_ms();
+  while(ck_pr_load_64(&freed) < ck_pr_load_64(&allocated) &&
+        mtev_now_ms() - mine < 10000) {
+    mtev_memory_maintenance_ex(MTEV_MM_BARRIER_ASYNCH);
+    usleep(1000);
+  }
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  pthread_t pin, tids[THREAD_COUNT];
+  mtev_memory_gc_stats_t stats;
+  uint64_t start, elapsed, total = (uint64_t)THREAD_COUNT * PER_THREAD;
+  int i;
+
+  (void)argc;
+  (void)argv;
+  mtev_memory_gc_threads(4);
+  mtev_memory_init();
+  mtev_memory_gc_batch(GC_BATCH);
+  mtev_memory_gc_max_pending(GC_MAX_PENDING);
+
+  pthread_create(&pin, NULL, pin_thread, NULL);
+  while(!ck_pr_load_int(&pinned)) usleep(100);
+
+  start = mtev_now_us();
+  for(i = 0; i < THREAD_COUNT; i++) pthread_create(&tids[i], NULL, free_thread, NULL);
+  for(i = 0; i < THREAD_COUNT; i++) pthread_join(tids[i], NULL);
+  elapsed = mtev_now_us() - start;
+  pthread_join(pin, NULL);
+
+  mtev_memory_gc_stats(&stats);
+  printf("%llu frees in %.3fs (%.0f/s), peak %llu pending, %llu handoffs, "
+         "%llu backpressure, %llu reclaimers\n",
+         (unsigned long long)total, (double)elapsed / 1000000.0,
+         (double)total * 1000000.0 / (double)(elapsed ? elapsed : 1),
+         (unsigned long long)stats.peak, (unsigned long long)stats.handoffs,
+         (unsigned long long)stats.backpressure, (unsigned long long)stats.reclaimers);
+
+  if(ck_pr_load_64(&allocated) != total) {
+    FAIL("allocated %llu, expected %llu", (unsigned long long)allocated,
+         (unsigned long long)total);
+  }
+  if(ck_pr_load_64(&freed) != total) {
+    FAIL("reclaimed %llu of %llu", (unsigned long long)freed, (unsigned long long)total);
+  }
+  if(stats.pending != 0) {
+    FAIL("%llu still pending", (unsigned long long)stats.pending);
+  }
+  if(stats.dispatched < total) {
+    FAIL("dispatched %llu < %llu", (unsigned long long)stats.dispatched,
+         (unsigned long long)total);
+  }
+  if(stats.handoffs < total / GC_BATCH / 2) {
+    FAIL("only %llu handoffs for batches of %d", (unsigned long long)stats.handoffs,
+         GC_BATCH);
+  }
+  if(stats.peak <= GC_MAX_PENDING) {
+    FAIL("peak %llu never exceeded the limit", (unsigned long long)stats.peak);
+  }
+  if(stats.backpressure == 0) {
+    FAIL("backpressure never engaged");
+  }
+  if(stats.reclaimers < 2) {
+    FAIL("reclaimer pool never grew (%llu)", (unsigned long long)stats.reclaimers);
+  }
+  printf("SUCCESS\n");
+  return 0;
+}
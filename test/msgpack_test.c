@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
+#include <float.h>
+#include <time.h>
+#include <mtev_defines.h>
+#include <mtev_json.h>
+#include <mtev_msgpack.h>
+#include <mtev_time.h>
+
+#define FAIL(...)                           \
+  printf("** ");                            \
+  printf( __VA_ARGS__);                     \
+  printf("\n** FAILURE\n"); \
+  exit(1);
+
+static uint64_t
+rand64(void) {
+  return ((uint64_t)rand() << 62) ^ ((uint64_t)rand() << 31) ^ (uint64_t)rand();
+}
+
+static void
+expect_bytes(mtev_dyn_buffer_t *buf, const char *what, const char *hex) {
+  char got[256] = "";
+  size_t i, used = mtev_dyn_buffer_used(buf);
+  for(i = 0; i < used && i < 100; i++)
+    snprintf(got + i * 2, sizeof(got) - i * 2, "%02x", mtev_dyn_buffer_data(buf)[i]);
+  if(strcmp(got, hex)) {
+    FAIL("%s encoded as %s, expected %s", what, got, hex);
+  }
+  mtev_dyn_buffer_reset(buf);
+}
+
+/* encodings from the MessagePack specification */
+static void
+test_encodings(void) {
+  mtev_dyn_buffer_t buf;
+  mtev_dyn_buffer_init(&buf);
+  mtev_msgpack_pack_nil(&buf); expect_bytes(&buf, "nil", "c0");
+  mtev_msgpack_pack_boolean(&buf, mtev_true); expect_bytes(&buf, "true", "c3");
+  mtev_msgpack_pack_int64(&buf, 0); expect_bytes(&buf, "0", "00");
+  mtev_msgpack_pack_int64(&buf, 127); expect_bytes(&buf, "127", "7f");
+  mtev_msgpack_pack_int64(&buf, 128); expect_bytes(&buf, "128", "cc80");
+  mtev_msgpack_pack_int64(&buf, 65536); expect_bytes(&buf, "65536", "ce00010000");
+  mtev_msgpack_pack_int64(&buf, -1); expect_bytes(&buf, "-1", "ff");
+  mtev_msgpack_pack_int64(&buf, -32); expect_bytes(&buf, "-32", "e0");
+  mtev_msgpack_pack_int64(&buf, -33); expect_bytes(&buf, "-33", "d0df");
+  mtev_msgpack_pack_int64(&buf, -129); expect_bytes(&buf, "-129", "d1ff7f");
+  mtev_msgpack_pack_int64(&buf, INT64_MIN);
+  expect_bytes(&buf, "INT64_MIN", "d38000000000000000");
+  mtev_msgpack_pack_uint64(&buf, UINT64_MAX);
+  expect_bytes(&buf, "UINT64_MAX", "cfffffffffffffffff");
+  mtev_msgpack_pack_double(&buf, 1.5); expect_bytes(&buf, "1.5", "ca3fc00000");
+  mtev_msgpack_pack_double(&buf, 0.1); expect_bytes(&buf, "0.1", "cb3fb999999999999a");
+  mtev_msgpack_pack_double(&buf, FLT_MAX); expect_bytes(&buf, "FLT_MAX", "ca7f7fffff");
+  mtev_msgpack_pack_double(&buf, -INFINITY); expect_bytes(&buf, "-inf", "caff800000");
+  mtev_msgpack_pack_double(&buf, 1e300); expect_bytes(&buf, "1e300", "cb7e37e43c8800759c");
+  mtev_msgpack_pack_double(&buf, -1e39); expect_bytes(&buf, "-1e39", "cbc8078287f49c4a1d");
+  mtev_msgpack_pack_str(&buf, "abc", 3); expect_bytes(&buf, "\"abc\"", "a3616263");
+  mtev_msgpack_pack_bin(&buf, "\x01\x02", 2); expect_bytes(&buf, "bin", "c4020102");
+  mtev_msgpack_pack_array(&buf, 2); expect_bytes(&buf, "array(2)", "92");
+  mtev_msgpack_pack_array(&buf, 16); expect_bytes(&buf, "array(16)", "dc0010");
+  mtev_msgpack_pack_map(&buf, 1); expect_bytes(&buf, "map(1)", "81");
+  mtev_msgpack_pack_map(&buf, 70000); expect_bytes(&buf, "map(70000)", "df00011170");
+  mtev_dyn_buffer_destroy(&buf);
+}
+
+static void
+test_scalars(void) {
+  mtev_dyn_buffer_t buf;
+  mtev_msgpack_reader_t r;
+  mtev_msgpack_item_t item;
+  char *str;
+  int i;
+
+  mtev_dyn_buffer_init(&buf);
+  for(i = 0; i < 1000000; i++) {
+    int64_t v = (int64_t)(rand64() >> (rand() % 64));
+    if(rand() & 1) v = -v;
+    mtev_dyn_buffer_reset(&buf);
+    mtev_msgpack_pack_int64(&buf, v);
+    mtev_msgpack_reader_init(&r, mtev_dyn_buffer_data(&buf), mtev_dyn_buffer_used(&buf));
+    if(!mtev_msgpack_read(&r, &item) || mtev_msgpack_reader_remaining(&r) ||
+       (v < 0 ? item.type != MTEV_MSGPACK_INT || item.v.i64 != v
+              : item.type != MTEV_MSGPACK_UINT || item.v.u64 != (uint64_t)v)) {
+      FAIL("int64 %" PRId64 " did not round trip", v);
+    }
+  }
+  for(i = 0; i < 100000; i++) {
+    union { double d; uint64_t u; } v;
+    do { v.u = rand64(); } while(isnan(v.d));
+    if((i & 1) && fabs(v.d) <= FLT_MAX) v.d = (float)v.d;
+    mtev_dyn_buffer_reset(&buf);
+    mtev_msgpack_pack_double(&buf, v.d);
+    mtev_msgpack_reader_init(&r, mtev_dyn_buffer_data(&buf), mtev_dyn_buffer_used(&buf));
+    if(!mtev_msgpack_read(&r, &item) || item.type != MTEV_MSGPACK_DOUBLE ||
+       item.v.dbl != v.d) {
+      FAIL("double %.17g did not round trip", v.d);
+    }
+  }
+
+  /* strings come back as views into the input at every length class */
+  str = malloc(70000);
+  memset(str, 'x', 70000);
+  for(i = 0; i < 5; i++) {
+    static const size_t lens[] = { 0, 31, 255, 65535, 70000 };
+    mtev_dyn_buffer_reset(&buf);
+    mtev_msgpack_pack_str(&buf, str, lens[i]);
+    mtev_msgpack_reader_init(&r, mtev_dyn_buffer_data(&buf), mtev_dyn_buffer_used(&buf));
+    if(!mtev_msgpack_read(&r, &item) || item.type != MTEV_MSGPACK_STR ||
+       item.v.str.len != lens[i] ||
+       item.v.str.ptr != (const char *)mtev_dyn_buffer_data(&buf) +
+                         mtev_dyn_buffer_used(&buf) - lens[i]) {
+      FAIL("string of %zu bytes did not round trip", lens[i]);
+    }
+  }
+  free(str);
+  mtev_dyn_buffer_destroy(&buf);
+}
+
+static struct mtev_json_object *
+gen_json(int depth) {
+  struct mtev_json_object *o;
+  char str[32];
+  int i, n;
+  switch(depth > 0 ? rand() % 9 : rand() % 7) {
+  case 0: return NULL;
+  case 1: return mtev_json_object_new_boolean(rand() & 1);
+  case 2: return mtev_json_object_new_int(rand() - RAND_MAX / 2);
+  case 3: return mtev_json_object_new_int64(-(int64_t)(rand64() >> 1));
+  case 4: return mtev_json_object_new_uint64(rand64());
+  case 5: return mtev_json_object_new_double((rand() - RAND_MAX / 2) / 7.0);
+  case 6:
+    n = rand() % (int)sizeof(str);
+    for(i = 0; i < n; i++) str[i] = 1 + rand() % 126;
+    return mtev_json_object_new_string_len(str, n);
+  case 7:
+    o = mtev_json_object_new_array();
+    n = rand() % 20;
+    for(i = 0; i < n; i++) mtev_json_object_array_add(o, gen_json(depth - 1));
+    return o;
+  default:
+    o = mtev_json_object_new_object();
+    n = rand() % 20;
+    for(i = 0; i < n; i++) {
+      snprintf(str, sizeof(str), "key%d", rand() % 30);
+      mtev_json_object_object_add(o, str, gen_json(depth - 1));
+    }
+    return o;
+  }
+}
+
+static void
+test_json(void) {
+  mtev_dyn_buffer_t buf;
+  mtev_msgpack_reader_t r;
+  int iter;
+
+  mtev_dyn_buffer_init(&buf);
+  for(iter = 0; iter < 20000; iter++) {
+    struct mtev_json_object *doc = gen_json(iter % 4), *back;
+    char *expect;
+    size_t len, cut;
+
+    mtev_dyn_buffer_reset(&buf);
+    mtev_msgpack_pack_json(&buf, doc);
+    len = mtev_dyn_buffer_used(&buf);
+    if(!mtev_msgpack_unpack_json(mtev_dyn_buffer_data(&buf), len, &back)) {
+      FAIL("could not decode %s", mtev_json_object_to_json_string(doc));
+    }
+    expect = strdup(doc ? mtev_json_object_to_json_string(doc) : "null");
+    if(strcmp(expect, back ? mtev_json_object_to_json_string(back) : "null")) {
+      FAIL("%s decoded as %s", expect, mtev_json_object_to_json_string(back));
+    }
+    free(expect);
+    mtev_json_object_put(back);
+
+    mtev_msgpack_reader_init(&r, mtev_dyn_buffer_data(&buf), len);
+    if(!mtev_msgpack_skip(&r) || mtev_msgpack_reader_remaining(&r)) {
+      FAIL("could not skip %s", mtev_json_object_to_json_string(doc));
+    }
+
+    /* every truncation must fail cleanly */
+    cut = rand() % len;
+    if(mtev_msgpack_unpack_json(mtev_dyn_buffer_data(&buf), cut, &back)) {
+      FAIL("truncated encoding of %s decoded", mtev_json_object_to_json_string(doc));
+    }
+    mtev_msgpack_reader_init(&r, mtev_dyn_buffer_data(&buf), cut);
+    if(mtev_msgpack_skip(&r) || mtev_msgpack_reader_remaining(&r) != cut) {
+      FAIL("truncated encoding of %s skipped", mtev_json_object_to_json_string(doc));
+    }
+    mtev_json_object_put(doc);
+  }
+  mtev_dyn_buffer_destroy(&buf);
+}
+
+static void
+test_invalid(void) {
+  static const struct { const char *bytes; size_t len; } bad[] = {
+    { "\xc1", 1 },                    /* never used */
+    { "\xd4\x01\x00", 3 },            /* ext types have no JSON form */
+    { "\x92\x01", 2 },                /* short array */
+    { "\xdb\xff\xff\xff\xff", 5 },    /* str 32 longer than the input */
+    { "\x01\x02", 2 },                /* trailing data */
+    { "\xdd\xff\xff\xff\xff", 5 },    /* array 32 with nothing in it */
+    { "\x81\x90\x01", 3 },            /* array as a key */
+  };
+  struct mtev_json_object *o;
+  unsigned char deep[MTEV_MSGPACK_MAX_DEPTH + 2];
+  mtev_msgpack_reader_t r;
+  int i;
+
+  for(i = 0; i < (int)(sizeof(bad)/sizeof(*bad)); i++) {
+    if(mtev_msgpack_unpack_json(bad[i].bytes, bad[i].len, &o)) {
+      FAIL("invalid input %d decoded", i);
+    }
+  }
+  memset(deep, 0x91, sizeof(deep));
+  deep[sizeof(deep) - 1] = 0xc0;
+  if(mtev_msgpack_unpack_json(deep, sizeof(deep), &o)) {
+    FAIL("nesting beyond MTEV_MSGPACK_MAX_DEPTH decoded");
+  }
+  if(!mtev_msgpack_unpack_json(deep + 1, sizeof(deep) - 1, &o)) {
+    FAIL("nesting of MTEV_MSGPACK_MAX_DEPTH rejected");
+  }
+  mtev_json_object_put(o);
+  mtev_msgpack_reader_init(&r, deep, sizeof(deep));
+  if(!mtev_msgpack_skip(&r)) {
+    FAIL("could not skip deep nesting");
+  }
+
+  /* random input must never crash the reader */
+  for(i = 0; i < 200000; i++) {
+    unsigned char junk[32];
+    int j, len = rand() % sizeof(junk);
+    for(j = 0; j < len; j++) junk[j] = rand();
+    if(mtev_msgpack_unpack_json(junk, len, &o)) mtev_json_object_put(o);
+    mtev_msgpack_reader_init(&r, junk, len);
+    (void)mtev_msgpack_skip(&r);
+  }
+}
+
+/* a REST style payload: an array of metric records */
+static void
+bench(void) {
+  struct mtev_json_object *doc = mtev_json_object_new_array(), *o;
+  struct mtev_json_tokener *tok;
+  mtev_dyn_buffer_t buf;
+  mtev_msgpack_reader_t r;
+  uint64_t start, json_enc, json_dec, mp_enc, mp_dec, mp_scan;
+  size_t jsonlen = 0, mplen = 0;
+  char *json;
+  int i;
+
+  for(i = 0; i < 10000; i++) {
+    char name[64];
+    o = mtev_json_object_new_object();
+    snprintf(name, sizeof(name), "service`host%d`cpu_used", i % 50);
+    mtev_json_object_object_add(o, "name", mtev_json_object_new_string(name));
+    mtev_json_object_object_add(o, "ts", mtev_json_object_new_int64(1500000000000LL + i));
+    mtev_json_object_object_add(o, "value", mtev_json_object_new_double(i * 0.37));
+    mtev_json_object_object_add(o, "count", mtev_json_object_new_int(i));
+    mtev_json_object_object_add(o, "ok", mtev_json_object_new_boolean(i & 1));
+    mtev_json_object_array_add(doc, o);
+  }
+
+  start = mtev_now_us();
+  for(i = 0; i < 20; i++) jsonlen = strlen(mtev_json_object_to_json_string(doc));
+  json_enc = mtev_now_us() - start;
+  json = strdup(mtev_json_object_to_json_string(doc));
+  start = mtev_now_us();
+  for(i = 0; i < 20; i++) {
+    tok = mtev_json_tokener_new();
+    o = mtev_json_tokener_parse_ex(tok, json, jsonlen + 1);
+    mtev_json_tokener_free(tok);
+    mtev_json_object_put(o);
+  }
+  json_dec = mtev_now_us() - start;
+
+  mtev_dyn_buffer_init(&buf);
+  start = mtev_now_us();
+  for(i = 0; i < 20; i++) {
+    mtev_dyn_buffer_reset(&buf);
+    mtev_msgpack_pack_json(&buf, doc);
+  }
+  mp_enc = mtev_now_us() - start;
+  mplen = mtev_dyn_buffer_used(&buf);
+  start = mtev_now_us();
+  for(i = 0; i < 20; i++) {
+    if(!mtev_msgpack_unpack_json(mtev_dyn_buffer_data(&buf), mplen, &o)) {
+      FAIL("benchmark payload failed to decode");
+    }
+    mtev_json_object_put(o);
+  }
+  mp_dec = mtev_now_us() - start;
+  /* walking the items without building objects */
+  start = mtev_now_us();
+  for(i = 0; i < 20; i++) {
+    mtev_msgpack_reader_init(&r, mtev_dyn_buffer_data(&buf), mplen);
+    if(!mtev_msgpack_skip(&r)) {
+      FAIL("benchmark payload failed to scan");
+    }
+  }
+  mp_scan = mtev_now_us() - start;
+
+  printf("json:    %zu bytes, encode %.2f ms, decode %.2f ms\n",
+         jsonlen, json_enc / 20000.0, json_dec / 20000.0);
+  printf("msgpack: %zu bytes, encode %.2f ms, decode %.2f ms, scan %.2f ms\n",
+         mplen, mp_enc / 20000.0, mp_dec / 20000.0, mp_scan / 20000.0);
+  free(json);
+  mtev_dyn_buffer_destroy(&buf);
+  mtev_json_object_put(doc);
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  srand(time(NULL));
+  test_encodings();
+  test_scalars();
+  test_json();
+  test_invalid();
+  bench();
+  printf("SUCCESS\n");
+  return 0;
+}
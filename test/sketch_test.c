@@ -0,0 +1,379 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <assert.h>
+#include <pthread.h>
+#include <mtev_defines.h>
+#include <mtev_sketch.h>
+#include <mtev_time.h>
+
+#define NKEYS 100000
+#define NOPS 1000000
+#define NTHREADS 4
+
+static char keys[NKEYS][16];
+static int keylen[NKEYS];
+
+#define BENCH(label, n, stmt) do { \
+  mtev_hrtime_t _start = mtev_gethrtime(); \
+  for(int _i = 0; _i < (n); _i++) { int i = _i; stmt; } \
+  printf("  %-28s %7.1f ns/op\n", label, \
+         (double)(mtev_gethrtime() - _start) / (n)); \
+} while(0)
+
+static void *roundtrip_buf(size_t len) {
+  return malloc(len ? len : 1);
+}
+
+/* keys drawn with a skewed (roughly Zipfian) distribution */
+static int skewed[NOPS];
+
+static void test_cms(void) {
+  mtev_cms_t *cms = mtev_cms_alloc_error(0.0005, 0.001, 0);
+  mtev_cms_t *a, *b, *copy;
+  uint32_t *truth = calloc(NKEYS, sizeof(*truth));
+  double err = 0, maxerr = 0;
+  int over = 0;
+  size_t len;
+  void *buf;
+
+  printf("count-min:\n");
+  BENCH("add", NOPS, (mtev_cms_add(cms, keys[skewed[i]], keylen[skewed[i]], 1),
+                      truth[skewed[i]]++));
+  BENCH("estimate", NOPS, (void)mtev_cms_estimate(cms, keys[skewed[i]], keylen[skewed[i]]));
+  assert(mtev_cms_total(cms) == NOPS);
+  for(int i = 0; i < NKEYS; i++) {
+    uint32_t est = mtev_cms_estimate(cms, keys[i], keylen[i]);
+    assert(est >= truth[i]);
+    err += est - truth[i];
+    if(est - truth[i] > maxerr) maxerr = est - truth[i];
+    if(est - truth[i] > 0.0005 * NOPS) over++;
+  }
+  printf("  mean overcount %.3f, max %.0f, %d keys over the %.0f bound\n",
+         err / NKEYS, maxerr, over, 0.0005 * NOPS);
+  /* each key exceeds epsilon * total with probability at most delta */
+  assert(over <= 0.001 * NKEYS);
+
+  /* merging two halves matches the counts (as an upper bound) */
+  a = mtev_cms_alloc_error(0.0005, 0.001, 0);
+  b = mtev_cms_alloc_error(0.0005, 0.001, 0);
+  for(int i = 0; i < NOPS; i++)
+    mtev_cms_add(i & 1 ? a : b, keys[skewed[i]], keylen[skewed[i]], 1);
+  assert(mtev_cms_merge(a, b) == 0);
+  assert(mtev_cms_total(a) == NOPS);
+  for(int i = 0; i < NKEYS; i++)
+    assert(mtev_cms_estimate(a, keys[i], keylen[i]) >= truth[i]);
+  assert(mtev_cms_merge(a, mtev_cms_alloc(16, 2, 0)) == -1);
+
+  len = mtev_cms_serialized_size(a);
+  buf = roundtrip_buf(len);
+  assert(mtev_cms_serialize(a, buf, len - 1) == -1);
+  assert(mtev_cms_serialize(a, buf, len) == (ssize_t)len);
+  assert(NULL == mtev_cms_deserialize(buf, len - 1, 0));
+  copy = mtev_cms_deserialize(buf, len, 0);
+  assert(copy && mtev_cms_total(copy) == NOPS);
+  for(int i = 0; i < NKEYS; i++)
+    assert(mtev_cms_estimate(a, keys[i], keylen[i]) ==
+           mtev_cms_estimate(copy, keys[i], keylen[i]));
+  printf("  serialized %zu bytes\n", len);
+  free(buf);
+  mtev_cms_destroy(copy);
+  mtev_cms_destroy(a);
+  mtev_cms_destroy(b);
+  mtev_cms_destroy(cms);
+  free(truth);
+}
+
+static mtev_cms_t *shared_cms;
+static void *cms_thread(void *unused) {
+  for(int i = 0; i < NOPS / NTHREADS; i++)
+    mtev_cms_add(shared_cms, keys[skewed[i]], keylen[skewed[i]], 1);
+  return NULL;
+}
+static void test_cms_concurrent(void) {
+  pthread_t t[NTHREADS];
+  uint32_t *truth = calloc(NKEYS, sizeof(*truth));
+  shared_cms = mtev_cms_alloc_error(0.0005, 0.001, MTEV_SKETCH_CONCURRENT);
+  for(int i = 0; i < NTHREADS; i++) pthread_create(&t[i], NULL, cms_thread, NULL);
+  for(int i = 0; i < NTHREADS; i++) pthread_join(t[i], NULL);
+  for(int i = 0; i < NOPS / NTHREADS; i++) truth[skewed[i]] += NTHREADS;
+  assert(mtev_cms_total(shared_cms) == (NOPS / NTHREADS) * NTHREADS);
+  /* conservative update never undercounts, even racing on one key */
+  for(int i = 0; i < NKEYS; i++)
+    assert(mtev_cms_estimate(shared_cms, keys[i], keylen[i]) >= truth[i]);
+  mtev_cms_destroy(shared_cms);
+  free(truth);
+  printf("  concurrent: ok\n");
+}
+
+static double *samples;
+static int dbl_cmp(const void *a, const void *b) {
+  double av = *(const double *)a, bv = *(const double *)b;
+  return (av < bv) ? -1 : (av > bv);
+}
+/* the rank (as a fraction) of v within the sorted samples */
+static double rank_of(double v, int n) {
+  int lo = 0, hi = n;
+  while(lo < hi) {
+    int m = (lo + hi) / 2;
+    if(samples[m] <= v) lo = m + 1;
+    else hi = m;
+  }
+  return (double)lo / n;
+}
+static void check_quantiles(const char *what, mtev_tdigest_t *td, int n) {
+  static const double qs[] = { 0.001, 0.01, 0.1, 0.5, 0.9, 0.99, 0.999 };
+  printf("  %s:", what);
+  for(size_t i = 0; i < sizeof(qs)/sizeof(*qs); i++) {
+    double q = qs[i], r = rank_of(mtev_tdigest_quantile(td, q), n);
+    /* error scales with sqrt(q(1-q)) / compression */
+    double allowed = 0.0005 + 3 * sqrt(q * (1 - q)) / 100.0 / 4;
+    printf(" q%g=%+.5f", q, r - q);
+    assert(fabs(r - q) <= allowed);
+  }
+  printf("\n");
+}
+static void test_tdigest(void) {
+  mtev_tdigest_t *td = mtev_tdigest_alloc(100, 0), *parts[10], *merged, *copy;
+  size_t len;
+  void *buf;
+
+  assert(isnan(mtev_tdigest_quantile(td, 0.5)));
+  printf("t-digest:\n");
+  samples = malloc(NOPS * sizeof(*samples));
+  srand(42);
+  for(int i = 0; i < NOPS; i++) samples[i] = -log((rand() + 1.0) / ((double)RAND_MAX + 2));
+  BENCH("add", NOPS, mtev_tdigest_add(td, samples[i], 1));
+  BENCH("quantile", 10000, (void)mtev_tdigest_quantile(td, i / 10000.0));
+  assert(mtev_tdigest_count(td) == NOPS);
+  qsort(samples, NOPS, sizeof(*samples), dbl_cmp);
+  check_quantiles("exponential", td, NOPS);
+  assert(mtev_tdigest_quantile(td, 0) == samples[0]);
+  assert(mtev_tdigest_quantile(td, 1) == samples[NOPS - 1]);
+  assert(fabs(mtev_tdigest_cdf(td, samples[NOPS / 2]) - 0.5) < 0.005);
+
+  /* merged pieces are as good as the whole */
+  for(int i = 0; i < 10; i++) parts[i] = mtev_tdigest_alloc(100, 0);
+  for(int i = 0; i < NOPS; i++) mtev_tdigest_add(parts[(i * 7) % 10], samples[i], 1);
+  merged = mtev_tdigest_alloc(100, 0);
+  for(int i = 0; i < 10; i++) {
+    assert(mtev_tdigest_merge(merged, parts[i]) == 0);
+    mtev_tdigest_destroy(parts[i]);
+  }
+  assert(mtev_tdigest_count(merged) == NOPS);
+  check_quantiles("merged", merged, NOPS);
+
+  len = mtev_tdigest_serialized_size(merged);
+  buf = roundtrip_buf(len);
+  assert(mtev_tdigest_serialize(merged, buf, len) == (ssize_t)len);
+  assert(NULL == mtev_tdigest_deserialize(buf, len - 1, 0));
+  copy = mtev_tdigest_deserialize(buf, len, 0);
+  assert(copy);
+  for(double q = 0; q <= 1; q += 0.01)
+    assert(mtev_tdigest_quantile(copy, q) == mtev_tdigest_quantile(merged, q));
+  printf("  serialized %zu bytes\n", len);
+  free(buf);
+  mtev_tdigest_destroy(copy);
+  mtev_tdigest_destroy(merged);
+  mtev_tdigest_destroy(td);
+}
+
+static mtev_tdigest_t *shared_td;
+static void *td_thread(void *unused) {
+  for(int i = 0; i < NOPS / NTHREADS; i++) mtev_tdigest_add(shared_td, samples[i], 1);
+  return NULL;
+}
+static void test_tdigest_concurrent(void) {
+  pthread_t t[NTHREADS];
+  shared_td = mtev_tdigest_alloc(100, MTEV_SKETCH_CONCURRENT);
+  for(int i = 0; i < NTHREADS; i++) pthread_create(&t[i], NULL, td_thread, NULL);
+  for(int i = 0; i < NTHREADS; i++) pthread_join(t[i], NULL);
+  assert(mtev_tdigest_count(shared_td) == (NOPS / NTHREADS) * NTHREADS);
+  mtev_tdigest_destroy(shared_td);
+  free(samples);
+  printf("  concurrent: ok\n");
+}
+
+static char absents[NKEYS][24];
+static int absentlen[NKEYS];
+static void absent_key(int i, char *buf, int *len) {
+  *len = snprintf(buf, 24, "absent%d", i);
+}
+
+static void test_bloom(void) {
+  mtev_bloom_t *bf = mtev_bloom_alloc(NKEYS, 0.01, 0), *other, *copy;
+  char absent[24];
+  int alen, fp = 0;
+  size_t len;
+  void *buf;
+
+  printf("bloom:\n");
+  BENCH("add", NKEYS, mtev_bloom_add(bf, keys[i], keylen[i]));
+  BENCH("contains (present)", NOPS,
+        assert(mtev_bloom_contains(bf, keys[i % NKEYS], keylen[i % NKEYS])));
+  BENCH("contains (absent)", NOPS,
+        fp += mtev_bloom_contains(bf, absents[i % NKEYS], absentlen[i % NKEYS]));
+  printf("  false positives %.3f%% (target 1%%), %zu bytes\n",
+         100.0 * fp / NOPS, mtev_bloom_serialized_size(bf));
+  assert(fp < NOPS / 75);
+
+  other = mtev_bloom_alloc(NKEYS, 0.01, 0);
+  absent_key(0, absent, &alen);
+  mtev_bloom_add(other, absent, alen);
+  assert(mtev_bloom_merge(other, bf) == 0);
+  assert(mtev_bloom_contains(other, absent, alen));
+  for(int i = 0; i < NKEYS; i++) assert(mtev_bloom_contains(other, keys[i], keylen[i]));
+  len = mtev_bloom_serialized_size(other);
+  buf = roundtrip_buf(len);
+  assert(mtev_bloom_serialize(other, buf, len) == (ssize_t)len);
+  assert(NULL == mtev_bloom_deserialize(buf, len - 1, 0));
+  copy = mtev_bloom_deserialize(buf, len, 0);
+  assert(copy && mtev_bloom_contains(copy, absent, alen));
+  for(int i = 0; i < NKEYS; i++) assert(mtev_bloom_contains(copy, keys[i], keylen[i]));
+  assert(mtev_bloom_merge(copy, mtev_bloom_alloc(10, 0.5, 0)) == -1);
+  free(buf);
+  mtev_bloom_destroy(copy);
+  mtev_bloom_destroy(other);
+  mtev_bloom_destroy(bf);
+}
+
+static void *shared_filter;
+static void *bloom_thread(void *vid) {
+  int id = (int)(intptr_t)vid;
+  for(int i = id; i < NKEYS; i += NTHREADS) mtev_bloom_add(shared_filter, keys[i], keylen[i]);
+  return NULL;
+}
+static void test_bloom_concurrent(void) {
+  pthread_t t[NTHREADS];
+  shared_filter = mtev_bloom_alloc(NKEYS, 0.01, MTEV_SKETCH_CONCURRENT);
+  for(int i = 0; i < NTHREADS; i++)
+    pthread_create(&t[i], NULL, bloom_thread, (void *)(intptr_t)i);
+  for(int i = 0; i < NTHREADS; i++) pthread_join(t[i], NULL);
+  for(int i = 0; i < NKEYS; i++)
+    assert(mtev_bloom_contains(shared_filter, keys[i], keylen[i]));
+  mtev_bloom_destroy(shared_filter);
+  printf("  concurrent: ok\n");
+}
+
+static void test_cuckoo(void) {
+  mtev_cuckoo_t *cf = mtev_cuckoo_alloc(NKEYS, 0), *a, *b, *copy;
+  char absent[24];
+  int alen, fp = 0, added = 0;
+  size_t len;
+  void *buf;
+
+  printf("cuckoo:\n");
+  BENCH("add", NKEYS, assert(mtev_cuckoo_add(cf, keys[i], keylen[i])));
+  assert(mtev_cuckoo_count(cf) == NKEYS);
+  BENCH("contains (present)", NOPS,
+        assert(mtev_cuckoo_contains(cf, keys[i % NKEYS], keylen[i % NKEYS])));
+  BENCH("contains (absent)", NOPS,
+        fp += mtev_cuckoo_contains(cf, absents[i % NKEYS], absentlen[i % NKEYS]));
+  printf("  false positives %.4f%%, %zu bytes\n",
+         100.0 * fp / NOPS, mtev_cuckoo_serialized_size(cf));
+  assert(fp < NOPS / 2000);
+  BENCH("delete", NKEYS / 2, assert(mtev_cuckoo_delete(cf, keys[i * 2], keylen[i * 2])));
+  assert(mtev_cuckoo_count(cf) == NKEYS / 2);
+  for(int i = 1; i < NKEYS; i += 2) assert(mtev_cuckoo_contains(cf, keys[i], keylen[i]));
+
+  /* keep going until it reports full; everything added must be present */
+  for(int i = 0; ; i++) {
+    absent_key(i, absent, &alen);
+    if(!mtev_cuckoo_add(cf, absent, alen)) break;
+    added++;
+  }
+  printf("  filled to %.1f%% load\n",
+         100.0 * mtev_cuckoo_count(cf) / (mtev_cuckoo_serialized_size(cf) / 2));
+  for(int i = 0; i < added; i++) {
+    absent_key(i, absent, &alen);
+    assert(mtev_cuckoo_contains(cf, absent, alen));
+  }
+  for(int i = 1; i < NKEYS; i += 2) assert(mtev_cuckoo_contains(cf, keys[i], keylen[i]));
+  /* deleting makes room again */
+  for(int i = 0; i < 100; i++) {
+    absent_key(i, absent, &alen);
+    assert(mtev_cuckoo_delete(cf, absent, alen));
+  }
+  assert(mtev_cuckoo_add(cf, absent, alen));
+
+  a = mtev_cuckoo_alloc(NKEYS, 0);
+  b = mtev_cuckoo_alloc(NKEYS, 0);
+  for(int i = 0; i < NKEYS; i++)
+    assert(mtev_cuckoo_add(i & 1 ? a : b, keys[i], keylen[i]));
+  assert(mtev_cuckoo_merge(a, b) == 0);
+  assert(mtev_cuckoo_count(a) == NKEYS);
+  for(int i = 0; i < NKEYS; i++) assert(mtev_cuckoo_contains(a, keys[i], keylen[i]));
+  len = mtev_cuckoo_serialized_size(a);
+  buf = roundtrip_buf(len);
+  assert(mtev_cuckoo_serialize(a, buf, len) == (ssize_t)len);
+  assert(NULL == mtev_cuckoo_deserialize(buf, len - 1, 0));
+  copy = mtev_cuckoo_deserialize(buf, len, 0);
+  assert(copy && mtev_cuckoo_count(copy) == NKEYS);
+  for(int i = 0; i < NKEYS; i++) assert(mtev_cuckoo_contains(copy, keys[i], keylen[i]));
+  free(buf);
+  mtev_cuckoo_destroy(copy);
+  mtev_cuckoo_destroy(b);
+  mtev_cuckoo_destroy(a);
+  mtev_cuckoo_destroy(cf);
+}
+
+/* readers must never miss a key that was added before they started, even
+ * while a writer is kicking fingerprints around a nearly full table */
+static volatile int writer_done;
+static void *cuckoo_writer(void *unused) {
+  char k[24];
+  int len;
+  for(int i = 0; ; i++) {
+    absent_key(i, k, &len);
+    if(!mtev_cuckoo_add(shared_filter, k, len)) break;
+  }
+  writer_done = 1;
+  return NULL;
+}
+static void *cuckoo_reader(void *unused) {
+  int misses = 0;
+  do {
+    for(int i = 0; i < NKEYS / 2; i++)
+      misses += !mtev_cuckoo_contains(shared_filter, keys[i], keylen[i]);
+  } while(!writer_done);
+  return (void *)(intptr_t)misses;
+}
+static void test_cuckoo_concurrent(void) {
+  pthread_t w, r[NTHREADS - 1];
+  void *misses;
+  shared_filter = mtev_cuckoo_alloc(NKEYS, MTEV_SKETCH_CONCURRENT);
+  for(int i = 0; i < NKEYS / 2; i++) assert(mtev_cuckoo_add(shared_filter, keys[i], keylen[i]));
+  for(int i = 0; i < NTHREADS - 1; i++) pthread_create(&r[i], NULL, cuckoo_reader, NULL);
+  pthread_create(&w, NULL, cuckoo_writer, NULL);
+  pthread_join(w, NULL);
+  for(int i = 0; i < NTHREADS - 1; i++) {
+    pthread_join(r[i], &misses);
+    assert(misses == NULL);
+  }
+  mtev_cuckoo_destroy(shared_filter);
+  printf("  concurrent: ok\n");
+}
+
+int main(int argc, char **argv) {
+  setvbuf(stdout, NULL, _IONBF, 0);
+  for(int i = 0; i < NKEYS; i++) {
+    keylen[i] = snprintf(keys[i], sizeof(keys[i]), "key%d", i);
+    absent_key(i, absents[i], &absentlen[i]);
+  }
+  srand(7);
+  for(int i = 0; i < NOPS; i++) {
+    double u = (rand() + 1.0) / ((double)RAND_MAX + 2);
+    skewed[i] = (int)(pow(NKEYS, u) - 1) % NKEYS;
+  }
+  test_cms();
+  test_cms_concurrent();
+  test_tdigest();
+  test_tdigest_concurrent();
+  test_bloom();
+  test_bloom_concurrent();
+  test_cuckoo();
+  test_cuckoo_concurrent();
+  return 0;
+}
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <mtev_defines.h>
+#include <mtev_smap.h>
+
+#define NKEYS 20000
+
+static char *keys[NKEYS];
+static int present[NKEYS];
+
+static void
+check_all(mtev_smap_t *map) {
+  size_t i, n = 0;
+  mtev_smap_iter_t iter = MTEV_SMAP_ITER_ZERO;
+  for(i = 0; i < NKEYS; i++) {
+    void *v = NULL;
+    mtev_boolean found = mtev_smap_retrieve(map, keys[i], strlen(keys[i]), &v);
+    assert(found == (present[i] != 0));
+    if(found) {
+      assert(v == (void *)keys[i]);
+      n++;
+    }
+  }
+  assert(n == mtev_smap_size(map));
+  n = 0;
+  while(mtev_smap_next(map, &iter)) {
+    assert(iter.value && !strcmp(iter.key, iter.value));
+    assert(iter.klen == strlen(iter.key));
+    n++;
+  }
+  assert(n == mtev_smap_size(map));
+}
+
+int main() {
+  mtev_smap_t *map = mtev_smap_create(0);
+  size_t i;
+  int round;
+  void *old;
+
+  for(i = 0; i < NKEYS; i++) {
+    char buf[128];
+    /* a mix of inline and out-of-line keys */
+    if(i % 3) snprintf(buf, sizeof(buf), "k%zu", i);
+    else snprintf(buf, sizeof(buf), "a-rather-longer-header-name-%zu", i);
+    keys[i] = strdup(buf);
+  }
+
+  srand(42);
+  for(round = 0; round < 10; round++) {
+    for(i = 0; i < NKEYS; i++) {
+      int k = rand() % NKEYS;
+      size_t klen = strlen(keys[k]);
+      switch(rand() % 3) {
+        case 0:
+        case 1:
+          assert(mtev_smap_set(map, keys[k], klen, keys[k], &old) == !present[k]);
+          if(present[k]) assert(old == keys[k]);
+          present[k] = 1;
+          break;
+        case 2:
+          assert(mtev_smap_delete(map, keys[k], klen, &old) == (present[k] != 0));
+          if(present[k]) assert(old == keys[k]);
+          present[k] = 0;
+          break;
+      }
+    }
+    check_all(map);
+  }
+
+  /* precomputed hashes and store-if-absent */
+  for(i = 0; i < NKEYS; i++) {
+    size_t klen = strlen(keys[i]);
+    uint64_t h = mtev_smap_hash(keys[i], klen);
+    assert(mtev_smap_hash(keys[i], klen) == h);
+    assert(mtev_smap_retrieve_hashed(map, keys[i], klen, h, NULL) == (present[i] != 0));
+    assert(mtev_smap_store(map, keys[i], klen, keys[i]) == !present[i]);
+    present[i] = 1;
+  }
+  check_all(map);
+  /* keys are copied in, and prefixes are distinct keys */
+  assert(!mtev_smap_retrieve(map, "k", 1, NULL));
+  assert(mtev_smap_store(map, "", 0, keys[0]));
+  assert(mtev_smap_retrieve(map, "", 0, &old) && old == keys[0]);
+  assert(mtev_smap_delete(map, "", 0, NULL));
+
+  mtev_smap_clear(map, NULL);
+  memset(present, 0, sizeof(present));
+  check_all(map);
+  mtev_smap_destroy(map, NULL);
+  for(i = 0; i < NKEYS; i++) free(keys[i]);
+  printf("ok\n");
+  return 0;
+}
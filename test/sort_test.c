@@ -1,9 +1,22 @@
+#include <mtev_defines.h>
+#include <mtev_main.h>
+#include <mtev_conf.h>
+#include <mtev_memory.h>
 #include <mtev_sort.h>
 #include <mtev_time.h>
+#include <eventer/eventer.h>
+#include <ck_pr.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+#include <time.h>
 
 #define FAIL(...)                           \
   printf("** ");                            \
@@ -34,10 +47,390 @@ void set_next_function(void *x, void *v) {
 }
 
 #define DEFAULT_SORT_SIZE 300000
+#define APPNAME "sort_test"
+#define JOBQ_CONCURRENCY 4
+
+static int sort_size = DEFAULT_SORT_SIZE;
+static char dir[PATH_MAX], config_file[PATH_MAX];
+
+static double elapsed_ms(mtev_hrtime_t start) {
+  return (double)(mtev_gethrtime() - start) / 1000000.0;
+}
+
+static uint64_t rnd64(void) {
+  return ((uint64_t)rand() << 42) ^ ((uint64_t)rand() << 21) ^ (uint64_t)rand();
+}
+
+static int cmp_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return x < y ? -1 : x > y;
+}
+static int cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+static int cmp_i64(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+  return x < y ? -1 : x > y;
+}
+static int cmp_dbl(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+/* A record type sorted through the inlined template. */
+struct sample {
+  double value;
+  uint32_t id;
+};
+#define SAMPLE_LESS(a, b) ((a).value < (b).value)
+#define SAMPLE_MORE(a, b) ((a).value > (b).value)
+MTEV_SORT_DEFINE(sample, struct sample, SAMPLE_LESS)
+MTEV_SORT_DEFINE(sample_desc, struct sample, SAMPLE_MORE)
+
+static int cmp_sample(const void *a, const void *b) {
+  const struct sample *x = a, *y = b;
+  return x->value < y->value ? -1 : x->value > y->value;
+}
+
+static void test_radix(size_t n) {
+  uint32_t *u32 = malloc(n * sizeof(*u32)), *u32c = malloc(n * sizeof(*u32));
+  uint64_t *u64 = malloc(n * sizeof(*u64)), *u64c = malloc(n * sizeof(*u64));
+  int64_t *i64 = (int64_t *)u64, *i64c = (int64_t *)u64c;
+  double *d = malloc(n * sizeof(*d)), *dc = malloc(n * sizeof(*d));
+  mtev_hrtime_t start;
+  double qs_ms;
+  size_t i;
+
+#define RADIX_CASE(label, arr, copy, fill, sortf, cmpf) do { \
+    for(i = 0; i < n; i++) arr[i] = fill; \
+    memcpy(copy, arr, n * sizeof(*arr)); \
+    start = mtev_gethrtime(); \
+    qsort(copy, n, sizeof(*arr), cmpf); \
+    qs_ms = elapsed_ms(start); \
+    start = mtev_gethrtime(); \
+    sortf(arr, n); \
+    printf("%-8s %zu: radix %.1fms, qsort %.1fms\n", label, n, \
+           elapsed_ms(start), qs_ms); \
+    if(memcmp(arr, copy, n * sizeof(*arr))) { FAIL("%s radix sort mismatch", label); } \
+  } while(0)
+
+  RADIX_CASE("uint32", u32, u32c, (uint32_t)rnd64(), mtev_sort_uint32, cmp_u32);
+  RADIX_CASE("uint32/s", u32, u32c, (uint32_t)(rand() % 1000), mtev_sort_uint32, cmp_u32);
+  RADIX_CASE("uint64", u64, u64c, rnd64(), mtev_sort_uint64, cmp_u64);
+  RADIX_CASE("int64", i64, i64c, (int64_t)rnd64() >> (rand() % 40), mtev_sort_int64, cmp_i64);
+  RADIX_CASE("double", d, dc, (double)(int64_t)rnd64() / (double)(1 + rand()),
+             mtev_sort_double, cmp_dbl);
+  RADIX_CASE("uint64/8", u64, u64c, rnd64(), mtev_sort_uint64, cmp_u64);
+
+  /* signed zeros and NaNs have a defined place */
+  d[0] = 0.0; d[1] = -0.0; d[2] = NAN; d[3] = -1.0; d[4] = 1.0;
+  mtev_sort_double(d, 5);
+  if(!(d[0] == -1.0 && signbit(d[1]) && d[2] == 0.0 && !signbit(d[2]) &&
+       d[3] == 1.0 && isnan(d[4]))) {
+    FAIL("double ordering of -0.0/NaN");
+  }
+  for(i = 0; i < n; i++) d[i] = (i % 7 == 0) ? NAN : (double)(rand() % 100);
+  if(!isnan(mtev_sort_select_double(d, n, n - 1))) {
+    FAIL("select_double: NaN should order last");
+  }
+  if(isnan(mtev_sort_select_double(d, n, 0))) {
+    FAIL("select_double: NaN selected first");
+  }
+  free(u32); free(u32c); free(u64); free(u64c); free(d); free(dc);
+}
+
+static void check_samples(const char *label, struct sample *a, size_t n) {
+  size_t i;
+  for(i = 1; i < n; i++) {
+    if(a[i].value < a[i-1].value) { FAIL("%s: out of order at %zu", label, i); }
+  }
+}
+
+static void test_template(size_t n) {
+  struct sample *a = malloc(n * sizeof(*a)), *b = malloc(n * sizeof(*a));
+  const char *patterns[] = { "random", "sorted", "reversed", "equal",
+                             "few-unique", "organ-pipe", "sorted+noise" };
+  mtev_hrtime_t start;
+  double qs_ms;
+  size_t i, p, k;
+
+  for(p = 0; p < sizeof(patterns)/sizeof(*patterns); p++) {
+    for(i = 0; i < n; i++) {
+      switch(p) {
+        case 0: a[i].value = rand(); break;
+        case 1: a[i].value = i; break;
+        case 2: a[i].value = n - i; break;
+        case 3: a[i].value = 42; break;
+        case 4: a[i].value = rand() % 8; break;
+        case 5: a[i].value = i < n / 2 ? i : n - i; break;
+        case 6: a[i].value = (i % 100 == 0) ? rand() : i; break;
+      }
+      a[i].id = i;
+    }
+    memcpy(b, a, n * sizeof(*a));
+    start = mtev_gethrtime();
+    qsort(b, n, sizeof(*b), cmp_sample);
+    qs_ms = elapsed_ms(start);
+    start = mtev_gethrtime();
+    sample_sort(a, n);
+    printf("pdqsort  %zu %-12s %.1fms, qsort %.1fms\n", n, patterns[p],
+           elapsed_ms(start), qs_ms);
+    check_samples(patterns[p], a, n);
+    for(i = 0; i < n; i++) {
+      if(a[i].value != b[i].value) { FAIL("%s: mismatch with qsort", patterns[p]); }
+    }
+  }
+
+  /* selection and top-K */
+  for(i = 0; i < n; i++) { a[i].value = rand() % (n / 4 + 1); a[i].id = i; }
+  memcpy(b, a, n * sizeof(*a));
+  qsort(b, n, sizeof(*b), cmp_sample);
+  for(k = 0; k < n; k += n / 7 + 1) {
+    struct sample *c = malloc(n * sizeof(*c));
+    memcpy(c, a, n * sizeof(*a));
+    sample_select(c, n, k);
+    if(c[k].value != b[k].value) { FAIL("select %zu", k); }
+    for(i = 0; i < k; i++) if(c[i].value > c[k].value) { FAIL("select %zu: left", k); }
+    for(i = k + 1; i < n; i++) if(c[i].value < c[k].value) { FAIL("select %zu: right", k); }
+    free(c);
+  }
+  memcpy(b, a, n * sizeof(*a));
+  start = mtev_gethrtime();
+  sample_desc_partial_sort(b, n, 100);
+  printf("top-100  %zu: %.1fms\n", n, elapsed_ms(start));
+  qsort(a, n, sizeof(*a), cmp_sample);
+  for(i = 0; i < 100; i++) {
+    if(b[i].value != a[n - 1 - i].value) { FAIL("top-K mismatch at %zu", i); }
+  }
+  free(a);
+  free(b);
+}
+
+static void test_parallel(size_t n) {
+  struct sample *a = malloc(n * sizeof(*a)), *b = malloc(n * sizeof(*a));
+  uint64_t *u = malloc(n * sizeof(*u)), *v = malloc(n * sizeof(*u));
+  int parts;
+  size_t i;
+
+  /* without a jobq the pieces run on the caller, exercising the merges */
+  for(parts = 1; parts <= 16; parts *= 2) {
+    for(i = 0; i < n; i++) { a[i].value = rand() % 1000; a[i].id = i; }
+    memcpy(b, a, n * sizeof(*a));
+    sample_sort_parallel(a, n, NULL, parts);
+    check_samples("parallel", a, n);
+    mtev_sort_parallel(b, n, sizeof(*b), cmp_sample, NULL, parts + 1);
+    check_samples("generic parallel", b, n);
+    for(i = 0; i < n; i++) u[i] = v[i] = rnd64();
+    mtev_sort_parallel(u, n, sizeof(*u), cmp_u64, NULL, parts);
+    mtev_sort_uint64(v, n);
+    if(memcmp(u, v, n * sizeof(*u))) { FAIL("generic parallel %d", parts); }
+  }
+  free(a); free(b); free(u); free(v);
+}
+
+/* Each index must run exactly once, and the caller must return only
+ * after all of them have. */
+struct task_count {
+  int ntasks;
+  int *runs;
+};
+
+static void count_task(void *closure, int idx) {
+  struct task_count *tc = closure;
+  if(idx & 1) usleep(100);
+  ck_pr_inc_int(&tc->runs[idx]);
+}
+
+static void check_run_parallel(eventer_jobq_t *jobq, int ntasks) {
+  struct task_count tc;
+  int i;
+  tc.ntasks = ntasks;
+  tc.runs = calloc(ntasks ? ntasks : 1, sizeof(*tc.runs));
+  mtev_sort_run_parallel(jobq, ntasks, count_task, &tc);
+  for(i = 0; i < ntasks; i++) {
+    if(ck_pr_load_int(&tc.runs[i]) != 1) {
+      FAIL("run_parallel(%d): task %d ran %d times", ntasks, i, tc.runs[i]);
+    }
+  }
+  free(tc.runs);
+}
+
+static int blockers_release;
+static int blockers_running;
+
+static int blocker(eventer_t e, int mask, void *closure, struct timeval *now) {
+  if(mask == EVENTER_ASYNCH_WORK) {
+    ck_pr_inc_int(&blockers_running);
+    while(!ck_pr_load_int(&blockers_release)) usleep(1000);
+  }
+  return 0;
+}
+
+static void test_run_parallel_jobq(eventer_jobq_t *jobq) {
+  int i, n;
+
+  /* fewer, as many and more tasks than helpers, back to back so helper
+   * references outlive the calls that spawned them */
+  for(i = 0; i < 200; i++) {
+    check_run_parallel(jobq, 1 + i % (3 * JOBQ_CONCURRENCY));
+  }
+
+  /* With every jobq thread busy the caller has to do all the work; the
+   * helpers queued behind the blockers find nothing left once released
+   * and drop the last references after we've returned. */
+  ck_pr_store_int(&blockers_release, 0);
+  for(i = 0; i < JOBQ_CONCURRENCY; i++) {
+    eventer_t e = eventer_alloc();
+    e->mask = EVENTER_ASYNCH;
+    e->callback = blocker;
+    eventer_add_asynch(jobq, e);
+  }
+  for(n = 0; ck_pr_load_int(&blockers_running) < JOBQ_CONCURRENCY && n < 5000; n++)
+    usleep(1000);
+  if(ck_pr_load_int(&blockers_running) < JOBQ_CONCURRENCY) {
+    FAIL("jobq blockers never started");
+  }
+  for(i = 0; i < 10; i++) check_run_parallel(jobq, 2 * JOBQ_CONCURRENCY);
+  ck_pr_store_int(&blockers_release, 1);
+  for(i = 0; i < 50; i++) check_run_parallel(jobq, JOBQ_CONCURRENCY);
+}
+
+static void test_parallel_jobq(eventer_jobq_t *jobq, size_t n) {
+  struct sample *a = malloc(n * sizeof(*a)), *b = malloc(n * sizeof(*a));
+  uint64_t *u = malloc(n * sizeof(*u)), *v = malloc(n * sizeof(*u));
+  int parts;
+  size_t i;
+
+  for(parts = 0; parts <= 16; parts = parts ? parts * 2 : 2) {
+    for(i = 0; i < n; i++) { a[i].value = rand() % 1000; a[i].id = i; }
+    memcpy(b, a, n * sizeof(*a));
+    sample_sort_parallel(a, n, jobq, parts);
+    check_samples("jobq parallel", a, n);
+    mtev_sort_parallel(b, n, sizeof(*b), cmp_sample, jobq, parts);
+    check_samples("jobq generic parallel", b, n);
+    for(i = 0; i < n; i++) u[i] = v[i] = rnd64();
+    mtev_sort_parallel(u, n, sizeof(*u), cmp_u64, jobq, parts);
+    mtev_sort_uint64(v, n);
+    if(memcmp(u, v, n * sizeof(*u))) { FAIL("jobq generic parallel %d", parts); }
+  }
+  free(a); free(b); free(u); free(v);
+}
+
+static void bench_parallel(eventer_jobq_t *jobq, size_t n) {
+  struct sample *orig = malloc(n * sizeof(*orig)), *a = malloc(n * sizeof(*a));
+  mtev_hrtime_t start;
+  double serial, alone, helped;
+  size_t i;
+  int parts = mtev_sort_parallel_parts(jobq, n);
+
+  for(i = 0; i < n; i++) { orig[i].value = rand(); orig[i].id = i; }
+  memcpy(a, orig, n * sizeof(*a));
+  start = mtev_gethrtime();
+  sample_sort(a, n);
+  serial = elapsed_ms(start);
+  memcpy(a, orig, n * sizeof(*a));
+  start = mtev_gethrtime();
+  sample_sort_parallel(a, n, NULL, parts);
+  alone = elapsed_ms(start);
+  check_samples("bench alone", a, n);
+  memcpy(a, orig, n * sizeof(*a));
+  start = mtev_gethrtime();
+  sample_sort_parallel(a, n, jobq, parts);
+  helped = elapsed_ms(start);
+  check_samples("bench jobq", a, n);
+  printf("parallel %zu in %d parts: pdqsort %.1fms, caller only %.1fms, "
+         "jobq(%d) %.1fms\n", n, parts, serial, alone, JOBQ_CONCURRENCY, helped);
+  free(orig);
+  free(a);
+}
+
+static void *
+jobq_main(void *unused) {
+  eventer_jobq_t *jobq;
+  (void)unused;
+  mtev_memory_init_thread();
+  jobq = eventer_jobq_create(APPNAME);
+  eventer_jobq_set_concurrency(jobq, JOBQ_CONCURRENCY);
+  test_run_parallel_jobq(jobq);
+  test_parallel_jobq(jobq, sort_size);
+  test_parallel_jobq(jobq, 37);
+  bench_parallel(jobq, (size_t)sort_size * 10);
+  printf("SUCCESS\n");
+  exit(0);
+  return NULL;
+}
+
+static int
+child_main(void) {
+  pthread_t tid;
+  if(mtev_conf_load(NULL) == -1) {
+    FAIL("cannot load config: %s", config_file);
+  }
+  eventer_init();
+  pthread_create(&tid, NULL, jobq_main, NULL);
+  eventer_loop();
+  return 0;
+}
+
+/* The jobq tests need a running eventer, so they go last, under mtev_main. */
+static void run_jobq_tests(void) {
+  FILE *fp;
+  char tmpl[] = "/tmp/sort_test.XXXXXX";
+
+  if(!mkdtemp(tmpl) || !realpath(tmpl, dir)) {
+    FAIL("mkdtemp: %s", strerror(errno));
+  }
+  snprintf(config_file, sizeof(config_file), "%s/" APPNAME ".conf", dir);
+  fp = fopen(config_file, "w");
+  if(!fp) {
+    FAIL("fopen: %s", strerror(errno));
+  }
+  fprintf(fp,
+          "<?xml version=\"1.0\" encoding=\"utf8\" standalone=\"yes\"?>\n"
+          "<" APPNAME " lockfile=\"%s/lock\">\n"
+          "  <logs>\n"
+          "    <console_output>\n"
+          "      <outlet name=\"stderr\"/>\n"
+          "      <log name=\"error\"/>\n"
+          "    </console_output>\n"
+          "  </logs>\n"
+          "</" APPNAME ">\n", dir);
+  fclose(fp);
+
+  /* don't hang the suite if a helper never finishes */
+  alarm(120);
+  mtev_memory_init();
+  mtev_main(APPNAME, config_file, 0, 1, MTEV_LOCK_OP_NONE, NULL, NULL, NULL,
+            child_main);
+  FAIL("mtev_main returned");
+}
+
+/* Records keyed by a big-endian integer; the radix sort must be stable. */
+struct rec {
+  uint32_t seq;
+  unsigned char key[3];
+  char pad;
+};
+
+static void test_fixed(size_t n) {
+  struct rec *r = malloc(n * sizeof(*r));
+  size_t i;
+  for(i = 0; i < n; i++) {
+    uint32_t k = rand() % 5000;
+    r[i].key[0] = k >> 16; r[i].key[1] = k >> 8; r[i].key[2] = k;
+    r[i].seq = i;
+  }
+  mtev_sort_fixed(r, n, sizeof(*r), offsetof(struct rec, key), sizeof(r->key));
+  for(i = 1; i < n; i++) {
+    int c = memcmp(r[i-1].key, r[i].key, sizeof(r->key));
+    if(c > 0 || (c == 0 && r[i-1].seq > r[i].seq)) { FAIL("fixed sort at %zu", i); }
+  }
+  free(r);
+}
 
 int main(int argc, char **argv) 
 {
-  int sort_size = DEFAULT_SORT_SIZE;
   srand(time(NULL));
   struct foo *list, *head;
   list = head = malloc(sizeof(struct foo));
@@ -71,5 +464,14 @@ int main(int argc, char **argv)
     begin = iter->data;
     iter = iter->next;
   }
-  printf("SUCCESS\n");
+
+  test_radix(sort_size * 10);
+  test_radix(100);
+  test_template(sort_size * 3);
+  test_template(1000);
+  test_parallel(sort_size);
+  test_parallel(37);
+  test_fixed(sort_size);
+  run_jobq_tests();
+  return 1;
 }
@@ -3,6 +3,10 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #define FAIL(...)                           \
   printf("** ");                            \
@@ -39,12 +43,13 @@ void parse_file()
   FILE *f = fopen("uuids.txt", "r");
 
   char c = getc(f);
-  int i = 0;
+  int i = 0, n = 0;
    
   while ((c != EOF)) {
     if (c == '\n') {
 
-      uuid[UUID_STR_LEN] = '\0';
+      /* libmtev's UUID_STR_LEN is 36, libuuid's 37: end at what we read */
+      uuid[i] = '\0';
       mtev_hrtime_t now = mtev_gethrtime();
       int x = uuid_parse_fn(uuid, result);
       mtev_hrtime_t end = mtev_gethrtime();
@@ -52,14 +57,129 @@ void parse_file()
       if (x != 0) {
         FAIL("Cannot parse!");
       }
+      n++;
       i = 0;
-    } else {
+    } else if (i < (int)sizeof(uuid) - 1) {
       uuid[i++] = c;
     }
     c = getc(f);
   }
   fclose(f);
+  if (n == 0) {
+    FAIL("no UUIDs parsed from uuids.txt");
+  }
+}
+
+static int
+uuid_cmp(const void *a, const void *b)
+{
+  return memcmp(a, b, sizeof(uuid_t));
+}
+
+/* Round-trip every UUID in uuids.txt through both formatters. */
+void unparse_file()
+{
+  char line[UUID_STR_LEN + 2], lower[UUID_STR_LEN + 1], upper[UUID_STR_LEN + 1];
+  char expect[UUID_STR_LEN + 1];
+  uuid_t uu;
+  mtev_hrtime_t mtev_ns = 0, libuuid_ns = 0, start;
+  int i, n = 0;
+  FILE *f = fopen("uuids.txt", "r");
 
+  while (fgets(line, sizeof(line), f)) {
+    line[strcspn(line, "\n")] = '\0';
+    if (uuid_parse(line, uu) != 0) continue;
+    start = mtev_gethrtime();
+    for (i = 0; i < 1000; i++) mtev_uuid_unparse_lower(uu, lower);
+    mtev_ns += mtev_gethrtime() - start;
+    start = mtev_gethrtime();
+    for (i = 0; i < 1000; i++) uuid_unparse_lower(uu, expect);
+    libuuid_ns += mtev_gethrtime() - start;
+    if (strcmp(lower, expect) != 0) {
+      FAIL("mtev_uuid_unparse_lower gave '%s', expected '%s'", lower, expect);
+    }
+    mtev_uuid_unparse_upper(uu, upper);
+    for (i = 0; i < UUID_STR_LEN; i++) {
+      if (upper[i] != toupper(expect[i])) {
+        FAIL("mtev_uuid_unparse_upper gave '%s'", upper);
+      }
+    }
+    n++;
+  }
+  fclose(f);
+  if (n == 0) {
+    FAIL("no UUIDs checked from uuids.txt");
+  }
+  printf("* Unparse: mtev %.1fns, libuuid %.1fns per UUID (%.2fx)\n",
+         (double)mtev_ns / (n * 1000.0), (double)libuuid_ns / (n * 1000.0),
+         (double)libuuid_ns / (double)mtev_ns);
+}
+
+#define NGEN 1000000
+
+void test_generate()
+{
+  uuid_t *uus = malloc(NGEN * sizeof(uuid_t));
+  mtev_hrtime_t start, mtev_ns, libuuid_ns;
+  uint64_t now;
+  int i, status;
+  int fds[2];
+  pid_t pid;
+
+  start = mtev_gethrtime();
+  for (i = 0; i < NGEN; i++) mtev_uuid_generate(uus[i]);
+  mtev_ns = mtev_gethrtime() - start;
+  start = mtev_gethrtime();
+  for (i = 0; i < NGEN / 10; i++) uuid_generate(uus[i]);
+  libuuid_ns = (mtev_gethrtime() - start) * 10;
+  printf("* Generate v4: mtev %.1fns, libuuid %.1fns per UUID\n",
+         (double)mtev_ns / NGEN, (double)libuuid_ns / NGEN);
+
+  mtev_uuid_generate_bulk(uus, NGEN);
+  for (i = 0; i < NGEN; i++) {
+    if ((uus[i][6] >> 4) != 4 || (uus[i][8] & 0xc0) != 0x80) {
+      FAIL("bad v4 version/variant");
+    }
+  }
+  qsort(uus, NGEN, sizeof(uuid_t), uuid_cmp);
+  for (i = 1; i < NGEN; i++) {
+    if (uuid_cmp(uus[i-1], uus[i]) == 0) { FAIL("duplicate v4 UUID"); }
+  }
+
+  now = mtev_now_ms();
+  start = mtev_gethrtime();
+  for (i = 0; i < NGEN; i++) mtev_uuid_generate_v7(uus[i]);
+  printf("* Generate v7: mtev %.1fns per UUID\n",
+         (double)(mtev_gethrtime() - start) / NGEN);
+  for (i = 0; i < NGEN; i++) {
+    if ((uus[i][6] >> 4) != 7 || (uus[i][8] & 0xc0) != 0x80) {
+      FAIL("bad v7 version/variant");
+    }
+    if (i > 0 && uuid_cmp(uus[i-1], uus[i]) >= 0) { FAIL("v7 UUIDs out of order at %d", i); }
+  }
+  if (mtev_uuid_v7_timestamp_ms(uus[0]) < now ||
+      mtev_uuid_v7_timestamp_ms(uus[0]) > now + 1000) {
+    FAIL("v7 timestamp is off");
+  }
+
+  /* a forked child must not repeat its parent's UUIDs */
+  mtev_uuid_generate(uus[0]);
+  if (pipe(fds) != 0) { FAIL("pipe"); }
+  pid = fork();
+  if (pid == 0) {
+    uuid_t child;
+    mtev_uuid_generate(child);
+    if (write(fds[1], child, sizeof(child)) != sizeof(child)) _exit(1);
+    _exit(0);
+  }
+  mtev_uuid_generate(uus[1]);
+  if (read(fds[0], uus[2], sizeof(uuid_t)) != sizeof(uuid_t)) { FAIL("read from child"); }
+  waitpid(pid, &status, 0);
+  close(fds[0]);
+  close(fds[1]);
+  if (uuid_cmp(uus[1], uus[2]) == 0) { FAIL("child repeated the parent's UUID"); }
+  printf("* Generated UUIDs are unique and well-formed\n");
+  free(uus);
 }
 
 int main(int argc, char **argv) 
@@ -144,7 +264,20 @@ int main(int argc, char **argv)
     FAIL("Expected parse failure 6!");
   }
 
+  /* misplaced hyphen and a bad digit in the last group */
+  const char *broken7 = "2f711a8ce-6a1-ce2e-ec52-82aac2906d08";
+  if (mtev_uuid_parse(broken7, uc) != -1) {
+    FAIL("Expected parse failure 7!");
+  }
+  const char *broken8 = "2f711a8c-e6a1-ce2e-ec52-82aac2906d0z";
+  if (mtev_uuid_parse(broken8, uc) != -1) {
+    FAIL("Expected parse failure 8!");
+  }
+
   printf("* Broken UUIDs expectedly fail\n");
+
+  unparse_file();
+  test_generate();
   
   printf("* SUCCESS\n");
 }
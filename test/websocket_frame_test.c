@@ -0,0 +1,317 @@
+#include <mtev_defines.h>
+#include <mtev_http.h>
+#include <mtev_websocket_frame.h>
+#include <eventer/eventer.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define FAIL(...)                           \
+  printf("** ");                            \
+  printf( __VA_ARGS__);                     \
+  printf("\n** FAILURE\n"); \
+  exit(1);
+
+#define WS_TEXT 1
+#define WS_BINARY 2
+
+struct frame {
+  int fin, rsv1, opcode, masked;
+  size_t hlen, plen;
+  unsigned char *payload; /* unmasked copy */
+};
+
+/* A straightforward RFC 6455 frame parser to check the builder against */
+static size_t
+parse_frame(const unsigned char *buf, size_t len, struct frame *f) {
+  size_t i;
+  unsigned char mkey[4];
+  if(len < 2) {
+    FAIL("short frame (%zu)", len);
+  }
+  f->fin = buf[0] >> 7;
+  f->rsv1 = (buf[0] >> 6) & 1;
+  f->opcode = buf[0] & 0x0f;
+  f->masked = buf[1] >> 7;
+  f->plen = buf[1] & 0x7f;
+  f->hlen = 2;
+  if(f->plen == 126) {
+    f->plen = (buf[2] << 8) | buf[3];
+    f->hlen = 4;
+  }
+  else if(f->plen == 127) {
+    f->plen = 0;
+    for(i=0; i<8; i++) f->plen = (f->plen << 8) | buf[2+i];
+    f->hlen = 10;
+  }
+  if(f->masked) {
+    memcpy(mkey, buf + f->hlen, 4);
+    f->hlen += 4;
+  }
+  if(f->hlen + f->plen > len) {
+    FAIL("frame overruns its buffer (%zu + %zu > %zu)", f->hlen, f->plen, len);
+  }
+  f->payload = malloc(f->plen + 1);
+  memcpy(f->payload, buf + f->hlen, f->plen);
+  if(f->masked) for(i=0; i<f->plen; i++) f->payload[i] ^= mkey[i & 3];
+  return f->hlen + f->plen;
+}
+
+static void
+fill(unsigned char *buf, size_t len, mtev_boolean compressible) {
+  size_t i;
+  for(i=0; i<len; i++) buf[i] = compressible ? "websocket "[i % 10] : rand();
+}
+
+static void
+test_frame_build(void) {
+  static const size_t sizes[] = { 0, 1, 125, 126, 127, 65535, 65536, 200000 };
+  int i, mask;
+  for(i=0; i<sizeof(sizes)/sizeof(*sizes); i++) {
+    for(mask=0; mask<2; mask++) {
+      unsigned char *payload = malloc(sizes[i] + 1);
+      struct bchain *b;
+      struct frame f;
+      size_t expect_hlen = sizes[i] < 126 ? 2 : sizes[i] <= 0xffff ? 4 : 10;
+
+      fill(payload, sizes[i], mtev_false);
+      b = mtev_ws_frame_build(WS_BINARY, NULL, mask, payload, sizes[i]);
+      if(!b) {
+        FAIL("frame build of %zu failed", sizes[i]);
+      }
+      if(parse_frame((unsigned char *)b->buff + b->start, b->size, &f) != b->size) {
+        FAIL("frame of %zu has trailing bytes", sizes[i]);
+      }
+      if(!f.fin || f.rsv1 || f.opcode != WS_BINARY || f.masked != mask) {
+        FAIL("frame of %zu: bad flags fin=%d rsv1=%d op=%d masked=%d",
+             sizes[i], f.fin, f.rsv1, f.opcode, f.masked);
+      }
+      if(f.hlen != expect_hlen + (mask ? 4 : 0)) {
+        FAIL("frame of %zu: %zu byte header", sizes[i], f.hlen);
+      }
+      if(f.plen != sizes[i] || memcmp(f.payload, payload, sizes[i])) {
+        FAIL("frame of %zu: payload mismatch", sizes[i]);
+      }
+      free(f.payload);
+      bchain_free(b, __LINE__);
+      free(payload);
+    }
+  }
+}
+
+static void
+test_deflate(mtev_boolean no_context_takeover, int bits) {
+  mtev_ws_deflate_params_t params = {
+    .server_no_context_takeover = no_context_takeover,
+    .client_no_context_takeover = mtev_false,
+    .server_max_window_bits = bits,
+    .client_max_window_bits = 15
+  };
+  mtev_ws_deflate_t *server = mtev_ws_deflate_new(&params, mtev_true, -1);
+  mtev_ws_deflate_t *client = mtev_ws_deflate_new(&params, mtev_false, -1);
+  int i;
+
+  if(mtev_ws_deflate_stateless(server) != no_context_takeover) {
+    FAIL("stateless mismatch");
+  }
+  if(mtev_ws_deflate_window_bits(server) != (bits < 9 ? 9 : bits)) {
+    FAIL("window bits %d for %d", mtev_ws_deflate_window_bits(server), bits);
+  }
+  /* a run of messages through one pair exercises context takeover */
+  for(i=0; i<50; i++) {
+    size_t len = (i % 5 == 4) ? 100000 + i : 1 + rand() % 4096;
+    unsigned char *payload = malloc(len), *out = NULL;
+    size_t outlen = 0;
+    struct bchain *b;
+    struct frame f;
+
+    fill(payload, len, i % 3 != 0);
+    b = mtev_ws_frame_build(WS_TEXT, server, mtev_false, payload, len);
+    if(!b) {
+      FAIL("deflated frame build failed");
+    }
+    parse_frame((unsigned char *)b->buff + b->start, b->size, &f);
+    if(!f.rsv1 || f.opcode != WS_TEXT) {
+      FAIL("deflated frame: rsv1=%d op=%d", f.rsv1, f.opcode);
+    }
+    /* the 00 00 ff ff sync flush trailer is not sent */
+    if(f.plen >= 4 && !memcmp(f.payload + f.plen - 4, "\x00\x00\xff\xff", 4)) {
+      FAIL("deflated frame kept its sync trailer");
+    }
+    if(i % 3 != 0 && len > 1000 && f.plen >= len / 4) {
+      FAIL("compressible %zu bytes deflated to %zu", len, f.plen);
+    }
+    if(mtev_ws_deflate_inflate(client, f.payload, f.plen, &out, &outlen) != 0) {
+      FAIL("inflate of message %d failed", i);
+    }
+    if(outlen != len || memcmp(out, payload, len)) {
+      FAIL("deflate round trip mismatch on message %d (%zu != %zu)", i, outlen, len);
+    }
+    free(out);
+    free(f.payload);
+    bchain_free(b, __LINE__);
+    free(payload);
+  }
+  mtev_ws_deflate_free(server);
+  mtev_ws_deflate_free(client);
+}
+
+static void
+test_negotiate(void) {
+  mtev_ws_deflate_params_t limits = {
+    .server_no_context_takeover = mtev_true,
+    .client_no_context_takeover = mtev_false,
+    .server_max_window_bits = 15,
+    .client_max_window_bits = 15
+  };
+  mtev_ws_deflate_params_t agreed;
+  char buf[256];
+
+  if(mtev_ws_deflate_negotiate("x-webkit-deflate-frame", &limits, &agreed)) {
+    FAIL("negotiated a foreign extension");
+  }
+  if(mtev_ws_deflate_negotiate("permessage-deflate; server_max_window_bits=8",
+                               &limits, &agreed)) {
+    FAIL("negotiated an 8 bit server window");
+  }
+  if(mtev_ws_deflate_negotiate("permessage-deflate; bogus", &limits, &agreed)) {
+    FAIL("negotiated an unknown parameter");
+  }
+  if(!mtev_ws_deflate_negotiate("permessage-deflate; server_max_window_bits=8, "
+                                "permessage-deflate; server_max_window_bits=10; "
+                                "client_max_window_bits", &limits, &agreed)) {
+    FAIL("no acceptable offer found");
+  }
+  if(agreed.server_max_window_bits != 10 || !agreed.server_no_context_takeover ||
+     agreed.client_max_window_bits != 15) {
+    FAIL("agreed %d/%d/%d", agreed.server_max_window_bits,
+         agreed.server_no_context_takeover, agreed.client_max_window_bits);
+  }
+  mtev_ws_deflate_params_format(&agreed, buf, sizeof(buf));
+  if(strcmp(buf, "permessage-deflate; server_no_context_takeover; "
+                 "server_max_window_bits=10")) {
+    FAIL("formatted '%s'", buf);
+  }
+  if(!mtev_ws_deflate_parse_response(buf, &agreed) ||
+     agreed.server_max_window_bits != 10) {
+    FAIL("couldn't parse our own response '%s'", buf);
+  }
+}
+
+/* Push frames, raw appends and shared messages through a queue into a
+ * socket small enough to force partial writes; what comes out the other
+ * end must be everything, in order. */
+static void
+test_outq(void) {
+  mtev_ws_outq_t q = { NULL, NULL, 0 };
+  struct _event ev;
+  unsigned char *expect = NULL, *got = NULL;
+  size_t expect_len = 0, got_len = 0, allocd = 0;
+  int sv[2], sndbuf = 4096, i, mask = 0, rounds = 0;
+  mtev_http_websocket_msg_t *m;
+  struct bchain *shared_frame;
+  unsigned char shared_payload[3000];
+
+  if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+    FAIL("socketpair: %s", strerror(errno));
+  }
+  setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+  fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+  fcntl(sv[1], F_SETFL, fcntl(sv[1], F_GETFL) | O_NONBLOCK);
+  memset(&ev, 0, sizeof(ev));
+  ev.fd = sv[0];
+  ev.opset = eventer_POSIX_fd_opset;
+
+  fill(shared_payload, sizeof(shared_payload), mtev_false);
+  /* NULL without websocket support; the shared entries are skipped then */
+  m = mtev_http_websocket_msg_new(WS_BINARY, shared_payload,
+                                  sizeof(shared_payload));
+  shared_frame = mtev_ws_frame_build(WS_BINARY, NULL, mtev_false, shared_payload,
+                                     sizeof(shared_payload));
+
+#define EXPECT(p, l) do { \
+  expect = realloc(expect, expect_len + (l)); \
+  memcpy(expect + expect_len, (p), (l)); \
+  expect_len += (l); \
+} while(0)
+
+  for(i=0; i<200; i++) {
+    unsigned char payload[2000];
+    size_t len = rand() % sizeof(payload);
+    fill(payload, len, mtev_false);
+    if(i % 4 == 0) {
+      /* small control-sized writes coalesce into the tail buffer */
+      mtev_ws_outq_append(&q, payload, len % 64);
+      EXPECT(payload, len % 64);
+    }
+    else if(i % 4 == 1 && m) {
+      /* the queue borrows the frame and holds a reference on m instead */
+      mtev_ws_outq_push_shared(&q, shared_frame, m);
+      EXPECT(shared_frame->buff + shared_frame->start, shared_frame->size);
+    }
+    else {
+      struct bchain *b = mtev_ws_frame_build(WS_BINARY, NULL,
+                                             mtev_false, payload, len);
+      EXPECT(b->buff + b->start, b->size);
+      mtev_ws_outq_push(&q, b);
+    }
+  }
+  if(q.bytes != expect_len) {
+    FAIL("queue holds %zu bytes, expected %zu", q.bytes, expect_len);
+  }
+
+  while(1) {
+    ssize_t r;
+    int rv = mtev_ws_outq_flush(&q, &ev, &mask);
+    if(rv < 0 && errno != EAGAIN) {
+      FAIL("flush: %s", strerror(errno));
+    }
+    if(rv < 0) rounds++;
+    do {
+      if(allocd - got_len < 65536) {
+        allocd = allocd ? allocd * 2 : 65536;
+        got = realloc(got, allocd);
+      }
+      r = read(sv[1], got + got_len, allocd - got_len);
+      if(r > 0) got_len += r;
+    } while(r > 0);
+    if(rv == 0) break;
+  }
+  if(rounds == 0) {
+    FAIL("the socket never filled; partial writes weren't exercised");
+  }
+  if(q.head || q.tail || q.bytes) {
+    FAIL("queue not empty after a full flush");
+  }
+  if(got_len != expect_len || memcmp(got, expect, expect_len)) {
+    FAIL("wrote %zu bytes, expected %zu (or content differs)", got_len, expect_len);
+  }
+  /* the queue has dropped its references; ours is the last */
+  mtev_http_websocket_msg_release(m);
+  bchain_free(shared_frame, __LINE__);
+  mtev_ws_outq_clear(&q);
+  free(expect);
+  free(got);
+  close(sv[0]);
+  close(sv[1]);
+}
+
+int main(int argc, char **argv)
+{
+  srand(time(NULL));
+  test_frame_build();
+  test_deflate(mtev_true, 15);
+  test_deflate(mtev_true, 10);
+  test_deflate(mtev_false, 15);
+  test_deflate(mtev_false, 8);
+  test_negotiate();
+  test_outq();
+  printf("SUCCESS\n");
+  return 0;
+}